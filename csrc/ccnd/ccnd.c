@@ -21,6 +21,10 @@
  * Main program of ccnd - the CCNx Daemon
  */
 
+#if defined(HAVE_RECVMMSG) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     /* for recvmmsg and sendmmsg */
+#endif
+
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
@@ -35,10 +39,12 @@
 #include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 
@@ -47,6 +53,10 @@
     #include "dummyin6.h"
 #endif
 
+#if defined(HAVE_EPOLL)
+#include <sys/epoll.h>
+#endif
+
 #include <ccn/bloom.h>
 #include <ccn/ccn.h>
 #include <ccn/ccn_private.h>
@@ -55,6 +65,7 @@
 #include <ccn/face_mgmt.h>
 #include <ccn/hashtb.h>
 #include <ccn/indexbuf.h>
+#include <ccn/pool.h>
 #include <ccn/schedule.h>
 #include <ccn/reg_mgmt.h>
 #include <ccn/uri.h>
@@ -80,22 +91,44 @@ static struct face *record_connection(struct ccnd_handle *h,
                                       int setflags);
 static void process_input_message(struct ccnd_handle *h, struct face *face,
                                   unsigned char *msg, size_t size, int pdu_ok);
-static void process_input(struct ccnd_handle *h, int fd);
+static void process_input(struct ccnd_handle *h, struct face *face);
 static int ccn_stuff_interest(struct ccnd_handle *h,
                               struct face *face, struct ccn_charbuf *c);
-static void do_deferred_write(struct ccnd_handle *h, int fd);
+static void do_deferred_write(struct ccnd_handle *h, struct face *face);
+static void register_face_fd(struct ccnd_handle *h, struct face *face);
+static void dgram_sendq_destroy(struct ccnd_dgram_sendq **pq);
+static void face_outq_clear(struct face *face);
+static void content_unref_output(struct ccnd_handle *h,
+                                 struct content_entry *content);
+static int rx_unshare(struct ccnd_handle *h, struct ccn_charbuf **pbuf,
+                      size_t keep);
+static void unregister_face_fd(struct ccnd_handle *h, struct face *face);
+static int interest_probe(struct ccnd_handle *h, struct face *face,
+                          const unsigned char *msg, size_t size,
+                          const struct ccn_parsed_interest *pi,
+                          struct ccn_indexbuf *comps);
+static struct content_entry *probe_take(struct ccnd_probe *probe);
+static void probes_destroy(struct ccnd_handle *h);
+static void transit_hit(struct ccnd_handle *h, struct content_entry *content,
+                        int stale);
+static void transit_done(struct ccnd_handle *h, struct content_entry *content,
+                         int sent);
 static void clean_needed(struct ccnd_handle *h);
 static struct face *get_dgram_source(struct ccnd_handle *h, struct face *face,
                                      struct sockaddr *addr, socklen_t addrlen,
                                      int why);
-static void content_skiplist_insert(struct ccnd_handle *h,
-                                    struct content_entry *content);
-static void content_skiplist_remove(struct ccnd_handle *h,
-                                    struct content_entry *content);
+static void content_trie_insert(struct ccnd_handle *h,
+                                struct content_entry *content);
+static void content_trie_remove(struct ccnd_handle *h,
+                                struct content_entry *content);
+static struct content_entry *content_trie_after(struct ccnd_handle *h,
+                                                struct content_trie_node *node);
 static void mark_stale(struct ccnd_handle *h,
                        struct content_entry *content);
-static ccn_accession_t content_skiplist_next(struct ccnd_handle *h,
-                                             struct content_entry *content);
+static struct content_entry *content_next(struct ccnd_handle *h,
+                                          struct content_entry *content);
+static struct content_entry *content_from_accession(struct ccnd_handle *h,
+                                                    ccn_accession_t accession);
 static void reap_needed(struct ccnd_handle *h, int init_delay_usec);
 static void check_comm_file(struct ccnd_handle *h);
 static int nameprefix_seek(struct ccnd_handle *h,
@@ -109,18 +142,43 @@ static void update_forward_to(struct ccnd_handle *h,
 static void stuff_and_send(struct ccnd_handle *h, struct face *face,
                            const unsigned char *data1, size_t size1,
                            const unsigned char *data2, size_t size2,
+                           struct content_entry *content,
                            const char *tag, int lineno);
+static void ccnd_sendv(struct ccnd_handle *h, struct face *face,
+                       const struct iovec *iov, int iovcnt,
+                       struct content_entry *content);
 static void ccn_link_state_init(struct ccnd_handle *h, struct face *face);
+static int link_timer(struct ccn_schedule *sched,
+                      void *clienth,
+                      struct ccn_scheduled_event *ev,
+                      int flags);
+static int send_fragments(struct ccnd_handle *h, struct face *face,
+                          struct content_entry *content);
 static void ccn_append_link_stuff(struct ccnd_handle *h,
                                   struct face *face,
-                                  struct ccn_charbuf *c);
+                                  struct ccn_charbuf *c,
+                                  struct content_entry *content);
 static int process_incoming_link_message(struct ccnd_handle *h,
                                          struct face *face, enum ccn_dtag dtag,
                                          unsigned char *msg, size_t size);
 static void process_internal_client_buffer(struct ccnd_handle *h);
+static void packet_forward(struct ccnd_handle *h, int thread,
+                           struct ccnd_packet *p);
+static void packet_raw(struct ccnd_handle *h, struct face *face,
+                       unsigned char *buf, size_t size);
+static void face_io_close(struct ccnd_handle *h, struct face *face);
+static void face_io_drop(struct ccnd_handle *h, struct face *face);
+static void hand_over_faces(struct ccnd_handle *h);
+void ccnd_setsockopt_v6only(struct ccnd_handle *h, int fd);
+static void flush_stream_output(struct ccnd_handle *h);
+static void flush_dgram_output(struct ccnd_handle *h);
+static int face_wanted_events(struct face *face);
+static void dispatch_face_events(struct ccnd_handle *h, struct face *face,
+                                 int revents);
 static void
 pfi_destroy(struct ccnd_handle *h, struct interest_entry *ie,
             struct pit_face_item *p);
+static void pfi_free(struct ccnd_handle *h, struct pit_face_item *p);
 static struct pit_face_item *
 pfi_set_nonce(struct ccnd_handle *h, struct interest_entry *ie,
              struct pit_face_item *p,
@@ -149,6 +207,11 @@ pfi_seek(struct ccnd_handle *h, struct interest_entry *ie,
 static void strategy_callout(struct ccnd_handle *h,
                              struct interest_entry *ie,
                              enum ccn_strategy_op op);
+static const struct ccn_strategy_class *
+strategy_class_from_flags(unsigned flags);
+static void note_upstream_rtt(struct ccnd_handle *h,
+                              struct interest_entry *ie, unsigned faceid);
+static unsigned ccnd_usec_clock(struct ccnd_handle *h);
 
 /**
  * Frequency of wrapped timer
@@ -176,6 +239,11 @@ cleanup_at_exit(void)
     }
 }
 
+/** Set by a signal asking us to stop, for the main loop to notice */
+static volatile sig_atomic_t stop_signal = 0;
+/** Written by the same signals, so that a wait in the main loop ends */
+static int stop_pipe[2] = {-1, -1};
+
 static void
 handle_fatal_signal(int sig)
 {
@@ -183,6 +251,26 @@ handle_fatal_signal(int sig)
     _exit(sig);
 }
 
+/**
+ * Ask the main loop to stop, so that it can finish up (for instance,
+ * by saving a snapshot of the content store).
+ *
+ * A second signal stops us at once.
+ */
+static void
+handle_stop_signal(int sig)
+{
+    int save_errno = errno;
+    
+    if (stop_signal != 0)
+        handle_fatal_signal(sig);
+    stop_signal = sig;
+    if (stop_pipe[1] != -1 && write(stop_pipe[1], "", 1) == -1) {
+        /* The pipe is full, so the main loop will wake up anyway */
+    }
+    errno = save_errno;
+}
+
 /**
  * Record the name of the unix-domain listener
  *
@@ -195,9 +283,15 @@ unlink_at_exit(const char *path)
         static char namstor[sizeof(struct sockaddr_un)];
         strncpy(namstor, path, sizeof(namstor));
         unlink_this_at_exit = namstor;
-        signal(SIGTERM, &handle_fatal_signal);
-        signal(SIGINT, &handle_fatal_signal);
-        signal(SIGHUP, &handle_fatal_signal);
+        if (pipe(stop_pipe) == 0) {
+            fcntl(stop_pipe[0], F_SETFL, O_NONBLOCK);
+            fcntl(stop_pipe[1], F_SETFL, O_NONBLOCK);
+            fcntl(stop_pipe[0], F_SETFD, FD_CLOEXEC);
+            fcntl(stop_pipe[1], F_SETFD, FD_CLOEXEC);
+        }
+        signal(SIGTERM, &handle_stop_signal);
+        signal(SIGINT, &handle_stop_signal);
+        signal(SIGHUP, &handle_stop_signal);
         atexit(&cleanup_at_exit);
     }
 }
@@ -299,6 +393,20 @@ ccnd_face_from_faceid(struct ccnd_handle *h, unsigned faceid)
     return(face_from_faceid(h, faceid));
 }
 
+/**
+ * Creates the traffic meters of a face.
+ */
+static void
+face_meters_create(struct ccnd_handle *h, struct face *face)
+{
+    face->meter[FM_BYTI] = ccnd_meter_create(h, "bytein");
+    face->meter[FM_BYTO] = ccnd_meter_create(h, "byteout");
+    face->meter[FM_INTI] = ccnd_meter_create(h, "intrin");
+    face->meter[FM_INTO] = ccnd_meter_create(h, "introut");
+    face->meter[FM_DATI] = ccnd_meter_create(h, "datain");
+    face->meter[FM_DATO] = ccnd_meter_create(h, "dataout");
+}
+
 /**
  * Assigns the faceid for a nacent face,
  * calls register_new_face() if successful.
@@ -332,13 +440,11 @@ use_i:
     a[i] = face;
     h->face_rover = i + 1;
     face->faceid = i | h->face_gen;
-    face->meter[FM_BYTI] = ccnd_meter_create(h, "bytein");
-    face->meter[FM_BYTO] = ccnd_meter_create(h, "byteout");
-    face->meter[FM_INTI] = ccnd_meter_create(h, "intrin");
-    face->meter[FM_INTO] = ccnd_meter_create(h, "introut");
-    face->meter[FM_DATI] = ccnd_meter_create(h, "datain");
-    face->meter[FM_DATO] = ccnd_meter_create(h, "dataout");
+    h->faces_changed++;
+    face_meters_create(h, face);
     register_new_face(h, face);
+    if (h->workers != NULL)
+        ccn_indexbuf_append_element(h->handover, face->faceid);
     return (face->faceid);
 }
 
@@ -378,8 +484,9 @@ content_queue_create(struct ccnd_handle *h, struct face *face, enum cq_delay_cla
         q->min_usec = usec;
         q->rand_usec = 2 * usec;
         q->nrun = 0;
-        q->send_queue = ccn_indexbuf_create();
-        if (q->send_queue == NULL) {
+        q->ring_size = 8;
+        q->ring = calloc(q->ring_size, sizeof(q->ring[0]));
+        if (q->ring == NULL) {
             free(q);
             return(NULL);
         }
@@ -397,7 +504,7 @@ content_queue_destroy(struct ccnd_handle *h, struct content_queue **pq)
     struct content_queue *q;
     if (*pq != NULL) {
         q = *pq;
-        ccn_indexbuf_destroy(&q->send_queue);
+        free(q->ring);
         if (q->sender != NULL) {
             ccn_schedule_cancel(h->sched, q->sender);
             q->sender = NULL;
@@ -407,6 +514,136 @@ content_queue_destroy(struct ccnd_handle *h, struct content_queue **pq)
     }
 }
 
+/**
+ * Where a ContentObject is waiting in one of a face's content queues
+ */
+struct queued_content {
+    unsigned seq;               /**< entry number in the queue */
+    enum cq_delay_class c;      /**< which queue */
+};
+
+/**
+ * Find which content queue of the face, if any, holds an accession.
+ */
+static struct queued_content *
+face_queued_lookup(struct face *face, ccn_accession_t accession)
+{
+    if (face->queued == NULL)
+        return(NULL);
+    return(hashtb_lookup(face->queued, &accession, sizeof(accession)));
+}
+
+/**
+ * Forget that an accession is in a content queue of the face.
+ */
+static void
+face_queued_remove(struct face *face, ccn_accession_t accession)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    
+    if (face->queued == NULL)
+        return;
+    hashtb_start(face->queued, e);
+    if (hashtb_seek(e, &accession, sizeof(accession), 0) >= 0)
+        hashtb_delete(e);
+    hashtb_end(e);
+}
+
+/**
+ * Add an accession at the end of content queue q (which is face->q[c]).
+ *
+ * The caller makes sure it is not already queued on the face.
+ * @returns its position in the queue, or -1 for error.
+ */
+static int
+content_queue_append(struct face *face, struct content_queue *q,
+                     enum cq_delay_class c, ccn_accession_t accession)
+{
+    struct hashtb_param param = {0};
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct queued_content *qc;
+    ccn_accession_t *ring;
+    unsigned size;
+    unsigned seq;
+    unsigned i;
+    int res;
+    
+    if (q->n == q->ring_size) {
+        size = 2 * q->ring_size;
+        ring = calloc(size, sizeof(ring[0]));
+        if (ring == NULL)
+            return(-1);
+        for (i = 0; i < q->n; i++) {
+            seq = q->head + i;
+            ring[seq & (size - 1)] = q->ring[seq & (q->ring_size - 1)];
+        }
+        free(q->ring);
+        q->ring = ring;
+        q->ring_size = size;
+    }
+    if (face->queued == NULL) {
+        param.flags = HASHTB_OPEN;
+        face->queued = hashtb_create(sizeof(struct queued_content), &param);
+        if (face->queued == NULL)
+            return(-1);
+    }
+    hashtb_start(face->queued, e);
+    res = hashtb_seek(e, &accession, sizeof(accession), 0);
+    qc = e->data;
+    if (res >= 0) {
+        seq = q->head + q->n++;
+        q->ring[seq & (q->ring_size - 1)] = accession;
+        qc->seq = seq;
+        qc->c = c;
+        res = q->n - 1;
+    }
+    hashtb_end(e);
+    return(res);
+}
+
+/**
+ * Take the first entry off a content queue of the face.
+ *
+ * @returns the content, or NULL if it was withdrawn or has left the store.
+ */
+static struct content_entry *
+content_queue_shift(struct ccnd_handle *h, struct face *face,
+                    struct content_queue *q)
+{
+    ccn_accession_t accession;
+    
+    if (q->n == 0)
+        return(NULL);
+    accession = q->ring[q->head++ & (q->ring_size - 1)];
+    q->n--;
+    if (accession == 0)
+        return(NULL);
+    face_queued_remove(face, accession);
+    return(content_from_accession(h, accession));
+}
+
+/**
+ * Withdraw an accession from whichever content queue of the face holds it.
+ *
+ * @returns 0 if it was queued, -1 if not.
+ */
+static int
+content_queue_withdraw(struct face *face, ccn_accession_t accession)
+{
+    struct queued_content *qc;
+    struct content_queue *q;
+    
+    qc = face_queued_lookup(face, accession);
+    if (qc == NULL)
+        return(-1);
+    q = face->q[qc->c];
+    q->ring[qc->seq & (q->ring_size - 1)] = 0;
+    face_queued_remove(face, accession);
+    return(0);
+}
+
 /**
  * Close an open file descriptor quietly.
  */
@@ -625,10 +862,12 @@ finalize_face(struct hashtb_enumerator *e)
     int m;
     
     if (i < h->face_limit && h->faces_by_faceid[i] == face) {
-        if ((face->flags & CCN_FACE_UNDECIDED) == 0)
+        if ((face->flags & CCN_FACE_UNDECIDED) == 0 && h->worker == NULL)
             ccnd_face_status_change(h, face->faceid);
-        if (e->ht == h->faces_by_fd)
+        if (e->ht == h->faces_by_fd) {
+            unregister_face_fd(h, face);
             ccnd_close_fd(h, face->faceid, &face->recv_fd);
+        }
         if ((face->guid) != NULL)
             ccnd_forget_face_guid(h, face);
         ccn_charbuf_destroy(&face->guid_cob);
@@ -641,15 +880,40 @@ finalize_face(struct hashtb_enumerator *e)
         }
         for (c = 0; c < CCN_CQ_N; c++)
             content_queue_destroy(h, &(face->q[c]));
-        ccnd_msg(h, "%s face id %u (slot %u)",
-            recycle ? "recycling" : "releasing",
-            face->faceid, face->faceid & MAXFACES);
+        if (h->worker == NULL)
+            ccnd_msg(h, "%s face id %u (slot %u)",
+                recycle ? "recycling" : "releasing",
+                face->faceid, face->faceid & MAXFACES);
         /* Don't free face->addr; storage is managed by hash table */
     }
     else if (face->faceid != CCN_NOFACEID)
         ccnd_msg(h, "orphaned face %u", face->faceid);
     for (m = 0; m < CCND_FACE_METER_N; m++)
         ccnd_meter_destroy(&face->meter[m]);
+    hashtb_destroy(&face->queued);
+    face_outq_clear(face);
+    dgram_sendq_destroy(&face->sendq);
+    free(face->link);
+    face->link = NULL;
+    if (face->frags != NULL) {
+        for (m = 0; m < CCND_FRAG_SETS; m++)
+            ccn_charbuf_destroy(&face->frags[m].buf);
+        free(face->frags);
+        face->frags = NULL;
+    }
+    if (h->worker != NULL) {
+        /* What a face handed over brought with it; see packet_adopt() */
+        if ((face->flags & CCN_FACE_DGRAM) != 0 && face->recv_fd != -1)
+            close(face->recv_fd);
+        face->recv_fd = -1;
+        free((void *)face->addr);
+        face->addr = NULL;
+        if (face->inbuf != NULL && face->inbuf == h->rx_buf)
+            rx_unshare(h, &face->inbuf, face->inbuf->length);
+        ccn_charbuf_destroy(&face->inbuf);
+    }
+    free(face->report);
+    face->report = NULL;
 }
 
 /**
@@ -780,4120 +1044,7200 @@ enroll_content(struct ccnd_handle *h, struct content_entry *content)
     h->content_by_accession[content->accession - h->accession_base] = content;
 }
 
-// the hash table this is for is going away
-static void
-finalize_content(struct hashtb_enumerator *content_enumerator)
-{
-    struct ccnd_handle *h = hashtb_get_param(content_enumerator->ht, NULL);
-    struct content_entry *entry = content_enumerator->data;
-    unsigned i = entry->accession - h->accession_base;
-    if (i < h->content_by_accession_window &&
-          h->content_by_accession[i] == entry) {
-        content_skiplist_remove(h, entry);
-        h->content_by_accession[i] = NULL;
-    }
-    else {
-        struct hashtb_enumerator ee;
-        struct hashtb_enumerator *e = &ee;
-        hashtb_start(h->sparse_straggler_tab, e);
-        if (hashtb_seek(e, &entry->accession, sizeof(entry->accession), 0) ==
-              HT_NEW_ENTRY) {
-            ccnd_msg(h, "orphaned content %llu",
-                     (unsigned long long)(entry->accession));
-            hashtb_delete(e);
-            hashtb_end(e);
-            return;
-        }
-        content_skiplist_remove(h, entry);
-        hashtb_delete(e);
-        hashtb_end(e);
-    }
-    if (entry->comps != NULL) {
-        free(entry->comps);
-        entry->comps = NULL;
-    }
-}
-
 /**
- * Find the skiplist entries associated with the key.
+ * Get the digest of content, computing it if this has not been done yet.
  *
- * @returns the number of entries of ans that were filled in.
+ * The digest is the implicit last name component.  Most interests do not
+ * name it, so it is computed only on demand.
  */
-static int
-content_skiplist_findbefore(struct ccnd_handle *h,
-                            const unsigned char *key,
-                            size_t keysize,
-                            struct content_entry *wanted_old,
-                            struct ccn_indexbuf **ans)
+static const unsigned char *
+content_digest(struct ccnd_handle *h, struct content_entry *content)
 {
-    int i;
-    int n = h->skiplinks->n;
-    struct ccn_indexbuf *c;
-    struct content_entry *content;
-    int order;
-    size_t start;
-    size_t end;
+    struct ccn_parsed_ContentObject pc;
+    int res;
     
-    c = h->skiplinks;
-    for (i = n - 1; i >= 0; i--) {
-        for (;;) {
-            if (c->buf[i] == 0)
-                break;
-            content = content_from_accession(h, c->buf[i]);
-            if (content == NULL)
-                abort();
-            start = content->comps[0];
-            end = content->comps[content->ncomps - 1];
-            order = ccn_compare_names(content->key + start - 1, end - start + 2,
-                                      key, keysize);
-            if (order > 0)
-                break;
-            if (order == 0 && (wanted_old == content || wanted_old == NULL))
-                break;
-            if (content->skiplinks == NULL || i >= content->skiplinks->n)
-                abort();
-            c = content->skiplinks;
-        }
-        ans[i] = c;
+    if ((content->flags & CCN_CONTENT_ENTRY_DIGEST) == 0) {
+        res = ccn_parse_ContentObject(content->key, content->size, &pc, NULL);
+        if (res < 0) abort(); /* it parsed when it arrived */
+        ccn_digest_ContentObject(content->key, &pc);
+        memcpy(content->digest, pc.digest, sizeof(content->digest));
+        content->flags |= CCN_CONTENT_ENTRY_DIGEST;
+        h->content_digests++;
     }
-    return(n);
+    return(content->digest);
 }
 
 /**
- * Limit for how deep our skiplists can be
+ * Keep the digest of content if ccn_content_matches_interest() or a
+ * similar library routine had to compute it into pc.
  */
-#define CCN_SKIPLIST_MAX_DEPTH 30
+static void
+content_note_digest(struct ccnd_handle *h, struct content_entry *content,
+                    const struct ccn_parsed_ContentObject *pc)
+{
+    if ((content->flags & CCN_CONTENT_ENTRY_DIGEST) != 0 ||
+        pc->digest_bytes != sizeof(content->digest))
+        return;
+    memcpy(content->digest, pc->digest, sizeof(content->digest));
+    content->flags |= CCN_CONTENT_ENTRY_DIGEST;
+    h->content_digests++;
+}
 
 /**
- * Insert a new entry into the skiplist.
+ * Append the implicit digest name component of content to c.
  */
 static void
-content_skiplist_insert(struct ccnd_handle *h, struct content_entry *content)
+content_append_digest_comp(struct ccnd_handle *h, struct ccn_charbuf *c,
+                           struct content_entry *content)
 {
-    int d;
-    int i;
-    size_t start;
-    size_t end;
-    struct ccn_indexbuf *pred[CCN_SKIPLIST_MAX_DEPTH] = {NULL};
-    if (content->skiplinks != NULL) abort();
-    for (d = 1; d < CCN_SKIPLIST_MAX_DEPTH - 1; d++)
-        if ((nrand48(h->seed) & 3) != 0) break;
-    while (h->skiplinks->n < d)
-        ccn_indexbuf_append_element(h->skiplinks, 0);
-    start = content->comps[0];
-    end = content->comps[content->ncomps - 1];
-    i = content_skiplist_findbefore(h,
-                                    content->key + start - 1,
-                                    end - start + 2, NULL, pred);
-    if (i < d)
-        d = i; /* just in case */
-    content->skiplinks = ccn_indexbuf_create();
-    for (i = 0; i < d; i++) {
-        ccn_indexbuf_append_element(content->skiplinks, pred[i]->buf[i]);
-        pred[i]->buf[i] = content->accession;
-    }
+    ccn_charbuf_append_tt(c, CCN_DTAG_Component, CCN_DTAG);
+    ccn_charbuf_append_tt(c, sizeof(content->digest), CCN_BLOB);
+    ccn_charbuf_append(c, content_digest(h, content), sizeof(content->digest));
+    ccn_charbuf_append_closer(c);
 }
 
 /**
- * Remove an entry from the skiplist.
+ * Check whether the Component element in buf[start..end) is the
+ * implicit digest name component of content.
  */
-static void
-content_skiplist_remove(struct ccnd_handle *h, struct content_entry *content)
+static int
+content_digest_comp_matches(struct ccnd_handle *h,
+                            struct content_entry *content,
+                            const unsigned char *buf, size_t start, size_t end)
 {
-    int i;
-    int d;
-    size_t start;
-    size_t end;
-    struct ccn_indexbuf *pred[CCN_SKIPLIST_MAX_DEPTH] = {NULL};
-    if (content->skiplinks == NULL) abort();
-    start = content->comps[0];
-    end = content->comps[content->ncomps - 1];
-    d = content_skiplist_findbefore(h,
-                                    content->key + start - 1,
-                                    end - start + 2, content, pred);
-    if (d > content->skiplinks->n)
-        d = content->skiplinks->n;
-    for (i = 0; i < d; i++) {
-        pred[i]->buf[i] = content->skiplinks->buf[i];
-    }
-    ccn_indexbuf_destroy(&content->skiplinks);
+    const unsigned char *val = NULL;
+    size_t size = 0;
+    
+    if (ccn_ref_tagged_BLOB(CCN_DTAG_Component, buf, start, end,
+                            &val, &size) < 0)
+        return(0);
+    if (size != sizeof(content->digest))
+        return(0);
+    return(0 == memcmp(val, content_digest(h, content), size));
 }
 
 /**
- * Find the first candidate that might match the given interest.
+ * Parse a stored ContentObject, filling in the digest if we have it.
+ *
+ * The result is suitable for ccn_content_matches_interest() with
+ * implicit_content_digest set.
  */
-static struct content_entry *
-find_first_match_candidate(struct ccnd_handle *h,
-                           const unsigned char *interest_msg,
-                           const struct ccn_parsed_interest *pi)
+static int
+content_parse(struct content_entry *content,
+              struct ccn_parsed_ContentObject *pc)
 {
     int res;
-    struct ccn_indexbuf *pred[CCN_SKIPLIST_MAX_DEPTH] = {NULL};
-    size_t start = pi->offset[CCN_PI_B_Name];
-    size_t end = pi->offset[CCN_PI_E_Name];
-    struct ccn_charbuf *namebuf = NULL;
-    if (pi->offset[CCN_PI_B_Exclude] < pi->offset[CCN_PI_E_Exclude]) {
-        /* Check for <Exclude><Any/><Component>... fast case */
-        struct ccn_buf_decoder decoder;
-        struct ccn_buf_decoder *d;
-        size_t ex1start;
-        size_t ex1end;
-        d = ccn_buf_decoder_start(&decoder,
-                                  interest_msg + pi->offset[CCN_PI_B_Exclude],
-                                  pi->offset[CCN_PI_E_Exclude] -
-                                  pi->offset[CCN_PI_B_Exclude]);
-        ccn_buf_advance(d);
-        if (ccn_buf_match_dtag(d, CCN_DTAG_Any)) {
-            ccn_buf_advance(d);
-            ccn_buf_check_close(d);
-            if (ccn_buf_match_dtag(d, CCN_DTAG_Component)) {
-                ex1start = pi->offset[CCN_PI_B_Exclude] + d->decoder.token_index;
-                ccn_buf_advance_past_element(d);
-                ex1end = pi->offset[CCN_PI_B_Exclude] + d->decoder.token_index;
-                if (d->decoder.state >= 0) {
-                    namebuf = ccn_charbuf_create();
-                    ccn_charbuf_append(namebuf,
-                                       interest_msg + start,
-                                       end - start);
-                    namebuf->length--;
-                    ccn_charbuf_append(namebuf,
-                                       interest_msg + ex1start,
-                                       ex1end - ex1start);
-                    ccn_charbuf_append_closer(namebuf);
-                    if (h->debug & 8)
-                        ccnd_debug_ccnb(h, __LINE__, "fastex", NULL,
-                                        namebuf->buf, namebuf->length);
-                }
-            }
-        }
-    }
-    if (namebuf == NULL) {
-        res = content_skiplist_findbefore(h, interest_msg + start, end - start,
-                                          NULL, pred);
-    }
-    else {
-        res = content_skiplist_findbefore(h, namebuf->buf, namebuf->length,
-                                          NULL, pred);
-        ccn_charbuf_destroy(&namebuf);
+    
+    res = ccn_parse_ContentObject(content->key, content->size, pc, NULL);
+    if (res < 0)
+        return(res);
+    if ((content->flags & CCN_CONTENT_ENTRY_DIGEST) != 0) {
+        memcpy(pc->digest, content->digest, sizeof(pc->digest));
+        pc->digest_bytes = sizeof(pc->digest);
     }
-    if (res == 0)
-        return(NULL);
-    return(content_from_accession(h, pred[0]->buf[0]));
+    return(res);
 }
 
 /**
- * Check for a prefix match.
+ * Test for a match between stored content and an interest.
+ *
+ * excl, if not NULL, is the compiled Exclude of the interest.
  */
 static int
-content_matches_interest_prefix(struct ccnd_handle *h,
-                                struct content_entry *content,
-                                const unsigned char *interest_msg,
-                                struct ccn_indexbuf *comps,
-                                int prefix_comps)
+content_matches_interest(struct ccnd_handle *h,
+                         struct content_entry *content,
+                         const unsigned char *msg, size_t size,
+                         const struct ccn_parsed_interest *pi,
+                         const struct ccn_exclude *excl)
 {
-    size_t prefixlen;
-    if (prefix_comps < 0 || prefix_comps >= comps->n)
-        abort();
-    /* First verify the prefix match. */
-    if (content->ncomps < prefix_comps + 1)
-            return(0);
-    prefixlen = comps->buf[prefix_comps] - comps->buf[0];
-    if (content->comps[prefix_comps] - content->comps[0] != prefixlen)
-        return(0);
-    if (0 != memcmp(content->key + content->comps[0],
-                    interest_msg + comps->buf[0],
-                    prefixlen))
+    struct ccn_parsed_ContentObject pc;
+    int res;
+    
+    if (content_parse(content, &pc) < 0)
         return(0);
-    return(1);
+    res = ccn_content_matches_interest_excl(content->key, content->size, 1,
+                                            &pc, msg, size, pi, excl);
+    content_note_digest(h, content, &pc);
+    return(res);
 }
 
 /**
- * Advance to the next entry in the skiplist.
+ * Number of bytes charged against CCND_CS_BYTES for a content entry.
  */
-static ccn_accession_t
-content_skiplist_next(struct ccnd_handle *h, struct content_entry *content)
+static unsigned long
+content_footprint(struct content_entry *content)
 {
-    if (content == NULL)
-        return(0);
-    if (content->skiplinks == NULL || content->skiplinks->n < 1)
-        return(0);
-    return(content->skiplinks->buf[0]);
+    return(sizeof(*content) + content->size +
+           content->ncomps * sizeof(content->comps[0]));
 }
 
 /**
- * Consume an interest.
+ * Take content off the replacement list, if it is there.
  */
 static void
-consume_interest(struct ccnd_handle *h, struct interest_entry *ie)
+content_lru_unlink(struct ccnd_handle *h, struct content_entry *content)
 {
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
-    int res;
-    
-    hashtb_start(h->interest_tab, e);
-    res = hashtb_seek(e, ie->interest_msg, ie->size - 1, 1);
-    if (res != HT_OLD_ENTRY)
-        abort();
-    hashtb_delete(e);
-    hashtb_end(e);
-}    
+    if (content->lru_prev == NULL && h->lru_oldest != content)
+        return;
+    if (content->lru_prev != NULL)
+        content->lru_prev->lru_next = content->lru_next;
+    else
+        h->lru_oldest = content->lru_next;
+    if (content->lru_next != NULL)
+        content->lru_next->lru_prev = content->lru_prev;
+    else
+        h->lru_newest = content->lru_prev;
+    content->lru_prev = content->lru_next = NULL;
+}
 
 /**
- * Clean up a name prefix entry when it is removed from the hash table.
+ * Put content on the replacement list.
+ *
+ * If cold is nonzero, the content goes at the end that is evicted first;
+ * otherwise it becomes the most recently used.  Precious content is
+ * never put on the list, so it is never evicted.
  */
 static void
-finalize_nameprefix(struct hashtb_enumerator *e)
+content_lru_insert(struct ccnd_handle *h, struct content_entry *content, int cold)
 {
-    struct ccnd_handle *h = hashtb_get_param(e->ht, NULL);
-    struct nameprefix_entry *npe = e->data;
-    struct ielinks *head = &npe->ie_head;
-    if (head->next != NULL) {
-        while (head->next != head)
-            consume_interest(h, (struct interest_entry *)(head->next));
+    if ((content->flags & CCN_CONTENT_ENTRY_TRANSIT) != 0)
+        return;
+    content_lru_unlink(h, content);
+    if ((content->flags & CCN_CONTENT_ENTRY_PRECIOUS) != 0)
+        return;
+    if (cold) {
+        content->lru_next = h->lru_oldest;
+        if (h->lru_oldest != NULL)
+            h->lru_oldest->lru_prev = content;
+        else
+            h->lru_newest = content;
+        h->lru_oldest = content;
     }
-    ccn_indexbuf_destroy(&npe->forward_to);
-    ccn_indexbuf_destroy(&npe->tap);
-    while (npe->forwarding != NULL) {
-        struct ccn_forwarding *f = npe->forwarding;
-        npe->forwarding = f->next;
-        free(f);
+    else {
+        content->lru_prev = h->lru_newest;
+        if (h->lru_newest != NULL)
+            h->lru_newest->lru_next = content;
+        else
+            h->lru_oldest = content;
+        h->lru_newest = content;
     }
 }
 
 /**
- * Link an interest to its name prefix entry.
+ * Check whether the content store is over its object count or byte budget.
+ *
+ * A nonzero slack allows an extra eighth of each limit, so that cleaning
+ * is not started for every new arrival.  With CCND_WORKERS, the limits
+ * are for the stores of all the threads together.
  */
-static void
-link_interest_entry_to_nameprefix(struct ccnd_handle *h,
-    struct interest_entry *ie, struct nameprefix_entry *npe)
+static int
+content_store_over_limit(struct ccnd_handle *h, int slack)
 {
-    struct ielinks *head = &npe->ie_head;
-    struct ielinks *ll = &ie->ll;
-    ll->next = head;
-    ll->prev = head->prev;
-    ll->prev->next = ll->next->prev = ll;
-    ll->npe = npe;
+    unsigned long n = hashtb_n(h->content_tab);
+    
+    if (h->worker != NULL || h->workers != NULL)
+        return(ccnd_workers_cs_over_limit(h, slack));
+    if (n > h->capacity &&
+        n - h->capacity > (slack ? (h->capacity >> 3) : 0))
+        return(1);
+    if (h->cs_bytes > h->cs_bytes_limit &&
+        h->cs_bytes - h->cs_bytes_limit > (slack ? (h->cs_bytes_limit >> 3) : 0))
+        return(1);
+    return(0);
 }
 
 /**
- * Clean up an interest_entry when it is removed from its hash table.
+ * Take content out of the accession-to-content tables.
+ *
+ * @returns 0, or -1 if it was not there.
  */
-static void
-finalize_interest(struct hashtb_enumerator *e)
+static int
+content_accession_remove(struct ccnd_handle *h, struct content_entry *entry)
 {
-    struct pit_face_item *p = NULL;
-    struct pit_face_item *next = NULL;
-    struct ccnd_handle *h = hashtb_get_param(e->ht, NULL);
-    struct interest_entry *ie = e->data;
-    struct face *face = NULL;
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    unsigned i = entry->accession - h->accession_base;
+    int res;
+    
+    if (i < h->content_by_accession_window &&
+          h->content_by_accession[i] == entry) {
+        h->content_by_accession[i] = NULL;
+        return(0);
+    }
+    hashtb_start(h->sparse_straggler_tab, e);
+    res = hashtb_seek(e, &entry->accession, sizeof(entry->accession), 0);
+    hashtb_delete(e);
+    hashtb_end(e);
+    return((res == HT_NEW_ENTRY) ? -1 : 0);
+}
 
-    if (ie->ev != NULL)
-        ccn_schedule_cancel(h->sched, ie->ev);
-    if (ie->strategy.ev != NULL)
-        ccn_schedule_cancel(h->sched, ie->strategy.ev);
-    if (ie->ll.next != NULL) {
-        ie->ll.next->prev = ie->ll.prev;
-        ie->ll.prev->next = ie->ll.next;
-        ie->ll.next = ie->ll.prev = NULL;
-        ie->ll.npe = NULL;
+// the hash table this is for is going away
+static void
+finalize_content(struct hashtb_enumerator *content_enumerator)
+{
+    struct ccnd_handle *h = hashtb_get_param(content_enumerator->ht, NULL);
+    struct content_entry *entry = content_enumerator->data;
+    if (entry->sendrefs != 0)
+        content_unref_output(h, entry);
+    content_lru_unlink(h, entry);
+    if (entry->comps != NULL) {
+        h->cs_bytes -= content_footprint(entry);
+        if (h->worker != NULL || h->workers != NULL)
+            ccnd_workers_cs_note(h, -1, -(long)content_footprint(entry));
+    }
+    if ((entry->flags & CCN_CONTENT_ENTRY_DIGEST) == 0)
+        h->content_digests_avoided++;
+    if (content_accession_remove(h, entry) < 0) {
+        ccnd_msg(h, "orphaned content %llu",
+                 (unsigned long long)(entry->accession));
+        return;
     }
-    for (p = ie->pfl; p != NULL; p = next) {
-        next = p->next;
-        if ((p->pfi_flags & CCND_PFI_PENDING) != 0) {
-            face = face_from_faceid(h, p->faceid);
-            if (face != NULL)
-                face->pending_interests -= 1;
-        }
-        free(p);
+    content_trie_remove(h, entry);
+    if (entry->comps != NULL) {
+        free(entry->comps);
+        entry->comps = NULL;
     }
-    ie->pfl = NULL;
-    ie->interest_msg = NULL; /* part of hashtb, don't free this */
 }
 
 /**
- * Clean up a guest_entry when it is removed from its hash table.
+ * A name component value, as used for searching content_trie.
  */
-static void
-finalize_guest(struct hashtb_enumerator *e)
+struct trie_comp {
+    const unsigned char *val;
+    size_t size;
+};
+
+#define TRIE_LABEL(node, k) ((node)->lval + (node)->loff[k])
+#define TRIE_LABEL_SIZE(node, k) ((node)->loff[(k) + 1] - (node)->loff[k])
+
+/**
+ * Compare component values in the order used by ccn_compare_names().
+ */
+static int
+trie_comp_compare(const unsigned char *a, size_t asize,
+                  const unsigned char *b, size_t bsize)
 {
-    struct guest_entry *g = e->data;
-    ccn_charbuf_destroy(&g->cob);
+    if (asize != bsize)
+        return(asize < bsize ? -1 : 1);
+    return(memcmp(a, b, asize));
 }
 
 /**
- * Create a listener on a unix-domain socket.
+ * Append the value of the Component element at msg[start..end) to cb,
+ * as a struct trie_comp.
  */
 static int
-create_local_listener(struct ccnd_handle *h, const char *sockname, int backlog)
+trie_comp_append(struct ccn_charbuf *cb, const unsigned char *msg,
+                 size_t start, size_t end)
 {
+    struct trie_comp tc;
     int res;
-    int savedmask;
-    int sock;
-    struct sockaddr_un a = { 0 };
-    res = unlink(sockname);
-    if (res == 0) {
-        ccnd_msg(NULL, "unlinked old %s, please wait", sockname);
-        sleep(9); /* give old ccnd a chance to exit */
-    }
-    if (!(res == 0 || errno == ENOENT))
-        ccnd_msg(NULL, "failed to unlink %s", sockname);
-    a.sun_family = AF_UNIX;
-    strncpy(a.sun_path, sockname, sizeof(a.sun_path));
-    sock = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (sock == -1)
-        return(sock);
-    savedmask = umask(0111); /* socket should be R/W by anybody */
-    res = bind(sock, (struct sockaddr *)&a, sizeof(a));
-    umask(savedmask);
-    if (res == -1) {
-        close(sock);
-        return(-1);
-    }
-    unlink_at_exit(sockname);
-    res = listen(sock, backlog);
-    if (res == -1) {
-        close(sock);
-        return(-1);
-    }
-    record_connection(h, sock, (struct sockaddr *)&a, sizeof(a),
-                      (CCN_FACE_LOCAL | CCN_FACE_PASSIVE));
-    return(sock);
+    
+    tc.val = msg + start;
+    tc.size = 0;
+    res = ccn_ref_tagged_BLOB(CCN_DTAG_Component, msg, start, end,
+                              &tc.val, &tc.size);
+    if (res < 0)
+        return(res);
+    return(ccn_charbuf_append(cb, &tc, sizeof(tc)));
 }
 
 /**
- * Adjust socket buffer limit
+ * Fill cb with the name components of a content entry.
+ *
+ * @returns the number of components.
  */
 static int
-establish_min_recv_bufsize(struct ccnd_handle *h, int fd, int minsize)
+trie_comps_from_content(struct ccn_charbuf *cb, struct content_entry *content)
 {
-    int res;
-    int rcvbuf;
-    socklen_t rcvbuf_sz;
-
-    rcvbuf_sz = sizeof(rcvbuf);
-    res = getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &rcvbuf_sz);
-    if (res == -1)
-        return (res);
-    if (rcvbuf < minsize) {
-        rcvbuf = minsize;
-        res = setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
-        if (res == -1)
-            return(res);
+    int i;
+    
+    cb->length = 0;
+    for (i = 0; i + 1 < content->ncomps; i++) {
+        if (trie_comp_append(cb, content->key, content->comps[i],
+                             content->comps[i + 1]) < 0)
+            abort();
     }
-    ccnd_msg(h, "SO_RCVBUF for fd %d is %d", fd, rcvbuf);
-    return(rcvbuf);
+    return(i);
 }
 
 /**
- * Initialize the face flags based upon the addr information
- * and the provided explicit setflags.
+ * Replace the edge label of a trie node.
+ *
+ * The new label may refer into the old one.
  */
 static void
-init_face_flags(struct ccnd_handle *h, struct face *face, int setflags)
+content_trie_set_label(struct content_trie_node *node,
+                       const struct trie_comp *kc, int n)
 {
-    const struct sockaddr *addr = face->addr;
-    const unsigned char *rawaddr = NULL;
+    size_t *loff;
+    unsigned char *lval;
+    size_t total = 0;
+    int i;
     
-    if (addr->sa_family == AF_INET6) {
-        const struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)addr;
-        face->flags |= CCN_FACE_INET6;
-#ifdef IN6_IS_ADDR_LOOPBACK
-        if (IN6_IS_ADDR_LOOPBACK(&addr6->sin6_addr))
-            face->flags |= CCN_FACE_LOOPBACK;
-#endif
+    for (i = 0; i < n; i++)
+        total += kc[i].size;
+    loff = calloc(n + 1, sizeof(loff[0]));
+    lval = malloc(total + 1);
+    if (loff == NULL || lval == NULL)
+        abort();
+    for (i = 0, total = 0; i < n; i++) {
+        loff[i] = total;
+        memcpy(lval + total, kc[i].val, kc[i].size);
+        total += kc[i].size;
     }
-    else if (addr->sa_family == AF_INET) {
-        const struct sockaddr_in *addr4 = (struct sockaddr_in *)addr;
-        rawaddr = (const unsigned char *)&addr4->sin_addr.s_addr;
-        face->flags |= CCN_FACE_INET;
-        if (rawaddr[0] == 127)
-            face->flags |= CCN_FACE_LOOPBACK;
-        else {
-            /* If our side and the peer have the same address, consider it loopback */
-            /* This is the situation inside of FreeBSD jail. */
-            struct sockaddr_in myaddr;
-            socklen_t myaddrlen = sizeof(myaddr);
-            if (0 == getsockname(face->recv_fd, (struct sockaddr *)&myaddr, &myaddrlen)) {
-                if (addr4->sin_addr.s_addr == myaddr.sin_addr.s_addr)
-                    face->flags |= CCN_FACE_LOOPBACK;
-            }
-        }
+    loff[n] = total;
+    free(node->loff);
+    free(node->lval);
+    node->loff = loff;
+    node->lval = lval;
+    node->nlabel = n;
+}
+
+/**
+ * Fill cb with components i through j-1 of the edge label of node,
+ * appending to anything already there.
+ */
+static void
+trie_comps_from_label(struct ccn_charbuf *cb,
+                      struct content_trie_node *node, int i, int j)
+{
+    struct trie_comp tc;
+    
+    for (; i < j; i++) {
+        tc.val = TRIE_LABEL(node, i);
+        tc.size = TRIE_LABEL_SIZE(node, i);
+        ccn_charbuf_append(cb, &tc, sizeof(tc));
     }
-    else if (addr->sa_family == AF_UNIX)
-        face->flags |= (CCN_FACE_GG | CCN_FACE_LOCAL);
-    face->flags |= setflags;
+}
+
+static struct content_trie_node *
+content_trie_node_create(void)
+{
+    struct content_trie_node *node;
+    
+    node = calloc(1, sizeof(*node));
+    if (node == NULL)
+        abort();
+    return(node);
+}
+
+static void
+content_trie_node_destroy(struct content_trie_node **pnode)
+{
+    struct content_trie_node *node = *pnode;
+    int i;
+    
+    if (node == NULL)
+        return;
+    for (i = 0; i < node->nchild; i++)
+        content_trie_node_destroy(&node->child[i]);
+    free(node->child);
+    free(node->loff);
+    free(node->lval);
+    free(node);
+    *pnode = NULL;
 }
 
 /**
- * Make a new face entered in the faces_by_fd table.
+ * Insert c as child number j of node.
  */
-static struct face *
-record_connection(struct ccnd_handle *h, int fd,
-                  struct sockaddr *who, socklen_t wholen,
-                  int setflags)
+static void
+content_trie_add_child(struct content_trie_node *node, int j,
+                       struct content_trie_node *c)
 {
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
-    int res;
-    struct face *face = NULL;
-    unsigned char *addrspace;
+    struct content_trie_node **child;
+    int i;
     
-    res = fcntl(fd, F_SETFL, O_NONBLOCK);
-    if (res == -1)
-        ccnd_msg(h, "fcntl: %s", strerror(errno));
-    hashtb_start(h->faces_by_fd, e);
-    if (hashtb_seek(e, &fd, sizeof(fd), wholen) == HT_NEW_ENTRY) {
-        face = e->data;
-        face->recv_fd = fd;
-        face->sendface = CCN_NOFACEID;
-        face->addrlen = e->extsize;
-        addrspace = ((unsigned char *)e->key) + e->keysize;
-        face->addr = (struct sockaddr *)addrspace;
-        memcpy(addrspace, who, e->extsize);
-        init_face_flags(h, face, setflags);
-        res = enroll_face(h, face);
-        if (res == -1) {
-            hashtb_delete(e);
-            face = NULL;
-        }
+    if (node->nchild == node->nalloc) {
+        i = node->nalloc ? 2 * node->nalloc : 4;
+        child = realloc(node->child, i * sizeof(child[0]));
+        if (child == NULL)
+            abort();
+        node->child = child;
+        node->nalloc = i;
     }
-    hashtb_end(e);
-    return(face);
+    memmove(node->child + j + 1, node->child + j,
+            (node->nchild - j) * sizeof(node->child[0]));
+    node->child[j] = c;
+    node->nchild++;
+    c->parent = node;
+    for (i = j; i < node->nchild; i++)
+        node->child[i]->pindex = i;
 }
 
 /**
- * Accept an incoming SOCK_STREAM connection, creating a new face.
- *
- * This could be, for example, a unix-domain socket, or TCP.
- *
- * @returns fd of new socket, or -1 for an error.
+ * Take child number j out of node's child array.
  */
-static int
-accept_connection(struct ccnd_handle *h, int listener_fd)
+static void
+content_trie_remove_child(struct content_trie_node *node, int j)
 {
-    struct sockaddr_storage who;
-    socklen_t wholen = sizeof(who);
-    int fd;
-    struct face *face;
+    int i;
+    
+    node->nchild--;
+    memmove(node->child + j, node->child + j + 1,
+            (node->nchild - j) * sizeof(node->child[0]));
+    for (i = j; i < node->nchild; i++)
+        node->child[i]->pindex = i;
+}
 
-    fd = accept(listener_fd, (struct sockaddr *)&who, &wholen);
-    if (fd == -1) {
-        ccnd_msg(h, "accept: %s", strerror(errno));
-        return(-1);
+/**
+ * Find the first child whose label begins with a component that sorts
+ * at or after kc.  Sets *exact if the components are equal.
+ */
+static int
+content_trie_child_search(struct content_trie_node *node,
+                          const struct trie_comp *kc, int *exact)
+{
+    struct content_trie_node *c;
+    int lo = 0;
+    int hi = node->nchild;
+    int mid;
+    int cmp;
+    
+    *exact = 0;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        c = node->child[mid];
+        cmp = trie_comp_compare(TRIE_LABEL(c, 0), TRIE_LABEL_SIZE(c, 0),
+                                kc->val, kc->size);
+        if (cmp < 0)
+            lo = mid + 1;
+        else if (cmp > 0)
+            hi = mid;
+        else {
+            *exact = 1;
+            return(mid);
+        }
     }
-    face = record_connection(h, fd,
-                            (struct sockaddr *)&who, wholen,
-                            CCN_FACE_UNDECIDED);
-    if (face == NULL)
-        close_fd(&fd);
-    else
-        ccnd_msg(h, "accepted client fd=%d id=%u", fd, face->faceid);
-    return(fd);
+    return(lo);
 }
 
 /**
- * Make an outbound stream connection.
+ * Split the edge label of node after k components, making a new
+ * interior node that takes node's place in the trie.
  */
-static struct face *
-make_connection(struct ccnd_handle *h,
-                struct sockaddr *who, socklen_t wholen,
-                int setflags)
+static struct content_trie_node *
+content_trie_split(struct ccnd_handle *h, struct content_trie_node *node, int k)
 {
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
-    int fd;
-    int res;
-    struct face *face;
-    const int checkflags = CCN_FACE_LINK | CCN_FACE_DGRAM | CCN_FACE_LOCAL |
-                           CCN_FACE_NOSEND | CCN_FACE_UNDECIDED;
-    const int wantflags = 0;
+    struct content_trie_node *upper;
+    struct content_trie_node *parent = node->parent;
+    struct ccn_charbuf *cb = charbuf_obtain(h);
+    int j = node->pindex;
     
-    /* Check for an existing usable connection */
-    for (hashtb_start(h->faces_by_fd, e); e->data != NULL; hashtb_next(e)) {
-        face = e->data;
-        if (face->addr != NULL && face->addrlen == wholen &&
-            ((face->flags & checkflags) == wantflags) &&
-            0 == memcmp(face->addr, who, wholen)) {
-            hashtb_end(e);
-            return(face);
-        }
-    }
-    face = NULL;
-    hashtb_end(e);
-    /* No existing connection, try to make a new one. */
-    fd = socket(who->sa_family, SOCK_STREAM, 0);
-    if (fd == -1) {
-        ccnd_msg(h, "socket: %s", strerror(errno));
-        return(NULL);
-    }
-    res = fcntl(fd, F_SETFL, O_NONBLOCK);
-    if (res == -1)
-        ccnd_msg(h, "connect fcntl: %s", strerror(errno));
-    setflags &= ~CCN_FACE_CONNECTING;
-    res = connect(fd, who, wholen);
-    if (res == -1 && errno == EINPROGRESS) {
-        res = 0;
-        setflags |= CCN_FACE_CONNECTING;
-    }
-    if (res == -1) {
-        ccnd_msg(h, "connect failed: %s (errno = %d)", strerror(errno), errno);
-        close(fd);
-        return(NULL);
-    }
-    face = record_connection(h, fd, who, wholen, setflags);
-    if (face == NULL) {
-        close(fd);
-        return(NULL);
-    }
-    if ((face->flags & CCN_FACE_CONNECTING) != 0) {
-        ccnd_msg(h, "connecting to client fd=%d id=%u", fd, face->faceid);
-        face->outbufindex = 0;
-        face->outbuf = ccn_charbuf_create();
-    }
-    else
-        ccnd_msg(h, "connected client fd=%d id=%u", fd, face->faceid);
-    return(face);
+    upper = content_trie_node_create();
+    trie_comps_from_label(cb, node, 0, k);
+    content_trie_set_label(upper, (struct trie_comp *)cb->buf, k);
+    cb->length = 0;
+    trie_comps_from_label(cb, node, k, node->nlabel);
+    content_trie_set_label(node, (struct trie_comp *)cb->buf, node->nlabel - k);
+    charbuf_release(h, cb);
+    parent->child[j] = upper;
+    upper->parent = parent;
+    upper->pindex = j;
+    content_trie_add_child(upper, 0, node);
+    return(upper);
 }
 
 /**
- * Get a bound datagram socket.
- *
- * This is handed to ccn_setup_socket() when setting up a multicast face.
+ * Fold a node that has no content and a single child into that child.
  */
-static int
-ccnd_getboundsocket(void *dat, struct sockaddr *who, socklen_t wholen)
+static void
+content_trie_merge(struct ccnd_handle *h, struct content_trie_node *node)
 {
-    struct ccnd_handle *h = dat;
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
-    int yes = 1;
-    int res;
-    int ans = -1;
-    int wantflags = (CCN_FACE_DGRAM | CCN_FACE_PASSIVE);
-    for (hashtb_start(h->faces_by_fd, e); e->data != NULL; hashtb_next(e)) {
-        struct face *face = e->data;
-        if ((face->flags & wantflags) == wantflags &&
-              wholen == face->addrlen &&
-              0 == memcmp(who, face->addr, wholen)) {
-            ans = face->recv_fd;
-            break;
-        }
-    }
-    hashtb_end(e);
-    if (ans != -1)
-        return(ans);
-    ans = socket(who->sa_family, SOCK_DGRAM, 0);
-    if (ans == -1)
-        return(ans);
-    setsockopt(ans, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
-    res = bind(ans, who, wholen);
-    if (res == -1) {
-        ccnd_msg(h, "bind failed: %s (errno = %d)", strerror(errno), errno);
-        close(ans);
-        return(-1);
-    }
-    record_connection(h, ans, who, wholen,
-                      CCN_FACE_DGRAM | CCN_FACE_PASSIVE | CCN_FACE_NORECV);
-    return(ans);
+    struct content_trie_node *parent = node->parent;
+    struct content_trie_node *c = node->child[0];
+    struct ccn_charbuf *cb = charbuf_obtain(h);
+    
+    trie_comps_from_label(cb, node, 0, node->nlabel);
+    trie_comps_from_label(cb, c, 0, c->nlabel);
+    content_trie_set_label(c, (struct trie_comp *)cb->buf,
+                           node->nlabel + c->nlabel);
+    charbuf_release(h, cb);
+    parent->child[node->pindex] = c;
+    c->parent = parent;
+    c->pindex = node->pindex;
+    node->nchild = 0;
+    content_trie_node_destroy(&node);
 }
 
 /**
- * Get the faceid associated with a file descriptor.
+ * Compare the implicit digest component of content with the first
+ * component of the edge label of c, a child of content's trie node.
  *
- * @returns the faceid, or CCN_NOFACEID.
+ * The digest is computed only if c's component is the same size.
+ *
+ * @returns negative if content sorts ahead of everything at or below c,
+ *          or positive if it sorts after all of it.
  */
-static unsigned
-faceid_from_fd(struct ccnd_handle *h, int fd)
+static int
+trie_entry_compare(struct ccnd_handle *h, struct content_entry *content,
+                   struct content_trie_node *c)
 {
-    struct face *face = hashtb_lookup(h->faces_by_fd, &fd, sizeof(fd));
-    if (face != NULL)
-        return(face->faceid);
-    return(CCN_NOFACEID);
+    size_t size = TRIE_LABEL_SIZE(c, 0);
+    
+    if (size != sizeof(content->digest))
+        return(size > sizeof(content->digest) ? -1 : 1);
+    if (memcmp(content_digest(h, content), TRIE_LABEL(c, 0), size) > 0)
+        return(1);
+    return(-1); /* equal digest still sorts first, as the shorter name */
 }
 
-typedef void (*loggerproc)(void *, const char *, ...);
-
 /**
- * Set up a multicast face.
+ * Count the children of node that sort ahead of content, which is
+ * one of node's entries.
  */
-static struct face *
-setup_multicast(struct ccnd_handle *h, struct ccn_face_instance *face_instance,
-                struct sockaddr *who, socklen_t wholen)
+static int
+content_trie_entry_pos(struct ccnd_handle *h, struct content_trie_node *node,
+                       struct content_entry *content)
 {
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
-    struct ccn_sockets socks = { -1, -1 };
-    int res;
-    struct face *face = NULL;
-    const int checkflags = CCN_FACE_LINK | CCN_FACE_DGRAM | CCN_FACE_MCAST |
-                           CCN_FACE_LOCAL | CCN_FACE_NOSEND;
-    const int wantflags = CCN_FACE_DGRAM | CCN_FACE_MCAST;
-
-    /* See if one is already active */
-    // XXX - should also compare and record additional mcast props.
-    for (hashtb_start(h->faces_by_fd, e); e->data != NULL; hashtb_next(e)) {
-        face = e->data;
-        if (face->addr != NULL && face->addrlen == wholen &&
-            ((face->flags & checkflags) == wantflags) &&
-            0 == memcmp(face->addr, who, wholen)) {
-            hashtb_end(e);
-            return(face);
-        }
-    }
-    face = NULL;
-    hashtb_end(e);
+    int lo = 0;
+    int hi = node->nchild;
+    int mid;
     
-    res = ccn_setup_socket(&face_instance->descr,
-                           (loggerproc)&ccnd_msg, (void *)h,
-                           &ccnd_getboundsocket, (void *)h,
-                           &socks);
-    if (res < 0)
-        return(NULL);
-    establish_min_recv_bufsize(h, socks.recving, 128*1024);
-    face = record_connection(h, socks.recving, who, wholen,
-                             (CCN_FACE_MCAST | CCN_FACE_DGRAM));
-    if (face == NULL) {
-        close(socks.recving);
-        if (socks.sending != socks.recving)
-            close(socks.sending); // XXX - could be problematic, but record_connection is unlikely to fail for other than ENOMEM
-        return(NULL);
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (trie_entry_compare(h, content, node->child[mid]) > 0)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    face->sendface = faceid_from_fd(h, socks.sending);
-    ccnd_msg(h, "multicast on fd=%d id=%u, sending on face %u",
-             face->recv_fd, face->faceid, face->sendface);
-    return(face);
+    return(lo);
 }
 
 /**
- * Close a socket, destroying the associated face.
+ * Insert a new entry into the name-ordered content index.
  */
 static void
-shutdown_client_fd(struct ccnd_handle *h, int fd)
-{
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
-    struct face *face = NULL;
-    unsigned faceid = CCN_NOFACEID;
-    hashtb_start(h->faces_by_fd, e);
-    if (hashtb_seek(e, &fd, sizeof(fd), 0) == HT_OLD_ENTRY) {
-        face = e->data;
-        if (face->recv_fd != fd) abort();
-        faceid = face->faceid;
-        if (faceid == CCN_NOFACEID) {
-            ccnd_msg(h, "error indication on fd %d ignored", fd);
-            hashtb_end(e);
-            return;
+content_trie_insert(struct ccnd_handle *h, struct content_entry *content)
+{
+    struct content_trie_node *node = h->content_trie;
+    struct content_trie_node *c;
+    struct content_entry **pp;
+    struct ccn_charbuf *cb;
+    struct trie_comp *kc;
+    int exact;
+    int i;
+    int j;
+    int k;
+    int n;
+    
+    if (content->trie_node != NULL) abort();
+    cb = charbuf_obtain(h);
+    n = trie_comps_from_content(cb, content);
+    kc = (struct trie_comp *)cb->buf;
+    for (i = 0; i < n; i += k) {
+        j = content_trie_child_search(node, &kc[i], &exact);
+        if (!exact) {
+            c = content_trie_node_create();
+            content_trie_set_label(c, &kc[i], n - i);
+            content_trie_add_child(node, j, c);
+            node = c;
+            break;
         }
-        close(fd);
-        face->recv_fd = -1;
-        ccnd_msg(h, "shutdown client fd=%d id=%u", fd, faceid);
-        ccn_charbuf_destroy(&face->inbuf);
-        ccn_charbuf_destroy(&face->outbuf);
-        face = NULL;
+        c = node->child[j];
+        for (k = 1; k < c->nlabel && i + k < n; k++)
+            if (0 != trie_comp_compare(TRIE_LABEL(c, k), TRIE_LABEL_SIZE(c, k),
+                                       kc[i + k].val, kc[i + k].size))
+                break;
+        if (k < c->nlabel)
+            c = content_trie_split(h, c, k);
+        node = c;
     }
-    hashtb_delete(e);
-    hashtb_end(e);
-    check_comm_file(h);
+    charbuf_release(h, cb);
+    for (pp = &node->content; *pp != NULL; pp = &(*pp)->trie_same)
+        if (memcmp(content_digest(h, *pp), content_digest(h, content),
+                   sizeof(content->digest)) > 0)
+            break;
+    content->trie_same = *pp;
+    *pp = content;
+    content->trie_node = node;
 }
 
 /**
- * Send a ContentObject
- *
- * This is after it has worked its way through the queue; update the meters
- * and stuff the packet as appropriate.
+ * Remove an entry from the name-ordered content index.
  */
 static void
-send_content(struct ccnd_handle *h, struct face *face, struct content_entry *content)
+content_trie_remove(struct ccnd_handle *h, struct content_entry *content)
 {
-    int n, a, b, size;
-    if ((face->flags & CCN_FACE_NOSEND) != 0) {
-        // XXX - should count this.
+    struct content_trie_node *node = content->trie_node;
+    struct content_trie_node *parent;
+    struct content_entry **pp;
+    
+    if (node == NULL) abort();
+    for (pp = &node->content; *pp != content; pp = &(*pp)->trie_same)
+        if (*pp == NULL) abort();
+    *pp = content->trie_same;
+    content->trie_same = NULL;
+    content->trie_node = NULL;
+    if (node->content != NULL || node == h->content_trie)
         return;
+    if (node->nchild == 0) {
+        parent = node->parent;
+        content_trie_remove_child(parent, node->pindex);
+        content_trie_node_destroy(&node);
+        node = parent;
     }
-    size = content->size;
-    if (h->debug & 4)
-        ccnd_debug_ccnb(h, __LINE__, "content_to", face,
-                        content->key, size);
-    /* Excise the message-digest name component */
-    n = content->ncomps;
-    if (n < 2) abort();
-    a = content->comps[n - 2];
-    b = content->comps[n - 1];
-    if (b - a != 36)
-        abort(); /* strange digest length */
-    stuff_and_send(h, face, content->key, a, content->key + b, size - b, 0, 0);
-    ccnd_meter_bump(h, face->meter[FM_DATO], 1);
-    h->content_items_sent += 1;
+    if (node != h->content_trie && node->content == NULL && node->nchild == 1)
+        content_trie_merge(h, node);
 }
 
 /**
- * Select the output queue class for a piece of content
+ * The first entry, in name order, at or below node.
  */
-static enum cq_delay_class
-choose_content_delay_class(struct ccnd_handle *h, unsigned faceid, int content_flags)
+static struct content_entry *
+content_trie_first(struct ccnd_handle *h, struct content_trie_node *node)
 {
-    struct face *face = face_from_faceid(h, faceid);
-    if (face == NULL)
-        return(CCN_CQ_ASAP); /* Going nowhere, get it over with */
-    if ((face->flags & (CCN_FACE_LINK | CCN_FACE_MCAST)) != 0) /* udplink or such, delay more */
-        return((content_flags & CCN_CONTENT_ENTRY_SLOWSEND) ? CCN_CQ_SLOW : CCN_CQ_NORMAL);
-    if ((face->flags & CCN_FACE_DGRAM) != 0)
-        return(CCN_CQ_NORMAL); /* udp, delay just a little */
-    if ((face->flags & (CCN_FACE_GG | CCN_FACE_LOCAL)) != 0)
-        return(CCN_CQ_ASAP); /* localhost, answer quickly */
-    return(CCN_CQ_NORMAL); /* default */
+    while (node != NULL) {
+        if (node->content != NULL && (node->nchild == 0 ||
+              trie_entry_compare(h, node->content, node->child[0]) < 0))
+            return(node->content);
+        node = (node->nchild > 0) ? node->child[0] : NULL;
+    }
+    return(NULL);
 }
 
 /**
- * Pick a randomized delay for sending
- *
- * This is primarily for multicast and similar broadcast situations, where we
- * may see the content being sent by somebody else.  If that is the case,
- * we will avoid sending our copy as well.
+ * The first entry, in name order, among what is left at node.
  *
+ * That is child number j and the children after it, and entry content
+ * with the entries chained after it.  Either may be absent.  If both
+ * are, this is what follows node.
  */
-static unsigned
-randomize_content_delay(struct ccnd_handle *h, struct content_queue *q)
+static struct content_entry *
+content_trie_pick(struct ccnd_handle *h, struct content_trie_node *node,
+                  int j, struct content_entry *content)
 {
-    unsigned usec;
+    if (j < node->nchild &&
+        (content == NULL || trie_entry_compare(h, content, node->child[j]) > 0))
+        return(content_trie_first(h, node->child[j]));
+    if (content != NULL)
+        return(content);
+    return(content_trie_after(h, node));
+}
+
+/**
+ * The first entry, in name order, after everything at or below node.
+ */
+static struct content_entry *
+content_trie_after(struct ccnd_handle *h, struct content_trie_node *node)
+{
+    struct content_trie_node *p;
+    struct content_entry *content;
     
-    usec = q->min_usec + q->rand_usec;
-    if (usec < 2)
-        return(1);
-    if (usec <= 20 || q->rand_usec < 2) // XXX - what is a good value for this?
-        return(usec); /* small value, don't bother to randomize */
-    usec = q->min_usec + (nrand48(h->seed) % q->rand_usec);
-    if (usec < 2)
-        return(1);
-    return(usec);
+    for (p = node->parent; p != NULL; node = p, p = p->parent) {
+        content = p->content;
+        while (content != NULL && trie_entry_compare(h, content, node) < 0)
+            content = content->trie_same;
+        if (node->pindex + 1 < p->nchild || content != NULL)
+            return(content_trie_pick(h, p, node->pindex + 1, content));
+    }
+    return(NULL);
 }
 
 /**
- * Scheduled event for sending from a queue.
+ * The first entry of node whose implicit digest component sorts after
+ * kc, or at kc if strict is 0.
  */
-static int
-content_sender(struct ccn_schedule *sched,
-    void *clienth,
-    struct ccn_scheduled_event *ev,
-    int flags)
+static struct content_entry *
+content_trie_entry_lower_bound(struct ccnd_handle *h,
+                               struct content_trie_node *node,
+                               const struct trie_comp *kc, int strict)
 {
-    int i, j;
-    int delay;
-    int nsec;
-    int burst_nsec;
-    int burst_max;
-    struct ccnd_handle *h = clienth;
-    struct content_entry *content = NULL;
-    unsigned faceid = ev->evint;
-    struct face *face = NULL;
-    struct content_queue *q = ev->evdata;
-    (void)sched;
+    struct content_entry *content = node->content;
+    int cmp;
     
-    if ((flags & CCN_SCHEDULE_CANCEL) != 0)
-        goto Bail;
-    face = face_from_faceid(h, faceid);
-    if (face == NULL)
-        goto Bail;
-    if (q->send_queue == NULL)
-        goto Bail;
-    if ((face->flags & CCN_FACE_NOSEND) != 0)
-        goto Bail;
-    /* Send the content at the head of the queue */
-    if (q->ready > q->send_queue->n ||
-        (q->ready == 0 && q->nrun >= 12 && q->nrun < 120))
-        q->ready = q->send_queue->n;
-    nsec = 0;
-    burst_nsec = q->burst_nsec;
-    burst_max = 2;
-    if (q->ready < burst_max)
-        burst_max = q->ready;
-    if (burst_max == 0)
-        q->nrun = 0;
-    for (i = 0; i < burst_max && nsec < 1000000; i++) {
-        content = content_from_accession(h, q->send_queue->buf[i]);
-        if (content == NULL)
-            q->nrun = 0;
-        else {
-            send_content(h, face, content);
-            /* face may have vanished, bail out if it did */
-            if (face_from_faceid(h, faceid) == NULL)
-                goto Bail;
-            nsec += burst_nsec * (unsigned)((content->size + 1023) / 1024);
-            q->nrun++;
-        }
-    }
-    if (q->ready < i) abort();
-    q->ready -= i;
-    /* Update queue */
-    for (j = 0; i < q->send_queue->n; i++, j++)
-        q->send_queue->buf[j] = q->send_queue->buf[i];
-    q->send_queue->n = j;
-    /* Do a poll before going on to allow others to preempt send. */
-    delay = (nsec + 499) / 1000 + 1;
-    if (q->ready > 0) {
-        if (h->debug & 8)
-            ccnd_msg(h, "face %u ready %u delay %i nrun %u",
-                     faceid, q->ready, delay, q->nrun, face->surplus);
-        return(delay);
-    }
-    q->ready = j;
-    if (q->nrun >= 12 && q->nrun < 120) {
-        /* We seem to be a preferred provider, forgo the randomized delay */
-        if (j == 0)
-            delay += burst_nsec / 50;
-        if (h->debug & 8)
-            ccnd_msg(h, "face %u ready %u delay %i nrun %u surplus %u",
-                    (unsigned)ev->evint, q->ready, delay, q->nrun, face->surplus);
-        return(delay);
+    if (content == NULL || kc->size != sizeof(content->digest))
+        return(kc->size < sizeof(content->digest) ? content : NULL);
+    for (; content != NULL; content = content->trie_same) {
+        cmp = memcmp(content_digest(h, content), kc->val, kc->size);
+        if (cmp > 0 || (cmp == 0 && !strict))
+            break;
     }
-    /* Determine when to run again */
-    for (i = 0; i < q->send_queue->n; i++) {
-        content = content_from_accession(h, q->send_queue->buf[i]);
-        if (content != NULL) {
-            q->nrun = 0;
-            delay = randomize_content_delay(h, q);
-            if (h->debug & 8)
-                ccnd_msg(h, "face %u queued %u delay %i",
-                         (unsigned)ev->evint, q->ready, delay);
-            return(delay);
+    return(content);
+}
+
+/**
+ * Find the first entry with a name that sorts at or after the given
+ * components.
+ *
+ * The implicit digest components are not in the index.  The entries named
+ * by a node sort among its children as a 32-byte component would, so at
+ * each level the first such entry not ahead of the key is weighed against
+ * the children.
+ */
+static struct content_entry *
+content_trie_lower_bound(struct ccnd_handle *h,
+                         const struct trie_comp *kc, int n)
+{
+    struct content_trie_node *node = h->content_trie;
+    struct content_trie_node *c;
+    struct content_entry *content;
+    int exact;
+    int cmp;
+    int i;
+    int j;
+    int k;
+    
+    for (i = 0; i < n; i += k) {
+        content = content_trie_entry_lower_bound(h, node, &kc[i], i + 1 < n);
+        j = content_trie_child_search(node, &kc[i], &exact);
+        if (!exact)
+            return(content_trie_pick(h, node, j, content));
+        c = node->child[j];
+        if (content != NULL && trie_entry_compare(h, content, c) < 0)
+            return(content);
+        for (k = 1; k < c->nlabel; k++) {
+            if (i + k == n)
+                return(content_trie_first(h, c));
+            cmp = trie_comp_compare(TRIE_LABEL(c, k), TRIE_LABEL_SIZE(c, k),
+                                    kc[i + k].val, kc[i + k].size);
+            if (cmp > 0)
+                return(content_trie_first(h, c));
+            if (cmp < 0)
+                return(content_trie_after(h, c));
         }
+        node = c;
     }
-    q->send_queue->n = q->ready = 0;
-Bail:
-    q->sender = NULL;
-    return(0);
+    return(content_trie_first(h, node));
 }
 
 /**
- * Queue a ContentObject to be sent on a face.
+ * Find the first candidate that might match the given interest.
  */
-static int
-face_send_queue_insert(struct ccnd_handle *h,
-                       struct face *face, struct content_entry *content)
+static struct content_entry *
+find_first_match_candidate(struct ccnd_handle *h,
+                           const unsigned char *interest_msg,
+                           const struct ccn_parsed_interest *pi,
+                           struct ccn_indexbuf *comps)
 {
-    int ans;
-    int delay;
-    enum cq_delay_class c;
-    enum cq_delay_class k;
-    struct content_queue *q;
-    if (face == NULL || content == NULL || (face->flags & CCN_FACE_NOSEND) != 0)
-        return(-1);
-    c = choose_content_delay_class(h, face->faceid, content->flags);
-    if (face->q[c] == NULL)
-        face->q[c] = content_queue_create(h, face, c);
-    q = face->q[c];
-    if (q == NULL)
-        return(-1);
-    /* Check the other queues first, it might be in one of them */
-    for (k = 0; k < CCN_CQ_N; k++) {
-        if (k != c && face->q[k] != NULL) {
-            ans = ccn_indexbuf_member(face->q[k]->send_queue, content->accession);
-            if (ans >= 0) {
-                if (h->debug & 8)
-                    ccnd_debug_ccnb(h, __LINE__, "content_otherq", face,
-                                    content->key, content->size);
-                return(ans);
+    struct content_entry *ans = NULL;
+    struct ccn_charbuf *cb = charbuf_obtain(h);
+    int i;
+    int n = comps->n - 1;
+    
+    for (i = 0; i < n; i++) {
+        if (trie_comp_append(cb, interest_msg, comps->buf[i],
+                             comps->buf[i + 1]) < 0)
+            goto Bail;
+    }
+    if (pi->offset[CCN_PI_B_Exclude] < pi->offset[CCN_PI_E_Exclude]) {
+        /* Check for <Exclude><Any/><Component>... fast case */
+        struct ccn_buf_decoder decoder;
+        struct ccn_buf_decoder *d;
+        size_t ex1start;
+        size_t ex1end;
+        d = ccn_buf_decoder_start(&decoder,
+                                  interest_msg + pi->offset[CCN_PI_B_Exclude],
+                                  pi->offset[CCN_PI_E_Exclude] -
+                                  pi->offset[CCN_PI_B_Exclude]);
+        ccn_buf_advance(d);
+        if (ccn_buf_match_dtag(d, CCN_DTAG_Any)) {
+            ccn_buf_advance(d);
+            ccn_buf_check_close(d);
+            if (ccn_buf_match_dtag(d, CCN_DTAG_Component)) {
+                ex1start = pi->offset[CCN_PI_B_Exclude] + d->decoder.token_index;
+                ccn_buf_advance_past_element(d);
+                ex1end = pi->offset[CCN_PI_B_Exclude] + d->decoder.token_index;
+                if (d->decoder.state >= 0 &&
+                    trie_comp_append(cb, interest_msg, ex1start, ex1end) >= 0) {
+                    n++;
+                    if (h->debug & 8)
+                        ccnd_debug_ccnb(h, __LINE__, "fastex", NULL,
+                                        interest_msg + ex1start,
+                                        ex1end - ex1start);
+                }
             }
         }
     }
-    ans = ccn_indexbuf_set_insert(q->send_queue, content->accession);
-    if (q->sender == NULL) {
-        delay = randomize_content_delay(h, q);
-        q->ready = q->send_queue->n;
-        q->sender = ccn_schedule_event(h->sched, delay,
-                                       content_sender, q, face->faceid);
-        if (h->debug & 8)
-            ccnd_msg(h, "face %u q %d delay %d usec", face->faceid, c, delay);
-    }
-    return (ans);
+    ans = content_trie_lower_bound(h, (struct trie_comp *)cb->buf, n);
+Bail:
+    charbuf_release(h, cb);
+    return(ans);
 }
 
 /**
- * Return true iff the interest is pending on the given face
+ * Check for a prefix match.
  */
 static int
-is_pending_on(struct ccnd_handle *h, struct interest_entry *ie, unsigned faceid)
+content_matches_interest_prefix(struct ccnd_handle *h,
+                                struct content_entry *content,
+                                const unsigned char *interest_msg,
+                                struct ccn_indexbuf *comps,
+                                int prefix_comps)
 {
-    struct pit_face_item *x;
-    
-    for (x = ie->pfl; x != NULL; x = x->next) {
-        if (x->faceid == faceid && (x->pfi_flags & CCND_PFI_PENDING) != 0)
-            return(1);
-        // XXX - depending on how list is ordered, an early out might be possible
-        // For now, we assume no particular ordering
+    size_t prefixlen;
+    if (prefix_comps < 0 || prefix_comps >= comps->n)
+        abort();
+    /* First verify the prefix match. */
+    if (content->ncomps < prefix_comps)
+            return(0);
+    if (content->ncomps == prefix_comps) {
+        /* The last prefix component must be the implicit digest */
+        if (!content_digest_comp_matches(h, content, interest_msg,
+                                         comps->buf[prefix_comps - 1],
+                                         comps->buf[prefix_comps]))
+            return(0);
+        prefix_comps--;
     }
-    return(0);
+    prefixlen = comps->buf[prefix_comps] - comps->buf[0];
+    if (content->comps[prefix_comps] - content->comps[0] != prefixlen)
+        return(0);
+    if (0 != memcmp(content->key + content->comps[0],
+                    interest_msg + comps->buf[0],
+                    prefixlen))
+        return(0);
+    return(1);
 }
 
 /**
- * Consume matching interests
- * given a nameprefix_entry and a piece of content.
- *
- * If face is not NULL, pay attention only to interests from that face.
- * It is allowed to pass NULL for pc, but if you have a (valid) one it
- * will avoid a re-parse.
- * @returns number of matches found.
+ * Advance to the next entry in name order.
  */
-static int
-consume_matching_interests(struct ccnd_handle *h,
-                           struct nameprefix_entry *npe,
-                           struct content_entry *content,
-                           struct ccn_parsed_ContentObject *pc,
-                           struct face *face)
+static struct content_entry *
+content_next(struct ccnd_handle *h, struct content_entry *content)
 {
-    int matches = 0;
-    struct ielinks *head;
-    struct ielinks *next;
-    struct ielinks *pl;
-    struct interest_entry *p;
-    struct pit_face_item *x;
-    const unsigned char *content_msg;
-    size_t content_size;
+    struct content_trie_node *node;
+    int j;
     
-    head = &npe->ie_head;
-    content_msg = content->key;
-    content_size = content->size;
-    for (pl = head->next; pl != head; pl = next) {
-        next = pl->next;
-        p = (struct interest_entry *)pl;
-        if (p->interest_msg == NULL)
-            continue;
-        if (face != NULL && is_pending_on(h, p, face->faceid) == 0)
-            continue;
-        if (ccn_content_matches_interest(content_msg, content_size, 0, pc,
-                                         p->interest_msg, p->size, NULL)) {
-            for (x = p->pfl; x != NULL; x = x->next) {
-                if ((x->pfi_flags & CCND_PFI_PENDING) != 0)
-                    face_send_queue_insert(h, face_from_faceid(h, x->faceid),
-                                           content);
-            }
-            matches += 1;
-            strategy_callout(h, p, CCNST_SATISFIED);
-            consume_interest(h, p);
-        }
-    }
-    return(matches);
+    if (content == NULL || content->trie_node == NULL)
+        return(NULL);
+    node = content->trie_node;
+    j = content_trie_entry_pos(h, node, content);
+    return(content_trie_pick(h, node, j, content->trie_same));
 }
 
 /**
- * Adjust the predicted response associated with a name prefix entry.
- *
- * It is decreased by a small fraction if we get content within our
- * previous predicted value, and increased by a larger fraction if not.
+ * Find the next entry in name order that differs from content
+ * in one of its first level + 1 components.
  *
+ * This skips over the rest of the children at the given level, so it is
+ * used for the rightmost-child selector.
  */
-static void
-adjust_npe_predicted_response(struct ccnd_handle *h,
-                              struct nameprefix_entry *npe, int up)
+static struct content_entry *
+next_child_at_level(struct ccnd_handle *h,
+                    struct content_entry *content, int level)
 {
-    unsigned t = npe->usec;
-    if (up)
-        t = t + (t >> 3);
-    else
-        t = t - (t >> 7);
-    if (t < 127)
-        t = 127;
-    else if (t > 160000)
-        t = 160000;
-    npe->usec = t;
+    struct content_trie_node *node;
+    int depth;
+    
+    if (content == NULL || content->trie_node == NULL)
+        return(NULL);
+    if (content->ncomps <= level)
+        return(NULL);
+    if (content->ncomps == level + 1)
+        return(content_next(h, content)); /* next child is a digest */
+    node = content->trie_node;
+    depth = content->ncomps - 1;
+    while (depth - node->nlabel > level) {
+        depth -= node->nlabel;
+        node = node->parent;
+    }
+    return(content_trie_after(h, node));
 }
 
 /**
- * Adjust the predicted responses for an interest.
- *
- * We adjust two npes, so that the parents are informed about activity
- * at the leaves.
- *
+ * Find the first match, in name order, at or below a trie node.
  */
-static void
-adjust_predicted_response(struct ccnd_handle *h,
-                          struct interest_entry *ie, int up)
+static struct content_entry *
+content_trie_first_match(struct ccnd_handle *h,
+                         struct content_trie_node *node,
+                         const unsigned char *msg, size_t size,
+                         const struct ccn_parsed_interest *pi,
+                         const struct ccn_exclude *excl, int s_ok)
 {
-    struct nameprefix_entry *npe;
-        
-    npe = ie->ll.npe;
-    if (npe == NULL)
-        return;
-    adjust_npe_predicted_response(h, npe, up);
-    if (npe->parent != NULL)
-        adjust_npe_predicted_response(h, npe->parent, up);
+    struct content_entry *content;
+    struct content_entry *stop;
+    
+    stop = content_trie_after(h, node);
+    for (content = content_trie_first(h, node);
+         content != NULL && content != stop;
+         content = content_next(h, content)) {
+        if ((s_ok || (content->flags & CCN_CONTENT_ENTRY_STALE) == 0) &&
+            content_matches_interest(h, content, msg, size, pi, excl))
+            return(content);
+    }
+    return(NULL);
 }
 
 /**
- * Keep a little history about where matching content comes from.
- */
-static void
-note_content_from(struct ccnd_handle *h,
-                  struct nameprefix_entry *npe,
-                  unsigned from_faceid,
-                  int prefix_comps)
-{
-    if (npe->src == from_faceid)
-        adjust_npe_predicted_response(h, npe, 0);
-    else if (npe->src == CCN_NOFACEID)
-        npe->src = from_faceid;
-    else {
-        npe->osrc = npe->src;
-        npe->src = from_faceid;
-    }
-    if (h->debug & 8)
-        ccnd_msg(h, "sl.%d %u ci=%d osrc=%u src=%u usec=%d", __LINE__,
-                 from_faceid, prefix_comps, npe->osrc, npe->src, npe->usec);
-}
-
-/**
- * Find and consume interests that match given content.
- *
- * Schedules the sending of the content.
- * If face is not NULL, pay attention only to interests from that face.
- * It is allowed to pass NULL for pc, but if you have a (valid) one it
- * will avoid a re-parse.
- * For new content, from_face is the source; for old content, from_face is NULL.
- * @returns number of matches, or -1 if the new content should be dropped.
+ * Find the match for an interest that asks for the rightmost child.
+ *
+ * This locates the trie node for the interest's name and tries its
+ * children from the greatest down, starting below any upper limit that
+ * the Exclude puts on the next component.  The first child with a match
+ * at or below it wins.  Entries named by the prefix itself are tried in
+ * their place among the children, as their digest components sort, so
+ * the answer is the one a forward scan would find.  The cost depends on
+ * the depth of the trie, not on how many children there are.
+ *
+ * A name that ends with what could be an implicit digest is left to the
+ * forward scan.
+ *
+ * @returns 1 if *ans holds the answer (NULL if nothing matches),
+ *          or 0 if the caller should do the forward scan.
  */
 static int
-match_interests(struct ccnd_handle *h, struct content_entry *content,
-                           struct ccn_parsed_ContentObject *pc,
-                           struct face *face, struct face *from_face)
+find_rightmost_match(struct ccnd_handle *h,
+                     const unsigned char *msg, size_t size,
+                     const struct ccn_parsed_interest *pi,
+                     struct ccn_indexbuf *comps,
+                     const struct ccn_exclude *excl, int s_ok,
+                     struct content_entry **ans)
 {
-    int n_matched = 0;
-    int new_matches;
-    int ci;
-    int cm = 0;
-    unsigned c0 = content->comps[0];
-    const unsigned char *key = content->key + c0;
-    struct nameprefix_entry *npe = NULL;
-    for (ci = content->ncomps - 1; ci >= 0; ci--) {
-        int size = content->comps[ci] - c0;
-        npe = hashtb_lookup(h->nameprefix_tab, key, size);
-        if (npe != NULL)
-            break;
+    struct ccn_charbuf *cb = charbuf_obtain(h);
+    struct content_trie_node *node = h->content_trie;
+    struct content_trie_node *c;
+    struct content_entry *content;
+    struct content_entry **v;
+    struct trie_comp *kc;
+    struct trie_comp lim;
+    int n = comps->n - 1;
+    int exact;
+    int res = 0;
+    int i;
+    int j;
+    int k;
+    int m;
+    
+    *ans = NULL;
+    for (i = 0; i < n; i++) {
+        if (trie_comp_append(cb, msg, comps->buf[i], comps->buf[i + 1]) < 0)
+            goto Bail;
     }
-    for (; npe != NULL; npe = npe->parent, ci--) {
-        if (npe->fgen != h->forward_to_gen)
-            update_forward_to(h, npe);
-        if (from_face != NULL && (npe->flags & CCN_FORW_LOCAL) != 0 &&
-            (from_face->flags & CCN_FACE_GG) == 0)
-            return(-1);
-        new_matches = consume_matching_interests(h, npe, content, pc, face);
-        if (from_face != NULL && (new_matches != 0 || ci + 1 == cm))
-            note_content_from(h, npe, from_face->faceid, ci);
-        if (new_matches != 0) {
-            cm = ci; /* update stats for this prefix and one shorter */
-            n_matched += new_matches;
+    kc = (struct trie_comp *)cb->buf;
+    if (n > 0 && kc[n - 1].size == sizeof(content->digest))
+        goto Bail;
+    res = 1;
+    for (i = 0; i < n; i += k) {
+        j = content_trie_child_search(node, &kc[i], &exact);
+        if (!exact)
+            goto Bail;
+        c = node->child[j];
+        for (k = 1; k < c->nlabel && i + k < n; k++) {
+            if (0 != trie_comp_compare(TRIE_LABEL(c, k), TRIE_LABEL_SIZE(c, k),
+                                       kc[i + k].val, kc[i + k].size))
+                goto Bail;
+        }
+        if (k < c->nlabel) {
+            /* The name ends inside this label, so there is one child */
+            *ans = content_trie_first_match(h, c, msg, size, pi, excl, s_ok);
+            goto Bail;
+        }
+        node = c;
+    }
+    j = node->nchild;
+    if (excl != NULL && ccn_exclude_upper_limit(excl, &lim.val, &lim.size))
+        j = content_trie_child_search(node, &lim, &exact);
+    /* The entries, in increasing digest order, to merge with the children */
+    cb->length = 0;
+    for (content = node->content; content != NULL; content = content->trie_same)
+        ccn_charbuf_append(cb, &content, sizeof(content));
+    v = (struct content_entry **)cb->buf;
+    m = cb->length / sizeof(content);
+    for (;;) {
+        if (m > 0 &&
+            (j == 0 || trie_entry_compare(h, v[m - 1], node->child[j - 1]) > 0)) {
+            content = v[--m];
+            if ((s_ok || (content->flags & CCN_CONTENT_ENTRY_STALE) == 0) &&
+                content_matches_interest(h, content, msg, size, pi, excl)) {
+                *ans = content;
+                break;
+            }
+            continue;
         }
+        if (j == 0)
+            break;
+        c = node->child[--j];
+        if (excl != NULL &&
+            ccn_exclude_test(excl, TRIE_LABEL(c, 0), TRIE_LABEL_SIZE(c, 0)))
+            continue;
+        *ans = content_trie_first_match(h, c, msg, size, pi, excl, s_ok);
+        if (*ans != NULL)
+            break;
     }
-    return(n_matched);
+Bail:
+    charbuf_release(h, cb);
+    return(res);
 }
 
 /**
- * Send a message in a PDU, possibly stuffing other interest messages into it.
- * The message may be in two pieces.
+ * Consume an interest.
  */
 static void
-stuff_and_send(struct ccnd_handle *h, struct face *face,
-               const unsigned char *data1, size_t size1,
-               const unsigned char *data2, size_t size2,
-               const char *tag, int lineno) {
-    struct ccn_charbuf *c = NULL;
+consume_interest(struct ccnd_handle *h, struct interest_entry *ie)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    int res;
     
-    if ((face->flags & CCN_FACE_LINK) != 0) {
-        c = charbuf_obtain(h);
-        ccn_charbuf_reserve(c, size1 + size2 + 5 + 8);
-        ccn_charbuf_append_tt(c, CCN_DTAG_CCNProtocolDataUnit, CCN_DTAG);
-        ccn_charbuf_append(c, data1, size1);
-        if (size2 != 0)
-            ccn_charbuf_append(c, data2, size2);
-        if (tag != NULL)
-            ccnd_debug_ccnb(h, lineno, tag, face, c->buf + 4, c->length - 4);
-        ccn_stuff_interest(h, face, c);
-        ccn_append_link_stuff(h, face, c);
-        ccn_charbuf_append_closer(c);
+    hashtb_start(h->interest_tab, e);
+    res = hashtb_seek(e, ie->interest_msg, ie->size - 1, 1);
+    if (res != HT_OLD_ENTRY)
+        abort();
+    hashtb_delete(e);
+    hashtb_end(e);
+}    
+
+/**
+ * Clean up a name prefix entry when it is removed from the hash table.
+ */
+static void
+finalize_nameprefix(struct hashtb_enumerator *e)
+{
+    struct ccnd_handle *h = hashtb_get_param(e->ht, NULL);
+    struct nameprefix_entry *npe = e->data;
+    struct ielinks *head = &npe->ie_head;
+    if (head->next != NULL) {
+        while (head->next != head)
+            consume_interest(h, (struct interest_entry *)(head->next));
     }
-    else if (size2 != 0 || h->mtu > size1 + size2 ||
-             (face->flags & (CCN_FACE_SEQOK | CCN_FACE_SEQPROBE)) != 0 ||
-             face->recvcount == 0) {
-        c = charbuf_obtain(h);
-        ccn_charbuf_append(c, data1, size1);
-        if (size2 != 0)
-            ccn_charbuf_append(c, data2, size2);
-        if (tag != NULL)
-            ccnd_debug_ccnb(h, lineno, tag, face, c->buf, c->length);
-        ccn_stuff_interest(h, face, c);
-        ccn_append_link_stuff(h, face, c);
+    head = &npe->ie_exact;
+    if (head->next != NULL) {
+        while (head->next != head)
+            consume_interest(h, (struct interest_entry *)(head->next));
     }
-    else {
-        /* avoid a copy in this case */
-        if (tag != NULL)
-            ccnd_debug_ccnb(h, lineno, tag, face, data1, size1);
-        ccnd_send(h, face, data1, size1);
-        return;
+    ccn_indexbuf_destroy(&npe->forward_to);
+    ccn_indexbuf_destroy(&npe->tap);
+    while (npe->forwarding != NULL) {
+        struct ccn_forwarding *f = npe->forwarding;
+        npe->forwarding = f->next;
+        free(f);
     }
-    ccnd_send(h, face, c->buf, c->length);
-    charbuf_release(h, c);
-    return;
 }
 
 /**
- * Append a link-check interest if appropriate.
+ * Link an interest to its name prefix entry.
  *
- * @returns the number of messages that were stuffed.
+ * An interest that has no selectors affecting which content matches
+ * goes on the ie_exact list, since any content that reaches the entry
+ * will do for it.
  */
-static int
-stuff_link_check(struct ccnd_handle *h,
-                   struct face *face, struct ccn_charbuf *c)
+static void
+link_interest_entry_to_nameprefix(struct ccnd_handle *h,
+    struct interest_entry *ie, struct nameprefix_entry *npe,
+    const struct ccn_parsed_interest *pi)
 {
-    int checkflags = CCN_FACE_DGRAM | CCN_FACE_MCAST | CCN_FACE_GG | CCN_FACE_LC;
-    int wantflags = CCN_FACE_DGRAM;
-    struct ccn_charbuf *name = NULL;
-    struct ccn_charbuf *ibuf = NULL;
-    int res;
-    int ans = 0;
-    if (face->recvcount > 0)
-        return(0);
-    if ((face->flags & checkflags) != wantflags)
-        return(0);
-    name = ccn_charbuf_create();
-    if (name == NULL) goto Bail;
-    ccn_name_init(name);
-    res = ccn_name_from_uri(name, CCNDID_NEIGHBOR_URI);
-    if (res < 0) goto Bail;
-    ibuf = ccn_charbuf_create();
-    if (ibuf == NULL) goto Bail;
-    ccn_charbuf_append_tt(ibuf, CCN_DTAG_Interest, CCN_DTAG);
-    ccn_charbuf_append(ibuf, name->buf, name->length);
-    ccnb_tagged_putf(ibuf, CCN_DTAG_Scope, "2");
-    // XXX - ought to generate a nonce
-    ccn_charbuf_append_closer(ibuf);
-    ccn_charbuf_append(c, ibuf->buf, ibuf->length);
-    ccnd_meter_bump(h, face->meter[FM_INTO], 1);
-    h->interests_stuffed++;
-    face->flags |= CCN_FACE_LC;
-    if (h->debug & 2)
-        ccnd_debug_ccnb(h, __LINE__, "stuff_interest_to", face,
-                        ibuf->buf, ibuf->length);
-    ans = 1;
-Bail:
-    ccn_charbuf_destroy(&ibuf);
-    ccn_charbuf_destroy(&name);
-    return(ans);
+    struct ielinks *head = &npe->ie_head;
+    struct ielinks *ll = &ie->ll;
+    
+    /* MinSuffixComponents through Exclude are all absent */
+    if (pi->offset[CCN_PI_B_MinSuffixComponents] == pi->offset[CCN_PI_E_Exclude])
+        head = &npe->ie_exact;
+    ll->next = head;
+    ll->prev = head->prev;
+    ll->prev->next = ll->next->prev = ll;
+    ll->npe = npe;
 }
 
 /**
- * Stuff a PDU with interest messages that will fit.
- *
- * @returns the number of messages that were stuffed.
+ * Clean up an interest_entry when it is removed from its hash table.
  */
-static int
-ccn_stuff_interest(struct ccnd_handle *h,
-                   struct face *face, struct ccn_charbuf *c)
+static void
+finalize_interest(struct hashtb_enumerator *e)
 {
-    int n_stuffed = 0;
-    
-    n_stuffed += stuff_link_check(h, face, c);
-    return(n_stuffed);
+    struct pit_face_item *p = NULL;
+    struct pit_face_item *next = NULL;
+    struct ccnd_handle *h = hashtb_get_param(e->ht, NULL);
+    struct interest_entry *ie = e->data;
+    struct face *face = NULL;
+
+    if (ie->ev != NULL)
+        ccn_schedule_cancel(h->sched, ie->ev);
+    if (ie->strategy.ev != NULL)
+        ccn_schedule_cancel(h->sched, ie->strategy.ev);
+    if (ie->ll.next != NULL) {
+        ie->ll.next->prev = ie->ll.prev;
+        ie->ll.prev->next = ie->ll.next;
+        ie->ll.next = ie->ll.prev = NULL;
+        ie->ll.npe = NULL;
+    }
+    for (p = ie->pfl; p != NULL; p = next) {
+        next = p->next;
+        if ((p->pfi_flags & CCND_PFI_PENDING) != 0) {
+            face = face_from_faceid(h, p->faceid);
+            if (face != NULL)
+                face->pending_interests -= 1;
+        }
+        pfi_free(h, p);
+    }
+    ie->pfl = NULL;
+    ccn_exclude_destroy(&ie->excl);
+    ie->interest_msg = NULL; /* part of hashtb, don't free this */
 }
 
 /**
- * Set up to send one sequence number to see it the other side wants to play.
- *
- * If we don't hear a number from the other side, we won't keep sending them.
+ * Clean up a guest_entry when it is removed from its hash table.
  */
 static void
-ccn_link_state_init(struct ccnd_handle *h, struct face *face)
+finalize_guest(struct hashtb_enumerator *e)
 {
-    int checkflags;
-    int matchflags;
-    
-    matchflags = CCN_FACE_DGRAM;
-    checkflags = matchflags | CCN_FACE_MCAST | CCN_FACE_GG | CCN_FACE_SEQOK | \
-                 CCN_FACE_PASSIVE;
-    if ((face->flags & checkflags) != matchflags)
-        return;
-    /* Send one sequence number to see if the other side wants to play. */
-    face->pktseq = nrand48(h->seed);
-    face->flags |= CCN_FACE_SEQPROBE;
+    struct guest_entry *g = e->data;
+    ccn_charbuf_destroy(&g->cob);
 }
 
 /**
- * Append a sequence number if appropriate.
+ * Create a listener on a unix-domain socket.
  */
-static void
-ccn_append_link_stuff(struct ccnd_handle *h,
-                      struct face *face,
-                      struct ccn_charbuf *c)
+static int
+create_local_listener(struct ccnd_handle *h, const char *sockname, int backlog)
 {
-    if ((face->flags & (CCN_FACE_SEQOK | CCN_FACE_SEQPROBE)) == 0)
-        return;
-    ccn_charbuf_append_tt(c, CCN_DTAG_SequenceNumber, CCN_DTAG);
-    ccn_charbuf_append_tt(c, 2, CCN_BLOB);
-    ccn_charbuf_append_value(c, face->pktseq, 2);
-    ccnb_element_end(c);
-    if (0)
-        ccnd_msg(h, "debug.%d pkt_to %u seq %u",
-                 __LINE__, face->faceid, (unsigned)face->pktseq);
-    face->pktseq++;
-    face->flags &= ~CCN_FACE_SEQPROBE;
+    int res;
+    int savedmask;
+    int sock;
+    struct sockaddr_un a = { 0 };
+    res = unlink(sockname);
+    if (res == 0) {
+        ccnd_msg(NULL, "unlinked old %s, please wait", sockname);
+        sleep(9); /* give old ccnd a chance to exit */
+    }
+    if (!(res == 0 || errno == ENOENT))
+        ccnd_msg(NULL, "failed to unlink %s", sockname);
+    a.sun_family = AF_UNIX;
+    strncpy(a.sun_path, sockname, sizeof(a.sun_path));
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1)
+        return(sock);
+    savedmask = umask(0111); /* socket should be R/W by anybody */
+    res = bind(sock, (struct sockaddr *)&a, sizeof(a));
+    umask(savedmask);
+    if (res == -1) {
+        close(sock);
+        return(-1);
+    }
+    unlink_at_exit(sockname);
+    res = listen(sock, backlog);
+    if (res == -1) {
+        close(sock);
+        return(-1);
+    }
+    record_connection(h, sock, (struct sockaddr *)&a, sizeof(a),
+                      (CCN_FACE_LOCAL | CCN_FACE_PASSIVE));
+    return(sock);
 }
 
 /**
- * Process an incoming link message.
+ * Adjust socket buffer limit
  */
 static int
-process_incoming_link_message(struct ccnd_handle *h,
-                              struct face *face, enum ccn_dtag dtag,
-                              unsigned char *msg, size_t size)
+establish_min_recv_bufsize(struct ccnd_handle *h, int fd, int minsize)
 {
-    uintmax_t s;
-    int checkflags;
-    int matchflags;
-    struct ccn_buf_decoder decoder;
-    struct ccn_buf_decoder *d = ccn_buf_decoder_start(&decoder, msg, size);
+    int res;
+    int rcvbuf;
+    socklen_t rcvbuf_sz;
 
-    switch (dtag) {
-        case CCN_DTAG_SequenceNumber:
-            s = ccn_parse_required_tagged_binary_number(d, dtag, 1, 6);
-            if (d->decoder.state < 0)
-                return(d->decoder.state);
-            /*
-             * If the other side is unicast and sends sequence numbers,
-             * then it is OK for us to send numbers as well.
-             */
-            matchflags = CCN_FACE_DGRAM;
-            checkflags = matchflags | CCN_FACE_MCAST | CCN_FACE_SEQOK;
-            if ((face->flags & checkflags) == matchflags)
-                face->flags |= CCN_FACE_SEQOK;
-            if (face->rrun == 0) {
-                face->rseq = s;
-                face->rrun = 1;
-                return(0);
-            }
-            if (s == face->rseq + 1) {
-                face->rseq = s;
-                if (face->rrun < 255)
-                    face->rrun++;
-                return(0);
-            }
-            if (s > face->rseq && s - face->rseq < 255) {
-                ccnd_msg(h, "seq_gap %u %ju to %ju",
-                         face->faceid, face->rseq, s);
-                face->rseq = s;
-                face->rrun = 1;
-                return(0);
-            }
-            if (s <= face->rseq) {
-                if (face->rseq - s < face->rrun) {
-                    ccnd_msg(h, "seq_dup %u %ju", face->faceid, s);
-                    return(0);
-                }
-                if (face->rseq - s < 255) {
-                    /* Received out of order */
-                    ccnd_msg(h, "seq_ooo %u %ju", face->faceid, s);
-                    if (s == face->rseq - face->rrun) {
-                        face->rrun++;
-                        return(0);
-                    }
-                }
-            }
-            face->rseq = s;
-            face->rrun = 1;
-            break;
-        default:
-            return(-1);
+    rcvbuf_sz = sizeof(rcvbuf);
+    res = getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &rcvbuf_sz);
+    if (res == -1)
+        return (res);
+    if (rcvbuf < minsize) {
+        rcvbuf = minsize;
+        res = setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        if (res == -1)
+            return(res);
     }
-    return(0);
+    ccnd_msg(h, "SO_RCVBUF for fd %d is %d", fd, rcvbuf);
+    return(rcvbuf);
 }
 
 /**
- * Checks for inactivity on datagram faces.
- * @returns number of faces that have gone away.
+ * Initialize the face flags based upon the addr information
+ * and the provided explicit setflags.
  */
-static int
-check_dgram_faces(struct ccnd_handle *h)
+static void
+init_face_flags(struct ccnd_handle *h, struct face *face, int setflags)
 {
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
-    int count = 0;
-    int checkflags = CCN_FACE_DGRAM;
-    int wantflags = CCN_FACE_DGRAM;
-    int adj_req = 0;
+    const struct sockaddr *addr = face->addr;
+    const unsigned char *rawaddr = NULL;
     
-    hashtb_start(h->dgram_faces, e);
-    while (e->data != NULL) {
-        struct face *face = e->data;
-        if (face->addr != NULL && (face->flags & checkflags) == wantflags) {
-            face->flags &= ~CCN_FACE_LC; /* Rate limit link check interests */
-            if (face->recvcount == 0) {
-                if ((face->flags & (CCN_FACE_PERMANENT | CCN_FACE_ADJ)) == 0) {
-                    count += 1;
-                    hashtb_delete(e);
-                    continue;
-                }
-            }
-            else if (face->recvcount == 1) {
-                face->recvcount = 0;
-            }
-            else {
-                face->recvcount = 1; /* go around twice */
+    if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)addr;
+        face->flags |= CCN_FACE_INET6;
+#ifdef IN6_IS_ADDR_LOOPBACK
+        if (IN6_IS_ADDR_LOOPBACK(&addr6->sin6_addr))
+            face->flags |= CCN_FACE_LOOPBACK;
+#endif
+    }
+    else if (addr->sa_family == AF_INET) {
+        const struct sockaddr_in *addr4 = (struct sockaddr_in *)addr;
+        rawaddr = (const unsigned char *)&addr4->sin_addr.s_addr;
+        face->flags |= CCN_FACE_INET;
+        if (rawaddr[0] == 127)
+            face->flags |= CCN_FACE_LOOPBACK;
+        else {
+            /* If our side and the peer have the same address, consider it loopback */
+            /* This is the situation inside of FreeBSD jail. */
+            struct sockaddr_in myaddr;
+            socklen_t myaddrlen = sizeof(myaddr);
+            if (0 == getsockname(face->recv_fd, (struct sockaddr *)&myaddr, &myaddrlen)) {
+                if (addr4->sin_addr.s_addr == myaddr.sin_addr.s_addr)
+                    face->flags |= CCN_FACE_LOOPBACK;
             }
         }
-        hashtb_next(e);
-    }
-    hashtb_end(e);
-    if (adj_req) {
-        process_internal_client_buffer(h);
     }
-    return(count);
+    else if (addr->sa_family == AF_UNIX)
+        face->flags |= (CCN_FACE_GG | CCN_FACE_LOCAL);
+    face->flags |= setflags;
 }
 
 /**
- * Destroys the face identified by faceid.
- * @returns 0 for success, -1 for failure.
+ * Make a new face entered in the faces_by_fd table.
  */
-int
-ccnd_destroy_face(struct ccnd_handle *h, unsigned faceid)
+static struct face *
+record_connection(struct ccnd_handle *h, int fd,
+                  struct sockaddr *who, socklen_t wholen,
+                  int setflags)
 {
     struct hashtb_enumerator ee;
     struct hashtb_enumerator *e = &ee;
-    struct face *face;
-    int dgram_chk = CCN_FACE_DGRAM | CCN_FACE_MCAST;
-    int dgram_want = CCN_FACE_DGRAM;
+    int res;
+    struct face *face = NULL;
+    unsigned char *addrspace;
     
-    face = face_from_faceid(h, faceid);
-    if (face == NULL)
-        return(-1);
-    if ((face->flags & dgram_chk) == dgram_want) {
-        hashtb_start(h->dgram_faces, e);
-        hashtb_seek(e, face->addr, face->addrlen, 0);
-        if (e->data == face)
+    res = fcntl(fd, F_SETFL, O_NONBLOCK);
+    if (res == -1)
+        ccnd_msg(h, "fcntl: %s", strerror(errno));
+    hashtb_start(h->faces_by_fd, e);
+    if (hashtb_seek(e, &fd, sizeof(fd), wholen) == HT_NEW_ENTRY) {
+        face = e->data;
+        face->recv_fd = fd;
+        face->sendface = CCN_NOFACEID;
+        face->addrlen = e->extsize;
+        addrspace = ((unsigned char *)e->key) + e->keysize;
+        face->addr = (struct sockaddr *)addrspace;
+        memcpy(addrspace, who, e->extsize);
+        init_face_flags(h, face, setflags);
+        res = enroll_face(h, face);
+        if (res == -1) {
+            hashtb_delete(e);
             face = NULL;
-        hashtb_delete(e);
-        hashtb_end(e);
-        if (face == NULL)
-            return(0);
+        }
+        else
+            register_face_fd(h, face);
     }
-    shutdown_client_fd(h, face->recv_fd);
-    face = NULL;
-    return(0);
+    hashtb_end(e);
+    return(face);
 }
 
 /**
- * Remove expired faces from *ip
+ * Accept an incoming SOCK_STREAM connection, creating a new face.
+ *
+ * This could be, for example, a unix-domain socket, or TCP.
+ *
+ * @returns fd of new socket, or -1 for an error.
  */
-static void
-check_forward_to(struct ccnd_handle *h, struct ccn_indexbuf **ip)
+static int
+accept_connection(struct ccnd_handle *h, int listener_fd)
 {
-    struct ccn_indexbuf *ft = *ip;
-    int i;
-    int j;
-    if (ft == NULL)
-        return;
-    for (i = 0; i < ft->n; i++)
-        if (face_from_faceid(h, ft->buf[i]) == NULL)
-            break;
-    for (j = i + 1; j < ft->n; j++)
-        if (face_from_faceid(h, ft->buf[j]) != NULL)
-            ft->buf[i++] = ft->buf[j];
-    if (i == 0)
-        ccn_indexbuf_destroy(ip);
-    else if (i < ft->n)
-        ft->n = i;
-}
-
-/**
- * Ages src info and retires unused nameprefix entries.
- * @returns number that have gone away.
+    struct sockaddr_storage who;
+    socklen_t wholen = sizeof(who);
+    int fd;
+    struct face *face;
+
+    fd = accept(listener_fd, (struct sockaddr *)&who, &wholen);
+    if (fd == -1) {
+        ccnd_msg(h, "accept: %s", strerror(errno));
+        return(-1);
+    }
+    face = record_connection(h, fd,
+                            (struct sockaddr *)&who, wholen,
+                            CCN_FACE_UNDECIDED);
+    if (face == NULL)
+        close_fd(&fd);
+    else
+        ccnd_msg(h, "accepted client fd=%d id=%u", fd, face->faceid);
+    return(fd);
+}
+
+/**
+ * Make an outbound stream connection.
  */
-static int
-check_nameprefix_entries(struct ccnd_handle *h)
+static struct face *
+make_connection(struct ccnd_handle *h,
+                struct sockaddr *who, socklen_t wholen,
+                int setflags)
 {
-    int count = 0;
     struct hashtb_enumerator ee;
     struct hashtb_enumerator *e = &ee;
-    struct ielinks *head;
-    struct nameprefix_entry *npe;    
+    int fd;
+    int res;
+    struct face *face;
+    const int checkflags = CCN_FACE_LINK | CCN_FACE_DGRAM | CCN_FACE_LOCAL |
+                           CCN_FACE_NOSEND | CCN_FACE_UNDECIDED;
+    const int wantflags = 0;
     
-    hashtb_start(h->nameprefix_tab, e);
-    for (npe = e->data; npe != NULL; npe = e->data) {
-        if (  npe->src == CCN_NOFACEID &&
-              npe->children == 0 &&
-              npe->forwarding == NULL) {
-            head = &npe->ie_head;
-            if (head == head->next) {
-                count += 1;
-                if (npe->parent != NULL) {
-                    npe->parent->children--;
-                    npe->parent = NULL;
-                }
-                hashtb_delete(e);
-                continue;
-            }
+    /* Check for an existing usable connection */
+    for (hashtb_start(h->faces_by_fd, e); e->data != NULL; hashtb_next(e)) {
+        face = e->data;
+        if (face->addr != NULL && face->addrlen == wholen &&
+            ((face->flags & checkflags) == wantflags) &&
+            0 == memcmp(face->addr, who, wholen)) {
+            hashtb_end(e);
+            return(face);
         }
-        check_forward_to(h, &npe->forward_to);
-        check_forward_to(h, &npe->tap);
-        npe->osrc = npe->src;
-        npe->src = CCN_NOFACEID;
-        hashtb_next(e);
     }
+    face = NULL;
     hashtb_end(e);
-    return(count);
-}
-
-static void
-check_comm_file(struct ccnd_handle *h)
-{
-    if (!comm_file_ok()) {
-        ccnd_msg(h, "stopping (%s gone)", unlink_this_at_exit);
-        unlink_this_at_exit = NULL;
-        h->running = 0;
+    /* No existing connection, try to make a new one. */
+    fd = socket(who->sa_family, SOCK_STREAM, 0);
+    if (fd == -1) {
+        ccnd_msg(h, "socket: %s", strerror(errno));
+        return(NULL);
+    }
+    res = fcntl(fd, F_SETFL, O_NONBLOCK);
+    if (res == -1)
+        ccnd_msg(h, "connect fcntl: %s", strerror(errno));
+    setflags &= ~CCN_FACE_CONNECTING;
+    res = connect(fd, who, wholen);
+    if (res == -1 && errno == EINPROGRESS) {
+        res = 0;
+        setflags |= CCN_FACE_CONNECTING;
+    }
+    if (res == -1) {
+        ccnd_msg(h, "connect failed: %s (errno = %d)", strerror(errno), errno);
+        close(fd);
+        return(NULL);
+    }
+    face = record_connection(h, fd, who, wholen, setflags);
+    if (face == NULL) {
+        close(fd);
+        return(NULL);
     }
+    if ((face->flags & CCN_FACE_CONNECTING) != 0) {
+        ccnd_msg(h, "connecting to client fd=%d id=%u", fd, face->faceid);
+        ccnd_update_face_events(h, face);
+    }
+    else
+        ccnd_msg(h, "connected client fd=%d id=%u", fd, face->faceid);
+    return(face);
 }
 
 /**
- * Scheduled reap event for retiring expired structures.
+ * Get a bound datagram socket.
+ *
+ * This is handed to ccn_setup_socket() when setting up a multicast face.
  */
 static int
-reap(
-    struct ccn_schedule *sched,
-    void *clienth,
-    struct ccn_scheduled_event *ev,
-    int flags)
+ccnd_getboundsocket(void *dat, struct sockaddr *who, socklen_t wholen)
 {
-    struct ccnd_handle *h = clienth;
-    (void)(sched);
-    (void)(ev);
-    if ((flags & CCN_SCHEDULE_CANCEL) != 0) {
-        h->reaper = NULL;
-        return(0);
+    struct ccnd_handle *h = dat;
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    int yes = 1;
+    int res;
+    int ans = -1;
+    int wantflags = (CCN_FACE_DGRAM | CCN_FACE_PASSIVE);
+    for (hashtb_start(h->faces_by_fd, e); e->data != NULL; hashtb_next(e)) {
+        struct face *face = e->data;
+        if ((face->flags & wantflags) == wantflags &&
+              wholen == face->addrlen &&
+              0 == memcmp(who, face->addr, wholen)) {
+            ans = face->recv_fd;
+            break;
+        }
     }
-    check_dgram_faces(h);
-    check_nameprefix_entries(h);
-    check_comm_file(h);
-    return(2 * CCN_INTEREST_LIFETIME_MICROSEC);
+    hashtb_end(e);
+    if (ans != -1)
+        return(ans);
+    ans = socket(who->sa_family, SOCK_DGRAM, 0);
+    if (ans == -1)
+        return(ans);
+    setsockopt(ans, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    res = bind(ans, who, wholen);
+    if (res == -1) {
+        ccnd_msg(h, "bind failed: %s (errno = %d)", strerror(errno), errno);
+        close(ans);
+        return(-1);
+    }
+    record_connection(h, ans, who, wholen,
+                      CCN_FACE_DGRAM | CCN_FACE_PASSIVE | CCN_FACE_NORECV);
+    return(ans);
 }
 
-static void
-reap_needed(struct ccnd_handle *h, int init_delay_usec)
+/**
+ * Get the faceid associated with a file descriptor.
+ *
+ * @returns the faceid, or CCN_NOFACEID.
+ */
+static unsigned
+faceid_from_fd(struct ccnd_handle *h, int fd)
 {
-    if (h->reaper == NULL)
-        h->reaper = ccn_schedule_event(h->sched, init_delay_usec, reap, NULL, 0);
+    struct face *face = hashtb_lookup(h->faces_by_fd, &fd, sizeof(fd));
+    if (face != NULL)
+        return(face->faceid);
+    return(CCN_NOFACEID);
 }
 
+typedef void (*loggerproc)(void *, const char *, ...);
+
 /**
- * Remove a content object from the store
+ * Set up a multicast face.
  */
-static int
-remove_content(struct ccnd_handle *h, struct content_entry *content)
+static struct face *
+setup_multicast(struct ccnd_handle *h, struct ccn_face_instance *face_instance,
+                struct sockaddr *who, socklen_t wholen)
 {
     struct hashtb_enumerator ee;
     struct hashtb_enumerator *e = &ee;
+    struct ccn_sockets socks = { -1, -1 };
     int res;
-    if (content == NULL)
-        return(-1);
-    hashtb_start(h->content_tab, e);
-    res = hashtb_seek(e, content->key,
-                      content->key_size, content->size - content->key_size);
-    if (res != HT_OLD_ENTRY)
-        abort();
-    if ((content->flags & CCN_CONTENT_ENTRY_STALE) != 0)
-        h->n_stale--;
-    if (h->debug & 4)
-        ccnd_debug_ccnb(h, __LINE__, "remove", NULL,
-                        content->key, content->size);
-    hashtb_delete(e);
+    struct face *face = NULL;
+    const int checkflags = CCN_FACE_LINK | CCN_FACE_DGRAM | CCN_FACE_MCAST |
+                           CCN_FACE_LOCAL | CCN_FACE_NOSEND;
+    const int wantflags = CCN_FACE_DGRAM | CCN_FACE_MCAST;
+
+    /* See if one is already active */
+    // XXX - should also compare and record additional mcast props.
+    for (hashtb_start(h->faces_by_fd, e); e->data != NULL; hashtb_next(e)) {
+        face = e->data;
+        if (face->addr != NULL && face->addrlen == wholen &&
+            ((face->flags & checkflags) == wantflags) &&
+            0 == memcmp(face->addr, who, wholen)) {
+            hashtb_end(e);
+            return(face);
+        }
+    }
+    face = NULL;
     hashtb_end(e);
-    return(0);
+    
+    res = ccn_setup_socket(&face_instance->descr,
+                           (loggerproc)&ccnd_msg, (void *)h,
+                           &ccnd_getboundsocket, (void *)h,
+                           &socks);
+    if (res < 0)
+        return(NULL);
+    establish_min_recv_bufsize(h, socks.recving, 128*1024);
+    face = record_connection(h, socks.recving, who, wholen,
+                             (CCN_FACE_MCAST | CCN_FACE_DGRAM));
+    if (face == NULL) {
+        close(socks.recving);
+        if (socks.sending != socks.recving)
+            close(socks.sending); // XXX - could be problematic, but record_connection is unlikely to fail for other than ENOMEM
+        return(NULL);
+    }
+    face->sendface = faceid_from_fd(h, socks.sending);
+    ccnd_msg(h, "multicast on fd=%d id=%u, sending on face %u",
+             face->recv_fd, face->faceid, face->sendface);
+    return(face);
 }
 
 /**
- * Periodic content cleaning
+ * Close a socket, destroying the associated face.
  */
-static int
-clean_daemon(struct ccn_schedule *sched,
-             void *clienth,
-             struct ccn_scheduled_event *ev,
-             int flags)
+static void
+shutdown_client_fd(struct ccnd_handle *h, int fd)
 {
-    struct ccnd_handle *h = clienth;
-    (void)(sched);
-    (void)(ev);
-    unsigned long n;
-    ccn_accession_t limit;
-    ccn_accession_t a;
-    ccn_accession_t min_stale;
-    int check_limit = 500;  /* Do not run for too long at once */
-    struct content_entry *content = NULL;
-    int res = 0;
-    int ignore;
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct face *face = NULL;
+    unsigned faceid = CCN_NOFACEID;
     int i;
     
-    /*
-     * If we ran into our processing limit (check_limit) last time,
-     * ev->evint tells us where to restart.
-     */
-    
-    if ((flags & CCN_SCHEDULE_CANCEL) != 0) {
-        h->clean = NULL;
-        return(0);
-    }
-    n = hashtb_n(h->content_tab);
-    if (n <= h->capacity) {
-        h->clean = NULL;
-        return(0);
-    }
-    /* Toss unsolicited content first */
-    for (i = 0; i < h->unsol->n; i++) {
-        if (i == check_limit) {
-            for (i = check_limit; i < h->unsol->n; i++)
-                h->unsol->buf[i-check_limit] = h->unsol->buf[i];
-            h->unsol->n -= check_limit;
-            return(500);
-        }
-        a = h->unsol->buf[i];
-        content = content_from_accession(h, a);
-        if (content != NULL &&
-            (content->flags & CCN_CONTENT_ENTRY_PRECIOUS) == 0)
-            remove_content(h, content);
-    }
-    h->unsol->n = 0;
-    n = hashtb_n(h->content_tab);
-    if (h->min_stale <= h->max_stale) {
-        /* clean out stale content next */
-        limit = h->max_stale;
-        if (limit > h->accession)
-            limit = h->accession;
-        min_stale = ~0;
-        a = ev->evint;
-        if (a <= h->min_stale || a > h->max_stale)
-            a = h->min_stale;
-        else
-            min_stale = h->min_stale;
-        for (; a <= limit && n > h->capacity; a++) {
-            if (check_limit-- <= 0) {
-                ev->evint = a;
-                break;
-            }
-            content = content_from_accession(h, a);
-            if (content != NULL &&
-                  (content->flags & CCN_CONTENT_ENTRY_STALE) != 0) {
-                res = remove_content(h, content);
-                if (res < 0) {
-                    if (a < min_stale)
-                        min_stale = a;
-                }
-                else {
-                    content = NULL;
-                    n -= 1;
-                }
+    if (h->worker != NULL) {
+        /* A worker has only the sockets of the faces it was handed */
+        for (i = 0; i < h->io_faces->n; i++) {
+            face = face_from_faceid(h, h->io_faces->buf[i]);
+            if (face != NULL && face->recv_fd == fd) {
+                face_io_close(h, face);
+                return;
             }
         }
-        if (min_stale < a)
-            h->min_stale = min_stale;
-        else if (a > limit) {
-            h->min_stale = ~0;
-            h->max_stale = 0;
-        }
-        else
-            h->min_stale = a;
-        if (check_limit <= 0)
-            return(5000);
+        return;
     }
-    else {
-        /* Make oldish content stale, for cleanup on next round */
-        limit = h->accession;
-        ignore = CCN_CONTENT_ENTRY_STALE | CCN_CONTENT_ENTRY_PRECIOUS;
-        for (a = h->accession_base; a <= limit && n > h->capacity; a++) {
-            content = content_from_accession(h, a);
-            if (content != NULL && (content->flags & ignore) == 0) {
-                mark_stale(h, content);
-                n--;
-            }
+    hashtb_start(h->faces_by_fd, e);
+    if (hashtb_seek(e, &fd, sizeof(fd), 0) == HT_OLD_ENTRY) {
+        face = e->data;
+        if (face->recv_fd != fd) abort();
+        faceid = face->faceid;
+        if (faceid == CCN_NOFACEID) {
+            ccnd_msg(h, "error indication on fd %d ignored", fd);
+            hashtb_end(e);
+            return;
         }
-        ev->evint = 0;
-        return(5000);
+        if (face->owner != h->thread) {
+            /* Its worker closes it down, and gives it back */
+            face_io_drop(h, face);
+            hashtb_end(e);
+            return;
+        }
+        unregister_face_fd(h, face);
+        close(fd);
+        face->recv_fd = -1;
+        ccnd_msg(h, "shutdown client fd=%d id=%u", fd, faceid);
+        if (face->inbuf != NULL && face->inbuf == h->rx_buf)
+            rx_unshare(h, &face->inbuf, face->inbuf->length);
+        ccn_charbuf_destroy(&face->inbuf);
+        face_outq_clear(face);
+        face = NULL;
     }
-    h->clean = NULL;
-    return(0);
+    hashtb_delete(e);
+    hashtb_end(e);
+    check_comm_file(h);
 }
 
 /**
- * Schedule clean_daemon, if it is not already scheduled.
+ * Send a ContentObject
+ *
+ * This is after it has worked its way through the queue; update the meters
+ * and stuff the packet as appropriate.
  */
 static void
-clean_needed(struct ccnd_handle *h)
+send_content(struct ccnd_handle *h, struct face *face, struct content_entry *content)
 {
-    if (h->clean == NULL)
-        h->clean = ccn_schedule_event(h->sched, 5000, clean_daemon, NULL, 0);
+    int size;
+    if ((face->flags & CCN_FACE_NOSEND) != 0) {
+        // XXX - should count this.
+        return;
+    }
+    size = content->size;
+    if (h->debug & 4)
+        ccnd_debug_ccnb(h, __LINE__, "content_to", face,
+                        content->key, size);
+    /* The thread that owns the face decides on fragments */
+    if (face->owner != h->thread || !send_fragments(h, face, content))
+        stuff_and_send(h, face, content->key, size, NULL, 0, content, 0, 0);
+    ccnd_meter_bump(h, face->meter[FM_DATO], 1);
+    h->content_items_sent += 1;
 }
 
 /**
- * Age out the old forwarding table entries
+ * Select the output queue class for a piece of content
  */
-static int
-age_forwarding(struct ccn_schedule *sched,
-             void *clienth,
-             struct ccn_scheduled_event *ev,
-             int flags)
+static enum cq_delay_class
+choose_content_delay_class(struct ccnd_handle *h, unsigned faceid, int content_flags)
 {
-    struct ccnd_handle *h = clienth;
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
-    struct ccn_forwarding *f;
-    struct ccn_forwarding *next;
-    struct ccn_forwarding **p;
-    struct nameprefix_entry *npe;
-    
-    if ((flags & CCN_SCHEDULE_CANCEL) != 0) {
-        h->age_forwarding = NULL;
-        return(0);
-    }
-    hashtb_start(h->nameprefix_tab, e);
-    for (npe = e->data; npe != NULL; npe = e->data) {
-        p = &npe->forwarding;
-        for (f = npe->forwarding; f != NULL; f = next) {
-            next = f->next;
-            if ((f->flags & CCN_FORW_REFRESHED) == 0 ||
-                  face_from_faceid(h, f->faceid) == NULL) {
-                if (h->debug & 2) {
-                    struct face *face = face_from_faceid(h, f->faceid);
-                    if (face != NULL) {
-                        struct ccn_charbuf *prefix = ccn_charbuf_create();
-                        ccn_name_init(prefix);
-                        ccn_name_append_components(prefix, e->key, 0, e->keysize);
-                        ccnd_debug_ccnb(h, __LINE__, "prefix_expiry", face,
-                                prefix->buf,
-                                prefix->length);
-                        ccn_charbuf_destroy(&prefix);
-                    }
-                }
-                *p = next;
-                free(f);
-                f = NULL;
-                continue;
-            }
-            f->expires -= CCN_FWU_SECS;
-            if (f->expires <= 0)
-                f->flags &= ~CCN_FORW_REFRESHED;
-            p = &(f->next);
-        }
-        hashtb_next(e);
-    }
-    hashtb_end(e);
-    h->forward_to_gen += 1;
-    return(CCN_FWU_SECS*1000000);
+    struct face *face = face_from_faceid(h, faceid);
+    if (face == NULL)
+        return(CCN_CQ_ASAP); /* Going nowhere, get it over with */
+    if ((face->flags & (CCN_FACE_LINK | CCN_FACE_MCAST)) != 0) /* udplink or such, delay more */
+        return((content_flags & CCN_CONTENT_ENTRY_SLOWSEND) ? CCN_CQ_SLOW : CCN_CQ_NORMAL);
+    if ((face->flags & CCN_FACE_DGRAM) != 0)
+        return(CCN_CQ_NORMAL); /* udp, delay just a little */
+    if ((face->flags & (CCN_FACE_GG | CCN_FACE_LOCAL)) != 0)
+        return(CCN_CQ_ASAP); /* localhost, answer quickly */
+    return(CCN_CQ_NORMAL); /* default */
 }
 
 /**
- * Make sure a call to age_forwarding is scheduled.
+ * Pick a randomized delay for sending
+ *
+ * This is primarily for multicast and similar broadcast situations, where we
+ * may see the content being sent by somebody else.  If that is the case,
+ * we will avoid sending our copy as well.
+ *
  */
-static void
-age_forwarding_needed(struct ccnd_handle *h)
+static unsigned
+randomize_content_delay(struct ccnd_handle *h, struct content_queue *q)
 {
-    if (h->age_forwarding == NULL)
-        h->age_forwarding = ccn_schedule_event(h->sched,
-                                               CCN_FWU_SECS*1000000,
-                                               age_forwarding,
-                                               NULL, 0);
+    unsigned usec;
+    
+    usec = q->min_usec + q->rand_usec;
+    if (usec < 2)
+        return(1);
+    if (usec <= 20 || q->rand_usec < 2) // XXX - what is a good value for this?
+        return(usec); /* small value, don't bother to randomize */
+    usec = q->min_usec + (nrand48(h->seed) % q->rand_usec);
+    if (usec < 2)
+        return(1);
+    return(usec);
 }
 
 /**
- * Look up a forwarding entry, creating it if it is not there.
+ * Bring the token bucket of a shaped face up to date.
  */
-static struct ccn_forwarding *
-seek_forwarding(struct ccnd_handle *h,
-                struct nameprefix_entry *npe, unsigned faceid)
+static void
+face_shaper_refill(struct ccnd_handle *h, struct face *face)
 {
-    struct ccn_forwarding *f;
+    long long usec;
+    long long full;
     
-    for (f = npe->forwarding; f != NULL; f = f->next)
-        if (f->faceid == faceid)
-            return(f);
-    f = calloc(1, sizeof(*f));
-    if (f != NULL) {
-        f->faceid = faceid;
-        f->flags = (CCN_FORW_CHILD_INHERIT | CCN_FORW_ACTIVE);
-        f->expires = 0x7FFFFFFF;
-        f->next = npe->forwarding;
-        npe->forwarding = f;
-    }
-    return(f);
+    usec = (h->sec - face->credit_sec) * 1000000LL +
+           ((long long)h->usec - face->credit_usec);
+    face->credit_sec = h->sec;
+    face->credit_usec = h->usec;
+    if (usec <= 0 || face->rate == 0)
+        return;
+    full = face->burst * 1000000LL;
+    if (usec >= (full - face->credit) / face->rate)
+        face->credit = full;
+    else
+        face->credit += usec * face->rate;
 }
 
 /**
- * Register or update a prefix in the forwarding table (FIB).
+ * Limit the rate at which content is sent on a face.
  *
- * @param h is the ccnd handle.
- * @param msg is a ccnb-encoded message containing the name prefix somewhere.
- * @param comps contains the delimiting offsets for the name components in msg.
- * @param ncomps is the number of relevant components.
- * @param faceid indicates which face to forward to.
- * @param flags are the forwarding entry flags (CCN_FORW_...), -1 for defaults.
- * @param expires tells the remaining lifetime, in seconds.
- * @returns -1 for error, or new flags upon success; the private flag
- *        CCN_FORW_REFRESHED indicates a previously existing entry.
+ * A rate of 0 turns shaping off.  If burst is 0, a burst of about
+ * 1/8 second's worth (but at least one big datagram) is allowed.
+ */
+static void
+face_set_shaper(struct ccnd_handle *h, struct face *face,
+                unsigned rate, unsigned burst)
+{
+    if (rate != 0 && burst == 0)
+        burst = rate / 8;
+    if (rate != 0 && burst < CCND_DGRAM_BUFSIZE)
+        burst = CCND_DGRAM_BUFSIZE;
+    face->rate = rate;
+    face->burst = (rate == 0) ? 0 : burst;
+    face->credit = face->burst * 1000000LL;
+    face->credit_sec = h->sec;
+    face->credit_usec = h->usec;
+    if (rate != 0)
+        ccnd_msg(h, "face %u shaped to %u bytes/sec, burst %u",
+                 face->faceid, face->rate, face->burst);
+}
+
+/**
+ * Scheduled event for sending from a queue.
  */
 static int
-ccnd_reg_prefix(struct ccnd_handle *h,
-                const unsigned char *msg,
-                struct ccn_indexbuf *comps,
-                int ncomps,
-                unsigned faceid,
-                int flags,
-                int expires)
+content_sender(struct ccn_schedule *sched,
+    void *clienth,
+    struct ccn_scheduled_event *ev,
+    int flags)
 {
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
-    struct ccn_forwarding *f = NULL;
-    struct nameprefix_entry *npe = NULL;
-    int res;
+    int i;
+    int delay;
+    int nsec;
+    int burst_nsec;
+    int burst_max;
+    struct ccnd_handle *h = clienth;
+    struct content_entry *content = NULL;
+    unsigned faceid = ev->evint;
     struct face *face = NULL;
+    struct content_queue *q = ev->evdata;
+    (void)sched;
     
-    if (flags >= 0 &&
-        (flags & CCN_FORW_PUBMASK) != flags)
-        return(-1);
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0)
+        goto Bail;
     face = face_from_faceid(h, faceid);
     if (face == NULL)
-        return(-1);
-    /* This is a bit hacky, but it gives us a way to set CCN_FACE_DC */
-    if (flags >= 0 && (flags & CCN_FORW_LAST) != 0)
-        face->flags |= CCN_FACE_DC;
-    hashtb_start(h->nameprefix_tab, e);
-    res = nameprefix_seek(h, e, msg, comps, ncomps);
-    if (res >= 0) {
-        res = (res == HT_OLD_ENTRY) ? CCN_FORW_REFRESHED : 0;
-        npe = e->data;
-        f = seek_forwarding(h, npe, faceid);
-        if (f != NULL) {
-            h->forward_to_gen += 1; // XXX - too conservative, should check changes
-            f->expires = expires;
-            if (flags < 0)
-                flags = f->flags & CCN_FORW_PUBMASK;
-            f->flags = (CCN_FORW_REFRESHED | flags);
-            res |= flags;
-            if (h->debug & (2 | 4)) {
-                struct ccn_charbuf *prefix = ccn_charbuf_create();
-                struct ccn_charbuf *debugtag = ccn_charbuf_create();
-                ccn_charbuf_putf(debugtag, "prefix,ff=%s%x",
-                                 flags > 9 ? "0x" : "", flags);
-                if (f->expires < (1 << 30))
-                    ccn_charbuf_putf(debugtag, ",sec=%d", expires);
-                ccn_name_init(prefix);
-                ccn_name_append_components(prefix, msg,
-                                           comps->buf[0], comps->buf[ncomps]);
-                ccnd_debug_ccnb(h, __LINE__,
-                                ccn_charbuf_as_string(debugtag),
-                                face,
-                                prefix->buf,
-                                prefix->length);
-                ccn_charbuf_destroy(&prefix);
-                ccn_charbuf_destroy(&debugtag);
-            }
-        }
-        else
-            res = -1;
+        goto Bail;
+    if ((face->flags & CCN_FACE_NOSEND) != 0)
+        goto Bail;
+    /* Hold off while the stream is backed up; see face_outq_drained() */
+    if (face->outq_bytes >= CCND_OUTQ_HIWAT)
+        goto Bail;
+    /* Send the content at the head of the queue */
+    if (q->ready > q->n ||
+        (q->ready == 0 && q->nrun >= 12 && q->nrun < 120))
+        q->ready = q->n;
+    nsec = 0;
+    burst_nsec = q->burst_nsec;
+    burst_max = h->data_burst;
+    if (q->ready < burst_max)
+        burst_max = q->ready;
+    if (burst_max == 0)
+        q->nrun = 0;
+    if (face->rate != 0)
+        face_shaper_refill(h, face);
+    for (i = 0; i < burst_max && nsec < 1000000 &&
+                face->outq_bytes < CCND_OUTQ_HIWAT &&
+                (face->rate == 0 || face->credit >= 0); i++) {
+        content = content_queue_shift(h, face, q);
+        if (content == NULL)
+            q->nrun = 0;
+        else {
+            send_content(h, face, content);
+            /* face may have vanished, bail out if it did */
+            if (face_from_faceid(h, faceid) == NULL)
+                goto Bail;
+            nsec += burst_nsec * (unsigned)((content->size + 1023) / 1024);
+            if (face->rate != 0)
+                face->credit -= content->size * 1000000LL;
+            q->nrun++;
+        }
     }
-    hashtb_end(e);
-    if (res >= 0)
-        update_npe_children(h, npe, faceid);
-    return(res);
+    if (q->ready < i) abort();
+    q->ready -= i;
+    /* Do a poll before going on to allow others to preempt send. */
+    delay = (nsec + 499) / 1000 + 1;
+    if (q->ready > 0 && face->rate != 0 && face->credit < 0) {
+        /* Wait for the token bucket to refill enough */
+        long long wait = -face->credit / face->rate + 1;
+        if (wait > 10000000)
+            wait = 10000000;
+        if (wait > delay)
+            delay = wait;
+    }
+    if (q->ready > 0) {
+        if (h->debug & 8)
+            ccnd_msg(h, "face %u ready %u delay %i nrun %u",
+                     faceid, q->ready, delay, q->nrun, face->surplus);
+        return(delay);
+    }
+    q->ready = q->n;
+    if (q->nrun >= 12 && q->nrun < 120) {
+        /* We seem to be a preferred provider, forgo the randomized delay */
+        if (q->n == 0)
+            delay += burst_nsec / 50;
+        if (h->debug & 8)
+            ccnd_msg(h, "face %u ready %u delay %i nrun %u surplus %u",
+                    (unsigned)ev->evint, q->ready, delay, q->nrun, face->surplus);
+        return(delay);
+    }
+    /* Determine when to run again */
+    for (i = 0; i < q->n; i++) {
+        content = content_from_accession(h,
+                                         q->ring[(q->head + i) & (q->ring_size - 1)]);
+        if (content != NULL) {
+            q->nrun = 0;
+            delay = randomize_content_delay(h, q);
+            if (h->debug & 8)
+                ccnd_msg(h, "face %u queued %u delay %i",
+                         (unsigned)ev->evint, q->ready, delay);
+            return(delay);
+        }
+    }
+    while (q->n > 0)
+        content_queue_shift(h, face, q);
+    q->ready = 0;
+Bail:
+    q->sender = NULL;
+    return(0);
 }
 
 /**
- * Register a prefix, expressed in the form of a URI.
- * @returns negative value for error, or new face flags for success.
+ * Queue a ContentObject to be sent on a face.
  */
-int
-ccnd_reg_uri(struct ccnd_handle *h,
-             const char *uri,
-             unsigned faceid,
-             int flags,
-             int expires)
+static int
+face_send_queue_insert(struct ccnd_handle *h,
+                       struct face *face, struct content_entry *content)
 {
-    struct ccn_charbuf *name;
-    struct ccn_buf_decoder decoder;
-    struct ccn_buf_decoder *d;
-    struct ccn_indexbuf *comps;
-    int res;
-    
-    name = ccn_charbuf_create();
-    ccn_name_init(name);
-    res = ccn_name_from_uri(name, uri);
-    if (res < 0)
-        goto Bail;
-    comps = ccn_indexbuf_create();
-    d = ccn_buf_decoder_start(&decoder, name->buf, name->length);
-    res = ccn_parse_Name(d, comps);
-    if (res < 0)
-        goto Bail;
-    res = ccnd_reg_prefix(h, name->buf, comps, comps->n - 1,
-                          faceid, flags, expires);
-Bail:
-    ccn_charbuf_destroy(&name);
-    ccn_indexbuf_destroy(&comps);
-    return(res);
+    int ans;
+    int delay;
+    enum cq_delay_class c;
+    struct content_queue *q;
+    struct queued_content *qc;
+    if (face == NULL || content == NULL || (face->flags & CCN_FACE_NOSEND) != 0)
+        return(-1);
+    c = choose_content_delay_class(h, face->faceid, content->flags);
+    if (face->q[c] == NULL)
+        face->q[c] = content_queue_create(h, face, c);
+    q = face->q[c];
+    if (q == NULL)
+        return(-1);
+    /* It might be queued already, perhaps in one of the other queues */
+    qc = face_queued_lookup(face, content->accession);
+    if (qc != NULL) {
+        if (qc->c != c && (h->debug & 8))
+            ccnd_debug_ccnb(h, __LINE__, "content_otherq", face,
+                            content->key, content->size);
+        return(qc->seq - face->q[qc->c]->head);
+    }
+    ans = content_queue_append(face, q, c, content->accession);
+    if (ans < 0)
+        return(-1);
+    if (q->sender == NULL) {
+        delay = randomize_content_delay(h, q);
+        q->ready = q->n;
+        q->sender = ccn_schedule_event(h->sched, delay,
+                                       content_sender, q, face->faceid);
+        if (h->debug & 8)
+            ccnd_msg(h, "face %u q %d delay %d usec", face->faceid, c, delay);
+    }
+    return (ans);
 }
 
 /**
- * Register prefixes, expressed in the form of a list of URIs.
- * The URIs in the charbuf are each terminated by nul.
+ * Return true iff the interest is pending on the given face
  */
-void
-ccnd_reg_uri_list(struct ccnd_handle *h,
-             struct ccn_charbuf *uris,
-             unsigned faceid,
-             int flags,
-             int expires)
+static int
+is_pending_on(struct ccnd_handle *h, struct interest_entry *ie, unsigned faceid)
 {
-    size_t i;
-    const char *s;
-    s = ccn_charbuf_as_string(uris);
-    for (i = 0; i + 1 < uris->length; i += strlen(s + i) + 1)
-        ccnd_reg_uri(h, s + i, faceid, flags, expires);
+    struct pit_face_item *x;
+    
+    for (x = ie->pfl; x != NULL; x = x->next) {
+        if (x->faceid == faceid && (x->pfi_flags & CCND_PFI_PENDING) != 0)
+            return(1);
+        // XXX - depending on how list is ordered, an early out might be possible
+        // For now, we assume no particular ordering
+    }
+    return(0);
 }
 
 /**
- * Called when a face is first created, and (perhaps) a second time in the case
- * that a face transitions from the undecided state.
+ * Send content to the downstreams of an interest it satisfies, and
+ * consume the interest.
  */
 static void
-register_new_face(struct ccnd_handle *h, struct face *face)
+consume_satisfied_interest(struct ccnd_handle *h, struct interest_entry *p,
+                           struct content_entry *content,
+                           struct face *from_face)
 {
-    if (face->faceid != 0 && (face->flags & (CCN_FACE_UNDECIDED | CCN_FACE_PASSIVE)) == 0) {
-        ccnd_face_status_change(h, face->faceid);
-        if (h->flood && h->autoreg != NULL && (face->flags & CCN_FACE_GG) == 0)
-            ccnd_reg_uri_list(h, h->autoreg, face->faceid,
-                              CCN_FORW_CAPTURE_OK | CCN_FORW_CHILD_INHERIT | CCN_FORW_ACTIVE,
-                              0x7FFFFFFF);
-        ccn_link_state_init(h, face);
+    struct pit_face_item *x;
+    
+    for (x = p->pfl; x != NULL; x = x->next) {
+        if ((x->pfi_flags & CCND_PFI_PENDING) != 0)
+            face_send_queue_insert(h, face_from_faceid(h, x->faceid),
+                                   content);
     }
+    if (from_face != NULL)
+        note_upstream_rtt(h, p, from_face->faceid);
+    strategy_callout(h, p, CCNST_SATISFIED);
+    consume_interest(h, p);
 }
 
 /**
- * Replaces contents of reply_body with a ccnb-encoded StatusResponse.
+ * Consume matching interests
+ * given a nameprefix_entry and a piece of content.
  *
- * @returns CCN_CONTENT_NACK, or -1 in case of error.
+ * The caller ensures that the name of npe is a prefix of the content name
+ * (counting the implicit digest), so the interests on the ie_exact list
+ * all match without further checking.  Only the ones with selectors need
+ * to be examined.
+ *
+ * If face is not NULL, pay attention only to interests from that face.
+ * It is allowed to pass NULL for pc, but if you have a (valid) one it
+ * will avoid a re-parse.
+ * For new content, from_face is the source; for old content, from_face is NULL.
+ * @returns number of matches found.
  */
 static int
-ccnd_nack(struct ccnd_handle *h, struct ccn_charbuf *reply_body,
-          int errcode, const char *errtext)
+consume_matching_interests(struct ccnd_handle *h,
+                           struct nameprefix_entry *npe,
+                           struct content_entry *content,
+                           struct ccn_parsed_ContentObject *pc,
+                           struct face *face, struct face *from_face)
 {
-    int res;
-    reply_body->length = 0;
-    res = ccn_encode_StatusResponse(reply_body, errcode, errtext);
-    if (res == 0)
-        res = CCN_CONTENT_NACK;
-    return(res);
+    int matches = 0;
+    struct ielinks *head;
+    struct ielinks *next;
+    struct ielinks *pl;
+    struct interest_entry *p;
+    const unsigned char *content_msg;
+    size_t content_size;
+    
+    head = &npe->ie_exact;
+    for (pl = head->next; pl != head; pl = next) {
+        next = pl->next;
+        p = (struct interest_entry *)pl;
+        if (p->interest_msg == NULL)
+            continue;
+        if (face != NULL && is_pending_on(h, p, face->faceid) == 0)
+            continue;
+        matches += 1;
+        consume_satisfied_interest(h, p, content, from_face);
+    }
+    head = &npe->ie_head;
+    content_msg = content->key;
+    content_size = content->size;
+    for (pl = head->next; pl != head; pl = next) {
+        next = pl->next;
+        p = (struct interest_entry *)pl;
+        if (p->interest_msg == NULL)
+            continue;
+        if (face != NULL && is_pending_on(h, p, face->faceid) == 0)
+            continue;
+        if (ccn_content_matches_interest_excl(content_msg, content_size, 1,
+                                              pc, p->interest_msg, p->size,
+                                              NULL, p->excl)) {
+            matches += 1;
+            consume_satisfied_interest(h, p, content, from_face);
+        }
+    }
+    return(matches);
 }
 
 /**
- * Check that indicated ccndid matches ours.
+ * Adjust the predicted response associated with a name prefix entry.
  *
- * Fills reply_body with a StatusResponse in case of no match.
+ * It is decreased by a small fraction if we get content within our
+ * previous predicted value, and increased by a larger fraction if not.
  *
- * @returns 0 if OK, or CCN_CONTENT_NACK if not.
  */
-static int
-check_ccndid(struct ccnd_handle *h,
-             const void *p, size_t sz, struct ccn_charbuf *reply_body)
+static void
+adjust_npe_predicted_response(struct ccnd_handle *h,
+                              struct nameprefix_entry *npe, int up)
 {
-    if (sz != sizeof(h->ccnd_id) || memcmp(p, h->ccnd_id, sz) != 0)
-        return(ccnd_nack(h, reply_body, 531, "missing or incorrect ccndid"));
-    return(0);
+    unsigned t = npe->usec;
+    if (up)
+        t = t + (t >> 3);
+    else
+        t = t - (t >> 7);
+    if (t < 127)
+        t = 127;
+    else if (t > 160000)
+        t = 160000;
+    npe->usec = t;
 }
 
 /**
- * Check ccndid, given a face instance.
+ * Adjust the predicted responses for an interest.
+ *
+ * We adjust two npes, so that the parents are informed about activity
+ * at the leaves.
+ *
  */
-static int
-check_face_instance_ccndid(struct ccnd_handle *h,
-    struct ccn_face_instance *f, struct ccn_charbuf *reply_body)
+static void
+adjust_predicted_response(struct ccnd_handle *h,
+                          struct interest_entry *ie, int up)
 {
-    return(check_ccndid(h, f->ccnd_id, f->ccnd_id_size, reply_body));
+    struct nameprefix_entry *npe;
+        
+    npe = ie->ll.npe;
+    if (npe == NULL)
+        return;
+    adjust_npe_predicted_response(h, npe, up);
+    if (npe->parent != NULL)
+        adjust_npe_predicted_response(h, npe->parent, up);
 }
 
 /**
- * Check ccndid, given a parsed ForwardingEntry.
+ * Keep a little history about where matching content comes from.
  */
-static int
-check_forwarding_entry_ccndid(struct ccnd_handle *h,
-    struct ccn_forwarding_entry *f, struct ccn_charbuf *reply_body)
+static void
+note_content_from(struct ccnd_handle *h,
+                  struct nameprefix_entry *npe,
+                  unsigned from_faceid,
+                  int prefix_comps)
 {
-    return(check_ccndid(h, f->ccnd_id, f->ccnd_id_size, reply_body));
+    if (npe->src == from_faceid)
+        adjust_npe_predicted_response(h, npe, 0);
+    else if (npe->src == CCN_NOFACEID)
+        npe->src = from_faceid;
+    else {
+        npe->osrc = npe->src;
+        npe->src = from_faceid;
+    }
+    if (h->debug & 8)
+        ccnd_msg(h, "sl.%d %u ci=%d osrc=%u src=%u usec=%d", __LINE__,
+                 from_faceid, prefix_comps, npe->osrc, npe->src, npe->usec);
 }
 
 /**
- * Process a newface request for the ccnd internal client.
+ * Find the forwarding entry that sends interests under npe to a face.
  *
- * @param h is the ccnd handle
- * @param msg points to a ccnd-encoded ContentObject containing a
- *         FaceInstance in its Content.
- * @param size is its size in bytes
- * @param reply_body is a buffer to hold the Content of the reply, as a
- *         FaceInstance including faceid
- * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK to
- *         set the response type to NACK.
+ * The entry may belong to npe or to any shorter prefix.
+ * @returns NULL if there is none.
+ */
+static struct ccn_forwarding *
+forwarding_for_face(struct nameprefix_entry *npe, unsigned faceid)
+{
+    struct ccn_forwarding *f;
+    
+    for (; npe != NULL; npe = npe->parent)
+        for (f = npe->forwarding; f != NULL; f = f->next)
+            if (f->faceid == faceid)
+                return(f);
+    return(NULL);
+}
+
+/**
+ * Fold a response time sample into a forwarding entry.
  *
- * Is is permitted for the face to already exist.
- * A newly created face will have no registered prefixes, and so will not
- * receive any traffic.
+ * This follows the usual SRTT/RTTVAR computation (RFC 6298), with
+ * times in microseconds.
  */
-int
-ccnd_req_newface(struct ccnd_handle *h,
-                 const unsigned char *msg, size_t size,
-                 struct ccn_charbuf *reply_body)
+static void
+forwarding_rtt_sample(struct ccn_forwarding *f, unsigned rtt)
 {
-    struct ccn_parsed_ContentObject pco = {0};
-    int res;
-    const unsigned char *req;
-    size_t req_size;
-    struct ccn_face_instance *face_instance = NULL;
-    struct addrinfo hints = {0};
-    struct addrinfo *addrinfo = NULL;
-    int mcast;
-    struct face *face = NULL;
-    struct face *reqface = NULL;
-    struct face *newface = NULL;
-    int save;
-    int nackallowed = 0;
+    unsigned delta;
+    unsigned rto;
+    
+    if (f->srtt == 0) {
+        f->srtt = rtt + 1;
+        f->rttvar = rtt / 2;
+    }
+    else {
+        delta = (f->srtt > rtt) ? f->srtt - rtt : rtt - f->srtt;
+        f->rttvar = f->rttvar - (f->rttvar >> 2) + (delta >> 2);
+        f->srtt = f->srtt - (f->srtt >> 3) + (rtt >> 3);
+    }
+    rto = f->srtt + 4 * f->rttvar;
+    if (rto < CCND_RTO_MIN)
+        rto = CCND_RTO_MIN;
+    else if (rto > CCND_RTO_MAX)
+        rto = CCND_RTO_MAX;
+    f->rto = rto;
+}
 
-    save = h->flood;
-    h->flood = 0; /* never auto-register for these */
-    res = ccn_parse_ContentObject(msg, size, &pco, NULL);
-    if (res < 0)
-        goto Finish;
-    res = ccn_content_get_value(msg, size, &pco, &req, &req_size);
-    if (res < 0)
-        goto Finish;
-    res = -1;
-    face_instance = ccn_face_instance_parse(req, req_size);
-    if (face_instance == NULL || face_instance->action == NULL)
-        goto Finish;
-    if (strcmp(face_instance->action, "newface") != 0)
-        goto Finish;
-    /* consider the source ... */
-    reqface = face_from_faceid(h, h->interest_faceid);
-    if (reqface == NULL ||
-        (reqface->flags & (CCN_FACE_LOOPBACK | CCN_FACE_LOCAL)) == 0)
-        goto Finish;
-    nackallowed = 1;
-    res = check_face_instance_ccndid(h, face_instance, reply_body);
-    if (res != 0)
-        goto Finish;
-    if (face_instance->descr.ipproto != IPPROTO_UDP &&
-        face_instance->descr.ipproto != IPPROTO_TCP) {
-        res = ccnd_nack(h, reply_body, 504, "parameter error");
-        goto Finish;
+/**
+ * Update the response time estimate for an upstream that answered.
+ *
+ * Called when content from faceid satisfies ie.  Following Karn, there
+ * is no sample if the interest was sent to that face more than once.
+ */
+static void
+note_upstream_rtt(struct ccnd_handle *h, struct interest_entry *ie,
+                  unsigned faceid)
+{
+    struct pit_face_item *p;
+    struct ccn_forwarding *f;
+    unsigned rtt;
+    
+    for (p = ie->pfl; p != NULL; p = p->next) {
+        if (p->faceid == faceid && (p->pfi_flags & CCND_PFI_UPSTREAM) != 0)
+            break;
     }
-    if (face_instance->descr.address == NULL) {
-        res = ccnd_nack(h, reply_body, 504, "parameter error");
-        goto Finish;
+    if (p == NULL || (p->pfi_flags & CCND_PFI_UPENDING) == 0 ||
+        (p->pfi_flags & CCND_PFI_RESENT) != 0)
+        return;
+    f = forwarding_for_face(ie->ll.npe, faceid);
+    if (f == NULL)
+        return;
+    rtt = ccnd_usec_clock(h) - p->sent_usec;
+    if (rtt > (~0U >> 1))
+        return; /* clock went backward */
+    if (rtt > 4 * CCND_RTO_MAX)
+        rtt = 4 * CCND_RTO_MAX;
+    forwarding_rtt_sample(f, rtt);
+    if (h->debug & 8)
+        ccnd_msg(h, "rtt.%d face %u sample %u srtt %u rttvar %u rto %u",
+                 __LINE__, faceid, rtt, f->srtt, f->rttvar, f->rto);
+}
+
+/**
+ * Find and consume interests that match given content.
+ *
+ * Schedules the sending of the content.
+ * If face is not NULL, pay attention only to interests from that face.
+ * It is allowed to pass NULL for pc, but if you have a (valid) one it
+ * will avoid a re-parse.
+ * For new content, from_face is the source; for old content, from_face is NULL.
+ * @returns number of matches, or -1 if the new content should be dropped.
+ */
+static int
+match_interests(struct ccnd_handle *h, struct content_entry *content,
+                           struct ccn_parsed_ContentObject *pc,
+                           struct face *face, struct face *from_face)
+{
+    int n_matched = 0;
+    int new_matches;
+    int ci;
+    int cm = 0;
+    unsigned c0 = content->comps[0];
+    const unsigned char *key = content->key + c0;
+    struct nameprefix_entry *npe = NULL;
+    struct ccn_parsed_ContentObject pc_store;
+    struct ccn_charbuf *name;
+    struct ccn_indexbuf *hashes;
+    size_t *ph;
+    struct hashtb_hash_state hs;
+    
+    if (pc == NULL) {
+        if (content_parse(content, &pc_store) < 0)
+            return(0);
+        pc = &pc_store;
     }
-    if (face_instance->descr.port == NULL) {
-        res = ccnd_nack(h, reply_body, 504, "parameter error");
-        goto Finish;
+    /* Hash all the prefixes in one pass, then look up longest first */
+    hashes = indexbuf_obtain(h);
+    ph = ccn_indexbuf_reserve(hashes, content->ncomps);
+    if (ph == NULL) {
+        indexbuf_release(h, hashes);
+        return(0);
     }
-    if ((reqface->flags & CCN_FACE_GG) == 0) {
-        res = ccnd_nack(h, reply_body, 430, "not authorized");
-        goto Finish;
+    hashtb_hash_start(&hs);
+    for (ci = 0; ci < content->ncomps; ci++) {
+        if (ci > 0)
+            hashtb_hash_step(&hs, content->key + content->comps[ci - 1],
+                             content->comps[ci] - content->comps[ci - 1]);
+        ph[ci] = hashtb_hash_final(&hs);
     }
-    hints.ai_flags |= AI_NUMERICHOST;
-    hints.ai_protocol = face_instance->descr.ipproto;
-    hints.ai_socktype = (hints.ai_protocol == IPPROTO_UDP) ? SOCK_DGRAM : SOCK_STREAM;
-    res = getaddrinfo(face_instance->descr.address,
-                      face_instance->descr.port,
-                      &hints,
-                      &addrinfo);
-    if (res != 0 || (h->debug & 128) != 0)
-        ccnd_msg(h, "ccnd_req_newface from %u: getaddrinfo(%s, %s, ...) returned %d",
-                 h->interest_faceid,
-                 face_instance->descr.address,
-                 face_instance->descr.port,
-                 res);
-    if (res != 0 || addrinfo == NULL) {
-        res = ccnd_nack(h, reply_body, 501, "syntax error in address");
-        goto Finish;
+    for (ci = content->ncomps - 1; ci >= 0; ci--) {
+        int size = content->comps[ci] - c0;
+        npe = hashtb_lookup_hashed(h->nameprefix_tab, key, size, ph[ci]);
+        if (npe != NULL)
+            break;
     }
-    if (addrinfo->ai_next != NULL)
-        ccnd_msg(h, "ccnd_req_newface: (addrinfo->ai_next != NULL) ? ?");
-    if (face_instance->descr.ipproto == IPPROTO_UDP) {
-        mcast = 0;
-        if (addrinfo->ai_family == AF_INET) {
-            face = face_from_faceid(h, h->ipv4_faceid);
-            mcast = IN_MULTICAST(ntohl(((struct sockaddr_in *)(addrinfo->ai_addr))->sin_addr.s_addr));
-        }
-        else if (addrinfo->ai_family == AF_INET6) {
-            face = face_from_faceid(h, h->ipv6_faceid);
-            mcast = IN6_IS_ADDR_MULTICAST(&((struct sockaddr_in6 *)addrinfo->ai_addr)->sin6_addr);
-        }
-        if (mcast)
-            face = setup_multicast(h, face_instance,
-                                   addrinfo->ai_addr,
-                                   addrinfo->ai_addrlen);
-        if (face == NULL) {
-            res = ccnd_nack(h, reply_body, 453, "could not setup multicast");
-            goto Finish;
+    indexbuf_release(h, hashes);
+    if (npe != NULL && ci == content->ncomps - 1 && npe->children > 0) {
+        /* Interests may name the implicit digest component explicitly */
+        struct nameprefix_entry *dnpe;
+        name = charbuf_obtain(h);
+        ccn_charbuf_append(name, key, content->comps[ci] - c0);
+        content_append_digest_comp(h, name, content);
+        dnpe = hashtb_lookup(h->nameprefix_tab, name->buf, name->length);
+        charbuf_release(h, name);
+        if (dnpe != NULL) {
+            npe = dnpe;
+            ci++;
         }
-        newface = get_dgram_source(h, face,
-                                   addrinfo->ai_addr,
-                                   addrinfo->ai_addrlen,
-                                   0);
     }
-    else if (addrinfo->ai_socktype == SOCK_STREAM) {
-        newface = make_connection(h,
-                                  addrinfo->ai_addr,
-                                  addrinfo->ai_addrlen,
-                                  0);
-    }
-    if (newface != NULL) {
-        newface->flags |= CCN_FACE_PERMANENT;
-        face_instance->action = NULL;
-        face_instance->ccnd_id = h->ccnd_id;
-        face_instance->ccnd_id_size = sizeof(h->ccnd_id);
-        face_instance->faceid = newface->faceid;
-        face_instance->lifetime = 0x7FFFFFFF;
-        /*
-         * A short lifetime is a clue to the client that
-         * the connection has not been completed.
-         */
-        if ((newface->flags & CCN_FACE_CONNECTING) != 0)
-            face_instance->lifetime = 1;
-        res = ccnb_append_face_instance(reply_body, face_instance);
-        if (res > 0)
-            res = 0;
+    for (; npe != NULL; npe = npe->parent, ci--) {
+        if (npe->fgen != h->forward_to_gen)
+            update_forward_to(h, npe);
+        if (from_face != NULL && (npe->flags & CCN_FORW_LOCAL) != 0 &&
+            (from_face->flags & CCN_FACE_GG) == 0)
+            return(-1);
+        new_matches = consume_matching_interests(h, npe, content, pc,
+                                                 face, from_face);
+        if (from_face != NULL && (new_matches != 0 || ci + 1 == cm))
+            note_content_from(h, npe, from_face->faceid, ci);
+        if (new_matches != 0) {
+            cm = ci; /* update stats for this prefix and one shorter */
+            n_matched += new_matches;
+        }
     }
-    else
-        res = ccnd_nack(h, reply_body, 450, "could not create face");
-Finish:
-    h->flood = save; /* restore saved flood flag */
-    ccn_face_instance_destroy(&face_instance);
-    if (addrinfo != NULL)
-        freeaddrinfo(addrinfo);
-    return((nackallowed || res <= 0) ? res : -1);
+    content_note_digest(h, content, pc);
+    return(n_matched);
 }
 
 /**
- * @brief Process a destroyface request for the ccnd internal client.
- * @param h is the ccnd handle
- * @param msg points to a ccnd-encoded ContentObject containing a FaceInstance
-            in its Content.
- * @param size is its size in bytes
- * @param reply_body is a buffer to hold the Content of the reply, as a
- *         FaceInstance including faceid
- * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK to
- *         set the response type to NACK.
+ * A received buffer shared by the packets that refer to messages in it.
+ */
+struct ccnd_rxbuf {
+    int refs;                   /**< holders (atomic) */
+    struct ccn_charbuf *buf;
+};
+
+/**
+ * A stand-in for content in the store of another thread, while this
+ * thread sends it.
  *
- * Is is an error if the face does not exist.
+ * The entry has an accession of its own, so that the send queues and
+ * the link layer find it as they would stored content, but it is not
+ * in the store.  Its key is that of the content, which is pinned until
+ * the stand-in is released.
+ */
+struct ccnd_transit {
+    struct content_entry content; /**< must come first */
+    struct content_entry *origin; /**< what it stands in for */
+    int thread;                 /**< the thread that stores the origin */
+    struct ccnd_transit *next;
+    unsigned until;             /**< usec clock at which it may go */
+};
+
+static void
+rxbuf_release(struct ccnd_rxbuf *rx)
+{
+    if (__atomic_sub_fetch(&rx->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    ccn_charbuf_destroy(&rx->buf);
+    free(rx);
+}
+
+/**
+ * Make a packet refer to a message.
+ *
+ * A message in the buffer being parsed (h->rx_buf) is shared with it;
+ * anything else is copied.
+ * @returns 0, or -1 if out of memory.
  */
-int
-ccnd_req_destroyface(struct ccnd_handle *h,
-                     const unsigned char *msg, size_t size,
-                     struct ccn_charbuf *reply_body)
+static int
+rx_hold(struct ccnd_handle *h, struct ccnd_packet *p,
+        const unsigned char *msg, size_t size)
 {
-    struct ccn_parsed_ContentObject pco = {0};
-    int res;
-    int at = 0;
-    const unsigned char *req;
-    size_t req_size;
-    struct ccn_face_instance *face_instance = NULL;
-    struct face *reqface = NULL;
-    int nackallowed = 0;
-
-    res = ccn_parse_ContentObject(msg, size, &pco, NULL);
-    if (res < 0) { at = __LINE__; goto Finish; }
-    res = ccn_content_get_value(msg, size, &pco, &req, &req_size);
-    if (res < 0) { at = __LINE__; goto Finish; }
-    res = -1;
-    face_instance = ccn_face_instance_parse(req, req_size);
-    if (face_instance == NULL) { at = __LINE__; goto Finish; }
-    if (face_instance->action == NULL) { at = __LINE__; goto Finish; }
-    /* consider the source ... */
-    reqface = face_from_faceid(h, h->interest_faceid);
-    if (reqface == NULL) { at = __LINE__; goto Finish; }
-    if ((reqface->flags & CCN_FACE_GG) == 0) { at = __LINE__; goto Finish; }
-    nackallowed = 1;
-    if (strcmp(face_instance->action, "destroyface") != 0)
-        { at = __LINE__; goto Finish; }
-    res = check_face_instance_ccndid(h, face_instance, reply_body);
-    if (res != 0)
-        { at = __LINE__; goto Finish; }
-    if (face_instance->faceid == 0) { at = __LINE__; goto Finish; }
-    res = ccnd_destroy_face(h, face_instance->faceid);
-    if (res < 0) { at = __LINE__; goto Finish; }
-    face_instance->action = NULL;
-    face_instance->ccnd_id = h->ccnd_id;
-    face_instance->ccnd_id_size = sizeof(h->ccnd_id);
-    face_instance->lifetime = 0;
-    res = ccnb_append_face_instance(reply_body, face_instance);
-    if (res < 0) {
-        at = __LINE__;
+    struct ccn_charbuf *b = h->rx_buf;
+    struct ccnd_rxbuf *rx;
+    
+    if (b != NULL && msg >= b->buf && msg + size <= b->buf + b->length) {
+        if (h->rx_ref == NULL) {
+            h->rx_ref = calloc(1, sizeof(*h->rx_ref));
+            if (h->rx_ref == NULL)
+                return(-1);
+            h->rx_ref->refs = 1; /* for the reader */
+            h->rx_ref->buf = b;
+        }
+        rx = h->rx_ref;
+        __atomic_add_fetch(&rx->refs, 1, __ATOMIC_RELAXED);
     }
-Finish:
-    if (at != 0) {
-        ccnd_msg(h, "ccnd_req_destroyface failed (line %d, res %d)", at, res);
-        if (reqface == NULL || (reqface->flags & CCN_FACE_GG) == 0)
-            res = -1;
-        else
-            res = ccnd_nack(h, reply_body, 450, "could not destroy face");
+    else {
+        rx = calloc(1, sizeof(*rx));
+        if (rx == NULL)
+            return(-1);
+        rx->buf = ccn_charbuf_create();
+        if (rx->buf == NULL || ccn_charbuf_append(rx->buf, msg, size) < 0) {
+            ccn_charbuf_destroy(&rx->buf);
+            free(rx);
+            return(-1);
+        }
+        msg = rx->buf->buf;
+        rx->refs = 1;
     }
-    ccn_face_instance_destroy(&face_instance);
-    return((nackallowed || res <= 0) ? res : -1);
+    p->rx = rx;
+    p->msg = msg;
+    p->size = size;
+    return(0);
 }
 
 /**
- * Worker bee for two very similar public functions.
+ * Finish with the buffer being parsed.
+ *
+ * If packets have been given messages in it, *pbuf is left to them,
+ * and is replaced by a new buffer holding what is there from keep on,
+ * or by NULL if that is nothing.
+ * @returns 1 if the buffer was left to packets, else 0.
  */
 static int
-ccnd_req_prefix_or_self_reg(struct ccnd_handle *h,
-                            const unsigned char *msg, size_t size, int selfreg,
-                            struct ccn_charbuf *reply_body)
+rx_unshare(struct ccnd_handle *h, struct ccn_charbuf **pbuf, size_t keep)
 {
-    struct ccn_parsed_ContentObject pco = {0};
-    int res;
-    const unsigned char *req;
-    size_t req_size;
-    struct ccn_forwarding_entry *forwarding_entry = NULL;
-    struct face *face = NULL;
-    struct face *reqface = NULL;
-    struct ccn_indexbuf *comps = NULL;
-    int nackallowed = 0;
-
-    res = ccn_parse_ContentObject(msg, size, &pco, NULL);
-    if (res < 0)
-        goto Finish;
-    res = ccn_content_get_value(msg, size, &pco, &req, &req_size);
-    if (res < 0)
-        goto Finish;
-    res = -1;
-    forwarding_entry = ccn_forwarding_entry_parse(req, req_size);
-    if (forwarding_entry == NULL || forwarding_entry->action == NULL)
-        goto Finish;
-    /* consider the source ... */
-    reqface = face_from_faceid(h, h->interest_faceid);
-    if (reqface == NULL)
-        goto Finish;
-    if ((reqface->flags & (CCN_FACE_GG | CCN_FACE_REGOK)) == 0)
-        goto Finish;
-    nackallowed = 1;
-    if (selfreg) {
-        if (strcmp(forwarding_entry->action, "selfreg") != 0)
-            goto Finish;
-        if (forwarding_entry->faceid == CCN_NOFACEID)
-            forwarding_entry->faceid = h->interest_faceid;
-        else if (forwarding_entry->faceid != h->interest_faceid)
-            goto Finish;
-    }
-    else {
-        if (strcmp(forwarding_entry->action, "prefixreg") != 0)
-        goto Finish;
-    }
-    if (forwarding_entry->name_prefix == NULL)
-        goto Finish;
-    if (forwarding_entry->ccnd_id_size == sizeof(h->ccnd_id)) {
-        if (memcmp(forwarding_entry->ccnd_id,
-                   h->ccnd_id, sizeof(h->ccnd_id)) != 0)
-            goto Finish;
+    struct ccnd_rxbuf *rx = h->rx_ref;
+    struct ccn_charbuf *old;
+    struct ccn_charbuf *c = NULL;
+    
+    h->rx_buf = NULL;
+    h->rx_ref = NULL;
+    if (rx == NULL)
+        return(0);
+    old = *pbuf;
+    if (keep < old->length) {
+        c = ccn_charbuf_create();
+        if (c != NULL)
+            ccn_charbuf_append(c, old->buf + keep, old->length - keep);
     }
-    else if (forwarding_entry->ccnd_id_size != 0)
-        goto Finish;
-    face = face_from_faceid(h, forwarding_entry->faceid);
-    if (face == NULL)
-        goto Finish;
-    if (forwarding_entry->lifetime < 0)
-        forwarding_entry->lifetime = 2000000000;
-    else if (forwarding_entry->lifetime > 3600 &&
-             forwarding_entry->lifetime < (1 << 30))
-        forwarding_entry->lifetime = 300;
-    comps = ccn_indexbuf_create();
-    res = ccn_name_split(forwarding_entry->name_prefix, comps);
-    if (res < 0)
-        goto Finish;
-    res = ccnd_reg_prefix(h,
-                          forwarding_entry->name_prefix->buf, comps, res,
-                          face->faceid,
-                          forwarding_entry->flags,
-                          forwarding_entry->lifetime);
-    if (res < 0)
-        goto Finish;
-    forwarding_entry->flags = res;
-    forwarding_entry->action = NULL;
-    forwarding_entry->ccnd_id = h->ccnd_id;
-    forwarding_entry->ccnd_id_size = sizeof(h->ccnd_id);
-    res = ccnb_append_forwarding_entry(reply_body, forwarding_entry);
-    if (res > 0)
-        res = 0;
-Finish:
-    ccn_forwarding_entry_destroy(&forwarding_entry);
-    ccn_indexbuf_destroy(&comps);
-    if (nackallowed && res < 0)
-        res = ccnd_nack(h, reply_body, 450, "could not register prefix");
-    return((nackallowed || res <= 0) ? res : -1);
+    *pbuf = c;
+    rxbuf_release(rx);
+    return(1);
 }
 
 /**
- * @brief Process a prefixreg request for the ccnd internal client.
- * @param h is the ccnd handle
- * @param msg points to a ccnd-encoded ContentObject containing a
- *          ForwardingEntry in its Content.
- * @param size is its size in bytes
- * @param reply_body is a buffer to hold the Content of the reply, as a
- *         FaceInstance including faceid
- * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK to
- *         set the response type to NACK.
+ * Pin stored content for a packet, standing in for its message.
  *
+ * For a stand-in (struct ccnd_transit), it is the content it stands
+ * in for that is pinned.
  */
-int
-ccnd_req_prefixreg(struct ccnd_handle *h,
-                   const unsigned char *msg, size_t size,
-                   struct ccn_charbuf *reply_body)
+static void
+packet_pin_content(struct ccnd_handle *h, struct ccnd_packet *p,
+                   struct content_entry *content)
 {
-    return(ccnd_req_prefix_or_self_reg(h, msg, size, 0, reply_body));
+    struct content_entry *real = content;
+    
+    p->store = h->thread;
+    if ((content->flags & CCN_CONTENT_ENTRY_TRANSIT) != 0) {
+        real = ((struct ccnd_transit *)content)->origin;
+        p->store = ((struct ccnd_transit *)content)->thread;
+    }
+    __atomic_add_fetch(&real->pins, 1, __ATOMIC_RELAXED);
+    p->content = real;
+    p->msg = real->key;
+    p->size = real->size;
+    p->flags = content->flags & (CCN_CONTENT_ENTRY_SLOWSEND |
+                                 CCN_CONTENT_ENTRY_DIGEST);
+    if ((p->flags & CCN_CONTENT_ENTRY_DIGEST) != 0)
+        memcpy(p->digest, content->digest, sizeof(p->digest));
 }
 
 /**
- * @brief Process a selfreg request for the ccnd internal client.
- * @param h is the ccnd handle
- * @param msg points to a ccnd-encoded ContentObject containing a
- *          ForwardingEntry in its Content.
- * @param size is its size in bytes
- * @param reply_body is a buffer to hold the Content of the reply, as a
- *         ccnb-encoded ForwardingEntry
- * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK to
- *         set the response type to NACK.
+ * Hand a message to the thread that owns the face, to be sent there.
  *
+ * This takes the place of stuff_and_send() for a face of another thread,
+ * which adds whatever link messages its face calls for.
  */
-int
-ccnd_req_selfreg(struct ccnd_handle *h,
-                 const unsigned char *msg, size_t size,
-                 struct ccn_charbuf *reply_body)
+static void
+face_post_send(struct ccnd_handle *h, struct face *face,
+               const unsigned char *data1, size_t size1,
+               const unsigned char *data2, size_t size2,
+               struct content_entry *content)
 {
-    return(ccnd_req_prefix_or_self_reg(h, msg, size, 1, reply_body));
+    struct ccnd_packet *p;
+    int res = 0;
+    
+    if (content != NULL && data1 == content->key && size2 == 0) {
+        p = ccnd_packet_create(CCND_PKT_CONTENT);
+        if (p == NULL)
+            return;
+        packet_pin_content(h, p, content);
+    }
+    else {
+        p = ccnd_packet_create(CCND_PKT_SEND);
+        if (p == NULL)
+            return;
+        if (size2 == 0)
+            res = rx_hold(h, p, data1, size1);
+        else {
+            p->buf = ccn_charbuf_create();
+            if (p->buf == NULL ||
+                ccn_charbuf_append(p->buf, data1, size1) < 0 ||
+                ccn_charbuf_append(p->buf, data2, size2) < 0)
+                res = -1;
+            else {
+                p->msg = p->buf->buf;
+                p->size = p->buf->length;
+            }
+        }
+    }
+    p->faceid = face->faceid;
+    p->origin = h->interest_faceid;
+    if (res < 0) {
+        ccnd_packet_release(p);
+        return;
+    }
+    ccnd_workers_post(h, face->owner, p);
 }
 
 /**
- * @brief Process an unreg request for the ccnd internal client.
- * @param h is the ccnd handle
- * @param msg points to a ccnd-encoded ContentObject containing a
- *          ForwardingEntry in its Content.
- * @param size is its size in bytes
- * @param reply_body is a buffer to hold the Content of the reply, as a
- *         ccnb-encoded ForwardingEntry
- * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK to
- *         set the response type to NACK.
+ * Send a message in a PDU, possibly stuffing other interest messages into it.
+ * The message may be in two pieces.
  *
+ * The pieces are handed to ccnd_sendv() as they are, along with any
+ * framing and stuffing, so the message itself is not copied here.
+ * If content is not NULL, data1 lies within its stored ContentObject.
  */
-int
-ccnd_req_unreg(struct ccnd_handle *h,
-               const unsigned char *msg, size_t size,
-               struct ccn_charbuf *reply_body)
+static void
+stuff_and_send(struct ccnd_handle *h, struct face *face,
+               const unsigned char *data1, size_t size1,
+               const unsigned char *data2, size_t size2,
+               struct content_entry *content,
+               const char *tag, int lineno) {
+    struct ccn_charbuf *c = NULL;
+    struct iovec iov[CCND_SENDV_MAX];
+    size_t hlen = 0;
+    int n = 0;
+    
+    if (tag != NULL) {
+        if (size2 == 0)
+            ccnd_debug_ccnb(h, lineno, tag, face, data1, size1);
+        else {
+            c = charbuf_obtain(h);
+            ccn_charbuf_append(c, data1, size1);
+            ccn_charbuf_append(c, data2, size2);
+            ccnd_debug_ccnb(h, lineno, tag, face, c->buf, c->length);
+            charbuf_release(h, c);
+        }
+    }
+    if (face->owner != h->thread) {
+        face_post_send(h, face, data1, size1, data2, size2, content);
+        return;
+    }
+    /* The PDU header and the stuffed trailer share one scratch buffer */
+    c = charbuf_obtain(h);
+    if ((face->flags & CCN_FACE_LINK) != 0) {
+        ccn_charbuf_append_tt(c, CCN_DTAG_CCNProtocolDataUnit, CCN_DTAG);
+        hlen = c->length;
+        ccn_stuff_interest(h, face, c);
+        ccn_append_link_stuff(h, face, c, content);
+        ccn_charbuf_append_closer(c);
+    }
+    else if (size2 != 0 || h->mtu > size1 + size2 ||
+             (face->flags & (CCN_FACE_SEQOK | CCN_FACE_SEQPROBE)) != 0 ||
+             face->recvcount == 0) {
+        ccn_stuff_interest(h, face, c);
+        ccn_append_link_stuff(h, face, c, content);
+    }
+    if (hlen > 0) {
+        iov[n].iov_base = c->buf;
+        iov[n++].iov_len = hlen;
+    }
+    iov[n].iov_base = (void *)data1;
+    iov[n++].iov_len = size1;
+    if (size2 != 0) {
+        iov[n].iov_base = (void *)data2;
+        iov[n++].iov_len = size2;
+    }
+    if (c->length > hlen) {
+        iov[n].iov_base = c->buf + hlen;
+        iov[n++].iov_len = c->length - hlen;
+    }
+    ccnd_sendv(h, face, iov, n, content);
+    charbuf_release(h, c);
+}
+
+/**
+ * Append a link-check interest if appropriate.
+ *
+ * @returns the number of messages that were stuffed.
+ */
+static int
+stuff_link_check(struct ccnd_handle *h,
+                   struct face *face, struct ccn_charbuf *c)
 {
-    struct ccn_parsed_ContentObject pco = {0};
-    int n_name_comp = 0;
+    int checkflags = CCN_FACE_DGRAM | CCN_FACE_MCAST | CCN_FACE_GG | CCN_FACE_LC;
+    int wantflags = CCN_FACE_DGRAM;
+    struct ccn_charbuf *name = NULL;
+    struct ccn_charbuf *ibuf = NULL;
     int res;
-    const unsigned char *req;
-    size_t req_size;
-    size_t start;
-    size_t stop;
-    int found;
-    struct ccn_forwarding_entry *forwarding_entry = NULL;
-    struct face *face = NULL;
-    struct face *reqface = NULL;
-    struct ccn_indexbuf *comps = NULL;
-    struct ccn_forwarding **p = NULL;
-    struct ccn_forwarding *f = NULL;
-    struct nameprefix_entry *npe = NULL;
-    int nackallowed = 0;
-    
-    res = ccn_parse_ContentObject(msg, size, &pco, NULL);
-    if (res < 0)
-        goto Finish;        
-    res = ccn_content_get_value(msg, size, &pco, &req, &req_size);
-    if (res < 0)
-        goto Finish;
-    res = -1;
-    forwarding_entry = ccn_forwarding_entry_parse(req, req_size);
-    /* consider the source ... */
-    reqface = face_from_faceid(h, h->interest_faceid);
-    if (reqface == NULL || (reqface->flags & CCN_FACE_GG) == 0)
-        goto Finish;
-    nackallowed = 1;
-    if (forwarding_entry == NULL || forwarding_entry->action == NULL)
-        goto Finish;
-    if (strcmp(forwarding_entry->action, "unreg") != 0)
-        goto Finish;
-    if (forwarding_entry->faceid == CCN_NOFACEID)
-        goto Finish;
-    if (forwarding_entry->name_prefix == NULL)
-        goto Finish;
-    res = check_forwarding_entry_ccndid(h, forwarding_entry, reply_body);
-    if (res != 0)
-        goto Finish;
-    res = -1;
-    face = face_from_faceid(h, forwarding_entry->faceid);
-    if (face == NULL)
-        goto Finish;
-    comps = ccn_indexbuf_create();
-    n_name_comp = ccn_name_split(forwarding_entry->name_prefix, comps);
-    if (n_name_comp < 0)
-        goto Finish;
-    if (n_name_comp + 1 > comps->n)
-        goto Finish;
-    start = comps->buf[0];
-    stop = comps->buf[n_name_comp];
-    npe = hashtb_lookup(h->nameprefix_tab,
-                        forwarding_entry->name_prefix->buf + start,
-                        stop - start);
-    if (npe == NULL)
-        goto Finish;
-    found = 0;
-    p = &npe->forwarding;
-    for (f = npe->forwarding; f != NULL; f = f->next) {
-        if (f->faceid == forwarding_entry->faceid) {
-            found = 1;
-            if (h->debug & (2 | 4))
-                ccnd_debug_ccnb(h, __LINE__, "prefix_unreg", face,
-                                forwarding_entry->name_prefix->buf,
-                                forwarding_entry->name_prefix->length);
-            *p = f->next;
-            free(f);
-            f = NULL;
-            h->forward_to_gen += 1;
-            break;
-        }
-        p = &(f->next);
-    }
-    if (!found)
-        goto Finish;    
-    forwarding_entry->action = NULL;
-    forwarding_entry->ccnd_id = h->ccnd_id;
-    forwarding_entry->ccnd_id_size = sizeof(h->ccnd_id);
-    res = ccnb_append_forwarding_entry(reply_body, forwarding_entry);
-    if (res > 0)
-        res = 0;
-Finish:
-    ccn_forwarding_entry_destroy(&forwarding_entry);
-    ccn_indexbuf_destroy(&comps);
-    if (nackallowed && res < 0)
-        res = ccnd_nack(h, reply_body, 450, "could not unregister prefix");
-    return((nackallowed || res <= 0) ? res : -1);
+    int ans = 0;
+    if (face->recvcount > 0)
+        return(0);
+    if ((face->flags & checkflags) != wantflags)
+        return(0);
+    name = ccn_charbuf_create();
+    if (name == NULL) goto Bail;
+    ccn_name_init(name);
+    res = ccn_name_from_uri(name, CCNDID_NEIGHBOR_URI);
+    if (res < 0) goto Bail;
+    ibuf = ccn_charbuf_create();
+    if (ibuf == NULL) goto Bail;
+    ccn_charbuf_append_tt(ibuf, CCN_DTAG_Interest, CCN_DTAG);
+    ccn_charbuf_append(ibuf, name->buf, name->length);
+    ccnb_tagged_putf(ibuf, CCN_DTAG_Scope, "2");
+    // XXX - ought to generate a nonce
+    ccn_charbuf_append_closer(ibuf);
+    ccn_charbuf_append(c, ibuf->buf, ibuf->length);
+    ccnd_meter_bump(h, face->meter[FM_INTO], 1);
+    h->interests_stuffed++;
+    face->flags |= CCN_FACE_LC;
+    if (h->debug & 2)
+        ccnd_debug_ccnb(h, __LINE__, "stuff_interest_to", face,
+                        ibuf->buf, ibuf->length);
+    ans = 1;
+Bail:
+    ccn_charbuf_destroy(&ibuf);
+    ccn_charbuf_destroy(&name);
+    return(ans);
 }
 
 /**
- * Set up forward_to list for a name prefix entry.
+ * Stuff a PDU with interest messages that will fit.
  *
- * Recomputes the contents of npe->forward_to and npe->flags
- * from forwarding lists of npe and all of its ancestors.
+ * @returns the number of messages that were stuffed.
+ */
+static int
+ccn_stuff_interest(struct ccnd_handle *h,
+                   struct face *face, struct ccn_charbuf *c)
+{
+    int n_stuffed = 0;
+    
+    n_stuffed += stuff_link_check(h, face, c);
+    return(n_stuffed);
+}
+
+/**
+ * Start the link timer if it is not already running.
  */
 static void
-update_forward_to(struct ccnd_handle *h, struct nameprefix_entry *npe)
+link_timer_start(struct ccnd_handle *h)
 {
-    struct ccn_indexbuf *x = NULL;
-    struct ccn_indexbuf *tap = NULL;
-    struct ccn_forwarding *f = NULL;
-    struct nameprefix_entry *p = NULL;
-    unsigned tflags;
-    unsigned wantflags;
-    unsigned moreflags;
-    unsigned lastfaceid;
-    unsigned namespace_flags;
+    if (h->link_timer == NULL)
+        h->link_timer = ccn_schedule_event(h->sched, CCND_LINK_TICK,
+                                           link_timer, NULL, 0);
+}
 
-    x = npe->forward_to;
-    if (x == NULL)
-        npe->forward_to = x = ccn_indexbuf_create();
-    else
-        x->n = 0;
-    wantflags = CCN_FORW_ACTIVE;
-    lastfaceid = CCN_NOFACEID;
-    namespace_flags = 0;
-    for (p = npe; p != NULL; p = p->parent) {
-        moreflags = CCN_FORW_CHILD_INHERIT;
-        for (f = p->forwarding; f != NULL; f = f->next) {
-            if (face_from_faceid(h, f->faceid) == NULL)
-                continue;
-            /* The sense of this flag needs to be inverted for this test */
-            tflags = f->flags ^ CCN_FORW_CAPTURE_OK;
-            if ((tflags & wantflags) == wantflags) {
-                if (h->debug & 32)
-                    ccnd_msg(h, "fwd.%d adding %u", __LINE__, f->faceid);
-                ccn_indexbuf_set_insert(x, f->faceid);
-                if ((f->flags & CCN_FORW_TAP) != 0) {
-                    if (tap == NULL)
-                        tap = ccn_indexbuf_create();
-                    ccn_indexbuf_set_insert(tap, f->faceid);
-                }
-                if ((f->flags & CCN_FORW_LAST) != 0)
-                    lastfaceid = f->faceid;
-            }
-            namespace_flags |= f->flags;
-            if ((f->flags & CCN_FORW_CAPTURE) != 0)
-                moreflags |= CCN_FORW_CAPTURE_OK;
-        }
-        wantflags |= moreflags;
-    }
-    if (lastfaceid != CCN_NOFACEID)
-        ccn_indexbuf_move_to_end(x, lastfaceid);
-    npe->flags = namespace_flags;
-    npe->fgen = h->forward_to_gen;
-    if (x->n == 0)
-        ccn_indexbuf_destroy(&npe->forward_to);
-    ccn_indexbuf_destroy(&npe->tap);
-    npe->tap = tap;
+/**
+ * Set up link reliability state for a face, if it is called for.
+ */
+static struct ccnd_link *
+link_create(struct ccnd_handle *h, struct face *face)
+{
+    struct ccnd_link *link;
+    
+    if (face->link != NULL || !h->link_reliable)
+        return(face->link);
+    if ((face->flags & (CCN_FACE_DGRAM | CCN_FACE_MCAST)) != CCN_FACE_DGRAM)
+        return(NULL);
+    link = calloc(1, sizeof(*link));
+    if (link == NULL)
+        return(NULL);
+    link->rto = CCND_LINK_RTO_INIT;
+    face->link = link;
+    return(link);
 }
 
 /**
- * This is where we consult the interest forwarding table.
- * @param h is the ccnd handle
- * @param from is the handle for the originating face (may be NULL).
- * @param msg points to the ccnb-encoded interest message
- * @param pi must be the parse information for msg
- * @param npe should be the result of the prefix lookup
- * @result Newly allocated set of outgoing faceids (never NULL)
+ * Append a LinkAck describing what we have received lately.
+ *
+ * The value is the highest sequence number received, in two bytes,
+ * followed by four bytes of bitmap.  Bit i of the bitmap (counting
+ * from the least significant) says whether the sequence number i + 1
+ * before the highest was received.
  */
-static struct ccn_indexbuf *
-get_outbound_faces(struct ccnd_handle *h,
-    struct face *from,
-    const unsigned char *msg,
-    struct ccn_parsed_interest *pi,
-    struct nameprefix_entry *npe)
+static void
+link_append_ack(struct ccnd_handle *h, struct face *face,
+                struct ccn_charbuf *c)
 {
-    int checkmask = 0;
-    int wantmask = 0;
-    struct ccn_indexbuf *x;
-    struct face *face;
-    int i;
-    int n;
-    unsigned faceid;
+    struct ccnd_link *link = face->link;
+    unsigned char val[6];
     
-    while (npe->parent != NULL && npe->forwarding == NULL)
-        npe = npe->parent;
-    if (npe->fgen != h->forward_to_gen)
-        update_forward_to(h, npe);
-    x = ccn_indexbuf_create();
-    if (pi->scope == 0)
-        return(x);
-    if (from != NULL && (from->flags & CCN_FACE_GG) != 0) {
-        i = ccn_fetch_tagged_nonNegativeInteger(CCN_DTAG_FaceID, msg,
-              pi->offset[CCN_PI_B_OTHER], pi->offset[CCN_PI_E_OTHER]);
-        if (i != -1) {
-            faceid = i;
-            ccn_indexbuf_append_element(x, faceid);
-            if (h->debug & 32)
-                ccnd_msg(h, "outbound.%d adding %u", __LINE__, faceid);
-            return(x);
-        }
-    }
-    if (npe->forward_to == NULL || npe->forward_to->n == 0)
-        return(x);
-    if ((npe->flags & CCN_FORW_LOCAL) != 0)
-        checkmask = (from != NULL && (from->flags & CCN_FACE_GG) != 0) ? CCN_FACE_GG : (~0);
-    else if (pi->scope == 1)
-        checkmask = CCN_FACE_GG;
-    else if (pi->scope == 2)
-        checkmask = from ? (CCN_FACE_GG & ~(from->flags)) : ~0;
-    wantmask = checkmask;
-    if (wantmask == CCN_FACE_GG)
-        checkmask |= CCN_FACE_DC;
-    for (n = npe->forward_to->n, i = 0; i < n; i++) {
-        faceid = npe->forward_to->buf[i];
-        face = face_from_faceid(h, faceid);
-        if (face != NULL && face != from &&
-            ((face->flags & checkmask) == wantmask)) {
-            if (h->debug & 32)
-                ccnd_msg(h, "outbound.%d adding %u", __LINE__, face->faceid);
-            ccn_indexbuf_append_element(x, face->faceid);
-        }
-    }
-    return(x);
+    val[0] = link->rhigh >> 8;
+    val[1] = link->rhigh;
+    val[2] = link->rbits >> 24;
+    val[3] = link->rbits >> 16;
+    val[4] = link->rbits >> 8;
+    val[5] = link->rbits;
+    ccnb_append_tagged_blob(c, CCN_DTAG_LinkAck, val, sizeof(val));
+    link->unacked = 0;
 }
 
 /**
- * Compute the delay until the next timed action on an interest.
+ * Send a LinkAck by itself.
+ *
+ * This datagram has no SequenceNumber, so it is not itself acknowledged.
  */
-static int
-ie_next_usec(struct ccnd_handle *h, struct interest_entry *ie,
-             ccn_wrappedtime *expiry)
+static void
+link_send_ack(struct ccnd_handle *h, struct face *face)
 {
-    struct pit_face_item *p;
-    ccn_wrappedtime base;
-    ccn_wrappedtime delta;
-    ccn_wrappedtime mn;
-    int ans;
-    int debug = (h->debug & 32) != 0;
-    const int horizon = 3 * WTHZ; /* complain if we get behind by too much */
+    struct ccn_charbuf *c = charbuf_obtain(h);
+    struct iovec iov;
     
-    base = h->wtnow - horizon;
-    mn = 600 * WTHZ + horizon;
-    for (p = ie->pfl; p != NULL; p = p->next) {
-        delta = p->expiry - base;
-        if (delta >= 0x80000000)
-            debug = 1;
-        if (debug) {
-            static const char fmt_ie_next_usec[] = 
-              "ie_next_usec.%d now%+d i=%u f=%04x %u "
-              " %02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X";
-            ccnd_msg(h, fmt_ie_next_usec, __LINE__,
-                     (int)delta - horizon, ie->serial, p->pfi_flags, p->faceid,
-                     p->nonce[0], p->nonce[1], p->nonce[2], p->nonce[3],
-                     p->nonce[4], p->nonce[5], p->nonce[6], p->nonce[7],
-                     p->nonce[8], p->nonce[9], p->nonce[10], p->nonce[11]);
+    if ((face->flags & CCN_FACE_LINK) != 0)
+        ccn_charbuf_append_tt(c, CCN_DTAG_CCNProtocolDataUnit, CCN_DTAG);
+    link_append_ack(h, face, c);
+    if ((face->flags & CCN_FACE_LINK) != 0)
+        ccn_charbuf_append_closer(c);
+    iov.iov_base = c->buf;
+    iov.iov_len = c->length;
+    ccnd_sendv(h, face, &iov, 1, NULL);
+    charbuf_release(h, c);
+}
+
+/**
+ * The link hello bits that say which link messages we take.
+ *
+ * We always reassemble LinkFragments, whether or not we send them.
+ */
+static int
+link_hello_bits(struct ccnd_handle *h)
+{
+    return((h->link_reliable ? CCND_LINK_HELLO_ACKS : 0) |
+           CCND_LINK_HELLO_FRAGS);
+}
+
+/**
+ * Send a link hello by itself.
+ *
+ * This is a LinkAck with a one-byte value, telling the other side which
+ * link messages we take, and maybe asking it to tell us the same.
+ */
+static void
+link_send_hello(struct ccnd_handle *h, struct face *face, int ask)
+{
+    struct ccn_charbuf *c = charbuf_obtain(h);
+    struct iovec iov;
+    unsigned char val;
+    
+    val = link_hello_bits(h) | (ask ? CCND_LINK_HELLO_ASK : 0);
+    if ((face->flags & CCN_FACE_LINK) != 0)
+        ccn_charbuf_append_tt(c, CCN_DTAG_CCNProtocolDataUnit, CCN_DTAG);
+    ccnb_append_tagged_blob(c, CCN_DTAG_LinkAck, &val, 1);
+    if ((face->flags & CCN_FACE_LINK) != 0)
+        ccn_charbuf_append_closer(c);
+    iov.iov_base = c->buf;
+    iov.iov_len = c->length;
+    ccnd_sendv(h, face, &iov, 1, NULL);
+    charbuf_release(h, c);
+}
+
+/**
+ * Ask a unicast datagram peer which link messages it takes, if we have
+ * not heard yet and might have a use for them.
+ *
+ * This is called when the peer sends a SequenceNumber, which every ccnd
+ * does.  Only CCND_LINK_HELLO_TRIES are sent, CCND_LINK_HELLO_GAP apart,
+ * so a peer that does not know about link hellos has few to complain of.
+ */
+static void
+link_hello_check(struct ccnd_handle *h, struct face *face)
+{
+    unsigned now;
+    
+    if (face->linkhellos >= CCND_LINK_HELLO_TRIES)
+        return;
+    if (!h->link_reliable && h->mtu == 0)
+        return;
+    if ((face->flags & (CCN_FACE_DGRAM | CCN_FACE_MCAST)) != CCN_FACE_DGRAM)
+        return;
+    now = ccnd_usec_clock(h);
+    if (face->linkhellos != 0 && now - face->linkhello_usec < CCND_LINK_HELLO_GAP)
+        return;
+    face->linkhellos++;
+    face->linkhello_usec = now;
+    link_send_hello(h, face, 1);
+}
+
+/**
+ * Note an incoming sequence number on a reliable link.
+ *
+ * A gap is reported right away, as are the next CCND_LINK_DUPTHRESH
+ * arrivals, so that the other side can tell a loss from reordering and
+ * repair it within one link round trip.  Otherwise the LinkAck waits for
+ * outgoing traffic to ride on, for a few more arrivals, or for the link
+ * timer.  A jump of more than CCND_LINK_WINDOW either way means that the
+ * other side has started over, so we do too.
+ *
+ * Nothing is sent until the other side has said, in a link hello or
+ * a LinkAck of its own, that it takes LinkAcks.
+ */
+static void
+link_note_received(struct ccnd_handle *h, struct face *face, uintmax_t seq)
+{
+    struct ccnd_link *link = face->link;
+    unsigned short s = seq;
+    unsigned short d;
+    uint32_t recent = (1U << CCND_LINK_DUPTHRESH) - 1;
+    int gap = 0;
+    
+    if (link->rhave != 0) {
+        d = s - link->rhigh;
+        if (d > CCND_LINK_WINDOW && d < 0x10000 - CCND_LINK_WINDOW)
+            link->rhave = 0;
+    }
+    if (link->rhave == 0) {
+        link->rhigh = s;
+        link->rbits = 0;
+        link->rhave = 1;
+    }
+    else {
+        d = s - link->rhigh;
+        if (d == 0)
+            return;
+        if (d < 0x8000) {
+            /* Newer than anything so far */
+            if (d > 32)
+                link->rbits = 0;
+            else if (d == 32)
+                link->rbits = 1U << 31;
+            else
+                link->rbits = (link->rbits << d) | (1U << (d - 1));
+            link->rhigh = s;
+            gap = ((link->rbits & recent) != recent);
+        }
+        else {
+            d = link->rhigh - s;
+            if (d <= 32)
+                link->rbits |= 1U << (d - 1);
         }
-        if (delta < mn)
-            mn = delta;
     }
-    if (mn < horizon)
-        mn = 0;
+    if ((face->flags & CCN_FACE_LINKOK) == 0)
+        return;
+    link->unacked++;
+    if (gap || link->unacked >= CCND_LINK_ACK_EVERY)
+        link_send_ack(h, face);
     else
-        mn -= horizon;
-    ans = mn * (1000000 / WTHZ);
-    if (expiry != NULL) {
-        *expiry = h->wtnow + mn;
-        if (debug)
-            ccnd_msg(h, "ie_next_usec.%d expiry=%x", __LINE__,
-                     (unsigned)*expiry);
-    }
-    if (debug)
-        ccnd_msg(h, "ie_next_usec.%d %d usec", __LINE__, ans);
-    return(ans);
+        link_timer_start(h);
 }
 
 /**
- *  Forward an interest message
- *
- *  x is downstream (the interest came x).
- *  p is upstream (the interest is to be forwarded to p).
- *  @returns p (or its reallocated replacement).
+ * Remember a ContentObject sent on a reliable link.
  */
-static struct pit_face_item *
-send_interest(struct ccnd_handle *h, struct interest_entry *ie,
-              struct pit_face_item *x, struct pit_face_item *p)
+static void
+link_note_sent(struct ccnd_handle *h, struct face *face,
+               unsigned short seq, struct content_entry *content)
 {
-    struct face *face = NULL;
-    struct ccn_charbuf *c = h->send_interest_scratch;
-    const intmax_t default_life = CCN_INTEREST_LIFETIME_SEC << 12;
-    intmax_t lifetime = default_life;
-    ccn_wrappedtime delta;
-    size_t noncesize;
+    struct ccnd_link_slot *slot;
     
-    face = face_from_faceid(h, p->faceid);
-    if (face == NULL)
-        return(p);
-    h->interest_faceid = x->faceid; /* relevant if p is face 0 */
-    p = pfi_copy_nonce(h, ie, p, x);
-    delta = x->expiry - x->renewed;
-    lifetime = (intmax_t)delta * 4096 / WTHZ;
-    /* clip lifetime against various limits here */
-    lifetime = (((lifetime + 511) >> 9) << 9); /* round up - 1/8 sec */
-    p->renewed = h->wtnow;
-    p->expiry = h->wtnow + (lifetime * WTHZ / 4096);
-    ccn_charbuf_reset(c);
-    if (lifetime != default_life)
-        ccnb_append_tagged_binary_number(c, CCN_DTAG_InterestLifetime, lifetime);
-    noncesize = p->pfi_flags & CCND_PFI_NONCESZ;
-    if (noncesize != 0)
-        ccnb_append_tagged_blob(c, CCN_DTAG_Nonce, p->nonce, noncesize);
-    ccn_charbuf_append_closer(c);
-    h->interests_sent += 1;
-    p->pfi_flags |= CCND_PFI_UPENDING;
-    p->pfi_flags &= ~(CCND_PFI_SENDUPST | CCND_PFI_UPHUNGRY);
-    ccnd_meter_bump(h, face->meter[FM_INTO], 1);
-    stuff_and_send(h, face, ie->interest_msg, ie->size - 1, c->buf, c->length, (h->debug & 2) ? "interest_to" : NULL, __LINE__);
-    return(p);
+    slot = &face->link->slot[seq & (CCND_LINK_WINDOW - 1)];
+    slot->accession = content->accession;
+    slot->sent_usec = ccnd_usec_clock(h);
+    slot->seq = seq;
+    slot->tries = 0;
+    slot->fragid = 0;
+    slot->frag = -1;
+    link_timer_start(h);
 }
 
 /**
- * Find the entry for the longest name prefix that contains forwarding info
+ * Decide whether to send content to a face in LinkFragments.
+ *
+ * Fragmentation is used only when CCND_MTU is set, for content that
+ * is larger, and only on faces whose peer has said in a link hello
+ * that it takes LinkFragments.
+ *
+ * @returns the number of fragments, or 0 to send the content whole.
  */
-struct nameprefix_entry *
-get_fib_npe(struct ccnd_handle *h, struct interest_entry *ie)
+static int
+link_fragment_count(struct ccnd_handle *h, struct face *face,
+                    struct content_entry *content)
 {
-    struct nameprefix_entry *npe;
+    size_t payload;
+    size_t count;
     
-    for (npe = ie->ll.npe; npe != NULL; npe = npe->parent)
-        if (npe->forwarding != NULL)
-            return(npe);
-    return(NULL);
+    if (h->mtu <= 2 * CCND_FRAG_OVERHEAD || content->size <= h->mtu)
+        return(0);
+    if ((face->flags & (CCN_FACE_FRAGOK | CCN_FACE_MCAST)) != CCN_FACE_FRAGOK)
+        return(0);
+    payload = h->mtu - CCND_FRAG_OVERHEAD;
+    count = (content->size + payload - 1) / payload;
+    if (count > 255)
+        return(0);
+    return(count);
 }
 
-/** Implementation detail for strategy_settimer */
+/**
+ * Send one LinkFragment of some content.
+ *
+ * The fragment goes in a datagram of its own, along with the usual
+ * link messages, inside a CCNProtocolDataUnit if the face uses them.
+ * On a reliable link it is noted by itself, so that a loss is repaired
+ * by sending just this fragment again.
+ */
+static void
+send_fragment(struct ccnd_handle *h, struct face *face,
+              struct content_entry *content,
+              unsigned fragid, int i, int count)
+{
+    struct ccn_charbuf *c = charbuf_obtain(h);
+    struct ccnd_link_slot *slot;
+    struct iovec iov[3];
+    unsigned char hdr[CCND_FRAG_HDR];
+    size_t payload = h->mtu - CCND_FRAG_OVERHEAD;
+    size_t start = i * payload;
+    size_t len = content->size - start;
+    size_t hlen;
+    unsigned short seq = face->pktseq;
+    int noted;
+    
+    if (len > payload)
+        len = payload;
+    hdr[0] = fragid >> 8;
+    hdr[1] = fragid;
+    hdr[2] = i;
+    hdr[3] = count;
+    hdr[4] = start >> 24;
+    hdr[5] = start >> 16;
+    hdr[6] = start >> 8;
+    hdr[7] = start;
+    if ((face->flags & CCN_FACE_LINK) != 0)
+        ccn_charbuf_append_tt(c, CCN_DTAG_CCNProtocolDataUnit, CCN_DTAG);
+    ccn_charbuf_append_tt(c, CCN_DTAG_LinkFragment, CCN_DTAG);
+    ccn_charbuf_append_tt(c, sizeof(hdr) + len, CCN_BLOB);
+    ccn_charbuf_append(c, hdr, sizeof(hdr));
+    hlen = c->length;
+    ccn_charbuf_append_closer(c);
+    noted = (face->link != NULL && (face->flags & CCN_FACE_LINKACK) != 0 &&
+             (face->flags & (CCN_FACE_SEQOK | CCN_FACE_SEQPROBE)) != 0);
+    ccn_append_link_stuff(h, face, c, NULL);
+    if ((face->flags & CCN_FACE_LINK) != 0)
+        ccn_charbuf_append_closer(c);
+    iov[0].iov_base = c->buf;
+    iov[0].iov_len = hlen;
+    iov[1].iov_base = (void *)(content->key + start);
+    iov[1].iov_len = len;
+    iov[2].iov_base = c->buf + hlen;
+    iov[2].iov_len = c->length - hlen;
+    ccnd_sendv(h, face, iov, 3, content);
+    if (noted) {
+        link_note_sent(h, face, seq, content);
+        slot = &face->link->slot[seq & (CCND_LINK_WINDOW - 1)];
+        slot->fragid = fragid;
+        slot->frag = i;
+    }
+    charbuf_release(h, c);
+}
+
+/**
+ * Send content in LinkFragments, if it calls for that.
+ *
+ * @returns 1 if the content was sent, or 0 if it should be sent whole.
+ */
 static int
-strategy_timer(struct ccn_schedule *sched,
-             void *clienth,
-             struct ccn_scheduled_event *ev,
-             int flags)
+send_fragments(struct ccnd_handle *h, struct face *face,
+               struct content_entry *content)
 {
-    struct ccnd_handle *h = clienth;
-    struct interest_entry *ie = ev->evdata;
-    struct ccn_strategy *s = &ie->strategy;
-
-    if (s->ev == ev)
-        s->ev = NULL;
-    if (flags & CCN_SCHEDULE_CANCEL)
+    int count;
+    int i;
+    
+    count = link_fragment_count(h, face, content);
+    if (count == 0)
         return(0);
-    strategy_callout(h, ie, (enum ccn_strategy_op)ev->evint);
-    return(0);
+    face->fragid++;
+    if (h->debug & 4)
+        ccnd_msg(h, "content_to %u in %d fragments, fragid %u",
+                 face->faceid, count, (unsigned)face->fragid);
+    for (i = 0; i < count; i++)
+        send_fragment(h, face, content, face->fragid, i, count);
+    return(1);
 }
 
 /**
- * Schedule a strategy wakeup
- *
- * Any previously wakeup will be cancelled.
+ * Update the link rtt estimate (RFC 6298, as for forwarding entries).
  */
 static void
-strategy_settimer(struct ccnd_handle *h, struct interest_entry *ie,
-                  int usec, enum ccn_strategy_op op)
+link_rtt_sample(struct ccnd_link *link, unsigned rtt)
 {
-    struct ccn_strategy *s = &ie->strategy;
+    unsigned delta;
+    unsigned rto;
     
-    if (s->ev != NULL)
-        ccn_schedule_cancel(h->sched, s->ev);
-    if (op == CCNST_NOP)
-        return;
-    s->ev = ccn_schedule_event(h->sched, usec, strategy_timer, ie, op);
+    if (link->srtt == 0) {
+        link->srtt = rtt + 1;
+        link->rttvar = rtt / 2;
+    }
+    else {
+        delta = (link->srtt > rtt) ? link->srtt - rtt : rtt - link->srtt;
+        link->rttvar = link->rttvar - (link->rttvar >> 2) + (delta >> 2);
+        link->srtt = link->srtt - (link->srtt >> 3) + (rtt >> 3);
+    }
+    /* Allow for the other side holding back its LinkAck */
+    rto = link->srtt + 4 * link->rttvar + CCND_LINK_TICK;
+    if (rto < CCND_LINK_RTO_MIN)
+        rto = CCND_LINK_RTO_MIN;
+    else if (rto > CCND_LINK_RTO_MAX)
+        rto = CCND_LINK_RTO_MAX;
+    link->rto = rto;
 }
 
 /**
- * This implements the default strategy.
+ * Send a ContentObject, or the lost fragment of one, again.
  *
- * Eventually there will be a way to have other strategies.
+ * This happens only if the content is still around.  It goes out with
+ * a new sequence number, so the receiving side does not need to tell
+ * the copies apart.
  */
 static void
-strategy_callout(struct ccnd_handle *h,
-                 struct interest_entry *ie,
-                 enum ccn_strategy_op op)
+link_retransmit(struct ccnd_handle *h, struct face *face,
+                const struct ccnd_link_slot *lost)
 {
-    struct pit_face_item *x = NULL;
-    struct pit_face_item *p = NULL;
-    struct nameprefix_entry *npe = NULL;
-    struct ccn_indexbuf *tap = NULL;
-    unsigned best = CCN_NOFACEID;
-    unsigned randlow, randrange;
-    unsigned nleft;
-    unsigned amt;
-    int usec;
-    int usefirst;
+    struct content_entry *content;
+    struct ccnd_link_slot *slot;
+    int count;
     
-    switch (op) {
-        case CCNST_NOP:
-            break;
-        case CCNST_FIRST:
-            
-            npe = get_fib_npe(h, ie);
-            if (npe != NULL)
-                tap = npe->tap;
-            npe = ie->ll.npe;
-            best = npe->src;
-            if (best == CCN_NOFACEID)
-                best = npe->src = npe->osrc;
-            /* Find our downstream; right now there should be just one. */
-            for (x = ie->pfl; x != NULL; x = x->next)
-                if ((x->pfi_flags & CCND_PFI_DNSTREAM) != 0)
-                    break;
-            if (x == NULL || (x->pfi_flags & CCND_PFI_PENDING) == 0) {
-                ccnd_debug_ccnb(h, __LINE__, "canthappen", NULL,
-                                ie->interest_msg, ie->size);
-                break;
-            }
-            if (best == CCN_NOFACEID || npe->usec > 150000) {
-                usefirst = 1;
-                randlow = 4000;
-                randrange = 75000;
-            }
-            else {
-                usefirst = 0;
-                randlow = npe->usec;
-                randrange = (randlow + 1) / 2;
-            }
-            nleft = 0;
-            for (p = ie->pfl; p!= NULL; p = p->next) {
-                if ((p->pfi_flags & CCND_PFI_UPSTREAM) != 0) {
-                    if (p->faceid == best) {
-                        p = send_interest(h, ie, x, p);
-                        strategy_settimer(h, ie, npe->usec, CCNST_TIMER);
-                    }
-                    else if (ccn_indexbuf_member(tap, p->faceid) >= 0)
-                        p = send_interest(h, ie, x, p);
-                    else if (usefirst) {
-                        usefirst = 0;
-                        pfi_set_expiry_from_micros(h, ie, p, 0);
-                    }
-                    else if (p->faceid == npe->osrc)
-                        pfi_set_expiry_from_micros(h, ie, p, randlow);
-                    else {
-                        /* Want to preserve the order of the rest */
-                        nleft++;
-                        p->pfi_flags |= CCND_PFI_SENDUPST;
-                    }
-                }
-            }
-            if (nleft > 0) {
-                /* Send remainder in order, with randomized timing */
-                amt = (2 * randrange + nleft - 1) / nleft;
-                if (amt == 0) amt = 1; /* paranoia - should never happen */
-                usec = randlow;
-                for (p = ie->pfl; p!= NULL; p = p->next) {
-                    if ((p->pfi_flags & CCND_PFI_SENDUPST) != 0) {
-                        pfi_set_expiry_from_micros(h, ie, p, usec);
-                        usec += nrand48(h->seed) % amt;
-                    }
-                }
-            }
-            break;
-        case CCNST_TIMER:
-            /*
-             * Our best choice has not responded in time.
-             * Increase the predicted response.
-             */
-            adjust_predicted_response(h, ie, 1);
-            break;
-        case CCNST_SATISFIED:
-            break;
-        case CCNST_TIMEOUT:
-            break;
+    if (lost->tries + 1 >= CCND_LINK_TRIES)
+        return;
+    content = content_from_accession(h, lost->accession);
+    if (content == NULL)
+        return;
+    if (h->debug & 4)
+        ccnd_debug_ccnb(h, __LINE__, "link_retransmit", face,
+                        content->key, content->size);
+    face->link->retransmits++;
+    if (lost->frag >= 0) {
+        count = link_fragment_count(h, face, content);
+        if (lost->frag >= count)
+            return;
+        send_fragment(h, face, content, lost->fragid, lost->frag, count);
     }
+    else
+        send_content(h, face, content);
+    slot = &face->link->slot[(face->pktseq - 1) & (CCND_LINK_WINDOW - 1)];
+    if (slot->accession == lost->accession)
+        slot->tries = lost->tries + 1;
 }
 
 /**
- * Execute the next timed action on a propagating interest.
+ * Check that a LinkFragment fits with the others of its object.
+ *
+ * Every fragment but the last has the same length, and fragment i
+ * starts at i times that length, so that once all are in they cover the
+ * object exactly.  The first fragment to arrive that shows the common
+ * length sets it.
+ *
+ * @returns 1 if the fragment fits, 0 if not.
  */
 static int
-do_propagate(struct ccn_schedule *sched,
-             void *clienth,
-             struct ccn_scheduled_event *ev,
-             int flags)
+frag_set_fits(struct ccnd_frag_set *fs, unsigned index,
+              size_t offset, size_t len)
 {
-    struct ccnd_handle *h = clienth;
-    struct interest_entry *ie = ev->evdata;
-    struct face *face = NULL;
-    struct pit_face_item *p = NULL;
-    struct pit_face_item *next = NULL;
-    struct pit_face_item *d[3] = { NULL, NULL, NULL };
-    ccn_wrappedtime now;
-    int next_delay;
-    int i;
-    int n;
-    int pending;
-    int upstreams;
-    unsigned life;
-    unsigned mn;
-    unsigned rem;
+    size_t step = fs->step;
     
-    if (ie->ev == ev)
-        ie->ev = NULL;
-    else if (ie->ev != NULL) abort();
-    if (flags & CCN_SCHEDULE_CANCEL)
-        return(0);
-    now = h->wtnow;  /* capture our reference */
-    mn = 600 * WTHZ; /* keep track of when we should wake up again */
-    pending = 0;
-    n = 0;
-    for (p = ie->pfl; p != NULL; p = next) {
-        next = p->next;
-        if ((p->pfi_flags & CCND_PFI_DNSTREAM) != 0) {
-            if (wt_compare(p->expiry, now) <= 0) {
-                if (h->debug & 2)
-                    ccnd_debug_ccnb(h, __LINE__, "interest_expiry",
-                                    face_from_faceid(h, p->faceid),
-                                    ie->interest_msg, ie->size);
-                pfi_destroy(h, ie, p);
-                continue;
-            }
-            if ((p->pfi_flags & CCND_PFI_PENDING) == 0)
-                continue;
-            rem = p->expiry - now;
-            if (rem < mn)
-                mn = rem;
-            pending++;
-            /* If this downstream will expire soon, don't use it */
-            life = p->expiry - p->renewed;
-            if (rem * 8 <= life)
-                continue;
-            /* keep track of the 2 longest-lasting downstreams */
-            for (i = n; i > 0 && wt_compare(d[i-1]->expiry, p->expiry) < 0; i--)
-                d[i] = d[i-1];
-            d[i] = p;
-            if (n < 2)
-                n++;
-        }
+    if (index + 1 < fs->count) {
+        if (step == 0)
+            step = len;
+        if (len != step)
+            return(0);
     }
-    /* Send the interests out */
-    upstreams = 0; /* Count unexpired upstreams */
-    for (p = ie->pfl; p != NULL; p = next) {
-        next = p->next;
-        if ((p->pfi_flags & CCND_PFI_UPSTREAM) == 0)
-            continue;
-        face = face_from_faceid(h, p->faceid);
-        if (face == NULL || (face->flags & CCN_FACE_NOSEND) != 0) {
-            pfi_destroy(h, ie, p);
-            continue;
-        }
-        if ((face->flags & CCN_FACE_DC) != 0 &&
-            (p->pfi_flags & CCND_PFI_DCFACE) == 0) {
-            /* Add 60 ms extra delay before sending to a DC face */
-            p->expiry += (60 * WTHZ + 999) / 1000;
-            p->pfi_flags |= CCND_PFI_DCFACE;
-        }
-        if (wt_compare(now + 1, p->expiry) < 0) {
-            /* Not expired yet */
-            rem = p->expiry - now;
-            if (rem < mn)
-                mn = rem;
-            upstreams++;
-            continue;
-        }
-        for (i = 0; i < n; i++)
-            if (d[i]->faceid != p->faceid)
-                break;
-        if (i < n) {
-            p = send_interest(h, ie, d[i], p);
-            if (ie->ev != NULL)
-                ccn_schedule_cancel(h->sched, ie->ev);
-            upstreams++;
-            rem = p->expiry - now;
-            if (rem < mn)
-                mn = rem;
-        }
-        else {
-            /* Upstream expired, but we have nothing to feed it. */
-            p->pfi_flags |= CCND_PFI_UPHUNGRY;
-        }
+    else if (index == 0)
+        return(offset == 0);
+    else {
+        if (step == 0 && offset % index == 0)
+            step = offset / index;
+        if (step == 0 || len > step)
+            return(0);
     }
-    if (pending == 0 && upstreams == 0) {
-        strategy_callout(h, ie, CCNST_TIMEOUT);
-        consume_interest(h, ie);
+    if (offset != index * step)
         return(0);
-    }
-    /* Determine when we need to run again */
-    if (mn == 0) abort();
-    next_delay = mn * (1000000 / WTHZ);
-    ev->evint = h->wtnow + mn;
-    if (ie->ev != NULL) abort();
-    ie->ev = ev;
-    return(next_delay);
+    fs->step = step;
+    return(1);
 }
 
 /**
- * Append an interest Nonce value that is useful for debugging.
- *
- * This does leak some information about the origin of interests, but it
- * also makes it easier to figure out what is happening.
- *
- * The debug nonce is 12 bytes long.  When converted to hexadecimal and
- * broken into fields (big-endian style), it looks like
- *
- *   IIIIII-PPPP-FFFF-SSss-XXXXXX
+ * Process an incoming LinkFragment.
  *
- * where
- *   IIIIII - first 24 bits of the CCNDID.
- *   PPPP   - pid of the ccnd.
- *   FFFF   - 16 low-order bits of the faceid.
- *   SSss   - local time modulo 256 seconds, with 8 bits of fraction
- *   XXXXXX - 24 random bits.
+ * When the last piece of an object is in, the object is processed as
+ * if it had arrived whole; only a ContentObject is accepted this way.
+ * An object still incomplete after CCND_FRAG_TIMEOUT is dropped, as is
+ * the oldest one when a face already has CCND_FRAG_SETS in progress, or
+ * one with a fragment that does not fit the others.
  */
 static int
-ccnd_debug_nonce(struct ccnd_handle *h, struct face *face, unsigned char *s) {
+process_incoming_fragment(struct ccnd_handle *h, struct face *face,
+                          unsigned char *msg, size_t size)
+{
+    struct ccn_skeleton_decoder decoder = {0};
+    struct ccn_buf_decoder bdecoder;
+    struct ccn_buf_decoder *d;
+    struct ccnd_frag_set *fs = NULL;
+    struct ccnd_frag_set *x;
+    struct ccn_charbuf *buf;
+    const unsigned char *val = NULL;
+    size_t vsize = 0;
+    size_t offset;
+    size_t len;
+    unsigned fragid;
+    unsigned index;
+    unsigned count;
+    unsigned now;
     int i;
     
-    for (i = 0; i < 3; i++)
-        s[i] = h->ccnd_id[i];
-    s[i++] = h->logpid >> 8;
-    s[i++] = h->logpid;
-    s[i++] = face->faceid >> 8;
-    s[i++] = face->faceid;
-    s[i++] = h->sec;
-    s[i++] = h->usec * 256 / 1000000;
-    for (; i < TYPICAL_NONCE_SIZE; i++)
-        s[i] = nrand48(h->seed);
-    return(i);
+    if (ccn_ref_tagged_BLOB(CCN_DTAG_LinkFragment, msg, 0, size,
+                            &val, &vsize) < 0 || vsize <= CCND_FRAG_HDR)
+        return(-1);
+    fragid = (val[0] << 8) + val[1];
+    index = val[2];
+    count = val[3];
+    offset = ((size_t)val[4] << 24) + (val[5] << 16) + (val[6] << 8) + val[7];
+    len = vsize - CCND_FRAG_HDR;
+    if (index >= count || offset + len > CCND_FRAG_MAX_SIZE)
+        return(-1);
+    if (face->frags == NULL) {
+        face->frags = calloc(CCND_FRAG_SETS, sizeof(face->frags[0]));
+        if (face->frags == NULL)
+            return(-1);
+    }
+    now = ccnd_usec_clock(h);
+    for (i = 0; i < CCND_FRAG_SETS; i++) {
+        x = &face->frags[i];
+        if (x->count != 0 && now - x->start_usec > CCND_FRAG_TIMEOUT)
+            x->count = 0;
+        if (x->count != 0 && x->fragid == fragid)
+            fs = x;
+    }
+    if (fs == NULL) {
+        for (i = 0; i < CCND_FRAG_SETS; i++) {
+            x = &face->frags[i];
+            if (fs == NULL || x->count == 0 ||
+                (fs->count != 0 &&
+                 now - x->start_usec > now - fs->start_usec))
+                fs = x;
+            if (fs->count == 0)
+                break;
+        }
+    }
+    if (fs->count != count || fs->fragid != fragid) {
+        if (fs->buf == NULL)
+            fs->buf = ccn_charbuf_create();
+        if (fs->buf == NULL)
+            return(-1);
+        fs->buf->length = 0;
+        memset(fs->have, 0, sizeof(fs->have));
+        fs->start_usec = now;
+        fs->size = 0;
+        fs->step = 0;
+        fs->fragid = fragid;
+        fs->count = count;
+        fs->got = 0;
+    }
+    if ((fs->have[index >> 5] & (1U << (index & 31))) != 0)
+        return(0); /* duplicate */
+    if (!frag_set_fits(fs, index, offset, len)) {
+        ccnd_msg(h, "discarding inconsistent fragments on face %u, fragid %u",
+                 face->faceid, fragid);
+        fs->count = 0;
+        return(-1);
+    }
+    if (offset + len > fs->buf->length) {
+        if (ccn_charbuf_reserve(fs->buf, offset + len - fs->buf->length) == NULL)
+            return(-1);
+        fs->buf->length = offset + len;
+    }
+    memcpy(fs->buf->buf + offset, val + CCND_FRAG_HDR, len);
+    fs->have[index >> 5] |= (1U << (index & 31));
+    fs->got++;
+    if (index + 1 == count)
+        fs->size = offset + len;
+    if (fs->got < count)
+        return(0);
+    fs->count = 0;
+    buf = fs->buf;
+    if (fs->size != buf->length)
+        return(-1);
+    ccn_skeleton_decode(&decoder, buf->buf, buf->length);
+    d = ccn_buf_decoder_start(&bdecoder, buf->buf, buf->length);
+    if (decoder.state != 0 || decoder.index != buf->length ||
+        !ccn_buf_match_dtag(d, CCN_DTAG_ContentObject)) {
+        ccnd_msg(h, "discarding reassembled message on face %u, %u bytes",
+                 face->faceid, (unsigned)buf->length);
+        return(-1);
+    }
+    /* Hold on to the buffer while the message is processed */
+    fs->buf = NULL;
+    process_input_message(h, face, buf->buf, buf->length, 0);
+    if (face->frags != NULL && fs->buf == NULL)
+        fs->buf = buf;
+    else
+        ccn_charbuf_destroy(&buf);
+    return(0);
 }
 
 /**
- * Append a random interest Nonce value.
+ * Count the sequence numbers received after the one d before the highest.
  *
- * For production use, although this uses a simple PRNG.
+ * @param bits is the bitmap from a LinkAck.
+ * @param d is between 1 and 32.
  */
 static int
-ccnd_plain_nonce(struct ccnd_handle *h, struct face *face, unsigned char *s) {
-    int noncebytes = 6;
-    int i;
+link_received_after(uint32_t bits, unsigned d)
+{
+    uint32_t m = bits & ((1U << (d - 1)) - 1);
+    int n = 1; /* the highest itself */
     
-    for (i = 0; i < noncebytes; i++)
-        s[i] = nrand48(h->seed);
-    return(i);
+    for (; m != 0; m &= m - 1)
+        n++;
+    return(n);
 }
 
 /**
- * Compare two wrapped time values
+ * Process a LinkAck from the other side of a reliable link.
  *
- * @returns negative if a < b, 0 if a == b, positive if a > b
+ * A one-byte LinkAck is a link hello instead, which is noted (and
+ * answered if it asks).  Content that the LinkAck shows as received
+ * is forgotten.  Content
+ * missing from the bitmap was lost, once CCND_LINK_DUPTHRESH later
+ * sequence numbers have been received (or all of them, if fewer were
+ * sent, as in RFC 5827), and is sent again now; until then it might
+ * just be reordered.  Content sent too long before the highest to be in
+ * the bitmap is left to the link timer.
  */
 static int
-wt_compare(ccn_wrappedtime a, ccn_wrappedtime b)
-{
-    ccn_wrappedtime delta = a - b;
-    if (delta >= 0x80000000)
-        return(-1);
-    return(delta > 0);
-}
-
-/** Used in just one place; could go away */
-static struct pit_face_item *
-pfi_create(struct ccnd_handle *h,
-           unsigned faceid, unsigned flags,
-           const unsigned char *nonce, size_t noncesize,
-           struct pit_face_item **pp)
-{
-    struct pit_face_item *p;    
-    size_t nsize = TYPICAL_NONCE_SIZE;
-    
-    if (noncesize > CCND_PFI_NONCESZ) return(NULL);
-    if (noncesize > nsize)
-        nsize = noncesize;
-    p = calloc(1, sizeof(*p) + nsize - TYPICAL_NONCE_SIZE);
-    if (p == NULL) return(NULL);
-    p->faceid = faceid;
-    p->renewed = h->wtnow;
-    p->expiry = h->wtnow;
-    p->pfi_flags = (flags & ~CCND_PFI_NONCESZ) + noncesize;
-    memcpy(p->nonce, nonce, noncesize);
-    if (pp != NULL) {
-        p->next = *pp;
-        *pp = p;
-    }
-    return(p);    
-}
-
-/** Remove the pit face item from the interest entry */
-static void
-pfi_destroy(struct ccnd_handle *h, struct interest_entry *ie,
-            struct pit_face_item *p)
-{
-    struct face *face = NULL;
-    struct pit_face_item **pp;
+link_process_ack(struct ccnd_handle *h, struct face *face,
+                 unsigned char *msg, size_t size)
+{
+    struct ccnd_link *link;
+    struct ccnd_link_slot *slot;
+    struct ccnd_link_slot lost[CCND_LINK_WINDOW];
+    const unsigned char *val = NULL;
+    size_t vsize = 0;
+    unsigned short high;
+    unsigned short d;
+    unsigned short after;
+    uint32_t bits;
+    int n = 0;
+    int i;
     
-    for (pp = &ie->pfl; *pp != p; pp = &(*pp)->next) {
-        if (*pp == NULL) abort();
+    if (ccn_ref_tagged_BLOB(CCN_DTAG_LinkAck, msg, 0, size, &val, &vsize) < 0)
+        return(-1);
+    if (vsize == 1) {
+        /* Now we know, so there is no need to ask */
+        face->linkhellos = CCND_LINK_HELLO_TRIES;
+        if ((val[0] & CCND_LINK_HELLO_ACKS) != 0)
+            face->flags |= CCN_FACE_LINKOK;
+        else
+            face->flags &= ~CCN_FACE_LINKOK;
+        if ((val[0] & CCND_LINK_HELLO_FRAGS) != 0)
+            face->flags |= CCN_FACE_FRAGOK;
+        else
+            face->flags &= ~CCN_FACE_FRAGOK;
+        if ((val[0] & CCND_LINK_HELLO_ASK) != 0)
+            link_send_hello(h, face, 0);
+        return(0);
     }
-    if ((p->pfi_flags & CCND_PFI_PENDING) != 0) {
-        face = face_from_faceid(h, p->faceid);
-        if (face != NULL)
-            face->pending_interests -= 1;
+    if (vsize != 6)
+        return(-1);
+    link = link_create(h, face);
+    if (link == NULL)
+        return(0);
+    face->flags |= (CCN_FACE_LINKACK | CCN_FACE_LINKOK);
+    high = (val[0] << 8) + val[1];
+    bits = ((uint32_t)val[2] << 24) + (val[3] << 16) + (val[4] << 8) + val[5];
+    for (i = 0; i < CCND_LINK_WINDOW; i++) {
+        slot = &link->slot[i];
+        if (slot->accession == 0)
+            continue;
+        d = high - slot->seq;
+        if (d == 0) {
+            link_rtt_sample(link, ccnd_usec_clock(h) - slot->sent_usec);
+            slot->accession = 0;
+        }
+        else if (d >= 0x8000)
+            continue; /* sent after the LinkAck's news */
+        else if (d > 32)
+            continue; /* not in the bitmap */
+        else if ((bits & (1U << (d - 1))) != 0)
+            slot->accession = 0;
+        else {
+            after = face->pktseq - 1 - slot->seq;
+            if (after > CCND_LINK_DUPTHRESH)
+                after = CCND_LINK_DUPTHRESH;
+            if (link_received_after(bits, d) >= after) {
+                lost[n++] = *slot;
+                slot->accession = 0;
+            }
+        }
     }
-    *pp = p->next;
-    free(p);
+    for (i = 0; i < n; i++)
+        link_retransmit(h, face, &lost[i]);
+    return(0);
 }
 
 /**
- * Find the pit face item with the given flag set,
- * or create it if not present.
+ * Scheduled event for reliable links.
  *
- * New items are appended to the end of the list
+ * Sends any LinkAck that has been held back, and sends again content
+ * that has gone unacknowledged for longer than the retransmit timeout.
+ * Runs every CCND_LINK_TICK microseconds while there is work pending.
  */
-static struct pit_face_item *
-pfi_seek(struct ccnd_handle *h, struct interest_entry *ie,
-         unsigned faceid, unsigned pfi_flag)
+static int
+link_timer(struct ccn_schedule *sched,
+           void *clienth,
+           struct ccn_scheduled_event *ev,
+           int flags)
 {
-    struct pit_face_item *p;
-    struct pit_face_item **pp;
+    struct ccnd_handle *h = clienth;
+    struct ccnd_link_slot lost[CCND_LINK_WINDOW];
+    struct ccnd_link_slot *slot;
+    struct ccnd_link *link;
+    struct face *face;
+    unsigned now;
+    int busy = 0;
+    int n;
+    int i;
+    int j;
+    (void)(sched);
+    (void)(ev);
     
-    for (pp = &ie->pfl, p = ie->pfl; p != NULL; pp = &p->next, p = p->next) {
-        if (p->faceid == faceid && (p->pfi_flags & pfi_flag) != 0)
-            return(p);
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0) {
+        h->link_timer = NULL;
+        return(0);
     }
-    p = calloc(1, sizeof(*p));
-    if (p != NULL) {
-        p->faceid = faceid;
-        p->pfi_flags = pfi_flag;
-        p->expiry = h->wtnow;
-        *pp = p;
+    now = ccnd_usec_clock(h);
+    for (i = 0; i < h->face_limit; i++) {
+        face = h->faces_by_faceid[i];
+        if (face == NULL || face->link == NULL)
+            continue;
+        link = face->link;
+        if (link->unacked != 0)
+            link_send_ack(h, face);
+        for (n = 0, j = 0; j < CCND_LINK_WINDOW; j++) {
+            slot = &link->slot[j];
+            if (slot->accession == 0)
+                continue;
+            if (now - slot->sent_usec >= link->rto) {
+                lost[n++] = *slot;
+                slot->accession = 0;
+            }
+            else
+                busy = 1;
+        }
+        if (n > 0) {
+            /* Back off, since the estimate was evidently too short */
+            link->rto = link->rto * 2;
+            if (link->rto > CCND_LINK_RTO_MAX)
+                link->rto = CCND_LINK_RTO_MAX;
+            for (j = 0; j < n; j++)
+                link_retransmit(h, face, &lost[j]);
+            busy = 1;
+        }
     }
-    return(p);
+    if (!busy) {
+        h->link_timer = NULL;
+        return(0);
+    }
+    return(CCND_LINK_TICK);
 }
 
 /**
- * Set the expiry of the pit face item based upon an interest lifetime
- *
- * lifetime is in the units specified by the CCNx protocal - 1/4096 sec
+ * Set up to send one sequence number to see it the other side wants to play.
  *
- * Also sets the renewed timestamp to now.
+ * If we don't hear a number from the other side, we won't keep sending them.
  */
 static void
-pfi_set_expiry_from_lifetime(struct ccnd_handle *h, struct interest_entry *ie,
-                             struct pit_face_item *p, intmax_t lifetime)
+ccn_link_state_init(struct ccnd_handle *h, struct face *face)
 {
-    ccn_wrappedtime delta;
-    ccn_wrappedtime odelta;
-    int minlifetime = 4096 / 4;
-    unsigned maxlifetime = 7 * 24 * 3600 * 4096U; /* one week */
+    int checkflags;
+    int matchflags;
     
-    if (lifetime < minlifetime)
-        lifetime = minlifetime;
-    if (lifetime > maxlifetime)
-        lifetime = maxlifetime;
-    lifetime = (((lifetime + 511) >> 9) << 9); /* round up - 1/8 sec */
-    delta = ((uintmax_t)lifetime * WTHZ + 4095U) / 4096U;
-    odelta = p->expiry - h->wtnow;
-    if (delta < odelta && odelta < 0x80000000)
-        ccnd_msg(h, "pfi_set_expiry_from_lifetime.%d Oops", __LINE__);
-    p->renewed = h->wtnow;
-    p->expiry = h->wtnow + delta;
+    matchflags = CCN_FACE_DGRAM;
+    checkflags = matchflags | CCN_FACE_MCAST | CCN_FACE_GG | CCN_FACE_SEQOK | \
+                 CCN_FACE_PASSIVE;
+    if ((face->flags & checkflags) != matchflags)
+        return;
+    /* Send one sequence number to see if the other side wants to play. */
+    face->pktseq = nrand48(h->seed);
+    face->flags |= CCN_FACE_SEQPROBE;
 }
 
 /**
- * Set the expiry of the pit face item using a time in microseconds from present
+ * Append a sequence number if appropriate.
  *
- * Does not set the renewed timestamp.
+ * On a reliable link, this also carries any LinkAck that is due, and
+ * notes content that is being sent so that it can be repaired if lost.
  */
 static void
-pfi_set_expiry_from_micros(struct ccnd_handle *h, struct interest_entry *ie,
-                           struct pit_face_item *p, unsigned micros)
+ccn_append_link_stuff(struct ccnd_handle *h,
+                      struct face *face,
+                      struct ccn_charbuf *c,
+                      struct content_entry *content)
 {
-    ccn_wrappedtime delta;
-    
-    delta = (micros + (1000000 / WTHZ - 1)) / (1000000 / WTHZ);
-    p->expiry = h->wtnow + delta;
+    if (face->link != NULL && face->link->unacked != 0)
+        link_append_ack(h, face, c);
+    if ((face->flags & (CCN_FACE_SEQOK | CCN_FACE_SEQPROBE)) == 0)
+        return;
+    ccn_charbuf_append_tt(c, CCN_DTAG_SequenceNumber, CCN_DTAG);
+    ccn_charbuf_append_tt(c, 2, CCN_BLOB);
+    ccn_charbuf_append_value(c, face->pktseq, 2);
+    ccnb_element_end(c);
+    if (0)
+        ccnd_msg(h, "debug.%d pkt_to %u seq %u",
+                 __LINE__, face->faceid, (unsigned)face->pktseq);
+    if (content != NULL && face->link != NULL &&
+        (face->flags & CCN_FACE_LINKACK) != 0)
+        link_note_sent(h, face, face->pktseq, content);
+    face->pktseq++;
+    face->flags &= ~CCN_FACE_SEQPROBE;
 }
 
 /**
- * Set the nonce in a pit face item
- *
- * @returns the replacement value, which is p unless the nonce will not fit.
+ * Process an incoming link message.
  */
-static struct pit_face_item *
-pfi_set_nonce(struct ccnd_handle *h, struct interest_entry *ie,
-             struct pit_face_item *p,
-             const unsigned char *nonce, size_t noncesize)
+static int
+process_incoming_link_message(struct ccnd_handle *h,
+                              struct face *face, enum ccn_dtag dtag,
+                              unsigned char *msg, size_t size)
 {
-    struct pit_face_item *q = NULL;    
-    size_t nsize;
-    
-    nsize = (p->pfi_flags & CCND_PFI_NONCESZ);
-    if (noncesize != nsize) {
-        if (noncesize > TYPICAL_NONCE_SIZE) {
-            /* Hard case, need to reallocate */
-            q = pfi_create(h, p->faceid, p->pfi_flags,
-                           nonce, noncesize, &p->next);
-            if (q != NULL) {
-                q->renewed = p->renewed;
-                q->expiry = p->expiry;
-                p->pfi_flags = 0; /* preserve pending interest accounting */
-                pfi_destroy(h, ie, p);
+    uintmax_t s;
+    int checkflags;
+    int matchflags;
+    struct ccn_buf_decoder decoder;
+    struct ccn_buf_decoder *d = ccn_buf_decoder_start(&decoder, msg, size);
+
+    switch (dtag) {
+        case CCN_DTAG_SequenceNumber:
+            s = ccn_parse_required_tagged_binary_number(d, dtag, 1, 6);
+            if (d->decoder.state < 0)
+                return(d->decoder.state);
+            /*
+             * If the other side is unicast and sends sequence numbers,
+             * then it is OK for us to send numbers as well.
+             */
+            matchflags = CCN_FACE_DGRAM;
+            checkflags = matchflags | CCN_FACE_MCAST | CCN_FACE_SEQOK;
+            if ((face->flags & checkflags) == matchflags)
+                face->flags |= CCN_FACE_SEQOK;
+            link_hello_check(h, face);
+            if (link_create(h, face) != NULL)
+                link_note_received(h, face, s);
+            if (face->rrun == 0) {
+                face->rseq = s;
+                face->rrun = 1;
+                return(0);
             }
-            return(q);
-        }
-        p->pfi_flags = (p->pfi_flags & ~CCND_PFI_NONCESZ) + noncesize;
+            if (s == face->rseq + 1) {
+                face->rseq = s;
+                if (face->rrun < 255)
+                    face->rrun++;
+                return(0);
+            }
+            if (s > face->rseq && s - face->rseq < 255) {
+                ccnd_msg(h, "seq_gap %u %ju to %ju",
+                         face->faceid, face->rseq, s);
+                face->rseq = s;
+                face->rrun = 1;
+                return(0);
+            }
+            if (s <= face->rseq) {
+                if (face->rseq - s < face->rrun) {
+                    ccnd_msg(h, "seq_dup %u %ju", face->faceid, s);
+                    return(0);
+                }
+                if (face->rseq - s < 255) {
+                    /* Received out of order */
+                    ccnd_msg(h, "seq_ooo %u %ju", face->faceid, s);
+                    if (s == face->rseq - face->rrun) {
+                        face->rrun++;
+                        return(0);
+                    }
+                }
+            }
+            face->rseq = s;
+            face->rrun = 1;
+            break;
+        case CCN_DTAG_LinkAck:
+            return(link_process_ack(h, face, msg, size));
+        case CCN_DTAG_LinkFragment:
+            return(process_incoming_fragment(h, face, msg, size));
+        default:
+            return(-1);
     }
-    memcpy(p->nonce, nonce, noncesize);
-    return(p);
+    return(0);
 }
 
 /**
- * Return true iff the nonce in p matches the given one.
+ * Checks for inactivity on datagram faces.
+ * @returns number of faces that have gone away.
  */
 static int
-pfi_nonce_matches(struct pit_face_item *p,
-                  const unsigned char *nonce, size_t size)
+check_dgram_faces(struct ccnd_handle *h)
 {
-    if (p == NULL)
-        return(0);
-    if (size != (p->pfi_flags & CCND_PFI_NONCESZ))
-        return(0);
-    if (memcmp(nonce, p->nonce, size) != 0)
-        return(0);
-    return(1);
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    int count = 0;
+    int checkflags = CCN_FACE_DGRAM;
+    int wantflags = CCN_FACE_DGRAM;
+    int adj_req = 0;
+    
+    hashtb_start(h->dgram_faces, e);
+    while (e->data != NULL) {
+        struct face *face = e->data;
+        if (face->addr != NULL && (face->flags & checkflags) == wantflags) {
+            face->flags &= ~CCN_FACE_LC; /* Rate limit link check interests */
+            if (h->worker != NULL) {
+                /* The main thread decides when it has gone quiet */
+                hashtb_next(e);
+                continue;
+            }
+            if (face->recvcount == 0) {
+                if ((face->flags & (CCN_FACE_PERMANENT | CCN_FACE_ADJ)) == 0) {
+                    count += 1;
+                    if (face->owner != h->thread) {
+                        face_io_drop(h, face);
+                        hashtb_next(e);
+                        continue;
+                    }
+                    hashtb_delete(e);
+                    continue;
+                }
+            }
+            else if (face->recvcount == 1) {
+                face->recvcount = 0;
+            }
+            else {
+                face->recvcount = 1; /* go around twice */
+            }
+        }
+        hashtb_next(e);
+    }
+    hashtb_end(e);
+    if (adj_req) {
+        process_internal_client_buffer(h);
+    }
+    return(count);
 }
 
 /**
- * Copy a nonce from src into p
+ * Ask the worker that does the i/o of a face to stop, and give it back.
  *
- * @returns p (or its replacement)
+ * Nothing more is sent on the face meanwhile.
  */
-static struct pit_face_item *
-pfi_copy_nonce(struct ccnd_handle *h, struct interest_entry *ie,
-             struct pit_face_item *p, const struct pit_face_item *src)
+static void
+face_io_drop(struct ccnd_handle *h, struct face *face)
 {
-    p = pfi_set_nonce(h, ie, p, src->nonce, src->pfi_flags & CCND_PFI_NONCESZ);
-    return(p);
+    struct ccnd_packet *p;
+    
+    if (face->dropping)
+        return;
+    p = ccnd_packet_create(CCND_PKT_DROP);
+    if (p == NULL)
+        return;
+    face->dropping = 1;
+    face->flags |= CCN_FACE_NOSEND;
+    p->faceid = face->faceid;
+    ccnd_workers_post(h, face->owner, p);
+    h->faces_changed++;
 }
 
 /**
- * True iff the nonce in p does not occur in any of the other items of the entry
+ * Destroys the face identified by faceid.
+ * @returns 0 for success, -1 for failure.
  */
-static int
-pfi_unique_nonce(struct ccnd_handle *h, struct interest_entry *ie,
-                 struct pit_face_item *p)
+int
+ccnd_destroy_face(struct ccnd_handle *h, unsigned faceid)
 {
-    struct pit_face_item *q = NULL;
-    size_t nsize;
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct face *face;
+    int dgram_chk = CCN_FACE_DGRAM | CCN_FACE_MCAST;
+    int dgram_want = CCN_FACE_DGRAM;
     
-    if (p == NULL)
-        return(1);
-    nsize = (p->pfi_flags & CCND_PFI_NONCESZ);
-    for (q = ie->pfl; q != NULL; q = q->next) {
-        if (q != p && pfi_nonce_matches(q, p->nonce, nsize))
+    face = face_from_faceid(h, faceid);
+    if (face == NULL)
+        return(-1);
+    if (face->owner != h->thread) {
+        /* Its worker gives it back first; see CCND_PKT_GONE */
+        face_io_drop(h, face);
+        return(0);
+    }
+    if ((face->flags & dgram_chk) == dgram_want) {
+        hashtb_start(h->dgram_faces, e);
+        hashtb_seek(e, face->addr, face->addrlen, 0);
+        if (e->data == face)
+            face = NULL;
+        hashtb_delete(e);
+        hashtb_end(e);
+        if (face == NULL)
             return(0);
     }
-    return(1);
+    shutdown_client_fd(h, face->recv_fd);
+    face = NULL;
+    return(0);
 }
 
 /**
- * Schedules the propagation of an Interest message.
+ * Remove expired faces from *ip
  */
-static int
-propagate_interest(struct ccnd_handle *h,
-                   struct face *face,
-                   unsigned char *msg,
-                   struct ccn_parsed_interest *pi,
-                   struct nameprefix_entry *npe)
+static void
+check_forward_to(struct ccnd_handle *h, struct ccn_indexbuf **ip)
 {
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
-    struct pit_face_item *p = NULL;
-    struct interest_entry *ie = NULL;
-    struct ccn_indexbuf *outbound = NULL;
-    const unsigned char *nonce;
-    intmax_t lifetime;
-    ccn_wrappedtime expiry;
-    unsigned char cb[TYPICAL_NONCE_SIZE];
-    size_t noncesize;
-    unsigned faceid;
+    struct ccn_indexbuf *ft = *ip;
     int i;
-    int res;
-    int usec;
-    
-    faceid = face->faceid;
-    hashtb_start(h->interest_tab, e);
-    res = hashtb_seek(e, msg, pi->offset[CCN_PI_B_InterestLifetime], 1);
-    if (res < 0) goto Bail;
-    ie = e->data;
-    if (res == HT_NEW_ENTRY) {
-        ie->serial = ++h->iserial;
-        ie->strategy.birth = h->wtnow;
-        ie->strategy.renewed = h->wtnow;
-        ie->strategy.renewals = 0;
-    }
-    if (ie->interest_msg == NULL) {
-        struct ccn_parsed_interest xpi = {0};
-        int xres;
-        link_interest_entry_to_nameprefix(h, ie, npe);
-        ie->interest_msg = e->key;
-        ie->size = pi->offset[CCN_PI_B_InterestLifetime] + 1;
-        /* Ugly bit, this.  Clear the extension byte. */
-        ((unsigned char *)(intptr_t)ie->interest_msg)[ie->size - 1] = 0;
-        xres = ccn_parse_interest(ie->interest_msg, ie->size, &xpi, NULL);
-        if (xres < 0) abort();
-    }
-    lifetime = ccn_interest_lifetime(msg, pi);
-    outbound = get_outbound_faces(h, face, msg, pi, npe);
-    if (outbound == NULL) goto Bail;
-    nonce = msg + pi->offset[CCN_PI_B_Nonce];
-    noncesize = pi->offset[CCN_PI_E_Nonce] - pi->offset[CCN_PI_B_Nonce];
-    if (noncesize != 0)
-        ccn_ref_tagged_BLOB(CCN_DTAG_Nonce, msg,
-                            pi->offset[CCN_PI_B_Nonce],
-                            pi->offset[CCN_PI_E_Nonce],
-                            &nonce, &noncesize);
-    else {
-        /* This interest has no nonce; generate one before going on */
-        noncesize = (h->noncegen)(h, face, cb);
-        nonce = cb;
-    }
-    p = pfi_seek(h, ie, faceid, CCND_PFI_DNSTREAM);
-    p = pfi_set_nonce(h, ie, p, nonce, noncesize);
-    if (nonce == cb || pfi_unique_nonce(h, ie, p)) {
-        ie->strategy.renewed = h->wtnow;
-        ie->strategy.renewals += 1;
-        if ((p->pfi_flags & CCND_PFI_PENDING) == 0) {
-            p->pfi_flags |= CCND_PFI_PENDING;
-            face->pending_interests += 1;
-        }
-    }
-    else {
-        /* Nonce has been seen before; do not forward. */
-        p->pfi_flags |= CCND_PFI_SUPDATA;
-    }
-    pfi_set_expiry_from_lifetime(h, ie, p, lifetime);
-    for (i = 0; i < outbound->n; i++) {
-        p = pfi_seek(h, ie, outbound->buf[i], CCND_PFI_UPSTREAM);
-        if (wt_compare(p->expiry, h->wtnow) < 0) {
-            p->expiry = h->wtnow + 1; // ZZZZ - the +1 may be overkill here.
-            p->pfi_flags &= ~CCND_PFI_UPHUNGRY;
-        }
-    }
-    if (res == HT_NEW_ENTRY)
-        strategy_callout(h, ie, CCNST_FIRST);
-    usec = ie_next_usec(h, ie, &expiry);
-    if (ie->ev != NULL && wt_compare(expiry + 2, ie->ev->evint) < 0)
-        ccn_schedule_cancel(h->sched, ie->ev);
-    if (ie->ev == NULL)
-        ie->ev = ccn_schedule_event(h->sched, usec, do_propagate, ie, expiry);
-Bail:
-    hashtb_end(e);
-    ccn_indexbuf_destroy(&outbound);
-    return(res);
+    int j;
+    if (ft == NULL)
+        return;
+    for (i = 0; i < ft->n; i++)
+        if (face_from_faceid(h, ft->buf[i]) == NULL)
+            break;
+    for (j = i + 1; j < ft->n; j++)
+        if (face_from_faceid(h, ft->buf[j]) != NULL)
+            ft->buf[i++] = ft->buf[j];
+    if (i == 0)
+        ccn_indexbuf_destroy(ip);
+    else if (i < ft->n)
+        ft->n = i;
 }
 
 /**
- * We have a FIB change - accelerate forwarding of existing interests
+ * Ages src info and retires unused nameprefix entries.
+ * @returns number that have gone away.
  */
-static void
-update_npe_children(struct ccnd_handle *h, struct nameprefix_entry *npe, unsigned faceid)
+static int
+check_nameprefix_entries(struct ccnd_handle *h)
 {
+    int count = 0;
     struct hashtb_enumerator ee;
     struct hashtb_enumerator *e = &ee;
-    struct face *fface = NULL;
-    struct ccn_parsed_interest pi;
-    struct pit_face_item *p = NULL;
-    struct interest_entry *ie = NULL;
-    struct nameprefix_entry *x = NULL;
-    struct ccn_indexbuf *ob = NULL;
-    int i;
-    unsigned usec = 6000; /*  a bit of time for prefix reg  */
-
-    hashtb_start(h->interest_tab, e);
-    for (ie = e->data; ie != NULL; ie = e->data) {
-        for (x = ie->ll.npe; x != NULL; x = x->parent) {
-            if (x == npe) {
-                for (fface = NULL, p = ie->pfl; p != NULL; p = p->next) {
-                    if (p->faceid == faceid) {
-                        if ((p->pfi_flags & CCND_PFI_UPSTREAM) != 0) {
-                            fface = NULL;
-                            break;
-                        }
-                    }
-                    else if ((p->pfi_flags & CCND_PFI_DNSTREAM) != 0) {
-                        if (fface == NULL || (fface->flags & CCN_FACE_GG) == 0)
-                            fface = face_from_faceid(h, p->faceid);
-                    }
-                }
-                if (fface != NULL) {
-                    ccn_parse_interest(ie->interest_msg, ie->size, &pi, NULL);
-                    ob = get_outbound_faces(h, fface, ie->interest_msg,
-                                            &pi, ie->ll.npe);
-                    for (i = 0; i < ob->n; i++) {
-                        if (ob->buf[i] == faceid) {
-                            p = pfi_seek(h, ie, faceid, CCND_PFI_UPSTREAM);
-                            if ((p->pfi_flags & CCND_PFI_UPENDING) == 0) {
-                                p->expiry = h->wtnow + usec / (1000000 / WTHZ);
-                                usec += 200;
-                                if (ie->ev != NULL && wt_compare(p->expiry + 4, ie->ev->evint) < 0)
-                                    ccn_schedule_cancel(h->sched, ie->ev);
-                                if (ie->ev == NULL)
-                                    ie->ev = ccn_schedule_event(h->sched, usec, do_propagate, ie, p->expiry);
-                            }
-                            break;
-                        }
-                    }
-                    ccn_indexbuf_destroy(&ob);
+    struct ielinks *head;
+    struct nameprefix_entry *npe;    
+    
+    hashtb_start(h->nameprefix_tab, e);
+    for (npe = e->data; npe != NULL; npe = e->data) {
+        if (  npe->src == CCN_NOFACEID &&
+              npe->children == 0 &&
+              npe->forwarding == NULL) {
+            head = &npe->ie_head;
+            if (head == head->next && npe->ie_exact.next == &npe->ie_exact) {
+                count += 1;
+                if (npe->parent != NULL) {
+                    npe->parent->children--;
+                    npe->parent = NULL;
                 }
-                break;
+                hashtb_delete(e);
+                continue;
             }
         }
+        check_forward_to(h, &npe->forward_to);
+        check_forward_to(h, &npe->tap);
+        npe->osrc = npe->src;
+        npe->src = CCN_NOFACEID;
         hashtb_next(e);
     }
     hashtb_end(e);
+    return(count);
+}
+
+static void
+check_comm_file(struct ccnd_handle *h)
+{
+    if (!comm_file_ok()) {
+        ccnd_msg(h, "stopping (%s gone)", unlink_this_at_exit);
+        unlink_this_at_exit = NULL;
+        h->running = 0;
+    }
 }
 
 /**
- * Creates a nameprefix entry if it does not already exist, together
- * with all of its parents.
+ * Scheduled reap event for retiring expired structures.
  */
 static int
-nameprefix_seek(struct ccnd_handle *h, struct hashtb_enumerator *e,
-                const unsigned char *msg, struct ccn_indexbuf *comps, int ncomps)
+reap(
+    struct ccn_schedule *sched,
+    void *clienth,
+    struct ccn_scheduled_event *ev,
+    int flags)
 {
-    int i;
-    int base;
-    int res = -1;
-    struct nameprefix_entry *parent = NULL;
-    struct nameprefix_entry *npe = NULL;
-    struct ielinks *head = NULL;
-
-    if (ncomps + 1 > comps->n)
-        return(-1);
-    base = comps->buf[0];
-    for (i = 0; i <= ncomps; i++) {
-        res = hashtb_seek(e, msg + base, comps->buf[i] - base, 0);
-        if (res < 0)
-            break;
-        npe = e->data;
-        if (res == HT_NEW_ENTRY) {
-            head = &npe->ie_head;
-            head->next = head;
-            head->prev = head;
-            head->npe = NULL;
-            npe->parent = parent;
-            npe->forwarding = NULL;
-            npe->fgen = h->forward_to_gen - 1;
-            npe->forward_to = NULL;
-            if (parent != NULL) {
-                parent->children++;
-                npe->flags = parent->flags;
-                npe->src = parent->src;
-                npe->osrc = parent->osrc;
-                npe->usec = parent->usec;
-            }
-            else {
-                npe->src = npe->osrc = CCN_NOFACEID;
-                npe->usec = (nrand48(h->seed) % 4096U) + 8192;
-            }
-        }
-        parent = npe;
+    struct ccnd_handle *h = clienth;
+    (void)(sched);
+    (void)(ev);
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0) {
+        h->reaper = NULL;
+        return(0);
     }
-    return(res);
+    check_dgram_faces(h);
+    check_nameprefix_entries(h);
+    if (h->worker == NULL)
+        check_comm_file(h);
+    return(2 * CCN_INTEREST_LIFETIME_MICROSEC);
 }
 
-// ZZZZ - not in the most obvious place - move closer to other content table stuff
-// XXX - missing doxy
-static struct content_entry *
-next_child_at_level(struct ccnd_handle *h,
-                    struct content_entry *content, int level)
+static void
+reap_needed(struct ccnd_handle *h, int init_delay_usec)
 {
-    struct content_entry *next = NULL;
-    struct ccn_charbuf *name;
-    struct ccn_indexbuf *pred[CCN_SKIPLIST_MAX_DEPTH] = {NULL};
-    int d;
-    int res;
-    
-    if (content == NULL)
-        return(NULL);
-    if (content->ncomps <= level + 1)
-        return(NULL);
-    name = ccn_charbuf_create();
-    ccn_name_init(name);
-    res = ccn_name_append_components(name, content->key,
-                                     content->comps[0],
-                                     content->comps[level + 1]);
-    if (res < 0) abort();
-    res = ccn_name_next_sibling(name);
-    if (res < 0) abort();
-    if (h->debug & 8)
-        ccnd_debug_ccnb(h, __LINE__, "child_successor", NULL,
-                        name->buf, name->length);
-    d = content_skiplist_findbefore(h, name->buf, name->length,
-                                    NULL, pred);
-    next = content_from_accession(h, pred[0]->buf[0]);
-    if (next == content) {
-        // XXX - I think this case should not occur, but just in case, avoid a loop.
-        next = content_from_accession(h, content_skiplist_next(h, content));
-        ccnd_debug_ccnb(h, __LINE__, "bump", NULL, next->key, next->size);
-    }
-    ccn_charbuf_destroy(&name);
-    return(next);
+    if (h->reaper == NULL)
+        h->reaper = ccn_schedule_event(h->sched, init_delay_usec, reap, NULL, 0);
 }
 
 /**
- * Check whether the interest should be dropped for local namespace reasons
+ * Remove a content object from the store
+ *
+ * @returns 0, or -1 if it is pinned by a packet or stand-in of
+ *          another thread and must stay for now.
  */
 static int
-drop_nonlocal_interest(struct ccnd_handle *h, struct nameprefix_entry *npe,
-                       struct face *face,
-                       unsigned char *msg, size_t size)
-{
-    if (npe->fgen != h->forward_to_gen)
-        update_forward_to(h, npe);
-    if ((npe->flags & CCN_FORW_LOCAL) != 0 &&
-        (face->flags & CCN_FACE_GG) == 0) {
-        ccnd_debug_ccnb(h, __LINE__, "interest_nonlocal", face, msg, size);
-        h->interests_dropped += 1;
-        return (1);
-    }
-    return(0);
-}
-
-/**
- * Process an incoming interest message.
- *
- * Parse the Interest and discard if it does not parse.
- * Check for correct scope (a scope 0 or scope 1 interest should never
- *  arrive on an external face).
- * Check for a duplicated Nonce, discard if it has been seen before.
- * Look up the name prefix.  Check for a local namespace and discard
- *  if an interest in a local namespace arrives from outside.
- * Consult the content store.  If a suitable matching ContentObject is found,
- *  prepare to send it, consuming this interest and any pending interests
- *  on that face that also match this object.
- * Otherwise, initiate propagation of the interest.
- */
-static void
-process_incoming_interest(struct ccnd_handle *h, struct face *face,
-                          unsigned char *msg, size_t size)
+remove_content(struct ccnd_handle *h, struct content_entry *content)
 {
     struct hashtb_enumerator ee;
     struct hashtb_enumerator *e = &ee;
-    struct ccn_parsed_interest parsed_interest = {0};
-    struct ccn_parsed_interest *pi = &parsed_interest;
-    size_t namesize = 0;
-    int k;
     int res;
-    int try;
-    int matched;
-    int s_ok;
-    struct interest_entry *ie = NULL;
-    struct nameprefix_entry *npe = NULL;
-    struct content_entry *content = NULL;
-    struct content_entry *last_match = NULL;
-    struct ccn_indexbuf *comps = indexbuf_obtain(h);
-    if (size > 65535)
-        res = -__LINE__;
-    else
-        res = ccn_parse_interest(msg, size, pi, comps);
-    if (res < 0) {
-        ccnd_msg(h, "error parsing Interest - code %d", res);
-        ccn_indexbuf_destroy(&comps);
-        return;
-    }
-    ccnd_meter_bump(h, face->meter[FM_INTI], 1);
-    if (pi->scope >= 0 && pi->scope < 2 &&
-             (face->flags & CCN_FACE_GG) == 0) {
-        ccnd_debug_ccnb(h, __LINE__, "interest_outofscope", face, msg, size);
-        h->interests_dropped += 1;
-    }
-    else {
-        if (h->debug & (16 | 8 | 2))
-            ccnd_debug_ccnb(h, __LINE__, "interest_from", face, msg, size);
-        if (pi->magic < 20090701) {
-            if (++(h->oldformatinterests) == h->oldformatinterestgrumble) {
-                h->oldformatinterestgrumble *= 2;
-                ccnd_msg(h, "downrev interests received: %d (%d)",
-                         h->oldformatinterests,
-                         pi->magic);
-            }
-        }
-        namesize = comps->buf[pi->prefix_comps] - comps->buf[0];
-        h->interests_accepted += 1;
-        ie = hashtb_lookup(h->interest_tab, msg,
-                           pi->offset[CCN_PI_B_InterestLifetime]);
-        if (ie != NULL) {
-            /* Since this is in the PIT, we do not need to check the CS. */
-            indexbuf_release(h, comps);
-            comps = NULL;
-            npe = ie->ll.npe;
-            if (drop_nonlocal_interest(h, npe, face, msg, size))
-                return;
-            propagate_interest(h, face, msg, pi, npe);
-            return;
-        }
-        if (h->debug & 16) {
-            /* Only print details that are not already presented */
-            // ZZZZ - should do nifty Exclude presentation here
-            ccnd_msg(h,
-                     "version: %d, "
-                     "excl: %d bytes, "
-                     "etc: %d bytes",
-                     pi->magic,
-                     pi->offset[CCN_PI_E_Exclude] - pi->offset[CCN_PI_B_Exclude],
-                     pi->offset[CCN_PI_E_OTHER] - pi->offset[CCN_PI_B_OTHER]);
-        }
-        s_ok = (pi->answerfrom & CCN_AOK_STALE) != 0;
-        matched = 0;
-        hashtb_start(h->nameprefix_tab, e);
-        res = nameprefix_seek(h, e, msg, comps, pi->prefix_comps);
-        npe = e->data;
-        if (npe == NULL || drop_nonlocal_interest(h, npe, face, msg, size))
-            goto Bail;
-        if ((pi->answerfrom & CCN_AOK_CS) != 0) {
-            last_match = NULL;
-            content = find_first_match_candidate(h, msg, pi);
-            if (content != NULL && (h->debug & 8))
-                ccnd_debug_ccnb(h, __LINE__, "first_candidate", NULL,
-                                content->key,
-                                content->size);
-            if (content != NULL &&
-                !content_matches_interest_prefix(h, content, msg, comps,
-                                                 pi->prefix_comps)) {
-                if (h->debug & 8)
-                    ccnd_debug_ccnb(h, __LINE__, "prefix_mismatch", NULL,
-                                    msg, size);
-                content = NULL;
-            }
-            for (try = 0; content != NULL; try++) {
-                if ((s_ok || (content->flags & CCN_CONTENT_ENTRY_STALE) == 0) &&
-                    ccn_content_matches_interest(content->key,
-                                       content->size,
-                                       0, NULL, msg, size, pi)) {
-                    if (h->debug & 8)
-                        ccnd_debug_ccnb(h, __LINE__, "matches", NULL,
-                                        content->key,
-                                        content->size);
-                    if ((pi->orderpref & 1) == 0) // XXX - should be symbolic
-                        break;
-                    last_match = content;
-                    content = next_child_at_level(h, content, comps->n - 1);
-                    goto check_next_prefix;
-                }
-                content = content_from_accession(h, content_skiplist_next(h, content));
-            check_next_prefix:
-                if (content != NULL &&
-                    !content_matches_interest_prefix(h, content, msg,
-                                                     comps, pi->prefix_comps)) {
-                    if (h->debug & 8)
-                        ccnd_debug_ccnb(h, __LINE__, "prefix_mismatch", NULL,
-                                        content->key,
-                                        content->size);
-                    content = NULL;
-                }
-            }
-            if (last_match != NULL)
-                content = last_match;
-            if (content != NULL) {
-                /* Check to see if we are planning to send already */
-                enum cq_delay_class c;
-                for (c = 0, k = -1; c < CCN_CQ_N && k == -1; c++)
-                    if (face->q[c] != NULL)
-                        k = ccn_indexbuf_member(face->q[c]->send_queue, content->accession);
-                if (k == -1) {
-                    k = face_send_queue_insert(h, face, content);
-                    if (k >= 0) {
-                        if (h->debug & (32 | 8))
-                            ccnd_debug_ccnb(h, __LINE__, "consume", face, msg, size);
-                    }
-                    /* Any other matched interests need to be consumed, too. */
-                    match_interests(h, content, NULL, face, NULL);
-                }
-                if ((pi->answerfrom & CCN_AOK_EXPIRE) != 0)
-                    mark_stale(h, content);
-                matched = 1;
-            }
-        }
-        if (!matched && npe != NULL && (pi->answerfrom & CCN_AOK_EXPIRE) == 0)
-            propagate_interest(h, face, msg, pi, npe);
-    Bail:
-        hashtb_end(e);
-    }
-    indexbuf_release(h, comps);
-}
-
-/**
- * Mark content as stale
- */
-static void
-mark_stale(struct ccnd_handle *h, struct content_entry *content)
-{
-    ccn_accession_t accession = content->accession;
+    if (content == NULL)
+        return(-1);
+    if (__atomic_load_n(&content->pins, __ATOMIC_ACQUIRE) != 0)
+        return(-1);
+    hashtb_start(h->content_tab, e);
+    res = hashtb_seek(e, content->key, content->size, 0);
+    if (res != HT_OLD_ENTRY)
+        abort();
     if ((content->flags & CCN_CONTENT_ENTRY_STALE) != 0)
-        return;
+        h->n_stale--;
     if (h->debug & 4)
-            ccnd_debug_ccnb(h, __LINE__, "stale", NULL,
-                            content->key, content->size);
-    content->flags |= CCN_CONTENT_ENTRY_STALE;
-    h->n_stale++;
-    if (accession < h->min_stale)
-        h->min_stale = accession;
-    if (accession > h->max_stale)
-        h->max_stale = accession;
+        ccnd_debug_ccnb(h, __LINE__, "remove", NULL,
+                        content->key, content->size);
+    hashtb_delete(e);
+    hashtb_end(e);
+    return(0);
 }
 
 /**
- * Scheduled event that makes content stale when its FreshnessSeconds
- * has exported.
+ * Periodic content cleaning
  *
- * May actually remove the content if we are over quota.
+ * Evicts from the cold end of the replacement list until the store is
+ * back within its limits.  Unsolicited and stale content is put at that
+ * end, so it goes first.  Content that is pinned is passed over, and
+ * tried again later.
  */
 static int
-expire_content(struct ccn_schedule *sched,
-               void *clienth,
-               struct ccn_scheduled_event *ev,
-               int flags)
+clean_daemon(struct ccn_schedule *sched,
+             void *clienth,
+             struct ccn_scheduled_event *ev,
+             int flags)
 {
     struct ccnd_handle *h = clienth;
-    ccn_accession_t accession = ev->evint;
-    struct content_entry *content = NULL;
-    int res;
-    unsigned n;
-    if ((flags & CCN_SCHEDULE_CANCEL) != 0)
+    (void)(sched);
+    (void)(ev);
+    int check_limit = 500;  /* Do not run for too long at once */
+    struct content_entry *victim;
+    struct content_entry *next;
+    int pinned = 0;
+    
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0) {
+        h->clean = NULL;
         return(0);
-    content = content_from_accession(h, accession);
-    if (content != NULL) {
-        n = hashtb_n(h->content_tab);
-        /* The fancy test here lets existing stale content go away, too. */
-        if ((n - (n >> 3)) > h->capacity ||
-            (n > h->capacity && h->min_stale > h->max_stale)) {
-            res = remove_content(h, content);
-            if (res == 0)
-                return(0);
-        }
-        mark_stale(h, content);
     }
+    victim = h->lru_oldest;
+    while (content_store_over_limit(h, 0) && victim != NULL) {
+        if (check_limit-- <= 0)
+            return(5000);
+        next = victim->lru_next;
+        if (remove_content(h, victim) == 0)
+            h->cs_evictions++;
+        else
+            pinned = 1;
+        victim = next;
+    }
+    if (pinned && content_store_over_limit(h, 0))
+        return(5000);
+    h->clean = NULL;
     return(0);
 }
 
 /**
- * Schedules content expiration based on its FreshnessSeconds, and the
- * configured default and limit.
+ * Schedule clean_daemon, if it is not already scheduled.
  */
 static void
-set_content_timer(struct ccnd_handle *h, struct content_entry *content,
-                  struct ccn_parsed_ContentObject *pco)
+clean_needed(struct ccnd_handle *h)
 {
-    int seconds = 0;
-    int microseconds = 0;
-    size_t start = pco->offset[CCN_PCO_B_FreshnessSeconds];
-    size_t stop  = pco->offset[CCN_PCO_E_FreshnessSeconds];
-    if (h->force_zero_freshness) {
-        /* Keep around for long enough to make it through the queues */
-        microseconds = 8 * h->data_pause_microsec + 10000;
-        goto Finish;
-    }
-    if (start == stop)
-        seconds = h->tts_default;
-    else
-        seconds = ccn_fetch_tagged_nonNegativeInteger(
-                CCN_DTAG_FreshnessSeconds,
-                content->key,
-                start, stop);
-    if (seconds <= 0 || (h->tts_limit > 0 && seconds > h->tts_limit))
-        seconds = h->tts_limit;
-    if (seconds <= 0)
-        return;
-    if (seconds > ((1U<<31) / 1000000)) {
-        ccnd_debug_ccnb(h, __LINE__, "FreshnessSeconds_too_large", NULL,
-            content->key, pco->offset[CCN_PCO_E]);
-        return;
-    }
-    microseconds = seconds * 1000000;
-Finish:
-    ccn_schedule_event(h->sched, microseconds,
-                       &expire_content, NULL, content->accession);
+    if (h->clean == NULL)
+        h->clean = ccn_schedule_event(h->sched, 5000, clean_daemon, NULL, 0);
 }
 
 /**
- * Process an arriving ContentObject.
- *
- * Parse the ContentObject and discard if it is not well-formed.
- *
- * Compute the digest.
- *
- * Look it up in the content store.  It it is already there, but is stale,
- * make it fresh again.  If it is not there, add it.
- *
- * Find the matching pending interests in the PIT and consume them,
- * queueing the ContentObject to be sent on the associated faces.
- * If no matches were found and the content object was new, discard remove it
- * from the store.
- *
- * XXX - the change to staleness should also not happen if there was no
- * matching PIT entry.
+ * Start cleaning if the content store is over its limits.
  */
-static void
-process_incoming_content(struct ccnd_handle *h, struct face *face,
-                         unsigned char *wire_msg, size_t wire_size)
+void
+ccnd_cs_check(struct ccnd_handle *h)
 {
-    unsigned char *msg;
-    size_t size;
+    if (content_store_over_limit(h, 0))
+        clean_needed(h);
+}
+
+/**
+ * Age out the old forwarding table entries
+ */
+static int
+age_forwarding(struct ccn_schedule *sched,
+             void *clienth,
+             struct ccn_scheduled_event *ev,
+             int flags)
+{
+    struct ccnd_handle *h = clienth;
     struct hashtb_enumerator ee;
     struct hashtb_enumerator *e = &ee;
-    struct ccn_parsed_ContentObject obj = {0};
-    int res;
-    size_t keysize = 0;
-    size_t tailsize = 0;
-    unsigned char *tail = NULL;
-    struct content_entry *content = NULL;
-    int i;
-    struct ccn_indexbuf *comps = indexbuf_obtain(h);
-    struct ccn_charbuf *cb = charbuf_obtain(h);
-    
-    msg = wire_msg;
-    size = wire_size;
+    struct ccn_forwarding *f;
+    struct ccn_forwarding *next;
+    struct ccn_forwarding **p;
+    struct nameprefix_entry *npe;
     
-    res = ccn_parse_ContentObject(msg, size, &obj, comps);
-    if (res < 0) {
-        ccnd_msg(h, "error parsing ContentObject - code %d", res);
-        goto Bail;
-    }
-    ccnd_meter_bump(h, face->meter[FM_DATI], 1);
-    if (comps->n < 1 ||
-        (keysize = comps->buf[comps->n - 1]) > 65535 - 36) {
-        ccnd_msg(h, "ContentObject with keysize %lu discarded",
-                 (unsigned long)keysize);
-        ccnd_debug_ccnb(h, __LINE__, "oversize", face, msg, size);
-        res = -__LINE__;
-        goto Bail;
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0) {
+        h->age_forwarding = NULL;
+        return(0);
     }
-    /* Make the ContentObject-digest name component explicit */
-    ccn_digest_ContentObject(msg, &obj);
-    if (obj.digest_bytes != 32) {
-        ccnd_debug_ccnb(h, __LINE__, "indigestible", face, msg, size);
-        goto Bail;
-    }
-    i = comps->buf[comps->n - 1];
-    ccn_charbuf_append(cb, msg, i);
-    ccn_charbuf_append_tt(cb, CCN_DTAG_Component, CCN_DTAG);
-    ccn_charbuf_append_tt(cb, obj.digest_bytes, CCN_BLOB);
-    ccn_charbuf_append(cb, obj.digest, obj.digest_bytes);
-    ccn_charbuf_append_closer(cb);
-    ccn_charbuf_append(cb, msg + i, size - i);
-    msg = cb->buf;
-    size = cb->length;
-    res = ccn_parse_ContentObject(msg, size, &obj, comps);
-    if (res < 0) abort(); /* must have just messed up */
-    
-    if (obj.magic != 20090415) {
-        if (++(h->oldformatcontent) == h->oldformatcontentgrumble) {
-            h->oldformatcontentgrumble *= 10;
-            ccnd_msg(h, "downrev content items received: %d (%d)",
-                     h->oldformatcontent,
-                     obj.magic);
-        }
-    }
-    if (h->debug & 4)
-        ccnd_debug_ccnb(h, __LINE__, "content_from", face, msg, size);
-    keysize = obj.offset[CCN_PCO_B_Content];
-    tail = msg + keysize;
-    tailsize = size - keysize;
-    hashtb_start(h->content_tab, e);
-    res = hashtb_seek(e, msg, keysize, tailsize);
-    content = e->data;
-    if (res == HT_OLD_ENTRY) {
-        if (tailsize != e->extsize ||
-              0 != memcmp(tail, ((unsigned char *)e->key) + keysize, tailsize)) {
-            ccnd_msg(h, "ContentObject name collision!!!!!");
-            ccnd_debug_ccnb(h, __LINE__, "new", face, msg, size);
-            ccnd_debug_ccnb(h, __LINE__, "old", NULL, e->key, e->keysize + e->extsize);
-            content = NULL;
-            hashtb_delete(e); /* XXX - Mercilessly throw away both of them. */
-            res = -__LINE__;
-        }
-        else if ((content->flags & CCN_CONTENT_ENTRY_STALE) != 0) {
-            /* When old content arrives after it has gone stale, freshen it */
-            // XXX - ought to do mischief checks before this
-            content->flags &= ~CCN_CONTENT_ENTRY_STALE;
-            h->n_stale--;
-            set_content_timer(h, content, &obj);
-            /* Record the new arrival face only if the old face is gone */
-            // XXX - it is not clear that this is the most useful choice
-            if (face_from_faceid(h, content->arrival_faceid) == NULL)
-                content->arrival_faceid = face->faceid;
-            // XXX - no counter for this case
-        }
-        else {
-            h->content_dups_recvd++;
-            ccnd_msg(h, "received duplicate ContentObject from %u (accession %llu)",
-                     face->faceid, (unsigned long long)content->accession);
-            ccnd_debug_ccnb(h, __LINE__, "dup", face, msg, size);
-        }
-    }
-    else if (res == HT_NEW_ENTRY) {
-        unsigned long n = hashtb_n(h->content_tab);
-        if (n > h->capacity + (h->capacity >> 3))
-            clean_needed(h);
-        content->accession = ++(h->accession);
-        content->arrival_faceid = face->faceid;
-        enroll_content(h, content);
-        if (content == content_from_accession(h, content->accession)) {
-            content->ncomps = comps->n;
-            content->comps = calloc(comps->n, sizeof(comps[0]));
-            if (content->comps == NULL) {
-                ccnd_msg(h, "could not enroll ContentObject (accession %llu)",
-                         (unsigned long long)content->accession);
-                content = NULL;
-                hashtb_delete(e);
-                res = -__LINE__;
-                hashtb_end(e);
-                goto Bail;
-            }
-        }
-        content->key_size = e->keysize;
-        content->size = e->keysize + e->extsize;
-        content->key = e->key;
-        for (i = 0; i < comps->n; i++)
-            content->comps[i] = comps->buf[i];
-        content_skiplist_insert(h, content);
-        set_content_timer(h, content, &obj);
-        /* Mark public keys supplied at startup as precious. */
-        if (obj.type == CCN_CONTENT_KEY && content->accession <= (h->capacity + 7)/8)
-            content->flags |= CCN_CONTENT_ENTRY_PRECIOUS;
+    hashtb_start(h->nameprefix_tab, e);
+    for (npe = e->data; npe != NULL; npe = e->data) {
+        p = &npe->forwarding;
+        for (f = npe->forwarding; f != NULL; f = next) {
+            next = f->next;
+            if ((f->flags & CCN_FORW_REFRESHED) == 0 ||
+                  face_from_faceid(h, f->faceid) == NULL) {
+                if (h->debug & 2) {
+                    struct face *face = face_from_faceid(h, f->faceid);
+                    if (face != NULL) {
+                        struct ccn_charbuf *prefix = ccn_charbuf_create();
+                        ccn_name_init(prefix);
+                        ccn_name_append_components(prefix, e->key, 0, e->keysize);
+                        ccnd_debug_ccnb(h, __LINE__, "prefix_expiry", face,
+                                prefix->buf,
+                                prefix->length);
+                        ccn_charbuf_destroy(&prefix);
+                    }
+                }
+                *p = next;
+                free(f);
+                f = NULL;
+                continue;
+            }
+            f->expires -= CCN_FWU_SECS;
+            if (f->expires <= 0)
+                f->flags &= ~CCN_FORW_REFRESHED;
+            p = &(f->next);
+        }
+        hashtb_next(e);
     }
     hashtb_end(e);
-Bail:
-    indexbuf_release(h, comps);
-    charbuf_release(h, cb);
-    cb = NULL;
-    if (res >= 0 && content != NULL) {
-        int n_matches;
-        enum cq_delay_class c;
-        struct content_queue *q;
-        n_matches = match_interests(h, content, &obj, NULL, face);
-        if (res == HT_NEW_ENTRY) {
-            if (n_matches < 0) {
-                remove_content(h, content);
-                return;
-            }
-            if (n_matches == 0 && (face->flags & CCN_FACE_GG) == 0) {
-                content->flags |= CCN_CONTENT_ENTRY_SLOWSEND;
-                ccn_indexbuf_append_element(h->unsol, content->accession);
-            }
-        }
-        // ZZZZ - review whether the following is actually needed
-        for (c = 0; c < CCN_CQ_N; c++) {
-            q = face->q[c];
-            if (q != NULL) {
-                i = ccn_indexbuf_member(q->send_queue, content->accession);
-                if (i >= 0) {
-                    /*
-                     * In the case this consumed any interests from this source,
-                     * don't send the content back
-                     */
-                    if (h->debug & 8)
-                        ccnd_debug_ccnb(h, __LINE__, "content_nosend", face, msg, size);
-                    q->send_queue->buf[i] = 0;
-                }
-            }
-        }
-    }
+    h->forward_to_gen += 1;
+    return(CCN_FWU_SECS*1000000);
 }
 
 /**
- * Process an incoming message.
- *
- * This is where we decide whether we have an Interest message,
- * a ContentObject, or something else.
+ * Make sure a call to age_forwarding is scheduled.
  */
 static void
-process_input_message(struct ccnd_handle *h, struct face *face,
-                      unsigned char *msg, size_t size, int pdu_ok)
+age_forwarding_needed(struct ccnd_handle *h)
 {
-    struct ccn_skeleton_decoder decoder = {0};
-    struct ccn_skeleton_decoder *d = &decoder;
-    ssize_t dres;
-    enum ccn_dtag dtag;
-    
-    if ((face->flags & CCN_FACE_UNDECIDED) != 0) {
-        face->flags &= ~CCN_FACE_UNDECIDED;
-        if ((face->flags & CCN_FACE_LOOPBACK) != 0)
-            face->flags |= CCN_FACE_GG;
-        /* YYY This is the first place that we know that an inbound stream face is speaking CCNx protocol. */
-        register_new_face(h, face);
-    }
-    d->state |= CCN_DSTATE_PAUSE;
-    dres = ccn_skeleton_decode(d, msg, size);
-    if (d->state < 0)
-        abort(); /* cannot happen because of checks in caller */
-    if (CCN_GET_TT_FROM_DSTATE(d->state) != CCN_DTAG) {
-        ccnd_msg(h, "discarding unknown message; size = %lu", (unsigned long)size);
-        // XXX - keep a count?
-        return;
-    }
-    dtag = d->numval;
-    switch (dtag) {
-        case CCN_DTAG_CCNProtocolDataUnit:
-            if (!pdu_ok)
-                break;
-            size -= d->index;
-            if (size > 0)
-                size--;
-            msg += d->index;
-            if ((face->flags & (CCN_FACE_LINK | CCN_FACE_GG)) != CCN_FACE_LINK) {
-                face->flags |= CCN_FACE_LINK;
-                face->flags &= ~CCN_FACE_GG;
-                register_new_face(h, face);
-            }
-            memset(d, 0, sizeof(*d));
-            while (d->index < size) {
-                dres = ccn_skeleton_decode(d, msg + d->index, size - d->index);
-                if (d->state != 0)
-                    abort(); /* cannot happen because of checks in caller */
-                /* The pdu_ok parameter limits the recursion depth */
-                process_input_message(h, face, msg + d->index - dres, dres, 0);
-            }
-            return;
-        case CCN_DTAG_Interest:
-            process_incoming_interest(h, face, msg, size);
-            return;
-        case CCN_DTAG_ContentObject:
-            process_incoming_content(h, face, msg, size);
-            return;
-        case CCN_DTAG_SequenceNumber:
-            process_incoming_link_message(h, face, dtag, msg, size);
-            return;
-        default:
-            break;
-    }
-    ccnd_msg(h, "discarding unknown message; dtag=%u, size = %lu",
-             (unsigned)dtag,
-             (unsigned long)size);
+    if (h->age_forwarding == NULL)
+        h->age_forwarding = ccn_schedule_event(h->sched,
+                                               CCN_FWU_SECS*1000000,
+                                               age_forwarding,
+                                               NULL, 0);
 }
 
 /**
- * Log a notification that a new datagram face has been created.
+ * Look up a forwarding entry, creating it if it is not there.
  */
-static void
-ccnd_new_face_msg(struct ccnd_handle *h, struct face *face)
+static struct ccn_forwarding *
+seek_forwarding(struct ccnd_handle *h,
+                struct nameprefix_entry *npe, unsigned faceid)
 {
-    const struct sockaddr *addr = face->addr;
-    int port = 0;
-    const unsigned char *rawaddr = NULL;
-    char printable[80];
-    const char *peer = NULL;
-    if (addr->sa_family == AF_INET6) {
-        const struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)addr;
-        rawaddr = (const unsigned char *)&addr6->sin6_addr;
-        port = htons(addr6->sin6_port);
-    }
-    else if (addr->sa_family == AF_INET) {
-        const struct sockaddr_in *addr4 = (struct sockaddr_in *)addr;
-        rawaddr = (const unsigned char *)&addr4->sin_addr.s_addr;
-        port = htons(addr4->sin_port);
+    struct ccn_forwarding *f;
+    
+    for (f = npe->forwarding; f != NULL; f = f->next)
+        if (f->faceid == faceid)
+            return(f);
+    f = calloc(1, sizeof(*f));
+    if (f != NULL) {
+        f->faceid = faceid;
+        f->flags = (CCN_FORW_CHILD_INHERIT | CCN_FORW_ACTIVE);
+        f->expires = 0x7FFFFFFF;
+        f->next = npe->forwarding;
+        npe->forwarding = f;
     }
-    if (rawaddr != NULL)
-        peer = inet_ntop(addr->sa_family, rawaddr, printable, sizeof(printable));
-    if (peer == NULL)
-        peer = "(unknown)";
-    ccnd_msg(h,
-             "accepted datagram client id=%d (flags=0x%x) %s port %d",
-             face->faceid, face->flags, peer, port);
+    return(f);
 }
 
 /**
- * Since struct sockaddr_in6 may contain fields that should not participate
- * in comparison / hash, ensure the undesired fields are zero.
- *
- * Per RFC 3493, sin6_flowinfo is zeroed.
- *
- * @param addr is the sockaddr (any family)
- * @param addrlen is its length
- * @param space points to a buffer that may be used for the result.
- * @returns either the original addr or a pointer to a scrubbed copy.
+ * Register or update a prefix in the forwarding table (FIB).
  *
+ * @param h is the ccnd handle.
+ * @param msg is a ccnb-encoded message containing the name prefix somewhere.
+ * @param comps contains the delimiting offsets for the name components in msg.
+ * @param ncomps is the number of relevant components.
+ * @param faceid indicates which face to forward to.
+ * @param flags are the forwarding entry flags (CCN_FORW_...), -1 for defaults.
+ * @param expires tells the remaining lifetime, in seconds.
+ * @returns -1 for error, or new flags upon success; the private flag
+ *        CCN_FORW_REFRESHED indicates a previously existing entry.
  */
-static struct sockaddr *
-scrub_sockaddr(struct sockaddr *addr, socklen_t addrlen,
-               struct sockaddr_in6 *space)
-{
-    struct sockaddr_in6 *src;
-    struct sockaddr_in6 *dst;
-    if (addr->sa_family != AF_INET6 || addrlen != sizeof(*space))
-        return(addr);
-    dst = space;
-    src = (void *)addr;
-    memset(dst, 0, addrlen);
-    /* Copy first byte case sin6_len is used. */
-    ((uint8_t *)dst)[0] = ((uint8_t *)src)[0];
-    dst->sin6_family   = src->sin6_family;
-    dst->sin6_port     = src->sin6_port;
-    dst->sin6_addr     = src->sin6_addr;
-    dst->sin6_scope_id = src->sin6_scope_id;
-    return((struct sockaddr *)dst);
-}
-
-/**
- * Get (or create) the face associated with a given sockaddr.
- */
-static struct face *
-get_dgram_source(struct ccnd_handle *h, struct face *face,
-                 struct sockaddr *addr, socklen_t addrlen, int why)
+static int
+ccnd_reg_prefix(struct ccnd_handle *h,
+                const unsigned char *msg,
+                struct ccn_indexbuf *comps,
+                int ncomps,
+                unsigned faceid,
+                int flags,
+                int expires)
 {
-    struct face *source = NULL;
     struct hashtb_enumerator ee;
     struct hashtb_enumerator *e = &ee;
-    struct sockaddr_in6 space;
+    struct ccn_forwarding *f = NULL;
+    struct nameprefix_entry *npe = NULL;
     int res;
-    if ((face->flags & CCN_FACE_DGRAM) == 0)
-        return(face);
-    if ((face->flags & CCN_FACE_MCAST) != 0)
-        return(face);
-    hashtb_start(h->dgram_faces, e);
-    res = hashtb_seek(e, scrub_sockaddr(addr, addrlen, &space), addrlen, 0);
-    if (res >= 0) {
-        source = e->data;
-        source->recvcount++;
-        if (source->addr == NULL) {
-            source->addr = e->key;
-            source->addrlen = e->keysize;
-            source->recv_fd = face->recv_fd;
-            source->sendface = face->faceid;
-            init_face_flags(h, source, CCN_FACE_DGRAM);
-            if (why == 1 && (source->flags & CCN_FACE_LOOPBACK) != 0)
-                source->flags |= CCN_FACE_GG;
-            res = enroll_face(h, source);
-            if (res == -1) {
-                hashtb_delete(e);
-                source = NULL;
+    struct face *face = NULL;
+    
+    if (flags >= 0 &&
+        (flags & CCN_FORW_PUBMASK) != flags)
+        return(-1);
+    face = face_from_faceid(h, faceid);
+    if (face == NULL)
+        return(-1);
+    /* This is a bit hacky, but it gives us a way to set CCN_FACE_DC */
+    if (flags >= 0 && (flags & CCN_FORW_LAST) != 0)
+        face->flags |= CCN_FACE_DC;
+    hashtb_start(h->nameprefix_tab, e);
+    res = nameprefix_seek(h, e, msg, comps, ncomps);
+    if (res >= 0) {
+        res = (res == HT_OLD_ENTRY) ? CCN_FORW_REFRESHED : 0;
+        npe = e->data;
+        f = seek_forwarding(h, npe, faceid);
+        if (f != NULL) {
+            h->forward_to_gen += 1; // XXX - too conservative, should check changes
+            f->expires = expires;
+            if (flags < 0)
+                flags = f->flags & CCN_FORW_PUBMASK;
+            f->flags = (CCN_FORW_REFRESHED | flags);
+            res |= flags;
+            if (h->debug & (2 | 4)) {
+                struct ccn_charbuf *prefix = ccn_charbuf_create();
+                struct ccn_charbuf *debugtag = ccn_charbuf_create();
+                ccn_charbuf_putf(debugtag, "prefix,ff=%s%x",
+                                 flags > 9 ? "0x" : "", flags);
+                if (f->expires < (1 << 30))
+                    ccn_charbuf_putf(debugtag, ",sec=%d", expires);
+                ccn_name_init(prefix);
+                ccn_name_append_components(prefix, msg,
+                                           comps->buf[0], comps->buf[ncomps]);
+                ccnd_debug_ccnb(h, __LINE__,
+                                ccn_charbuf_as_string(debugtag),
+                                face,
+                                prefix->buf,
+                                prefix->length);
+                ccn_charbuf_destroy(&prefix);
+                ccn_charbuf_destroy(&debugtag);
             }
-            else
-                ccnd_new_face_msg(h, source);
         }
+        else
+            res = -1;
     }
     hashtb_end(e);
-    return(source);
+    if (res >= 0)
+        update_npe_children(h, npe, faceid);
+    return(res);
 }
 
 /**
- * Break up data in a face's input buffer buffer into individual messages,
- * and call process_input_message on each one.
- *
- * This is used to handle things originating from the internal client -
- * its output is input for face 0.
+ * Register a prefix, expressed in the form of a URI.
+ * @returns negative value for error, or new face flags for success.
  */
-static void
-process_input_buffer(struct ccnd_handle *h, struct face *face)
+int
+ccnd_reg_uri(struct ccnd_handle *h,
+             const char *uri,
+             unsigned faceid,
+             int flags,
+             int expires)
 {
-    unsigned char *msg;
-    size_t size;
-    ssize_t dres;
-    struct ccn_skeleton_decoder *d;
+    struct ccn_charbuf *name;
+    struct ccn_buf_decoder decoder;
+    struct ccn_buf_decoder *d;
+    struct ccn_indexbuf *comps;
+    int res;
+    
+    name = ccn_charbuf_create();
+    ccn_name_init(name);
+    res = ccn_name_from_uri(name, uri);
+    if (res < 0)
+        goto Bail;
+    comps = ccn_indexbuf_create();
+    d = ccn_buf_decoder_start(&decoder, name->buf, name->length);
+    res = ccn_parse_Name(d, comps);
+    if (res < 0)
+        goto Bail;
+    res = ccnd_reg_prefix(h, name->buf, comps, comps->n - 1,
+                          faceid, flags, expires);
+Bail:
+    ccn_charbuf_destroy(&name);
+    ccn_indexbuf_destroy(&comps);
+    return(res);
+}
 
-    if (face == NULL || face->inbuf == NULL)
+/**
+ * Register prefixes, expressed in the form of a list of URIs.
+ * The URIs in the charbuf are each terminated by nul.
+ */
+void
+ccnd_reg_uri_list(struct ccnd_handle *h,
+             struct ccn_charbuf *uris,
+             unsigned faceid,
+             int flags,
+             int expires)
+{
+    size_t i;
+    const char *s;
+    s = ccn_charbuf_as_string(uris);
+    for (i = 0; i + 1 < uris->length; i += strlen(s + i) + 1)
+        ccnd_reg_uri(h, s + i, faceid, flags, expires);
+}
+
+/**
+ * Called when a face is first created, and (perhaps) a second time in the case
+ * that a face transitions from the undecided state.
+ */
+static void
+register_new_face(struct ccnd_handle *h, struct face *face)
+{
+    if (h->worker != NULL) {
+        /* The main thread hears of it from faces_report() */
+        ccn_link_state_init(h, face);
         return;
-    d = &face->decoder;
-    msg = face->inbuf->buf;
-    size = face->inbuf->length;
-    while (d->index < size) {
-        dres = ccn_skeleton_decode(d, msg + d->index, size - d->index);
-        if (d->state != 0)
-            break;
-        process_input_message(h, face, msg + d->index - dres, dres, 0);
     }
-    if (d->index != size) {
-        ccnd_msg(h, "protocol error on face %u (state %d), discarding %d bytes",
-                     face->faceid, d->state, (int)(size - d->index));
-        // XXX - perhaps this should be a fatal error.
+    if (face->faceid != 0 && (face->flags & (CCN_FACE_UNDECIDED | CCN_FACE_PASSIVE)) == 0) {
+        ccnd_face_status_change(h, face->faceid);
+        if (h->flood && h->autoreg != NULL && (face->flags & CCN_FACE_GG) == 0)
+            ccnd_reg_uri_list(h, h->autoreg, face->faceid,
+                              CCN_FORW_CAPTURE_OK | CCN_FORW_CHILD_INHERIT | CCN_FORW_ACTIVE,
+                              0x7FFFFFFF);
+        ccn_link_state_init(h, face);
     }
-    face->inbuf->length = 0;
-    memset(d, 0, sizeof(*d));
 }
 
 /**
- * Process the input from a socket.
+ * Replaces contents of reply_body with a ccnb-encoded StatusResponse.
  *
- * The socket has been found ready for input by the poll call.
- * Decide what face it corresponds to, and after checking for exceptional
- * cases, receive data, parse it into ccnb-encoded messages, and call
- * process_input_message for each one.
+ * @returns CCN_CONTENT_NACK, or -1 in case of error.
  */
-static void
-process_input(struct ccnd_handle *h, int fd)
+static int
+ccnd_nack(struct ccnd_handle *h, struct ccn_charbuf *reply_body,
+          int errcode, const char *errtext)
+{
+    int res;
+    reply_body->length = 0;
+    res = ccn_encode_StatusResponse(reply_body, errcode, errtext);
+    if (res == 0)
+        res = CCN_CONTENT_NACK;
+    return(res);
+}
+
+/**
+ * Check that indicated ccndid matches ours.
+ *
+ * Fills reply_body with a StatusResponse in case of no match.
+ *
+ * @returns 0 if OK, or CCN_CONTENT_NACK if not.
+ */
+static int
+check_ccndid(struct ccnd_handle *h,
+             const void *p, size_t sz, struct ccn_charbuf *reply_body)
+{
+    if (sz != sizeof(h->ccnd_id) || memcmp(p, h->ccnd_id, sz) != 0)
+        return(ccnd_nack(h, reply_body, 531, "missing or incorrect ccndid"));
+    return(0);
+}
+
+/**
+ * Check ccndid, given a face instance.
+ */
+static int
+check_face_instance_ccndid(struct ccnd_handle *h,
+    struct ccn_face_instance *f, struct ccn_charbuf *reply_body)
+{
+    return(check_ccndid(h, f->ccnd_id, f->ccnd_id_size, reply_body));
+}
+
+/**
+ * Check ccndid, given a parsed ForwardingEntry.
+ */
+static int
+check_forwarding_entry_ccndid(struct ccnd_handle *h,
+    struct ccn_forwarding_entry *f, struct ccn_charbuf *reply_body)
+{
+    return(check_ccndid(h, f->ccnd_id, f->ccnd_id_size, reply_body));
+}
+
+/**
+ * Process a newface request for the ccnd internal client.
+ *
+ * @param h is the ccnd handle
+ * @param msg points to a ccnd-encoded ContentObject containing a
+ *         FaceInstance in its Content.
+ * @param size is its size in bytes
+ * @param reply_body is a buffer to hold the Content of the reply, as a
+ *         FaceInstance including faceid
+ * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK to
+ *         set the response type to NACK.
+ *
+ * Is is permitted for the face to already exist.
+ * A newly created face will have no registered prefixes, and so will not
+ * receive any traffic.
+ */
+int
+ccnd_req_newface(struct ccnd_handle *h,
+                 const unsigned char *msg, size_t size,
+                 struct ccn_charbuf *reply_body)
 {
+    struct ccn_parsed_ContentObject pco = {0};
+    int res;
+    const unsigned char *req;
+    size_t req_size;
+    struct ccn_face_instance *face_instance = NULL;
+    struct addrinfo hints = {0};
+    struct addrinfo *addrinfo = NULL;
+    int mcast;
     struct face *face = NULL;
-    struct face *source = NULL;
-    ssize_t res;
-    ssize_t dres;
-    ssize_t msgstart;
-    unsigned char *buf;
-    struct ccn_skeleton_decoder *d;
-    struct sockaddr_storage sstor;
-    socklen_t addrlen = sizeof(sstor);
-    struct sockaddr *addr = (struct sockaddr *)&sstor;
-    int err = 0;
-    socklen_t err_sz;
-    
-    face = hashtb_lookup(h->faces_by_fd, &fd, sizeof(fd));
-    if (face == NULL)
-        return;
-    if ((face->flags & (CCN_FACE_DGRAM | CCN_FACE_PASSIVE)) == CCN_FACE_PASSIVE) {
-        accept_connection(h, fd);
-        check_comm_file(h);
-        return;
-    }
-    err_sz = sizeof(err);
-    res = getsockopt(face->recv_fd, SOL_SOCKET, SO_ERROR, &err, &err_sz);
-    if (res >= 0 && err != 0) {
-        ccnd_msg(h, "error on face %u: %s (%d)", face->faceid, strerror(err), err);
-        if (err == ETIMEDOUT && (face->flags & CCN_FACE_CONNECTING) != 0) {
-            shutdown_client_fd(h, fd);
-            return;
-        }
-    }
-    d = &face->decoder;
-    if (face->inbuf == NULL)
+    struct face *reqface = NULL;
+    struct face *newface = NULL;
+    int save;
+    int nackallowed = 0;
+
+    save = h->flood;
+    h->flood = 0; /* never auto-register for these */
+    res = ccn_parse_ContentObject(msg, size, &pco, NULL);
+    if (res < 0)
+        goto Finish;
+    res = ccn_content_get_value(msg, size, &pco, &req, &req_size);
+    if (res < 0)
+        goto Finish;
+    res = -1;
+    face_instance = ccn_face_instance_parse(req, req_size);
+    if (face_instance == NULL || face_instance->action == NULL)
+        goto Finish;
+    if (strcmp(face_instance->action, "newface") != 0)
+        goto Finish;
+    /* consider the source ... */
+    reqface = face_from_faceid(h, h->interest_faceid);
+    if (reqface == NULL ||
+        (reqface->flags & (CCN_FACE_LOOPBACK | CCN_FACE_LOCAL)) == 0)
+        goto Finish;
+    nackallowed = 1;
+    res = check_face_instance_ccndid(h, face_instance, reply_body);
+    if (res != 0)
+        goto Finish;
+    if (face_instance->descr.ipproto != IPPROTO_UDP &&
+        face_instance->descr.ipproto != IPPROTO_TCP) {
+        res = ccnd_nack(h, reply_body, 504, "parameter error");
+        goto Finish;
+    }
+    if (face_instance->descr.address == NULL) {
+        res = ccnd_nack(h, reply_body, 504, "parameter error");
+        goto Finish;
+    }
+    if (face_instance->descr.port == NULL) {
+        res = ccnd_nack(h, reply_body, 504, "parameter error");
+        goto Finish;
+    }
+    if (face_instance->burst < 0)
+        face_instance->burst = 0; /* not given, use the default */
+    if ((reqface->flags & CCN_FACE_GG) == 0) {
+        res = ccnd_nack(h, reply_body, 430, "not authorized");
+        goto Finish;
+    }
+    hints.ai_flags |= AI_NUMERICHOST;
+    hints.ai_protocol = face_instance->descr.ipproto;
+    hints.ai_socktype = (hints.ai_protocol == IPPROTO_UDP) ? SOCK_DGRAM : SOCK_STREAM;
+    res = getaddrinfo(face_instance->descr.address,
+                      face_instance->descr.port,
+                      &hints,
+                      &addrinfo);
+    if (res != 0 || (h->debug & 128) != 0)
+        ccnd_msg(h, "ccnd_req_newface from %u: getaddrinfo(%s, %s, ...) returned %d",
+                 h->interest_faceid,
+                 face_instance->descr.address,
+                 face_instance->descr.port,
+                 res);
+    if (res != 0 || addrinfo == NULL) {
+        res = ccnd_nack(h, reply_body, 501, "syntax error in address");
+        goto Finish;
+    }
+    if (addrinfo->ai_next != NULL)
+        ccnd_msg(h, "ccnd_req_newface: (addrinfo->ai_next != NULL) ? ?");
+    if (face_instance->descr.ipproto == IPPROTO_UDP) {
+        mcast = 0;
+        if (addrinfo->ai_family == AF_INET) {
+            face = face_from_faceid(h, h->ipv4_faceid);
+            mcast = IN_MULTICAST(ntohl(((struct sockaddr_in *)(addrinfo->ai_addr))->sin_addr.s_addr));
+        }
+        else if (addrinfo->ai_family == AF_INET6) {
+            face = face_from_faceid(h, h->ipv6_faceid);
+            mcast = IN6_IS_ADDR_MULTICAST(&((struct sockaddr_in6 *)addrinfo->ai_addr)->sin6_addr);
+        }
+        if (mcast)
+            face = setup_multicast(h, face_instance,
+                                   addrinfo->ai_addr,
+                                   addrinfo->ai_addrlen);
+        if (face == NULL) {
+            res = ccnd_nack(h, reply_body, 453, "could not setup multicast");
+            goto Finish;
+        }
+        newface = get_dgram_source(h, face,
+                                   addrinfo->ai_addr,
+                                   addrinfo->ai_addrlen,
+                                   0);
+    }
+    else if (addrinfo->ai_socktype == SOCK_STREAM) {
+        newface = make_connection(h,
+                                  addrinfo->ai_addr,
+                                  addrinfo->ai_addrlen,
+                                  0);
+    }
+    if (newface != NULL) {
+        newface->flags |= CCN_FACE_PERMANENT;
+        if (face_instance->rate > 0)
+            face_set_shaper(h, newface, face_instance->rate, face_instance->burst);
+        face_instance->rate = newface->rate;
+        face_instance->burst = newface->burst;
+        face_instance->action = NULL;
+        face_instance->ccnd_id = h->ccnd_id;
+        face_instance->ccnd_id_size = sizeof(h->ccnd_id);
+        face_instance->faceid = newface->faceid;
+        face_instance->lifetime = 0x7FFFFFFF;
+        /*
+         * A short lifetime is a clue to the client that
+         * the connection has not been completed.
+         */
+        if ((newface->flags & CCN_FACE_CONNECTING) != 0)
+            face_instance->lifetime = 1;
+        res = ccnb_append_face_instance(reply_body, face_instance);
+        if (res > 0)
+            res = 0;
+    }
+    else
+        res = ccnd_nack(h, reply_body, 450, "could not create face");
+Finish:
+    h->flood = save; /* restore saved flood flag */
+    ccn_face_instance_destroy(&face_instance);
+    if (addrinfo != NULL)
+        freeaddrinfo(addrinfo);
+    return((nackallowed || res <= 0) ? res : -1);
+}
+
+/**
+ * @brief Process a destroyface request for the ccnd internal client.
+ * @param h is the ccnd handle
+ * @param msg points to a ccnd-encoded ContentObject containing a FaceInstance
+            in its Content.
+ * @param size is its size in bytes
+ * @param reply_body is a buffer to hold the Content of the reply, as a
+ *         FaceInstance including faceid
+ * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK to
+ *         set the response type to NACK.
+ *
+ * Is is an error if the face does not exist.
+ */
+int
+ccnd_req_destroyface(struct ccnd_handle *h,
+                     const unsigned char *msg, size_t size,
+                     struct ccn_charbuf *reply_body)
+{
+    struct ccn_parsed_ContentObject pco = {0};
+    int res;
+    int at = 0;
+    const unsigned char *req;
+    size_t req_size;
+    struct ccn_face_instance *face_instance = NULL;
+    struct face *reqface = NULL;
+    int nackallowed = 0;
+
+    res = ccn_parse_ContentObject(msg, size, &pco, NULL);
+    if (res < 0) { at = __LINE__; goto Finish; }
+    res = ccn_content_get_value(msg, size, &pco, &req, &req_size);
+    if (res < 0) { at = __LINE__; goto Finish; }
+    res = -1;
+    face_instance = ccn_face_instance_parse(req, req_size);
+    if (face_instance == NULL) { at = __LINE__; goto Finish; }
+    if (face_instance->action == NULL) { at = __LINE__; goto Finish; }
+    /* consider the source ... */
+    reqface = face_from_faceid(h, h->interest_faceid);
+    if (reqface == NULL) { at = __LINE__; goto Finish; }
+    if ((reqface->flags & CCN_FACE_GG) == 0) { at = __LINE__; goto Finish; }
+    nackallowed = 1;
+    if (strcmp(face_instance->action, "destroyface") != 0)
+        { at = __LINE__; goto Finish; }
+    res = check_face_instance_ccndid(h, face_instance, reply_body);
+    if (res != 0)
+        { at = __LINE__; goto Finish; }
+    if (face_instance->faceid == 0) { at = __LINE__; goto Finish; }
+    res = ccnd_destroy_face(h, face_instance->faceid);
+    if (res < 0) { at = __LINE__; goto Finish; }
+    face_instance->action = NULL;
+    face_instance->ccnd_id = h->ccnd_id;
+    face_instance->ccnd_id_size = sizeof(h->ccnd_id);
+    face_instance->lifetime = 0;
+    res = ccnb_append_face_instance(reply_body, face_instance);
+    if (res < 0) {
+        at = __LINE__;
+    }
+Finish:
+    if (at != 0) {
+        ccnd_msg(h, "ccnd_req_destroyface failed (line %d, res %d)", at, res);
+        if (reqface == NULL || (reqface->flags & CCN_FACE_GG) == 0)
+            res = -1;
+        else
+            res = ccnd_nack(h, reply_body, 450, "could not destroy face");
+    }
+    ccn_face_instance_destroy(&face_instance);
+    return((nackallowed || res <= 0) ? res : -1);
+}
+
+/**
+ * Worker bee for two very similar public functions.
+ */
+static int
+ccnd_req_prefix_or_self_reg(struct ccnd_handle *h,
+                            const unsigned char *msg, size_t size, int selfreg,
+                            struct ccn_charbuf *reply_body)
+{
+    struct ccn_parsed_ContentObject pco = {0};
+    int res;
+    const unsigned char *req;
+    size_t req_size;
+    struct ccn_forwarding_entry *forwarding_entry = NULL;
+    struct face *face = NULL;
+    struct face *reqface = NULL;
+    struct ccn_indexbuf *comps = NULL;
+    int nackallowed = 0;
+
+    res = ccn_parse_ContentObject(msg, size, &pco, NULL);
+    if (res < 0)
+        goto Finish;
+    res = ccn_content_get_value(msg, size, &pco, &req, &req_size);
+    if (res < 0)
+        goto Finish;
+    res = -1;
+    forwarding_entry = ccn_forwarding_entry_parse(req, req_size);
+    if (forwarding_entry == NULL || forwarding_entry->action == NULL)
+        goto Finish;
+    /* consider the source ... */
+    reqface = face_from_faceid(h, h->interest_faceid);
+    if (reqface == NULL)
+        goto Finish;
+    if ((reqface->flags & (CCN_FACE_GG | CCN_FACE_REGOK)) == 0)
+        goto Finish;
+    nackallowed = 1;
+    if (selfreg) {
+        if (strcmp(forwarding_entry->action, "selfreg") != 0)
+            goto Finish;
+        if (forwarding_entry->faceid == CCN_NOFACEID)
+            forwarding_entry->faceid = h->interest_faceid;
+        else if (forwarding_entry->faceid != h->interest_faceid)
+            goto Finish;
+    }
+    else {
+        if (strcmp(forwarding_entry->action, "prefixreg") != 0)
+        goto Finish;
+    }
+    if (forwarding_entry->name_prefix == NULL)
+        goto Finish;
+    if (forwarding_entry->ccnd_id_size == sizeof(h->ccnd_id)) {
+        if (memcmp(forwarding_entry->ccnd_id,
+                   h->ccnd_id, sizeof(h->ccnd_id)) != 0)
+            goto Finish;
+    }
+    else if (forwarding_entry->ccnd_id_size != 0)
+        goto Finish;
+    face = face_from_faceid(h, forwarding_entry->faceid);
+    if (face == NULL)
+        goto Finish;
+    if (forwarding_entry->lifetime < 0)
+        forwarding_entry->lifetime = 2000000000;
+    else if (forwarding_entry->lifetime > 3600 &&
+             forwarding_entry->lifetime < (1 << 30))
+        forwarding_entry->lifetime = 300;
+    comps = ccn_indexbuf_create();
+    res = ccn_name_split(forwarding_entry->name_prefix, comps);
+    if (res < 0)
+        goto Finish;
+    res = ccnd_reg_prefix(h,
+                          forwarding_entry->name_prefix->buf, comps, res,
+                          face->faceid,
+                          forwarding_entry->flags,
+                          forwarding_entry->lifetime);
+    if (res < 0)
+        goto Finish;
+    forwarding_entry->flags = res;
+    forwarding_entry->action = NULL;
+    forwarding_entry->ccnd_id = h->ccnd_id;
+    forwarding_entry->ccnd_id_size = sizeof(h->ccnd_id);
+    res = ccnb_append_forwarding_entry(reply_body, forwarding_entry);
+    if (res > 0)
+        res = 0;
+Finish:
+    ccn_forwarding_entry_destroy(&forwarding_entry);
+    ccn_indexbuf_destroy(&comps);
+    if (nackallowed && res < 0)
+        res = ccnd_nack(h, reply_body, 450, "could not register prefix");
+    return((nackallowed || res <= 0) ? res : -1);
+}
+
+/**
+ * @brief Process a prefixreg request for the ccnd internal client.
+ * @param h is the ccnd handle
+ * @param msg points to a ccnd-encoded ContentObject containing a
+ *          ForwardingEntry in its Content.
+ * @param size is its size in bytes
+ * @param reply_body is a buffer to hold the Content of the reply, as a
+ *         FaceInstance including faceid
+ * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK to
+ *         set the response type to NACK.
+ *
+ */
+int
+ccnd_req_prefixreg(struct ccnd_handle *h,
+                   const unsigned char *msg, size_t size,
+                   struct ccn_charbuf *reply_body)
+{
+    return(ccnd_req_prefix_or_self_reg(h, msg, size, 0, reply_body));
+}
+
+/**
+ * @brief Process a selfreg request for the ccnd internal client.
+ * @param h is the ccnd handle
+ * @param msg points to a ccnd-encoded ContentObject containing a
+ *          ForwardingEntry in its Content.
+ * @param size is its size in bytes
+ * @param reply_body is a buffer to hold the Content of the reply, as a
+ *         ccnb-encoded ForwardingEntry
+ * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK to
+ *         set the response type to NACK.
+ *
+ */
+int
+ccnd_req_selfreg(struct ccnd_handle *h,
+                 const unsigned char *msg, size_t size,
+                 struct ccn_charbuf *reply_body)
+{
+    return(ccnd_req_prefix_or_self_reg(h, msg, size, 1, reply_body));
+}
+
+/**
+ * @brief Process an unreg request for the ccnd internal client.
+ * @param h is the ccnd handle
+ * @param msg points to a ccnd-encoded ContentObject containing a
+ *          ForwardingEntry in its Content.
+ * @param size is its size in bytes
+ * @param reply_body is a buffer to hold the Content of the reply, as a
+ *         ccnb-encoded ForwardingEntry
+ * @returns 0 for success, negative for no response, or CCN_CONTENT_NACK to
+ *         set the response type to NACK.
+ *
+ */
+int
+ccnd_req_unreg(struct ccnd_handle *h,
+               const unsigned char *msg, size_t size,
+               struct ccn_charbuf *reply_body)
+{
+    struct ccn_parsed_ContentObject pco = {0};
+    int n_name_comp = 0;
+    int res;
+    const unsigned char *req;
+    size_t req_size;
+    size_t start;
+    size_t stop;
+    int found;
+    struct ccn_forwarding_entry *forwarding_entry = NULL;
+    struct face *face = NULL;
+    struct face *reqface = NULL;
+    struct ccn_indexbuf *comps = NULL;
+    struct ccn_forwarding **p = NULL;
+    struct ccn_forwarding *f = NULL;
+    struct nameprefix_entry *npe = NULL;
+    int nackallowed = 0;
+    
+    res = ccn_parse_ContentObject(msg, size, &pco, NULL);
+    if (res < 0)
+        goto Finish;        
+    res = ccn_content_get_value(msg, size, &pco, &req, &req_size);
+    if (res < 0)
+        goto Finish;
+    res = -1;
+    forwarding_entry = ccn_forwarding_entry_parse(req, req_size);
+    /* consider the source ... */
+    reqface = face_from_faceid(h, h->interest_faceid);
+    if (reqface == NULL || (reqface->flags & CCN_FACE_GG) == 0)
+        goto Finish;
+    nackallowed = 1;
+    if (forwarding_entry == NULL || forwarding_entry->action == NULL)
+        goto Finish;
+    if (strcmp(forwarding_entry->action, "unreg") != 0)
+        goto Finish;
+    if (forwarding_entry->faceid == CCN_NOFACEID)
+        goto Finish;
+    if (forwarding_entry->name_prefix == NULL)
+        goto Finish;
+    res = check_forwarding_entry_ccndid(h, forwarding_entry, reply_body);
+    if (res != 0)
+        goto Finish;
+    res = -1;
+    face = face_from_faceid(h, forwarding_entry->faceid);
+    if (face == NULL)
+        goto Finish;
+    comps = ccn_indexbuf_create();
+    n_name_comp = ccn_name_split(forwarding_entry->name_prefix, comps);
+    if (n_name_comp < 0)
+        goto Finish;
+    if (n_name_comp + 1 > comps->n)
+        goto Finish;
+    start = comps->buf[0];
+    stop = comps->buf[n_name_comp];
+    npe = hashtb_lookup(h->nameprefix_tab,
+                        forwarding_entry->name_prefix->buf + start,
+                        stop - start);
+    if (npe == NULL)
+        goto Finish;
+    found = 0;
+    p = &npe->forwarding;
+    for (f = npe->forwarding; f != NULL; f = f->next) {
+        if (f->faceid == forwarding_entry->faceid) {
+            found = 1;
+            if (h->debug & (2 | 4))
+                ccnd_debug_ccnb(h, __LINE__, "prefix_unreg", face,
+                                forwarding_entry->name_prefix->buf,
+                                forwarding_entry->name_prefix->length);
+            *p = f->next;
+            free(f);
+            f = NULL;
+            h->forward_to_gen += 1;
+            break;
+        }
+        p = &(f->next);
+    }
+    if (!found)
+        goto Finish;    
+    forwarding_entry->action = NULL;
+    forwarding_entry->ccnd_id = h->ccnd_id;
+    forwarding_entry->ccnd_id_size = sizeof(h->ccnd_id);
+    res = ccnb_append_forwarding_entry(reply_body, forwarding_entry);
+    if (res > 0)
+        res = 0;
+Finish:
+    ccn_forwarding_entry_destroy(&forwarding_entry);
+    ccn_indexbuf_destroy(&comps);
+    if (nackallowed && res < 0)
+        res = ccnd_nack(h, reply_body, 450, "could not unregister prefix");
+    return((nackallowed || res <= 0) ? res : -1);
+}
+
+/**
+ * Set up forward_to list for a name prefix entry.
+ *
+ * Recomputes the contents of npe->forward_to, npe->flags, and
+ * npe->strategy from forwarding lists of npe and all of its ancestors.
+ */
+static void
+update_forward_to(struct ccnd_handle *h, struct nameprefix_entry *npe)
+{
+    struct ccn_indexbuf *x = NULL;
+    struct ccn_indexbuf *tap = NULL;
+    struct ccn_forwarding *f = NULL;
+    struct nameprefix_entry *p = NULL;
+    unsigned tflags;
+    unsigned wantflags;
+    unsigned moreflags;
+    unsigned lastfaceid;
+    unsigned namespace_flags;
+    unsigned strategy_flags;
+
+    x = npe->forward_to;
+    if (x == NULL)
+        npe->forward_to = x = ccn_indexbuf_create();
+    else
+        x->n = 0;
+    wantflags = CCN_FORW_ACTIVE;
+    lastfaceid = CCN_NOFACEID;
+    namespace_flags = 0;
+    strategy_flags = 0;
+    for (p = npe; p != NULL; p = p->parent) {
+        moreflags = CCN_FORW_CHILD_INHERIT;
+        for (f = p->forwarding; f != NULL; f = f->next) {
+            if (face_from_faceid(h, f->faceid) == NULL)
+                continue;
+            /* The sense of this flag needs to be inverted for this test */
+            tflags = f->flags ^ CCN_FORW_CAPTURE_OK;
+            if ((tflags & wantflags) == wantflags) {
+                if (h->debug & 32)
+                    ccnd_msg(h, "fwd.%d adding %u", __LINE__, f->faceid);
+                ccn_indexbuf_set_insert(x, f->faceid);
+                if ((f->flags & CCN_FORW_TAP) != 0) {
+                    if (tap == NULL)
+                        tap = ccn_indexbuf_create();
+                    ccn_indexbuf_set_insert(tap, f->faceid);
+                }
+                if ((f->flags & CCN_FORW_LAST) != 0)
+                    lastfaceid = f->faceid;
+            }
+            namespace_flags |= (f->flags & ~CCN_FORW_STRATEGY);
+            /* The longest prefix that names a strategy decides */
+            if (strategy_flags == 0)
+                strategy_flags = f->flags & CCN_FORW_STRATEGY;
+            if ((f->flags & CCN_FORW_CAPTURE) != 0)
+                moreflags |= CCN_FORW_CAPTURE_OK;
+        }
+        wantflags |= moreflags;
+    }
+    if (lastfaceid != CCN_NOFACEID)
+        ccn_indexbuf_move_to_end(x, lastfaceid);
+    npe->flags = namespace_flags;
+    npe->strategy = strategy_class_from_flags(strategy_flags);
+    npe->fgen = h->forward_to_gen;
+    if (x->n == 0)
+        ccn_indexbuf_destroy(&npe->forward_to);
+    ccn_indexbuf_destroy(&npe->tap);
+    npe->tap = tap;
+}
+
+/**
+ * This is where we consult the interest forwarding table.
+ * @param h is the ccnd handle
+ * @param from is the handle for the originating face (may be NULL).
+ * @param msg points to the ccnb-encoded interest message
+ * @param pi must be the parse information for msg
+ * @param npe should be the result of the prefix lookup
+ * @result Newly allocated set of outgoing faceids (never NULL)
+ */
+static struct ccn_indexbuf *
+get_outbound_faces(struct ccnd_handle *h,
+    struct face *from,
+    const unsigned char *msg,
+    struct ccn_parsed_interest *pi,
+    struct nameprefix_entry *npe)
+{
+    int checkmask = 0;
+    int wantmask = 0;
+    struct ccn_indexbuf *x;
+    struct face *face;
+    int i;
+    int n;
+    unsigned faceid;
+    
+    while (npe->parent != NULL && npe->forwarding == NULL)
+        npe = npe->parent;
+    if (npe->fgen != h->forward_to_gen)
+        update_forward_to(h, npe);
+    x = ccn_indexbuf_create();
+    if (pi->scope == 0)
+        return(x);
+    if (from != NULL && (from->flags & CCN_FACE_GG) != 0) {
+        i = ccn_fetch_tagged_nonNegativeInteger(CCN_DTAG_FaceID, msg,
+              pi->offset[CCN_PI_B_OTHER], pi->offset[CCN_PI_E_OTHER]);
+        if (i != -1) {
+            faceid = i;
+            ccn_indexbuf_append_element(x, faceid);
+            if (h->debug & 32)
+                ccnd_msg(h, "outbound.%d adding %u", __LINE__, faceid);
+            return(x);
+        }
+    }
+    if (npe->forward_to == NULL || npe->forward_to->n == 0)
+        return(x);
+    if ((npe->flags & CCN_FORW_LOCAL) != 0)
+        checkmask = (from != NULL && (from->flags & CCN_FACE_GG) != 0) ? CCN_FACE_GG : (~0);
+    else if (pi->scope == 1)
+        checkmask = CCN_FACE_GG;
+    else if (pi->scope == 2)
+        checkmask = from ? (CCN_FACE_GG & ~(from->flags)) : ~0;
+    wantmask = checkmask;
+    if (wantmask == CCN_FACE_GG)
+        checkmask |= CCN_FACE_DC;
+    for (n = npe->forward_to->n, i = 0; i < n; i++) {
+        faceid = npe->forward_to->buf[i];
+        face = face_from_faceid(h, faceid);
+        if (face != NULL && face != from &&
+            ((face->flags & checkmask) == wantmask)) {
+            if (h->debug & 32)
+                ccnd_msg(h, "outbound.%d adding %u", __LINE__, face->faceid);
+            ccn_indexbuf_append_element(x, face->faceid);
+        }
+    }
+    return(x);
+}
+
+/**
+ * Compute the delay until the next timed action on an interest.
+ */
+static int
+ie_next_usec(struct ccnd_handle *h, struct interest_entry *ie,
+             ccn_wrappedtime *expiry)
+{
+    struct pit_face_item *p;
+    ccn_wrappedtime base;
+    ccn_wrappedtime delta;
+    ccn_wrappedtime mn;
+    int ans;
+    int debug = (h->debug & 32) != 0;
+    const int horizon = 3 * WTHZ; /* complain if we get behind by too much */
+    
+    base = h->wtnow - horizon;
+    mn = 600 * WTHZ + horizon;
+    for (p = ie->pfl; p != NULL; p = p->next) {
+        delta = p->expiry - base;
+        if (delta >= 0x80000000)
+            debug = 1;
+        if (debug) {
+            static const char fmt_ie_next_usec[] = 
+              "ie_next_usec.%d now%+d i=%u f=%04x %u "
+              " %02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X";
+            ccnd_msg(h, fmt_ie_next_usec, __LINE__,
+                     (int)delta - horizon, ie->serial, p->pfi_flags, p->faceid,
+                     p->nonce[0], p->nonce[1], p->nonce[2], p->nonce[3],
+                     p->nonce[4], p->nonce[5], p->nonce[6], p->nonce[7],
+                     p->nonce[8], p->nonce[9], p->nonce[10], p->nonce[11]);
+        }
+        if (delta < mn)
+            mn = delta;
+    }
+    if (mn < horizon)
+        mn = 0;
+    else
+        mn -= horizon;
+    ans = mn * (1000000 / WTHZ);
+    if (expiry != NULL) {
+        *expiry = h->wtnow + mn;
+        if (debug)
+            ccnd_msg(h, "ie_next_usec.%d expiry=%x", __LINE__,
+                     (unsigned)*expiry);
+    }
+    if (debug)
+        ccnd_msg(h, "ie_next_usec.%d %d usec", __LINE__, ans);
+    return(ans);
+}
+
+/**
+ *  Forward an interest message
+ *
+ *  x is downstream (the interest came x).
+ *  p is upstream (the interest is to be forwarded to p).
+ *  @returns p (or its reallocated replacement).
+ */
+static struct pit_face_item *
+send_interest(struct ccnd_handle *h, struct interest_entry *ie,
+              struct pit_face_item *x, struct pit_face_item *p)
+{
+    struct face *face = NULL;
+    struct ccn_charbuf *c = h->send_interest_scratch;
+    const intmax_t default_life = CCN_INTEREST_LIFETIME_SEC << 12;
+    intmax_t lifetime = default_life;
+    ccn_wrappedtime delta;
+    size_t noncesize;
+    
+    face = face_from_faceid(h, p->faceid);
+    if (face == NULL)
+        return(p);
+    h->interest_faceid = x->faceid; /* relevant if p is face 0 */
+    p = pfi_copy_nonce(h, ie, p, x);
+    delta = x->expiry - x->renewed;
+    lifetime = (intmax_t)delta * 4096 / WTHZ;
+    /* clip lifetime against various limits here */
+    lifetime = (((lifetime + 511) >> 9) << 9); /* round up - 1/8 sec */
+    p->renewed = h->wtnow;
+    p->expiry = h->wtnow + (lifetime * WTHZ / 4096);
+    ccn_charbuf_reset(c);
+    if (lifetime != default_life)
+        ccnb_append_tagged_binary_number(c, CCN_DTAG_InterestLifetime, lifetime);
+    noncesize = p->pfi_flags & CCND_PFI_NONCESZ;
+    if (noncesize != 0)
+        ccnb_append_tagged_blob(c, CCN_DTAG_Nonce, p->nonce, noncesize);
+    ccn_charbuf_append_closer(c);
+    h->interests_sent += 1;
+    if ((p->pfi_flags & CCND_PFI_UPENDING) != 0)
+        p->pfi_flags |= CCND_PFI_RESENT;
+    p->pfi_flags |= CCND_PFI_UPENDING;
+    p->sent_usec = ccnd_usec_clock(h);
+    p->pfi_flags &= ~(CCND_PFI_SENDUPST | CCND_PFI_UPHUNGRY);
+    ccnd_meter_bump(h, face->meter[FM_INTO], 1);
+    stuff_and_send(h, face, ie->interest_msg, ie->size - 1, c->buf, c->length, NULL, (h->debug & 2) ? "interest_to" : NULL, __LINE__);
+    return(p);
+}
+
+/**
+ * Find the entry for the longest name prefix that contains forwarding info
+ */
+struct nameprefix_entry *
+get_fib_npe(struct ccnd_handle *h, struct interest_entry *ie)
+{
+    struct nameprefix_entry *npe;
+    
+    for (npe = ie->ll.npe; npe != NULL; npe = npe->parent)
+        if (npe->forwarding != NULL)
+            return(npe);
+    return(NULL);
+}
+
+/** Implementation detail for strategy_settimer */
+static int
+strategy_timer(struct ccn_schedule *sched,
+             void *clienth,
+             struct ccn_scheduled_event *ev,
+             int flags)
+{
+    struct ccnd_handle *h = clienth;
+    struct interest_entry *ie = ev->evdata;
+    struct ccn_strategy *s = &ie->strategy;
+
+    if (s->ev == ev)
+        s->ev = NULL;
+    if (flags & CCN_SCHEDULE_CANCEL)
+        return(0);
+    strategy_callout(h, ie, (enum ccn_strategy_op)ev->evint);
+    return(0);
+}
+
+/**
+ * Schedule a strategy wakeup
+ *
+ * Any previously wakeup will be cancelled.
+ */
+static void
+strategy_settimer(struct ccnd_handle *h, struct interest_entry *ie,
+                  int usec, enum ccn_strategy_op op)
+{
+    struct ccn_strategy *s = &ie->strategy;
+    
+    if (s->ev != NULL)
+        ccn_schedule_cancel(h->sched, s->ev);
+    if (op == CCNST_NOP)
+        return;
+    s->ev = ccn_schedule_event(h->sched, usec, strategy_timer, ie, op);
+}
+
+/**
+ * Find the downstream of a newly created interest entry.
+ *
+ * Right now there should be just one.
+ */
+static struct pit_face_item *
+strategy_downstream(struct ccnd_handle *h, struct interest_entry *ie)
+{
+    struct pit_face_item *x;
+    
+    for (x = ie->pfl; x != NULL; x = x->next)
+        if ((x->pfi_flags & CCND_PFI_DNSTREAM) != 0)
+            break;
+    if (x == NULL || (x->pfi_flags & CCND_PFI_PENDING) == 0) {
+        ccnd_debug_ccnb(h, __LINE__, "canthappen", NULL,
+                        ie->interest_msg, ie->size);
+        return(NULL);
+    }
+    return(x);
+}
+
+/**
+ * Schedule the upstreams marked CCND_PFI_SENDUPST, in order, with
+ * randomized timing starting at randlow microseconds.
+ */
+static void
+strategy_stagger(struct ccnd_handle *h, struct interest_entry *ie,
+                 unsigned nleft, unsigned randlow, unsigned randrange)
+{
+    struct pit_face_item *p;
+    unsigned amt;
+    unsigned usec;
+    
+    if (nleft == 0)
+        return;
+    amt = (2 * randrange + nleft - 1) / nleft;
+    if (amt == 0) amt = 1; /* paranoia - should never happen */
+    usec = randlow;
+    for (p = ie->pfl; p!= NULL; p = p->next) {
+        if ((p->pfi_flags & CCND_PFI_SENDUPST) != 0) {
+            pfi_set_expiry_from_micros(h, ie, p, usec);
+            usec += nrand48(h->seed) % amt;
+        }
+    }
+}
+
+/**
+ * Response time limit to use when waiting on one upstream.
+ *
+ * This is the retransmission timeout for the face if it has been
+ * measured, or else the prediction for the name prefix.
+ */
+static unsigned
+strategy_rto(struct interest_entry *ie, unsigned faceid)
+{
+    struct ccn_forwarding *f;
+    
+    f = forwarding_for_face(ie->ll.npe, faceid);
+    if (f != NULL && f->rto != 0)
+        return(f->rto);
+    return(ie->ll.npe->usec);
+}
+
+/**
+ * Wait on one upstream, so that the timer callout happens if it is slow.
+ */
+static void
+strategy_wait_on(struct ccnd_handle *h, struct interest_entry *ie,
+                 unsigned faceid)
+{
+    ie->strategy.upstream = faceid;
+    strategy_settimer(h, ie, strategy_rto(ie, faceid), CCNST_TIMER);
+}
+
+/**
+ * Best-route strategy, the default.
+ *
+ * Send to the upstream with the lowest measured response time, or if
+ * none has been measured, to the face that most recently answered for
+ * the prefix.  Taps get the interest right away, too.  The others
+ * follow, in order, once the response time limit has gone by.
+ */
+static void
+best_route_first(struct ccnd_handle *h, struct interest_entry *ie,
+                 struct nameprefix_entry *fnpe)
+{
+    struct pit_face_item *x = NULL;
+    struct pit_face_item *p = NULL;
+    struct nameprefix_entry *npe = NULL;
+    struct ccn_indexbuf *tap = NULL;
+    struct ccn_forwarding *f = NULL;
+    struct ccn_forwarding *g = NULL;
+    unsigned best = CCN_NOFACEID;
+    unsigned randlow, randrange;
+    unsigned nleft;
+    int usefirst;
+    
+    if (fnpe != NULL)
+        tap = fnpe->tap;
+    npe = ie->ll.npe;
+    best = npe->src;
+    if (best == CCN_NOFACEID)
+        best = npe->src = npe->osrc;
+    x = strategy_downstream(h, ie);
+    if (x == NULL)
+        return;
+    /* Rank by measured response time, where we have it */
+    for (p = ie->pfl; p != NULL; p = p->next) {
+        if ((p->pfi_flags & CCND_PFI_UPSTREAM) == 0 ||
+            ccn_indexbuf_member(tap, p->faceid) >= 0)
+            continue;
+        g = forwarding_for_face(npe, p->faceid);
+        if (g != NULL && g->rto != 0 && (f == NULL || g->srtt < f->srtt))
+            f = g;
+    }
+    if (f != NULL) {
+        best = f->faceid;
+        usefirst = 0;
+        randlow = f->rto;
+        randrange = (randlow + 1) / 2;
+    }
+    else if (best == CCN_NOFACEID || npe->usec > 150000) {
+        usefirst = 1;
+        randlow = 4000;
+        randrange = 75000;
+    }
+    else {
+        usefirst = 0;
+        randlow = npe->usec;
+        randrange = (randlow + 1) / 2;
+    }
+    nleft = 0;
+    for (p = ie->pfl; p!= NULL; p = p->next) {
+        if ((p->pfi_flags & CCND_PFI_UPSTREAM) != 0) {
+            if (p->faceid == best) {
+                p = send_interest(h, ie, x, p);
+                strategy_wait_on(h, ie, best);
+            }
+            else if (ccn_indexbuf_member(tap, p->faceid) >= 0)
+                p = send_interest(h, ie, x, p);
+            else if (usefirst) {
+                usefirst = 0;
+                pfi_set_expiry_from_micros(h, ie, p, 0);
+            }
+            else if (p->faceid == npe->osrc)
+                pfi_set_expiry_from_micros(h, ie, p, randlow);
+            else {
+                /* Want to preserve the order of the rest */
+                nleft++;
+                p->pfi_flags |= CCND_PFI_SENDUPST;
+            }
+        }
+    }
+    /* Send remainder in order, with randomized timing */
+    strategy_stagger(h, ie, nleft, randlow, randrange);
+}
+
+/**
+ * Our chosen upstream has not responded in time.
+ * Increase the predicted response, and back off its timeout.
+ */
+static void
+best_route_timer(struct ccnd_handle *h, struct interest_entry *ie)
+{
+    struct ccn_forwarding *f;
+    
+    adjust_predicted_response(h, ie, 1);
+    f = forwarding_for_face(ie->ll.npe, ie->strategy.upstream);
+    if (f != NULL && f->rto != 0) {
+        f->rto *= 2;
+        if (f->rto > CCND_RTO_MAX)
+            f->rto = CCND_RTO_MAX;
+    }
+}
+
+/**
+ * Multicast strategy - send to all of the upstreams right away.
+ *
+ * This trades upstream traffic for latency.
+ */
+static void
+multicast_first(struct ccnd_handle *h, struct interest_entry *ie,
+                struct nameprefix_entry *fnpe)
+{
+    struct pit_face_item *x = NULL;
+    struct pit_face_item *p = NULL;
+    (void)fnpe;
+    
+    x = strategy_downstream(h, ie);
+    if (x == NULL)
+        return;
+    for (p = ie->pfl; p != NULL; p = p->next)
+        if ((p->pfi_flags & CCND_PFI_UPSTREAM) != 0)
+            p = send_interest(h, ie, x, p);
+}
+
+/**
+ * Load-balance strategy - spread interests over the upstreams in turn.
+ *
+ * Each new interest goes to the next upstream in rotation (and to any
+ * taps).  The others are held back as for best-route, in case the
+ * chosen one does not answer in time.
+ */
+static void
+load_balance_first(struct ccnd_handle *h, struct interest_entry *ie,
+                   struct nameprefix_entry *fnpe)
+{
+    struct pit_face_item *x = NULL;
+    struct pit_face_item *p = NULL;
+    struct ccn_indexbuf *tap = NULL;
+    unsigned chosen = CCN_NOFACEID;
+    unsigned rto;
+    unsigned n;
+    unsigned k;
+    unsigned nleft;
+    
+    x = strategy_downstream(h, ie);
+    if (x == NULL)
+        return;
+    if (fnpe != NULL)
+        tap = fnpe->tap;
+    for (n = 0, p = ie->pfl; p != NULL; p = p->next)
+        if ((p->pfi_flags & CCND_PFI_UPSTREAM) != 0 &&
+            ccn_indexbuf_member(tap, p->faceid) < 0)
+            n++;
+    k = 0;
+    if (n > 0 && fnpe != NULL)
+        k = (fnpe->rr++) % n;
+    nleft = 0;
+    for (p = ie->pfl; p != NULL; p = p->next) {
+        if ((p->pfi_flags & CCND_PFI_UPSTREAM) == 0)
+            continue;
+        if (ccn_indexbuf_member(tap, p->faceid) >= 0)
+            p = send_interest(h, ie, x, p);
+        else if (k-- == 0) {
+            p = send_interest(h, ie, x, p);
+            chosen = p->faceid;
+            strategy_wait_on(h, ie, chosen);
+        }
+        else {
+            nleft++;
+            p->pfi_flags |= CCND_PFI_SENDUPST;
+        }
+    }
+    rto = strategy_rto(ie, chosen);
+    strategy_stagger(h, ie, nleft, rto, (rto + 1) / 2);
+}
+
+static const struct ccn_strategy_class best_route_strategy = {
+    "best-route", &best_route_first, &best_route_timer, NULL, NULL
+};
+static const struct ccn_strategy_class multicast_strategy = {
+    "multicast", &multicast_first, NULL, NULL, NULL
+};
+static const struct ccn_strategy_class load_balance_strategy = {
+    "load-balance", &load_balance_first, &best_route_timer, NULL, NULL
+};
+
+/**
+ * Map the CCN_FORW_STRATEGY bits of the forwarding flags to a strategy.
+ *
+ * Unknown values get the default.
+ */
+static const struct ccn_strategy_class *
+strategy_class_from_flags(unsigned flags)
+{
+    switch (flags & CCN_FORW_STRATEGY) {
+        case CCN_FORW_MULTICAST:
+            return(&multicast_strategy);
+        case CCN_FORW_LOAD_BALANCE:
+            return(&load_balance_strategy);
+        default:
+            return(&best_route_strategy);
+    }
+}
+
+/**
+ * Make a strategy callout for an interest entry.
+ *
+ * The strategy is chosen from the FIB when the entry is created, and
+ * stays with it after that.
+ */
+static void
+strategy_callout(struct ccnd_handle *h,
+                 struct interest_entry *ie,
+                 enum ccn_strategy_op op)
+{
+    const struct ccn_strategy_class *sc = ie->strategy.sc;
+    struct nameprefix_entry *fnpe = NULL;
+    
+    switch (op) {
+        case CCNST_NOP:
+            break;
+        case CCNST_FIRST:
+            fnpe = get_fib_npe(h, ie);
+            sc = &best_route_strategy;
+            if (fnpe != NULL && fnpe->strategy != NULL)
+                sc = fnpe->strategy;
+            ie->strategy.sc = sc;
+            if (sc->first != NULL)
+                (sc->first)(h, ie, fnpe);
+            break;
+        case CCNST_TIMER:
+            if (sc != NULL && sc->timer != NULL)
+                (sc->timer)(h, ie);
+            break;
+        case CCNST_SATISFIED:
+            if (sc != NULL && sc->satisfied != NULL)
+                (sc->satisfied)(h, ie);
+            break;
+        case CCNST_TIMEOUT:
+            if (sc != NULL && sc->timeout != NULL)
+                (sc->timeout)(h, ie);
+            break;
+    }
+}
+
+/**
+ * Execute the next timed action on a propagating interest.
+ */
+static int
+do_propagate(struct ccn_schedule *sched,
+             void *clienth,
+             struct ccn_scheduled_event *ev,
+             int flags)
+{
+    struct ccnd_handle *h = clienth;
+    struct interest_entry *ie = ev->evdata;
+    struct face *face = NULL;
+    struct pit_face_item *p = NULL;
+    struct pit_face_item *next = NULL;
+    struct pit_face_item *d[3] = { NULL, NULL, NULL };
+    ccn_wrappedtime now;
+    int next_delay;
+    int i;
+    int n;
+    int pending;
+    int upstreams;
+    unsigned life;
+    unsigned mn;
+    unsigned rem;
+    
+    if (ie->ev == ev)
+        ie->ev = NULL;
+    else if (ie->ev != NULL) abort();
+    if (flags & CCN_SCHEDULE_CANCEL)
+        return(0);
+    now = h->wtnow;  /* capture our reference */
+    mn = 600 * WTHZ; /* keep track of when we should wake up again */
+    pending = 0;
+    n = 0;
+    for (p = ie->pfl; p != NULL; p = next) {
+        next = p->next;
+        if ((p->pfi_flags & CCND_PFI_DNSTREAM) != 0) {
+            if (wt_compare(p->expiry, now) <= 0) {
+                if (h->debug & 2)
+                    ccnd_debug_ccnb(h, __LINE__, "interest_expiry",
+                                    face_from_faceid(h, p->faceid),
+                                    ie->interest_msg, ie->size);
+                pfi_destroy(h, ie, p);
+                continue;
+            }
+            if ((p->pfi_flags & CCND_PFI_PENDING) == 0)
+                continue;
+            rem = p->expiry - now;
+            if (rem < mn)
+                mn = rem;
+            pending++;
+            /* If this downstream will expire soon, don't use it */
+            life = p->expiry - p->renewed;
+            if (rem * 8 <= life)
+                continue;
+            /* keep track of the 2 longest-lasting downstreams */
+            for (i = n; i > 0 && wt_compare(d[i-1]->expiry, p->expiry) < 0; i--)
+                d[i] = d[i-1];
+            d[i] = p;
+            if (n < 2)
+                n++;
+        }
+    }
+    /* Send the interests out */
+    upstreams = 0; /* Count unexpired upstreams */
+    for (p = ie->pfl; p != NULL; p = next) {
+        next = p->next;
+        if ((p->pfi_flags & CCND_PFI_UPSTREAM) == 0)
+            continue;
+        face = face_from_faceid(h, p->faceid);
+        if (face == NULL || (face->flags & CCN_FACE_NOSEND) != 0) {
+            pfi_destroy(h, ie, p);
+            continue;
+        }
+        if ((face->flags & CCN_FACE_DC) != 0 &&
+            (p->pfi_flags & CCND_PFI_DCFACE) == 0) {
+            /* Add 60 ms extra delay before sending to a DC face */
+            p->expiry += (60 * WTHZ + 999) / 1000;
+            p->pfi_flags |= CCND_PFI_DCFACE;
+        }
+        if (wt_compare(now + 1, p->expiry) < 0) {
+            /* Not expired yet */
+            rem = p->expiry - now;
+            if (rem < mn)
+                mn = rem;
+            upstreams++;
+            continue;
+        }
+        for (i = 0; i < n; i++)
+            if (d[i]->faceid != p->faceid)
+                break;
+        if (i < n) {
+            p = send_interest(h, ie, d[i], p);
+            if (ie->ev != NULL)
+                ccn_schedule_cancel(h->sched, ie->ev);
+            upstreams++;
+            rem = p->expiry - now;
+            if (rem < mn)
+                mn = rem;
+        }
+        else {
+            /* Upstream expired, but we have nothing to feed it. */
+            p->pfi_flags |= CCND_PFI_UPHUNGRY;
+        }
+    }
+    if (pending == 0 && upstreams == 0) {
+        strategy_callout(h, ie, CCNST_TIMEOUT);
+        consume_interest(h, ie);
+        return(0);
+    }
+    /* Determine when we need to run again */
+    if (mn == 0) abort();
+    next_delay = mn * (1000000 / WTHZ);
+    ev->evint = h->wtnow + mn;
+    if (ie->ev != NULL) abort();
+    ie->ev = ev;
+    return(next_delay);
+}
+
+/**
+ * Append an interest Nonce value that is useful for debugging.
+ *
+ * This does leak some information about the origin of interests, but it
+ * also makes it easier to figure out what is happening.
+ *
+ * The debug nonce is 12 bytes long.  When converted to hexadecimal and
+ * broken into fields (big-endian style), it looks like
+ *
+ *   IIIIII-PPPP-FFFF-SSss-XXXXXX
+ *
+ * where
+ *   IIIIII - first 24 bits of the CCNDID.
+ *   PPPP   - pid of the ccnd.
+ *   FFFF   - 16 low-order bits of the faceid.
+ *   SSss   - local time modulo 256 seconds, with 8 bits of fraction
+ *   XXXXXX - 24 random bits.
+ */
+static int
+ccnd_debug_nonce(struct ccnd_handle *h, struct face *face, unsigned char *s) {
+    int i;
+    
+    for (i = 0; i < 3; i++)
+        s[i] = h->ccnd_id[i];
+    s[i++] = h->logpid >> 8;
+    s[i++] = h->logpid;
+    s[i++] = face->faceid >> 8;
+    s[i++] = face->faceid;
+    s[i++] = h->sec;
+    s[i++] = h->usec * 256 / 1000000;
+    for (; i < TYPICAL_NONCE_SIZE; i++)
+        s[i] = nrand48(h->seed);
+    return(i);
+}
+
+/**
+ * Append a random interest Nonce value.
+ *
+ * For production use, although this uses a simple PRNG.
+ */
+static int
+ccnd_plain_nonce(struct ccnd_handle *h, struct face *face, unsigned char *s) {
+    int noncebytes = 6;
+    int i;
+    
+    for (i = 0; i < noncebytes; i++)
+        s[i] = nrand48(h->seed);
+    return(i);
+}
+
+/**
+ * Compare two wrapped time values
+ *
+ * @returns negative if a < b, 0 if a == b, positive if a > b
+ */
+static int
+wt_compare(ccn_wrappedtime a, ccn_wrappedtime b)
+{
+    ccn_wrappedtime delta = a - b;
+    if (delta >= 0x80000000)
+        return(-1);
+    return(delta > 0);
+}
+
+/** Used in just one place; could go away */
+static struct pit_face_item *
+pfi_create(struct ccnd_handle *h,
+           unsigned faceid, unsigned flags,
+           const unsigned char *nonce, size_t noncesize,
+           struct pit_face_item **pp)
+{
+    struct pit_face_item *p;    
+    
+    if (noncesize > CCND_PFI_NONCESZ) return(NULL);
+    flags &= ~(CCND_PFI_NONCESZ | CCND_PFI_BIGNONCE);
+    if (noncesize > TYPICAL_NONCE_SIZE) {
+        p = calloc(1, sizeof(*p) + noncesize - TYPICAL_NONCE_SIZE);
+        flags |= CCND_PFI_BIGNONCE;
+    }
+    else
+        p = ccn_pool_alloc(h->pfi_pool);
+    if (p == NULL) return(NULL);
+    p->faceid = faceid;
+    p->renewed = h->wtnow;
+    p->expiry = h->wtnow;
+    p->pfi_flags = flags + noncesize;
+    memcpy(p->nonce, nonce, noncesize);
+    if (pp != NULL) {
+        p->next = *pp;
+        *pp = p;
+    }
+    return(p);    
+}
+
+/** Remove the pit face item from the interest entry */
+static void
+pfi_destroy(struct ccnd_handle *h, struct interest_entry *ie,
+            struct pit_face_item *p)
+{
+    struct face *face = NULL;
+    struct pit_face_item **pp;
+    
+    for (pp = &ie->pfl; *pp != p; pp = &(*pp)->next) {
+        if (*pp == NULL) abort();
+    }
+    if ((p->pfi_flags & CCND_PFI_PENDING) != 0) {
+        face = face_from_faceid(h, p->faceid);
+        if (face != NULL)
+            face->pending_interests -= 1;
+    }
+    *pp = p->next;
+    pfi_free(h, p);
+}
+
+/** Release the storage for a pit face item */
+static void
+pfi_free(struct ccnd_handle *h, struct pit_face_item *p)
+{
+    if ((p->pfi_flags & CCND_PFI_BIGNONCE) != 0)
+        free(p);
+    else
+        ccn_pool_free(h->pfi_pool, p);
+}
+
+/**
+ * Find the pit face item with the given flag set,
+ * or create it if not present.
+ *
+ * New items are appended to the end of the list
+ */
+static struct pit_face_item *
+pfi_seek(struct ccnd_handle *h, struct interest_entry *ie,
+         unsigned faceid, unsigned pfi_flag)
+{
+    struct pit_face_item *p;
+    struct pit_face_item **pp;
+    
+    for (pp = &ie->pfl, p = ie->pfl; p != NULL; pp = &p->next, p = p->next) {
+        if (p->faceid == faceid && (p->pfi_flags & pfi_flag) != 0)
+            return(p);
+    }
+    p = ccn_pool_alloc(h->pfi_pool);
+    if (p != NULL) {
+        p->faceid = faceid;
+        p->pfi_flags = pfi_flag;
+        p->expiry = h->wtnow;
+        *pp = p;
+    }
+    return(p);
+}
+
+/**
+ * Set the expiry of the pit face item based upon an interest lifetime
+ *
+ * lifetime is in the units specified by the CCNx protocal - 1/4096 sec
+ *
+ * Also sets the renewed timestamp to now.
+ */
+static void
+pfi_set_expiry_from_lifetime(struct ccnd_handle *h, struct interest_entry *ie,
+                             struct pit_face_item *p, intmax_t lifetime)
+{
+    ccn_wrappedtime delta;
+    ccn_wrappedtime odelta;
+    int minlifetime = 4096 / 4;
+    unsigned maxlifetime = 7 * 24 * 3600 * 4096U; /* one week */
+    
+    if (lifetime < minlifetime)
+        lifetime = minlifetime;
+    if (lifetime > maxlifetime)
+        lifetime = maxlifetime;
+    lifetime = (((lifetime + 511) >> 9) << 9); /* round up - 1/8 sec */
+    delta = ((uintmax_t)lifetime * WTHZ + 4095U) / 4096U;
+    odelta = p->expiry - h->wtnow;
+    if (delta < odelta && odelta < 0x80000000)
+        ccnd_msg(h, "pfi_set_expiry_from_lifetime.%d Oops", __LINE__);
+    p->renewed = h->wtnow;
+    p->expiry = h->wtnow + delta;
+}
+
+/**
+ * Set the expiry of the pit face item using a time in microseconds from present
+ *
+ * Does not set the renewed timestamp.
+ */
+static void
+pfi_set_expiry_from_micros(struct ccnd_handle *h, struct interest_entry *ie,
+                           struct pit_face_item *p, unsigned micros)
+{
+    ccn_wrappedtime delta;
+    
+    delta = (micros + (1000000 / WTHZ - 1)) / (1000000 / WTHZ);
+    p->expiry = h->wtnow + delta;
+}
+
+/**
+ * Set the nonce in a pit face item
+ *
+ * @returns the replacement value, which is p unless the nonce will not fit.
+ */
+static struct pit_face_item *
+pfi_set_nonce(struct ccnd_handle *h, struct interest_entry *ie,
+             struct pit_face_item *p,
+             const unsigned char *nonce, size_t noncesize)
+{
+    struct pit_face_item *q = NULL;    
+    size_t nsize;
+    
+    nsize = (p->pfi_flags & CCND_PFI_NONCESZ);
+    if (noncesize != nsize) {
+        if (noncesize > TYPICAL_NONCE_SIZE) {
+            /* Hard case, need to reallocate */
+            q = pfi_create(h, p->faceid, p->pfi_flags,
+                           nonce, noncesize, &p->next);
+            if (q != NULL) {
+                q->renewed = p->renewed;
+                q->expiry = p->expiry;
+                q->sent_usec = p->sent_usec;
+                /* preserve pending interest accounting */
+                p->pfi_flags &= CCND_PFI_BIGNONCE;
+                pfi_destroy(h, ie, p);
+            }
+            return(q);
+        }
+        p->pfi_flags = (p->pfi_flags & ~CCND_PFI_NONCESZ) + noncesize;
+    }
+    memcpy(p->nonce, nonce, noncesize);
+    return(p);
+}
+
+/**
+ * Return true iff the nonce in p matches the given one.
+ */
+static int
+pfi_nonce_matches(struct pit_face_item *p,
+                  const unsigned char *nonce, size_t size)
+{
+    if (p == NULL)
+        return(0);
+    if (size != (p->pfi_flags & CCND_PFI_NONCESZ))
+        return(0);
+    if (memcmp(nonce, p->nonce, size) != 0)
+        return(0);
+    return(1);
+}
+
+/**
+ * Copy a nonce from src into p
+ *
+ * @returns p (or its replacement)
+ */
+static struct pit_face_item *
+pfi_copy_nonce(struct ccnd_handle *h, struct interest_entry *ie,
+             struct pit_face_item *p, const struct pit_face_item *src)
+{
+    p = pfi_set_nonce(h, ie, p, src->nonce, src->pfi_flags & CCND_PFI_NONCESZ);
+    return(p);
+}
+
+/**
+ * True iff the nonce in p does not occur in any of the other items of the entry
+ */
+static int
+pfi_unique_nonce(struct ccnd_handle *h, struct interest_entry *ie,
+                 struct pit_face_item *p)
+{
+    struct pit_face_item *q = NULL;
+    size_t nsize;
+    
+    if (p == NULL)
+        return(1);
+    nsize = (p->pfi_flags & CCND_PFI_NONCESZ);
+    for (q = ie->pfl; q != NULL; q = q->next) {
+        if (q != p && pfi_nonce_matches(q, p->nonce, nsize))
+            return(0);
+    }
+    return(1);
+}
+
+/**
+ * Make a fresh nonce table.
+ */
+static struct hashtb *
+nonce_tab_create(void)
+{
+    struct hashtb_param param = {0};
+    
+    param.flags = HASHTB_OPEN;
+    return(hashtb_create(sizeof(struct nonce_entry), &param));
+}
+
+/**
+ * Check a nonce against the recently seen ones, and remember it.
+ *
+ * Nonces are remembered for between one and two CCND_NONCE_WINDOW
+ * periods, in a pair of tables that trade places as time passes.
+ * A nonce that comes back on the face that first brought it is a
+ * retransmission, and is allowed.  Without memory for a new table,
+ * the old ones are kept a while longer, or if there are none the
+ * nonce is let through.
+ *
+ * @returns 1 if the nonce was recently seen on a different face,
+ *          otherwise 0.
+ */
+static int
+nonce_seen_elsewhere(struct ccnd_handle *h, unsigned faceid,
+                     const unsigned char *nonce, size_t noncesize)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct nonce_entry *ne;
+    struct hashtb *fresh;
+    int res;
+    
+    if (h->sec - h->nonce_rotated >= CCND_NONCE_WINDOW) {
+        /* If there is no memory for a new table, keep the ones we have */
+        fresh = nonce_tab_create();
+        if (fresh != NULL) {
+            hashtb_destroy(&h->nonce_old);
+            if (h->sec - h->nonce_rotated < 2 * CCND_NONCE_WINDOW)
+                h->nonce_old = h->nonce_tab;
+            else
+                hashtb_destroy(&h->nonce_tab);
+            h->nonce_tab = fresh;
+            h->nonce_rotated = h->sec;
+        }
+    }
+    if (h->nonce_old != NULL) {
+        ne = hashtb_lookup(h->nonce_old, nonce, noncesize);
+        if (ne != NULL)
+            return(ne->faceid != faceid);
+    }
+    if (h->nonce_tab == NULL)
+        return(0);
+    hashtb_start(h->nonce_tab, e);
+    res = hashtb_seek(e, nonce, noncesize, 0);
+    ne = e->data;
+    if (res == HT_NEW_ENTRY)
+        ne->faceid = faceid;
+    hashtb_end(e);
+    if (ne == NULL)
+        return(0);
+    return(ne->faceid != faceid);
+}
+
+/**
+ * Check whether an incoming interest has looped or been duplicated.
+ *
+ * Interests without a nonce always pass; they get a fresh one when
+ * they are propagated.
+ */
+static int
+interest_looped(struct ccnd_handle *h, struct face *face,
+                const unsigned char *msg, const struct ccn_parsed_interest *pi)
+{
+    const unsigned char *nonce = NULL;
+    size_t noncesize = 0;
+    
+    if (pi->offset[CCN_PI_E_Nonce] == pi->offset[CCN_PI_B_Nonce])
+        return(0);
+    if (ccn_ref_tagged_BLOB(CCN_DTAG_Nonce, msg,
+                            pi->offset[CCN_PI_B_Nonce],
+                            pi->offset[CCN_PI_E_Nonce],
+                            &nonce, &noncesize) < 0 || noncesize == 0)
+        return(0);
+    return(nonce_seen_elsewhere(h, face->faceid, nonce, noncesize));
+}
+
+/**
+ * Schedules the propagation of an Interest message.
+ */
+static int
+propagate_interest(struct ccnd_handle *h,
+                   struct face *face,
+                   unsigned char *msg,
+                   struct ccn_parsed_interest *pi,
+                   struct nameprefix_entry *npe)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct pit_face_item *p = NULL;
+    struct interest_entry *ie = NULL;
+    struct ccn_indexbuf *outbound = NULL;
+    const unsigned char *nonce;
+    intmax_t lifetime;
+    ccn_wrappedtime expiry;
+    unsigned char cb[TYPICAL_NONCE_SIZE];
+    size_t noncesize;
+    unsigned faceid;
+    int i;
+    int res;
+    int usec;
+    
+    faceid = face->faceid;
+    hashtb_start(h->interest_tab, e);
+    res = hashtb_seek(e, msg, pi->offset[CCN_PI_B_InterestLifetime], 1);
+    if (res < 0) goto Bail;
+    ie = e->data;
+    if (res == HT_NEW_ENTRY) {
+        ie->serial = ++h->iserial;
+        ie->strategy.birth = h->wtnow;
+        ie->strategy.renewed = h->wtnow;
+        ie->strategy.renewals = 0;
+    }
+    if (ie->interest_msg == NULL) {
+        struct ccn_parsed_interest xpi = {0};
+        int xres;
+        ie->interest_msg = e->key;
+        ie->size = pi->offset[CCN_PI_B_InterestLifetime] + 1;
+        /* Ugly bit, this.  Clear the extension byte. */
+        ((unsigned char *)(intptr_t)ie->interest_msg)[ie->size - 1] = 0;
+        xres = ccn_parse_interest(ie->interest_msg, ie->size, &xpi, NULL);
+        if (xres < 0) abort();
+        link_interest_entry_to_nameprefix(h, ie, npe, &xpi);
+        /* Compile any Exclude now, rather than for each content arrival */
+        if (xpi.offset[CCN_PI_E_Exclude] > xpi.offset[CCN_PI_B_Exclude])
+            ie->excl = ccn_exclude_compile(
+                ie->interest_msg + xpi.offset[CCN_PI_B_Exclude],
+                xpi.offset[CCN_PI_E_Exclude] - xpi.offset[CCN_PI_B_Exclude]);
+    }
+    lifetime = ccn_interest_lifetime(msg, pi);
+    outbound = get_outbound_faces(h, face, msg, pi, npe);
+    if (outbound == NULL) goto Bail;
+    nonce = msg + pi->offset[CCN_PI_B_Nonce];
+    noncesize = pi->offset[CCN_PI_E_Nonce] - pi->offset[CCN_PI_B_Nonce];
+    if (noncesize != 0)
+        ccn_ref_tagged_BLOB(CCN_DTAG_Nonce, msg,
+                            pi->offset[CCN_PI_B_Nonce],
+                            pi->offset[CCN_PI_E_Nonce],
+                            &nonce, &noncesize);
+    else {
+        /* This interest has no nonce; generate one before going on */
+        noncesize = (h->noncegen)(h, face, cb);
+        nonce = cb;
+        nonce_seen_elsewhere(h, faceid, nonce, noncesize);
+    }
+    p = pfi_seek(h, ie, faceid, CCND_PFI_DNSTREAM);
+    p = pfi_set_nonce(h, ie, p, nonce, noncesize);
+    if (nonce == cb || pfi_unique_nonce(h, ie, p)) {
+        ie->strategy.renewed = h->wtnow;
+        ie->strategy.renewals += 1;
+        if ((p->pfi_flags & CCND_PFI_PENDING) == 0) {
+            p->pfi_flags |= CCND_PFI_PENDING;
+            face->pending_interests += 1;
+        }
+    }
+    else {
+        /* Nonce has been seen before; do not forward. */
+        p->pfi_flags |= CCND_PFI_SUPDATA;
+    }
+    pfi_set_expiry_from_lifetime(h, ie, p, lifetime);
+    for (i = 0; i < outbound->n; i++) {
+        p = pfi_seek(h, ie, outbound->buf[i], CCND_PFI_UPSTREAM);
+        if (wt_compare(p->expiry, h->wtnow) < 0) {
+            p->expiry = h->wtnow + 1; // ZZZZ - the +1 may be overkill here.
+            p->pfi_flags &= ~CCND_PFI_UPHUNGRY;
+        }
+    }
+    if (res == HT_NEW_ENTRY)
+        strategy_callout(h, ie, CCNST_FIRST);
+    usec = ie_next_usec(h, ie, &expiry);
+    if (ie->ev != NULL && wt_compare(expiry + 2, ie->ev->evint) < 0)
+        ccn_schedule_cancel(h->sched, ie->ev);
+    if (ie->ev == NULL)
+        ie->ev = ccn_schedule_event(h->sched, usec, do_propagate, ie, expiry);
+Bail:
+    hashtb_end(e);
+    ccn_indexbuf_destroy(&outbound);
+    return(res);
+}
+
+/**
+ * We have a FIB change - accelerate forwarding of existing interests
+ */
+static void
+update_npe_children(struct ccnd_handle *h, struct nameprefix_entry *npe, unsigned faceid)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct face *fface = NULL;
+    struct ccn_parsed_interest pi;
+    struct pit_face_item *p = NULL;
+    struct interest_entry *ie = NULL;
+    struct nameprefix_entry *x = NULL;
+    struct ccn_indexbuf *ob = NULL;
+    int i;
+    unsigned usec = 6000; /*  a bit of time for prefix reg  */
+
+    hashtb_start(h->interest_tab, e);
+    for (ie = e->data; ie != NULL; ie = e->data) {
+        for (x = ie->ll.npe; x != NULL; x = x->parent) {
+            if (x == npe) {
+                for (fface = NULL, p = ie->pfl; p != NULL; p = p->next) {
+                    if (p->faceid == faceid) {
+                        if ((p->pfi_flags & CCND_PFI_UPSTREAM) != 0) {
+                            fface = NULL;
+                            break;
+                        }
+                    }
+                    else if ((p->pfi_flags & CCND_PFI_DNSTREAM) != 0) {
+                        if (fface == NULL || (fface->flags & CCN_FACE_GG) == 0)
+                            fface = face_from_faceid(h, p->faceid);
+                    }
+                }
+                if (fface != NULL) {
+                    ccn_parse_interest(ie->interest_msg, ie->size, &pi, NULL);
+                    ob = get_outbound_faces(h, fface, ie->interest_msg,
+                                            &pi, ie->ll.npe);
+                    for (i = 0; i < ob->n; i++) {
+                        if (ob->buf[i] == faceid) {
+                            p = pfi_seek(h, ie, faceid, CCND_PFI_UPSTREAM);
+                            if ((p->pfi_flags & CCND_PFI_UPENDING) == 0) {
+                                p->expiry = h->wtnow + usec / (1000000 / WTHZ);
+                                usec += 200;
+                                if (ie->ev != NULL && wt_compare(p->expiry + 4, ie->ev->evint) < 0)
+                                    ccn_schedule_cancel(h->sched, ie->ev);
+                                if (ie->ev == NULL)
+                                    ie->ev = ccn_schedule_event(h->sched, usec, do_propagate, ie, p->expiry);
+                            }
+                            break;
+                        }
+                    }
+                    ccn_indexbuf_destroy(&ob);
+                }
+                break;
+            }
+        }
+        hashtb_next(e);
+    }
+    hashtb_end(e);
+}
+
+/**
+ * Creates a nameprefix entry if it does not already exist, together
+ * with all of its parents.
+ */
+static int
+nameprefix_seek(struct ccnd_handle *h, struct hashtb_enumerator *e,
+                const unsigned char *msg, struct ccn_indexbuf *comps, int ncomps)
+{
+    int i;
+    int base;
+    int res = -1;
+    struct hashtb_hash_state hs;
+    struct nameprefix_entry *parent = NULL;
+    struct nameprefix_entry *npe = NULL;
+    struct ielinks *head = NULL;
+
+    if (ncomps + 1 > comps->n)
+        return(-1);
+    base = comps->buf[0];
+    hashtb_hash_start(&hs);
+    for (i = 0; i <= ncomps; i++) {
+        /* Extend the running hash by one component for each prefix */
+        if (i > 0)
+            hashtb_hash_step(&hs, msg + comps->buf[i - 1],
+                             comps->buf[i] - comps->buf[i - 1]);
+        res = hashtb_seek_hashed(e, msg + base, comps->buf[i] - base, 0,
+                                 hashtb_hash_final(&hs));
+        if (res < 0)
+            break;
+        npe = e->data;
+        if (res == HT_NEW_ENTRY) {
+            head = &npe->ie_head;
+            head->next = head;
+            head->prev = head;
+            head->npe = NULL;
+            head = &npe->ie_exact;
+            head->next = head;
+            head->prev = head;
+            head->npe = NULL;
+            npe->parent = parent;
+            npe->forwarding = NULL;
+            npe->fgen = h->forward_to_gen - 1;
+            npe->forward_to = NULL;
+            if (h->worker != NULL)
+                ccnd_worker_fib_fill(h, npe, msg + base, comps->buf[i] - base);
+            if (parent != NULL) {
+                parent->children++;
+                npe->flags = parent->flags;
+                npe->src = parent->src;
+                npe->osrc = parent->osrc;
+                npe->usec = parent->usec;
+            }
+            else {
+                npe->src = npe->osrc = CCN_NOFACEID;
+                npe->usec = (nrand48(h->seed) % 4096U) + 8192;
+            }
+        }
+        parent = npe;
+    }
+    return(res);
+}
+
+/**
+ * Check whether the interest should be dropped for local namespace reasons
+ */
+static int
+drop_nonlocal_interest(struct ccnd_handle *h, struct nameprefix_entry *npe,
+                       struct face *face,
+                       unsigned char *msg, size_t size)
+{
+    if (npe->fgen != h->forward_to_gen)
+        update_forward_to(h, npe);
+    if ((npe->flags & CCN_FORW_LOCAL) != 0 &&
+        (face->flags & CCN_FACE_GG) == 0) {
+        ccnd_debug_ccnb(h, __LINE__, "interest_nonlocal", face, msg, size);
+        h->interests_dropped += 1;
+        return (1);
+    }
+    return(0);
+}
+
+/**
+ * Look in the content store for a match to an interest.
+ *
+ * @returns the content that answers it, or NULL.
+ */
+static struct content_entry *
+cs_lookup(struct ccnd_handle *h, const unsigned char *msg, size_t size,
+          const struct ccn_parsed_interest *pi, struct ccn_indexbuf *comps)
+{
+    struct content_entry *content = NULL;
+    struct content_entry *last_match = NULL;
+    struct ccn_exclude *excl = NULL;
+    int s_ok;
+    int try;
+    
+    s_ok = (pi->answerfrom & CCN_AOK_STALE) != 0;
+    if (pi->offset[CCN_PI_E_Exclude] > pi->offset[CCN_PI_B_Exclude])
+        excl = ccn_exclude_compile(msg + pi->offset[CCN_PI_B_Exclude],
+                                   pi->offset[CCN_PI_E_Exclude] -
+                                   pi->offset[CCN_PI_B_Exclude]);
+    if ((pi->orderpref & 1) != 0 &&
+        find_rightmost_match(h, msg, size, pi, comps, excl, s_ok,
+                             &last_match))
+        content = NULL;
+    else
+        content = find_first_match_candidate(h, msg, pi, comps);
+    if (content != NULL && (h->debug & 8))
+        ccnd_debug_ccnb(h, __LINE__, "first_candidate", NULL,
+                        content->key,
+                        content->size);
+    if (content != NULL &&
+        !content_matches_interest_prefix(h, content, msg, comps,
+                                         pi->prefix_comps)) {
+        if (h->debug & 8)
+            ccnd_debug_ccnb(h, __LINE__, "prefix_mismatch", NULL,
+                            msg, size);
+        content = NULL;
+    }
+    for (try = 0; content != NULL; try++) {
+        if ((s_ok || (content->flags & CCN_CONTENT_ENTRY_STALE) == 0) &&
+            content_matches_interest(h, content, msg, size, pi, excl)) {
+            if (h->debug & 8)
+                ccnd_debug_ccnb(h, __LINE__, "matches", NULL,
+                                content->key,
+                                content->size);
+            if ((pi->orderpref & 1) == 0) // XXX - should be symbolic
+                break;
+            last_match = content;
+            content = next_child_at_level(h, content, comps->n - 1);
+            goto check_next_prefix;
+        }
+        content = content_next(h, content);
+    check_next_prefix:
+        if (content != NULL &&
+            !content_matches_interest_prefix(h, content, msg,
+                                             comps, pi->prefix_comps)) {
+            if (h->debug & 8)
+                ccnd_debug_ccnb(h, __LINE__, "prefix_mismatch", NULL,
+                                content->key,
+                                content->size);
+            content = NULL;
+        }
+    }
+    ccn_exclude_destroy(&excl);
+    if (last_match != NULL)
+        content = last_match;
+    return(content);
+}
+
+/**
+ * Refer to name component i of content, where the component just past
+ * the explicit ones is the implicit digest.
+ *
+ * @returns 0, or -1 if the name has no such component.
+ */
+static int
+content_comp_ref(struct ccnd_handle *h, struct content_entry *content, int i,
+                 const unsigned char **val, size_t *size)
+{
+    if (i + 1 < content->ncomps)
+        return(ccn_ref_tagged_BLOB(CCN_DTAG_Component, content->key,
+                                   content->comps[i], content->comps[i + 1],
+                                   val, size));
+    if (i + 1 > content->ncomps)
+        return(-1);
+    *val = content_digest(h, content);
+    *size = sizeof(content->digest);
+    return(0);
+}
+
+/**
+ * Compare the names of two content entries, each with its implicit
+ * digest, in the order used by ccn_compare_names().
+ *
+ * Only the components from i on and before stop are compared; a stop
+ * of -1 means all of them.
+ */
+static int
+content_name_compare(struct ccnd_handle *h, struct content_entry *a,
+                     struct content_entry *b, int i, int stop)
+{
+    const unsigned char *av = NULL;
+    const unsigned char *bv = NULL;
+    size_t as = 0;
+    size_t bs = 0;
+    int ares;
+    int bres;
+    int res;
+    
+    for (; stop < 0 || i < stop; i++) {
+        ares = content_comp_ref(h, a, i, &av, &as);
+        bres = content_comp_ref(h, b, i, &bv, &bs);
+        if (ares < 0 || bres < 0)
+            return((ares < 0) == (bres < 0) ? 0 : (ares < 0) ? -1 : 1);
+        res = trie_comp_compare(av, as, bv, bs);
+        if (res != 0)
+            return(res);
+    }
+    return(0);
+}
+
+/**
+ * Decide which of two matches for an interest, from different stores,
+ * a single store holding both would have chosen.
+ *
+ * That is the leftmost in name order, or for the rightmost-child selector,
+ * the one with the greatest component at level (the first one past the
+ * name in the interest), and the leftmost of those.
+ * @returns nonzero if a is to be preferred to b.
+ */
+static int
+content_preferred(struct ccnd_handle *h, struct content_entry *a,
+                  struct content_entry *b, int rightmost, int level)
+{
+    int res;
+    
+    if (rightmost) {
+        res = content_name_compare(h, a, b, level, level + 1);
+        if (res != 0)
+            return(res > 0);
+    }
+    return(content_name_compare(h, a, b, 0, -1) < 0);
+}
+
+/**
+ * Send stored content in answer to an interest.
+ *
+ * Any other interests pending on the face that it matches are consumed too.
+ * For a stand-in, the thread that stores the content is told of the hit.
+ */
+static void
+cs_serve(struct ccnd_handle *h, struct face *face,
+         struct content_entry *content,
+         const unsigned char *msg, size_t size,
+         const struct ccn_parsed_interest *pi)
+{
+    int k;
+    
+    if ((content->flags & CCN_CONTENT_ENTRY_TRANSIT) != 0)
+        transit_hit(h, content, (pi->answerfrom & CCN_AOK_EXPIRE) != 0);
+    else {
+        h->cs_hits++;
+        content_lru_insert(h, content, 0);
+    }
+    /* Check to see if we are planning to send already */
+    if (face_queued_lookup(face, content->accession) == NULL) {
+        k = face_send_queue_insert(h, face, content);
+        if (k >= 0) {
+            if (h->debug & (32 | 8))
+                ccnd_debug_ccnb(h, __LINE__, "consume", face, msg, size);
+        }
+        /* Any other matched interests need to be consumed, too. */
+        match_interests(h, content, NULL, face, NULL);
+    }
+    if ((pi->answerfrom & CCN_AOK_EXPIRE) != 0)
+        mark_stale(h, content);
+}
+
+/**
+ * Answer an interest that has been accepted, from the content store,
+ * or else propagate it.
+ *
+ * With workers, the shards are asked first about an interest that stays
+ * on the main thread (see interest_probe()), and this is called again
+ * when they have answered, with the best match they found in probe.
+ */
+static void
+interest_lookup(struct ccnd_handle *h, struct face *face,
+                unsigned char *msg, size_t size,
+                struct ccn_parsed_interest *pi, struct ccn_indexbuf *comps,
+                struct ccnd_probe *probe)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct interest_entry *ie = NULL;
+    struct nameprefix_entry *npe = NULL;
+    struct content_entry *content = NULL;
+    struct content_entry *found;
+    int matched;
+    
+    ie = hashtb_lookup(h->interest_tab, msg,
+                       pi->offset[CCN_PI_B_InterestLifetime]);
+    if (ie != NULL) {
+        /* Since this is in the PIT, we do not need to check the CS. */
+        npe = ie->ll.npe;
+        if (drop_nonlocal_interest(h, npe, face, msg, size))
+            return;
+        propagate_interest(h, face, msg, pi, npe);
+        return;
+    }
+    if (probe == NULL && (h->debug & 16)) {
+        /* Only print details that are not already presented */
+        // ZZZZ - should do nifty Exclude presentation here
+        ccnd_msg(h,
+                 "version: %d, "
+                 "excl: %d bytes, "
+                 "etc: %d bytes",
+                 pi->magic,
+                 pi->offset[CCN_PI_E_Exclude] - pi->offset[CCN_PI_B_Exclude],
+                 pi->offset[CCN_PI_E_OTHER] - pi->offset[CCN_PI_B_OTHER]);
+    }
+    if (probe == NULL && h->workers != NULL &&
+        (pi->answerfrom & CCN_AOK_CS) != 0 &&
+        interest_probe(h, face, msg, size, pi, comps) == 0)
+        return;
+    matched = 0;
+    hashtb_start(h->nameprefix_tab, e);
+    nameprefix_seek(h, e, msg, comps, pi->prefix_comps);
+    npe = e->data;
+    if (npe == NULL || drop_nonlocal_interest(h, npe, face, msg, size))
+        goto Bail;
+    if ((pi->answerfrom & CCN_AOK_CS) != 0) {
+        content = cs_lookup(h, msg, size, pi, comps);
+        found = probe_take(probe);
+        if (found != NULL &&
+            (content == NULL ||
+             content_preferred(h, found, content, pi->orderpref & 1,
+                               comps->n - 1)))
+            content = found;
+        if (content != NULL) {
+            cs_serve(h, face, content, msg, size, pi);
+            matched = 1;
+        }
+        else
+            h->cs_misses++;
+        if (found != NULL)
+            transit_done(h, found, content == found);
+    }
+    if (!matched && npe != NULL && (pi->answerfrom & CCN_AOK_EXPIRE) == 0)
+        propagate_interest(h, face, msg, pi, npe);
+Bail:
+    hashtb_end(e);
+}
+
+/**
+ * Process an incoming interest message.
+ *
+ * Parse the Interest and discard if it does not parse.
+ * Check for correct scope (a scope 0 or scope 1 interest should never
+ *  arrive on an external face).
+ * Check for a duplicated Nonce, discard if it has been seen before.
+ * Look up the name prefix.  Check for a local namespace and discard
+ *  if an interest in a local namespace arrives from outside.
+ * Consult the content store.  If a suitable matching ContentObject is found,
+ *  prepare to send it, consuming this interest and any pending interests
+ *  on that face that also match this object.
+ * Otherwise, initiate propagation of the interest.
+ */
+static void
+process_incoming_interest(struct ccnd_handle *h, struct face *face,
+                          unsigned char *msg, size_t size)
+{
+    struct ccn_parsed_interest parsed_interest = {0};
+    struct ccn_parsed_interest *pi = &parsed_interest;
+    size_t namesize = 0;
+    int res;
+    struct ccn_indexbuf *comps = indexbuf_obtain(h);
+    if (size > 65535)
+        res = -__LINE__;
+    else
+        res = ccn_parse_interest(msg, size, pi, comps);
+    if (res < 0) {
+        ccnd_msg(h, "error parsing Interest - code %d", res);
+        ccn_indexbuf_destroy(&comps);
+        return;
+    }
+    ccnd_meter_bump(h, face->meter[FM_INTI], 1);
+    if (interest_looped(h, face, msg, pi)) {
+        if (h->debug & (16 | 8 | 2))
+            ccnd_debug_ccnb(h, __LINE__, "interest_looped", face, msg, size);
+        h->interests_looped += 1;
+    }
+    else if (pi->scope >= 0 && pi->scope < 2 &&
+             (face->flags & CCN_FACE_GG) == 0) {
+        ccnd_debug_ccnb(h, __LINE__, "interest_outofscope", face, msg, size);
+        h->interests_dropped += 1;
+    }
+    else {
+        if (h->debug & (16 | 8 | 2))
+            ccnd_debug_ccnb(h, __LINE__, "interest_from", face, msg, size);
+        if (pi->magic < 20090701) {
+            if (++(h->oldformatinterests) == h->oldformatinterestgrumble) {
+                h->oldformatinterestgrumble *= 2;
+                ccnd_msg(h, "downrev interests received: %d (%d)",
+                         h->oldformatinterests,
+                         pi->magic);
+            }
+        }
+        namesize = comps->buf[pi->prefix_comps] - comps->buf[0];
+        h->interests_accepted += 1;
+        interest_lookup(h, face, msg, size, pi, comps, NULL);
+    }
+    indexbuf_release(h, comps);
+}
+
+/**
+ * Mark content as stale
+ */
+static void
+mark_stale(struct ccnd_handle *h, struct content_entry *content)
+{
+    if ((content->flags & (CCN_CONTENT_ENTRY_STALE |
+                           CCN_CONTENT_ENTRY_TRANSIT)) != 0)
+        return;
+    if (h->debug & 4)
+            ccnd_debug_ccnb(h, __LINE__, "stale", NULL,
+                            content->key, content->size);
+    content->flags |= CCN_CONTENT_ENTRY_STALE;
+    h->n_stale++;
+    content_lru_insert(h, content, 1);
+}
+
+/**
+ * Make content stale now that its FreshnessSeconds has expired.
+ *
+ * May actually remove the content if we are over quota.
+ */
+static void
+content_expired(struct ccnd_handle *h, struct content_entry *content)
+{
+    if (content_store_over_limit(h, 0) && remove_content(h, content) == 0) {
+        h->cs_evictions++;
+        return;
+    }
+    mark_stale(h, content);
+}
+
+/**
+ * Scheduled event that makes one ContentObject stale.
+ *
+ * This is only for force_zero_freshness (CCND_CAP=0), where content must
+ * go stale much sooner than the expiry ring can manage.  Such content
+ * is kept so briefly that there are never many of these events.
+ */
+static int
+expire_content_soon(struct ccn_schedule *sched,
+                    void *clienth,
+                    struct ccn_scheduled_event *ev,
+                    int flags)
+{
+    struct ccnd_handle *h = clienth;
+    struct content_entry *content;
+    (void)(sched);
+    
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0)
+        return(0);
+    content = content_from_accession(h, ev->evint);
+    if (content != NULL && (content->flags & CCN_CONTENT_ENTRY_STALE) == 0)
+        content_expired(h, content);
+    return(0);
+}
+
+/**
+ * Scheduled event that sweeps the expiry ring.
+ *
+ * Each second, the content in the slot for that second is made stale.
+ * This runs once a second for as long as the ring is not empty.
+ */
+static int
+expire_content(struct ccn_schedule *sched,
+               void *clienth,
+               struct ccn_scheduled_event *ev,
+               int flags)
+{
+    struct ccnd_handle *h = clienth;
+    struct content_expiry_slot *slot;
+    struct content_entry *content;
+    unsigned i;
+    int check_limit = 5000;  /* Do not run for too long at once */
+    (void)(sched);
+    (void)(ev);
+    
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0) {
+        h->expiry = NULL;
+        return(0);
+    }
+    /* Do not go around more than once if the clock jumps ahead */
+    if (h->sec - h->expiry_swept > CCND_EXPIRY_SLOTS)
+        h->expiry_swept = h->sec - CCND_EXPIRY_SLOTS;
+    if (h->sec < h->expiry_swept)
+        h->expiry_swept = h->sec;
+    while (h->expiry_swept < h->sec) {
+        i = (h->expiry_swept + 1) & (CCND_EXPIRY_SLOTS - 1);
+        slot = &h->expiry_ring[i];
+        while (slot->n > 0) {
+            if (check_limit-- <= 0)
+                return(5000);
+            content = content_from_accession(h, slot->accession[--slot->n]);
+            h->expiry_count--;
+            if (content != NULL && content->fresh_until != 0 &&
+                (content->fresh_until & (CCND_EXPIRY_SLOTS - 1)) == i &&
+                (content->flags & CCN_CONTENT_ENTRY_STALE) == 0)
+                content_expired(h, content);
+        }
+        free(slot->accession);
+        slot->accession = NULL;
+        slot->room = 0;
+        h->expiry_swept++;
+    }
+    if (h->expiry_count == 0) {
+        h->expiry = NULL;
+        return(0);
+    }
+    /* Wake up just after the next second starts */
+    return(1000000 - h->usec + 1000);
+}
+
+/**
+ * Put content into the expiry ring slot for its fresh_until.
+ */
+static void
+content_expiry_insert(struct ccnd_handle *h, struct content_entry *content)
+{
+    struct content_expiry_slot *slot;
+    ccn_accession_t *a;
+    
+    if (h->expiry_ring == NULL) {
+        h->expiry_ring = calloc(CCND_EXPIRY_SLOTS, sizeof(h->expiry_ring[0]));
+        if (h->expiry_ring == NULL)
+            return;
+    }
+    if (h->expiry == NULL) {
+        if (h->expiry_count == 0)
+            h->expiry_swept = h->sec;
+        h->expiry = ccn_schedule_event(h->sched, 1000000 - h->usec + 1000,
+                                       &expire_content, NULL, 0);
+    }
+    if ((long)content->fresh_until <= h->expiry_swept)
+        content->fresh_until = h->expiry_swept + 1;
+    slot = &h->expiry_ring[content->fresh_until & (CCND_EXPIRY_SLOTS - 1)];
+    if (slot->n == slot->room) {
+        a = realloc(slot->accession, (2 * slot->room + 16) * sizeof(*a));
+        if (a == NULL) {
+            content_expired(h, content);
+            return;
+        }
+        slot->accession = a;
+        slot->room = 2 * slot->room + 16;
+    }
+    slot->accession[slot->n++] = content->accession;
+    h->expiry_count++;
+}
+
+/**
+ * Schedules content expiration based on its FreshnessSeconds, and the
+ * configured default and limit.
+ *
+ * Expiry is rounded up to a whole second, so that the content goes
+ * into the expiry ring rather than getting an event of its own.
+ * With force_zero_freshness the content is kept for only a fraction
+ * of a second, so it gets an event after all.
+ */
+static void
+set_content_timer(struct ccnd_handle *h, struct content_entry *content,
+                  struct ccn_parsed_ContentObject *pco)
+{
+    int seconds = 0;
+    int microseconds = 0;
+    size_t start = pco->offset[CCN_PCO_B_FreshnessSeconds];
+    size_t stop  = pco->offset[CCN_PCO_E_FreshnessSeconds];
+    content->fresh_until = 0;
+    if (h->force_zero_freshness) {
+        /* Keep around for long enough to make it through the queues */
+        microseconds = 8 * h->data_pause_microsec + 10000;
+        content->fresh_until = h->sec +
+                               (h->usec + microseconds + 999999) / 1000000;
+        ccn_schedule_event(h->sched, microseconds,
+                           &expire_content_soon, NULL, content->accession);
+        return;
+    }
+    if (start == stop)
+        seconds = h->tts_default;
+    else
+        seconds = ccn_fetch_tagged_nonNegativeInteger(
+                CCN_DTAG_FreshnessSeconds,
+                content->key,
+                start, stop);
+    if (seconds <= 0 || (h->tts_limit > 0 && seconds > h->tts_limit))
+        seconds = h->tts_limit;
+    if (seconds <= 0)
+        return;
+    if (seconds > ((1U<<31) / 1000000)) {
+        ccnd_debug_ccnb(h, __LINE__, "FreshnessSeconds_too_large", NULL,
+            content->key, pco->offset[CCN_PCO_E]);
+        return;
+    }
+    microseconds = seconds * 1000000;
+    content->fresh_until = h->sec +
+                           (h->usec + microseconds + 999999) / 1000000;
+    content_expiry_insert(h, content);
+}
+
+/**
+ * Set up a content entry that has just been added to content_tab.
+ *
+ * Assigns the accession number and indexes the entry by name.
+ * The caller still needs to set the arrival face, timer, and place in
+ * the replacement list.
+ *
+ * @returns 0, or -1 (having deleted the entry) if out of memory.
+ */
+static int
+content_enroll_new(struct ccnd_handle *h, struct hashtb_enumerator *e,
+                   const struct ccn_parsed_ContentObject *obj,
+                   struct ccn_indexbuf *comps)
+{
+    struct content_entry *content = e->data;
+    int i;
+    
+    content->accession = ++(h->accession);
+    enroll_content(h, content);
+    if (content == content_from_accession(h, content->accession)) {
+        content->ncomps = comps->n;
+        content->comps = calloc(comps->n, sizeof(comps[0]));
+        if (content->comps == NULL) {
+            ccnd_msg(h, "could not enroll ContentObject (accession %llu)",
+                     (unsigned long long)content->accession);
+            hashtb_delete(e);
+            return(-1);
+        }
+    }
+    content->key_size = obj->offset[CCN_PCO_B_Content];
+    content->size = e->keysize;
+    content->key = e->key;
+    for (i = 0; i < comps->n; i++)
+        content->comps[i] = comps->buf[i];
+    content_trie_insert(h, content);
+    h->cs_bytes += content_footprint(content);
+    if (h->worker != NULL || h->workers != NULL)
+        ccnd_workers_cs_note(h, 1, content_footprint(content));
+    return(0);
+}
+
+/**
+ * Offer content just stored in a shard to the interests pending on the
+ * main thread, whose names are too short to have a shard.
+ *
+ * The content is pinned, and the main thread sends it through a stand-in.
+ */
+static void
+content_offer_main(struct ccnd_handle *h, struct face *from_face,
+                   struct content_entry *content)
+{
+    struct ccnd_packet *p;
+    
+    p = ccnd_packet_create(CCND_PKT_MATCH);
+    if (p == NULL)
+        return;
+    packet_pin_content(h, p, content);
+    p->faceid = from_face->faceid;
+    ccnd_workers_post(h, 0, p);
+}
+
+/**
+ * Process an arriving ContentObject.
+ *
+ * Parse the ContentObject and discard if it is not well-formed.
+ *
+ * Look it up in the content store.  It it is already there, but is stale,
+ * make it fresh again.  If it is not there, add it.
+ *
+ * Find the matching pending interests in the PIT and consume them,
+ * queueing the ContentObject to be sent on the associated faces.
+ * If no matches were found and the content object was new, discard remove it
+ * from the store.
+ *
+ * XXX - the change to staleness should also not happen if there was no
+ * matching PIT entry.
+ */
+static void
+process_incoming_content(struct ccnd_handle *h, struct face *face,
+                         unsigned char *msg, size_t size)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct ccn_parsed_ContentObject obj = {0};
+    int res;
+    size_t keysize = 0;
+    struct content_entry *content = NULL;
+    struct ccn_indexbuf *comps = indexbuf_obtain(h);
+    
+    res = ccn_parse_ContentObject(msg, size, &obj, comps);
+    if (res < 0) {
+        ccnd_msg(h, "error parsing ContentObject - code %d", res);
+        goto Bail;
+    }
+    ccnd_meter_bump(h, face->meter[FM_DATI], 1);
+    if (comps->n < 1 ||
+        (keysize = comps->buf[comps->n - 1]) > 65535) {
+        ccnd_msg(h, "ContentObject with keysize %lu discarded",
+                 (unsigned long)keysize);
+        ccnd_debug_ccnb(h, __LINE__, "oversize", face, msg, size);
+        res = -__LINE__;
+        goto Bail;
+    }
+    if (obj.magic != 20090415) {
+        if (++(h->oldformatcontent) == h->oldformatcontentgrumble) {
+            h->oldformatcontentgrumble *= 10;
+            ccnd_msg(h, "downrev content items received: %d (%d)",
+                     h->oldformatcontent,
+                     obj.magic);
+        }
+    }
+    if (h->debug & 4)
+        ccnd_debug_ccnb(h, __LINE__, "content_from", face, msg, size);
+    /*
+     * The whole object is the key, so objects that differ only after the
+     * name (and so in their implicit digest) get entries of their own.
+     */
+    hashtb_start(h->content_tab, e);
+    res = hashtb_seek(e, msg, size, 0);
+    content = e->data;
+    if (res == HT_OLD_ENTRY) {
+        if ((content->flags & CCN_CONTENT_ENTRY_STALE) != 0) {
+            /* When old content arrives after it has gone stale, freshen it */
+            // XXX - ought to do mischief checks before this
+            content->flags &= ~CCN_CONTENT_ENTRY_STALE;
+            h->n_stale--;
+            content_lru_insert(h, content, 0);
+            set_content_timer(h, content, &obj);
+            /* Record the new arrival face only if the old face is gone */
+            // XXX - it is not clear that this is the most useful choice
+            if (face_from_faceid(h, content->arrival_faceid) == NULL)
+                content->arrival_faceid = face->faceid;
+            // XXX - no counter for this case
+        }
+        else {
+            h->content_dups_recvd++;
+            ccnd_msg(h, "received duplicate ContentObject from %u (accession %llu)",
+                     face->faceid, (unsigned long long)content->accession);
+            ccnd_debug_ccnb(h, __LINE__, "dup", face, msg, size);
+        }
+    }
+    else if (res == HT_NEW_ENTRY) {
+        if (content_enroll_new(h, e, &obj, comps) < 0) {
+            content = NULL;
+            res = -__LINE__;
+            hashtb_end(e);
+            goto Bail;
+        }
+        content->arrival_faceid = face->faceid;
+        set_content_timer(h, content, &obj);
+        /* Mark public keys supplied at startup as precious. */
+        if (obj.type == CCN_CONTENT_KEY && content->accession <= (h->capacity + 7)/8)
+            content->flags |= CCN_CONTENT_ENTRY_PRECIOUS;
+        content_lru_insert(h, content, 0);
+        if (content_store_over_limit(h, 1))
+            clean_needed(h);
+    }
+    hashtb_end(e);
+Bail:
+    indexbuf_release(h, comps);
+    if (res >= 0 && content != NULL) {
+        int n_matches;
+        n_matches = match_interests(h, content, &obj, NULL, face);
+        if (res == HT_NEW_ENTRY) {
+            if (n_matches < 0) {
+                remove_content(h, content);
+                return;
+            }
+            if (n_matches == 0 && (face->flags & CCN_FACE_GG) == 0) {
+                content->flags |= CCN_CONTENT_ENTRY_SLOWSEND;
+                content_lru_insert(h, content, 1);
+            }
+        }
+        if (h->worker != NULL && n_matches >= 0 &&
+            ccnd_workers_match_wanted(h, content))
+            content_offer_main(h, face, content);
+        // ZZZZ - review whether the following is actually needed
+        if (content_queue_withdraw(face, content->accession) == 0) {
+            /*
+             * In the case this consumed any interests from this source,
+             * don't send the content back
+             */
+            if (h->debug & 8)
+                ccnd_debug_ccnb(h, __LINE__, "content_nosend", face, msg, size);
+        }
+    }
+}
+
+/**
+ * Store a 32-bit value in a snapshot file, most significant byte first.
+ */
+static void
+snapshot_put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t
+snapshot_get32(const unsigned char *p)
+{
+    return(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3]);
+}
+
+/**
+ * Compute the CRC-32 (the one used by zlib and ethernet) of some bytes.
+ *
+ * Pass 0 as crc to start, or a previous result to continue.
+ */
+static uint32_t
+snapshot_crc32(uint32_t crc, const unsigned char *p, size_t n)
+{
+    static uint32_t table[256];
+    uint32_t c;
+    int i;
+    int k;
+    
+    if (table[1] == 0) {
+        for (i = 0; i < 256; i++) {
+            for (c = i, k = 0; k < 8; k++)
+                c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    while (n-- > 0)
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return(~crc);
+}
+
+/**
+ * The check value of a snapshot record, covering its size, its
+ * fresh_until, and the ContentObject itself.
+ */
+static uint32_t
+snapshot_check(const unsigned char *rec, const unsigned char *data, size_t size)
+{
+    return(snapshot_crc32(snapshot_crc32(0, rec, 8), data, size));
+}
+
+/**
+ * Write a snapshot record for each fresh ContentObject in the store.
+ *
+ * Records go from the eviction end of the replacement list to the most
+ * recently used end, so that loading them puts them back in the same
+ * order.  With CCND_WORKERS, this runs on the thread that owns the store.
+ * The counts are added to *count and *bytes.
+ *
+ * @returns 0 for success, -1 for a write error.
+ */
+int
+ccnd_snapshot_write(struct ccnd_handle *h, FILE *f,
+                    long *count, unsigned long *bytes)
+{
+    struct content_entry *content;
+    unsigned char rec[CCND_SNAPSHOT_RECSIZE];
+    
+    for (content = h->lru_oldest; content != NULL; content = content->lru_next) {
+        if ((content->flags & CCN_CONTENT_ENTRY_STALE) != 0)
+            continue;
+        if (content->fresh_until != 0 && content->fresh_until <= h->sec)
+            continue;
+        snapshot_put32(rec, content->size);
+        snapshot_put32(rec + 4, content->fresh_until);
+        snapshot_put32(rec + 8, snapshot_check(rec, content->key, content->size));
+        if (fwrite(rec, sizeof(rec), 1, f) != 1 ||
+            fwrite(content->key, content->size, 1, f) != 1)
+            return(-1);
+        *count += 1;
+        *bytes += content->size;
+    }
+    return(0);
+}
+
+/**
+ * Write the fresh part of the content store to the CCND_CS_SNAPSHOT file.
+ *
+ * After a header with the format version, each record carries
+ * a CRC-32, and a record of size 0 that holds the record count marks
+ * the end.  With CCND_WORKERS, the records of the main thread come
+ * first, then those of each shard.  The file is written under a temporary
+ * name and then renamed into place.
+ *
+ * @returns the number of ContentObjects written, or -1 for error.
+ */
+static long
+ccnd_snapshot_save(struct ccnd_handle *h)
+{
+    struct ccn_charbuf *tmpname = NULL;
+    unsigned char hdr[CCND_SNAPSHOT_HDRSIZE];
+    unsigned char rec[CCND_SNAPSHOT_RECSIZE];
+    FILE *f = NULL;
+    long count = 0;
+    unsigned long bytes = 0;
+    int res = -1;
+    
+    if (h->cs_snapshot == NULL)
+        return(-1);
+    tmpname = ccn_charbuf_create();
+    ccn_charbuf_putf(tmpname, "%s.new", h->cs_snapshot);
+    f = fopen(ccn_charbuf_as_string(tmpname), "wb");
+    if (f == NULL)
+        goto Bail;
+    memcpy(hdr, CCND_SNAPSHOT_MAGIC, CCND_SNAPSHOT_MAGICSIZE);
+    snapshot_put32(hdr + CCND_SNAPSHOT_MAGICSIZE, CCND_SNAPSHOT_VERSION);
+    if (fwrite(hdr, sizeof(hdr), 1, f) != 1)
+        goto Bail;
+    if (ccnd_snapshot_write(h, f, &count, &bytes) < 0)
+        goto Bail;
+    if (h->workers != NULL && ccnd_workers_snapshot(h, f, &count, &bytes) < 0)
+        goto Bail;
+    snapshot_put32(rec, 0);
+    snapshot_put32(rec + 4, 0);
+    snapshot_put32(rec + 8, count);
+    if (fwrite(rec, sizeof(rec), 1, f) != 1 || fflush(f) != 0 ||
+        fsync(fileno(f)) != 0)
+        goto Bail;
+    res = fclose(f);
+    f = NULL;
+    if (res == 0)
+        res = rename(ccn_charbuf_as_string(tmpname), h->cs_snapshot);
+Bail:
+    if (res != 0) {
+        ccnd_msg(h, "snapshot %s: %s (errno = %d)",
+                 ccn_charbuf_as_string(tmpname), strerror(errno), errno);
+        if (f != NULL)
+            fclose(f);
+        unlink(ccn_charbuf_as_string(tmpname));
+        count = -1;
+    }
+    else
+        ccnd_msg(h, "snapshot %s: %ld ContentObjects, %lu bytes",
+                 h->cs_snapshot, count, bytes);
+    ccn_charbuf_destroy(&tmpname);
+    return(count);
+}
+
+/**
+ * Put one ContentObject from a snapshot into the store.
+ *
+ * This is like process_incoming_content, but there are no interests to
+ * match at startup, and the caller takes care of staleness.
+ *
+ * @returns the new entry, or NULL if it was not added.
+ */
+static struct content_entry *
+snapshot_enroll_content(struct ccnd_handle *h,
+                        const unsigned char *msg, size_t size)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct ccn_parsed_ContentObject obj = {0};
+    struct content_entry *content = NULL;
+    struct ccn_indexbuf *comps = indexbuf_obtain(h);
+    int res;
+    
+    res = ccn_parse_ContentObject(msg, size, &obj, comps);
+    if (res < 0 || comps->n < 1 || comps->buf[comps->n - 1] > 65535)
+        goto Bail;
+    hashtb_start(h->content_tab, e);
+    res = hashtb_seek(e, msg, size, 0);
+    if (res == HT_NEW_ENTRY && content_enroll_new(h, e, &obj, comps) == 0) {
+        content = e->data;
+        content->arrival_faceid = CCN_NOFACEID;
+        content_lru_insert(h, content, 0);
+    }
+    hashtb_end(e);
+Bail:
+    indexbuf_release(h, comps);
+    return(content);
+}
+
+/**
+ * Reload the content store from the CCND_CS_SNAPSHOT file, if there is one.
+ *
+ * The file is mapped rather than read.  Records that have gone stale in
+ * the meantime are skipped; a damaged record ends the load.  With
+ * CCND_WORKERS, this is called before the worker threads start, and each
+ * record goes to the shard that owns its name.
+ */
+static void
+ccnd_snapshot_load(struct ccnd_handle *h)
+{
+    struct ccnd_handle *shard;
+    struct content_entry *content;
+    struct stat statbuf;
+    const unsigned char *base = NULL;
+    const char *note = " (damaged or truncated)";
+    size_t size = 0;
+    size_t pos;
+    uint32_t len;
+    uint32_t when;
+    uint32_t check;
+    uint32_t version;
+    unsigned long nrec = 0;
+    unsigned long loaded = 0;
+    int fd;
+    int i;
+    struct ccn_timeval dummy;
+    
+    h->ticktock.gettime(&h->ticktock, &dummy);
+    for (i = 0; (shard = ccnd_workers_shard(h, i)) != NULL; i++)
+        shard->ticktock.gettime(&shard->ticktock, &dummy);
+    fd = open(h->cs_snapshot, O_RDONLY);
+    if (fd == -1) {
+        if (errno != ENOENT)
+            ccnd_msg(h, "snapshot %s: %s", h->cs_snapshot, strerror(errno));
+        return;
+    }
+    if (fstat(fd, &statbuf) == 0 && statbuf.st_size >= CCND_SNAPSHOT_HDRSIZE) {
+        size = statbuf.st_size;
+        base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED)
+            base = NULL;
+    }
+    close(fd);
+    if (base == NULL ||
+        memcmp(base, CCND_SNAPSHOT_MAGIC, CCND_SNAPSHOT_MAGICSIZE) != 0) {
+        ccnd_msg(h, "snapshot %s: not a content store snapshot", h->cs_snapshot);
+        goto Finish;
+    }
+    version = snapshot_get32(base + CCND_SNAPSHOT_MAGICSIZE);
+    if (version != CCND_SNAPSHOT_VERSION) {
+        ccnd_msg(h, "snapshot %s: unsupported version %u, ignored",
+                 h->cs_snapshot, (unsigned)version);
+        goto Finish;
+    }
+#if defined(MADV_SEQUENTIAL)
+    madvise((void *)base, size, MADV_SEQUENTIAL);
+#endif
+    for (pos = CCND_SNAPSHOT_HDRSIZE; size - pos >= CCND_SNAPSHOT_RECSIZE;) {
+        len = snapshot_get32(base + pos);
+        when = snapshot_get32(base + pos + 4);
+        check = snapshot_get32(base + pos + 8);
+        pos += CCND_SNAPSHOT_RECSIZE;
+        if (len == 0) {
+            if (check == nrec)
+                note = "";
+            break;
+        }
+        if (len > size - pos ||
+            check != snapshot_check(base + pos - CCND_SNAPSHOT_RECSIZE,
+                                    base + pos, len))
+            break;
+        nrec++;
+        if (when == 0 || when > h->sec) {
+            shard = h;
+            if (h->workers != NULL)
+                shard = ccnd_workers_content_shard(h, base + pos, len);
+            content = NULL;
+            if (shard != NULL)
+                content = snapshot_enroll_content(shard, base + pos, len);
+            if (content != NULL) {
+                loaded++;
+                content->fresh_until = when;
+                if (when != 0)
+                    content_expiry_insert(shard, content);
+            }
+        }
+        pos += len;
+    }
+    ccnd_msg(h, "snapshot %s: loaded %lu of %lu ContentObjects%s",
+             h->cs_snapshot, loaded, nrec, note);
+    ccnd_cs_check(h);
+    for (i = 0; (shard = ccnd_workers_shard(h, i)) != NULL; i++)
+        ccnd_cs_check(shard);
+Finish:
+    if (base != NULL)
+        munmap((void *)base, size);
+}
+
+/**
+ * Write a content store snapshot, at the request of a local client.
+ *
+ * This is handled by the internal client as /ccnx/CCNDID/snapshot/ARG,
+ * where ARG is a signed ContentObject whose content is ignored.
+ * The reply is a StatusResponse.
+ */
+int
+ccnd_req_snapshot(struct ccnd_handle *h,
+                  const unsigned char *msg, size_t size,
+                  struct ccn_charbuf *reply_body)
+{
+    struct face *reqface = NULL;
+    char text[80];
+    long count;
+    (void)msg;
+    (void)size;
+    
+    reqface = face_from_faceid(h, h->interest_faceid);
+    if (reqface == NULL ||
+        (reqface->flags & (CCN_FACE_LOOPBACK | CCN_FACE_LOCAL)) == 0)
+        return(-1);
+    if ((reqface->flags & CCN_FACE_GG) == 0)
+        return(ccnd_nack(h, reply_body, 430, "not authorized"));
+    if (h->cs_snapshot == NULL)
+        return(ccnd_nack(h, reply_body, 404, "no snapshot file configured"));
+    count = ccnd_snapshot_save(h);
+    if (count < 0)
+        return(ccnd_nack(h, reply_body, 500, "could not write snapshot"));
+    snprintf(text, sizeof(text), "%ld ContentObjects saved", count);
+    reply_body->length = 0;
+    return(ccn_encode_StatusResponse(reply_body, 200, text));
+}
+
+/**
+ * Hand an Interest or ContentObject to the thread whose shard its
+ * name belongs to, if that is not this one.
+ *
+ * The packet refers to the message where it lies; see rx_hold().
+ * @returns 1 if it was handed over (or lost trying), else 0.
+ */
+static int
+input_elsewhere(struct ccnd_handle *h, struct face *face, enum ccn_dtag dtag,
+                unsigned char *msg, size_t size)
+{
+    struct ccnd_packet *p;
+    int t;
+    
+    t = ccnd_workers_dispatch(h, dtag, msg, size);
+    if (t == h->thread)
+        return(0);
+    p = ccnd_packet_create(CCND_PKT_INPUT);
+    if (p == NULL)
+        return(1);
+    if (rx_hold(h, p, msg, size) < 0) {
+        ccnd_packet_release(p);
+        return(1);
+    }
+    p->faceid = face->faceid;
+    p->flags = face->flags;
+    p->dtag = dtag;
+    ccnd_workers_post(h, t, p);
+    return(1);
+}
+
+/**
+ * Process an incoming message.
+ *
+ * This is where we decide whether we have an Interest message,
+ * a ContentObject, or something else.
+ */
+static void
+process_input_message(struct ccnd_handle *h, struct face *face,
+                      unsigned char *msg, size_t size, int pdu_ok)
+{
+    struct ccn_skeleton_decoder decoder = {0};
+    struct ccn_skeleton_decoder *d = &decoder;
+    ssize_t dres;
+    enum ccn_dtag dtag;
+    
+    if ((face->flags & CCN_FACE_UNDECIDED) != 0) {
+        face->flags &= ~CCN_FACE_UNDECIDED;
+        if ((face->flags & CCN_FACE_LOOPBACK) != 0)
+            face->flags |= CCN_FACE_GG;
+        /* YYY This is the first place that we know that an inbound stream face is speaking CCNx protocol. */
+        register_new_face(h, face);
+    }
+    d->state |= CCN_DSTATE_PAUSE;
+    dres = ccn_skeleton_decode(d, msg, size);
+    if (d->state < 0)
+        abort(); /* cannot happen because of checks in caller */
+    if (CCN_GET_TT_FROM_DSTATE(d->state) != CCN_DTAG) {
+        ccnd_msg(h, "discarding unknown message; size = %lu", (unsigned long)size);
+        // XXX - keep a count?
+        return;
+    }
+    dtag = d->numval;
+    switch (dtag) {
+        case CCN_DTAG_CCNProtocolDataUnit:
+            if (!pdu_ok)
+                break;
+            size -= d->index;
+            if (size > 0)
+                size--;
+            msg += d->index;
+            if ((face->flags & (CCN_FACE_LINK | CCN_FACE_GG)) != CCN_FACE_LINK) {
+                face->flags |= CCN_FACE_LINK;
+                face->flags &= ~CCN_FACE_GG;
+                register_new_face(h, face);
+            }
+            memset(d, 0, sizeof(*d));
+            while (d->index < size) {
+                dres = ccn_skeleton_decode(d, msg + d->index, size - d->index);
+                if (d->state != 0)
+                    abort(); /* cannot happen because of checks in caller */
+                /* The pdu_ok parameter limits the recursion depth */
+                process_input_message(h, face, msg + d->index - dres, dres, 0);
+            }
+            return;
+        case CCN_DTAG_Interest:
+            if ((h->workers != NULL || h->worker != NULL) &&
+                  input_elsewhere(h, face, dtag, msg, size)) {
+                ccnd_meter_bump(h, face->meter[FM_INTI], 1);
+                return;
+            }
+            process_incoming_interest(h, face, msg, size);
+            return;
+        case CCN_DTAG_ContentObject:
+            if ((h->workers != NULL || h->worker != NULL) &&
+                  input_elsewhere(h, face, dtag, msg, size)) {
+                ccnd_meter_bump(h, face->meter[FM_DATI], 1);
+                return;
+            }
+            process_incoming_content(h, face, msg, size);
+            return;
+        case CCN_DTAG_SequenceNumber:
+        case CCN_DTAG_LinkAck:
+        case CCN_DTAG_LinkFragment:
+            process_incoming_link_message(h, face, dtag, msg, size);
+            return;
+        default:
+            break;
+    }
+    ccnd_msg(h, "discarding unknown message; dtag=%u, size = %lu",
+             (unsigned)dtag,
+             (unsigned long)size);
+}
+
+/**
+ * Log a notification that a new datagram face has been created.
+ */
+static void
+ccnd_new_face_msg(struct ccnd_handle *h, struct face *face)
+{
+    const struct sockaddr *addr = face->addr;
+    int port = 0;
+    const unsigned char *rawaddr = NULL;
+    char printable[80];
+    const char *peer = NULL;
+    if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)addr;
+        rawaddr = (const unsigned char *)&addr6->sin6_addr;
+        port = htons(addr6->sin6_port);
+    }
+    else if (addr->sa_family == AF_INET) {
+        const struct sockaddr_in *addr4 = (struct sockaddr_in *)addr;
+        rawaddr = (const unsigned char *)&addr4->sin_addr.s_addr;
+        port = htons(addr4->sin_port);
+    }
+    if (rawaddr != NULL)
+        peer = inet_ntop(addr->sa_family, rawaddr, printable, sizeof(printable));
+    if (peer == NULL)
+        peer = "(unknown)";
+    ccnd_msg(h,
+             "accepted datagram client id=%d (flags=0x%x) %s port %d",
+             face->faceid, face->flags, peer, port);
+}
+
+/**
+ * Since struct sockaddr_in6 may contain fields that should not participate
+ * in comparison / hash, ensure the undesired fields are zero.
+ *
+ * Per RFC 3493, sin6_flowinfo is zeroed.
+ *
+ * @param addr is the sockaddr (any family)
+ * @param addrlen is its length
+ * @param space points to a buffer that may be used for the result.
+ * @returns either the original addr or a pointer to a scrubbed copy.
+ *
+ */
+static struct sockaddr *
+scrub_sockaddr(struct sockaddr *addr, socklen_t addrlen,
+               struct sockaddr_in6 *space)
+{
+    struct sockaddr_in6 *src;
+    struct sockaddr_in6 *dst;
+    if (addr->sa_family != AF_INET6 || addrlen != sizeof(*space))
+        return(addr);
+    dst = space;
+    src = (void *)addr;
+    memset(dst, 0, addrlen);
+    /* Copy first byte case sin6_len is used. */
+    ((uint8_t *)dst)[0] = ((uint8_t *)src)[0];
+    dst->sin6_family   = src->sin6_family;
+    dst->sin6_port     = src->sin6_port;
+    dst->sin6_addr     = src->sin6_addr;
+    dst->sin6_scope_id = src->sin6_scope_id;
+    return((struct sockaddr *)dst);
+}
+
+/**
+ * Get (or create) the face associated with a given sockaddr.
+ */
+static struct face *
+get_dgram_source(struct ccnd_handle *h, struct face *face,
+                 struct sockaddr *addr, socklen_t addrlen, int why)
+{
+    struct face *source = NULL;
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct sockaddr_in6 space;
+    int res;
+    if ((face->flags & CCN_FACE_DGRAM) == 0)
+        return(face);
+    if ((face->flags & CCN_FACE_MCAST) != 0)
+        return(face);
+    /* A worker receives only on sockets connected to their peers */
+    if (h->worker != NULL)
+        return(face);
+    hashtb_start(h->dgram_faces, e);
+    res = hashtb_seek(e, scrub_sockaddr(addr, addrlen, &space), addrlen, 0);
+    if (res >= 0) {
+        source = e->data;
+        source->recvcount++;
+        if (source->addr == NULL) {
+            source->addr = e->key;
+            source->addrlen = e->keysize;
+            source->recv_fd = face->recv_fd;
+            source->sendface = face->faceid;
+            init_face_flags(h, source, CCN_FACE_DGRAM);
+            if (why == 1 && (source->flags & CCN_FACE_LOOPBACK) != 0)
+                source->flags |= CCN_FACE_GG;
+            res = enroll_face(h, source);
+            if (res == -1) {
+                hashtb_delete(e);
+                source = NULL;
+            }
+            else
+                ccnd_new_face_msg(h, source);
+        }
+    }
+    hashtb_end(e);
+    return(source);
+}
+
+/**
+ * Break up data in a face's input buffer buffer into individual messages,
+ * and call process_input_message on each one.
+ *
+ * This is used to handle things originating from the internal client -
+ * its output is input for face 0.
+ */
+static void
+process_input_buffer(struct ccnd_handle *h, struct face *face)
+{
+    unsigned char *msg;
+    size_t size;
+    ssize_t dres;
+    struct ccn_skeleton_decoder *d;
+
+    if (face == NULL || face->inbuf == NULL)
+        return;
+    d = &face->decoder;
+    msg = face->inbuf->buf;
+    size = face->inbuf->length;
+    h->rx_buf = face->inbuf;
+    while (d->index < size) {
+        dres = ccn_skeleton_decode(d, msg + d->index, size - d->index);
+        if (d->state != 0)
+            break;
+        process_input_message(h, face, msg + d->index - dres, dres, 0);
+    }
+    if (d->index != size) {
+        ccnd_msg(h, "protocol error on face %u (state %d), discarding %d bytes",
+                     face->faceid, d->state, (int)(size - d->index));
+        // XXX - perhaps this should be a fatal error.
+    }
+    if (!rx_unshare(h, &face->inbuf, size))
+        face->inbuf->length = 0;
+    memset(d, 0, sizeof(*d));
+}
+
+/**
+ * Pass a datagram for a face to the worker that does its i/o.
+ */
+static void
+packet_raw(struct ccnd_handle *h, struct face *face,
+           unsigned char *buf, size_t size)
+{
+    struct ccnd_packet *p;
+    
+    if ((face->flags & CCN_FACE_NOSEND) != 0)
+        return;
+    p = ccnd_packet_create(CCND_PKT_RAW);
+    if (p == NULL)
+        return;
+    if (rx_hold(h, p, buf, size) < 0) {
+        ccnd_packet_release(p);
+        return;
+    }
+    p->faceid = face->faceid;
+    p->flags = face->flags;
+    ccnd_workers_post(h, face->owner, p);
+}
+
+/**
+ * Process one received datagram.
+ *
+ * Each datagram stands on its own, so no decoder state carries over
+ * from one to the next.
+ */
+static void
+process_input_dgram(struct ccnd_handle *h, struct face *face,
+                    unsigned char *buf, size_t size,
+                    struct sockaddr *addr, socklen_t addrlen)
+{
+    struct face *source = NULL;
+    struct ccn_skeleton_decoder decoder = {0};
+    struct ccn_skeleton_decoder *d = &decoder;
+    size_t msgstart;
+    int pdu_ok;
+    
+    source = get_dgram_source(h, face, addr, addrlen, (size == 1) ? 1 : 2);
+    if (source == NULL)
+        return;
+    if (source->owner != h->thread) {
+        /* Came in on the listener, not the face's own socket */
+        packet_raw(h, source, buf, size);
+        return;
+    }
+    ccnd_meter_bump(h, source->meter[FM_BYTI], size);
+    source->recvcount++;
+    source->surplus = 0; // XXX - we don't actually use this, except for some obscure messages.
+    if (size <= 1) {
+        // XXX - If the initial heartbeat gets missed, we don't realize the locality of the face.
+        if (h->debug & 128)
+            ccnd_msg(h, "%d-byte heartbeat on %d", (int)size, source->faceid);
+        return;
+    }
+    pdu_ok = ((face->flags & CCN_FACE_LOCAL) != 0);
+    msgstart = 0;
+    ccn_skeleton_decode(d, buf, size);
+    while (d->state == 0) {
+        process_input_message(h, source, buf + msgstart,
+                              d->index - msgstart, pdu_ok);
+        msgstart = d->index;
+        if (msgstart == size)
+            return;
+        ccn_skeleton_decode(d, buf + msgstart, size - msgstart);
+    }
+    ccnd_msg(h, "protocol error on face %u, discarding %u bytes",
+             source->faceid, (unsigned)(size - msgstart));
+    /* XXX - should probably ignore this source for a while */
+}
+
+#if defined(HAVE_RECVMMSG)
+/**
+ * Scratch space for receiving a batch of datagrams with recvmmsg.
+ */
+struct ccnd_dgram_rbatch {
+    struct mmsghdr msgs[CCND_DGRAM_BATCH_MAX];
+    struct iovec iov[CCND_DGRAM_BATCH_MAX];
+    struct sockaddr_storage addr[CCND_DGRAM_BATCH_MAX];
+    struct ccn_charbuf *buf[CCND_DGRAM_BATCH_MAX]; /**< one per datagram */
+};
+
+/**
+ * Drain up to h->dgram_batch datagrams from a socket with one system call.
+ */
+static void
+process_dgram_input_batch(struct ccnd_handle *h, struct face *face)
+{
+    struct ccnd_dgram_rbatch *b = h->dgram_rbatch;
+    unsigned faceid = face->faceid;
+    int i;
+    int n;
+    
+    if (b == NULL) {
+        b = calloc(1, sizeof(*b));
+        if (b == NULL)
+            return;
+        h->dgram_rbatch = b;
+    }
+    for (i = 0; i < h->dgram_batch; i++) {
+        /* A buffer left to packets by the last batch is replaced */
+        if (b->buf[i] == NULL)
+            b->buf[i] = ccn_charbuf_create();
+        if (b->buf[i] == NULL ||
+            ccn_charbuf_reserve(b->buf[i], CCND_DGRAM_BUFSIZE) == NULL)
+            break;
+        b->buf[i]->length = 0;
+        b->iov[i].iov_base = b->buf[i]->buf;
+        b->iov[i].iov_len = CCND_DGRAM_BUFSIZE;
+        memset(&b->msgs[i], 0, sizeof(b->msgs[i]));
+        b->msgs[i].msg_hdr.msg_name = &b->addr[i];
+        b->msgs[i].msg_hdr.msg_namelen = sizeof(b->addr[i]);
+        b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    if (i == 0)
+        return;
+    memset(b->addr, 0, i * sizeof(b->addr[0]));
+    n = recvmmsg(face->recv_fd, b->msgs, i, 0, NULL);
+    if (n == -1 && errno == ECONNREFUSED)
+        return;
+    if (n == -1) {
+        ccnd_msg(h, "recvmmsg face %u :%s (errno = %d)",
+                    face->faceid, strerror(errno), errno);
+        return;
+    }
+    h->dgram_recv_calls++;
+    h->dgram_recv_msgs += n;
+    for (i = 0; i < n; i++) {
+        /* Processing a message might have done away with the face */
+        if (face_from_faceid(h, faceid) != face)
+            break;
+        b->buf[i]->length = b->msgs[i].msg_len;
+        h->rx_buf = b->buf[i];
+        process_input_dgram(h, face, b->buf[i]->buf, b->msgs[i].msg_len,
+                            (struct sockaddr *)&b->addr[i],
+                            b->msgs[i].msg_hdr.msg_namelen);
+        rx_unshare(h, &b->buf[i], b->buf[i]->length);
+    }
+}
+#endif
+
+/**
+ * Process the input from a datagram socket.
+ */
+static void
+process_dgram_input(struct ccnd_handle *h, struct face *face)
+{
+    ssize_t res;
+    unsigned char *buf;
+    struct sockaddr_storage sstor;
+    socklen_t addrlen = sizeof(sstor);
+    struct sockaddr *addr = (struct sockaddr *)&sstor;
+    struct ccn_charbuf *c;
+    unsigned faceid = face->faceid;
+    
+#if defined(HAVE_RECVMMSG)
+    if (h->dgram_batch > 1) {
+        process_dgram_input_batch(h, face);
+        return;
+    }
+#endif
+    if (face->inbuf == NULL)
+        face->inbuf = ccn_charbuf_create();
+    face->inbuf->length = 0;
+    buf = ccn_charbuf_reserve(face->inbuf, CCND_DGRAM_BUFSIZE);
+    memset(&sstor, 0, sizeof(sstor));
+    res = recvfrom(face->recv_fd, buf, face->inbuf->limit - face->inbuf->length,
+            /* flags */ 0, addr, &addrlen);
+    if (res == -1 && errno == ECONNREFUSED)
+        return; /* see clear_socket_error() */
+    if (res == -1)
+        ccnd_msg(h, "recvfrom face %u :%s (errno = %d)",
+                    face->faceid, strerror(errno), errno);
+    else {
+        c = face->inbuf;
+        c->length = res;
+        h->rx_buf = c;
+        process_input_dgram(h, face, buf, res, addr, addrlen);
+        /* If it was left to packets, a new one is made next time */
+        if (rx_unshare(h, &c, res) && face_from_faceid(h, faceid) == face)
+            face->inbuf = c;
+    }
+}
+
+/**
+ * Process the input from a socket.
+ *
+ * The socket has been found ready for input by the poll call.
+ * Decide what face it corresponds to, and after checking for exceptional
+ * cases, receive data, parse it into ccnb-encoded messages, and call
+ * process_input_message for each one.
+ */
+static void
+process_input(struct ccnd_handle *h, struct face *face)
+{
+    ssize_t res;
+    ssize_t dres;
+    ssize_t msgstart;
+    unsigned char *buf;
+    struct ccn_skeleton_decoder *d;
+    struct sockaddr_storage sstor;
+    socklen_t addrlen = sizeof(sstor);
+    struct sockaddr *addr = (struct sockaddr *)&sstor;
+    int err = 0;
+    socklen_t err_sz;
+    int fd = face->recv_fd;
+    
+    if ((face->flags & (CCN_FACE_DGRAM | CCN_FACE_PASSIVE)) == CCN_FACE_PASSIVE) {
+        accept_connection(h, fd);
+        check_comm_file(h);
+        return;
+    }
+    err_sz = sizeof(err);
+    res = getsockopt(face->recv_fd, SOL_SOCKET, SO_ERROR, &err, &err_sz);
+    if (res >= 0 && err != 0 &&
+          !(err == ECONNREFUSED && (face->flags & CCN_FACE_DGRAM) != 0)) {
+        ccnd_msg(h, "error on face %u: %s (%d)", face->faceid, strerror(err), err);
+        if (err == ETIMEDOUT && (face->flags & CCN_FACE_CONNECTING) != 0) {
+            shutdown_client_fd(h, fd);
+            return;
+        }
+    }
+    if ((face->flags & CCN_FACE_DGRAM) != 0) {
+        process_dgram_input(h, face);
+        return;
+    }
+    d = &face->decoder;
+    if (face->inbuf == NULL)
         face->inbuf = ccn_charbuf_create();
     if (face->inbuf->length == 0)
         memset(d, 0, sizeof(*d));
@@ -4904,981 +8248,3420 @@ process_input(struct ccnd_handle *h, int fd)
     if (res == -1)
         ccnd_msg(h, "recvfrom face %u :%s (errno = %d)",
                     face->faceid, strerror(errno), errno);
-    else if (res == 0 && (face->flags & CCN_FACE_DGRAM) == 0)
+    else if (res == 0)
+        shutdown_client_fd(h, fd);
+    else {
+        ccnd_meter_bump(h, face->meter[FM_BYTI], res);
+        face->recvcount++;
+        face->surplus = 0; // XXX - we don't actually use this, except for some obscure messages.
+        face->inbuf->length += res;
+        msgstart = 0;
+        if (((face->flags & CCN_FACE_UNDECIDED) != 0 &&
+             face->inbuf->length >= 6 &&
+             0 == memcmp(face->inbuf->buf, "GET ", 4))) {
+            ccnd_stats_handle_http_connection(h, face);
+            return;
+        }
+        h->rx_buf = face->inbuf;
+        dres = ccn_skeleton_decode(d, buf, res);
+        while (d->state == 0) {
+            process_input_message(h, face,
+                                  face->inbuf->buf + msgstart,
+                                  d->index - msgstart,
+                                  (face->flags & CCN_FACE_LOCAL) != 0);
+            msgstart = d->index;
+            if (msgstart == face->inbuf->length) {
+                if (!rx_unshare(h, &face->inbuf, msgstart))
+                    face->inbuf->length = 0;
+                return;
+            }
+            dres = ccn_skeleton_decode(d,
+                    face->inbuf->buf + d->index, // XXX - msgstart and d->index are the same here - use msgstart
+                    res = face->inbuf->length - d->index);  // XXX - why is res set here?
+        }
+        if (d->state < 0) {
+            ccnd_msg(h, "protocol error on face %u", face->faceid);
+            rx_unshare(h, &face->inbuf, face->inbuf->length);
+            shutdown_client_fd(h, fd);
+            return;
+        }
+        /* A buffer left to packets comes back with just the partial message */
+        if (rx_unshare(h, &face->inbuf, msgstart))
+            d->index -= msgstart;
+        else if (msgstart < face->inbuf->length && msgstart > 0) {
+            /* move partial message to start of buffer */
+            memmove(face->inbuf->buf, face->inbuf->buf + msgstart,
+                face->inbuf->length - msgstart);
+            face->inbuf->length -= msgstart;
+            d->index -= msgstart;
+        }
+    }
+}
+
+/**
+ * Process messages from our internal client.
+ *
+ * The internal client's output is input to us.
+ */
+static void
+process_internal_client_buffer(struct ccnd_handle *h)
+{
+    struct face *face = h->face0;
+    if (face == NULL)
+        return;
+    face->inbuf = ccn_grab_buffered_output(h->internal_client);
+    if (face->inbuf == NULL)
+        return;
+    ccnd_meter_bump(h, face->meter[FM_BYTI], face->inbuf->length);
+    process_input_buffer(h, face);
+    ccn_charbuf_destroy(&(face->inbuf));
+}
+
+/**
+ * Scheduled event for deferred processing of internal client
+ */
+static int
+process_icb_action(
+    struct ccn_schedule *sched,
+    void *clienth,
+    struct ccn_scheduled_event *ev,
+    int flags)
+{
+    struct ccnd_handle *h = clienth;
+    
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0)
+        return(0);
+    process_internal_client_buffer(h);
+    return(0);
+}
+
+/**
+ * Schedule the processing of internal client results
+ *
+ * This little dance keeps us from destroying an interest
+ * entry while we are in the middle of processing it.
+ */
+void
+ccnd_internal_client_has_somthing_to_say(struct ccnd_handle *h)
+{
+    ccn_schedule_event(h->sched, 0, process_icb_action, NULL, 0);
+}
+
+/**
+ * Handle errors after send() or sendto().
+ * @returns -1 if error has been dealt with, or 0 to defer sending.
+ */
+static int
+handle_send_error(struct ccnd_handle *h, int errnum, struct face *face)
+{
+    int res = -1;
+    if (errnum == EAGAIN) {
+        face->drops++;
+        res = 0;
+    }
+    else if (errnum == EPIPE) {
+        face->flags |= CCN_FACE_NOSEND;
+        face_outq_clear(face);
+        ccnd_update_face_events(h, face);
+    }
+    else if (errnum == ECONNREFUSED) {
+        /* The peer of a connected datagram socket is not there just now */
+        face->drops++;
+    }
+    else {
+        ccnd_msg(h, "send to face %u failed: %s (errno = %d)",
+                 face->faceid, strerror(errnum), errnum);
+        if (errnum == EISCONN)
+            res = 0;
+    }
+    return(res);
+}
+
+/**
+ * Determine what socket to use to send on a face.
+ *
+ * For streams, this just returns the associated fd.
+ *
+ * For datagrams, one fd may be in use for many faces, so we need to find the
+ * right one to use.
+ *
+ * This is not as smart as it should be for situations where
+ * CCND_LISTEN_ON has been specified.
+ */
+static struct face *
+sending_face(struct ccnd_handle *h, struct face *face)
+{
+    struct face *out = NULL;
+    if (face->sendface == face->faceid)
+        return(face);
+    out = face_from_faceid(h, face->sendface);
+    if (out != NULL)
+        return(out);
+    face->sendface = CCN_NOFACEID;
+    if (face->addr != NULL) {
+        switch (face->addr->sa_family) {
+            case AF_INET:
+                face->sendface = h->ipv4_faceid;
+                break;
+            case AF_INET6:
+                face->sendface = h->ipv6_faceid;
+                break;
+            default:
+                break;
+        }
+    }
+    return(face_from_faceid(h, face->sendface));
+}
+
+static int
+sending_fd(struct ccnd_handle *h, struct face *face)
+{
+    struct face *out = sending_face(h, face);
+    if (out != NULL)
+        return(out->recv_fd);
+    return(-1);
+}
+
+/**
+ * Send a datagram, gathered from iovcnt pieces, to the face's address
+ * on the given socket.
+ *
+ * If permission is denied, try again with SO_BROADCAST, and remember
+ * whether that helped.
+ */
+static ssize_t
+sendto_face(struct ccnd_handle *h, struct face *face, int fd,
+            const struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+    ssize_t res;
+    int bcast = 0;
+    
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = (void *)face->addr;
+    msg.msg_namelen = face->addrlen;
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt;
+    if ((face->flags & CCN_FACE_BC) != 0) {
+        bcast = 1;
+        setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &bcast, sizeof(bcast));
+    }
+    res = sendmsg(fd, &msg, 0);
+    if (res == -1 && errno == EACCES &&
+        (face->flags & (CCN_FACE_BC | CCN_FACE_NBC)) == 0) {
+        bcast = 1;
+        setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &bcast, sizeof(bcast));
+        res = sendmsg(fd, &msg, 0);
+        if (res == -1)
+            face->flags |= CCN_FACE_NBC; /* did not work, do not try */
+        else
+            face->flags |= CCN_FACE_BC; /* remember for next time */
+    }
+    if (bcast != 0) {
+        bcast = 0;
+        setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &bcast, sizeof(bcast));
+    }
+    return(res);
+}
+
+#if defined(HAVE_RECVMMSG)
+/** Bytes in a queued datagram */
+static size_t
+dgram_pending_size(struct ccnd_dgram_pending *p)
+{
+    size_t size = 0;
+    int i;
+    
+    for (i = 0; i < p->npiece; i++)
+        size += p->piece[i].size;
+    return(size);
+}
+
+/**
+ * Find the queue for a face on a shared socket.
+ * @returns its index in q->flow, or -1 if it has nothing queued.
+ */
+static int
+dgram_sendq_flow(struct ccnd_dgram_sendq *q, unsigned faceid)
+{
+    int f;
+    
+    for (f = 0; f < q->nflow; f++)
+        if (q->flow[f].faceid == faceid)
+            return(f);
+    return(-1);
+}
+
+/**
+ * Make an empty queue for a face, at index f of q->flow.
+ */
+static struct ccnd_sendq_flow *
+dgram_sendq_flow_add(struct ccnd_dgram_sendq *q, int f, unsigned faceid)
+{
+    memmove(&q->flow[f + 1], &q->flow[f], (q->nflow - f) * sizeof(q->flow[0]));
+    q->nflow++;
+    q->flow[f].faceid = faceid;
+    q->flow[f].head = q->flow[f].tail = -1;
+    q->flow[f].n = 0;
+    q->flow[f].deficit = 0;
+    return(&q->flow[f]);
+}
+
+/**
+ * Drop the queue at index f of q->flow, which must be empty.
+ * Whatever deficit it had is forgotten, as round robin requires.
+ */
+static void
+dgram_sendq_flow_remove(struct ccnd_dgram_sendq *q, int f)
+{
+    q->nflow--;
+    memmove(&q->flow[f], &q->flow[f + 1], (q->nflow - f) * sizeof(q->flow[0]));
+    if (q->turn > f)
+        q->turn--;
+    else if (q->turn == f)
+        q->fresh = 1;
+}
+
+/**
+ * Return a slot of q->pending to the free list.
+ */
+static void
+dgram_sendq_release(struct ccnd_dgram_sendq *q, int slot)
+{
+    struct ccnd_dgram_pending *p = &q->pending[slot];
+    
+    if (p->content != NULL)
+        p->content->sendrefs--;
+    p->content = NULL;
+    p->next = q->free;
+    q->free = slot;
+}
+
+/**
+ * Choose up to max datagrams to send next, by deficit round robin.
+ *
+ * The chosen ones are taken off their queues, and their slots are
+ * stored in order.  Anything queued for a face that has gone away
+ * is discarded.
+ * @returns the number chosen.
+ */
+static int
+dgram_sendq_pick(struct ccnd_handle *h, struct ccnd_dgram_sendq *q,
+                 int *order, int max)
+{
+    struct ccnd_sendq_flow *f;
+    struct face *face;
+    size_t size;
+    int slot;
+    int k = 0;
+    
+    while (k < max && q->nflow > 0) {
+        if (q->turn >= q->nflow) {
+            q->turn = 0;
+            q->fresh = 1;
+        }
+        f = &q->flow[q->turn];
+        face = face_from_faceid(h, f->faceid);
+        slot = f->head;
+        if (face == NULL || q->pending[slot].npiece == 0) {
+            /* Nobody to send it to, or nothing left to send */
+            f->head = q->pending[slot].next;
+            dgram_sendq_release(q, slot);
+            q->n--;
+            if (face != NULL)
+                face->sendq_n--;
+            if (--(f->n) == 0)
+                dgram_sendq_flow_remove(q, q->turn);
+            continue;
+        }
+        if (q->fresh) {
+            f->deficit += CCND_SENDQ_QUANTUM;
+            q->fresh = 0;
+        }
+        size = dgram_pending_size(&q->pending[slot]);
+        if (size > f->deficit) {
+            q->turn++;
+            q->fresh = 1;
+            continue;
+        }
+        f->deficit -= size;
+        f->head = q->pending[slot].next;
+        order[k++] = slot;
+        q->n--;
+        face->sendq_n--;
+        if (--(f->n) == 0)
+            dgram_sendq_flow_remove(q, q->turn);
+    }
+    return(k);
+}
+
+/**
+ * Put datagrams that could not be sent back at the heads of their
+ * queues, in the same order, and give back the deficit they used.
+ */
+static void
+dgram_sendq_requeue(struct ccnd_handle *h, struct ccnd_dgram_sendq *q,
+                    const int *order, int n)
+{
+    struct ccnd_sendq_flow *f;
+    struct face *face;
+    int slot;
+    int i;
+    int k;
+    
+    for (i = n - 1; i >= 0; i--) {
+        slot = order[i];
+        k = dgram_sendq_flow(q, q->pending[slot].faceid);
+        if (k >= 0)
+            f = &q->flow[k];
+        else {
+            /* It was the last for its face, so let the face go first */
+            if (q->turn > q->nflow)
+                q->turn = q->nflow;
+            f = dgram_sendq_flow_add(q, q->turn, q->pending[slot].faceid);
+            f->tail = slot;
+            q->fresh = 0;
+        }
+        q->pending[slot].next = f->head;
+        f->head = slot;
+        f->n++;
+        f->deficit += dgram_pending_size(&q->pending[slot]);
+        q->n++;
+        face = face_from_faceid(h, q->pending[slot].faceid);
+        if (face != NULL)
+            face->sendq_n++;
+    }
+}
+
+/**
+ * Send the datagrams queued on a socket, using as few calls as possible.
+ *
+ * This goes on until the queues are empty or the socket buffer is full.
+ * In the latter case we ask for POLLOUT, and carry on when it comes.
+ * Bytes are metered for the datagrams actually sent; failures are
+ * handled per face, as for a direct send.
+ */
+static void
+dgram_sendq_flush(struct ccnd_handle *h, struct face *out)
+{
+    struct ccnd_dgram_sendq *q = out->sendq;
+    struct ccnd_dgram_pending *p;
+    struct mmsghdr msgs[CCND_DGRAM_BATCH_MAX];
+    struct iovec iov[CCND_DGRAM_BATCH_MAX * CCND_SENDV_MAX];
+    int order[CCND_DGRAM_BATCH_MAX];
+    struct iovec *v;
+    struct face *face;
+    ssize_t sent;
+    int blocked = 0;
+    int n;
+    int i;
+    int j;
+    int res;
+    
+    if (q == NULL)
+        return;
+    while (!blocked && q->n > 0) {
+        n = dgram_sendq_pick(h, q, order, h->dgram_batch);
+        if (n == 0)
+            break;
+        memset(msgs, 0, n * sizeof(msgs[0]));
+        for (v = iov, i = 0; i < n; i++) {
+            p = &q->pending[order[i]];
+            msgs[i].msg_hdr.msg_name = &p->addr;
+            msgs[i].msg_hdr.msg_namelen = p->addrlen;
+            msgs[i].msg_hdr.msg_iov = v;
+            msgs[i].msg_hdr.msg_iovlen = p->npiece;
+            for (j = 0; j < p->npiece; j++, v++) {
+                if (p->piece[j].ref != NULL)
+                    v->iov_base = (void *)p->piece[j].ref;
+                else
+                    v->iov_base = p->data->buf + p->piece[j].start;
+                v->iov_len = p->piece[j].size;
+            }
+        }
+        for (i = 0; i < n;) {
+            res = sendmmsg(out->recv_fd, msgs + i, n - i, 0);
+            if (res > 0) {
+                h->dgram_send_calls++;
+                h->dgram_send_msgs += res;
+                for (j = i + res; i < j; i++) {
+                    face = face_from_faceid(h, q->pending[order[i]].faceid);
+                    if (face != NULL)
+                        ccnd_meter_bump(h, face->meter[FM_BYTO],
+                                        msgs[i].msg_len);
+                }
+                continue;
+            }
+            if (res == 0 || errno == EAGAIN) {
+                blocked = 1;
+                break;
+            }
+            /* Datagram i could not be sent; deal with it and carry on. */
+            res = errno;
+            face = face_from_faceid(h, q->pending[order[i]].faceid);
+            if (face != NULL && (face->flags & CCN_FACE_NOSEND) == 0) {
+                sent = -1;
+                if (res == EACCES) {
+                    sent = sendto_face(h, face, out->recv_fd,
+                                       msgs[i].msg_hdr.msg_iov,
+                                       msgs[i].msg_hdr.msg_iovlen);
+                    res = errno;
+                }
+                if (sent > 0)
+                    ccnd_meter_bump(h, face->meter[FM_BYTO], sent);
+                else
+                    handle_send_error(h, res, face);
+            }
+            i++;
+        }
+        for (j = 0; j < i; j++)
+            dgram_sendq_release(q, order[j]);
+        if (i < n)
+            dgram_sendq_requeue(h, q, order + i, n - i);
+    }
+    if (blocked != q->blocked) {
+        q->blocked = blocked;
+        ccnd_update_face_events(h, out);
+    }
+}
+
+/**
+ * Queue a datagram for sending with sendmmsg before the next poll.
+ *
+ * Pieces that lie within the stored ContentObject content (if not NULL)
+ * are queued by reference; others are copied.  If the face already has
+ * as much waiting as it may, the datagram is dropped.
+ *
+ * @returns 0 if queued or dropped, -1 if the caller should send it directly.
+ */
+static int
+dgram_enqueue(struct ccnd_handle *h, struct face *face,
+              const struct iovec *iov, int iovcnt,
+              struct content_entry *content)
+{
+    struct face *out;
+    struct ccnd_dgram_sendq *q;
+    struct ccnd_dgram_pending *p;
+    struct ccnd_sendq_flow *f;
+    const unsigned char *base;
+    size_t len;
+    int slot;
+    int i;
+    int k;
+    
+    out = sending_face(h, face);
+    if (out == NULL || out->recv_fd == -1 ||
+          face->addrlen > sizeof(p->addr) || iovcnt > CCND_SENDV_MAX)
+        return(-1);
+    q = out->sendq;
+    if (q == NULL) {
+        q = calloc(1, sizeof(*q));
+        if (q == NULL)
+            return(-1);
+        for (i = 0; i < CCND_SENDQ_SLOTS; i++)
+            q->pending[i].next = i + 1;
+        q->pending[CCND_SENDQ_SLOTS - 1].next = -1;
+        q->fresh = 1;
+        out->sendq = q;
+    }
+    if (q->n >= h->dgram_batch && !q->blocked)
+        dgram_sendq_flush(h, out);
+    k = dgram_sendq_flow(q, face->faceid);
+    if (q->free < 0 || (k >= 0 && q->flow[k].n >= CCND_SENDQ_FACE_MAX)) {
+        handle_send_error(h, EAGAIN, face);
+        return(0);
+    }
+    if (q->n == 0 &&
+          ccn_indexbuf_append_element(h->dgram_flush, out->faceid) < 0)
+        return(-1); /* it would not be flushed, so send it now instead */
+    slot = q->free;
+    p = &q->pending[slot];
+    if (p->data == NULL && (p->data = ccn_charbuf_create()) == NULL)
+        return(-1);
+    p->data->length = 0;
+    for (i = 0; i < iovcnt; i++) {
+        base = iov[i].iov_base;
+        len = iov[i].iov_len;
+        p->piece[i].size = len;
+        if (content != NULL && base >= content->key &&
+              base + len <= content->key + content->size) {
+            p->piece[i].ref = base;
+            p->content = content;
+        }
+        else {
+            p->piece[i].ref = NULL;
+            p->piece[i].start = p->data->length;
+            if (ccn_charbuf_append(p->data, base, len) < 0) {
+                p->content = NULL;
+                return(-1);
+            }
+        }
+    }
+    if (p->content != NULL)
+        p->content->sendrefs++;
+    q->free = p->next;
+    p->next = -1;
+    p->npiece = iovcnt;
+    p->faceid = face->faceid;
+    p->addrlen = face->addrlen;
+    memcpy(&p->addr, face->addr, face->addrlen);
+    f = (k >= 0) ? &q->flow[k] : dgram_sendq_flow_add(q, q->nflow, face->faceid);
+    if (f->tail >= 0)
+        q->pending[f->tail].next = slot;
+    else
+        f->head = slot;
+    f->tail = slot;
+    f->n++;
+    q->n++;
+    face->sendq_n++;
+    return(0);
+}
+
+/**
+ * Stop the datagrams queued on a socket from referring to content,
+ * by copying what they need.  Any that cannot be copied are abandoned.
+ */
+static void
+dgram_sendq_unref(struct ccnd_dgram_sendq *q, struct content_entry *content)
+{
+    struct ccnd_dgram_pending *p;
+    int i;
+    int j;
+    
+    for (i = 0; i < CCND_SENDQ_SLOTS; i++) {
+        p = &q->pending[i];
+        if (p->content != content)
+            continue;
+        for (j = 0; j < p->npiece; j++) {
+            if (p->piece[j].ref == NULL)
+                continue;
+            p->piece[j].start = p->data->length;
+            if (ccn_charbuf_append(p->data, p->piece[j].ref,
+                                   p->piece[j].size) < 0) {
+                p->npiece = 0;
+                break;
+            }
+            p->piece[j].ref = NULL;
+        }
+        p->content = NULL;
+        content->sendrefs--;
+    }
+}
+#endif
+
+/**
+ * Send any datagrams that have been queued during this pass.
+ *
+ * A socket that is waiting for POLLOUT is left alone.
+ */
+static void
+flush_dgram_output(struct ccnd_handle *h)
+{
+#if defined(HAVE_RECVMMSG)
+    struct face *out;
+    int i;
+    
+    for (i = 0; i < h->dgram_flush->n; i++) {
+        out = face_from_faceid(h, h->dgram_flush->buf[i]);
+        if (out != NULL && out->sendq != NULL && !out->sendq->blocked)
+            dgram_sendq_flush(h, out);
+    }
+    h->dgram_flush->n = 0;
+#endif
+}
+
+/**
+ * Discard a datagram send queue.
+ */
+static void
+dgram_sendq_destroy(struct ccnd_dgram_sendq **pq)
+{
+    struct ccnd_dgram_sendq *q = *pq;
+    int i;
+    
+    if (q != NULL) {
+        for (i = 0; i < CCND_SENDQ_SLOTS; i++) {
+            if (q->pending[i].content != NULL)
+                q->pending[i].content->sendrefs--;
+            ccn_charbuf_destroy(&q->pending[i].data);
+        }
+        free(q);
+        *pq = NULL;
+    }
+}
+
+/**
+ * Make an output chunk holding a copy of some bytes, with room for more.
+ */
+static struct ccnd_outchunk *
+outchunk_copy(const unsigned char *data, size_t size, size_t room)
+{
+    struct ccnd_outchunk *chunk;
+    
+    chunk = malloc(sizeof(*chunk) + size + room);
+    if (chunk == NULL)
+        return(NULL);
+    chunk->next = NULL;
+    chunk->content = NULL;
+    chunk->data = (unsigned char *)(chunk + 1);
+    chunk->size = size;
+    chunk->room = room;
+    memcpy(chunk + 1, data, size);
+    return(chunk);
+}
+
+/**
+ * Free the first output chunk of a face.
+ */
+static void
+face_outq_pop(struct face *face)
+{
+    struct ccnd_outchunk *chunk = face->outq;
+    
+    face->outq = chunk->next;
+    if (face->outq == NULL)
+        face->outq_last = NULL;
+    face->outq_bytes -= chunk->size;
+    if (chunk->content != NULL)
+        chunk->content->sendrefs--;
+    free(chunk);
+}
+
+/**
+ * Discard a face's deferred output.
+ */
+static void
+face_outq_clear(struct face *face)
+{
+    while (face->outq != NULL)
+        face_outq_pop(face);
+}
+
+/**
+ * Add to the deferred output of a stream face.
+ *
+ * The first skip bytes of the pieces have already been sent.
+ * Pieces that lie within the stored ContentObject content (if not NULL)
+ * are queued by reference; others are copied, into the last chunk if
+ * there is room.
+ *
+ * Either all of the pieces are queued or, if memory runs out, none are,
+ * so that a failure does not break up the stream's framing.
+ *
+ * @returns 0 for success, -1 for error.
+ */
+static int
+face_outq_append(struct face *face, const struct iovec *iov, int iovcnt,
+                 struct content_entry *content, size_t skip)
+{
+    struct ccnd_outchunk *chunk;
+    struct ccnd_outchunk *head = NULL;
+    struct ccnd_outchunk *tail = face->outq_last;
+    struct ccnd_outchunk *last = face->outq_last;
+    size_t last_size = 0;
+    size_t last_room = 0;
+    size_t bytes = 0;
+    const unsigned char *base;
+    size_t len;
+    int i;
+    
+    if (last != NULL) {
+        last_size = last->size;
+        last_room = last->room;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        base = iov[i].iov_base;
+        len = iov[i].iov_len;
+        if (skip >= len) {
+            skip -= len;
+            continue;
+        }
+        base += skip;
+        len -= skip;
+        skip = 0;
+        if (content != NULL && base >= content->key &&
+              base + len <= content->key + content->size) {
+            chunk = malloc(sizeof(*chunk));
+            if (chunk == NULL)
+                goto Fail;
+            chunk->next = NULL;
+            chunk->content = content;
+            chunk->data = base;
+            chunk->size = len;
+            chunk->room = 0;
+            content->sendrefs++;
+        }
+        else {
+            chunk = tail;
+            if (chunk != NULL && chunk->content == NULL && chunk->room >= len) {
+                memcpy((unsigned char *)chunk->data + chunk->size, base, len);
+                chunk->size += len;
+                chunk->room -= len;
+                bytes += len;
+                continue;
+            }
+            chunk = outchunk_copy(base, len, (len < CCND_OUTCHUNK_MIN) ?
+                                  CCND_OUTCHUNK_MIN - len : 0);
+            if (chunk == NULL)
+                goto Fail;
+        }
+        /* New chunks are linked in only once all of them are made */
+        if (head == NULL)
+            head = chunk;
+        else
+            tail->next = chunk;
+        tail = chunk;
+        bytes += len;
+    }
+    if (head != NULL) {
+        if (face->outq == NULL)
+            face->outq = head;
+        else
+            face->outq_last->next = head;
+        face->outq_last = tail;
+    }
+    face->outq_bytes += bytes;
+    return(0);
+Fail:
+    while (head != NULL) {
+        chunk = head;
+        head = chunk->next;
+        if (chunk->content != NULL)
+            chunk->content->sendrefs--;
+        free(chunk);
+    }
+    if (last != NULL) {
+        last->size = last_size;
+        last->room = last_room;
+    }
+    return(-1);
+}
+
+#if defined(MSG_MORE)
+#define CCND_MSG_MORE MSG_MORE
+#else
+#define CCND_MSG_MORE 0
+#endif
+
+/**
+ * Write as much queued output as the stream will take.
+ *
+ * When the queue is too long for one call, MSG_MORE lets the kernel
+ * hold the earlier parts back until the rest arrives.
+ *
+ * @returns the number of bytes written, or -1 with errno set.
+ */
+static ssize_t
+face_outq_write(struct ccnd_handle *h, struct face *face)
+{
+    struct iovec iov[64];
+    struct msghdr msg;
+    struct ccnd_outchunk *chunk;
+    ssize_t res;
+    ssize_t total = 0;
+    size_t want;
+    size_t left;
+    int n;
+    
+    while (face->outq != NULL) {
+        want = 0;
+        for (n = 0, chunk = face->outq; chunk != NULL && n < 64;
+             chunk = chunk->next) {
+            iov[n].iov_base = (void *)chunk->data;
+            iov[n++].iov_len = chunk->size;
+            want += chunk->size;
+        }
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        res = sendmsg(face->recv_fd, &msg,
+                      (chunk != NULL) ? CCND_MSG_MORE : 0);
+        if (res <= 0)
+            return((total > 0) ? total : res);
+        ccnd_meter_bump(h, face->meter[FM_BYTO], res);
+        total += res;
+        for (left = res; left > 0;) {
+            chunk = face->outq;
+            if (left < chunk->size) {
+                chunk->data += left;
+                chunk->size -= left;
+                face->outq_bytes -= left;
+                break;
+            }
+            left -= chunk->size;
+            face_outq_pop(face);
+        }
+        if (res < want)
+            break;
+    }
+    return(total);
+}
+
+/**
+ * Restart any content queues of the face that were held back by
+ * a long output queue.
+ */
+static void
+face_outq_drained(struct ccnd_handle *h, struct face *face)
+{
+    struct content_queue *q;
+    int c;
+    
+    for (c = 0; c < CCN_CQ_N; c++) {
+        q = face->q[c];
+        if (q != NULL && q->sender == NULL && q->n > 0)
+            q->sender = ccn_schedule_event(h->sched, 1, content_sender,
+                                           q, face->faceid);
+    }
+}
+
+/**
+ * Write out what is queued on a stream face, and ask for POLLOUT if
+ * some of it has to wait.
+ *
+ * @returns -1 if the face has been shut down, else 0.
+ */
+static int
+face_outq_flush(struct ccnd_handle *h, struct face *face)
+{
+    size_t before = face->outq_bytes;
+    ssize_t res;
+    
+    res = face_outq_write(h, face);
+    if (res == -1 && errno != EAGAIN) {
+        if (errno != EPIPE) {
+            ccnd_msg(h, "send: %s (errno = %d)", strerror(errno), errno);
+            shutdown_client_fd(h, face->recv_fd);
+            return(-1);
+        }
+        face->flags |= CCN_FACE_NOSEND;
+        face_outq_clear(face);
+    }
+    if (before >= CCND_OUTQ_HIWAT / 2 && face->outq_bytes < CCND_OUTQ_HIWAT / 2)
+        face_outq_drained(h, face);
+    ccnd_update_face_events(h, face);
+    return(0);
+}
+
+/**
+ * Write the stream output gathered during this pass.
+ *
+ * Each face gets one sendmsg (more if it has many pieces queued),
+ * however many messages were sent to it.
+ */
+static void
+flush_stream_output(struct ccnd_handle *h)
+{
+    struct face *face;
+    int i;
+    
+    for (i = 0; i < h->stream_flush->n; i++) {
+        face = face_from_faceid(h, h->stream_flush->buf[i]);
+        if (face != NULL && face->outq != NULL &&
+              (face->flags & CCN_FACE_CONNECTING) == 0)
+            face_outq_flush(h, face);
+    }
+    h->stream_flush->n = 0;
+}
+
+/**
+ * A ContentObject is leaving the store while output still refers to it.
+ *
+ * Queued datagrams are sent now if they can be, and any output that
+ * is still waiting is changed to hold copies (or, failing that, stream
+ * output is dropped along with the face), so that no reference is left
+ * behind.
+ */
+static void
+content_unref_output(struct ccnd_handle *h, struct content_entry *content)
+{
+    struct ccnd_outchunk **pp;
+    struct ccnd_outchunk *chunk;
+    struct ccnd_outchunk *copy;
+    struct face *face;
+    unsigned i;
+    
+    flush_dgram_output(h);
+    for (i = 0; content->sendrefs > 0 && i < h->face_limit; i++) {
+        face = h->faces_by_faceid[i];
+        if (face == NULL)
+            continue;
+#if defined(HAVE_RECVMMSG)
+        if (face->sendq != NULL && face->sendq->n > 0)
+            dgram_sendq_unref(face->sendq, content);
+#endif
+        for (pp = &face->outq; (chunk = *pp) != NULL; pp = &chunk->next) {
+            if (chunk->content != content)
+                continue;
+            copy = outchunk_copy(chunk->data, chunk->size, 0);
+            if (copy == NULL) {
+                /* The stream cannot be kept intact, so give up on it */
+                ccnd_msg(h, "face %u output lost: %s",
+                         face->faceid, strerror(errno));
+                face->flags |= (CCN_FACE_NOSEND | CCN_FACE_CLOSING);
+                face_outq_clear(face);
+                ccnd_update_face_events(h, face);
+                break;
+            }
+            copy->next = chunk->next;
+            if (face->outq_last == chunk)
+                face->outq_last = copy;
+            *pp = copy;
+            content->sendrefs--;
+            free(chunk);
+            chunk = copy;
+        }
+    }
+}
+
+/**
+ * Send data to the face, gathered from iovcnt pieces.
+ *
+ * Stream output is collected on the face and written at the end of the
+ * pass by flush_stream_output(), or when the socket is ready if it has
+ * to wait.  Pieces that lie within the stored ContentObject content
+ * (if not NULL) are referred to rather than copied.
+ *
+ * No direct error result is provided; the face state is updated as needed.
+ */
+static void
+ccnd_sendv(struct ccnd_handle *h, struct face *face,
+           const struct iovec *iov, int iovcnt,
+           struct content_entry *content)
+{
+    struct ccn_charbuf *c;
+    ssize_t res;
+    size_t size = 0;
+    int fd;
+    int i;
+    
+    if ((face->flags & CCN_FACE_NOSEND) != 0)
+        return;
+    /* Only the thread that owns the socket writes to it */
+    if (face->owner != h->thread)
+        return;
+    face->surplus++;
+    for (i = 0; i < iovcnt; i++)
+        size += iov[i].iov_len;
+    if (face == h->face0) {
+        ccnd_meter_bump(h, face->meter[FM_BYTO], size);
+        if (iovcnt == 1)
+            ccn_dispatch_message(h->internal_client,
+                                 iov[0].iov_base, iov[0].iov_len);
+        else {
+            c = charbuf_obtain(h);
+            for (i = 0; i < iovcnt; i++)
+                ccn_charbuf_append(c, iov[i].iov_base, iov[i].iov_len);
+            ccn_dispatch_message(h->internal_client, c->buf, c->length);
+            charbuf_release(h, c);
+        }
+        ccnd_internal_client_has_somthing_to_say(h);
+        return;
+    }
+    if ((face->flags & CCN_FACE_DGRAM) == 0) {
+        if (face->outq == NULL && (face->flags & CCN_FACE_CONNECTING) == 0)
+            ccn_indexbuf_append_element(h->stream_flush, face->faceid);
+        if (face_outq_append(face, iov, iovcnt, content, 0) < 0)
+            ccnd_msg(h, "face %u: out of memory, dropped %u bytes of output",
+                     face->faceid, (unsigned)size);
+        return;
+    }
+#if defined(HAVE_RECVMMSG)
+    if (h->dgram_batch > 1 && (face->flags & CCN_FACE_BC) == 0 &&
+          dgram_enqueue(h, face, iov, iovcnt, content) == 0)
+        return;
+#endif
+    fd = sending_fd(h, face);
+    res = sendto_face(h, face, fd, iov, iovcnt);
+    if (res > 0)
+        ccnd_meter_bump(h, face->meter[FM_BYTO], res);
+    if (res == size)
+        return;
+    if (res == -1) {
+        res = handle_send_error(h, errno, face);
+        if (res == -1)
+            return;
+    }
+    ccnd_msg(h, "sendto short");
+}
+
+/**
+ * Send data to the face.
+ *
+ * No direct error result is provided; the face state is updated as needed.
+ */
+void
+ccnd_send(struct ccnd_handle *h,
+          struct face *face,
+          const void *data, size_t size)
+{
+    struct iovec iov;
+    
+    iov.iov_base = (void *)data;
+    iov.iov_len = size;
+    ccnd_sendv(h, face, &iov, 1, NULL);
+}
+
+/**
+ * Do deferred sends.
+ *
+ * These happen on streams, after there has been a partial write
+ * or while a connect is in progress, and on datagram sockets whose
+ * send queue filled the socket buffer.
+ */
+static void
+do_deferred_write(struct ccnd_handle *h, struct face *face)
+{
+    int fd = face->recv_fd;
+    
+#if defined(HAVE_RECVMMSG)
+    if (face->sendq != NULL && face->sendq->blocked) {
+        dgram_sendq_flush(h, face);
+        return;
+    }
+#endif
+    /* The rest only happens on connected sockets */
+    if (face->outq != NULL) {
+        if (face_outq_flush(h, face) < 0 || face->outq != NULL)
+            return;
+        if ((face->flags & (CCN_FACE_CLOSING | CCN_FACE_CONNECTING)) == 0)
+            return;
+    }
+    if ((face->flags & CCN_FACE_CLOSING) != 0)
         shutdown_client_fd(h, fd);
+    else if ((face->flags & CCN_FACE_CONNECTING) != 0) {
+        face->flags &= ~CCN_FACE_CONNECTING;
+        ccnd_update_face_events(h, face);
+        ccnd_face_status_change(h, face->faceid);
+    }
+    else {
+        ccnd_msg(h, "ccnd:do_deferred_write: something fishy on %d", fd);
+        ccnd_update_face_events(h, face);
+    }
+}
+
+/**
+ * Compute the poll(2) events that a face is waiting for.
+ */
+static int
+face_wanted_events(struct face *face)
+{
+    int events;
+    
+    events = ((face->flags & CCN_FACE_NORECV) == 0) ? POLLIN : 0;
+    if (face->outq != NULL ||
+          (face->flags & (CCN_FACE_CLOSING | CCN_FACE_CONNECTING)) != 0)
+        events |= POLLOUT;
+#if defined(HAVE_RECVMMSG)
+    if (face->sendq != NULL && face->sendq->blocked)
+        events |= POLLOUT;
+#endif
+    return(events);
+}
+
+#if defined(HAVE_EPOLL)
+/**
+ * Convert between poll(2) and epoll(7) event bits.
+ */
+static unsigned
+epoll_events_from_poll(int events)
+{
+    unsigned ans = 0;
+    
+    if ((events & POLLIN) != 0)
+        ans |= EPOLLIN;
+    if ((events & POLLOUT) != 0)
+        ans |= EPOLLOUT;
+    return(ans);
+}
+
+static int
+poll_events_from_epoll(unsigned events)
+{
+    int ans = 0;
+    
+    if ((events & EPOLLIN) != 0)
+        ans |= POLLIN;
+    if ((events & EPOLLOUT) != 0)
+        ans |= POLLOUT;
+    if ((events & EPOLLERR) != 0)
+        ans |= POLLERR;
+    if ((events & EPOLLHUP) != 0)
+        ans |= POLLHUP;
+    return(ans);
+}
+#endif
+
+/**
+ * Register the receive fd of a newly recorded face with epoll.
+ *
+ * The face pointer rides along with each readiness event, so the main loop
+ * need not look the fd up again.  No-op when we are using poll(2).
+ */
+static void
+register_face_fd(struct ccnd_handle *h, struct face *face)
+{
+#if defined(HAVE_EPOLL)
+    struct epoll_event ev;
+    
+    if (h->epfd == -1 || face->recv_fd == -1)
+        return;
+    memset(&ev, 0, sizeof(ev));
+    face->pollevents = face_wanted_events(face);
+    ev.events = epoll_events_from_poll(face->pollevents);
+    ev.data.ptr = face;
+    if (epoll_ctl(h->epfd, EPOLL_CTL_ADD, face->recv_fd, &ev) == -1) {
+        ccnd_msg(h, "epoll_ctl add fd=%d: %s (errno = %d)",
+                 face->recv_fd, strerror(errno), errno);
+        return;
+    }
+    face->pollreg = 1;
+#endif
+}
+
+/**
+ * Remove a face from epoll, before its fd gets closed.
+ *
+ * Any events for the face that have been collected but not yet
+ * dispatched are discarded, since the face is about to go away.
+ */
+static void
+unregister_face_fd(struct ccnd_handle *h, struct face *face)
+{
+#if defined(HAVE_EPOLL)
+    struct epoll_event ev;
+    int i;
+    
+    if (!face->pollreg)
+        return;
+    face->pollreg = 0;
+    memset(&ev, 0, sizeof(ev));
+    if (face->recv_fd != -1)
+        epoll_ctl(h->epfd, EPOLL_CTL_DEL, face->recv_fd, &ev);
+    for (i = 0; i < h->nready; i++)
+        if (h->events[i].data.ptr == face)
+            h->events[i].data.ptr = NULL;
+#endif
+}
+
+/**
+ * Bring the registered events for a face up to date.
+ *
+ * This must be called after anything that may change the result of
+ * face_wanted_events(), such as adding to or emptying face->outq.
+ * No-op when we are using poll(2), since that rebuilds its array each time.
+ */
+void
+ccnd_update_face_events(struct ccnd_handle *h, struct face *face)
+{
+#if defined(HAVE_EPOLL)
+    struct epoll_event ev;
+    int events;
+    
+    if (!face->pollreg)
+        return;
+    events = face_wanted_events(face);
+    if (events == face->pollevents)
+        return;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = epoll_events_from_poll(events);
+    ev.data.ptr = face;
+    if (epoll_ctl(h->epfd, EPOLL_CTL_MOD, face->recv_fd, &ev) == -1) {
+        ccnd_msg(h, "epoll_ctl mod fd=%d: %s (errno = %d)",
+                 face->recv_fd, strerror(errno), errno);
+        return;
+    }
+    face->pollevents = events;
+#endif
+}
+
+/**
+ * Take and discard the pending error of a socket.
+ */
+static void
+clear_socket_error(int fd)
+{
+    int err = 0;
+    socklen_t err_sz = sizeof(err);
+    
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_sz);
+}
+
+/**
+ * Handle the readiness events reported for a face.
+ */
+static void
+dispatch_face_events(struct ccnd_handle *h, struct face *face, int revents)
+{
+    unsigned faceid;
+    int dgram;
+    
+    if (revents & (POLLERR | POLLNVAL | POLLHUP)) {
+        if (revents & (POLLIN))
+            process_input(h, face);
+        else if ((face->flags & CCN_FACE_DGRAM) != 0 &&
+                 (revents & POLLNVAL) == 0)
+            /* A connected datagram socket heard that its peer is not there */
+            clear_socket_error(face->recv_fd);
+        else
+            shutdown_client_fd(h, face->recv_fd);
+        return;
+    }
+    if (revents & (POLLOUT)) {
+        /* A datagram socket may have input waiting as well */
+        dgram = ((face->flags & CCN_FACE_DGRAM) != 0);
+        faceid = face->faceid;
+        /* The write may shut down a stream face */
+        do_deferred_write(h, face);
+        if (!dgram || face_from_faceid(h, faceid) != face)
+            return;
+    }
+    if (revents & (POLLIN))
+        process_input(h, face);
+}
+
+/**
+ * Set up the array of fd descriptors for the poll(2) call.
+ *
+ * Arrange the array so that multicast receivers are early, so that
+ * if the same packet arrives on both a multicast socket and a
+ * normal socket, we will count is as multicast.  The stop pipe, which
+ * a signal handler writes to, follows the faces, and then the pipe
+ * that the workers write to (if there are none, its fd is -1, which
+ * poll ignores).
+ */
+static void
+prepare_poll_fds(struct ccnd_handle *h)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    int i, j, k;
+    if (h->fds == NULL || hashtb_n(h->faces_by_fd) != h->nfds) {
+        /* Two more, past the faces, for the stop and worker pipes */
+        h->nfds = hashtb_n(h->faces_by_fd);
+        h->fds = realloc(h->fds, (h->nfds + 2) * sizeof(h->fds[0]));
+        memset(h->fds, 0, (h->nfds + 2) * sizeof(h->fds[0]));
+    }
+    for (i = 0, k = h->nfds, hashtb_start(h->faces_by_fd, e);
+         i < k && e->data != NULL; hashtb_next(e)) {
+        struct face *face = e->data;
+        if (face->flags & CCN_FACE_MCAST)
+            j = i++;
+        else
+            j = --k;
+        /* A worker polls the faces it does the i/o of */
+        h->fds[j].fd = (face->owner == h->thread) ? face->recv_fd : -1;
+        h->fds[j].events = face_wanted_events(face);
+    }
+    hashtb_end(e);
+    if (i < k)
+        abort();
+    h->fds[h->nfds].fd = stop_pipe[0];
+    h->fds[h->nfds].events = POLLIN;
+    h->fds[h->nfds + 1].fd = ccnd_workers_fd(h);
+    h->fds[h->nfds + 1].events = POLLIN;
+}
+
+/**
+ * Wait for activity using poll(2), and handle it.
+ *
+ * @returns the number of ready fds, or -1 for an error.
+ */
+static int
+ccnd_poll_once(struct ccnd_handle *h, int timeout_ms)
+{
+    int i;
+    int res;
+    int ans;
+    
+    prepare_poll_fds(h);
+    if (0) ccnd_msg(h, "at ccnd.c:%d poll(h->fds, %d, %d)", __LINE__, h->nfds, timeout_ms);
+    res = poll(h->fds, h->nfds + 2, timeout_ms);
+    if (-1 == res && errno == EINTR)
+        return(-1);
+    if (-1 == res) {
+        ccnd_msg(h, "poll: %s (errno = %d)", strerror(errno), errno);
+        sleep(1);
+        return(-1);
+    }
+    if (res > 0) {
+        /* we need a fresh current time for setting interest expiries */
+        struct ccn_timeval dummy;
+        h->ticktock.gettime(&h->ticktock, &dummy);
+    }
+    for (i = 0, ans = res; res > 0 && i < h->nfds; i++) {
+        if (h->fds[i].revents != 0) {
+            struct face *face;
+            res--;
+            face = hashtb_lookup(h->faces_by_fd, &h->fds[i].fd, sizeof(h->fds[i].fd));
+            if (face != NULL)
+                dispatch_face_events(h, face, h->fds[i].revents);
+        }
+    }
+    return(ans);
+}
+
+#if defined(HAVE_EPOLL)
+/**
+ * Wait for activity using epoll(7), and handle it.
+ *
+ * The cost here is proportional to the number of ready fds, rather than
+ * to the total number of faces.  Level-triggered notification is used,
+ * since process_input() does only one read per wakeup.
+ *
+ * As with poll, multicast receivers are handled first.
+ *
+ * @returns the number of ready fds, or -1 for an error.
+ */
+static int
+ccnd_epoll_once(struct ccnd_handle *h, int timeout_ms)
+{
+    int i;
+    int res;
+    int pass;
+    
+    res = epoll_wait(h->epfd, h->events, h->nevents, timeout_ms);
+    if (-1 == res && errno == EINTR)
+        return(-1);
+    if (-1 == res) {
+        ccnd_msg(h, "epoll_wait: %s (errno = %d)", strerror(errno), errno);
+        sleep(1);
+        return(-1);
+    }
+    if (res > 0) {
+        /* we need a fresh current time for setting interest expiries */
+        struct ccn_timeval dummy;
+        h->ticktock.gettime(&h->ticktock, &dummy);
+    }
+    h->nready = res;
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < res; i++) {
+            struct face *face = h->events[i].data.ptr;
+            if (face == NULL)
+                continue;
+            if (((face->flags & CCN_FACE_MCAST) == 0) == (pass == 0))
+                continue;
+            h->events[i].data.ptr = NULL;
+            dispatch_face_events(h, face,
+                                 poll_events_from_epoll(h->events[i].events));
+        }
+    }
+    h->nready = 0;
+    return(res);
+}
+#endif
+
+/**
+ * Make a datagram socket of its own for a unicast face.
+ *
+ * It shares the local address of the socket the face has been using,
+ * and is connected to the peer, so that the kernel gives it what the
+ * peer sends from now on.
+ * @returns the fd, or -1.
+ */
+static int
+dgram_connect(struct ccnd_handle *h, struct face *face)
+{
+    struct face *out;
+    struct sockaddr_storage local;
+    socklen_t locallen = sizeof(local);
+    int yes = 1;
+    int fd;
+    
+    out = sending_face(h, face);
+    if (out == NULL || out->recv_fd == -1 || face->addr == NULL ||
+          getsockname(out->recv_fd, (struct sockaddr *)&local, &locallen) != 0)
+        return(-1);
+    fd = socket(face->addr->sa_family, SOCK_DGRAM, 0);
+    if (fd == -1)
+        return(-1);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+#ifdef IPV6_V6ONLY
+    if (face->addr->sa_family == AF_INET6) {
+        int v6only = 0;
+        socklen_t sz = sizeof(v6only);
+        getsockopt(out->recv_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, &sz);
+        if (v6only)
+            ccnd_setsockopt_v6only(h, fd);
+    }
+#endif
+    if (bind(fd, (struct sockaddr *)&local, locallen) != 0 ||
+          connect(fd, face->addr, face->addrlen) != 0 ||
+          fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+        ccnd_msg(h, "could not make a socket for face %u: %s (errno = %d)",
+                 face->faceid, strerror(errno), errno);
+        close(fd);
+        return(-1);
+    }
+    return(fd);
+}
+
+/**
+ * Hand over the i/o of a face to a worker.
+ *
+ * The link state starts afresh there; only the sequence number carries
+ * over.
+ * @returns 0, or -1 if the face stays with the main thread.
+ */
+static int
+face_hand_over(struct ccnd_handle *h, struct face *face)
+{
+    struct ccnd_packet *p;
+    int m;
+    
+    p = ccnd_packet_create(CCND_PKT_ADOPT);
+    if (p == NULL)
+        return(-1);
+    p->faceid = face->faceid;
+    p->flags = face->flags;
+    p->pktseq = face->pktseq;
+    if ((face->flags & CCN_FACE_DGRAM) != 0) {
+        p->buf = ccn_charbuf_create();
+        if (p->buf == NULL ||
+              ccn_charbuf_append(p->buf, face->addr, face->addrlen) < 0 ||
+              (p->fd = dgram_connect(h, face)) == -1) {
+            ccnd_packet_release(p);
+            return(-1);
+        }
+    }
+    else {
+        unregister_face_fd(h, face);
+        p->fd = face->recv_fd;
+        p->buf = face->inbuf;
+        face->inbuf = NULL;
+        p->decoder = face->decoder;
+    }
+    free(face->link);
+    face->link = NULL;
+    if (face->frags != NULL) {
+        for (m = 0; m < CCND_FRAG_SETS; m++)
+            ccn_charbuf_destroy(&face->frags[m].buf);
+        free(face->frags);
+        face->frags = NULL;
+    }
+    return(ccnd_workers_hand_over(h, face, p));
+}
+
+/**
+ * Hand over the i/o of the faces that have settled down to the workers.
+ *
+ * Listeners, multicast faces, and the internal client stay with the
+ * main thread, as does any face that cannot be handed over.
+ */
+static void
+hand_over_faces(struct ccnd_handle *h)
+{
+    struct ccn_indexbuf *c = h->handover;
+    struct face *face;
+    int i;
+    int n;
+    
+    for (i = 0, n = 0; i < c->n; i++) {
+        face = face_from_faceid(h, c->buf[i]);
+        if (face == NULL || face == h->face0 || face->owner != h->thread ||
+              (face->flags & (CCN_FACE_PASSIVE | CCN_FACE_MCAST |
+                              CCN_FACE_NORECV | CCN_FACE_NOSEND |
+                              CCN_FACE_CLOSING)) != 0)
+            continue;
+        if ((face->flags & (CCN_FACE_UNDECIDED | CCN_FACE_CONNECTING)) != 0 ||
+              face->outq != NULL) {
+            /* Not yet */
+            c->buf[n++] = c->buf[i];
+            continue;
+        }
+        if (face_hand_over(h, face) < 0)
+            ccnd_msg(h, "face %u stays with the main thread", face->faceid);
+    }
+    c->n = n;
+}
+
+/**
+ * Run the main loop of the ccnd
+ */
+void
+ccnd_run(struct ccnd_handle *h)
+{
+    int res;
+    int timeout_ms = -1;
+    int prev_timeout_ms = -1;
+    int usec;
+#if defined(HAVE_EPOLL)
+    struct epoll_event ev = {0};
+    
+    if (h->epfd != -1 && stop_pipe[0] != -1) {
+        /* data.ptr stays NULL, so this is not taken for a face */
+        ev.events = EPOLLIN;
+        epoll_ctl(h->epfd, EPOLL_CTL_ADD, stop_pipe[0], &ev);
+    }
+    if (h->epfd != -1 && ccnd_workers_fd(h) != -1) {
+        ev.events = EPOLLIN;
+        epoll_ctl(h->epfd, EPOLL_CTL_ADD, ccnd_workers_fd(h), &ev);
+    }
+#endif
+    for (h->running = 1; h->running;) {
+        process_internal_client_buffer(h);
+        usec = ccn_schedule_run(h->sched);
+        timeout_ms = (usec < 0) ? -1 : ((usec + 960) / 1000);
+        if (timeout_ms == 0 && prev_timeout_ms == 0)
+            timeout_ms = 1;
+        if (h->workers != NULL && ccnd_workers_collect(h))
+            timeout_ms = 0;
+        if (h->workers != NULL)
+            ccnd_transit_sweep(h, 0);
+        process_internal_client_buffer(h);
+        flush_stream_output(h);
+        flush_dgram_output(h);
+        if (h->workers != NULL)
+            hand_over_faces(h);
+        if (stop_signal != 0)
+            timeout_ms = 0;
+        if (h->workers != NULL && ccnd_workers_kick(h))
+            timeout_ms = 0;
+        /* A signal from here on still ends the wait, by way of stop_pipe */
+#if defined(HAVE_EPOLL)
+        if (h->epfd != -1)
+            res = ccnd_epoll_once(h, timeout_ms);
+        else
+#endif
+        res = ccnd_poll_once(h, timeout_ms);
+        prev_timeout_ms = ((res == 0) ? timeout_ms : 1);
+        if (stop_signal != 0) {
+            ccnd_msg(h, "stopping (signal %d)", (int)stop_signal);
+            h->running = 0;
+        }
+    }
+    if (h->cs_snapshot != NULL)
+        ccnd_snapshot_save(h);
+}
+
+/**
+ * Reseed our pseudo-random number generator.
+ */
+static void
+ccnd_reseed(struct ccnd_handle *h)
+{
+    int fd;
+    ssize_t res;
+    
+    res = -1;
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd != -1) {
+        res = read(fd, h->seed, sizeof(h->seed));
+        close(fd);
+    }
+    if (res != sizeof(h->seed)) {
+        h->seed[1] = (unsigned short)getpid(); /* better than no entropy */
+        h->seed[2] = (unsigned short)time(NULL);
+    }
+    /*
+     * The call to seed48 is needed by cygwin, and should be harmless
+     * on other platforms.
+     */
+    seed48(h->seed);
+}
+
+/**
+ * Get the name of our unix-domain socket listener.
+ *
+ * Uses the library to generate the name, using the environment.
+ * @returns a newly-allocated nul-terminated string.
+ */
+static char *
+ccnd_get_local_sockname(void)
+{
+    struct sockaddr_un sa;
+    ccn_setup_sockaddr_un(NULL, &sa);
+    return(strdup(sa.sun_path));
+}
+
+/**
+ * Get the time.
+ *
+ * This is used to supply the clock for our scheduled events.
+ */
+static void
+ccnd_gettime(const struct ccn_gettime *self, struct ccn_timeval *result)
+{
+    struct ccnd_handle *h = self->data;
+    struct timeval now = {0};
+    long int sdelta;
+    int udelta;
+    ccn_wrappedtime delta;
+    
+    gettimeofday(&now, 0);
+    result->s = now.tv_sec;
+    result->micros = now.tv_usec;
+    sdelta = now.tv_sec - h->sec;
+    udelta = now.tv_usec + h->sliver - h->usec;
+    h->sec = now.tv_sec;
+    h->usec = now.tv_usec;
+    while (udelta < 0) {
+        udelta += 1000000;
+        sdelta -= 1;
+    }
+    /* avoid letting time run backwards or taking huge steps */
+    if (sdelta < 0)
+        delta = 1;
+    else if (sdelta >= (1U << 30) / WTHZ)
+        delta = (1U << 30) / WTHZ;
     else {
-        source = get_dgram_source(h, face, addr, addrlen, (res == 1) ? 1 : 2);
-        ccnd_meter_bump(h, source->meter[FM_BYTI], res);
-        source->recvcount++;
-        source->surplus = 0; // XXX - we don't actually use this, except for some obscure messages.
-        if (res <= 1 && (source->flags & CCN_FACE_DGRAM) != 0) {
-            // XXX - If the initial heartbeat gets missed, we don't realize the locality of the face.
-            if (h->debug & 128)
-                ccnd_msg(h, "%d-byte heartbeat on %d", (int)res, source->faceid);
-            return;
-        }
-        face->inbuf->length += res;
-        msgstart = 0;
-        if (((face->flags & CCN_FACE_UNDECIDED) != 0 &&
-             face->inbuf->length >= 6 &&
-             0 == memcmp(face->inbuf->buf, "GET ", 4))) {
-            ccnd_stats_handle_http_connection(h, face);
-            return;
+        delta = (unsigned)udelta / (1000000U / WTHZ);
+        h->sliver = udelta - delta * (1000000U / WTHZ);
+        delta += (unsigned)sdelta * WTHZ;
+    }
+    h->wtnow += delta;
+}
+
+/**
+ * A microsecond clock for measuring response times.
+ *
+ * The cached time may be as old as the last poll, so this reads the
+ * clock afresh.  Only differences of these values are meaningful.
+ */
+static unsigned
+ccnd_usec_clock(struct ccnd_handle *h)
+{
+    struct timeval now = {0};
+    (void)h;
+    
+    gettimeofday(&now, 0);
+    return((unsigned)now.tv_sec * 1000000U + now.tv_usec);
+}
+
+/**
+ * Set IPV6_V6ONLY on a socket.
+ *
+ * The handle is used for error reporting.
+ */
+void
+ccnd_setsockopt_v6only(struct ccnd_handle *h, int fd)
+{
+    int yes = 1;
+    int res = 0;
+#ifdef IPV6_V6ONLY
+    res = setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &yes, sizeof(yes));
+#endif
+    if (res == -1)
+        ccnd_msg(h, "warning - could not set IPV6_V6ONLY on fd %d: %s",
+                 fd, strerror(errno));
+}
+
+/**
+ * Translate an address family constant to a string.
+ */
+static const char *
+af_name(int family)
+{
+    switch (family) {
+        case AF_INET:
+            return("ipv4");
+        case AF_INET6:
+            return("ipv6");
+        default:
+            return("");
+    }
+}
+
+/**
+ * Create the standard ipv4 and ipv6 bound ports.
+ */
+static int
+ccnd_listen_on_wildcards(struct ccnd_handle *h)
+{
+    int fd;
+    int res;
+    int whichpf;
+    struct addrinfo hints = {0};
+    struct addrinfo *addrinfo = NULL;
+    struct addrinfo *a;
+    
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+    for (whichpf = 0; whichpf < 2; whichpf++) {
+        hints.ai_family = whichpf ? PF_INET6 : PF_INET;
+        res = getaddrinfo(NULL, h->portstr, &hints, &addrinfo);
+        if (res == 0) {
+            for (a = addrinfo; a != NULL; a = a->ai_next) {
+                fd = socket(a->ai_family, SOCK_DGRAM, 0);
+                if (fd != -1) {
+                    struct face *face = NULL;
+                    int yes = 1;
+                    int rcvbuf = 0;
+                    socklen_t rcvbuf_sz;
+                    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+                    rcvbuf_sz = sizeof(rcvbuf);
+                    getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &rcvbuf_sz);
+                    if (a->ai_family == AF_INET6)
+                        ccnd_setsockopt_v6only(h, fd);
+                    res = bind(fd, a->ai_addr, a->ai_addrlen);
+                    if (res != 0) {
+                        close(fd);
+                        continue;
+                    }
+                    face = record_connection(h, fd,
+                                             a->ai_addr, a->ai_addrlen,
+                                             CCN_FACE_DGRAM | CCN_FACE_PASSIVE);
+                    if (face == NULL) {
+                        close(fd);
+                        continue;
+                    }
+                    if (a->ai_family == AF_INET)
+                        h->ipv4_faceid = face->faceid;
+                    else
+                        h->ipv6_faceid = face->faceid;
+                    ccnd_msg(h, "accepting %s datagrams on fd %d rcvbuf %d",
+                             af_name(a->ai_family), fd, rcvbuf);
+                }
+            }
+            for (a = addrinfo; a != NULL; a = a->ai_next) {
+                fd = socket(a->ai_family, SOCK_STREAM, 0);
+                if (fd != -1) {
+                    int yes = 1;
+                    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+                    if (a->ai_family == AF_INET6)
+                        ccnd_setsockopt_v6only(h, fd);
+                    res = bind(fd, a->ai_addr, a->ai_addrlen);
+                    if (res != 0) {
+                        close(fd);
+                        continue;
+                    }
+                    res = listen(fd, 30);
+                    if (res == -1) {
+                        close(fd);
+                        continue;
+                    }
+                    record_connection(h, fd,
+                                      a->ai_addr, a->ai_addrlen,
+                                      CCN_FACE_PASSIVE);
+                    ccnd_msg(h, "accepting %s connections on fd %d",
+                             af_name(a->ai_family), fd);
+                }
+            }
+            freeaddrinfo(addrinfo);
         }
-        dres = ccn_skeleton_decode(d, buf, res);
-        while (d->state == 0) {
-            process_input_message(h, source,
-                                  face->inbuf->buf + msgstart,
-                                  d->index - msgstart,
-                                  (face->flags & CCN_FACE_LOCAL) != 0);
-            msgstart = d->index;
-            if (msgstart == face->inbuf->length) {
-                face->inbuf->length = 0;
-                return;
+    }
+    return(0);
+}
+
+/**
+ * Create a tcp listener and a bound udp socket on the given address
+ */
+static int
+ccnd_listen_on_address(struct ccnd_handle *h, const char *addr)
+{
+    int fd;
+    int res;
+    struct addrinfo hints = {0};
+    struct addrinfo *addrinfo = NULL;
+    struct addrinfo *a;
+    int ok = 0;
+    
+    ccnd_msg(h, "listen_on %s", addr);
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+    res = getaddrinfo(addr, h->portstr, &hints, &addrinfo);
+    if (res == 0) {
+        for (a = addrinfo; a != NULL; a = a->ai_next) {
+            fd = socket(a->ai_family, SOCK_DGRAM, 0);
+            if (fd != -1) {
+                struct face *face = NULL;
+                int yes = 1;
+                int rcvbuf = 0;
+                socklen_t rcvbuf_sz;
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+                rcvbuf_sz = sizeof(rcvbuf);
+                getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &rcvbuf_sz);
+                if (a->ai_family == AF_INET6)
+                    ccnd_setsockopt_v6only(h, fd);
+                res = bind(fd, a->ai_addr, a->ai_addrlen);
+                if (res != 0) {
+                    close(fd);
+                    continue;
+                }
+                face = record_connection(h, fd,
+                                         a->ai_addr, a->ai_addrlen,
+                                         CCN_FACE_DGRAM | CCN_FACE_PASSIVE);
+                if (face == NULL) {
+                    close(fd);
+                    continue;
+                }
+                if (a->ai_family == AF_INET)
+                    h->ipv4_faceid = face->faceid;
+                else
+                    h->ipv6_faceid = face->faceid;
+                ccnd_msg(h, "accepting %s datagrams on fd %d rcvbuf %d",
+                             af_name(a->ai_family), fd, rcvbuf);
+                ok++;
             }
-            dres = ccn_skeleton_decode(d,
-                    face->inbuf->buf + d->index, // XXX - msgstart and d->index are the same here - use msgstart
-                    res = face->inbuf->length - d->index);  // XXX - why is res set here?
         }
-        if ((face->flags & CCN_FACE_DGRAM) != 0) {
-            ccnd_msg(h, "protocol error on face %u, discarding %u bytes",
-                source->faceid,
-                (unsigned)(face->inbuf->length));  // XXX - Should be face->inbuf->length - d->index (or msgstart)
-            face->inbuf->length = 0;
-            /* XXX - should probably ignore this source for a while */
-            return;
+        for (a = addrinfo; a != NULL; a = a->ai_next) {
+            fd = socket(a->ai_family, SOCK_STREAM, 0);
+            if (fd != -1) {
+                int yes = 1;
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+                if (a->ai_family == AF_INET6)
+                    ccnd_setsockopt_v6only(h, fd);
+                res = bind(fd, a->ai_addr, a->ai_addrlen);
+                if (res != 0) {
+                    close(fd);
+                    continue;
+                }
+                res = listen(fd, 30);
+                if (res == -1) {
+                    close(fd);
+                    continue;
+                }
+                record_connection(h, fd,
+                                  a->ai_addr, a->ai_addrlen,
+                                  CCN_FACE_PASSIVE);
+                ccnd_msg(h, "accepting %s connections on fd %d",
+                         af_name(a->ai_family), fd);
+                ok++;
+            }
         }
-        else if (d->state < 0) {
-            ccnd_msg(h, "protocol error on face %u", source->faceid);
-            shutdown_client_fd(h, fd);
-            return;
+        freeaddrinfo(addrinfo);
+    }
+    return(ok > 0 ? 0 : -1);
+}
+
+/**
+ * Create listeners or bound udp ports using the given addresses
+ *
+ * The addresses may be separated by whitespace, commas, or semicolons.
+ */
+static int
+ccnd_listen_on(struct ccnd_handle *h, const char *addrs)
+{
+    unsigned char ch;
+    unsigned char dlm;
+    int res = 0;
+    int i;
+    struct ccn_charbuf *addr = NULL;
+    
+    if (addrs == NULL || !*addrs || 0 == strcmp(addrs, "*"))
+        return(ccnd_listen_on_wildcards(h));
+    addr = ccn_charbuf_create();
+    for (i = 0, ch = addrs[i]; addrs[i] != 0;) {
+        addr->length = 0;
+        dlm = 0;
+        if (ch == '[') {
+            dlm = ']';
+            ch = addrs[++i];
         }
-        if (msgstart < face->inbuf->length && msgstart > 0) {
-            /* move partial message to start of buffer */
-            memmove(face->inbuf->buf, face->inbuf->buf + msgstart,
-                face->inbuf->length - msgstart);
-            face->inbuf->length -= msgstart;
-            d->index -= msgstart;
+        for (; ch > ' ' && ch != ',' && ch != ';' && ch != dlm; ch = addrs[++i])
+            ccn_charbuf_append_value(addr, ch, 1);
+        if (ch && ch == dlm)
+            ch = addrs[++i];
+        if (addr->length > 0) {
+            res |= ccnd_listen_on_address(h, ccn_charbuf_as_string(addr));
         }
+        while ((0 < ch && ch <= ' ') || ch == ',' || ch == ';')
+            ch = addrs[++i];
     }
+    ccn_charbuf_destroy(&addr);
+    return(res);
 }
 
 /**
- * Process messages from our internal client.
+ * Parse a list of ccnx URIs
  *
- * The internal client's output is input to us.
+ * The URIs may be separated by whitespace, commas, or semicolons.
+ *
+ * Errors are logged.
+ *
+ * @returns a newly-allocated charbuf containing nul-terminated URIs; or
+ *          NULL if no valid URIs are found.
  */
-static void
-process_internal_client_buffer(struct ccnd_handle *h)
+static struct ccn_charbuf *
+ccnd_parse_uri_list(struct ccnd_handle *h, const char *what, const char *uris)
 {
-    struct face *face = h->face0;
-    if (face == NULL)
-        return;
-    face->inbuf = ccn_grab_buffered_output(h->internal_client);
-    if (face->inbuf == NULL)
-        return;
-    ccnd_meter_bump(h, face->meter[FM_BYTI], face->inbuf->length);
-    process_input_buffer(h, face);
-    ccn_charbuf_destroy(&(face->inbuf));
-}
+    struct ccn_charbuf *ans;
+    struct ccn_charbuf *name;
+    int i;
+    size_t j;
+    int res;
+    unsigned char ch;
+    const char *uri;
 
-/**
- * Scheduled event for deferred processing of internal client
- */
-static int
-process_icb_action(
-    struct ccn_schedule *sched,
-    void *clienth,
-    struct ccn_scheduled_event *ev,
-    int flags)
-{
-    struct ccnd_handle *h = clienth;
-    
-    if ((flags & CCN_SCHEDULE_CANCEL) != 0)
-        return(0);
-    process_internal_client_buffer(h);
-    return(0);
+    if (uris == NULL)
+        return(NULL);
+    ans = ccn_charbuf_create();
+    name = ccn_charbuf_create();
+    for (i = 0, ch = uris[0]; ch != 0;) {
+        while ((0 < ch && ch <= ' ') || ch == ',' || ch == ';')
+            ch = uris[++i];
+        j = ans->length;
+        while (ch > ' ' && ch != ',' && ch != ';') {
+            ccn_charbuf_append_value(ans, ch, 1);
+            ch = uris[++i];
+        }
+        if (j < ans->length) {
+            ccn_charbuf_append_value(ans, 0, 1);
+            uri = (const char *)ans->buf + j;
+            name->length = 0;
+            res = ccn_name_from_uri(name, uri);
+            if (res < 0) {
+                ccnd_msg(h, "%s: invalid ccnx URI: %s", what, uri);
+                ans->length = j;
+            }
+        }
+    }
+    ccn_charbuf_destroy(&name);
+    if (ans->length == 0)
+        ccn_charbuf_destroy(&ans);
+    return(ans);
 }
 
 /**
- * Schedule the processing of internal client results
+ * Create the tables and the scheduler of a new handle.
  *
- * This little dance keeps us from destroying an interest
- * entry while we are in the middle of processing it.
+ * This is the part of the setup that a worker's shard shares with
+ * the main handle.
  */
-void
-ccnd_internal_client_has_somthing_to_say(struct ccnd_handle *h)
+static void
+ccnd_init_tables(struct ccnd_handle *h)
 {
-    ccn_schedule_event(h->sched, 0, process_icb_action, NULL, 0);
+    struct hashtb_param param = {0};
+    
+    h->content_trie = calloc(1, sizeof(*h->content_trie));
+    param.finalize_data = h;
+    h->face_limit = 1024; /* soft limit */
+    h->faces_by_faceid = calloc(h->face_limit, sizeof(h->faces_by_faceid[0]));
+    param.finalize = &finalize_face;
+    h->faces_by_fd = hashtb_create(sizeof(struct face), &param);
+    h->dgram_faces = hashtb_create(sizeof(struct face), &param);
+    param.finalize = 0;
+    h->faceid_by_guid = hashtb_create(sizeof(unsigned), &param);
+    /* The big, busy tables use open addressing and pooled entries */
+    param.flags = HASHTB_OPEN | HASHTB_POOLED;
+    param.finalize = &finalize_content;
+    h->content_tab = hashtb_create(sizeof(struct content_entry), &param);
+    param.finalize = &finalize_nameprefix;
+    h->nameprefix_tab = hashtb_create(sizeof(struct nameprefix_entry), &param);
+    param.finalize = &finalize_interest;
+    h->interest_tab = hashtb_create(sizeof(struct interest_entry), &param);
+    param.flags = 0;
+    param.finalize = &finalize_guest;
+    h->guest_tab = hashtb_create(sizeof(struct guest_entry), &param);
+    param.finalize = 0;
+    h->sparse_straggler_tab = hashtb_create(sizeof(struct sparse_straggler_entry), NULL);
+    h->send_interest_scratch = ccn_charbuf_create();
+    h->dgram_flush = ccn_indexbuf_create();
+    h->stream_flush = ccn_indexbuf_create();
+    h->handover = ccn_indexbuf_create();
+    h->io_faces = ccn_indexbuf_create();
+    h->ticktock.descr[0] = 'C';
+    h->ticktock.micros_per_base = 1000000;
+    h->ticktock.gettime = &ccnd_gettime;
+    h->ticktock.data = h;
+    h->sched = ccn_schedule_create_wheel(h, &h->ticktock);
+    h->pfi_pool = ccn_pool_create(sizeof(struct pit_face_item));
+    h->starttime = h->sec;
+    h->starttime_usec = h->usec;
+    h->wtnow = 0xFFFF0000; /* provoke a rollover early on */
+    h->oldformatcontentgrumble = 1;
+    h->oldformatinterestgrumble = 1;
 }
 
 /**
- * Handle errors after send() or sendto().
- * @returns -1 if error has been dealt with, or 0 to defer sending.
+ * Start a new ccnd instance
+ * @param progname - name of program binary, used for locating helpers
+ * @param logger - logger function
+ * @param loggerdata - data to pass to logger function
  */
-static int
-handle_send_error(struct ccnd_handle *h, int errnum, struct face *face,
-                  const void *data, size_t size)
+struct ccnd_handle *
+ccnd_create(const char *progname, ccnd_logger logger, void *loggerdata)
 {
-    int res = -1;
-    if (errnum == EAGAIN) {
-        res = 0;
+    char *sockname;
+    const char *portstr;
+    const char *debugstr;
+    const char *entrylimit;
+    const char *mtu;
+    const char *data_pause;
+    const char *dgram_batch;
+    const char *data_burst;
+    const char *link_reliable;
+    const char *tts_default;
+    const char *tts_limit;
+    const char *autoreg;
+    const char *listen_on;
+    const char *cs_snapshot;
+    const char *workers;
+    int nworkers = 0;
+    int fd;
+    struct ccnd_handle *h;
+    
+    sockname = ccnd_get_local_sockname();
+    h = calloc(1, sizeof(*h));
+    if (h == NULL)
+        return(h);
+    h->logger = logger;
+    h->loggerdata = loggerdata;
+    h->noncegen = &ccnd_plain_nonce;
+    h->logpid = (int)getpid();
+    h->progname = progname;
+    h->debug = -1;
+    ccnd_init_tables(h);
+    h->epfd = -1;
+#if defined(HAVE_EPOLL)
+    h->nevents = 256;
+    h->events = calloc(h->nevents, sizeof(h->events[0]));
+    if (h->events != NULL)
+        h->epfd = epoll_create(h->nevents);
+    if (h->epfd == -1)
+        ccnd_msg(h, "epoll_create: %s (errno = %d) - using poll",
+                 strerror(errno), errno);
+#endif
+    debugstr = getenv("CCND_DEBUG");
+    if (debugstr != NULL && debugstr[0] != 0) {
+        h->debug = atoi(debugstr);
+        if (h->debug == 0 && debugstr[0] != '0')
+            h->debug = 1;
     }
-    else if (errnum == EPIPE) {
-        face->flags |= CCN_FACE_NOSEND;
-        face->outbufindex = 0;
-        ccn_charbuf_destroy(&face->outbuf);
+    else
+        h->debug = 1;
+    portstr = getenv(CCN_LOCAL_PORT_ENVNAME);
+    if (portstr == NULL || portstr[0] == 0 || strlen(portstr) > 10)
+        portstr = CCN_DEFAULT_UNICAST_PORT;
+    h->portstr = portstr;
+    entrylimit = getenv("CCND_CAP");
+    h->capacity = ~0;
+    if (entrylimit != NULL && entrylimit[0] != 0) {
+        h->capacity = atol(entrylimit);
+        if (h->capacity == 0)
+            h->force_zero_freshness = 1;
+        if (h->capacity <= 0)
+            h->capacity = 10;
     }
-    else {
-        ccnd_msg(h, "send to face %u failed: %s (errno = %d)",
-                 face->faceid, strerror(errnum), errnum);
-        if (errnum == EISCONN)
-            res = 0;
+    ccnd_msg(h, "CCND_DEBUG=%d CCND_CAP=%lu", h->debug, h->capacity);
+    h->cs_bytes_limit = ~0;
+    entrylimit = getenv("CCND_CS_BYTES");
+    if (entrylimit != NULL && entrylimit[0] != 0) {
+        h->cs_bytes_limit = strtoul(entrylimit, NULL, 10);
+        if (h->cs_bytes_limit == 0)
+            h->cs_bytes_limit = ~0;
+        else
+            ccnd_msg(h, "CCND_CS_BYTES=%lu", h->cs_bytes_limit);
+    }
+    h->mtu = 0;
+    mtu = getenv("CCND_MTU");
+    if (mtu != NULL && mtu[0] != 0) {
+        h->mtu = atol(mtu);
+        if (h->mtu < 0)
+            h->mtu = 0;
+        if (h->mtu > 8800)
+            h->mtu = 8800;
+    }
+    h->dgram_batch = 1;
+#if defined(HAVE_RECVMMSG)
+    h->dgram_batch = CCND_DGRAM_BATCH_DEFAULT;
+    dgram_batch = getenv("CCND_DGRAM_BATCH");
+    if (dgram_batch != NULL && dgram_batch[0] != 0) {
+        h->dgram_batch = atoi(dgram_batch);
+        if (h->dgram_batch < 1)
+            h->dgram_batch = 1;
+        if (h->dgram_batch > CCND_DGRAM_BATCH_MAX)
+            h->dgram_batch = CCND_DGRAM_BATCH_MAX;
+        ccnd_msg(h, "CCND_DGRAM_BATCH=%d", h->dgram_batch);
+    }
+#endif
+    h->data_pause_microsec = 10000;
+    data_pause = getenv("CCND_DATA_PAUSE_MICROSEC");
+    if (data_pause != NULL && data_pause[0] != 0) {
+        h->data_pause_microsec = atol(data_pause);
+        if (h->data_pause_microsec == 0)
+            h->data_pause_microsec = 1;
+        if (h->data_pause_microsec > 1000000)
+            h->data_pause_microsec = 1000000;
+    }
+    h->data_burst = CCND_DATA_BURST_DEFAULT;
+    data_burst = getenv("CCND_DATA_BURST");
+    if (data_burst != NULL && data_burst[0] != 0) {
+        h->data_burst = atoi(data_burst);
+        if (h->data_burst < 1)
+            h->data_burst = 1;
+        if (h->data_burst > CCND_DATA_BURST_MAX)
+            h->data_burst = CCND_DATA_BURST_MAX;
+        ccnd_msg(h, "CCND_DATA_BURST=%d", h->data_burst);
+    }
+    link_reliable = getenv("CCND_LINK_RELIABLE");
+    if (link_reliable != NULL && link_reliable[0] != 0) {
+        h->link_reliable = (atoi(link_reliable) != 0);
+        ccnd_msg(h, "CCND_LINK_RELIABLE=%d", h->link_reliable);
+    }
+    h->tts_default = -1;
+    tts_default = getenv("CCND_DEFAULT_TIME_TO_STALE");
+    if (tts_default != NULL && tts_default[0] != 0) {
+        h->tts_default = atoi(tts_default);
+        if (h->tts_default <= 0)
+            h->tts_default = -1;
+        ccnd_msg(h, "CCND_DEFAULT_TIME_TO_STALE=%d", h->tts_default);
+    }
+    h->tts_limit = ~0U;
+    tts_limit = getenv("CCND_MAX_TIME_TO_STALE");
+    if (tts_limit != NULL && tts_limit[0] != 0) {
+        h->tts_limit = atoi(tts_limit);
+        if (h->tts_limit <= 0)
+            h->tts_limit = -1;
+        else if (h->tts_limit > ((1U<<31) / 1000000))
+            h->tts_limit = (1U<<31) / 1000000;
+        ccnd_msg(h, "CCND_MAX_TIME_TO_STALE=%d", h->tts_limit);
+    }
+    cs_snapshot = getenv("CCND_CS_SNAPSHOT");
+    if (cs_snapshot != NULL && cs_snapshot[0] != 0) {
+        h->cs_snapshot = cs_snapshot;
+        ccnd_msg(h, "CCND_CS_SNAPSHOT=%s", cs_snapshot);
+    }
+    workers = getenv("CCND_WORKERS");
+    if (workers != NULL && workers[0] != 0) {
+        nworkers = atoi(workers);
+        if (nworkers < 0)
+            nworkers = 0;
+        if (nworkers > CCND_WORKERS_MAX)
+            nworkers = CCND_WORKERS_MAX;
+        ccnd_msg(h, "CCND_WORKERS=%d", nworkers);
+    }
+    listen_on = getenv("CCND_LISTEN_ON");
+    autoreg = getenv("CCND_AUTOREG");
+    
+    if (autoreg != NULL && autoreg[0] != 0) {
+        h->autoreg = ccnd_parse_uri_list(h, "CCND_AUTOREG", autoreg);
+        if (h->autoreg != NULL)
+            ccnd_msg(h, "CCND_AUTOREG=%s", autoreg);
+    }
+    if (listen_on != NULL && listen_on[0] != 0)
+        ccnd_msg(h, "CCND_LISTEN_ON=%s", listen_on);
+    // if (h->debug & 256)
+        h->noncegen = &ccnd_debug_nonce;
+    /* Do keystore setup early, it takes a while the first time */
+    ccnd_init_internal_keystore(h);
+    ccnd_reseed(h);
+    if (h->face0 == NULL) {
+        struct face *face;
+        face = calloc(1, sizeof(*face));
+        face->recv_fd = -1;
+        face->sendface = 0;
+        face->flags = (CCN_FACE_GG | CCN_FACE_LOCAL);
+        h->face0 = face;
     }
-    return(res);
+    enroll_face(h, h->face0);
+    fd = create_local_listener(h, sockname, 42);
+    if (fd == -1)
+        ccnd_msg(h, "%s: %s", sockname, strerror(errno));
+    else
+        ccnd_msg(h, "listening on %s", sockname);
+    h->flood = (h->autoreg != NULL);
+    h->ipv4_faceid = h->ipv6_faceid = CCN_NOFACEID;
+    ccnd_listen_on(h, listen_on);
+    reap_needed(h, 55000);
+    age_forwarding_needed(h);
+    ccnd_internal_client_start(h);
+    if (nworkers > 1 && ccnd_workers_create(h, nworkers) < 0)
+        ccnd_msg(h, "could not create workers - forwarding on one thread");
+    if (h->cs_snapshot != NULL)
+        ccnd_snapshot_load(h);
+    if (h->workers != NULL && ccnd_workers_start(h) < 0)
+        ccnd_msg(h, "could not start workers - forwarding on one thread");
+    free(sockname);
+    sockname = NULL;
+    return(h);
 }
 
 /**
- * Determine what socket to use to send on a face.
- *
- * For streams, this just returns the associated fd.
- *
- * For datagrams, one fd may be in use for many faces, so we need to find the
- * right one to use.
- *
- * This is not as smart as it should be for situations where
- * CCND_LISTEN_ON has been specified.
+ * Shutdown listeners and bound datagram sockets, leaving connected streams.
  */
-static int
-sending_fd(struct ccnd_handle *h, struct face *face)
+static void
+ccnd_shutdown_listeners(struct ccnd_handle *h)
 {
-    struct face *out = NULL;
-    if (face->sendface == face->faceid)
-        return(face->recv_fd);
-    out = face_from_faceid(h, face->sendface);
-    if (out != NULL)
-        return(out->recv_fd);
-    face->sendface = CCN_NOFACEID;
-    if (face->addr != NULL) {
-        switch (face->addr->sa_family) {
-            case AF_INET:
-                face->sendface = h->ipv4_faceid;
-                break;
-            case AF_INET6:
-                face->sendface = h->ipv6_faceid;
-                break;
-            default:
-                break;
-        }
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    for (hashtb_start(h->faces_by_fd, e); e->data != NULL;) {
+        struct face *face = e->data;
+        if ((face->flags & (CCN_FACE_MCAST | CCN_FACE_PASSIVE)) != 0)
+            hashtb_delete(e);
+        else
+            hashtb_next(e);
     }
-    out = face_from_faceid(h, face->sendface);
-    if (out != NULL)
-        return(out->recv_fd);
-    return(-1);
+    hashtb_end(e);
 }
 
 /**
- * Send data to the face.
- *
- * No direct error result is provided; the face state is updated as needed.
+ * Destroy the ccnd instance, releasing all associated resources.
  */
 void
-ccnd_send(struct ccnd_handle *h,
-          struct face *face,
-          const void *data, size_t size)
+ccnd_destroy(struct ccnd_handle **pccnd)
 {
-    ssize_t res;
-    int fd;
-    int bcast = 0;
-    
-    if ((face->flags & CCN_FACE_NOSEND) != 0)
-        return;
-    face->surplus++;
-    if (face->outbuf != NULL) {
-        ccn_charbuf_append(face->outbuf, data, size);
+    struct ccnd_handle *h = *pccnd;
+    int i;
+    if (h == NULL)
         return;
+    probes_destroy(h);
+    ccnd_workers_stop(h);
+    ccnd_transit_sweep(h, 1);
+    ccnd_shutdown_listeners(h);
+    ccnd_internal_client_stop(h);
+    ccn_schedule_destroy(&h->sched);
+    hashtb_destroy(&h->dgram_faces);
+    hashtb_destroy(&h->faces_by_fd);
+    hashtb_destroy(&h->faceid_by_guid);
+    hashtb_destroy(&h->content_tab);
+    hashtb_destroy(&h->interest_tab);
+    hashtb_destroy(&h->nameprefix_tab);
+    hashtb_destroy(&h->sparse_straggler_tab);
+    hashtb_destroy(&h->nonce_tab);
+    hashtb_destroy(&h->nonce_old);
+    hashtb_destroy(&h->guest_tab);
+    ccn_pool_destroy(&h->pfi_pool);
+    if (h->fds != NULL) {
+        free(h->fds);
+        h->fds = NULL;
+        h->nfds = 0;
     }
-    if (face == h->face0) {
-        ccnd_meter_bump(h, face->meter[FM_BYTO], size);
-        ccn_dispatch_message(h->internal_client, (void *)data, size);
-        ccnd_internal_client_has_somthing_to_say(h);
-        return;
+#if defined(HAVE_EPOLL)
+    if (h->epfd != -1) {
+        close(h->epfd);
+        h->epfd = -1;
     }
-    if ((face->flags & CCN_FACE_DGRAM) == 0)
-        res = send(face->recv_fd, data, size, 0);
-    else {
-        fd = sending_fd(h, face);
-        if ((face->flags & CCN_FACE_BC) != 0) {
-            bcast = 1;
-            setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &bcast, sizeof(bcast));
-        }
-        res = sendto(fd, data, size, 0, face->addr, face->addrlen);
-        if (res == -1 && errno == EACCES &&
-            (face->flags & (CCN_FACE_BC | CCN_FACE_NBC)) == 0) {
-            bcast = 1;
-            setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &bcast, sizeof(bcast));
-            res = sendto(fd, data, size, 0, face->addr, face->addrlen);
-            if (res == -1)
-                face->flags |= CCN_FACE_NBC; /* did not work, do not try */
-            else
-                face->flags |= CCN_FACE_BC; /* remember for next time */
-        }
-        if (bcast != 0) {
-            bcast = 0;
-            setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &bcast, sizeof(bcast));
-        }
+    if (h->events != NULL) {
+        free(h->events);
+        h->events = NULL;
+        h->nevents = h->nready = 0;
     }
-    if (res > 0)
-        ccnd_meter_bump(h, face->meter[FM_BYTO], res);
-    if (res == size)
-        return;
-    if (res == -1) {
-        res = handle_send_error(h, errno, face, data, size);
-        if (res == -1)
-            return;
+#endif
+    if (h->faces_by_faceid != NULL) {
+        free(h->faces_by_faceid);
+        h->faces_by_faceid = NULL;
+        h->face_limit = h->face_gen = 0;
     }
-    if ((face->flags & CCN_FACE_DGRAM) != 0) {
-        ccnd_msg(h, "sendto short");
-        return;
+    if (h->content_by_accession != NULL) {
+        free(h->content_by_accession);
+        h->content_by_accession = NULL;
+        h->content_by_accession_window = 0;
     }
-    face->outbufindex = 0;
-    face->outbuf = ccn_charbuf_create();
-    if (face->outbuf == NULL) {
-        ccnd_msg(h, "do_write: %s", strerror(errno));
-        return;
+    ccn_charbuf_destroy(&h->send_interest_scratch);
+    ccn_charbuf_destroy(&h->scratch_charbuf);
+    ccn_charbuf_destroy(&h->autoreg);
+    content_trie_node_destroy(&h->content_trie);
+    ccn_indexbuf_destroy(&h->scratch_indexbuf);
+    ccn_indexbuf_destroy(&h->dgram_flush);
+    ccn_indexbuf_destroy(&h->stream_flush);
+    ccn_indexbuf_destroy(&h->handover);
+    ccn_indexbuf_destroy(&h->io_faces);
+    if (h->expiry_ring != NULL) {
+        for (i = 0; i < CCND_EXPIRY_SLOTS; i++)
+            free(h->expiry_ring[i].accession);
+        free(h->expiry_ring);
+    }
+#if defined(HAVE_RECVMMSG)
+    if (h->dgram_rbatch != NULL) {
+        for (i = 0; i < CCND_DGRAM_BATCH_MAX; i++)
+            ccn_charbuf_destroy(&h->dgram_rbatch->buf[i]);
+        free(h->dgram_rbatch);
+        h->dgram_rbatch = NULL;
+    }
+#endif
+    if (h->face0 != NULL) {
+        ccn_charbuf_destroy(&h->face0->inbuf);
+        face_outq_clear(h->face0);
+        free(h->face0);
+        h->face0 = NULL;
     }
-    ccn_charbuf_append(face->outbuf,
-                       ((const unsigned char *)data) + res, size - res);
+    free(h);
+    *pccnd = NULL;
 }
 
 /**
- * Do deferred sends.
+ * Create the handle for a worker's shard of the PIT and Content Store.
  *
- * These can only happen on streams, after there has been a partial write.
+ * The shard takes its settings from the main handle.
+ * It has no sockets, and no internal client.
  */
-static void
-do_deferred_write(struct ccnd_handle *h, int fd)
+struct ccnd_handle *
+ccnd_worker_handle_create(struct ccnd_handle *h, struct ccnd_worker *worker)
 {
-    /* This only happens on connected sockets */
-    ssize_t res;
-    struct face *face = hashtb_lookup(h->faces_by_fd, &fd, sizeof(fd));
-    if (face == NULL)
-        return;
-    if (face->outbuf != NULL) {
-        ssize_t sendlen = face->outbuf->length - face->outbufindex;
-        if (sendlen > 0) {
-            res = send(fd, face->outbuf->buf + face->outbufindex, sendlen, 0);
-            if (res == -1) {
-                if (errno == EPIPE) {
-                    face->flags |= CCN_FACE_NOSEND;
-                    face->outbufindex = 0;
-                    ccn_charbuf_destroy(&face->outbuf);
-                    return;
-                }
-                ccnd_msg(h, "send: %s (errno = %d)", strerror(errno), errno);
-                shutdown_client_fd(h, fd);
-                return;
-            }
-            if (res == sendlen) {
-                face->outbufindex = 0;
-                ccn_charbuf_destroy(&face->outbuf);
-                if ((face->flags & CCN_FACE_CLOSING) != 0)
-                    shutdown_client_fd(h, fd);
-                return;
-            }
-            face->outbufindex += res;
-            return;
-        }
-        face->outbufindex = 0;
-        ccn_charbuf_destroy(&face->outbuf);
-    }
-    if ((face->flags & CCN_FACE_CLOSING) != 0)
-        shutdown_client_fd(h, fd);
-    else if ((face->flags & CCN_FACE_CONNECTING) != 0) {
-        face->flags &= ~CCN_FACE_CONNECTING;
-        ccnd_face_status_change(h, face->faceid);
+    struct ccnd_handle *w;
+    
+    w = calloc(1, sizeof(*w));
+    if (w == NULL)
+        return(w);
+    w->logger = h->logger;
+    w->loggerdata = h->loggerdata;
+    w->noncegen = h->noncegen;
+    w->logpid = h->logpid;
+    w->progname = h->progname;
+    w->debug = h->debug;
+    ccnd_init_tables(w);
+    w->epfd = -1;
+    w->worker = worker;
+    w->portstr = h->portstr;
+    memcpy(w->ccnd_id, h->ccnd_id, sizeof(w->ccnd_id));
+    /* The limits are for all the stores together; see ccnd_workers.c */
+    w->capacity = h->capacity;
+    w->cs_bytes_limit = h->cs_bytes_limit;
+    w->force_zero_freshness = h->force_zero_freshness;
+    /* It may be handed faces to do the i/o of */
+    w->mtu = h->mtu;
+    w->link_reliable = h->link_reliable;
+    w->dgram_batch = h->dgram_batch;
+    w->data_pause_microsec = h->data_pause_microsec;
+    w->data_burst = h->data_burst;
+    w->tts_default = h->tts_default;
+    w->tts_limit = h->tts_limit;
+    w->ipv4_faceid = w->ipv6_faceid = CCN_NOFACEID;
+    if (w->content_trie == NULL || w->sched == NULL || w->pfi_pool == NULL) {
+        ccnd_destroy(&w);
+        return(NULL);
     }
-    else
-        ccnd_msg(h, "ccnd:do_deferred_write: something fishy on %d", fd);
+    ccnd_reseed(w);
+    reap_needed(w, 55000);
+    return(w);
 }
 
 /**
- * Set up the array of fd descriptors for the poll(2) call.
+ * Find or make the face of a shard that stands for a face of the
+ * main thread.
  *
- * Arrange the array so that multicast receivers are early, so that
- * if the same packet arrives on both a multicast socket and a
- * normal socket, we will count is as multicast.
+ * The shard's faces carry the same faceids, but no addresses or fds;
+ * what is sent on them goes to the thread that owns the face, as
+ * far as the shard knows.  A face whose i/o this worker does keeps
+ * the flags that its i/o has set (CCND_FACE_IO_FLAGS), and becomes
+ * this worker's only by being handed over (CCND_PKT_ADOPT).
  */
-static void
-prepare_poll_fds(struct ccnd_handle *h)
+struct face *
+ccnd_worker_face(struct ccnd_handle *h, unsigned faceid, int flags, int owner)
 {
     struct hashtb_enumerator ee;
     struct hashtb_enumerator *e = &ee;
-    int i, j, k;
-    if (hashtb_n(h->faces_by_fd) != h->nfds) {
-        h->nfds = hashtb_n(h->faces_by_fd);
-        h->fds = realloc(h->fds, h->nfds * sizeof(h->fds[0]));
-        memset(h->fds, 0, h->nfds * sizeof(h->fds[0]));
-    }
-    for (i = 0, k = h->nfds, hashtb_start(h->faces_by_fd, e);
-         i < k && e->data != NULL; hashtb_next(e)) {
-        struct face *face = e->data;
-        if (face->flags & CCN_FACE_MCAST)
-            j = i++;
-        else
-            j = --k;
-        h->fds[j].fd = face->recv_fd;
-        h->fds[j].events = ((face->flags & CCN_FACE_NORECV) == 0) ? POLLIN : 0;
-        if ((face->outbuf != NULL || (face->flags & CCN_FACE_CLOSING) != 0))
-            h->fds[j].events |= POLLOUT;
-    }
-    hashtb_end(e);
-    if (i < k)
-        abort();
-}
-
-/**
- * Run the main loop of the ccnd
- */
-void
-ccnd_run(struct ccnd_handle *h)
-{
-    int i;
+    struct face **a;
+    struct face *face;
+    unsigned slot = faceid & MAXFACES;
+    unsigned n;
     int res;
-    int timeout_ms = -1;
-    int prev_timeout_ms = -1;
-    int usec;
-    for (h->running = 1; h->running;) {
-        process_internal_client_buffer(h);
-        usec = ccn_schedule_run(h->sched);
-        timeout_ms = (usec < 0) ? -1 : ((usec + 960) / 1000);
-        if (timeout_ms == 0 && prev_timeout_ms == 0)
-            timeout_ms = 1;
-        process_internal_client_buffer(h);
-        prepare_poll_fds(h);
-        if (0) ccnd_msg(h, "at ccnd.c:%d poll(h->fds, %d, %d)", __LINE__, h->nfds, timeout_ms);
-        res = poll(h->fds, h->nfds, timeout_ms);
-        prev_timeout_ms = ((res == 0) ? timeout_ms : 1);
-        if (-1 == res) {
-            ccnd_msg(h, "poll: %s (errno = %d)", strerror(errno), errno);
-            sleep(1);
-            continue;
-        }
-        if (res > 0) {
-            /* we need a fresh current time for setting interest expiries */
-            struct ccn_timeval dummy;
-            h->ticktock.gettime(&h->ticktock, &dummy);
-        }
-        for (i = 0; res > 0 && i < h->nfds; i++) {
-            if (h->fds[i].revents != 0) {
-                res--;
-                if (h->fds[i].revents & (POLLERR | POLLNVAL | POLLHUP)) {
-                    if (h->fds[i].revents & (POLLIN))
-                        process_input(h, h->fds[i].fd);
-                    else
-                        shutdown_client_fd(h, h->fds[i].fd);
-                    continue;
-                }
-                if (h->fds[i].revents & (POLLOUT))
-                    do_deferred_write(h, h->fds[i].fd);
-                else if (h->fds[i].revents & (POLLIN))
-                    process_input(h, h->fds[i].fd);
-            }
-        }
-    }
-}
-
-/**
- * Reseed our pseudo-random number generator.
- */
-static void
-ccnd_reseed(struct ccnd_handle *h)
-{
-    int fd;
-    ssize_t res;
     
-    res = -1;
-    fd = open("/dev/urandom", O_RDONLY);
-    if (fd != -1) {
-        res = read(fd, h->seed, sizeof(h->seed));
-        close(fd);
+    flags &= ~CCN_FACE_UNDECIDED;
+    if (owner == h->thread)
+        owner = 0;
+    face = face_from_faceid(h, faceid);
+    if (face != NULL) {
+        if (face->owner == h->thread)
+            flags = (flags & ~CCND_FACE_IO_FLAGS) |
+                    (face->flags & CCND_FACE_IO_FLAGS);
+        else
+            face->owner = owner;
+        face->flags = flags;
+        return(face);
     }
-    if (res != sizeof(h->seed)) {
-        h->seed[1] = (unsigned short)getpid(); /* better than no entropy */
-        h->seed[2] = (unsigned short)time(NULL);
+    /* The main thread has reused the slot */
+    if (slot < h->face_limit && h->faces_by_faceid[slot] != NULL)
+        ccnd_worker_face_drop(h, h->faces_by_faceid[slot]->faceid);
+    if (slot >= h->face_limit) {
+        n = (slot + 1) * 3 / 2;
+        if (n > MAXFACES + 1)
+            n = MAXFACES + 1;
+        a = realloc(h->faces_by_faceid, n * sizeof(struct face *));
+        if (a == NULL)
+            return(NULL);
+        memset(a + h->face_limit, 0, (n - h->face_limit) * sizeof(a[0]));
+        h->faces_by_faceid = a;
+        h->face_limit = n;
     }
-    /*
-     * The call to seed48 is needed by cygwin, and should be harmless
-     * on other platforms.
-     */
-    seed48(h->seed);
+    hashtb_start(h->dgram_faces, e);
+    res = hashtb_seek(e, &faceid, sizeof(faceid), 0);
+    if (res >= 0) {
+        face = e->data;
+        if (res == HT_NEW_ENTRY) {
+            face->recv_fd = -1;
+            face->sendface = CCN_NOFACEID;
+            face->faceid = faceid;
+            face->owner = owner;
+            face_meters_create(h, face);
+        }
+        face->flags = flags;
+        h->faces_by_faceid[slot] = face;
+    }
+    hashtb_end(e);
+    return(face);
 }
 
 /**
- * Get the name of our unix-domain socket listener.
- *
- * Uses the library to generate the name, using the environment.
- * @returns a newly-allocated nul-terminated string.
+ * Remove a face from a shard.
  */
-static char *
-ccnd_get_local_sockname(void)
-{
-    struct sockaddr_un sa;
-    ccn_setup_sockaddr_un(NULL, &sa);
-    return(strdup(sa.sun_path));
+void
+ccnd_worker_face_drop(struct ccnd_handle *h, unsigned faceid)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    
+    if (hashtb_lookup(h->dgram_faces, &faceid, sizeof(faceid)) == NULL)
+        return;
+    hashtb_start(h->dgram_faces, e);
+    hashtb_seek(e, &faceid, sizeof(faceid), 0);
+    hashtb_delete(e);
+    hashtb_end(e);
 }
 
 /**
- * Get the time.
+ * Take over the i/o of a face from the main thread.
  *
- * This is used to supply the clock for our scheduled events.
+ * A stream comes with its socket and any partial message read from it;
+ * a datagram face with a socket of its own, connected to the peer.
+ * Link state starts afresh, from the sequence number that the main
+ * thread had reached.
  */
 static void
-ccnd_gettime(const struct ccn_gettime *self, struct ccn_timeval *result)
+packet_adopt(struct ccnd_handle *h, struct ccnd_packet *p)
 {
-    struct ccnd_handle *h = self->data;
-    struct timeval now = {0};
-    long int sdelta;
-    int udelta;
-    ccn_wrappedtime delta;
+    struct ccnd_packet *gone;
+    struct face *face;
+    struct sockaddr *addr;
     
-    gettimeofday(&now, 0);
-    result->s = now.tv_sec;
-    result->micros = now.tv_usec;
-    sdelta = now.tv_sec - h->sec;
-    udelta = now.tv_usec + h->sliver - h->usec;
-    h->sec = now.tv_sec;
-    h->usec = now.tv_usec;
-    while (udelta < 0) {
-        udelta += 1000000;
-        sdelta -= 1;
+    face = ccnd_worker_face(h, p->faceid, p->flags, 0);
+    if (face == NULL || face->recv_fd != -1 ||
+          ccn_indexbuf_append_element(h->io_faces, p->faceid) < 0)
+        goto Bail;
+    if ((p->flags & CCN_FACE_DGRAM) != 0) {
+        addr = malloc(p->buf->length);
+        face->report = calloc(1, sizeof(*face->report));
+        if (addr == NULL || face->report == NULL) {
+            free(addr);
+            h->io_faces->n--;
+            goto Bail;
+        }
+        memcpy(addr, p->buf->buf, p->buf->length);
+        face->addr = addr;
+        face->addrlen = p->buf->length;
+        face->sendface = face->faceid;
     }
-    /* avoid letting time run backwards or taking huge steps */
-    if (sdelta < 0)
-        delta = 1;
-    else if (sdelta >= (1U << 30) / WTHZ)
-        delta = (1U << 30) / WTHZ;
     else {
-        delta = (unsigned)udelta / (1000000U / WTHZ);
-        h->sliver = udelta - delta * (1000000U / WTHZ);
-        delta += (unsigned)sdelta * WTHZ;
-    }
-    h->wtnow += delta;
+        face->report = calloc(1, sizeof(*face->report));
+        if (face->report == NULL) {
+            h->io_faces->n--;
+            goto Bail;
+        }
+        face->inbuf = p->buf;
+        p->buf = NULL;
+        face->decoder = p->decoder;
+    }
+    face->owner = h->thread;
+    face->flags = p->flags;
+    face->recv_fd = p->fd;
+    p->fd = -1;
+    face->pktseq = p->pktseq;
+    face->report->flags = face->flags;
+    return;
+Bail:
+    /* Let the main thread have it back, to destroy */
+    ccnd_msg(h, "face %u could not be taken over", p->faceid);
+    gone = ccnd_packet_create(CCND_PKT_GONE);
+    if (gone == NULL)
+        return;
+    gone->faceid = p->faceid;
+    ccnd_workers_post(h, 0, gone);
 }
 
 /**
- * Set IPV6_V6ONLY on a socket.
+ * Stop doing the i/o of a face, and give the face back to the main
+ * thread to destroy.
  *
- * The handle is used for error reporting.
+ * The socket of a stream belongs to the main thread, which closes it
+ * once the face is back; a datagram socket made for the face is closed
+ * here.  What is sent on the face from now on is dropped.
  */
-void
-ccnd_setsockopt_v6only(struct ccnd_handle *h, int fd)
+static void
+face_io_close(struct ccnd_handle *h, struct face *face)
 {
-    int yes = 1;
-    int res = 0;
-#ifdef IPV6_V6ONLY
-    res = setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &yes, sizeof(yes));
-#endif
-    if (res == -1)
-        ccnd_msg(h, "warning - could not set IPV6_V6ONLY on fd %d: %s",
-                 fd, strerror(errno));
+    struct ccnd_packet *p;
+    int i;
+    
+    if (face->recv_fd == -1)
+        return;
+    for (i = 0; i < h->io_faces->n; i++)
+        if (h->io_faces->buf[i] == face->faceid)
+            h->io_faces->buf[i] = CCN_NOFACEID; /* see ccnd_worker_poll() */
+    if ((face->flags & CCN_FACE_DGRAM) != 0)
+        close(face->recv_fd);
+    face->recv_fd = -1;
+    face->flags |= CCN_FACE_NOSEND;
+    if (face->inbuf != NULL && face->inbuf == h->rx_buf)
+        rx_unshare(h, &face->inbuf, face->inbuf->length);
+    ccn_charbuf_destroy(&face->inbuf);
+    face_outq_clear(face);
+    dgram_sendq_destroy(&face->sendq);
+    p = ccnd_packet_create(CCND_PKT_GONE);
+    if (p == NULL)
+        return;
+    p->faceid = face->faceid;
+    ccnd_workers_post(h, 0, p);
 }
 
 /**
- * Translate an address family constant to a string.
+ * Tell the main thread how the faces whose i/o this worker does are
+ * getting on: at once if their flags have changed, and otherwise once
+ * a second if there is anything new.
  */
-static const char *
-af_name(int family)
+static void
+faces_report(struct ccnd_handle *h)
 {
-    switch (family) {
-        case AF_INET:
-            return("ipv4");
-        case AF_INET6:
-            return("ipv6");
-        default:
-            return("");
+    struct ccnd_face_report *last;
+    struct ccnd_face_report *r;
+    struct ccnd_packet *p;
+    struct face *face;
+    uintmax_t total;
+    int tick = (h->sec != h->io_report_sec);
+    int news;
+    int i;
+    int m;
+    
+    h->io_report_sec = h->sec;
+    for (i = 0; i < h->io_faces->n; i++) {
+        face = face_from_faceid(h, h->io_faces->buf[i]);
+        if (face == NULL || face->recv_fd == -1)
+            continue;
+        last = face->report;
+        if (!tick && last->flags == face->flags)
+            continue;
+        p = ccnd_packet_create(CCND_PKT_REPORT);
+        if (p == NULL)
+            return;
+        p->buf = ccn_charbuf_create();
+        if (p->buf == NULL ||
+            (r = (void *)ccn_charbuf_reserve(p->buf, sizeof(*r))) == NULL) {
+            ccnd_packet_release(p);
+            return;
+        }
+        p->buf->length = sizeof(*r);
+        memset(r, 0, sizeof(*r));
+        news = (last->flags != face->flags || last->drops != face->drops ||
+                last->sendq_n != face->sendq_n);
+        r->flags = last->flags = face->flags;
+        r->recvcount = face->recvcount - last->recvcount;
+        last->recvcount = face->recvcount;
+        r->drops = last->drops = face->drops;
+        r->sendq_n = last->sendq_n = face->sendq_n;
+        news |= (r->recvcount != 0);
+        for (m = 0; m < CCND_FACE_METER_N; m++) {
+            total = ccnd_meter_total(face->meter[m]);
+            r->meter[m] = total - last->meter[m];
+            last->meter[m] = total;
+            news |= (r->meter[m] != 0);
+        }
+        if (!news) {
+            ccnd_packet_release(p);
+            continue;
+        }
+        p->faceid = face->faceid;
+        ccnd_workers_post(h, 0, p);
     }
 }
 
 /**
- * Create the standard ipv4 and ipv6 bound ports.
+ * Take in what the worker that does the i/o of a face reports of it.
+ *
+ * Others hear of a change to the flags that matter to forwarding.
  */
-static int
-ccnd_listen_on_wildcards(struct ccnd_handle *h)
+static void
+packet_report(struct ccnd_handle *h, struct ccnd_packet *p)
 {
-    int fd;
-    int res;
-    int whichpf;
-    struct addrinfo hints = {0};
-    struct addrinfo *addrinfo = NULL;
-    struct addrinfo *a;
+    const struct ccnd_face_report *r;
+    struct face *face;
+    int changed;
+    int m;
     
-    hints.ai_socktype = SOCK_DGRAM;
-    hints.ai_flags = AI_PASSIVE;
-    for (whichpf = 0; whichpf < 2; whichpf++) {
-        hints.ai_family = whichpf ? PF_INET6 : PF_INET;
-        res = getaddrinfo(NULL, h->portstr, &hints, &addrinfo);
-        if (res == 0) {
-            for (a = addrinfo; a != NULL; a = a->ai_next) {
-                fd = socket(a->ai_family, SOCK_DGRAM, 0);
-                if (fd != -1) {
-                    struct face *face = NULL;
-                    int yes = 1;
-                    int rcvbuf = 0;
-                    socklen_t rcvbuf_sz;
-                    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
-                    rcvbuf_sz = sizeof(rcvbuf);
-                    getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &rcvbuf_sz);
-                    if (a->ai_family == AF_INET6)
-                        ccnd_setsockopt_v6only(h, fd);
-                    res = bind(fd, a->ai_addr, a->ai_addrlen);
-                    if (res != 0) {
-                        close(fd);
-                        continue;
-                    }
-                    face = record_connection(h, fd,
-                                             a->ai_addr, a->ai_addrlen,
-                                             CCN_FACE_DGRAM | CCN_FACE_PASSIVE);
-                    if (face == NULL) {
-                        close(fd);
-                        continue;
-                    }
-                    if (a->ai_family == AF_INET)
-                        h->ipv4_faceid = face->faceid;
-                    else
-                        h->ipv6_faceid = face->faceid;
-                    ccnd_msg(h, "accepting %s datagrams on fd %d rcvbuf %d",
-                             af_name(a->ai_family), fd, rcvbuf);
-                }
-            }
-            for (a = addrinfo; a != NULL; a = a->ai_next) {
-                fd = socket(a->ai_family, SOCK_STREAM, 0);
-                if (fd != -1) {
-                    int yes = 1;
-                    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
-                    if (a->ai_family == AF_INET6)
-                        ccnd_setsockopt_v6only(h, fd);
-                    res = bind(fd, a->ai_addr, a->ai_addrlen);
-                    if (res != 0) {
-                        close(fd);
-                        continue;
-                    }
-                    res = listen(fd, 30);
-                    if (res == -1) {
-                        close(fd);
-                        continue;
-                    }
-                    record_connection(h, fd,
-                                      a->ai_addr, a->ai_addrlen,
-                                      CCN_FACE_PASSIVE);
-                    ccnd_msg(h, "accepting %s connections on fd %d",
-                             af_name(a->ai_family), fd);
-                }
-            }
-            freeaddrinfo(addrinfo);
-        }
-    }
-    return(0);
+    face = face_from_faceid(h, p->faceid);
+    if (face == NULL || face->owner != p->thread || face->dropping ||
+          p->buf == NULL || p->buf->length != sizeof(*r))
+        return;
+    r = (const void *)p->buf->buf;
+    face->recvcount += r->recvcount;
+    face->drops = r->drops;
+    face->sendq_n = r->sendq_n;
+    for (m = 0; m < CCND_FACE_METER_N; m++)
+        if (r->meter[m] != 0)
+            ccnd_meter_bump(h, face->meter[m], r->meter[m]);
+    changed = (face->flags ^ r->flags) & CCND_FACE_IO_FLAGS;
+    face->flags ^= changed;
+    if ((changed & (CCN_FACE_LINK | CCN_FACE_GG)) != 0)
+        register_new_face(h, face);
+    else if ((changed & CCN_FACE_NOSEND) != 0)
+        ccnd_face_status_change(h, face->faceid);
 }
 
 /**
- * Create a tcp listener and a bound udp socket on the given address
+ * Write out what the worker has sent during this pass, and report on
+ * its faces.
+ *
+ * Runs on the worker thread, before it waits.
  */
-static int
-ccnd_listen_on_address(struct ccnd_handle *h, const char *addr)
+void
+ccnd_worker_flush(struct ccnd_handle *h)
 {
-    int fd;
-    int res;
-    struct addrinfo hints = {0};
-    struct addrinfo *addrinfo = NULL;
-    struct addrinfo *a;
-    int ok = 0;
-    
-    ccnd_msg(h, "listen_on %s", addr);
-    hints.ai_socktype = SOCK_DGRAM;
-    hints.ai_flags = AI_PASSIVE;
-    res = getaddrinfo(addr, h->portstr, &hints, &addrinfo);
-    if (res == 0) {
-        for (a = addrinfo; a != NULL; a = a->ai_next) {
-            fd = socket(a->ai_family, SOCK_DGRAM, 0);
-            if (fd != -1) {
-                struct face *face = NULL;
-                int yes = 1;
-                int rcvbuf = 0;
-                socklen_t rcvbuf_sz;
-                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
-                rcvbuf_sz = sizeof(rcvbuf);
-                getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &rcvbuf_sz);
-                if (a->ai_family == AF_INET6)
-                    ccnd_setsockopt_v6only(h, fd);
-                res = bind(fd, a->ai_addr, a->ai_addrlen);
-                if (res != 0) {
-                    close(fd);
-                    continue;
-                }
-                face = record_connection(h, fd,
-                                         a->ai_addr, a->ai_addrlen,
-                                         CCN_FACE_DGRAM | CCN_FACE_PASSIVE);
-                if (face == NULL) {
-                    close(fd);
-                    continue;
-                }
-                if (a->ai_family == AF_INET)
-                    h->ipv4_faceid = face->faceid;
-                else
-                    h->ipv6_faceid = face->faceid;
-                ccnd_msg(h, "accepting %s datagrams on fd %d rcvbuf %d",
-                             af_name(a->ai_family), fd, rcvbuf);
-                ok++;
-            }
-        }
-        for (a = addrinfo; a != NULL; a = a->ai_next) {
-            fd = socket(a->ai_family, SOCK_STREAM, 0);
-            if (fd != -1) {
-                int yes = 1;
-                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
-                if (a->ai_family == AF_INET6)
-                    ccnd_setsockopt_v6only(h, fd);
-                res = bind(fd, a->ai_addr, a->ai_addrlen);
-                if (res != 0) {
-                    close(fd);
-                    continue;
-                }
-                res = listen(fd, 30);
-                if (res == -1) {
-                    close(fd);
-                    continue;
-                }
-                record_connection(h, fd,
-                                  a->ai_addr, a->ai_addrlen,
-                                  CCN_FACE_PASSIVE);
-                ccnd_msg(h, "accepting %s connections on fd %d",
-                         af_name(a->ai_family), fd);
-                ok++;
-            }
-        }
-        freeaddrinfo(addrinfo);
+    flush_stream_output(h);
+    flush_dgram_output(h);
+    faces_report(h);
+}
+
+/**
+ * Wait for the faces whose i/o the worker does, or for its wake pipe,
+ * and handle what they have.
+ *
+ * Runs on the worker thread, in place of the poll of ccnd_run().
+ */
+void
+ccnd_worker_poll(struct ccnd_handle *h, int wake_fd, int timeout_ms)
+{
+    struct ccn_indexbuf *io = h->io_faces;
+    struct ccn_timeval dummy;
+    struct face *face;
+    int res;
+    int i;
+    int n;
+    
+    /* Faces closed during the last pass left holes */
+    for (i = 0, n = 0; i < io->n; i++) {
+        face = face_from_faceid(h, io->buf[i]);
+        if (face != NULL && face->recv_fd != -1)
+            io->buf[n++] = io->buf[i];
+    }
+    io->n = n;
+    if (n == 0 && timeout_ms == 0)
+        return;
+    if (h->fds == NULL || h->nfds < n + 1) {
+        struct pollfd *fds = realloc(h->fds, (n + 1) * sizeof(h->fds[0]));
+        if (fds == NULL)
+            return;
+        h->fds = fds;
+        h->nfds = n + 1;
+    }
+    for (i = 0; i < n; i++) {
+        face = face_from_faceid(h, io->buf[i]);
+        h->fds[i].fd = face->recv_fd;
+        h->fds[i].events = face_wanted_events(face);
+        h->fds[i].revents = 0;
+    }
+    h->fds[n].fd = wake_fd;
+    h->fds[n].events = POLLIN;
+    h->fds[n].revents = 0;
+    res = poll(h->fds, n + 1, timeout_ms);
+    if (res <= 0)
+        return;
+    h->ticktock.gettime(&h->ticktock, &dummy);
+    for (i = 0; i < n; i++) {
+        if (h->fds[i].revents == 0 || io->buf[i] == CCN_NOFACEID)
+            continue;
+        face = face_from_faceid(h, io->buf[i]);
+        if (face != NULL && face->recv_fd == h->fds[i].fd)
+            dispatch_face_events(h, face, h->fds[i].revents);
     }
-    return(ok > 0 ? 0 : -1);
 }
 
 /**
- * Create listeners or bound udp ports using the given addresses
+ * Replace the forwarding entries of a shard's name prefix with those
+ * from a snapshot of the FIB.
  *
- * The addresses may be separated by whitespace, commas, or semicolons.
+ * The response time estimates kept with existing entries are retained.
+ * If accelerate is nonzero, pending interests are sent promptly to
+ * newly active faces, as they are for a registration.
  */
-static int
-ccnd_listen_on(struct ccnd_handle *h, const char *addrs)
+void
+ccnd_worker_set_forwarding(struct ccnd_handle *h,
+                           struct nameprefix_entry *npe,
+                           const struct ccn_forwarding *fwd, int n,
+                           int accelerate)
 {
-    unsigned char ch;
-    unsigned char dlm;
-    int res = 0;
+    struct ccn_forwarding *old = npe->forwarding;
+    struct ccn_forwarding **pp;
+    struct ccn_forwarding **pf;
+    struct ccn_forwarding *f;
+    struct ccn_indexbuf *fresh = NULL;
     int i;
-    struct ccn_charbuf *addr = NULL;
     
-    if (addrs == NULL || !*addrs || 0 == strcmp(addrs, "*"))
-        return(ccnd_listen_on_wildcards(h));
-    addr = ccn_charbuf_create();
-    for (i = 0, ch = addrs[i]; addrs[i] != 0;) {
-        addr->length = 0;
-        dlm = 0;
-        if (ch == '[') {
-            dlm = ']';
-            ch = addrs[++i];
-        }
-        for (; ch > ' ' && ch != ',' && ch != ';' && ch != dlm; ch = addrs[++i])
-            ccn_charbuf_append_value(addr, ch, 1);
-        if (ch && ch == dlm)
-            ch = addrs[++i];
-        if (addr->length > 0) {
-            res |= ccnd_listen_on_address(h, ccn_charbuf_as_string(addr));
+    npe->forwarding = NULL;
+    pp = &npe->forwarding;
+    for (i = 0; i < n; i++) {
+        for (pf = &old; *pf != NULL; pf = &(*pf)->next)
+            if ((*pf)->faceid == fwd[i].faceid)
+                break;
+        f = *pf;
+        if (f != NULL)
+            *pf = f->next;
+        else {
+            f = calloc(1, sizeof(*f));
+            if (f == NULL)
+                break;
+            if (accelerate && (fwd[i].flags & CCN_FORW_ACTIVE) != 0) {
+                if (fresh == NULL)
+                    fresh = indexbuf_obtain(h);
+                ccn_indexbuf_append_element(fresh, fwd[i].faceid);
+            }
         }
-        while ((0 < ch && ch <= ' ') || ch == ',' || ch == ';')
-            ch = addrs[++i];
+        f->faceid = fwd[i].faceid;
+        f->flags = fwd[i].flags;
+        f->expires = fwd[i].expires;
+        f->next = NULL;
+        *pp = f;
+        pp = &f->next;
+    }
+    while (old != NULL) {
+        f = old;
+        old = f->next;
+        free(f);
+    }
+    if (fresh != NULL) {
+        h->forward_to_gen += 1;
+        for (i = 0; i < fresh->n; i++)
+            update_npe_children(h, npe, fresh->buf[i]);
+        indexbuf_release(h, fresh);
     }
-    ccn_charbuf_destroy(&addr);
-    return(res);
 }
 
 /**
- * Parse a list of ccnx URIs
- *
- * The URIs may be separated by whitespace, commas, or semicolons.
+ * The usec clock, as of the last gettime of the thread.
+ */
+static unsigned
+transit_clock(struct ccnd_handle *h)
+{
+    return((unsigned)h->sec * 1000000U + h->usec);
+}
+
+/**
+ * Make a stand-in for the content that a packet has pinned.
  *
- * Errors are logged.
+ * The stand-in holds a pin of its own, and goes away with
+ * transit_release() or, once handed to transit_keep(), with
+ * ccnd_transit_sweep().
+ */
+static struct ccnd_transit *
+transit_create(struct ccnd_handle *h, struct ccnd_packet *p)
+{
+    struct content_entry *origin = p->content;
+    struct content_entry *content;
+    struct ccnd_transit *x;
+    
+    x = calloc(1, sizeof(*x));
+    if (x == NULL)
+        return(NULL);
+    __atomic_add_fetch(&origin->pins, 1, __ATOMIC_RELAXED);
+    x->origin = origin;
+    x->thread = p->store;
+    content = &x->content;
+    content->arrival_faceid = CCN_NOFACEID;
+    content->comps = origin->comps;
+    content->ncomps = origin->ncomps;
+    content->key = origin->key;
+    content->key_size = origin->key_size;
+    content->size = origin->size;
+    content->flags = p->flags | CCN_CONTENT_ENTRY_TRANSIT;
+    if ((p->flags & CCN_CONTENT_ENTRY_DIGEST) != 0)
+        memcpy(content->digest, p->digest, sizeof(content->digest));
+    content->accession = ++(h->accession);
+    enroll_content(h, content);
+    return(x);
+}
+
+static void
+transit_release(struct ccnd_handle *h, struct ccnd_transit *x)
+{
+    if (x->content.sendrefs != 0)
+        content_unref_output(h, &x->content);
+    content_accession_remove(h, &x->content);
+    __atomic_sub_fetch(&x->origin->pins, 1, __ATOMIC_RELEASE);
+    free(x);
+}
+
+/**
+ * Keep a stand-in for as long as its class calls for.
  *
- * @returns a newly-allocated charbuf containing nul-terminated URIs; or
- *          NULL if no valid URIs are found.
+ * Those of CCND_TRANSIT_SEND go as soon as no output refers to them.
+ * The others are kept for a fixed time, so that the link layer can
+ * repair a loss, or a send queue can get to them; then they are treated
+ * as CCND_TRANSIT_SEND.
  */
-static struct ccn_charbuf *
-ccnd_parse_uri_list(struct ccnd_handle *h, const char *what, const char *uris)
+static void
+transit_keep(struct ccnd_handle *h, struct ccnd_transit *x,
+             enum ccnd_transit_class c)
 {
-    struct ccn_charbuf *ans;
-    struct ccn_charbuf *name;
-    int i;
-    size_t j;
-    int res;
-    unsigned char ch;
-    const char *uri;
+    x->next = NULL;
+    if (c == CCND_TRANSIT_SEND) {
+        if (x->content.sendrefs == 0) {
+            transit_release(h, x);
+            return;
+        }
+        x->next = h->transit[c];
+        h->transit[c] = x;
+        return;
+    }
+    x->until = transit_clock(h) + CCND_LINK_RTO_MAX * (CCND_LINK_TRIES + 1);
+    if (c == CCND_TRANSIT_QUEUE)
+        x->until += CCND_TRANSIT_USEC;
+    if (h->transit_last[c] == NULL)
+        h->transit[c] = x;
+    else
+        h->transit_last[c]->next = x;
+    h->transit_last[c] = x;
+}
 
-    if (uris == NULL)
-        return(NULL);
-    ans = ccn_charbuf_create();
-    name = ccn_charbuf_create();
-    for (i = 0, ch = uris[0]; ch != 0;) {
-        while ((0 < ch && ch <= ' ') || ch == ',' || ch == ';')
-            ch = uris[++i];
-        j = ans->length;
-        while (ch > ' ' && ch != ',' && ch != ';') {
-            ccn_charbuf_append_value(ans, ch, 1);
-            ch = uris[++i];
+/**
+ * Tell the thread that stores the content behind a stand-in that the
+ * stand-in answered an interest, so that it counts the hit and keeps
+ * the content fresh in its replacement order - or makes it stale, if
+ * the interest asked for that.
+ */
+static void
+transit_hit(struct ccnd_handle *h, struct content_entry *content, int stale)
+{
+    struct ccnd_transit *x = (struct ccnd_transit *)content;
+    struct ccnd_packet *p;
+    
+    p = ccnd_packet_create(stale ? CCND_PKT_STALE : CCND_PKT_HIT);
+    if (p == NULL)
+        return;
+    packet_pin_content(h, p, content);
+    ccnd_workers_post(h, x->thread, p);
+}
+
+/**
+ * Finish with a stand-in that was a candidate answer to an interest,
+ * keeping it for the send queues if it was sent.
+ */
+static void
+transit_done(struct ccnd_handle *h, struct content_entry *content, int sent)
+{
+    struct ccnd_transit *x = (struct ccnd_transit *)content;
+    
+    if (sent)
+        transit_keep(h, x, CCND_TRANSIT_QUEUE);
+    else
+        transit_release(h, x);
+}
+
+/**
+ * Release the stand-ins that are no longer needed, or all of them.
+ */
+void
+ccnd_transit_sweep(struct ccnd_handle *h, int all)
+{
+    struct ccnd_transit **pp;
+    struct ccnd_transit *x;
+    unsigned now = transit_clock(h);
+    int c;
+    
+    for (c = CCND_TRANSIT_SEND + 1; c < CCND_TRANSIT_N; c++) {
+        /* Each of these lists is in the order the stand-ins may go */
+        while ((x = h->transit[c]) != NULL &&
+               (all || (int)(now - x->until) >= 0)) {
+            h->transit[c] = x->next;
+            if (h->transit[c] == NULL)
+                h->transit_last[c] = NULL;
+            if (all)
+                transit_release(h, x);
+            else
+                transit_keep(h, x, CCND_TRANSIT_SEND);
         }
-        if (j < ans->length) {
-            ccn_charbuf_append_value(ans, 0, 1);
-            uri = (const char *)ans->buf + j;
-            name->length = 0;
-            res = ccn_name_from_uri(name, uri);
-            if (res < 0) {
-                ccnd_msg(h, "%s: invalid ccnx URI: %s", what, uri);
-                ans->length = j;
-            }
+    }
+    for (pp = &h->transit[CCND_TRANSIT_SEND]; (x = *pp) != NULL;) {
+        if (all || x->content.sendrefs == 0) {
+            *pp = x->next;
+            transit_release(h, x);
         }
+        else
+            pp = &x->next;
     }
-    ccn_charbuf_destroy(&name);
-    if (ans->length == 0)
-        ccn_charbuf_destroy(&ans);
-    return(ans);
+}
+
+struct ccnd_packet *
+ccnd_packet_create(enum ccnd_packet_kind kind)
+{
+    struct ccnd_packet *p;
+    
+    p = calloc(1, sizeof(*p));
+    if (p != NULL) {
+        p->kind = kind;
+        p->fd = -1;
+    }
+    return(p);
 }
 
 /**
- * Start a new ccnd instance
- * @param progname - name of program binary, used for locating helpers
- * @param logger - logger function
- * @param loggerdata - data to pass to logger function
+ * Let go of a packet and whatever it holds.
  */
-struct ccnd_handle *
-ccnd_create(const char *progname, ccnd_logger logger, void *loggerdata)
+void
+ccnd_packet_release(struct ccnd_packet *p)
 {
-    char *sockname;
-    const char *portstr;
-    const char *debugstr;
-    const char *entrylimit;
-    const char *mtu;
-    const char *data_pause;
-    const char *tts_default;
-    const char *tts_limit;
-    const char *autoreg;
-    const char *listen_on;
-    int fd;
-    struct ccnd_handle *h;
-    struct hashtb_param param = {0};
+    if (p == NULL)
+        return;
+    if (p->rx != NULL)
+        rxbuf_release(p->rx);
+    ccn_charbuf_destroy(&p->buf);
+    if (p->content != NULL)
+        __atomic_sub_fetch(&p->content->pins, 1, __ATOMIC_RELEASE);
+    /* A datagram socket made for a face goes with it; see face_hand_over() */
+    if (p->kind == CCND_PKT_ADOPT && p->fd != -1 &&
+          (p->flags & CCN_FACE_DGRAM) != 0)
+        close(p->fd);
+    free(p);
+}
+
+/**
+ * Pass on a packet for a face to the thread that now owns the face.
+ *
+ * What the packet holds goes with it; the thread to tell of a hit
+ * on stored content stays the same.
+ */
+static void
+packet_forward(struct ccnd_handle *h, int thread, struct ccnd_packet *p)
+{
+    struct ccnd_packet *q;
     
-    sockname = ccnd_get_local_sockname();
-    h = calloc(1, sizeof(*h));
-    if (h == NULL)
-        return(h);
-    h->logger = logger;
-    h->loggerdata = loggerdata;
-    h->noncegen = &ccnd_plain_nonce;
-    h->logpid = (int)getpid();
-    h->progname = progname;
-    h->debug = -1;
-    h->skiplinks = ccn_indexbuf_create();
-    param.finalize_data = h;
-    h->face_limit = 1024; /* soft limit */
-    h->faces_by_faceid = calloc(h->face_limit, sizeof(h->faces_by_faceid[0]));
-    param.finalize = &finalize_face;
-    h->faces_by_fd = hashtb_create(sizeof(struct face), &param);
-    h->dgram_faces = hashtb_create(sizeof(struct face), &param);
-    param.finalize = 0;
-    h->faceid_by_guid = hashtb_create(sizeof(unsigned), &param);
-    param.finalize = &finalize_content;
-    h->content_tab = hashtb_create(sizeof(struct content_entry), &param);
-    param.finalize = &finalize_nameprefix;
-    h->nameprefix_tab = hashtb_create(sizeof(struct nameprefix_entry), &param);
-    param.finalize = &finalize_interest;
-    h->interest_tab = hashtb_create(sizeof(struct interest_entry), &param);
-    param.finalize = &finalize_guest;
-    h->guest_tab = hashtb_create(sizeof(struct guest_entry), &param);
-    param.finalize = 0;
-    h->sparse_straggler_tab = hashtb_create(sizeof(struct sparse_straggler_entry), NULL);
-    h->min_stale = ~0;
-    h->max_stale = 0;
-    h->send_interest_scratch = ccn_charbuf_create();
-    h->unsol = ccn_indexbuf_create();
-    h->ticktock.descr[0] = 'C';
-    h->ticktock.micros_per_base = 1000000;
-    h->ticktock.gettime = &ccnd_gettime;
-    h->ticktock.data = h;
-    h->sched = ccn_schedule_create(h, &h->ticktock);
-    h->starttime = h->sec;
-    h->starttime_usec = h->usec;
-    h->wtnow = 0xFFFF0000; /* provoke a rollover early on */
-    h->oldformatcontentgrumble = 1;
-    h->oldformatinterestgrumble = 1;
-    debugstr = getenv("CCND_DEBUG");
-    if (debugstr != NULL && debugstr[0] != 0) {
-        h->debug = atoi(debugstr);
-        if (h->debug == 0 && debugstr[0] != '0')
-            h->debug = 1;
-    }
-    else
-        h->debug = 1;
-    portstr = getenv(CCN_LOCAL_PORT_ENVNAME);
-    if (portstr == NULL || portstr[0] == 0 || strlen(portstr) > 10)
-        portstr = CCN_DEFAULT_UNICAST_PORT;
-    h->portstr = portstr;
-    entrylimit = getenv("CCND_CAP");
-    h->capacity = ~0;
-    if (entrylimit != NULL && entrylimit[0] != 0) {
-        h->capacity = atol(entrylimit);
-        if (h->capacity == 0)
-            h->force_zero_freshness = 1;
-        if (h->capacity <= 0)
-            h->capacity = 10;
+    q = ccnd_packet_create(p->kind);
+    if (q == NULL)
+        return;
+    q->faceid = p->faceid;
+    q->origin = p->origin;
+    q->probe = p->probe;
+    q->store = p->store;
+    q->flags = p->flags;
+    q->dtag = p->dtag;
+    q->msg = p->msg;
+    q->size = p->size;
+    q->rx = p->rx;
+    p->rx = NULL;
+    q->buf = p->buf;
+    p->buf = NULL;
+    q->content = p->content;
+    p->content = NULL;
+    memcpy(q->digest, p->digest, sizeof(q->digest));
+    ccnd_workers_post(h, thread, q);
+}
+
+/**
+ * Send content that another thread has pinned for a face of this one.
+ */
+static void
+packet_send_content(struct ccnd_handle *h, struct face *face,
+                    struct ccnd_packet *p)
+{
+    struct ccnd_transit *x;
+    
+    x = transit_create(h, p);
+    if (x == NULL)
+        return;
+    ccnd_meter_bump(h, face->meter[FM_DATO], 1);
+    if (!send_fragments(h, face, &x->content))
+        stuff_and_send(h, face, x->content.key, x->content.size, NULL, 0,
+                       &x->content, NULL, 0);
+    transit_keep(h, x, (face->link != NULL) ? CCND_TRANSIT_LINK :
+                                              CCND_TRANSIT_SEND);
+}
+
+/**
+ * An interest with a short name, held on the main thread while the
+ * shards look in their stores.
+ *
+ * A name with fewer than CCND_WORKER_NAMECOMPS components does not pick
+ * a shard, so content that matches it may be in any of them.  Each shard
+ * sends back the match it would have answered with, and the best of
+ * these, and of the store of the main thread, is chosen as a single
+ * store would have chosen.
+ */
+struct ccnd_probe {
+    struct ccnd_probe *next;
+    unsigned serial;
+    unsigned faceid;            /**< where the interest arrived */
+    struct ccnd_packet *interest; /**< holds the message */
+    int rightmost;              /**< it asks for the rightmost child */
+    int level;                  /**< components in its name */
+    int pending;                /**< shards that have yet to answer */
+    struct ccnd_transit *best;  /**< best match so far, or NULL */
+    struct ccn_scheduled_event *ev; /**< gives up on the stragglers */
+};
+
+static struct ccnd_probe *
+probe_lookup(struct ccnd_handle *h, unsigned serial)
+{
+    struct ccnd_probe *probe;
+    
+    for (probe = h->probes; probe != NULL; probe = probe->next)
+        if (probe->serial == serial)
+            return(probe);
+    return(NULL);
+}
+
+/**
+ * Take the best match that the shards found, if any.
+ *
+ * The caller then owns the stand-in, and passes it to transit_done().
+ */
+static struct content_entry *
+probe_take(struct ccnd_probe *probe)
+{
+    struct ccnd_transit *x;
+    
+    if (probe == NULL || probe->best == NULL)
+        return(NULL);
+    x = probe->best;
+    probe->best = NULL;
+    return(&x->content);
+}
+
+/**
+ * Remove a probe from the list and free it.
+ */
+static void
+probe_destroy(struct ccnd_handle *h, struct ccnd_probe *probe)
+{
+    struct ccnd_probe **pp;
+    
+    for (pp = &h->probes; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp == probe) {
+            *pp = probe->next;
+            break;
+        }
     }
-    ccnd_msg(h, "CCND_DEBUG=%d CCND_CAP=%lu", h->debug, h->capacity);
-    h->mtu = 0;
-    mtu = getenv("CCND_MTU");
-    if (mtu != NULL && mtu[0] != 0) {
-        h->mtu = atol(mtu);
-        if (h->mtu < 0)
-            h->mtu = 0;
-        if (h->mtu > 8800)
-            h->mtu = 8800;
+    if (probe->ev != NULL)
+        ccn_schedule_cancel(h->sched, probe->ev);
+    if (probe->best != NULL)
+        transit_release(h, probe->best);
+    ccnd_packet_release(probe->interest);
+    free(probe);
+}
+
+/**
+ * Free the probes still waiting.
+ *
+ * This must come before the shards go away, for their content is pinned.
+ */
+static void
+probes_destroy(struct ccnd_handle *h)
+{
+    while (h->probes != NULL)
+        probe_destroy(h, h->probes);
+}
+
+/**
+ * Answer the interest of a probe, now that the shards have had their say.
+ */
+static void
+probe_finish(struct ccnd_handle *h, struct ccnd_probe *probe)
+{
+    struct ccn_parsed_interest parsed_interest = {0};
+    struct ccn_parsed_interest *pi = &parsed_interest;
+    struct ccnd_packet *p = probe->interest;
+    struct ccn_indexbuf *comps;
+    struct ccn_charbuf *rx_buf = h->rx_buf;
+    struct ccnd_rxbuf *rx_ref = h->rx_ref;
+    struct face *face;
+    
+    face = face_from_faceid(h, probe->faceid);
+    if (face != NULL) {
+        comps = indexbuf_obtain(h);
+        if (ccn_parse_interest(p->msg, p->size, pi, comps) >= 0) {
+            /* What is sent on from here may refer to the same buffer */
+            h->rx_buf = p->rx->buf;
+            h->rx_ref = p->rx;
+            interest_lookup(h, face, (unsigned char *)p->msg, p->size,
+                            pi, comps, probe);
+            h->rx_buf = rx_buf;
+            h->rx_ref = rx_ref;
+        }
+        indexbuf_release(h, comps);
     }
-    h->data_pause_microsec = 10000;
-    data_pause = getenv("CCND_DATA_PAUSE_MICROSEC");
-    if (data_pause != NULL && data_pause[0] != 0) {
-        h->data_pause_microsec = atol(data_pause);
-        if (h->data_pause_microsec == 0)
-            h->data_pause_microsec = 1;
-        if (h->data_pause_microsec > 1000000)
-            h->data_pause_microsec = 1000000;
+    probe_destroy(h, probe);
+}
+
+/**
+ * Scheduled event that answers the interest of a probe without the
+ * shards that have not answered, in case a packet was lost.
+ */
+static int
+probe_expire(struct ccn_schedule *sched,
+             void *clienth,
+             struct ccn_scheduled_event *ev,
+             int flags)
+{
+    struct ccnd_handle *h = clienth;
+    struct ccnd_probe *probe;
+    (void)(sched);
+    
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0)
+        return(0);
+    probe = probe_lookup(h, ev->evint);
+    if (probe != NULL) {
+        probe->ev = NULL;
+        probe_finish(h, probe);
     }
-    h->tts_default = -1;
-    tts_default = getenv("CCND_DEFAULT_TIME_TO_STALE");
-    if (tts_default != NULL && tts_default[0] != 0) {
-        h->tts_default = atoi(tts_default);
-        if (h->tts_default <= 0)
-            h->tts_default = -1;
-        ccnd_msg(h, "CCND_DEFAULT_TIME_TO_STALE=%d", h->tts_default);
+    return(0);
+}
+
+/**
+ * Ask the shards to look in their stores for an interest whose name
+ * is too short to pick a shard, before it is answered here.
+ *
+ * interest_lookup() is called again with the probe once every shard has
+ * answered, or after CCND_PROBE_USEC if an answer went astray.
+ * @returns 0 if the shards were asked, or -1 if the interest should be
+ *          answered from this store alone.
+ */
+static int
+interest_probe(struct ccnd_handle *h, struct face *face,
+               const unsigned char *msg, size_t size,
+               const struct ccn_parsed_interest *pi,
+               struct ccn_indexbuf *comps)
+{
+    struct ccnd_probe *probe;
+    struct ccnd_probe **pp;
+    struct ccnd_packet *p;
+    int n = ccnd_workers_count(h);
+    int i;
+    
+    probe = calloc(1, sizeof(*probe));
+    if (probe == NULL)
+        return(-1);
+    probe->interest = ccnd_packet_create(CCND_PKT_PROBE);
+    if (probe->interest == NULL ||
+        rx_hold(h, probe->interest, msg, size) < 0) {
+        ccnd_packet_release(probe->interest);
+        free(probe);
+        return(-1);
     }
-    h->tts_limit = ~0U;
-    tts_limit = getenv("CCND_MAX_TIME_TO_STALE");
-    if (tts_limit != NULL && tts_limit[0] != 0) {
-        h->tts_limit = atoi(tts_limit);
-        if (h->tts_limit <= 0)
-            h->tts_limit = -1;
-        else if (h->tts_limit > ((1U<<31) / 1000000))
-            h->tts_limit = (1U<<31) / 1000000;
-        ccnd_msg(h, "CCND_MAX_TIME_TO_STALE=%d", h->tts_limit);
+    probe->serial = ++(h->probe_serial);
+    probe->faceid = face->faceid;
+    probe->rightmost = pi->orderpref & 1;
+    probe->level = comps->n - 1;
+    for (i = 1; i <= n; i++) {
+        p = ccnd_packet_create(CCND_PKT_PROBE);
+        if (p == NULL)
+            continue;
+        p->rx = probe->interest->rx;
+        __atomic_add_fetch(&p->rx->refs, 1, __ATOMIC_RELAXED);
+        p->msg = probe->interest->msg;
+        p->size = probe->interest->size;
+        p->probe = probe->serial;
+        if (ccnd_workers_post(h, i, p) == 0)
+            probe->pending++;
+    }
+    if (probe->pending == 0) {
+        ccnd_packet_release(probe->interest);
+        free(probe);
+        return(-1);
     }
-    listen_on = getenv("CCND_LISTEN_ON");
-    autoreg = getenv("CCND_AUTOREG");
+    probe->ev = ccn_schedule_event(h->sched, CCND_PROBE_USEC, probe_expire,
+                                   NULL, probe->serial);
+    for (pp = &h->probes; *pp != NULL; pp = &(*pp)->next)
+        continue;
+    *pp = probe;
+    return(0);
+}
+
+/**
+ * Consider content pinned by a packet as an answer to a probe.
+ *
+ * What a shard found is known to match; content offered to the main
+ * thread since is checked here.
+ */
+static void
+probe_offer(struct ccnd_handle *h, struct ccnd_probe *probe,
+            struct ccnd_packet *p, int check)
+{
+    struct ccn_parsed_interest parsed_interest = {0};
+    struct ccn_parsed_interest *pi = &parsed_interest;
+    struct ccnd_packet *q = probe->interest;
+    struct ccn_indexbuf *comps;
+    struct ccnd_transit *x;
+    int res = 1;
     
-    if (autoreg != NULL && autoreg[0] != 0) {
-        h->autoreg = ccnd_parse_uri_list(h, "CCND_AUTOREG", autoreg);
-        if (h->autoreg != NULL)
-            ccnd_msg(h, "CCND_AUTOREG=%s", autoreg);
+    x = transit_create(h, p);
+    if (x == NULL)
+        return;
+    if (check) {
+        comps = indexbuf_obtain(h);
+        res = (ccn_parse_interest(q->msg, q->size, pi, comps) >= 0 &&
+               content_matches_interest(h, &x->content, q->msg, q->size,
+                                        pi, NULL));
+        indexbuf_release(h, comps);
+    }
+    if (!res) {
+        transit_release(h, x);
+        return;
     }
-    if (listen_on != NULL && listen_on[0] != 0)
-        ccnd_msg(h, "CCND_LISTEN_ON=%s", listen_on);
-    // if (h->debug & 256)
-        h->noncegen = &ccnd_debug_nonce;
-    /* Do keystore setup early, it takes a while the first time */
-    ccnd_init_internal_keystore(h);
-    ccnd_reseed(h);
-    if (h->face0 == NULL) {
-        struct face *face;
-        face = calloc(1, sizeof(*face));
-        face->recv_fd = -1;
-        face->sendface = 0;
-        face->flags = (CCN_FACE_GG | CCN_FACE_LOCAL);
-        h->face0 = face;
+    if (probe->best != NULL &&
+        !content_preferred(h, &x->content, &probe->best->content,
+                           probe->rightmost, probe->level)) {
+        transit_release(h, x);
+        return;
     }
-    enroll_face(h, h->face0);
-    fd = create_local_listener(h, sockname, 42);
-    if (fd == -1)
-        ccnd_msg(h, "%s: %s", sockname, strerror(errno));
-    else
-        ccnd_msg(h, "listening on %s", sockname);
-    h->flood = (h->autoreg != NULL);
-    h->ipv4_faceid = h->ipv6_faceid = CCN_NOFACEID;
-    ccnd_listen_on(h, listen_on);
-    reap_needed(h, 55000);
-    age_forwarding_needed(h);
-    ccnd_internal_client_start(h);
-    free(sockname);
-    sockname = NULL;
-    return(h);
+    if (probe->best != NULL)
+        transit_release(h, probe->best);
+    probe->best = x;
 }
 
 /**
- * Shutdown listeners and bound datagram sockets, leaving connected streams.
+ * Take in what a shard found for a probe.
  */
 static void
-ccnd_shutdown_listeners(struct ccnd_handle *h)
+packet_found(struct ccnd_handle *h, struct ccnd_packet *p)
 {
-    struct hashtb_enumerator ee;
-    struct hashtb_enumerator *e = &ee;
-    for (hashtb_start(h->faces_by_fd, e); e->data != NULL;) {
-        struct face *face = e->data;
-        if ((face->flags & (CCN_FACE_MCAST | CCN_FACE_PASSIVE)) != 0)
-            hashtb_delete(e);
-        else
-            hashtb_next(e);
-    }
-    hashtb_end(e);
+    struct ccnd_probe *probe;
+    
+    probe = probe_lookup(h, p->probe);
+    if (probe == NULL)
+        return; /* too late */
+    if (p->content != NULL)
+        probe_offer(h, probe, p, 0);
+    if (--probe->pending == 0)
+        probe_finish(h, probe);
 }
 
 /**
- * Destroy the ccnd instance, releasing all associated resources.
+ * Look in the store of a shard for the interest of a probe, and say
+ * what was found.
  */
-void
-ccnd_destroy(struct ccnd_handle **pccnd)
+static void
+packet_probe(struct ccnd_handle *h, struct ccnd_packet *p)
 {
-    struct ccnd_handle *h = *pccnd;
-    if (h == NULL)
+    struct ccn_parsed_interest parsed_interest = {0};
+    struct ccn_parsed_interest *pi = &parsed_interest;
+    struct ccn_indexbuf *comps = indexbuf_obtain(h);
+    struct content_entry *content = NULL;
+    struct ccnd_packet *r;
+    
+    if (ccn_parse_interest(p->msg, p->size, pi, comps) >= 0)
+        content = cs_lookup(h, p->msg, p->size, pi, comps);
+    indexbuf_release(h, comps);
+    r = ccnd_packet_create(CCND_PKT_FOUND);
+    if (r == NULL)
         return;
-    ccnd_shutdown_listeners(h);
-    ccnd_internal_client_stop(h);
-    ccn_schedule_destroy(&h->sched);
-    hashtb_destroy(&h->dgram_faces);
-    hashtb_destroy(&h->faces_by_fd);
-    hashtb_destroy(&h->faceid_by_guid);
-    hashtb_destroy(&h->content_tab);
-    hashtb_destroy(&h->interest_tab);
-    hashtb_destroy(&h->nameprefix_tab);
-    hashtb_destroy(&h->sparse_straggler_tab);
-    hashtb_destroy(&h->guest_tab);
-    if (h->fds != NULL) {
-        free(h->fds);
-        h->fds = NULL;
-        h->nfds = 0;
-    }
-    if (h->faces_by_faceid != NULL) {
-        free(h->faces_by_faceid);
-        h->faces_by_faceid = NULL;
-        h->face_limit = h->face_gen = 0;
-    }
-    if (h->content_by_accession != NULL) {
-        free(h->content_by_accession);
-        h->content_by_accession = NULL;
-        h->content_by_accession_window = 0;
-    }
-    ccn_charbuf_destroy(&h->send_interest_scratch);
-    ccn_charbuf_destroy(&h->scratch_charbuf);
-    ccn_charbuf_destroy(&h->autoreg);
-    ccn_indexbuf_destroy(&h->skiplinks);
-    ccn_indexbuf_destroy(&h->scratch_indexbuf);
-    ccn_indexbuf_destroy(&h->unsol);
-    if (h->face0 != NULL) {
-        ccn_charbuf_destroy(&h->face0->inbuf);
-        ccn_charbuf_destroy(&h->face0->outbuf);
-        free(h->face0);
-        h->face0 = NULL;
+    r->probe = p->probe;
+    if (content != NULL)
+        packet_pin_content(h, r, content);
+    ccnd_workers_post(h, p->thread, r);
+}
+
+/**
+ * Account for an answer sent from this store by another thread.
+ */
+static void
+packet_hit(struct ccnd_handle *h, struct ccnd_packet *p)
+{
+    h->cs_hits++;
+    content_lru_insert(h, p->content, 0);
+    if (p->kind == CCND_PKT_STALE)
+        mark_stale(h, p->content);
+}
+
+/**
+ * Offer content that a shard has stored to the interests pending here,
+ * and to the probes still waiting.
+ */
+static void
+packet_match(struct ccnd_handle *h, struct ccnd_packet *p)
+{
+    struct ccnd_transit *x;
+    struct ccnd_probe *probe;
+    int n;
+    
+    for (probe = h->probes; probe != NULL; probe = probe->next)
+        probe_offer(h, probe, p, 1);
+    x = transit_create(h, p);
+    if (x == NULL)
+        return;
+    x->content.arrival_faceid = p->faceid;
+    n = match_interests(h, &x->content, NULL, NULL,
+                        face_from_faceid(h, p->faceid));
+    if (n > 0)
+        transit_keep(h, x, CCND_TRANSIT_QUEUE);
+    else
+        transit_release(h, x);
+}
+
+/**
+ * Do what a packet posted to this thread asks.
+ *
+ * The packet is released by the caller.
+ */
+void
+ccnd_packet_handle(struct ccnd_handle *h, struct ccnd_packet *p)
+{
+    struct face *face;
+    
+    switch (p->kind) {
+        case CCND_PKT_INPUT:
+            if (h->worker != NULL)
+                face = ccnd_worker_face(h, p->faceid, p->flags, p->thread);
+            else
+                face = face_from_faceid(h, p->faceid);
+            if (face == NULL)
+                return;
+            /* What is sent on from here may refer to the same buffer */
+            h->rx_buf = p->rx->buf;
+            h->rx_ref = p->rx;
+            if (p->dtag == CCN_DTAG_Interest)
+                process_incoming_interest(h, face,
+                                          (unsigned char *)p->msg, p->size);
+            else
+                process_incoming_content(h, face,
+                                         (unsigned char *)p->msg, p->size);
+            h->rx_buf = NULL;
+            h->rx_ref = NULL;
+            return;
+        case CCND_PKT_SEND:
+        case CCND_PKT_CONTENT:
+            face = face_from_faceid(h, p->faceid);
+            if (face == NULL || (face->flags & CCN_FACE_NOSEND) != 0)
+                return;
+            if (face->owner != h->thread) {
+                /* The face has been handed over since this was posted */
+                packet_forward(h, face->owner, p);
+                return;
+            }
+            h->interest_faceid = p->origin;
+            if (p->kind == CCND_PKT_CONTENT) {
+                packet_send_content(h, face, p);
+                return;
+            }
+            ccnd_meter_bump(h, face->meter[FM_INTO], 1);
+            stuff_and_send(h, face, p->msg, p->size, NULL, 0, NULL, NULL, 0);
+            return;
+        case CCND_PKT_MATCH:
+            packet_match(h, p);
+            return;
+        case CCND_PKT_PROBE:
+            packet_probe(h, p);
+            return;
+        case CCND_PKT_FOUND:
+            packet_found(h, p);
+            return;
+        case CCND_PKT_HIT:
+        case CCND_PKT_STALE:
+            packet_hit(h, p);
+            return;
+        case CCND_PKT_ADOPT:
+            packet_adopt(h, p);
+            return;
+        case CCND_PKT_DROP:
+            face = face_from_faceid(h, p->faceid);
+            if (face != NULL && face->owner == h->thread)
+                face_io_close(h, face);
+            return;
+        case CCND_PKT_GONE:
+            face = face_from_faceid(h, p->faceid);
+            if (face == NULL || face->owner != p->thread)
+                return;
+            face->owner = h->thread;
+            ccnd_destroy_face(h, face->faceid);
+            return;
+        case CCND_PKT_REPORT:
+            packet_report(h, p);
+            return;
+        case CCND_PKT_RAW:
+            face = face_from_faceid(h, p->faceid);
+            if (face == NULL || face->owner != h->thread || face->recv_fd == -1)
+                return;
+            h->rx_buf = p->rx->buf;
+            h->rx_ref = p->rx;
+            process_input_dgram(h, face, (unsigned char *)p->msg, p->size,
+                                NULL, 0);
+            h->rx_buf = NULL;
+            h->rx_ref = NULL;
+            return;
     }
-    free(h);
-    *pccnd = NULL;
 }
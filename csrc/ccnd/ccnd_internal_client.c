@@ -964,6 +964,7 @@ ccnd_req_guest(struct ccn_closure *selfp,
 #define OP_SERVICE     0x0800
 #define OP_ADJACENCY   0x0900
 #define OP_GUEST       0x0A00
+#define OP_SNAPSHOT    0x0B00
 
 /**
  * Common interest handler for ccnd_internal_client
@@ -1069,6 +1070,10 @@ ccnd_answer_req(struct ccn_closure *selfp,
             reply_body = ccn_charbuf_create();
             res = ccnd_req_unreg(ccnd, final_comp, final_size, reply_body);
             break;
+        case OP_SNAPSHOT:
+            reply_body = ccn_charbuf_create();
+            res = ccnd_req_snapshot(ccnd, final_comp, final_size, reply_body);
+            break;
         case OP_NOTICE:
             ccnd_start_notice(ccnd);
             goto Bail;
@@ -1469,6 +1474,7 @@ ccnd_face_status_change(struct ccnd_handle *ccnd, unsigned faceid)
 {
     struct ccn_indexbuf *chface = ccnd->chface;
     
+    ccnd->faces_changed++; /* the workers need to know, too */
     if (chface != NULL) {
         ccn_indexbuf_set_insert(chface, faceid);
         if (ccnd->notice_push == NULL)
@@ -1541,6 +1547,8 @@ ccnd_internal_client_start(struct ccnd_handle *ccnd)
                     &ccnd_answer_req, OP_SELFREG + MUST_VERIFY1);
     ccnd_uri_listen(ccnd, "ccnx:/ccnx/" CCND_ID_TEMPL "/unreg",
                     &ccnd_answer_req, OP_UNREG + MUST_VERIFY1);
+    ccnd_uri_listen(ccnd, "ccnx:/ccnx/" CCND_ID_TEMPL "/snapshot",
+                    &ccnd_answer_req, OP_SNAPSHOT + MUST_VERIFY1);
     ccnd_uri_listen(ccnd, "ccnx:/ccnx/" CCND_ID_TEMPL "/" CCND_NOTICE_NAME,
                     &ccnd_answer_req, OP_NOTICE);
     ccnd_uri_listen(ccnd, "ccnx:/%C1.M.S.localhost/%C1.M.SRV/ccnd",
@@ -198,16 +198,33 @@ const char *ccnd_usage_message =
     "    CCND_CAP=\n"
     "      Capacity limit, in count of ContentObjects.\n"
     "      Not an absolute limit.\n"
+    "    CCND_CS_BYTES=\n"
+    "      Content store budget, in bytes, including per-object overhead.\n"
+    "      Least recently used ContentObjects are evicted first.\n"
     "    CCND_MTU=\n"
     "      Packet size in bytes.\n"
     "      If set, interest stuffing is allowed within this budget.\n"
-    "      Single items larger than this are not precluded.\n"
+    "      Single items larger than this are sent whole, except that\n"
+    "      ContentObjects go as LinkFragments to a unicast datagram peer\n"
+    "      that has said it reassembles them.\n"
     "    CCND_DATA_PAUSE_MICROSEC=\n"
     "      Adjusts content-send delay time for multicast and udplink faces\n"
+    "    CCND_DATA_BURST=\n"
+    "      Max ContentObjects sent on a face at each turn (default 2, limit 64).\n"
+    "    CCND_DGRAM_BATCH=\n"
+    "      Max datagrams per recvmmsg/sendmmsg call where supported (default 32).\n"
+    "      Set to 1 to use one system call per datagram.\n"
+    "    CCND_LINK_RELIABLE=\n"
+    "      Set to 1 to repair lost content on unicast UDP faces.\n"
+    "    CCND_WORKERS=\n"
+    "      Number of threads that forward, each with a share of the PIT and\n"
+    "      content store; 0 or 1 means forward on the main thread\n"
     "    CCND_DEFAULT_TIME_TO_STALE=\n"
     "      Default for content objects without explicit FreshnessSeconds\n"
     "    CCND_MAX_TIME_TO_STALE=\n"
     "      Limit, in seconds, until content becomes stale\n"
+    "    CCND_CS_SNAPSHOT=\n"
+    "      File for saving the content store at exit; reloaded at startup\n"
     "    CCND_KEYSTORE_DIRECTORY=\n"
     "      Directory readable only by ccnd where its keystores are kept\n"
     "      Defaults to a private subdirectory of /var/tmp\n"
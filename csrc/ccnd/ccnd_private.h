@@ -28,6 +28,7 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
@@ -45,6 +46,8 @@ struct ccn_charbuf;
 struct ccn_indexbuf;
 struct hashtb;
 struct ccnd_meter;
+struct epoll_event;
+struct ccnd_dgram_rbatch;
 
 /*
  * These are defined in this header.
@@ -52,6 +55,8 @@ struct ccnd_meter;
 struct ccnd_handle;
 struct face;
 struct content_entry;
+struct content_expiry_slot;
+struct content_trie_node;
 struct nameprefix_entry;
 struct interest_entry;
 struct guest_entry;
@@ -59,6 +64,18 @@ struct pit_face_item;
 struct content_tree_node;
 struct ccn_forwarding;
 struct ccn_strategy;
+struct ccn_strategy_class;
+struct ccnd_link;
+struct ccnd_frag_set;
+struct ccnd_dgram_sendq;
+struct ccnd_outchunk;
+struct ccn_pool;
+struct ccnd_worker;
+struct ccnd_workers;
+struct ccnd_rxbuf;
+struct ccnd_transit;
+struct ccnd_probe;
+struct ccnd_face_report;
 
 //typedef uint_least64_t ccn_accession_t;
 typedef unsigned ccn_accession_t;
@@ -72,6 +89,17 @@ typedef uint32_t ccn_wrappedtime;
 
 typedef int (*ccnd_logger)(void *loggerdata, const char *format, va_list ap);
 
+/**
+ * How long a thread keeps its stand-in for content stored by another
+ * thread (see struct ccnd_transit in ccnd.c).
+ */
+enum ccnd_transit_class {
+    CCND_TRANSIT_SEND,          /**< until the output is written */
+    CCND_TRANSIT_LINK,          /**< until the link layer cannot resend it */
+    CCND_TRANSIT_QUEUE,         /**< until the send queues are done with it */
+    CCND_TRANSIT_N
+};
+
 /**
  * We pass this handle almost everywhere within ccnd
  */
@@ -84,7 +112,7 @@ struct ccnd_handle {
     struct hashtb *nameprefix_tab;  /**< keyed by name prefix components */
     struct hashtb *interest_tab;    /**< keyed by interest msg sans Nonce */
     struct hashtb *guest_tab;       /**< keyed by faceid */
-    struct ccn_indexbuf *skiplinks; /**< skiplist for content-ordered ops */
+    struct content_trie_node *content_trie; /**< name-ordered content index */
     unsigned forward_to_gen;        /**< for forward_to updates */
     unsigned face_gen;              /**< faceid generation number */
     unsigned face_rover;            /**< for faceid allocation */
@@ -94,11 +122,23 @@ struct ccnd_handle {
     struct ccn_scheduled_event *age;
     struct ccn_scheduled_event *clean;
     struct ccn_scheduled_event *age_forwarding;
+    struct ccn_scheduled_event *expiry; /**< sweeps the expiry ring */
+    struct content_expiry_slot *expiry_ring; /**< CCND_EXPIRY_SLOTS slots */
+    long expiry_swept;              /**< last second swept */
+    unsigned long expiry_count;     /**< entries in the expiry ring */
     const char *portstr;            /**< "main" port number */
     unsigned ipv4_faceid;           /**< wildcard IPv4, bound to port */
     unsigned ipv6_faceid;           /**< wildcard IPv6, bound to port */
     nfds_t nfds;                    /**< number of entries in fds array */
     struct pollfd *fds;             /**< used for poll system call */
+    int epfd;                       /**< epoll instance, or -1 to use poll */
+    int nevents;                    /**< number of entries in events array */
+    int nready;                     /**< events not yet dispatched */
+    struct epoll_event *events;     /**< used for epoll_wait system call */
+    int dgram_batch;                /**< max datagrams per recvmmsg/sendmmsg */
+    struct ccnd_dgram_rbatch *dgram_rbatch; /**< recvmmsg scratch space */
+    struct ccn_indexbuf *dgram_flush; /**< faceids with queued datagrams */
+    struct ccn_indexbuf *stream_flush; /**< faceids with new stream output */
     struct ccn_gettime ticktock;    /**< our time generator */
     long sec;                       /**< cached gettime seconds */
     unsigned usec;                  /**< cached gettime microseconds */
@@ -108,6 +148,7 @@ struct ccnd_handle {
     unsigned starttime_usec;        /**< ccnd start time fractional part */
     unsigned iserial;               /**< interest serial number (for logs) */
     struct ccn_schedule *sched;     /**< our schedule */
+    struct ccn_pool *pfi_pool;      /**< for pit_face_items */
     struct ccn_charbuf *send_interest_scratch; /**< for use by send_interest */
     struct ccn_charbuf *scratch_charbuf; /**< one-slot scratch cache */
     struct ccn_indexbuf *scratch_indexbuf; /**< one-slot scratch cache */
@@ -117,13 +158,23 @@ struct ccnd_handle {
     struct content_entry **content_by_accession;
     /** The following holds stragglers that would otherwise bloat the above */
     struct hashtb *sparse_straggler_tab; /* keyed by accession */
+    struct hashtb *nonce_tab;       /**< nonces seen this window */
+    struct hashtb *nonce_old;       /**< nonces seen the window before */
+    long nonce_rotated;             /**< when nonce_tab was started */
     ccn_accession_t accession;      /**< newest used accession number */
-    ccn_accession_t min_stale;      /**< smallest accession of stale content */
-    ccn_accession_t max_stale;      /**< largest accession of stale content */
     unsigned long capacity;         /**< may toss content if there more than
                                      this many content objects in the store */
+    unsigned long cs_bytes_limit;   /**< may toss content if the store uses
+                                     more than this many bytes */
+    unsigned long cs_bytes;         /**< bytes charged to stored content */
+    struct content_entry *lru_oldest; /**< next content to be evicted */
+    struct content_entry *lru_newest; /**< most recently used content */
     unsigned long n_stale;          /**< Number of stale content objects */
-    struct ccn_indexbuf *unsol;     /**< unsolicited content */
+    unsigned long cs_hits;          /**< interests answered from the store */
+    unsigned long cs_misses;        /**< store lookups that found nothing */
+    unsigned long cs_evictions;     /**< content removed to stay in budget */
+    unsigned long content_digests;  /**< content digests computed */
+    unsigned long content_digests_avoided; /**< content gone, never digested */
     unsigned long oldformatcontent;
     unsigned long oldformatcontentgrumble;
     unsigned long oldformatinterests;
@@ -134,6 +185,11 @@ struct ccnd_handle {
     unsigned long interests_dropped;
     unsigned long interests_sent;
     unsigned long interests_stuffed;
+    unsigned long interests_looped; /**< dropped by the nonce tables */
+    unsigned long dgram_recv_calls; /**< recvmmsg calls that got data */
+    unsigned long dgram_recv_msgs;  /**< datagrams received by recvmmsg */
+    unsigned long dgram_send_calls; /**< sendmmsg calls that sent data */
+    unsigned long dgram_send_msgs;  /**< datagrams sent by sendmmsg */
     unsigned short seed[3];         /**< for PRNG */
     int running;                    /**< true while should be running */
     int debug;                      /**< For controlling debug output */
@@ -157,10 +213,27 @@ struct ccnd_handle {
     struct ccn_scheduled_event *internal_client_refresh;
     struct ccn_scheduled_event *notice_push;
     unsigned data_pause_microsec;   /**< tunable, see choose_face_delay() */
+    int data_burst;                 /**< max ContentObjects per content_sender */
     int (*noncegen)(struct ccnd_handle *, struct face *, unsigned char *);
                                     /**< pluggable nonce generation */
     int tts_default;                /**< CCND_DEFAULT_TIME_TO_STALE (seconds) */
     int tts_limit;                  /**< CCND_MAX_TIME_TO_STALE (seconds) */
+    const char *cs_snapshot;        /**< CCND_CS_SNAPSHOT file, or NULL */
+    int link_reliable;              /**< CCND_LINK_RELIABLE */
+    struct ccn_scheduled_event *link_timer; /**< link acks and retransmits */
+    unsigned faces_changed;         /**< count of face status changes */
+    struct ccnd_workers *workers;   /**< CCND_WORKERS threads, or NULL */
+    struct ccnd_worker *worker;     /**< set in a worker's shard */
+    int thread;                     /**< 0 for the main thread, or worker + 1 */
+    struct ccn_charbuf *rx_buf;     /**< holds the input being processed */
+    struct ccnd_rxbuf *rx_ref;      /**< rx_buf, once another thread has it */
+    struct ccnd_transit *transit[CCND_TRANSIT_N]; /**< stand-ins kept */
+    struct ccnd_transit *transit_last[CCND_TRANSIT_N];
+    struct ccnd_probe *probes;      /**< short interests awaiting the shards */
+    unsigned probe_serial;          /**< for telling probes apart */
+    struct ccn_indexbuf *handover;  /**< faces to hand to the workers */
+    struct ccn_indexbuf *io_faces;  /**< faces whose i/o a worker does */
+    long io_report_sec;             /**< when they were last reported */
 };
 
 /**
@@ -173,13 +246,24 @@ struct ccnd_handle {
 #define FACESLOTBITS 18
 #define MAXFACES ((1U << FACESLOTBITS) - 1)
 
+/**
+ * Content waiting to be sent on a face, first in first out.
+ *
+ * Entry number seq (counting from when the queue was made) is kept in
+ * ring[seq & (ring_size - 1)].  An entry of 0 was withdrawn.
+ * Which content is queued on the face is found from face->queued,
+ * rather than by searching.
+ */
 struct content_queue {
     unsigned burst_nsec;             /**< nsec per KByte, limits burst rate */
     unsigned min_usec;               /**< minimum delay for this queue */
     unsigned rand_usec;              /**< randomization range */
     unsigned ready;                  /**< # that have waited enough */
     unsigned nrun;                   /**< # sent since last randomized delay */
-    struct ccn_indexbuf *send_queue; /**< accession numbers of pending content */
+    ccn_accession_t *ring;           /**< accession numbers of pending content */
+    unsigned ring_size;              /**< allocated entries, a power of 2 */
+    unsigned head;                   /**< seq of the first entry */
+    unsigned n;                      /**< number of entries */
     struct ccn_scheduled_event *sender;
 };
 
@@ -216,18 +300,38 @@ struct face {
     const unsigned char *guid;  /**< guid name for channel, shared w/ peers */
     struct ccn_charbuf *guid_cob; /**< content object publishing face guid */
     struct content_queue *q[CCN_CQ_N]; /**< outgoing content, per delay class */
+    struct hashtb *queued;      /**< accession => where it is in q[] */
     struct ccn_charbuf *inbuf;
     struct ccn_skeleton_decoder decoder;
-    size_t outbufindex;
-    struct ccn_charbuf *outbuf;
+    struct ccnd_outchunk *outq; /**< stream output not yet written */
+    struct ccnd_outchunk *outq_last; /**< end of outq, for appending */
+    size_t outq_bytes;          /**< bytes waiting in outq */
+    short pollevents;           /**< poll events registered with epoll */
+    short pollreg;              /**< nonzero if recv_fd is registered */
+    struct ccnd_dgram_sendq *sendq; /**< datagrams queued for sendmmsg */
     const struct sockaddr *addr;
     socklen_t addrlen;
     int pending_interests;
     unsigned rrun;
     uintmax_t rseq;
     struct ccnd_meter *meter[CCND_FACE_METER_N];
+    unsigned rate;              /**< content shaping, bytes/sec, 0 for none */
+    unsigned burst;             /**< token bucket depth, in bytes */
+    long long credit;           /**< token bucket, in millionths of a byte */
+    long credit_sec;            /**< when credit was last brought up to date */
+    unsigned credit_usec;
+    unsigned drops;             /**< datagrams dropped for lack of room */
+    unsigned sendq_n;           /**< datagrams waiting in a shared send queue */
     unsigned short pktseq;      /**< sequence number for sent packets */
+    struct ccnd_link *link;     /**< link reliability state, or NULL */
+    unsigned linkhello_usec;    /**< when we last asked for a link hello */
+    unsigned char linkhellos;   /**< link hellos we have asked for */
+    struct ccnd_frag_set *frags; /**< CCND_FRAG_SETS in reassembly, or NULL */
+    unsigned short fragid;      /**< id for the next fragmented object */
     unsigned short adjstate;    /**< state of adjacency negotiotiation */
+    int owner;                  /**< thread that does its i/o, 0 for main */
+    short dropping;             /**< its worker has been asked to give it back */
+    struct ccnd_face_report *report; /**< what its worker last reported */
 };
 
 /** face flags */
@@ -254,17 +358,193 @@ struct face {
 #define CCN_FACE_BC    (1 << 20) /** Needs SO_BROADCAST to send */
 #define CCN_FACE_NBC   (1 << 21) /** Don't use SO_BROADCAST to send */
 #define CCN_FACE_ADJ   (1 << 22) /** Adjacency guid has been negotiatied */
+#define CCN_FACE_LINKACK (1 << 23) /** Peer sends LinkAck link messages */
+#define CCN_FACE_LINKOK (1 << 24) /** Peer takes LinkAck link messages */
+#define CCN_FACE_FRAGOK (1 << 25) /** Peer takes LinkFragment link messages */
 #define CCN_NOFACEID    (~0U)    /** denotes no face */
 
+/** Face flags that the thread doing the face's i/o may change */
+#define CCND_FACE_IO_FLAGS (CCN_FACE_LINK | CCN_FACE_GG | CCN_FACE_NOSEND | \
+    CCN_FACE_CLOSING | CCN_FACE_SEQOK | CCN_FACE_SEQPROBE | CCN_FACE_LC | \
+    CCN_FACE_BC | CCN_FACE_NBC | CCN_FACE_LINKACK | CCN_FACE_LINKOK | \
+    CCN_FACE_FRAGOK)
+
+/** Limits for batched datagram i/o (see CCND_DGRAM_BATCH) */
+#define CCND_DGRAM_BATCH_DEFAULT 32
+#define CCND_DGRAM_BATCH_MAX 64
+#define CCND_DGRAM_BUFSIZE 8800
+
+/** Multi-worker forwarding parameters (see CCND_WORKERS) */
+#define CCND_WORKERS_MAX 64
+#define CCND_WORKER_NAMECOMPS 2     /**< name components that pick a shard */
+#define CCND_WORKER_QUEUE 4096      /**< packets that may wait for a thread */
+#define CCND_WORKER_BATCH 64        /**< packets a thread handles per pass */
+#define CCND_TRANSIT_USEC 1000000   /**< how long queued stand-ins are kept */
+#define CCND_PROBE_USEC 50000       /**< longest wait for the shards' stores */
+
+/** Link reliability parameters (see CCND_LINK_RELIABLE) */
+#define CCND_LINK_WINDOW 64         /**< power of 2 */
+#define CCND_LINK_TRIES 3           /**< most transmissions of one item */
+#define CCND_LINK_ACK_EVERY 8       /**< receipts per LinkAck, at most */
+#define CCND_LINK_DUPTHRESH 3       /**< later receipts that show a loss */
+#define CCND_LINK_TICK 5000         /**< usec between timer runs */
+#define CCND_LINK_RTO_INIT 100000
+#define CCND_LINK_RTO_MIN 20000
+#define CCND_LINK_RTO_MAX 1000000
+#define CCND_LINK_HELLO_TRIES 3     /**< link hellos sent to ask, at most */
+#define CCND_LINK_HELLO_GAP 1000000 /**< usec between them */
+
+/** Bits of a link hello (a LinkAck with a one-byte value) */
+#define CCND_LINK_HELLO_ASK 0x01    /**< please answer with yours */
+#define CCND_LINK_HELLO_ACKS 0x02   /**< sender takes LinkAcks */
+#define CCND_LINK_HELLO_FRAGS 0x04  /**< sender takes LinkFragments */
+
 /**
- *  The content hash table is keyed by the initial portion of the ContentObject
- *  that contains all the parts of the complete name.  The extdata of the hash
- *  table holds the rest of the object, so that the whole ContentObject is
- *  stored contiguously.  The internal form differs from the on-wire form in
- *  that the final content-digest name component is represented explicitly,
- *  which simplifies the matching logic.
- *  The original ContentObject may be reconstructed simply by excising this
- *  last name component, which is easily located via the comps array.
+ * A ContentObject sent on a reliable link and not yet acknowledged.
+ */
+struct ccnd_link_slot {
+    ccn_accession_t accession;  /**< what was sent, or 0 if free */
+    unsigned sent_usec;         /**< microsecond clock when sent */
+    unsigned short seq;         /**< the SequenceNumber it went with */
+    unsigned short tries;       /**< transmissions before this one */
+    unsigned short fragid;      /**< LinkFragment id, if frag >= 0 */
+    short frag;                 /**< fragment index, or -1 for all of it */
+};
+
+/**
+ * Link reliability state for a unicast datagram face.
+ *
+ * The sending side keeps the recently sent ContentObjects, by accession,
+ * in slots indexed by sequence number.  The receiving side keeps the
+ * highest sequence number it has seen and a bitmap of the 32 before it,
+ * which it reports in LinkAck messages.
+ */
+struct ccnd_link {
+    struct ccnd_link_slot slot[CCND_LINK_WINDOW];
+    unsigned srtt;              /**< smoothed link rtt, microseconds */
+    unsigned rttvar;            /**< rtt variation, microseconds */
+    unsigned rto;               /**< retransmit timeout, microseconds */
+    unsigned long retransmits;  /**< ContentObjects sent again */
+    uint32_t rbits;             /**< bit i: rhigh - 1 - i was received */
+    unsigned short rhigh;       /**< highest sequence number received */
+    unsigned short rhave;       /**< nonzero once rhigh is valid */
+    unsigned unacked;           /**< received since our last LinkAck */
+};
+
+/** Link fragmentation parameters (see CCND_MTU) */
+#define CCND_FRAG_SETS 4            /**< objects in reassembly per face */
+#define CCND_FRAG_TIMEOUT 1000000   /**< usec to wait for the rest */
+#define CCND_FRAG_HDR 8             /**< LinkFragment header bytes */
+#define CCND_FRAG_OVERHEAD 48       /**< bytes of mtu kept for framing */
+#define CCND_FRAG_MAX_SIZE 65535    /**< largest object reassembled */
+
+/**
+ * A ContentObject being reassembled from LinkFragment messages.
+ */
+struct ccnd_frag_set {
+    struct ccn_charbuf *buf;    /**< fragments, placed by offset */
+    uint32_t have[8];           /**< bitmap of fragment indices received */
+    unsigned start_usec;        /**< when the first fragment arrived */
+    size_t size;                /**< object size, once the last is in */
+    unsigned step;              /**< length of all but the last, or 0 */
+    unsigned short fragid;      /**< the sender's id for the object */
+    unsigned char count;        /**< fragments in all, or 0 if free */
+    unsigned char got;          /**< fragments received so far */
+};
+
+/** Most pieces a single message is sent in (see stuff_and_send) */
+#define CCND_SENDV_MAX 4
+
+/** Stream output beyond this many bytes holds back content_sender */
+#define CCND_OUTQ_HIWAT (256 * 1024)
+/** Smallest allocation for copied stream output, so small messages share */
+#define CCND_OUTCHUNK_MIN 2048
+
+/** Bytes a face may send per turn on a shared socket (deficit round robin) */
+#define CCND_SENDQ_QUANTUM 1500
+/** Datagrams that may wait on one socket, and on it for any one face */
+#define CCND_SENDQ_SLOTS 256
+#define CCND_SENDQ_FACE_MAX 64
+
+/** Identifies a content store snapshot file (see CCND_CS_SNAPSHOT) */
+#define CCND_SNAPSHOT_MAGIC "CCNDSNAP"
+#define CCND_SNAPSHOT_MAGICSIZE 8
+/** Snapshot format version; files with any other version are ignored */
+#define CCND_SNAPSHOT_VERSION 2
+/** The header is the magic followed by the version (32 bits) */
+#define CCND_SNAPSHOT_HDRSIZE 12
+/** Each record is size, fresh_until and CRC-32 (32 bits each), then data */
+#define CCND_SNAPSHOT_RECSIZE 12
+
+/** Limits for the content burst size (see CCND_DATA_BURST) */
+#define CCND_DATA_BURST_DEFAULT 2
+#define CCND_DATA_BURST_MAX 64
+
+/**
+ * Output waiting for a stream face to become writable.
+ *
+ * A chunk either refers to bytes of a ContentObject that is in the
+ * store, or holds a copy of its bytes.  Should the ContentObject leave
+ * the store first, its chunks are changed into copies.
+ */
+struct ccnd_outchunk {
+    struct ccnd_outchunk *next;
+    struct content_entry *content;  /**< ContentObject referred to, or NULL */
+    const unsigned char *data;      /**< next byte to send */
+    size_t size;                    /**< bytes left to send */
+    size_t room;                    /**< space for more copied bytes */
+    /* copied bytes follow, when content is NULL */
+};
+
+/**
+ * Datagrams waiting to go out on one socket.
+ *
+ * These are accumulated during a pass through the main loop, and sent
+ * with sendmmsg before we wait again.  Each face that shares the socket
+ * has its own queue, and the queues are served by deficit round robin,
+ * CCND_SENDQ_QUANTUM bytes per turn, with the deficits and the turn
+ * carried over from one flush to the next.  If the socket buffer fills,
+ * what is left waits for POLLOUT instead of being dropped, so a face
+ * that sends a lot only ever fills its own queue; datagrams beyond
+ * CCND_SENDQ_FACE_MAX for a face (or CCND_SENDQ_SLOTS in all) are dropped.
+ */
+struct ccnd_dgram_sendq {
+    int n;                          /**< number of queued datagrams */
+    int nflow;                      /**< faces with datagrams queued */
+    int turn;                       /**< index in flow of the face to serve */
+    int fresh;                      /**< nonzero if its quantum is still due */
+    int free;                       /**< first unused slot of pending, or -1 */
+    int blocked;                    /**< nonzero while waiting for POLLOUT */
+    struct ccnd_sendq_flow {
+        unsigned faceid;            /**< face whose queue this is */
+        int head;                   /**< first datagram, an index in pending */
+        int tail;                   /**< last datagram */
+        int n;                      /**< datagrams in this queue */
+        size_t deficit;             /**< bytes it may still send this turn */
+    } flow[CCND_SENDQ_SLOTS];
+    struct ccnd_dgram_pending {
+        int next;                   /**< next in its face's queue, or -1 */
+        unsigned faceid;            /**< face the datagram is addressed to */
+        struct content_entry *content; /**< ContentObject referred to, or NULL */
+        struct ccn_charbuf *data;   /**< copied pieces, or NULL */
+        int npiece;                 /**< number of pieces, 0 if abandoned */
+        struct ccnd_dgram_piece {
+            const unsigned char *ref; /**< bytes in content, or NULL */
+            size_t start;           /**< else offset in data */
+            size_t size;            /**< length in bytes */
+        } piece[CCND_SENDV_MAX];
+        socklen_t addrlen;
+        struct sockaddr_storage addr;
+    } pending[CCND_SENDQ_SLOTS];
+};
+
+/**
+ *  The content hash table is keyed by the whole ContentObject, stored
+ *  contiguously, exactly as it arrived on the wire.  Objects that differ
+ *  anywhere, and so in their implicit digests, have separate entries.
+ *  The final content-digest name component is implicit.  Its value is
+ *  computed only when needed and then kept in the digest field.  The comps
+ *  array covers only the explicit name components.
  */
 struct content_entry {
     ccn_accession_t accession;  /**< assigned in arrival order */
@@ -275,7 +555,52 @@ struct content_entry {
     const unsigned char *key;   /**< ccnb-encoded ContentObject */
     int key_size;               /**< Size of fragment prior to Content */
     int size;                   /**< Size of ContentObject */
-    struct ccn_indexbuf *skiplinks; /**< skiplist for name-ordered ops */
+    int sendrefs;               /**< queued output referring to key */
+    unsigned fresh_until;       /**< wall clock second it goes stale, or 0 */
+    unsigned char digest[32];   /**< SHA-256, if CCN_CONTENT_ENTRY_DIGEST */
+    int pins;                   /**< holds by other threads (atomic) */
+    struct content_trie_node *trie_node; /**< our place in content_trie */
+    struct content_entry *trie_same; /**< next entry with the same name */
+    struct content_entry *lru_prev; /**< toward the eviction end */
+    struct content_entry *lru_next; /**< toward the most recently used end */
+};
+
+/**
+ * Content that goes stale in a given second, modulo CCND_EXPIRY_SLOTS.
+ *
+ * Entries are accessions.  Content that has gone away, or has since been
+ * given a different fresh_until, is simply dropped when its slot is swept.
+ */
+struct content_expiry_slot {
+    ccn_accession_t *accession;
+    int n;
+    int room;
+};
+
+/** Power of 2, larger than the longest freshness period in seconds */
+#define CCND_EXPIRY_SLOTS 4096
+
+/**
+ * A node of the name-ordered content index.
+ *
+ * This is a radix trie keyed by name components.  The edge from the
+ * parent is labelled with one or more component values, and children are
+ * kept in the order used by ccn_compare_names().  Apart from the root, a
+ * node that names no content always has at least two children.
+ * Implicit digest components are not part of the key.  Content objects
+ * that share a name are chained through trie_same in digest order, and
+ * they sort among the node's children as 32-byte components would.
+ */
+struct content_trie_node {
+    struct content_trie_node *parent;
+    struct content_trie_node **child; /**< ordered children */
+    int nchild;                 /**< number of children */
+    int nalloc;                 /**< allocated size of child array */
+    int pindex;                 /**< our index in parent->child */
+    int nlabel;                 /**< number of components in edge label */
+    size_t *loff;               /**< nlabel + 1 offsets into lval */
+    unsigned char *lval;        /**< component values of edge label */
+    struct content_entry *content; /**< entries named by path to here */
 };
 
 /**
@@ -284,6 +609,8 @@ struct content_entry {
 #define CCN_CONTENT_ENTRY_SLOWSEND  1
 #define CCN_CONTENT_ENTRY_STALE     2
 #define CCN_CONTENT_ENTRY_PRECIOUS  4
+#define CCN_CONTENT_ENTRY_DIGEST    8
+#define CCN_CONTENT_ENTRY_TRANSIT  16 /**< stand-in, not in the store */
 
 /**
  * The sparse_straggler hash table, keyed by accession, holds scattered
@@ -294,13 +621,46 @@ struct sparse_straggler_entry {
 };
 
 /**
- * State for the strategy engine
+ * The nonce tables, keyed by nonce, remember which face first brought
+ * each recently seen nonce.  A nonce that turns up again on a different
+ * face marks a looped or duplicated interest.
+ */
+struct nonce_entry {
+    unsigned faceid;
+};
+
+/** Seconds that a nonce table collects before it is retired */
+#define CCND_NONCE_WINDOW 4
+
+/**
+ * A forwarding strategy
  *
- * This is still quite embryonic.
+ * The callouts are made at the points in the life of an interest entry
+ * named by the members.  The first one decides which upstreams get the
+ * interest right away, and sets the expiry of the others to say when
+ * do_propagate should send to them.  Any of them may be NULL.
+ */
+struct ccn_strategy_class {
+    const char *name;
+    /** newly created interest entry; fnpe holds the FIB entry, if any */
+    void (*first)(struct ccnd_handle *h, struct interest_entry *ie,
+                  struct nameprefix_entry *fnpe);
+    /** wakeup requested with strategy_settimer */
+    void (*timer)(struct ccnd_handle *h, struct interest_entry *ie);
+    /** matching content has arrived, interest entry will go away */
+    void (*satisfied)(struct ccnd_handle *h, struct interest_entry *ie);
+    /** all downstreams timed out, interest entry will go away */
+    void (*timeout)(struct ccnd_handle *h, struct interest_entry *ie);
+};
+
+/**
+ * State for the strategy engine
  */
 struct ccn_strategy {
     struct ccn_scheduled_event *ev; /**< for time-based strategy event */
+    const struct ccn_strategy_class *sc; /**< chosen at creation */
     int state;
+    unsigned upstream;              /**< faceid the timer is waiting on */
     ccn_wrappedtime birth;          /**< when interest entry was created */
     ccn_wrappedtime renewed;        /**< when interest entry was renewed */
     unsigned renewals;              /**< number of times renewed */
@@ -328,6 +688,7 @@ struct interest_entry {
     const unsigned char *interest_msg; /**< pending interest message */
     unsigned size;                  /**< size of interest message */
     unsigned serial;                /**< used for logging */
+    struct ccn_exclude *excl;       /**< compiled Exclude, if any */
 };
 
 /**
@@ -355,6 +716,7 @@ struct pit_face_item {
     ccn_wrappedtime renewed;        /**< when entry was last refreshed */
     ccn_wrappedtime expiry;         /**< when entry expires */
     unsigned pfi_flags;             /**< CCND_PFI_x */
+    unsigned sent_usec;             /**< microsecond clock when sent */
     unsigned char nonce[TYPICAL_NONCE_SIZE]; /**< nonce bytes */
 };
 #define CCND_PFI_NONCESZ  0x00FF    /**< Mask for actual nonce size */
@@ -366,13 +728,16 @@ struct pit_face_item {
 #define CCND_PFI_PENDING  0x2000    /**< Pending for immediate data */
 #define CCND_PFI_SUPDATA  0x4000    /**< Suppressed data reply */
 #define CCND_PFI_DCFACE  0x10000    /**< This upstream is a DC face */
+#define CCND_PFI_BIGNONCE 0x20000   /**< Allocated with room for big nonce */
+#define CCND_PFI_RESENT  0x40000    /**< Sent upstream more than once */
 
 /**
  * The nameprefix hash table is keyed by the Component elements of
  * the Name prefix.
  */
 struct nameprefix_entry {
-    struct ielinks ie_head;      /**< list head for interest entries */
+    struct ielinks ie_head;      /**< list head for interests with selectors */
+    struct ielinks ie_exact;     /**< list head for interests without */
     struct ccn_indexbuf *forward_to; /**< faceids to forward to */
     struct ccn_indexbuf *tap;    /**< faceids to forward to as tap */
     struct ccn_forwarding *forwarding; /**< detailed forwarding info */
@@ -383,6 +748,8 @@ struct nameprefix_entry {
     unsigned src;                /**< faceid of recent content source */
     unsigned osrc;               /**< and of older matching content */
     unsigned usec;               /**< response-time prediction */
+    const struct ccn_strategy_class *strategy; /**< set with forward_to */
+    unsigned rr;                 /**< load balancing rotor */
 };
 
 /**
@@ -393,9 +760,18 @@ struct ccn_forwarding {
     unsigned faceid;             /**< locally unique number identifying face */
     unsigned flags;              /**< CCN_FORW_* - c.f. <ccn/reg_mgnt.h> */
     int expires;                 /**< time remaining, in seconds */
+    unsigned srtt;               /**< smoothed response time, microseconds */
+    unsigned rttvar;             /**< response time variation */
+    unsigned rto;                /**< retransmission timeout, or 0 */
     struct ccn_forwarding *next;
 };
 
+/**
+ * Bounds on the retransmission timeout kept with ccn_forwarding entries.
+ */
+#define CCND_RTO_MIN 2000
+#define CCND_RTO_MAX 160000
+
 /* create and destroy procs for separately allocated meters */
 struct ccnd_meter *ccnd_meter_create(struct ccnd_handle *h, const char *what);
 void ccnd_meter_destroy(struct ccnd_meter **);
@@ -421,6 +797,7 @@ uintmax_t ccnd_meter_total(struct ccnd_meter *m);
  * @def CCN_FORW_LOCAL         32
  * @def CCN_FORW_TAP           64
  * @def CCN_FORW_CAPTURE_OK   128
+ * @def CCN_FORW_STRATEGY    3840
  */
 #define CCN_FORW_PFXO (CCN_FORW_ADVERTISE | CCN_FORW_CAPTURE | CCN_FORW_LOCAL)
 #define CCN_FORW_REFRESHED      (1 << 16) /**< private to ccnd */
@@ -472,6 +849,14 @@ int ccnd_req_selfreg(struct ccnd_handle *h,
                      const unsigned char *msg, size_t size,
                      struct ccn_charbuf *reply_body);
 
+/*
+ * The internal client calls this with the argument portion ARG of
+ * a content store snapshot request (/ccnx/CCNDID/snapshot/ARG)
+ */
+int ccnd_req_snapshot(struct ccnd_handle *h,
+                      const unsigned char *msg, size_t size,
+                      struct ccn_charbuf *reply_body);
+
 /**
  * URIs for prefixes served by the internal client
  */
@@ -509,9 +894,134 @@ void ccnd_internal_client_has_somthing_to_say(struct ccnd_handle *h);
 struct face *ccnd_face_from_faceid(struct ccnd_handle *, unsigned);
 void ccnd_face_status_change(struct ccnd_handle *, unsigned);
 int ccnd_destroy_face(struct ccnd_handle *h, unsigned faceid);
+void ccnd_update_face_events(struct ccnd_handle *h, struct face *face);
 void ccnd_send(struct ccnd_handle *h, struct face *face,
                const void *data, size_t size);
 
+/*
+ * Multi-worker forwarding (CCND_WORKERS), see ccnd_workers.c
+ */
+struct ccnd_worker_report {
+    unsigned long content;      /**< content objects in the shard */
+    unsigned long interests;    /**< interest entries in the shard */
+    unsigned long accepted;     /**< interests accepted */
+    unsigned long sent;         /**< content items sent */
+    unsigned long hits;         /**< interests answered from the store */
+    unsigned long received;     /**< packets handed to the worker */
+    unsigned long dropped;      /**< packets lost to full queues */
+};
+
+/**
+ * What a ccnd_packet asks of the thread it is posted to
+ */
+enum ccnd_packet_kind {
+    CCND_PKT_INPUT,             /**< forward an Interest or ContentObject */
+    CCND_PKT_SEND,              /**< send msg on a face of the thread */
+    CCND_PKT_CONTENT,           /**< send stored content on such a face */
+    CCND_PKT_MATCH,             /**< offer new content to pending interests */
+    CCND_PKT_PROBE,             /**< look in the store for a short interest */
+    CCND_PKT_FOUND,             /**< what a probe found, if anything */
+    CCND_PKT_HIT,               /**< stored content was sent by another thread */
+    CCND_PKT_STALE,             /**< and the interest asked that it go stale */
+    CCND_PKT_ADOPT,             /**< do the i/o of a face from now on */
+    CCND_PKT_DROP,              /**< stop doing it, and give the face back */
+    CCND_PKT_GONE,              /**< a face given back, to be destroyed */
+    CCND_PKT_REPORT,            /**< how a face is doing, from its worker */
+    CCND_PKT_RAW                /**< a datagram for a face of the thread */
+};
+
+/**
+ * How a face is doing, as the worker that does its i/o tells the main
+ * thread, for its reaper and its status page.
+ *
+ * In a report, the counts are those since the last report; the worker
+ * keeps the totals it last reported in the same form.
+ */
+struct ccnd_face_report {
+    int flags;
+    unsigned recvcount;
+    unsigned drops;
+    unsigned sendq_n;
+    uintmax_t meter[CCND_FACE_METER_N];
+};
+
+/**
+ * A message handed from one thread to another.
+ *
+ * Nothing is copied into it.  The message lies in a received buffer
+ * that the packet holds a reference to, or in a ContentObject in the
+ * store of the sending thread, which stays pinned until the packet is
+ * released.
+ */
+struct ccnd_packet {
+    struct ccnd_packet *next;
+    enum ccnd_packet_kind kind;
+    unsigned faceid;            /**< arrival face, or the face to send on */
+    unsigned origin;            /**< downstream of an interest for face 0 */
+    unsigned probe;             /**< serial of the probe it belongs to */
+    int thread;                 /**< the thread that posted it */
+    int store;                  /**< the thread that stores content */
+    int flags;                  /**< face flags at arrival, or content flags */
+    enum ccn_dtag dtag;         /**< for input, what msg is */
+    const unsigned char *msg;
+    size_t size;
+    struct ccnd_rxbuf *rx;      /**< holds msg, if it was received */
+    struct ccn_charbuf *buf;    /**< holds msg, if it was made to send;
+                                     the input, address, or report of a face */
+    struct content_entry *content; /**< pinned stored content, or NULL */
+    unsigned char digest[32];   /**< of content, if flags say it is known */
+    int fd;                     /**< socket of a face handed over, or -1 */
+    unsigned pktseq;            /**< its next link sequence number */
+    struct ccn_skeleton_decoder decoder; /**< where its input stands */
+};
+
+int ccnd_workers_create(struct ccnd_handle *h, int n);
+int ccnd_workers_start(struct ccnd_handle *h);
+void ccnd_workers_stop(struct ccnd_handle *h);
+int ccnd_workers_dispatch(struct ccnd_handle *h, enum ccn_dtag dtag,
+                          const unsigned char *msg, size_t size);
+int ccnd_workers_post(struct ccnd_handle *h, int thread,
+                      struct ccnd_packet *p);
+int ccnd_workers_match_wanted(struct ccnd_handle *h,
+                              struct content_entry *content);
+int ccnd_workers_collect(struct ccnd_handle *h);
+int ccnd_workers_count(struct ccnd_handle *h);
+int ccnd_workers_kick(struct ccnd_handle *h);
+int ccnd_workers_fd(struct ccnd_handle *h);
+int ccnd_workers_report(struct ccnd_handle *h, int i,
+                        struct ccnd_worker_report *r);
+int ccnd_workers_hand_over(struct ccnd_handle *h, struct face *face,
+                           struct ccnd_packet *p);
+struct ccnd_handle *ccnd_workers_content_shard(struct ccnd_handle *h,
+                                               const unsigned char *msg,
+                                               size_t size);
+struct ccnd_handle *ccnd_workers_shard(struct ccnd_handle *h, int i);
+void ccnd_workers_cs_note(struct ccnd_handle *h, long count, long bytes);
+int ccnd_workers_cs_over_limit(struct ccnd_handle *h, int slack);
+int ccnd_workers_snapshot(struct ccnd_handle *h, FILE *f,
+                          long *count, unsigned long *bytes);
+void ccnd_worker_fib_fill(struct ccnd_handle *h, struct nameprefix_entry *npe,
+                          const unsigned char *key, size_t keysize);
+/* These are in ccnd.c */
+struct ccnd_handle *ccnd_worker_handle_create(struct ccnd_handle *h,
+                                              struct ccnd_worker *worker);
+struct face *ccnd_worker_face(struct ccnd_handle *h, unsigned faceid,
+                              int flags, int owner);
+void ccnd_worker_face_drop(struct ccnd_handle *h, unsigned faceid);
+void ccnd_worker_set_forwarding(struct ccnd_handle *h,
+                                struct nameprefix_entry *npe,
+                                const struct ccn_forwarding *fwd, int n,
+                                int accelerate);
+struct ccnd_packet *ccnd_packet_create(enum ccnd_packet_kind kind);
+void ccnd_packet_handle(struct ccnd_handle *h, struct ccnd_packet *p);
+void ccnd_packet_release(struct ccnd_packet *p);
+void ccnd_transit_sweep(struct ccnd_handle *h, int all);
+void ccnd_worker_flush(struct ccnd_handle *h);
+void ccnd_worker_poll(struct ccnd_handle *h, int wake_fd, int timeout_ms);
+void ccnd_cs_check(struct ccnd_handle *h);
+int ccnd_snapshot_write(struct ccnd_handle *h, FILE *f,
+                        long *count, unsigned long *bytes);
+
 /* Consider a separate header for these */
 int ccnd_stats_handle_http_connection(struct ccnd_handle *, struct face *);
 void ccnd_msg(struct ccnd_handle *, const char *, ...);
@@ -36,6 +36,7 @@
 #include <ccn/charbuf.h>
 #include <ccn/coding.h>
 #include <ccn/indexbuf.h>
+#include <ccn/pool.h>
 #include <ccn/schedule.h>
 #include <ccn/sockaddrutil.h>
 #include <ccn/hashtb.h>
@@ -147,6 +148,7 @@ ccnd_stats_handle_http_connection(struct ccnd_handle *h, struct face *face)
     else
         ccnd_send(h, face, resp405, strlen(resp405));
     face->flags |= (CCN_FACE_NOSEND | CCN_FACE_CLOSING);
+    ccnd_update_face_events(h, face);
     ccn_charbuf_destroy(&response);
     return(0);
 }
@@ -184,15 +186,18 @@ ccnd_collect_stats(struct ccnd_handle *h, struct ccnd_stats *ans)
     for (sum = 0, hashtb_start(h->nameprefix_tab, e);
          e->data != NULL; hashtb_next(e)) {
         struct nameprefix_entry *npe = e->data;
-        struct ielinks *head = &npe->ie_head;
+        struct ielinks *heads[2] = { &npe->ie_head, &npe->ie_exact };
         struct ielinks *ll;
-        for (ll = head->next; ll != head; ll = ll->next) {
-            struct interest_entry *ie = (struct interest_entry *)ll;
-            struct pit_face_item *p;
-            for (p = ie->pfl; p != NULL; p = p->next)
-                if ((p->pfi_flags & CCND_PFI_PENDING) != 0)
-                    if (ccnd_face_from_faceid(h, p->faceid) != NULL)
-                        sum += 1;
+        int k;
+        for (k = 0; k < 2; k++) {
+            for (ll = heads[k]->next; ll != heads[k]; ll = ll->next) {
+                struct interest_entry *ie = (struct interest_entry *)ll;
+                struct pit_face_item *p;
+                for (p = ie->pfl; p != NULL; p = p->next)
+                    if ((p->pfi_flags & CCND_PFI_PENDING) != 0)
+                        if (ccnd_face_from_faceid(h, p->faceid) != NULL)
+                            sum += 1;
+            }
         }
     }
     ans->total_interest_counts = sum;
@@ -211,6 +216,21 @@ ccnd_collect_stats(struct ccnd_handle *h, struct ccnd_stats *ans)
     return(0);
 }
 
+/**
+ * Count the content objects waiting to be sent on a face
+ */
+static int
+face_queue_depth(struct face *face)
+{
+    int c;
+    int n = 0;
+    
+    for (c = 0; c < CCN_CQ_N; c++)
+        if (face->q[c] != NULL)
+            n += face->q[c]->n;
+    return(n);
+}
+
 /* HTML formatting */
 
 static void
@@ -234,6 +254,20 @@ collect_faces_html(struct ccnd_handle *h, struct ccn_charbuf *b)
             if (face->recvcount != 0)
                 ccn_charbuf_putf(b, " <b>activity:</b> %d",
                                  face->recvcount);
+            if (face_queue_depth(face) != 0)
+                ccn_charbuf_putf(b, " <b>queued:</b> %d",
+                                 face_queue_depth(face));
+            if (face->sendq_n != 0)
+                ccn_charbuf_putf(b, " <b>sendq:</b> %u", face->sendq_n);
+            if (face->drops != 0)
+                ccn_charbuf_putf(b, " <b>drops:</b> %u", face->drops);
+            if (face->rate != 0)
+                ccn_charbuf_putf(b, " <b>rate:</b> %u/%u",
+                                 face->rate, face->burst);
+            if (face->link != NULL)
+                ccn_charbuf_putf(b, " <b>link rtt:</b> %u"
+                                 " <b>retransmits:</b> %lu",
+                                 face->link->srtt, face->link->retransmits);
             nodebuf->length = 0;
             port = ccn_charbuf_append_sockaddr(nodebuf, face->addr);
             if (port > 0) {
@@ -333,6 +367,12 @@ collect_forwarding_html(struct ccnd_handle *h, struct ccn_charbuf *b)
                                  f->faceid,
                                  f->flags & CCN_FORW_PUBMASK,
                                  f->expires);
+                if (f->srtt != 0)
+                    ccn_charbuf_putf(b,
+                                     " <b>srtt:</b> %u"
+                                     " <b>rttvar:</b> %u"
+                                     " <b>rto:</b> %u",
+                                     f->srtt, f->rttvar, f->rto);
                 ccn_charbuf_putf(b, "</li>" NL);
             }
         }
@@ -342,6 +382,65 @@ collect_forwarding_html(struct ccnd_handle *h, struct ccn_charbuf *b)
     ccn_charbuf_putf(b, "</ul>");
 }
 
+/**
+ * Memory pool occupancy, for the status reports.
+ */
+struct ccnd_pool_report {
+    const char *name;
+    struct ccn_pool_stats s;
+};
+#define CCND_POOL_REPORT_N 5
+
+static void
+collect_pool_stats(struct ccnd_handle *h, struct ccnd_pool_report *r)
+{
+    r[0].name = "content";
+    hashtb_pool_stats(h->content_tab, &r[0].s);
+    r[1].name = "nameprefix";
+    hashtb_pool_stats(h->nameprefix_tab, &r[1].s);
+    r[2].name = "interest";
+    hashtb_pool_stats(h->interest_tab, &r[2].s);
+    r[3].name = "pitface";
+    ccn_pool_get_stats(h->pfi_pool, &r[3].s, 0);
+    r[4].name = "event";
+    ccn_schedule_pool_stats(h->sched, &r[4].s);
+}
+
+static void
+collect_pools_html(struct ccnd_handle *h, struct ccn_charbuf *b)
+{
+    struct ccnd_pool_report r[CCND_POOL_REPORT_N];
+    int i;
+    
+    collect_pool_stats(h, r);
+    ccn_charbuf_putf(b, "<div><b>Memory pools:</b>");
+    for (i = 0; i < CCND_POOL_REPORT_N; i++)
+        ccn_charbuf_putf(b, "%s %s %lu in use (high %lu), %lu free, %lu KiB",
+                         i == 0 ? "" : ";", r[i].name,
+                         r[i].s.in_use, r[i].s.high, r[i].s.free,
+                         (unsigned long)(r[i].s.bytes / 1024));
+    ccn_charbuf_putf(b, "</div>" NL);
+}
+
+static void
+collect_workers_html(struct ccnd_handle *h, struct ccn_charbuf *b)
+{
+    struct ccnd_worker_report r;
+    int i;
+    
+    if (h->workers == NULL)
+        return;
+    ccn_charbuf_putf(b, "<div><b>Workers:</b>");
+    for (i = 0; ccnd_workers_report(h, i, &r) == 0; i++)
+        ccn_charbuf_putf(b, "%s %d: %lu stored, %lu pending,"
+                         " %lu accepted, %lu sent, %lu hits,"
+                         " %lu received, %lu dropped",
+                         i == 0 ? "" : ";", i,
+                         r.content, r.interests, r.accepted, r.sent, r.hits,
+                         r.received, r.dropped);
+    ccn_charbuf_putf(b, "</div>" NL);
+}
+
 static unsigned
 ccnd_colorhash(struct ccnd_handle *h)
 {
@@ -395,7 +494,7 @@ collect_stats_html(struct ccnd_handle *h)
         "<div><b>Interests:</b> %d names,"
         " %ld pending, %ld propagating, %ld noted</div>" NL
         "<div><b>Interest totals:</b> %lu accepted,"
-        " %lu dropped, %lu sent, %lu stuffed</div>" NL,
+        " %lu dropped, %lu looped, %lu sent, %lu stuffed</div>" NL,
         un.nodename,
         pid,
         ccnd_colorhash(h),
@@ -415,12 +514,30 @@ collect_stats_html(struct ccnd_handle *h)
         hashtb_n(h->nameprefix_tab), stats.total_interest_counts,
         hashtb_n(h->interest_tab) - stats.total_flood_control,
         stats.total_flood_control,
-        h->interests_accepted, h->interests_dropped,
+        h->interests_accepted, h->interests_dropped, h->interests_looped,
         h->interests_sent, h->interests_stuffed);
     if (0)
         ccn_charbuf_putf(b,
                          "<div><b>Active faces and listeners:</b> %d</div>" NL,
                          hashtb_n(h->faces_by_fd) + hashtb_n(h->dgram_faces));
+    ccn_charbuf_putf(b,
+                     "<div><b>Content store:</b> %lu bytes", h->cs_bytes);
+    if (h->cs_bytes_limit != ~0UL)
+        ccn_charbuf_putf(b, " of %lu", h->cs_bytes_limit);
+    ccn_charbuf_putf(b, ", %lu hits, %lu misses, %lu evicted,"
+                     " %lu digests computed, %lu avoided</div>" NL,
+                     h->cs_hits, h->cs_misses, h->cs_evictions,
+                     h->content_digests, h->content_digests_avoided);
+    if (h->dgram_batch > 1)
+        ccn_charbuf_putf(b,
+                         "<div><b>Datagram batching:</b> limit %d,"
+                         " %lu received in %lu calls,"
+                         " %lu sent in %lu calls</div>" NL,
+                         h->dgram_batch,
+                         h->dgram_recv_msgs, h->dgram_recv_calls,
+                         h->dgram_send_msgs, h->dgram_send_calls);
+    collect_workers_html(h, b);
+    collect_pools_html(h, b);
     collect_faces_html(h, b);
     collect_face_meter_html(h, b);
     collect_forwarding_html(h, b);
@@ -446,6 +563,54 @@ collect_meter_xml(struct ccnd_handle *h, struct ccn_charbuf *b, struct ccnd_mete
         m->what, total, rate, m->what);
 }
 
+static void
+collect_pools_xml(struct ccnd_handle *h, struct ccn_charbuf *b)
+{
+    struct ccnd_pool_report r[CCND_POOL_REPORT_N];
+    int i;
+    
+    collect_pool_stats(h, r);
+    ccn_charbuf_putf(b, "<pools>");
+    for (i = 0; i < CCND_POOL_REPORT_N; i++)
+        ccn_charbuf_putf(b,
+                         "<pool>"
+                         "<name>%s</name>"
+                         "<inuse>%lu</inuse>"
+                         "<high>%lu</high>"
+                         "<free>%lu</free>"
+                         "<pages>%lu</pages>"
+                         "<bytes>%lu</bytes>"
+                         "</pool>",
+                         r[i].name, r[i].s.in_use, r[i].s.high, r[i].s.free,
+                         r[i].s.pages, (unsigned long)r[i].s.bytes);
+    ccn_charbuf_putf(b, "</pools>");
+}
+
+static void
+collect_workers_xml(struct ccnd_handle *h, struct ccn_charbuf *b)
+{
+    struct ccnd_worker_report r;
+    int i;
+    
+    if (h->workers == NULL)
+        return;
+    ccn_charbuf_putf(b, "<workers>");
+    for (i = 0; ccnd_workers_report(h, i, &r) == 0; i++)
+        ccn_charbuf_putf(b,
+                         "<worker>"
+                         "<stored>%lu</stored>"
+                         "<pending>%lu</pending>"
+                         "<accepted>%lu</accepted>"
+                         "<sent>%lu</sent>"
+                         "<hits>%lu</hits>"
+                         "<received>%lu</received>"
+                         "<dropped>%lu</dropped>"
+                         "</worker>",
+                         r.content, r.interests, r.accepted, r.sent, r.hits,
+                         r.received, r.dropped);
+    ccn_charbuf_putf(b, "</workers>");
+}
+
 static void
 collect_faces_xml(struct ccnd_handle *h, struct ccn_charbuf *b)
 {
@@ -468,6 +633,20 @@ collect_faces_xml(struct ccnd_handle *h, struct ccn_charbuf *b)
                              face->pending_interests);
             ccn_charbuf_putf(b, "<recvcount>%d</recvcount>",
                              face->recvcount);
+            ccn_charbuf_putf(b, "<queued>%d</queued>",
+                             face_queue_depth(face));
+            if (face->sendq_n != 0)
+                ccn_charbuf_putf(b, "<sendq>%u</sendq>", face->sendq_n);
+            if (face->drops != 0)
+                ccn_charbuf_putf(b, "<drops>%u</drops>", face->drops);
+            if (face->rate != 0)
+                ccn_charbuf_putf(b, "<ratelimit>%u</ratelimit>"
+                                 "<burstsize>%u</burstsize>",
+                                 face->rate, face->burst);
+            if (face->link != NULL)
+                ccn_charbuf_putf(b, "<linkrtt>%u</linkrtt>"
+                                 "<retransmits>%lu</retransmits>",
+                                 face->link->srtt, face->link->retransmits);
             nodebuf->length = 0;
             port = ccn_charbuf_append_sockaddr(nodebuf, face->addr);
             if (port > 0) {
@@ -520,11 +699,17 @@ collect_forwarding_xml(struct ccnd_handle *h, struct ccn_charbuf *b)
                                      "<dest>"
                                      "<faceid>%u</faceid>"
                                      "<flags>%x</flags>"
-                                     "<expires>%d</expires>"
-                                     "</dest>",
+                                     "<expires>%d</expires>",
                                      f->faceid,
                                      f->flags & CCN_FORW_PUBMASK,
                                      f->expires);
+                    if (f->srtt != 0)
+                        ccn_charbuf_putf(b,
+                                         "<srtt>%u</srtt>"
+                                         "<rttvar>%u</rttvar>"
+                                         "<rto>%u</rto>",
+                                         f->srtt, f->rttvar, f->rto);
+                    ccn_charbuf_putf(b, "</dest>");
                 }
             }
             ccn_charbuf_putf(b, "</fentry>");
@@ -566,6 +751,12 @@ collect_stats_xml(struct ccnd_handle *h)
         "<sparse>%d</sparse>"
         "<duplicate>%lu</duplicate>"
         "<sent>%lu</sent>"
+        "<bytes>%lu</bytes>"
+        "<hits>%lu</hits>"
+        "<misses>%lu</misses>"
+        "<evicted>%lu</evicted>"
+        "<digests>%lu</digests>"
+        "<digestsavoided>%lu</digestsavoided>"
         "</cobs>"
         "<interests>"
         "<names>%d</names>"
@@ -574,6 +765,7 @@ collect_stats_xml(struct ccnd_handle *h)
         "<noted>%ld</noted>"
         "<accepted>%lu</accepted>"
         "<dropped>%lu</dropped>"
+        "<looped>%lu</looped>"
         "<sent>%lu</sent>"
         "<stuffed>%lu</stuffed>"
         "</interests>",
@@ -583,11 +775,26 @@ collect_stats_xml(struct ccnd_handle *h)
         hashtb_n(h->sparse_straggler_tab),
         h->content_dups_recvd,
         h->content_items_sent,
+        h->cs_bytes, h->cs_hits, h->cs_misses, h->cs_evictions,
+        h->content_digests, h->content_digests_avoided,
         hashtb_n(h->nameprefix_tab), stats.total_interest_counts,
         hashtb_n(h->interest_tab) - stats.total_flood_control,
         stats.total_flood_control,
-        h->interests_accepted, h->interests_dropped,
+        h->interests_accepted, h->interests_dropped, h->interests_looped,
         h->interests_sent, h->interests_stuffed);
+    ccn_charbuf_putf(b,
+        "<dgrambatch>"
+        "<limit>%d</limit>"
+        "<recvcalls>%lu</recvcalls>"
+        "<recvmsgs>%lu</recvmsgs>"
+        "<sendcalls>%lu</sendcalls>"
+        "<sendmsgs>%lu</sendmsgs>"
+        "</dgrambatch>",
+        h->dgram_batch,
+        h->dgram_recv_calls, h->dgram_recv_msgs,
+        h->dgram_send_calls, h->dgram_send_msgs);
+    collect_workers_xml(h, b);
+    collect_pools_xml(h, b);
     collect_faces_xml(h, b);
     collect_forwarding_xml(h, b);
     ccn_charbuf_putf(b, "</ccnd>" NL);
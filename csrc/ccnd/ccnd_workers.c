@@ -0,0 +1,1281 @@
+/**
+ * @file ccnd_workers.c
+ *
+ * Sharded forwarding on several threads (CCND_WORKERS).
+ *
+ * The main thread keeps the faces, the listeners, the internal client,
+ * and the FIB.  Each worker thread owns a shard of the PIT and Content
+ * Store, in a ccnd_handle of its own.  Interests and ContentObjects go
+ * to the shard chosen by a hash of the leading components of their
+ * names, so that content meets the interests it can satisfy.  Names too short to pick a shard stay on the main
+ * thread.  Such an interest is looked up in the store of every shard,
+ * and answered with the best of their matches, as one store would
+ * answer it; new content in a shard is offered to the interests
+ * pending on the main thread as well.
+ *
+ * Each thread has a mailbox that any thread may post packets to.
+ * A packet refers to the message rather than holding a copy: received
+ * input stays in the buffer it was read into, which is shared by
+ * reference count, and stored content is pinned in the store of the
+ * thread that sends it, so that it cannot be removed while the packet
+ * or a stand-in for it (struct ccnd_transit) refers to it.
+ *
+ * The FIB and the list of faces are published to the workers as an
+ * immutable snapshot.  A new snapshot replaces the old by a pointer
+ * swap; the old one is freed once every worker has moved past it.
+ *
+ * Once a stream or unicast datagram face has settled, the main thread
+ * hands its socket to a worker, in turn (CCND_PKT_ADOPT), and from then
+ * on the worker reads it, writes it, and runs its link protocol, and
+ * the others send to the face by way of the worker.  A datagram face
+ * gets a socket of its own, connected to the peer; what still arrives
+ * on the listener is passed along.  The worker reports the counters and
+ * link flags of its faces to the main thread, and gives a face back
+ * when it closes or when the main thread asks for it, to be destroyed
+ * there.
+ *
+ * CCND_CAP and CCND_CS_BYTES limit the content of all the shards
+ * together.  A shard evicts only while it holds more than its share;
+ * when the total is over but the shard is not, the others are roused
+ * to evict instead.  For a CCND_CS_SNAPSHOT, each worker writes the
+ * records of its own shard in turn; at startup the records are sorted
+ * into the shards before the threads start.
+ *
+ * Part of ccnd - the CCNx Daemon.
+ *
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ccn/ccn.h>
+#include <ccn/charbuf.h>
+#include <ccn/coding.h>
+#include <ccn/hashtb.h>
+#include <ccn/indexbuf.h>
+#include <ccn/schedule.h>
+
+#include "ccnd_private.h"
+
+/**
+ * The packets posted to one thread.
+ *
+ * Any thread may post, by pushing onto a lock-free stack; the thread
+ * takes the whole stack at once and puts it back in order.  A thread
+ * that is about to wait says so in asleep, and only then is its wake
+ * pipe written.  The fields that other threads use come first, on a
+ * cache line of their own.
+ */
+struct ccnd_mailbox {
+    struct ccnd_packet *top;    /**< newest posted packet (atomic) */
+    int count;                  /**< posted, not yet handled (atomic) */
+    int asleep;                 /**< the thread may be waiting (atomic) */
+    unsigned long dropped;      /**< packets it could not post (atomic) */
+    char pad[64];
+    int wake[2];                /**< pipe that rouses the thread */
+    struct ccnd_packet *head;   /**< taken, oldest first, not yet handled */
+    struct ccnd_packet *tail;
+    unsigned char *rouse;       /**< threads it posted to during this pass */
+    struct ccn_indexbuf *comps; /**< scratch for the thread */
+};
+
+/**
+ * A name prefix in a FIB snapshot.
+ */
+struct ccnd_fib_prefix {
+    const unsigned char *key;   /**< Component elements of the prefix */
+    size_t keysize;
+    int first;                  /**< index of its first forwarding entry */
+    int n;                      /**< number of forwarding entries */
+};
+
+/**
+ * A face in a FIB snapshot.
+ */
+struct ccnd_fib_face {
+    unsigned faceid;
+    int flags;
+    int owner;                  /**< the thread that does its i/o */
+};
+
+/**
+ * Immutable copy of the FIB and faces of the main thread.
+ */
+struct ccnd_fib {
+    unsigned gen;               /**< publication number, from 1 */
+    int nprefix;
+    struct ccnd_fib_prefix *prefix; /**< ordered by key */
+    struct ccn_forwarding *fwd; /**< forwarding entries (next is unused) */
+    int nface;
+    struct ccnd_fib_face *face; /**< ordered by face slot */
+    struct ccn_charbuf *keys;   /**< storage for the prefix keys */
+    struct ccnd_fib *older;     /**< retired snapshots, newest first */
+};
+
+/**
+ * One worker thread and its shard.
+ */
+struct ccnd_worker {
+    struct ccnd_workers *set;
+    struct ccnd_handle *h;      /**< the shard */
+    pthread_t thread;
+    int started;
+    int stop;                   /**< tells the thread to finish (atomic) */
+    struct ccnd_mailbox *box;   /**< where its packets are posted */
+    const struct ccnd_fib *fib; /**< snapshot in use by the worker */
+    unsigned fib_seen;          /**< its gen, for reclamation (atomic) */
+    struct ccnd_worker_report report; /**< published counters (atomic) */
+    int snap_pending;           /**< snapshot records wanted (atomic) */
+    FILE *snap_file;            /**< where they go */
+    int snap_res;               /**< 0, or -1 for a write error */
+    long snap_count;            /**< ContentObjects written */
+    unsigned long snap_bytes;   /**< and their size */
+};
+
+/**
+ * The workers, as seen from the main thread.
+ */
+struct ccnd_workers {
+    int n;
+    struct ccnd_worker **worker;
+    struct ccnd_mailbox *box;   /**< n + 1 mailboxes, the main thread's first */
+    struct ccnd_fib *fib;       /**< newest snapshot (atomic) */
+    unsigned forward_to_gen;    /**< FIB generation of the newest snapshot */
+    unsigned faces_changed;     /**< and its face change count */
+    uint64_t short_mask;        /**< first components of the interests
+                                     pending on the main thread (atomic) */
+    long short_sec;             /**< when short_mask was last worked out */
+    unsigned long cs_count;     /**< content in all the stores (atomic) */
+    unsigned long cs_bytes;     /**< and its footprint (atomic) */
+    int cs_pressure;            /**< the total is over budget (atomic) */
+    unsigned rover;             /**< the worker to hand the next face to */
+    pthread_mutex_t snap_lock;  /**< guards snap_pending */
+    pthread_cond_t snap_done;   /**< signalled as each shard finishes */
+};
+
+/**
+ * Add to a published counter.
+ *
+ * The counters are read by the main thread for the status page.
+ */
+static void
+report_bump(unsigned long *counter, unsigned long amt)
+{
+    __atomic_fetch_add(counter, amt, __ATOMIC_RELAXED);
+}
+
+static int
+wake_pipe_create(int fds[2])
+{
+    if (pipe(fds) == -1) {
+        fds[0] = fds[1] = -1;
+        return(-1);
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return(0);
+}
+
+static void
+wake_pipe_close(int fds[2])
+{
+    if (fds[0] != -1)
+        close(fds[0]);
+    if (fds[1] != -1)
+        close(fds[1]);
+    fds[0] = fds[1] = -1;
+}
+
+/**
+ * Rouse the thread that waits on the other end of a wake pipe.
+ */
+static void
+wake_pipe_write(int fds[2])
+{
+    if (write(fds[1], "", 1) == -1) {
+        /* The pipe is full, so the reader will wake up anyway */
+    }
+}
+
+static void
+wake_pipe_drain(int fds[2])
+{
+    char buf[64];
+
+    while (read(fds[0], buf, sizeof(buf)) > 0)
+        continue;
+}
+
+static struct ccnd_workers *
+workers_of(struct ccnd_handle *h)
+{
+    return((h->worker != NULL) ? h->worker->set : h->workers);
+}
+
+/**
+ * Post a packet to a thread.
+ *
+ * The thread is roused at the end of the pass of the poster, by
+ * workers_rouse().  If its mailbox is full, the packet is released,
+ * unless it has to do with handing over a face.
+ * @returns 0 for success, -1 if the packet was dropped.
+ */
+int
+ccnd_workers_post(struct ccnd_handle *h, int thread, struct ccnd_packet *p)
+{
+    struct ccnd_workers *set = workers_of(h);
+    struct ccnd_mailbox *box = &set->box[thread];
+    struct ccnd_packet *top;
+
+    p->thread = h->thread;
+    if (__atomic_add_fetch(&box->count, 1, __ATOMIC_RELAXED) >
+          CCND_WORKER_QUEUE && p->kind != CCND_PKT_ADOPT &&
+          p->kind != CCND_PKT_DROP && p->kind != CCND_PKT_GONE) {
+        __atomic_sub_fetch(&box->count, 1, __ATOMIC_RELAXED);
+        report_bump(&set->box[h->thread].dropped, 1);
+        ccnd_packet_release(p);
+        return(-1);
+    }
+    top = __atomic_load_n(&box->top, __ATOMIC_RELAXED);
+    do {
+        p->next = top;
+    } while (!__atomic_compare_exchange_n(&box->top, &top, p, 1,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    set->box[h->thread].rouse[thread] = 1;
+    return(0);
+}
+
+/**
+ * Take what has been posted, and put it after what is left from before.
+ */
+static void
+mailbox_take(struct ccnd_mailbox *box)
+{
+    struct ccnd_packet *p;
+    struct ccnd_packet *next;
+    struct ccnd_packet *newest;
+    struct ccnd_packet *list = NULL;
+
+    newest = __atomic_exchange_n(&box->top, NULL, __ATOMIC_ACQUIRE);
+    for (p = newest; p != NULL; p = next) {
+        next = p->next;
+        p->next = list;
+        list = p;
+    }
+    if (list == NULL)
+        return;
+    if (box->tail == NULL)
+        box->head = list;
+    else
+        box->tail->next = list;
+    box->tail = newest;
+}
+
+/**
+ * Handle up to CCND_WORKER_BATCH of the packets posted to the thread
+ * of h, in the order they were posted.
+ *
+ * @returns the number handled.
+ */
+static int
+mailbox_handle(struct ccnd_handle *h, struct ccnd_mailbox *box)
+{
+    struct ccnd_packet *p;
+    int n;
+
+    mailbox_take(box);
+    for (n = 0; n < CCND_WORKER_BATCH && box->head != NULL; n++) {
+        p = box->head;
+        box->head = p->next;
+        if (box->head == NULL)
+            box->tail = NULL;
+        p->next = NULL;
+        ccnd_packet_handle(h, p);
+        ccnd_packet_release(p);
+    }
+    if (n > 0)
+        __atomic_sub_fetch(&box->count, n, __ATOMIC_RELAXED);
+    return(n);
+}
+
+/**
+ * Get ready to wait.
+ *
+ * @returns 0 if the thread may wait, or 1 if there are packets to handle.
+ */
+static int
+mailbox_doze(struct ccnd_mailbox *box)
+{
+    __atomic_store_n(&box->asleep, 1, __ATOMIC_SEQ_CST);
+    if (box->head == NULL &&
+        __atomic_load_n(&box->top, __ATOMIC_SEQ_CST) == NULL)
+        return(0);
+    __atomic_store_n(&box->asleep, 0, __ATOMIC_RELAXED);
+    return(1);
+}
+
+/**
+ * Start a pass of a thread: it is not waiting now.
+ */
+static void
+mailbox_wake(struct ccnd_mailbox *box)
+{
+    __atomic_store_n(&box->asleep, 0, __ATOMIC_RELAXED);
+    wake_pipe_drain(box->wake);
+}
+
+/**
+ * Rouse the threads that the thread of h posted to during this pass,
+ * if they may be waiting.
+ */
+static void
+workers_rouse(struct ccnd_handle *h)
+{
+    struct ccnd_workers *set = workers_of(h);
+    unsigned char *rouse = set->box[h->thread].rouse;
+    int i;
+
+    for (i = 0; i <= set->n; i++) {
+        if (rouse[i] == 0)
+            continue;
+        rouse[i] = 0;
+        if (__atomic_exchange_n(&set->box[i].asleep, 0, __ATOMIC_SEQ_CST))
+            wake_pipe_write(set->box[i].wake);
+    }
+}
+
+static int
+fib_prefix_compare(const void *a, const void *b)
+{
+    const struct ccnd_fib_prefix *x = a;
+    const struct ccnd_fib_prefix *y = b;
+    size_t n = (x->keysize < y->keysize) ? x->keysize : y->keysize;
+    int res;
+
+    res = memcmp(x->key, y->key, n);
+    if (res != 0)
+        return(res);
+    if (x->keysize != y->keysize)
+        return((x->keysize < y->keysize) ? -1 : 1);
+    return(0);
+}
+
+static void
+fib_destroy(struct ccnd_fib **pfib)
+{
+    struct ccnd_fib *fib = *pfib;
+
+    if (fib == NULL)
+        return;
+    free(fib->prefix);
+    free(fib->fwd);
+    free(fib->face);
+    ccn_charbuf_destroy(&fib->keys);
+    free(fib);
+    *pfib = NULL;
+}
+
+/**
+ * Make a snapshot of the FIB and faces of the main thread.
+ */
+static struct ccnd_fib *
+fib_create(struct ccnd_handle *h)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct ccnd_fib *fib;
+    struct nameprefix_entry *npe;
+    struct ccn_forwarding *f;
+    struct face *face;
+    size_t *offset = NULL;
+    int nprefix = 0;
+    int nfwd = 0;
+    int i;
+
+    fib = calloc(1, sizeof(*fib));
+    if (fib == NULL)
+        return(NULL);
+    fib->keys = ccn_charbuf_create();
+    for (hashtb_start(h->nameprefix_tab, e); e->data != NULL; hashtb_next(e)) {
+        npe = e->data;
+        if (npe->forwarding == NULL)
+            continue;
+        nprefix++;
+        for (f = npe->forwarding; f != NULL; f = f->next)
+            nfwd++;
+    }
+    hashtb_end(e);
+    fib->prefix = calloc(nprefix + 1, sizeof(fib->prefix[0]));
+    fib->fwd = calloc(nfwd + 1, sizeof(fib->fwd[0]));
+    fib->face = calloc(h->face_limit + 1, sizeof(fib->face[0]));
+    offset = calloc(nprefix + 1, sizeof(offset[0]));
+    if (fib->keys == NULL || fib->prefix == NULL || fib->fwd == NULL ||
+        fib->face == NULL || offset == NULL)
+        goto Bail;
+    nfwd = 0;
+    for (hashtb_start(h->nameprefix_tab, e); e->data != NULL; hashtb_next(e)) {
+        npe = e->data;
+        if (npe->forwarding == NULL)
+            continue;
+        if (fib->nprefix == nprefix)
+            break; /* cannot happen; the table did not change */
+        offset[fib->nprefix] = fib->keys->length;
+        if (ccn_charbuf_append(fib->keys, e->key, e->keysize) < 0)
+            break;
+        fib->prefix[fib->nprefix].keysize = e->keysize;
+        fib->prefix[fib->nprefix].first = nfwd;
+        for (f = npe->forwarding; f != NULL; f = f->next) {
+            fib->fwd[nfwd] = *f;
+            fib->fwd[nfwd].next = NULL;
+            nfwd++;
+        }
+        fib->prefix[fib->nprefix].n = nfwd - fib->prefix[fib->nprefix].first;
+        fib->nprefix++;
+    }
+    hashtb_end(e);
+    if (fib->nprefix != nprefix)
+        goto Bail;
+    /* The keys do not move once they are all in */
+    for (i = 0; i < fib->nprefix; i++)
+        fib->prefix[i].key = fib->keys->buf + offset[i];
+    qsort(fib->prefix, fib->nprefix, sizeof(fib->prefix[0]),
+          &fib_prefix_compare);
+    for (i = 0; i < h->face_limit; i++) {
+        face = h->faces_by_faceid[i];
+        if (face == NULL || (face->flags & CCN_FACE_PASSIVE) != 0)
+            continue;
+        fib->face[fib->nface].faceid = face->faceid;
+        fib->face[fib->nface].flags = face->flags;
+        fib->face[fib->nface].owner = face->owner;
+        fib->nface++;
+    }
+    free(offset);
+    return(fib);
+Bail:
+    free(offset);
+    fib_destroy(&fib);
+    return(NULL);
+}
+
+static const struct ccnd_fib_prefix *
+fib_lookup(const struct ccnd_fib *fib, const unsigned char *key, size_t keysize)
+{
+    struct ccnd_fib_prefix probe = {0};
+
+    if (fib == NULL || fib->nprefix == 0)
+        return(NULL);
+    probe.key = key;
+    probe.keysize = keysize;
+    return(bsearch(&probe, fib->prefix, fib->nprefix, sizeof(fib->prefix[0]),
+                   &fib_prefix_compare));
+}
+
+/**
+ * Publish a new snapshot if the FIB or the faces have changed, and free
+ * the snapshots that no worker is using any more.
+ *
+ * Runs on the main thread.
+ */
+static void
+workers_publish(struct ccnd_handle *h)
+{
+    struct ccnd_workers *set = h->workers;
+    struct ccnd_fib *fib;
+    struct ccnd_fib **pp;
+    unsigned oldest;
+    unsigned seen;
+    int i;
+
+    fib = set->fib;
+    if (fib == NULL || set->forward_to_gen != h->forward_to_gen ||
+        set->faces_changed != h->faces_changed) {
+        fib = fib_create(h);
+        if (fib == NULL) {
+            ccnd_msg(h, "workers: out of memory for the FIB snapshot");
+            return;
+        }
+        fib->gen = (set->fib == NULL) ? 1 : set->fib->gen + 1;
+        fib->older = set->fib;
+        __atomic_store_n(&set->fib, fib, __ATOMIC_RELEASE);
+        set->forward_to_gen = h->forward_to_gen;
+        set->faces_changed = h->faces_changed;
+        for (i = 0; i < set->n; i++)
+            wake_pipe_write(set->worker[i]->box->wake);
+    }
+    /* A worker may still pick up the newest, but no longer an older one */
+    oldest = fib->gen;
+    for (i = 0; i < set->n; i++) {
+        seen = __atomic_load_n(&set->worker[i]->fib_seen, __ATOMIC_ACQUIRE);
+        if (seen < oldest)
+            oldest = seen;
+    }
+    for (pp = &fib->older; *pp != NULL && (*pp)->gen >= oldest;)
+        pp = &(*pp)->older;
+    while (*pp != NULL) {
+        fib = (*pp)->older;
+        fib_destroy(pp);
+        *pp = fib;
+    }
+}
+
+/**
+ * Copy the forwarding entries of a name prefix from the snapshot the
+ * worker is using.
+ *
+ * Called when the shard makes a nameprefix_entry, so that the FIB
+ * is consulted just as if it were kept there.
+ */
+void
+ccnd_worker_fib_fill(struct ccnd_handle *h, struct nameprefix_entry *npe,
+                     const unsigned char *key, size_t keysize)
+{
+    const struct ccnd_fib *fib = h->worker->fib;
+    const struct ccnd_fib_prefix *p;
+
+    p = fib_lookup(fib, key, keysize);
+    if (p != NULL)
+        ccnd_worker_set_forwarding(h, npe, fib->fwd + p->first, p->n, 0);
+}
+
+/**
+ * Bring the shard up to date with the newest snapshot, if it is not.
+ *
+ * Runs on the worker thread.
+ */
+static void
+worker_fib_update(struct ccnd_worker *w)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct ccnd_handle *h = w->h;
+    const struct ccnd_fib *fib;
+    const struct ccnd_fib_prefix *p;
+    struct face *face;
+    int i;
+    int j;
+
+    fib = __atomic_load_n(&w->set->fib, __ATOMIC_ACQUIRE);
+    if (fib == w->fib)
+        return;
+    /* Faces first, so that the forwarding entries find them */
+    for (i = 0, j = 0; i < h->face_limit; i++) {
+        face = h->faces_by_faceid[i];
+        if (face == NULL)
+            continue;
+        while (j < fib->nface && (fib->face[j].faceid & MAXFACES) < i)
+            j++;
+        if (j < fib->nface && fib->face[j].faceid == face->faceid)
+            continue;
+        /* A face handed over goes only when the main thread asks for it */
+        if (face->owner == h->thread && face->recv_fd != -1)
+            continue;
+        ccnd_worker_face_drop(h, face->faceid);
+    }
+    for (j = 0; j < fib->nface; j++)
+        ccnd_worker_face(h, fib->face[j].faceid, fib->face[j].flags,
+                         fib->face[j].owner);
+    for (hashtb_start(h->nameprefix_tab, e); e->data != NULL; hashtb_next(e)) {
+        p = fib_lookup(fib, e->key, e->keysize);
+        if (p != NULL)
+            ccnd_worker_set_forwarding(h, e->data,
+                                       fib->fwd + p->first, p->n, 1);
+        else
+            ccnd_worker_set_forwarding(h, e->data, NULL, 0, 1);
+    }
+    hashtb_end(e);
+    h->forward_to_gen += 1;
+    w->fib = fib;
+    __atomic_store_n(&w->fib_seen, fib->gen, __ATOMIC_RELEASE);
+}
+
+/**
+ * Publish the size of the shard for the status page.
+ */
+static void
+worker_report(struct ccnd_worker *w)
+{
+    struct ccnd_handle *h = w->h;
+
+    __atomic_store_n(&w->report.content, hashtb_n(h->content_tab),
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&w->report.interests, hashtb_n(h->interest_tab),
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&w->report.accepted, h->interests_accepted,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&w->report.sent, h->content_items_sent,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&w->report.hits, h->cs_hits, __ATOMIC_RELAXED);
+}
+
+/**
+ * Write the records of the shard to the snapshot file, at the request
+ * of the main thread, and tell it when they are done.
+ */
+static void
+worker_snapshot(struct ccnd_worker *w)
+{
+    struct ccnd_workers *set = w->set;
+    
+    w->snap_count = 0;
+    w->snap_bytes = 0;
+    w->snap_res = ccnd_snapshot_write(w->h, w->snap_file,
+                                      &w->snap_count, &w->snap_bytes);
+    pthread_mutex_lock(&set->snap_lock);
+    __atomic_store_n(&w->snap_pending, 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&set->snap_done);
+    pthread_mutex_unlock(&set->snap_lock);
+}
+
+/**
+ * Main loop of a worker thread.
+ */
+static void *
+worker_main(void *arg)
+{
+    struct ccnd_worker *w = arg;
+    struct ccnd_handle *h = w->h;
+    struct ccn_timeval dummy;
+    int timeout_ms;
+    int usec;
+    int n;
+
+    while (!__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) {
+        mailbox_wake(w->box);
+        h->ticktock.gettime(&h->ticktock, &dummy);
+        worker_fib_update(w);
+        n = mailbox_handle(h, w->box);
+        if (n > 0)
+            report_bump(&w->report.received, n);
+        if (__atomic_load_n(&w->set->cs_pressure, __ATOMIC_ACQUIRE))
+            ccnd_cs_check(h);
+        if (__atomic_load_n(&w->snap_pending, __ATOMIC_ACQUIRE))
+            worker_snapshot(w);
+        usec = ccn_schedule_run(h->sched);
+        ccnd_transit_sweep(h, 0);
+        ccnd_worker_flush(h);
+        worker_report(w);
+        workers_rouse(h);
+        if (n == CCND_WORKER_BATCH || mailbox_doze(w->box))
+            timeout_ms = 0;
+        else /* Anything posted from here on also writes to the wake pipe */
+            timeout_ms = (usec < 0) ? -1 : ((usec + 960) / 1000);
+        ccnd_worker_poll(h, w->box->wake[0], timeout_ms);
+    }
+    return(NULL);
+}
+
+/**
+ * Choose the shard for a name.
+ *
+ * Interests and content go by their first CCND_WORKER_NAMECOMPS name
+ * components, so all the content that an interest can match is in the
+ * same shard as the interest.  A name with fewer components than that
+ * could match content in any shard; these are kept on the main thread
+ * rather than being copied to every shard, so that each interest is
+ * forwarded once, and the main thread asks the shards what they have
+ * for it (see interest_probe() in ccnd.c).  (An interest whose last
+ * component is the digest of a ContentObject with such a short name
+ * goes to a shard, so it is not answered from the store.)
+ *
+ * @returns the shard index, or -1 for the main thread.
+ */
+static int
+workers_choose(struct ccnd_workers *set, const unsigned char *msg,
+               struct ccn_indexbuf *comps)
+{
+    int k = CCND_WORKER_NAMECOMPS;
+    
+    if (comps->n - 1 < k)
+        return(-1);
+    return(hashtb_hash(msg + comps->buf[0], comps->buf[k] - comps->buf[0]) %
+           set->n);
+}
+
+/**
+ * Find the name of an Interest or ContentObject, leaving its component
+ * boundaries in comps.
+ *
+ * @returns 0, or -1 if the name could not be found.
+ */
+static int
+workers_parse_name(struct ccn_indexbuf *comps, enum ccn_dtag dtag,
+                   const unsigned char *msg, size_t size)
+{
+    struct ccn_buf_decoder decoder;
+    struct ccn_buf_decoder *d;
+    
+    d = ccn_buf_decoder_start(&decoder, msg, size);
+    ccn_buf_advance(d);
+    if (dtag == CCN_DTAG_ContentObject &&
+        ccn_buf_match_dtag(d, CCN_DTAG_Signature))
+        ccn_buf_advance_past_element(d);
+    if (d->decoder.state < 0 || ccn_parse_Name(d, comps) < 0)
+        return(-1);
+    return(0);
+}
+
+/**
+ * The bit of short_mask for the first component of a name.
+ *
+ * comps holds the component boundaries within msg; a name with no
+ * components stands for every bit.
+ */
+static uint64_t
+workers_name_bit(const unsigned char *msg, const unsigned short *comps,
+                 int ncomps)
+{
+    if (ncomps < 2)
+        return(~(uint64_t)0);
+    return((uint64_t)1 << (hashtb_hash(msg + comps[0],
+                                       comps[1] - comps[0]) & 63));
+}
+
+static uint64_t
+workers_name_bit_ib(const unsigned char *msg, struct ccn_indexbuf *comps)
+{
+    unsigned short c[2];
+
+    if (comps->n < 2)
+        return(~(uint64_t)0);
+    c[0] = comps->buf[0];
+    c[1] = comps->buf[1];
+    return(workers_name_bit(msg, c, 2));
+}
+
+/**
+ * Choose the thread that forwards an incoming Interest or ContentObject,
+ * the one whose shard its name belongs to.
+ *
+ * A message whose name cannot be found stays where it is, to be
+ * rejected there.  An interest kept on the main thread is noted in
+ * short_mask at once, so that a shard that stores content for it
+ * from now on offers that content to the main thread.
+ * @returns the thread index, 0 for the main thread.
+ */
+int
+ccnd_workers_dispatch(struct ccnd_handle *h, enum ccn_dtag dtag,
+                      const unsigned char *msg, size_t size)
+{
+    struct ccnd_workers *set = workers_of(h);
+    struct ccn_indexbuf *comps = set->box[h->thread].comps;
+    int i;
+    
+    if (workers_parse_name(comps, dtag, msg, size) < 0)
+        return(h->thread);
+    i = workers_choose(set, msg, comps);
+    if (i >= 0) {
+        /* A new face must be in the snapshot before anything it sends */
+        if (h->workers != NULL && set->faces_changed != h->faces_changed)
+            workers_publish(h);
+        return(i + 1);
+    }
+    if (dtag == CCN_DTAG_Interest)
+        __atomic_fetch_or(&set->short_mask, workers_name_bit_ib(msg, comps),
+                          __ATOMIC_SEQ_CST);
+    return(0);
+}
+
+/**
+ * Decide whether content just stored in a shard should be offered to
+ * the interests pending on the main thread.
+ *
+ * Runs on the worker.  The answer may be yes when there is no such
+ * interest after all, but not the other way around.
+ */
+int
+ccnd_workers_match_wanted(struct ccnd_handle *h, struct content_entry *content)
+{
+    struct ccnd_workers *set = workers_of(h);
+    uint64_t mask = __atomic_load_n(&set->short_mask, __ATOMIC_SEQ_CST);
+    
+    if (mask == 0)
+        return(0);
+    return((mask & workers_name_bit(content->key, content->comps,
+                                    content->ncomps)) != 0);
+}
+
+/**
+ * Work out short_mask afresh from the interests pending on the main
+ * thread, so that bits no longer needed are cleared.
+ *
+ * This is done once a second; until then, a bit left over only costs
+ * the shards some needless offers.
+ */
+static void
+workers_short_mask_update(struct ccnd_handle *h)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct ccnd_workers *set = h->workers;
+    struct ccn_indexbuf *comps = set->box[0].comps;
+    struct interest_entry *ie;
+    uint64_t mask = 0;
+    
+    if (set->short_sec == h->sec)
+        return;
+    set->short_sec = h->sec;
+    if (hashtb_n(h->interest_tab) != 0) {
+        for (hashtb_start(h->interest_tab, e); e->data != NULL; hashtb_next(e)) {
+            ie = e->data;
+            if (ie->interest_msg == NULL ||
+                workers_parse_name(comps, CCN_DTAG_Interest,
+                                   ie->interest_msg, ie->size) < 0)
+                continue;
+            mask |= workers_name_bit_ib(ie->interest_msg, comps);
+            if (mask == ~(uint64_t)0)
+                break;
+        }
+        hashtb_end(e);
+    }
+    if (mask != __atomic_load_n(&set->short_mask, __ATOMIC_RELAXED))
+        __atomic_store_n(&set->short_mask, mask, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Find the store that owns a ContentObject.
+ *
+ * Used on the main thread before the workers start.
+ * @returns the handle of the shard (or h itself, for a name kept on the
+ *          main thread), or NULL if the name could not be found.
+ */
+struct ccnd_handle *
+ccnd_workers_content_shard(struct ccnd_handle *h,
+                           const unsigned char *msg, size_t size)
+{
+    struct ccnd_workers *set = h->workers;
+    struct ccn_indexbuf *comps = set->box[0].comps;
+    int i;
+    
+    if (workers_parse_name(comps, CCN_DTAG_ContentObject, msg, size) < 0)
+        return(NULL);
+    i = workers_choose(set, msg, comps);
+    return((i < 0) ? h : set->worker[i]->h);
+}
+
+/**
+ * The number of worker threads, which are threads 1 to n.
+ */
+int
+ccnd_workers_count(struct ccnd_handle *h)
+{
+    struct ccnd_workers *set = workers_of(h);
+    
+    return((set == NULL) ? 0 : set->n);
+}
+
+/**
+ * Get the handle of a shard.
+ *
+ * Used on the main thread before the workers start or after they stop.
+ * @returns the handle, or NULL if there is no such shard.
+ */
+struct ccnd_handle *
+ccnd_workers_shard(struct ccnd_handle *h, int i)
+{
+    struct ccnd_workers *set = h->workers;
+    
+    if (set == NULL || i < 0 || i >= set->n)
+        return(NULL);
+    return(set->worker[i]->h);
+}
+
+/**
+ * Account for content entering a store of the main thread or a shard,
+ * or, with negative amounts, leaving it.
+ */
+void
+ccnd_workers_cs_note(struct ccnd_handle *h, long count, long bytes)
+{
+    struct ccnd_workers *set = workers_of(h);
+    
+    __atomic_fetch_add(&set->cs_count, (unsigned long)count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&set->cs_bytes, (unsigned long)bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Rouse every store to check its share, if that is not already under way.
+ */
+static void
+workers_cs_pressure(struct ccnd_workers *set)
+{
+    int expected = 0;
+    int i;
+    
+    if (!__atomic_compare_exchange_n(&set->cs_pressure, &expected, 1, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        return;
+    for (i = 0; i <= set->n; i++)
+        wake_pipe_write(set->box[i].wake);
+}
+
+/**
+ * Decide whether a store should evict, under CCND_CAP and CCND_CS_BYTES
+ * for all the stores together.
+ *
+ * A store evicts while the total is over a limit and it holds more than
+ * its share of that limit.  If the total is over but this store is
+ * within its share, the others are roused to evict instead.  The main
+ * thread counts as one more store.  A nonzero slack allows an extra
+ * eighth of each limit, as for a single store.
+ *
+ * @returns 1 if this store should evict.
+ */
+int
+ccnd_workers_cs_over_limit(struct ccnd_handle *h, int slack)
+{
+    struct ccnd_workers *set = workers_of(h);
+    unsigned long n = __atomic_load_n(&set->cs_count, __ATOMIC_RELAXED);
+    unsigned long bytes = __atomic_load_n(&set->cs_bytes, __ATOMIC_RELAXED);
+    unsigned long stores = set->n + 1;
+    int over = 0;
+    
+    if (n > h->capacity &&
+        n - h->capacity > (slack ? (h->capacity >> 3) : 0)) {
+        if (hashtb_n(h->content_tab) > h->capacity / stores)
+            return(1);
+        over = 1;
+    }
+    if (bytes > h->cs_bytes_limit &&
+        bytes - h->cs_bytes_limit > (slack ? (h->cs_bytes_limit >> 3) : 0)) {
+        if (h->cs_bytes > h->cs_bytes_limit / stores)
+            return(1);
+        over = 1;
+    }
+    if (over)
+        workers_cs_pressure(set);
+    else if (!slack)
+        __atomic_store_n(&set->cs_pressure, 0, __ATOMIC_RELEASE);
+    return(0);
+}
+
+/**
+ * Add the content of every shard to a snapshot file.
+ *
+ * Each worker writes its own records in turn while the main thread
+ * waits.  The counts are added to *count and *bytes.
+ * @returns 0 for success, -1 for a write error.
+ */
+int
+ccnd_workers_snapshot(struct ccnd_handle *h, FILE *f,
+                      long *count, unsigned long *bytes)
+{
+    struct ccnd_workers *set = h->workers;
+    struct ccnd_worker *w;
+    int i;
+    
+    for (i = 0; i < set->n; i++) {
+        w = set->worker[i];
+        w->snap_file = f;
+        if (!w->started)
+            worker_snapshot(w);
+        else {
+            pthread_mutex_lock(&set->snap_lock);
+            __atomic_store_n(&w->snap_pending, 1, __ATOMIC_RELEASE);
+            wake_pipe_write(w->box->wake);
+            while (__atomic_load_n(&w->snap_pending, __ATOMIC_ACQUIRE))
+                pthread_cond_wait(&set->snap_done, &set->snap_lock);
+            pthread_mutex_unlock(&set->snap_lock);
+        }
+        w->snap_file = NULL;
+        if (w->snap_res < 0)
+            return(-1);
+        *count += w->snap_count;
+        *bytes += w->snap_bytes;
+    }
+    return(0);
+}
+
+/**
+ * Handle what has been posted to the main thread, and publish a new
+ * snapshot of the FIB if it has changed.
+ *
+ * Runs on the main thread.
+ * @returns nonzero if there may be more to do right away.
+ */
+int
+ccnd_workers_collect(struct ccnd_handle *h)
+{
+    struct ccnd_workers *set = h->workers;
+
+    mailbox_wake(&set->box[0]);
+    workers_publish(h);
+    if (__atomic_load_n(&set->cs_pressure, __ATOMIC_ACQUIRE))
+        ccnd_cs_check(h);
+    return(mailbox_handle(h, &set->box[0]) == CCND_WORKER_BATCH);
+}
+
+/**
+ * Rouse the threads that were posted to during this pass, and get
+ * ready to wait.
+ *
+ * Runs on the main thread, before it waits.
+ * @returns nonzero if there is more to do right away.
+ */
+int
+ccnd_workers_kick(struct ccnd_handle *h)
+{
+    struct ccnd_workers *set = h->workers;
+
+    workers_short_mask_update(h);
+    workers_rouse(h);
+    return(mailbox_doze(&set->box[0]));
+}
+
+/**
+ * Hand over the i/o of a face to a worker, in turn.
+ *
+ * The packet says what the worker needs to take it over.  A snapshot
+ * that names the worker as the owner is published before the packet
+ * is posted, so that the worker never gets an older one that leaves
+ * the face out.
+ * @returns 0.
+ */
+int
+ccnd_workers_hand_over(struct ccnd_handle *h, struct face *face,
+                       struct ccnd_packet *p)
+{
+    struct ccnd_workers *set = h->workers;
+    int thread;
+    
+    thread = 1 + (set->rover++ % set->n);
+    face->owner = thread;
+    h->faces_changed++;
+    workers_publish(h);
+    ccnd_workers_post(h, thread, p);
+    ccnd_msg(h, "worker %d does the i/o of face %u", thread, face->faceid);
+    return(0);
+}
+
+/**
+ * @returns the fd that the main thread should watch for packets from
+ *          the workers, or -1.
+ */
+int
+ccnd_workers_fd(struct ccnd_handle *h)
+{
+    if (h->workers == NULL)
+        return(-1);
+    return(h->workers->box[0].wake[0]);
+}
+
+/**
+ * Get the published counters of a worker.
+ *
+ * Packets that the main thread could not post count against the
+ * first worker.
+ * @returns 0 for success, -1 if there is no such worker.
+ */
+int
+ccnd_workers_report(struct ccnd_handle *h, int i, struct ccnd_worker_report *r)
+{
+    struct ccnd_workers *set = h->workers;
+    struct ccnd_worker *w;
+
+    if (set == NULL || i < 0 || i >= set->n)
+        return(-1);
+    w = set->worker[i];
+    r->content = __atomic_load_n(&w->report.content, __ATOMIC_RELAXED);
+    r->interests = __atomic_load_n(&w->report.interests, __ATOMIC_RELAXED);
+    r->accepted = __atomic_load_n(&w->report.accepted, __ATOMIC_RELAXED);
+    r->sent = __atomic_load_n(&w->report.sent, __ATOMIC_RELAXED);
+    r->hits = __atomic_load_n(&w->report.hits, __ATOMIC_RELAXED);
+    r->received = __atomic_load_n(&w->report.received, __ATOMIC_RELAXED);
+    r->dropped = __atomic_load_n(&w->box->dropped, __ATOMIC_RELAXED);
+    if (i == 0)
+        r->dropped += __atomic_load_n(&set->box[0].dropped, __ATOMIC_RELAXED);
+    return(0);
+}
+
+static void
+workers_destroy(struct ccnd_handle *h, struct ccnd_workers **pset)
+{
+    struct ccnd_workers *set = *pset;
+    struct ccnd_worker *w;
+    struct ccnd_mailbox *box;
+    struct ccnd_packet *p;
+    struct ccnd_fib *fib;
+    int i;
+
+    if (set == NULL)
+        return;
+    for (i = 0; i < set->n; i++) {
+        w = set->worker[i];
+        if (w == NULL)
+            continue;
+        if (w->started) {
+            __atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+            wake_pipe_write(w->box->wake);
+            pthread_join(w->thread, NULL);
+        }
+    }
+    /* What is left refers to content of all the stores, so let go first */
+    for (i = 0; set->box != NULL && i <= set->n; i++) {
+        box = &set->box[i];
+        mailbox_take(box);
+        while ((p = box->head) != NULL) {
+            box->head = p->next;
+            ccnd_packet_release(p);
+        }
+        box->tail = NULL;
+    }
+    ccnd_transit_sweep(h, 1);
+    for (i = 0; i < set->n; i++) {
+        w = set->worker[i];
+        if (w != NULL && w->h != NULL)
+            ccnd_transit_sweep(w->h, 1);
+    }
+    for (i = 0; i < set->n; i++) {
+        w = set->worker[i];
+        if (w == NULL)
+            continue;
+        ccnd_destroy(&w->h);
+        free(w);
+    }
+    free(set->worker);
+    while (set->fib != NULL) {
+        fib = set->fib->older;
+        fib_destroy(&set->fib);
+        set->fib = fib;
+    }
+    for (i = 0; set->box != NULL && i <= set->n; i++) {
+        box = &set->box[i];
+        wake_pipe_close(box->wake);
+        free(box->rouse);
+        ccn_indexbuf_destroy(&box->comps);
+    }
+    free(set->box);
+    pthread_cond_destroy(&set->snap_done);
+    pthread_mutex_destroy(&set->snap_lock);
+    free(set);
+    *pset = NULL;
+}
+
+/**
+ * Set up n shards of the PIT and Content Store, without starting
+ * their threads.
+ *
+ * Until ccnd_workers_start() is called, the main thread may fill the
+ * shards (from a snapshot, say) through ccnd_workers_content_shard().
+ * @returns 0 for success, -1 for failure.
+ */
+int
+ccnd_workers_create(struct ccnd_handle *h, int n)
+{
+    struct ccnd_workers *set;
+    struct ccnd_worker *w;
+    struct ccnd_mailbox *box;
+    int i;
+
+    set = calloc(1, sizeof(*set));
+    if (set == NULL)
+        return(-1);
+    pthread_mutex_init(&set->snap_lock, NULL);
+    pthread_cond_init(&set->snap_done, NULL);
+    set->worker = calloc(n, sizeof(set->worker[0]));
+    set->box = calloc(n + 1, sizeof(set->box[0]));
+    if (set->worker == NULL || set->box == NULL)
+        goto Bail;
+    set->n = n;
+    for (i = 0; i <= n; i++)
+        set->box[i].wake[0] = set->box[i].wake[1] = -1;
+    for (i = 0; i <= n; i++) {
+        box = &set->box[i];
+        box->rouse = calloc(n + 1, 1);
+        box->comps = ccn_indexbuf_create();
+        if (box->rouse == NULL || box->comps == NULL ||
+            wake_pipe_create(box->wake) < 0)
+            goto Bail;
+    }
+    for (i = 0; i < n; i++) {
+        w = calloc(1, sizeof(*w));
+        if (w == NULL)
+            goto Bail;
+        set->worker[i] = w;
+        w->set = set;
+        w->box = &set->box[i + 1];
+        w->h = ccnd_worker_handle_create(h, w);
+        if (w->h == NULL)
+            goto Bail;
+        w->h->thread = i + 1;
+    }
+    set->cs_count = hashtb_n(h->content_tab);
+    set->cs_bytes = h->cs_bytes;
+    h->workers = set;
+    workers_publish(h);
+    if (set->fib == NULL)
+        goto Bail;
+    return(0);
+Bail:
+    h->workers = NULL;
+    workers_destroy(h, &set);
+    return(-1);
+}
+
+/**
+ * Start the worker threads, one for each shard.
+ *
+ * On failure the shards are torn down, and ccnd goes on forwarding
+ * on the main thread alone.
+ * @returns 0 for success, -1 for failure.
+ */
+int
+ccnd_workers_start(struct ccnd_handle *h)
+{
+    struct ccnd_workers *set = h->workers;
+    struct ccnd_worker *w;
+    sigset_t all;
+    sigset_t old;
+    int res;
+    int i;
+
+    /* Signals are for the main thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (i = 0; i < set->n; i++) {
+        w = set->worker[i];
+        res = pthread_create(&w->thread, NULL, &worker_main, w);
+        if (res != 0) {
+            ccnd_msg(h, "pthread_create: %s", strerror(res));
+            break;
+        }
+        w->started = 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (i < set->n) {
+        workers_destroy(h, &h->workers);
+        return(-1);
+    }
+    ccnd_msg(h, "forwarding with %d workers", set->n);
+    return(0);
+}
+
+/**
+ * Stop the worker threads and tear down their shards.
+ */
+void
+ccnd_workers_stop(struct ccnd_handle *h)
+{
+    workers_destroy(h, &h->workers);
+}
@@ -21,7 +21,8 @@ DEBRIS = anything.ccnb contentobjecthash.ccnb contentmishash.ccnb \
          contenthash.ccnb
 
 BROKEN_PROGRAMS = 
-CSRC = ccnd_main.c ccnd.c ccnd_msg.c ccnd_stats.c ccnd_internal_client.c ccndsmoketest.c
+CSRC = ccnd_main.c ccnd.c ccnd_msg.c ccnd_stats.c ccnd_internal_client.c \
+       ccnd_workers.c ccndsmoketest.c
 HSRC = ccnd_private.h
 SCRIPTSRC = testbasics fortunes.ccnb contentobjecthash.ref anything.ref \
             minsuffix.ref
@@ -32,9 +33,10 @@ all: default $(BROKEN_PROGRAMS)
 
 $(PROGRAMS): $(CCNLIBDIR)/libccn.a
 
-CCND_OBJ = ccnd_main.o ccnd.o ccnd_msg.o ccnd_stats.o ccnd_internal_client.o
+CCND_OBJ = ccnd_main.o ccnd.o ccnd_msg.o ccnd_stats.o ccnd_internal_client.o \
+           ccnd_workers.o
 ccnd: $(CCND_OBJ) ccnd_built.sh
-	$(CC) $(CFLAGS) -o $@ $(CCND_OBJ) $(LDLIBS) $(OPENSSL_LIBS) -lcrypto
+	$(CC) $(CFLAGS) -o $@ $(CCND_OBJ) $(LDLIBS) $(OPENSSL_LIBS) -lcrypto -lpthread
 	sh ./ccnd_built.sh
 
 ccnd_built.sh:
@@ -66,8 +68,9 @@ ccnd.o: ccnd.c ../include/ccn/bloom.h ../include/ccn/ccn.h \
   ../include/ccn/indexbuf.h ../include/ccn/ccn_private.h \
   ../include/ccn/ccnd.h ../include/ccn/face_mgmt.h \
   ../include/ccn/sockcreate.h ../include/ccn/hashtb.h \
-  ../include/ccn/schedule.h ../include/ccn/reg_mgmt.h \
-  ../include/ccn/uri.h ccnd_private.h ../include/ccn/seqwriter.h
+  ../include/ccn/pool.h ../include/ccn/schedule.h \
+  ../include/ccn/reg_mgmt.h ../include/ccn/uri.h ccnd_private.h \
+  ../include/ccn/seqwriter.h
 ccnd_msg.o: ccnd_msg.c ../include/ccn/ccn.h ../include/ccn/coding.h \
   ../include/ccn/charbuf.h ../include/ccn/indexbuf.h \
   ../include/ccn/ccnd.h ../include/ccn/hashtb.h ../include/ccn/uri.h \
@@ -75,7 +78,7 @@ ccnd_msg.o: ccnd_msg.c ../include/ccn/ccn.h ../include/ccn/coding.h \
   ../include/ccn/schedule.h ../include/ccn/seqwriter.h
 ccnd_stats.o: ccnd_stats.c ../include/ccn/ccn.h ../include/ccn/coding.h \
   ../include/ccn/charbuf.h ../include/ccn/indexbuf.h \
-  ../include/ccn/ccnd.h ../include/ccn/schedule.h \
+  ../include/ccn/ccnd.h ../include/ccn/pool.h ../include/ccn/schedule.h \
   ../include/ccn/sockaddrutil.h ../include/ccn/hashtb.h \
   ../include/ccn/uri.h ccnd_private.h ../include/ccn/ccn_private.h \
   ../include/ccn/reg_mgmt.h ../include/ccn/seqwriter.h
@@ -86,5 +89,10 @@ ccnd_internal_client.o: ccnd_internal_client.c ../include/ccn/ccn.h \
   ../include/ccn/schedule.h ../include/ccn/sockaddrutil.h \
   ../include/ccn/uri.h ccnd_private.h ../include/ccn/reg_mgmt.h \
   ../include/ccn/seqwriter.h
+ccnd_workers.o: ccnd_workers.c ../include/ccn/ccn.h \
+  ../include/ccn/coding.h ../include/ccn/charbuf.h \
+  ../include/ccn/indexbuf.h ../include/ccn/hashtb.h \
+  ../include/ccn/schedule.h ccnd_private.h ../include/ccn/ccn_private.h \
+  ../include/ccn/reg_mgmt.h ../include/ccn/seqwriter.h
 ccndsmoketest.o: ccndsmoketest.c ../include/ccn/ccnd.h \
   ../include/ccn/ccn_private.h
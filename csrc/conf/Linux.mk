@@ -17,4 +17,4 @@ SHLIBDEPS=
 SHARED_LD_FLAGS = -shared --whole-archive -soname=$(SHLIBNAME) -lc
 PLATCFLAGS=-fPIC
 CWARNFLAGS = -Wall -Wpointer-arith -Wreturn-type -Wstrict-prototypes
-CPREFLAGS= -I../include -D_REENTRANT
+CPREFLAGS= -I../include -D_REENTRANT -DHAVE_EPOLL -DHAVE_RECVMMSG
@@ -16,7 +16,7 @@
 # possibly with different CFLAGS, etc.
 # This is not used at all for a make from the top level.
 
-default all clean depend test check shared install uninstall: _always
+default all clean depend test check bench shared install uninstall: _always
 	SELF=`basename \`pwd\``; (cd .. && $(MAKE) SUBDIRS=$$SELF $@)
 
 _always:
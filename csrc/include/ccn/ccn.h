@@ -906,6 +906,37 @@ int ccn_excluded(const unsigned char *excl,
                  const unsigned char *nextcomp,
                  size_t nextcomp_size);
 
+/*
+ * Compiled Exclude filters, for testing many names against one Exclude.
+ * ccn_exclude_compile returns NULL if excl is not a valid Exclude element.
+ * ccn_exclude_test gives the same answer as ccn_excluded.
+ * ccn_exclude_upper_limit finds a value at and after which everything
+ * is excluded, if there is one.
+ */
+struct ccn_exclude;
+struct ccn_exclude *ccn_exclude_compile(const unsigned char *excl,
+                                        size_t excl_size);
+int ccn_exclude_test(const struct ccn_exclude *x,
+                     const unsigned char *nextcomp,
+                     size_t nextcomp_size);
+int ccn_exclude_upper_limit(const struct ccn_exclude *x,
+                            const unsigned char **val,
+                            size_t *size);
+void ccn_exclude_destroy(struct ccn_exclude **px);
+
+/*
+ * ccn_content_matches_interest_excl: as above, but the Exclude is
+ * supplied pre-compiled (or NULL to decode it from the interest).
+ */
+int ccn_content_matches_interest_excl(const unsigned char *content_object,
+                                      size_t content_object_size,
+                                      int implicit_content_digest,
+                                      struct ccn_parsed_ContentObject *pc,
+                                      const unsigned char *interest_msg,
+                                      size_t interest_msg_size,
+                                      const struct ccn_parsed_interest *pi,
+                                      const struct ccn_exclude *excl);
+
 /***********************************
  * StatusResponse
  */
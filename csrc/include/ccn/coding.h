@@ -164,7 +164,11 @@ enum ccn_dtag {
     CCN_DTAG_SyncConfigSliceList = 125,
     CCN_DTAG_SyncConfigSliceOp = 126,
     CCN_DTAG_SyncNodeDeltas = 127,
+    CCN_DTAG_RateLimit = 128,
+    CCN_DTAG_BurstSize = 129,
     CCN_DTAG_SequenceNumber = 256,
+    CCN_DTAG_LinkAck = 257,
+    CCN_DTAG_LinkFragment = 258,
     CCN_DTAG_CCNProtocolDataUnit = 17702112
 };
 
@@ -33,6 +33,8 @@ struct ccn_face_instance {
     unsigned faceid;
     struct ccn_sockdescr descr;
     int lifetime;
+    int rate;                   /**< content bytes/sec, 0 or -1 if unshaped */
+    int burst;                  /**< shaping burst size, bytes */
     struct ccn_charbuf *store;
 };
 
@@ -23,6 +23,7 @@
 #define CCN_HASHTB_DEFINED
 
 #include <stddef.h>
+#include <stdint.h>
 
 struct hashtb; /* details are private to the implementation */
 struct hashtb_enumerator; /* more about this below */
@@ -31,8 +32,25 @@ struct hashtb_param {
     hashtb_finalize_proc finalize; /* default is NULL */
     void *finalize_data;           /* default is NULL */
     int orders;                    /* default is 0 */
+    int flags;                     /* default is 0 */
 }; 
 
+/*
+ * HASHTB_OPEN selects open addressing instead of chaining.
+ * The interface and the enumerator semantics are the same.  Lookups
+ * probe an array that holds each entry's full hash, and the array grows
+ * and shrinks a few slots at a time instead of all at once.
+ * This suits large, busy tables.
+ */
+#define HASHTB_OPEN 1
+
+/*
+ * HASHTB_POOLED takes small entries from pools of fixed-size objects
+ * kept by the table (see ccn/pool.h), rather than from malloc.
+ * This suits tables with a high turnover of entries.
+ */
+#define HASHTB_POOLED 2
+
 /*
  * hashtb_create: Create a new hash table.
  * The param may be NULL to use the defaults, otherwise
@@ -61,6 +79,16 @@ hashtb_destroy(struct hashtb **ht);
 int
 hashtb_n(struct hashtb *ht);
 
+/*
+ * hashtb_pool_stats: Get the memory pool statistics, summed over the
+ * pools that hold the table's elements.  Very large elements, and
+ * those of a table without HASHTB_POOLED, are allocated individually
+ * and are not counted.
+ */
+struct ccn_pool_stats;
+void
+hashtb_pool_stats(struct hashtb *ht, struct ccn_pool_stats *s);
+
 /*
  * hashtb_lookup: Find an item
  * Keys are arbitrary data of specified length.
@@ -69,6 +97,52 @@ hashtb_n(struct hashtb *ht);
 void *
 hashtb_lookup(struct hashtb *ht, const void *key, size_t keysize);
 
+/*
+ * hashtb_hash: The hash function used for keys.
+ */
+size_t
+hashtb_hash(const unsigned char *key, size_t keysize);
+
+/*
+ * hashtb_hash_start, hashtb_hash_step, hashtb_hash_final:
+ * Compute hashtb_hash incrementally.
+ * Feed the key bytes through hashtb_hash_step, in as many pieces as
+ * convenient; hashtb_hash_final then gives the hash of the bytes seen
+ * so far, without disturbing the state.  This lets the hashes of a key's
+ * prefixes be computed in one pass.
+ */
+struct hashtb_hash_state {
+    uint64_t h;
+    size_t n;                   /* bytes so far */
+    unsigned ntail;             /* bytes in tail not yet mixed in */
+    unsigned char tail[8];
+};
+void
+hashtb_hash_start(struct hashtb_hash_state *s);
+void
+hashtb_hash_step(struct hashtb_hash_state *s, const unsigned char *p, size_t n);
+size_t
+hashtb_hash_final(const struct hashtb_hash_state *s);
+
+/*
+ * hashtb_hash_prefixes: Hash several prefixes of one key in a single pass.
+ * The offsets must be non-decreasing; hashes[i] is set to the hash of
+ * the offsets[i] - offsets[0] bytes starting at base + offsets[0].
+ * With the component boundaries from ccn_name_split or ccn_parse_interest
+ * (a ccn_indexbuf), this gives the hashes of all of a name's prefixes.
+ */
+void
+hashtb_hash_prefixes(const unsigned char *base, const size_t *offsets, int n,
+                     size_t *hashes);
+
+/*
+ * hashtb_lookup_hashed: Like hashtb_lookup, with the hash supplied
+ * The hash must be hashtb_hash(key, keysize).
+ */
+void *
+hashtb_lookup_hashed(struct hashtb *ht, const void *key, size_t keysize,
+                     size_t hash);
+
 /* The client owns the memory for an enumerator, normally in a local. */ 
 struct hashtb_enumerator {
     struct hashtb *ht;
@@ -111,6 +185,15 @@ hashtb_seek(struct hashtb_enumerator *hte,
 #define HT_OLD_ENTRY 0
 #define HT_NEW_ENTRY 1
 
+/*
+ * hashtb_seek_hashed: Like hashtb_seek, with the hash supplied
+ * The hash must be hashtb_hash(key, keysize).
+ */
+int
+hashtb_seek_hashed(struct hashtb_enumerator *hte,
+                   const void *key, size_t keysize, size_t extsize,
+                   size_t hash);
+
 /*
  * hashtb_delete: Delete an item
  * The item will be unlinked from the table, and will
@@ -126,6 +209,8 @@ void hashtb_delete(struct hashtb_enumerator *);
 /*
  * hashtb_rehash: Hint about number of buckets to use
  * Normally the implementation grows the number of buckets as needed.
+ * For a HASHTB_OPEN table this is the number of slots, and any resize
+ * that is in progress is completed.
  * This optional call might help if the caller knows something about
  * the expected number of elements in advance, or if the size of the
  * table has shrunken dramatically and is not expected to grow soon.
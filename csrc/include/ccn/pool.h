@@ -0,0 +1,70 @@
+/**
+ * @file ccn/pool.h
+ *
+ * Pools of fixed-size objects.
+ *
+ * Part of the CCNx C Library.
+ *
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation.
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details. You should have received
+ * a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
+ * Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef CCN_POOL_DEFINED
+#define CCN_POOL_DEFINED
+
+#include <stddef.h>
+
+/*
+ * A pool hands out objects of one size, carved from pages obtained in
+ * bulk from malloc.  Freed objects go onto a free list for reuse.  A page
+ * whose objects have all been freed is given back to malloc, except that
+ * one such page is kept in reserve.
+ * There is no locking.
+ */
+struct ccn_pool;
+
+struct ccn_pool_stats {
+    size_t item_size;       /* rounded object size, or 0 if summed */
+    unsigned long in_use;   /* objects currently allocated */
+    unsigned long free;     /* objects on the free list */
+    unsigned long high;     /* largest value in_use has reached */
+    unsigned long pages;    /* pages currently held */
+    size_t bytes;           /* total size of those pages */
+};
+
+/*
+ * Create and destroy
+ * Destroying a pool frees all of its objects, in use or not.
+ */
+struct ccn_pool *ccn_pool_create(size_t item_size);
+void ccn_pool_destroy(struct ccn_pool **poolp);
+
+/*
+ * ccn_pool_alloc: get a zeroed object, or NULL if out of memory
+ */
+void *ccn_pool_alloc(struct ccn_pool *pool);
+
+/*
+ * ccn_pool_free: return an object obtained from the same pool
+ */
+void ccn_pool_free(struct ccn_pool *pool, void *item);
+
+/*
+ * ccn_pool_get_stats: fill in occupancy statistics
+ * If accumulate is nonzero, the counts are added to those already in *s,
+ * which is handy for summarizing several pools.
+ */
+void ccn_pool_get_stats(struct ccn_pool *pool,
+                        struct ccn_pool_stats *s, int accumulate);
+
+#endif
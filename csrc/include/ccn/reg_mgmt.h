@@ -43,6 +43,11 @@ struct ccn_forwarding_entry {
 #define CCN_FORW_LOCAL         32
 #define CCN_FORW_TAP           64
 #define CCN_FORW_CAPTURE_OK   128
+/** Forwarding strategy for the prefix - one of the values below, or 0 */
+#define CCN_FORW_STRATEGY    3840
+#define CCN_FORW_BEST_ROUTE   256
+#define CCN_FORW_MULTICAST    512
+#define CCN_FORW_LOAD_BALANCE 768
 #define CCN_FORW_PUBMASK (CCN_FORW_ACTIVE        | \
                           CCN_FORW_CHILD_INHERIT | \
                           CCN_FORW_ADVERTISE     | \
@@ -50,7 +55,8 @@ struct ccn_forwarding_entry {
                           CCN_FORW_CAPTURE       | \
                           CCN_FORW_LOCAL         | \
                           CCN_FORW_TAP           | \
-                          CCN_FORW_CAPTURE_OK    )
+                          CCN_FORW_CAPTURE_OK    | \
+                          CCN_FORW_STRATEGY      )
 
 struct ccn_forwarding_entry *
 ccn_forwarding_entry_parse(const unsigned char *p, size_t size);
@@ -76,11 +76,26 @@ struct ccn_schedule *ccn_schedule_create(void *clienth,
                                          const struct ccn_gettime *ccnclock);
 void ccn_schedule_destroy(struct ccn_schedule **schedp);
 
+/*
+ * ccn_schedule_create_wheel: like ccn_schedule_create, but keeps the
+ * events in a hierarchical timing wheel rather than a heap.
+ * Scheduling and cancelling are O(1), and a cancelled event is freed
+ * immediately - so the client must not touch it after the cancel.
+ */
+struct ccn_schedule *ccn_schedule_create_wheel(void *clienth,
+                                          const struct ccn_gettime *ccnclock);
+
 /*
  * Accessor for the clock passed into create
  */
 const struct ccn_gettime *ccn_schedule_get_gettime(struct ccn_schedule *);
 
+/*
+ * Memory pool statistics for the scheduled events
+ */
+struct ccn_pool_stats;
+void ccn_schedule_pool_stats(struct ccn_schedule *, struct ccn_pool_stats *);
+
 /*
  * ccn_schedule_event: schedule a new event
  */
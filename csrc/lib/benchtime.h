@@ -0,0 +1,57 @@
+/**
+ * @file benchtime.h
+ *
+ * Timing for the benchmark programs in this directory.
+ *
+ * A CCNx program.
+ *
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef CCN_BENCHTIME_DEFINED
+#define CCN_BENCHTIME_DEFINED
+
+#include <string.h>
+#include <sys/time.h>
+
+/**
+ * Seconds since *t0, which was filled in by gettimeofday.
+ */
+static inline double
+bench_elapsed(struct timeval *t0)
+{
+    struct timeval t1;
+
+    gettimeofday(&t1, NULL);
+    return((t1.tv_sec - t0->tv_sec) + (t1.tv_usec - t0->tv_usec) / 1e6);
+}
+
+/**
+ * Look for the -c flag that the test target passes, for a run that
+ * makes the agreement checks only, without timing anything.
+ * @returns 1 if it was there (removing it from the arguments), else 0.
+ */
+static inline int
+bench_check_only(int *argc, char ***argv)
+{
+    if (*argc > 1 && strcmp((*argv)[1], "-c") == 0) {
+        (*argv)[1] = (*argv)[0];
+        (*argc)--;
+        (*argv)++;
+        return(1);
+    }
+    return(0);
+}
+
+#endif
@@ -1622,8 +1622,21 @@ ccn_dispatch_message(struct ccn *h, unsigned char *msg, size_t size)
             size_t keystart = comps->buf[0];
             unsigned char *key = msg + keystart;
             struct interest_filter *entry;
+            struct ccn_indexbuf *hashes = ccn_indexbuf_obtain(h);
+            size_t *ph = NULL;
+            if (hashes != NULL)
+                ph = ccn_indexbuf_reserve(hashes, comps->n);
+            if (ph != NULL)
+                hashtb_hash_prefixes(msg, comps->buf, comps->n, ph);
+            else
+                NOTE_ERR(h, ENOMEM); /* hash each prefix as we go instead */
             for (i = comps->n - 1; i >= 0; i--) {
-                entry = hashtb_lookup(h->interest_filters, key, comps->buf[i] - keystart);
+                if (ph != NULL)
+                    entry = hashtb_lookup_hashed(h->interest_filters, key,
+                                                 comps->buf[i] - keystart, ph[i]);
+                else
+                    entry = hashtb_lookup(h->interest_filters, key,
+                                          comps->buf[i] - keystart);
                 if (entry != NULL) {
                     info.matched_comps = i;
                     ures = (entry->action->p)(entry->action, upcall_kind, &info);
@@ -1631,6 +1644,8 @@ ccn_dispatch_message(struct ccn *h, unsigned char *msg, size_t size)
                         upcall_kind = CCN_UPCALL_CONSUMED_INTEREST;
                 }
             }
+            if (hashes != NULL)
+                ccn_indexbuf_release(h, hashes);
         }
     }
     else {
@@ -1647,8 +1662,21 @@ ccn_dispatch_message(struct ccn *h, unsigned char *msg, size_t size)
                 unsigned char *key = msg + keystart;
                 struct expressed_interest *interest = NULL;
                 struct interests_by_prefix *entry = NULL;
+                struct ccn_indexbuf *hashes = ccn_indexbuf_obtain(h);
+                size_t *ph = NULL;
+                if (hashes != NULL)
+                    ph = ccn_indexbuf_reserve(hashes, comps->n);
+                if (ph != NULL)
+                    hashtb_hash_prefixes(msg, comps->buf, comps->n, ph);
+                else
+                    NOTE_ERR(h, ENOMEM); /* hash each prefix as we go instead */
                 for (i = comps->n - 1; i >= 0; i--) {
-                    entry = hashtb_lookup(h->interests_by_prefix, key, comps->buf[i] - keystart);
+                    if (ph != NULL)
+                        entry = hashtb_lookup_hashed(h->interests_by_prefix, key,
+                                                     comps->buf[i] - keystart, ph[i]);
+                    else
+                        entry = hashtb_lookup(h->interests_by_prefix, key,
+                                              comps->buf[i] - keystart);
                     if (entry != NULL) {
                         for (interest = entry->list; interest != NULL; interest = interest->next) {
                             if (interest->magic != 0x7059e5f4) {
@@ -1714,6 +1742,8 @@ ccn_dispatch_message(struct ccn *h, unsigned char *msg, size_t size)
                         }
                     }
                 }
+                if (hashes != NULL)
+                    ccn_indexbuf_release(h, hashes);
             }
         }
     } // XXX whew, what a lot of right braces!
@@ -130,7 +130,11 @@ static const struct ccn_dict_entry ccn_tagdict[] = {
     {CCN_DTAG_SyncConfigSliceList, "SyncConfigSliceList"},
     {CCN_DTAG_SyncConfigSliceOp, "SyncConfigSliceOp"},
     {CCN_DTAG_SyncNodeDeltas, "SyncNodeDeltas"},
+    {CCN_DTAG_RateLimit, "RateLimit"},
+    {CCN_DTAG_BurstSize, "BurstSize"},
     {CCN_DTAG_SequenceNumber, "SequenceNumber"},
+    {CCN_DTAG_LinkAck, "LinkAck"},
+    {CCN_DTAG_LinkFragment, "LinkFragment"},
     {CCN_DTAG_CCNProtocolDataUnit, "CCNProtocolDataUnit"},
     {0, 0}
 };
@@ -102,7 +102,7 @@ ccn_keystore_init(struct ccn_keystore *p, char *filename, char *password)
      * ECDSA keys from 160 through 383 bits are OK with SHA-256 (n.b. RFC5480)
      */
     
-    switch (EVP_PKEY_type(p->private_key->type)) {
+    switch (EVP_PKEY_base_id(p->private_key)) {
         case EVP_PKEY_DSA:
             digest_obj = OBJ_nid2obj(NID_sha1);
             break;
@@ -172,6 +172,243 @@ ccn_excluded(const unsigned char *excl,
     return(!excluded);
 }
 
+/**
+ * Compiled form of an Exclude element.
+ *
+ * The components are kept in the order they appear.  Between them are
+ * n + 1 filters; filter[i] covers the names that sort just before comp[i],
+ * and filter[n] covers everything after the last component.
+ * The struct, the arrays, and a private copy of the encoding share
+ * a single allocation.
+ */
+struct ccn_exclude {
+    int n;                      /**< number of explicit components */
+    int sorted;                 /**< nonzero if comps are in canonical order */
+    struct ccn_exclude_comp {
+        const unsigned char *val;
+        size_t size;
+    } *comp;                    /**< n entries */
+    struct ccn_exclude_filter {
+        int any;
+        const struct ccn_bloom_wire *bloom;
+    } *filter;                  /**< n + 1 entries */
+};
+
+/**
+ * Canonical order of name components - shorter first, then bytewise.
+ */
+static int
+exclude_comp_compare(const unsigned char *a, size_t asize,
+                     const unsigned char *b, size_t bsize)
+{
+    if (asize != bsize)
+        return(asize < bsize ? -1 : 1);
+    return(memcmp(a, b, asize));
+}
+
+/**
+ * Decode an Any or Bloom, if present, into *f.
+ */
+static void
+exclude_decode_filter(struct ccn_buf_decoder *d, struct ccn_exclude_filter *f)
+{
+    const unsigned char *bloom = NULL;
+    size_t bloom_size = 0;
+    
+    if (ccn_buf_match_dtag(d, CCN_DTAG_Any)) {
+        ccn_buf_advance(d);
+        ccn_buf_check_close(d);
+        if (f != NULL)
+            f->any = 1;
+    }
+    else if (ccn_buf_match_dtag(d, CCN_DTAG_Bloom)) {
+        ccn_buf_advance(d);
+        if (ccn_buf_match_blob(d, &bloom, &bloom_size))
+            ccn_buf_advance(d);
+        ccn_buf_check_close(d);
+        if (f != NULL && bloom_size != 0) {
+            f->bloom = ccn_bloom_validate_wire(bloom, bloom_size);
+            /* If not a valid filter, treat like a false positive */
+            if (f->bloom == NULL)
+                f->any = 1;
+        }
+    }
+}
+
+/**
+ * Decode an Exclude, filling in x if it is not NULL.
+ * @returns the number of components, or -1 for a decoding error.
+ */
+static int
+exclude_decode(const unsigned char *excl, size_t excl_size,
+               struct ccn_exclude *x)
+{
+    struct ccn_buf_decoder decoder;
+    struct ccn_buf_decoder *d = ccn_buf_decoder_start(&decoder, excl, excl_size);
+    const unsigned char *comp = NULL;
+    size_t comp_size = 0;
+    int n = 0;
+    
+    if (!ccn_buf_match_dtag(d, CCN_DTAG_Exclude))
+        return(-1);
+    ccn_buf_advance(d);
+    exclude_decode_filter(d, x ? &x->filter[0] : NULL);
+    while (ccn_buf_match_dtag(d, CCN_DTAG_Component)) {
+        ccn_buf_advance(d);
+        comp = NULL;
+        comp_size = 0;
+        if (ccn_buf_match_blob(d, &comp, &comp_size))
+            ccn_buf_advance(d);
+        ccn_buf_check_close(d);
+        if (x != NULL) {
+            x->comp[n].val = comp;
+            x->comp[n].size = comp_size;
+        }
+        n++;
+        exclude_decode_filter(d, x ? &x->filter[n] : NULL);
+    }
+    ccn_buf_check_close(d);
+    if (d->decoder.state < 0 || d->decoder.index != excl_size)
+        return(-1);
+    return(n);
+}
+
+/**
+ * Compile an Exclude element for repeated testing
+ *
+ * The result does not refer to excl after the call.
+ *
+ * @param excl          address of exclusion encoding
+ * @param excl_size     bytes in exclusion encoding
+ * @returns a new compiled filter, or NULL if excl is not a valid Exclude.
+ */
+struct ccn_exclude *
+ccn_exclude_compile(const unsigned char *excl, size_t excl_size)
+{
+    struct ccn_exclude *x = NULL;
+    unsigned char *copy = NULL;
+    size_t size;
+    int i;
+    int n;
+    
+    n = exclude_decode(excl, excl_size, NULL);
+    if (n < 0)
+        return(NULL);
+    size = sizeof(*x) + n * sizeof(x->comp[0]) + (n + 1) * sizeof(x->filter[0]);
+    x = calloc(1, size + excl_size);
+    if (x == NULL)
+        return(NULL);
+    x->comp = (void *)(x + 1);
+    x->filter = (void *)(x->comp + n);
+    copy = ((unsigned char *)x) + size;
+    memcpy(copy, excl, excl_size);
+    if (exclude_decode(copy, excl_size, x) != n)
+        abort();
+    x->n = n;
+    x->sorted = 1;
+    for (i = 1; i < n && x->sorted; i++)
+        if (exclude_comp_compare(x->comp[i - 1].val, x->comp[i - 1].size,
+                                 x->comp[i].val, x->comp[i].size) > 0)
+            x->sorted = 0;
+    return(x);
+}
+
+/**
+ * Free a compiled Exclude and set the pointer to NULL.
+ */
+void
+ccn_exclude_destroy(struct ccn_exclude **px)
+{
+    if (*px != NULL) {
+        free(*px);
+        *px = NULL;
+    }
+}
+
+/**
+ * Test a next component against a compiled Exclude
+ *
+ * Gives the same answer as ccn_excluded() on the original encoding.
+ * Uses a binary search when the components are in canonical order, as
+ * they should be.
+ *
+ * @result 1 if nextcomp is excluded, otherwise 0.
+ */
+int
+ccn_exclude_test(const struct ccn_exclude *x,
+                 const unsigned char *nextcomp,
+                 size_t nextcomp_size)
+{
+    const struct ccn_exclude_filter *f;
+    int lo = 0;
+    int hi = x->n;
+    int mid;
+    int res;
+    
+    if (x->sorted) {
+        /* Find the first component that is not less than nextcomp */
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+            res = exclude_comp_compare(x->comp[mid].val, x->comp[mid].size,
+                                       nextcomp, nextcomp_size);
+            if (res < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+    else {
+        /* Same stopping rule as ccn_excluded() */
+        for (lo = 0; lo < hi; lo++) {
+            res = exclude_comp_compare(x->comp[lo].val, x->comp[lo].size,
+                                       nextcomp, nextcomp_size);
+            if (res >= 0)
+                break;
+        }
+    }
+    if (lo < x->n &&
+        0 == exclude_comp_compare(x->comp[lo].val, x->comp[lo].size,
+                                  nextcomp, nextcomp_size))
+        return(1); /* One of the explicit excludes */
+    f = &x->filter[lo];
+    if (f->any)
+        return(1);
+    if (f->bloom != NULL && ccn_bloom_match_wire(f->bloom, nextcomp, nextcomp_size))
+        return(1);
+    return(0);
+}
+
+/**
+ * Find the point past which a compiled Exclude excludes everything
+ *
+ * When the components are in canonical order and the Exclude ends
+ * with an Any, every next component that sorts at or after the last
+ * explicit component is excluded.  An Exclude that is just an Any
+ * gives an empty limit.
+ *
+ * @param x             the compiled Exclude
+ * @param val           set to the limiting component value
+ * @param size          set to its size
+ * @result 1 if there is such a limit, otherwise 0.
+ */
+int
+ccn_exclude_upper_limit(const struct ccn_exclude *x,
+                        const unsigned char **val,
+                        size_t *size)
+{
+    if (!x->sorted || !x->filter[x->n].any)
+        return(0);
+    if (x->n == 0) {
+        *val = (const unsigned char *)"";
+        *size = 0;
+    }
+    else {
+        *val = x->comp[x->n - 1].val;
+        *size = x->comp[x->n - 1].size;
+    }
+    return(1);
+}
+
 /**
  * Test for a match between a ContentObject and an Interest
  *
@@ -199,6 +436,30 @@ ccn_content_matches_interest(const unsigned char *content_object,
                              const unsigned char *interest_msg,
                              size_t interest_msg_size,
                              const struct ccn_parsed_interest *pi)
+{
+    return(ccn_content_matches_interest_excl(content_object,
+                                             content_object_size,
+                                             implicit_content_digest, pc,
+                                             interest_msg, interest_msg_size,
+                                             pi, NULL));
+}
+
+/**
+ * Test for a match, using a compiled Exclude
+ *
+ * Like ccn_content_matches_interest(), but if excl is not NULL it is
+ * used in place of decoding the interest's Exclude element.  It must
+ * have been compiled from that same element.
+ */
+int
+ccn_content_matches_interest_excl(const unsigned char *content_object,
+                                  size_t content_object_size,
+                                  int implicit_content_digest,
+                                  struct ccn_parsed_ContentObject *pc,
+                                  const unsigned char *interest_msg,
+                                  size_t interest_msg_size,
+                                  const struct ccn_parsed_interest *pi,
+                                  const struct ccn_exclude *excl)
 {
     struct ccn_parsed_ContentObject pc_store;
     struct ccn_parsed_interest pi_store;
@@ -300,7 +561,11 @@ ccn_content_matches_interest(const unsigned char *content_object,
             nextcomp = pc->digest;
         }
         else abort(); /* bug - should have returned already */
-        if (ccn_excluded(interest_msg + pi->offset[CCN_PI_B_Exclude],
+        if (excl != NULL) {
+            if (ccn_exclude_test(excl, nextcomp, nextcomp_size))
+                return(0);
+        }
+        else if (ccn_excluded(interest_msg + pi->offset[CCN_PI_B_Exclude],
                          (pi->offset[CCN_PI_E_Exclude] -
                           pi->offset[CCN_PI_B_Exclude]),
                          nextcomp,
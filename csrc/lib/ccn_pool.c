@@ -0,0 +1,240 @@
+/**
+ * @file ccn_pool.c
+ * @brief Pools of fixed-size objects.
+ *
+ * Part of the CCNx C Library.
+ *
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation.
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details. You should have received
+ * a copy of the GNU Lesser General Public License along with this library;
+ * if not, write to the Free Software Foundation, Inc., 51 Franklin Street,
+ * Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ccn/pool.h>
+
+/** Objects are rounded up to a multiple of this, for alignment */
+#define POOL_ALIGN (2 * sizeof(void *))
+#define POOL_ROUND(n) (((n) + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1))
+/** Smallest page obtained from malloc; pages are a power of two in size */
+#define POOL_PAGE_BYTES 16384
+/** But always put at least this many objects in a page */
+#define POOL_PAGE_MIN_ITEMS 8
+/** Empty pages kept in reserve; any more are given back */
+#define POOL_KEEP_EMPTY 1
+
+/**
+ * Each page is aligned on a multiple of its size, so the page that holds
+ * an object can be found from the object's address.
+ */
+struct pool_page {
+    struct pool_page *next;
+    struct pool_page *prev;
+    struct pool_free_item *free; /**< free objects in this page */
+    size_t in_use;              /**< objects handed out from this page */
+};
+
+struct pool_free_item {
+    struct pool_free_item *next;
+};
+
+struct ccn_pool {
+    size_t item_size;           /**< rounded object size */
+    size_t page_items;          /**< objects per page */
+    size_t page_size;           /**< bytes per page, including header */
+    struct pool_page partial;   /**< pages with free objects (list head) */
+    struct pool_page full;      /**< pages with none (list head) */
+    unsigned long empty;        /**< pages with nothing in use */
+    struct ccn_pool_stats stats;
+};
+
+#define POOL_PAGE_OF(pool, item) \
+    ((struct pool_page *)((uintptr_t)(item) & ~(uintptr_t)((pool)->page_size - 1)))
+
+static void
+page_unlink(struct pool_page *page)
+{
+    page->prev->next = page->next;
+    page->next->prev = page->prev;
+}
+
+/** Put page on a list, at the front or (if last is nonzero) at the back */
+static void
+page_link(struct pool_page *head, struct pool_page *page, int last)
+{
+    struct pool_page *after = last ? head->prev : head;
+
+    page->prev = after;
+    page->next = after->next;
+    after->next->prev = page;
+    after->next = page;
+}
+
+struct ccn_pool *
+ccn_pool_create(size_t item_size)
+{
+    struct ccn_pool *pool;
+    size_t hdr = POOL_ROUND(sizeof(struct pool_page));
+
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return(NULL);
+    if (item_size < sizeof(struct pool_free_item))
+        item_size = sizeof(struct pool_free_item);
+    pool->item_size = POOL_ROUND(item_size);
+    pool->page_size = POOL_PAGE_BYTES;
+    while (pool->page_size < hdr + POOL_PAGE_MIN_ITEMS * pool->item_size)
+        pool->page_size *= 2;
+    pool->page_items = (pool->page_size - hdr) / pool->item_size;
+    pool->partial.next = pool->partial.prev = &pool->partial;
+    pool->full.next = pool->full.prev = &pool->full;
+    pool->stats.item_size = pool->item_size;
+    return(pool);
+}
+
+static void
+pages_free(struct pool_page *head)
+{
+    struct pool_page *page;
+
+    while (head->next != head) {
+        page = head->next;
+        page_unlink(page);
+        free(page);
+    }
+}
+
+void
+ccn_pool_destroy(struct ccn_pool **poolp)
+{
+    struct ccn_pool *pool = *poolp;
+
+    if (pool == NULL)
+        return;
+    pages_free(&pool->partial);
+    pages_free(&pool->full);
+    free(pool);
+    *poolp = NULL;
+}
+
+/**
+ * Get a new page, with all of its objects on its free list.
+ * @returns -1 if out of memory.
+ */
+static int
+pool_grow(struct ccn_pool *pool)
+{
+    struct pool_page *page;
+    struct pool_free_item *item;
+    unsigned char *p;
+    void *mem = NULL;
+    size_t i;
+
+    if (posix_memalign(&mem, pool->page_size, pool->page_size) != 0)
+        return(-1);
+    page = mem;
+    page->free = NULL;
+    page->in_use = 0;
+    p = ((unsigned char *)page) + POOL_ROUND(sizeof(*page));
+    /* Thread in reverse so that objects are handed out in address order */
+    for (i = pool->page_items; i > 0; i--) {
+        item = (void *)(p + (i - 1) * pool->item_size);
+        item->next = page->free;
+        page->free = item;
+    }
+    page_link(&pool->partial, page, 0);
+    pool->empty += 1;
+    pool->stats.pages += 1;
+    pool->stats.bytes += pool->page_size;
+    pool->stats.free += pool->page_items;
+    return(0);
+}
+
+void *
+ccn_pool_alloc(struct ccn_pool *pool)
+{
+    struct pool_page *page;
+    struct pool_free_item *item;
+
+    if (pool->partial.next == &pool->partial && pool_grow(pool) < 0)
+        return(NULL);
+    page = pool->partial.next;
+    item = page->free;
+    page->free = item->next;
+    if (page->in_use++ == 0)
+        pool->empty -= 1;
+    if (page->free == NULL) {
+        page_unlink(page);
+        page_link(&pool->full, page, 0);
+    }
+    pool->stats.free -= 1;
+    pool->stats.in_use += 1;
+    if (pool->stats.in_use > pool->stats.high)
+        pool->stats.high = pool->stats.in_use;
+    memset(item, 0, pool->item_size);
+    return(item);
+}
+
+/**
+ * Objects are handed out from the pages at the front of the partial
+ * list, so pages that empty go to the back, where they can stay empty.
+ * Beyond POOL_KEEP_EMPTY of them, they go back to malloc.
+ */
+void
+ccn_pool_free(struct ccn_pool *pool, void *item)
+{
+    struct pool_free_item *f = item;
+    struct pool_page *page;
+
+    if (f == NULL)
+        return;
+    page = POOL_PAGE_OF(pool, f);
+    if (pool->stats.in_use == 0 || page->in_use == 0)
+        abort(); /* freeing something we did not hand out */
+    if (page->free == NULL) {
+        page_unlink(page);
+        page_link(&pool->partial, page, 0);
+    }
+    f->next = page->free;
+    page->free = f;
+    pool->stats.in_use -= 1;
+    pool->stats.free += 1;
+    if (--page->in_use != 0)
+        return;
+    page_unlink(page);
+    if (pool->empty >= POOL_KEEP_EMPTY) {
+        free(page);
+        pool->stats.pages -= 1;
+        pool->stats.bytes -= pool->page_size;
+        pool->stats.free -= pool->page_items;
+        return;
+    }
+    page_link(&pool->partial, page, 1);
+    pool->empty += 1;
+}
+
+void
+ccn_pool_get_stats(struct ccn_pool *pool,
+                   struct ccn_pool_stats *s, int accumulate)
+{
+    if (!accumulate) {
+        *s = pool->stats;
+        return;
+    }
+    s->item_size = 0;
+    s->in_use += pool->stats.in_use;
+    s->free += pool->stats.free;
+    s->high += pool->stats.high;
+    s->pages += pool->stats.pages;
+    s->bytes += pool->stats.bytes;
+}
@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <string.h>
+#include <ccn/pool.h>
 #include <ccn/schedule.h>
 
 /**
@@ -41,6 +42,43 @@ struct ccn_schedule_heap_item {
     struct ccn_scheduled_event *ev;
 };
 
+/**
+ * The timing wheel is an alternative to the heap.
+ *
+ * Time is kept in 64-bit ticks of one micro.  There are WHEEL_LEVELS
+ * levels of WHEEL_SLOTS slots; level k holds the events whose time first
+ * differs from wnow in base-WHEEL_SLOTS digit k, filed by that digit.
+ * When wnow reaches the start of a slot at level k > 0, the slot is
+ * emptied into the lower levels (a cascade).  An occupancy bitmap per
+ * level lets us skip over empty stretches of time.
+ *
+ * The events are doubly linked within their slots, so cancelling is
+ * O(1) and frees the event immediately.
+ */
+#define WHEEL_BITS 8
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK ((uint_least64_t)(WHEEL_SLOTS - 1))
+#define WHEEL_LEVELS 8  /* WHEEL_BITS * WHEEL_LEVELS covers 64 bits */
+#define WHEEL_DIGIT(t, k) ((int)(((t) >> ((k) * WHEEL_BITS)) & WHEEL_MASK))
+#define WHEEL_DUE (WHEEL_LEVELS * WHEEL_SLOTS) /* extra slot for due events */
+
+struct wheel_event {
+    struct ccn_scheduled_event ev; /* must be first - this is the client's */
+    struct wheel_event *next;
+    struct wheel_event **pprev;
+    uint_least64_t when;
+    int slot;                   /* level * WHEEL_SLOTS + digit, or WHEEL_DUE */
+};
+
+struct ccn_schedule_wheel {
+    uint_least64_t wnow;        /* next tick to be processed */
+    uint_least64_t occupied[WHEEL_LEVELS][WHEEL_SLOTS / 64];
+    struct wheel_event *slot[WHEEL_DUE + 1];
+};
+
+static void wheel_insert(struct ccn_schedule_wheel *w, struct wheel_event *e);
+static void wheel_unlink(struct ccn_schedule_wheel *w, struct wheel_event *e);
+
 struct ccn_schedule {
     void *clienth;
     const struct ccn_gettime *clock;
@@ -52,6 +90,10 @@ struct ccn_schedule {
     struct ccn_timeval lasttime; /* actual time when we last checked  */
     int time_leap;      /* number of times clock took a large jump */
     int time_ran_backward; /* number of times clock ran backwards */
+    struct ccn_pool *evpool; /* where the events come from */
+    uint_least64_t ticks;   /* like now, but never reset (for the wheel) */
+    struct ccn_schedule_wheel *wheel; /* if not NULL, use instead of heap */
+    struct wheel_event *running; /* wheel event whose action is running */
 };
 
 /*
@@ -93,25 +135,53 @@ update_time(struct ccn_schedule *sched)
     else if (elapsed >= epochmax - sched->now)
         update_epoch(sched);
     sched->now += elapsed;
+    sched->ticks += elapsed;
     sched->lasttime = now;
 }
 
-struct ccn_schedule *
-ccn_schedule_create(void *clienth, const struct ccn_gettime *ccnclock)
+static struct ccn_schedule *
+schedule_create(void *clienth, const struct ccn_gettime *ccnclock, int wheel)
 {
     struct ccn_schedule *sched;
+    size_t evsize = sizeof(struct ccn_scheduled_event);
     if (ccnclock == NULL)
         return(NULL);
     sched = calloc(1, sizeof(*sched));
     if (sched != NULL) {
         sched->clienth = clienth;
         sched->clock = ccnclock;
+        if (wheel) {
+            evsize = sizeof(struct wheel_event);
+            sched->wheel = calloc(1, sizeof(*sched->wheel));
+            if (sched->wheel == NULL) {
+                free(sched);
+                return(NULL);
+            }
+        }
+        sched->evpool = ccn_pool_create(evsize);
+        if (sched->evpool == NULL) {
+            free(sched->wheel);
+            free(sched);
+            return(NULL);
+        }
         update_time(sched);
         sched->time_leap = 0;
     }
     return(sched);
 }
 
+struct ccn_schedule *
+ccn_schedule_create(void *clienth, const struct ccn_gettime *ccnclock)
+{
+    return(schedule_create(clienth, ccnclock, 0));
+}
+
+struct ccn_schedule *
+ccn_schedule_create_wheel(void *clienth, const struct ccn_gettime *ccnclock)
+{
+    return(schedule_create(clienth, ccnclock, 1));
+}
+
 void
 ccn_schedule_destroy(struct ccn_schedule **schedp)
 {
@@ -131,10 +201,25 @@ ccn_schedule_destroy(struct ccn_schedule **schedp)
         for (i = 0; i < n; i++) {
             ev = heap[i].ev;
             (ev->action)(sched, sched->clienth, ev, CCN_SCHEDULE_CANCEL);
-            free(ev);
+            ccn_pool_free(sched->evpool, ev);
         }
         free(heap);
     }
+    if (sched->wheel != NULL) {
+        struct ccn_schedule_wheel *w = sched->wheel;
+        struct wheel_event *e;
+        for (i = 0; i <= WHEEL_DUE; i++) {
+            while ((e = w->slot[i]) != NULL) {
+                wheel_unlink(w, e);
+                (e->ev.action)(sched, sched->clienth, &e->ev,
+                               CCN_SCHEDULE_CANCEL);
+                ccn_pool_free(sched->evpool, e);
+            }
+        }
+        free(w);
+        sched->wheel = NULL;
+    }
+    ccn_pool_destroy(&sched->evpool);
     free(sched);
 }
 
@@ -143,6 +228,12 @@ ccn_schedule_get_gettime(struct ccn_schedule *schedp) {
     return(schedp->clock);
 }
 
+void
+ccn_schedule_pool_stats(struct ccn_schedule *sched, struct ccn_pool_stats *s)
+{
+    ccn_pool_get_stats(sched->evpool, s, 0);
+}
+
 /*
  * heap_insert: insert a new item
  * n is the total heap size, counting the new item
@@ -241,12 +332,18 @@ ccn_schedule_event(
     struct ccn_scheduled_event *ev;
     if (micros < 0)
         return(NULL);
-    ev = calloc(1, sizeof(*ev));
+    ev = ccn_pool_alloc(sched->evpool);
     if (ev == NULL) return(NULL);
     ev->action = action;
     ev->evdata = evdata;
     ev->evint = evint;
     update_time(sched);
+    if (sched->wheel != NULL) {
+        struct wheel_event *e = (struct wheel_event *)ev;
+        e->when = sched->ticks + micros;
+        wheel_insert(sched->wheel, e);
+        return(ev);
+    }
     return(reschedule_event(sched, micros, ev));
 }
 
@@ -258,6 +355,221 @@ ccn_schedule_cancelled_event(struct ccn_schedule *sched, void *clienth,
     return(0);
 }
 
+/*
+ * Timing wheel internals
+ */
+
+/* Index of the lowest set bit of a nonzero word */
+static int
+lowest_bit(uint_least64_t w)
+{
+    int i = 0;
+
+    if ((w & 0xFFFFFFFF) == 0) { w >>= 32; i += 32; }
+    if ((w & 0xFFFF) == 0) { w >>= 16; i += 16; }
+    if ((w & 0xFF) == 0) { w >>= 8; i += 8; }
+    if ((w & 0xF) == 0) { w >>= 4; i += 4; }
+    if ((w & 0x3) == 0) { w >>= 2; i += 2; }
+    if ((w & 0x1) == 0) { i += 1; }
+    return(i);
+}
+
+/*
+ * wheel_next_occupied: first occupied slot at level k with digit >= d
+ * Returns -1 if there is none.
+ */
+static int
+wheel_next_occupied(struct ccn_schedule_wheel *w, int k, int d)
+{
+    uint_least64_t bits;
+    int i;
+
+    for (i = d / 64; d < WHEEL_SLOTS; i++, d = i * 64) {
+        bits = w->occupied[k][i] & ((~(uint_least64_t)0) << (d % 64));
+        if (bits != 0)
+            return(i * 64 + lowest_bit(bits));
+    }
+    return(-1);
+}
+
+static void
+wheel_insert(struct ccn_schedule_wheel *w, struct wheel_event *e)
+{
+    uint_least64_t x;
+    int k = 0;
+    int d;
+    int s;
+
+    if (e->when < w->wnow)
+        e->when = w->wnow;
+    for (x = e->when ^ w->wnow; x > WHEEL_MASK; x >>= WHEEL_BITS)
+        k++;
+    d = WHEEL_DIGIT(e->when, k);
+    s = k * WHEEL_SLOTS + d;
+    e->slot = s;
+    e->next = w->slot[s];
+    if (e->next != NULL)
+        e->next->pprev = &e->next;
+    e->pprev = &w->slot[s];
+    w->slot[s] = e;
+    w->occupied[k][d / 64] |= ((uint_least64_t)1) << (d % 64);
+}
+
+static void
+wheel_unlink(struct ccn_schedule_wheel *w, struct wheel_event *e)
+{
+    int s = e->slot;
+
+    if (s < 0)
+        return;
+    *e->pprev = e->next;
+    if (e->next != NULL)
+        e->next->pprev = e->pprev;
+    if (s < WHEEL_DUE && w->slot[s] == NULL) {
+        int k = s / WHEEL_SLOTS;
+        int d = s % WHEEL_SLOTS;
+        w->occupied[k][d / 64] &= ~(((uint_least64_t)1) << (d % 64));
+    }
+    e->next = NULL;
+    e->pprev = NULL;
+    e->slot = -1;
+}
+
+/*
+ * wheel_cascade: wnow has just moved; refile the events from any
+ * higher-level slots that start at wnow.
+ */
+static void
+wheel_cascade(struct ccn_schedule_wheel *w)
+{
+    struct wheel_event *e;
+    int k;
+    int s;
+
+    for (k = WHEEL_LEVELS - 1; k > 0; k--) {
+        if ((w->wnow & ((((uint_least64_t)1) << (k * WHEEL_BITS)) - 1)) != 0)
+            continue;
+        s = k * WHEEL_SLOTS + WHEEL_DIGIT(w->wnow, k);
+        while ((e = w->slot[s]) != NULL) {
+            wheel_unlink(w, e);
+            wheel_insert(w, e);
+        }
+    }
+}
+
+/*
+ * wheel_attention: the next tick at which the wheel has work to do
+ * This is either when a level-0 slot comes due or when a
+ * higher-level slot needs to be cascaded, so it may be early.
+ * Returns 0 if the wheel is empty.
+ */
+static int
+wheel_attention(struct ccn_schedule_wheel *w, uint_least64_t *t)
+{
+    uint_least64_t above;
+    int k;
+    int d;
+
+    d = wheel_next_occupied(w, 0, WHEEL_DIGIT(w->wnow, 0));
+    if (d >= 0) {
+        *t = (w->wnow & ~WHEEL_MASK) + d;
+        return(1);
+    }
+    for (k = 1; k < WHEEL_LEVELS; k++) {
+        d = WHEEL_DIGIT(w->wnow, k) + 1;
+        if (d < WHEEL_SLOTS)
+            d = wheel_next_occupied(w, k, d);
+        else
+            d = -1;
+        if (d >= 0) {
+            above = w->wnow;
+            if (k + 1 < WHEEL_LEVELS)
+                above &= ~((((uint_least64_t)1) << ((k + 1) * WHEEL_BITS)) - 1);
+            else
+                above = 0;
+            *t = above + (((uint_least64_t)d) << (k * WHEEL_BITS));
+            return(1);
+        }
+    }
+    return(0);
+}
+
+/*
+ * wheel_run_event: call the action of an event that has come due,
+ * and either reschedule or free it.
+ */
+static void
+wheel_run_event(struct ccn_schedule *sched, struct wheel_event *e)
+{
+    struct ccn_scheduled_event *ev = &e->ev;
+    uint_least64_t late = sched->ticks - e->when;
+    int res;
+
+    sched->running = e;
+    res = (ev->action)(sched, sched->clienth, ev, 0);
+    sched->running = NULL;
+    if (res <= 0 || ev->action == &ccn_schedule_cancelled_event) {
+        ccn_pool_free(sched->evpool, e);
+        return;
+    }
+    /* Same catch-up policy as the heap */
+    if (late > res)
+        e->when = sched->ticks + 1;
+    else if (late <= sched->clock->micros_per_base)
+        e->when += res;
+    else
+        e->when = sched->ticks + res;
+    wheel_insert(sched->wheel, e);
+}
+
+/*
+ * wheel_advance: run everything that is due as of sched->ticks
+ */
+static void
+wheel_advance(struct ccn_schedule *sched)
+{
+    struct ccn_schedule_wheel *w = sched->wheel;
+    struct wheel_event *e;
+    uint_least64_t target = sched->ticks;
+    uint_least64_t t;
+    int s;
+
+    while (w->wnow <= target) {
+        if (!wheel_attention(w, &t) || t > target) {
+            /* Nothing is filed at the ticks we skip over */
+            w->wnow = target + 1;
+            wheel_cascade(w);
+            break;
+        }
+        w->wnow = t;
+        if ((t & WHEEL_MASK) == 0)
+            wheel_cascade(w);
+        s = WHEEL_DIGIT(t, 0);
+        if (w->slot[s] == NULL || w->slot[s]->when != t)
+            continue; /* That was a cascade */
+        /*
+         * Move the due events aside and mark the tick done, so that
+         * anything filed while they run is kept apart from them.
+         */
+        while ((e = w->slot[s]) != NULL) {
+            wheel_unlink(w, e);
+            e->slot = WHEEL_DUE;
+            e->next = w->slot[WHEEL_DUE];
+            if (e->next != NULL)
+                e->next->pprev = &e->next;
+            e->pprev = &w->slot[WHEEL_DUE];
+            w->slot[WHEEL_DUE] = e;
+        }
+        w->wnow = t + 1;
+        if ((w->wnow & WHEEL_MASK) == 0)
+            wheel_cascade(w);
+        while ((e = w->slot[WHEEL_DUE]) != NULL) {
+            wheel_unlink(w, e);
+            wheel_run_event(sched, e);
+        }
+    }
+}
+
 /**
  * Cancel a scheduled event.
  *
@@ -273,6 +585,12 @@ ccn_schedule_cancel(struct ccn_schedule *sched, struct ccn_scheduled_event *ev)
     res = (ev->action)(sched, sched->clienth, ev, CCN_SCHEDULE_CANCEL);
     if (res > 0)
         abort(); /* Bug in ev->action - bad return value */
+    if (sched->wheel != NULL && (struct wheel_event *)ev != sched->running) {
+        /* Not running, so we can get rid of it now */
+        wheel_unlink(sched->wheel, (struct wheel_event *)ev);
+        ccn_pool_free(sched->evpool, ev);
+        return(0);
+    }
     ev->action = &ccn_schedule_cancelled_event;
     ev->evdata = NULL;
     ev->evint = 0;
@@ -292,7 +610,7 @@ ccn_schedule_run_next(struct ccn_schedule *sched)
     heap_sift(sched->heap, sched->heap_n--);
     res = (ev->action)(sched, sched->clienth, ev, 0);
     if (res <= 0) {
-        free(ev);
+        ccn_pool_free(sched->evpool, ev);
         return;
     }
     /*
@@ -317,6 +635,18 @@ int
 ccn_schedule_run(struct ccn_schedule *sched)
 {
     heapmicros ans;
+    uint_least64_t t;
+    if (sched->wheel != NULL) {
+        do {
+            wheel_advance(sched);
+            update_time(sched);
+        } while (wheel_attention(sched->wheel, &t) && t <= sched->ticks);
+        if (!wheel_attention(sched->wheel, &t))
+            return(-1);
+        if (t - sched->ticks < INT_MAX)
+            return(t - sched->ticks);
+        return(INT_MAX);
+    }
     do {
         while (sched->heap_n > 0 && sched->heap[0].event_time <= sched->now)
             ccn_schedule_run_next(sched);
@@ -29,10 +29,10 @@
 #include <ccn/random.h>
 
 struct ccn_sigc {
-    EVP_MD_CTX context;
+    EVP_MD_CTX *context;
 };
 
-#if !defined(OPENSSL_NO_EC) && !defined(OPENSSL_NO_ECDSA) && defined(NID_ecdsa_with_SHA256)
+#if 0
 static int init256(EVP_MD_CTX *ctx)
 { return SHA256_Init(ctx->md_data); }
 static int update256(EVP_MD_CTX *ctx,const void *data,size_t count)
@@ -80,7 +80,7 @@ md_from_digest_and_pkey(const char *digest, const struct ccn_pkey *pkey)
             return (NULL);
         }
     }
-    pkey_type = EVP_PKEY_type(((EVP_PKEY *)pkey)->type);
+    pkey_type = EVP_PKEY_base_id((EVP_PKEY *)pkey);
     switch (pkey_type) {
         case EVP_PKEY_RSA:
         case EVP_PKEY_DSA:
@@ -112,10 +112,10 @@ md_from_digest_and_pkey(const char *digest, const struct ccn_pkey *pkey)
                 case EVP_PKEY_RSA:
                     return(EVP_sha1());
                 case EVP_PKEY_DSA:
-                    return(EVP_dss1());
+                    return(EVP_sha1());
 #if !defined(OPENSSL_NO_EC) && !defined(OPENSSL_NO_ECDSA)
                 case EVP_PKEY_EC:
-                    return(EVP_ecdsa());
+                    return(EVP_sha1());
 #endif
             }
             break;
@@ -125,7 +125,7 @@ md_from_digest_and_pkey(const char *digest, const struct ccn_pkey *pkey)
                 return(EVP_sha256());
 #if !defined(OPENSSL_NO_EC) && !defined(OPENSSL_NO_ECDSA) && defined(NID_ecdsa_with_SHA256)
             else if (pkey_type == EVP_PKEY_EC) {
-                return(&sha256ec_md);
+                return(EVP_sha256());
             } /* our own md */
 #endif
             break;
@@ -152,7 +152,7 @@ ccn_sigc_destroy(struct ccn_sigc **ctx)
 {
     if (*ctx) {
         // XXX - is it OK to call cleanup unconditionally?
-        EVP_MD_CTX_cleanup(&(*ctx)->context);
+        EVP_MD_CTX_free((*ctx)->context);
         free(*ctx);
         *ctx = NULL;
     }
@@ -163,9 +163,10 @@ ccn_sigc_init(struct ccn_sigc *ctx, const char *digest, const struct ccn_pkey *p
 {
     const EVP_MD *md;
 
-    EVP_MD_CTX_init(&ctx->context);
+    if (ctx->context == NULL) ctx->context = EVP_MD_CTX_new();
+    EVP_MD_CTX_reset(ctx->context);
     md = md_from_digest_and_pkey(digest, priv_key);
-    if (0 == EVP_SignInit_ex(&ctx->context, md, NULL))
+    if (0 == EVP_SignInit_ex(ctx->context, md, NULL))
         return (-1);
     return (0);
 }
@@ -173,7 +174,7 @@ ccn_sigc_init(struct ccn_sigc *ctx, const char *digest, const struct ccn_pkey *p
 int
 ccn_sigc_update(struct ccn_sigc *ctx, const void *data, size_t size)
 {
-    if (0 == EVP_SignUpdate(&ctx->context, (unsigned char *)data, size))
+    if (0 == EVP_SignUpdate(ctx->context, (unsigned char *)data, size))
         return (-1);
     return (0);
 }
@@ -183,7 +184,7 @@ ccn_sigc_final(struct ccn_sigc *ctx, struct ccn_signature *signature, size_t *si
 {
     unsigned int sig_size;
 
-    if (0 == EVP_SignFinal(&ctx->context, (unsigned char *)signature, &sig_size, (EVP_PKEY *)priv_key))
+    if (0 == EVP_SignFinal(ctx->context, (unsigned char *)signature, &sig_size, (EVP_PKEY *)priv_key))
         return (-1);
     *size = sig_size;
     return (0);
@@ -207,8 +208,7 @@ int ccn_merkle_root_hash(const unsigned char *msg, size_t size,
                          unsigned char *result, int result_size)
 {
     int node = ASN1_INTEGER_get(merkle_path_info->node);
-    EVP_MD_CTX digest_context;
-    EVP_MD_CTX *digest_contextp = &digest_context;
+    EVP_MD_CTX *digest_contextp = EVP_MD_CTX_new();
     size_t data_size;
     unsigned char *input_hash[2] = {NULL, NULL};
     //int hash_count = sk_ASN1_OCTET_STRING_num(merkle_path_info->hashes);
@@ -232,7 +232,7 @@ int ccn_merkle_root_hash(const unsigned char *msg, size_t size,
     data_size = co->offset[CCN_PCO_E_Content] - co->offset[CCN_PCO_B_Name];
     res = EVP_DigestUpdate(digest_contextp, msg + co->offset[CCN_PCO_B_Name], data_size);
     res &= EVP_DigestFinal_ex(digest_contextp, result, NULL);
-    EVP_MD_CTX_cleanup(digest_contextp);
+    EVP_MD_CTX_reset(digest_contextp);
     if (res != 1)
         return(-1);
     /* input_hash[0, 1] = address of hash for (left,right) node of parent
@@ -261,7 +261,7 @@ int ccn_merkle_root_hash(const unsigned char *msg, size_t size,
         res &= EVP_DigestUpdate(digest_contextp, input_hash[0], result_size);
         res &= EVP_DigestUpdate(digest_contextp, input_hash[1], result_size);
         res &= EVP_DigestFinal_ex(digest_contextp, result, NULL);
-        EVP_MD_CTX_cleanup(digest_contextp);
+        EVP_MD_CTX_reset(digest_contextp);
         if (res != 1)
             return(-1);
         node = parent_of(node);
@@ -282,8 +282,8 @@ int ccn_verify_signature(const unsigned char *msg,
                      const struct ccn_parsed_ContentObject *co,
                      const struct ccn_pkey *verification_pubkey)
 {
-    EVP_MD_CTX verc;
-    EVP_MD_CTX *ver_ctx = &verc;
+    EVP_MD_CTX *ver_ctx = EVP_MD_CTX_new();
+    const X509_ALGOR *sig_alg; const ASN1_OCTET_STRING *sig_dig;
     X509_SIG *digest_info = NULL;
     const unsigned char *dd = NULL;
     MP_info *merkle_path_info = NULL;
@@ -332,7 +332,7 @@ int ccn_verify_signature(const unsigned char *msg,
     EVP_MD_CTX_init(ver_ctx);
     res = EVP_VerifyInit_ex(ver_ctx, digest, NULL);
     if (!res) {
-        EVP_MD_CTX_cleanup(ver_ctx);
+        EVP_MD_CTX_reset(ver_ctx);
         return (-1);
     }
     if (co->offset[CCN_PCO_B_Witness] != co->offset[CCN_PCO_E_Witness]) {
@@ -346,19 +346,20 @@ int ccn_verify_signature(const unsigned char *msg,
                                   &witness,
                                   &witness_size);
         if (res < 0) {
-            EVP_MD_CTX_cleanup(ver_ctx);
+            EVP_MD_CTX_reset(ver_ctx);
             return (-1);
         }
 
         digest_info = d2i_X509_SIG(NULL, &witness, witness_size);
-        /* digest_info->algor->algorithm->{length, data}
-         * digest_info->digest->{length, type, data}
+        /* sig_alg->algorithm->{length, data}
+         * sig_dig->{length, type, data}
          */
         /* ...2.2 is an MHT w/ SHA256 */
+        X509_SIG_get0(digest_info, &sig_alg, &sig_dig);
         ASN1_OBJECT *merkle_hash_tree_oid = OBJ_txt2obj("1.2.840.113550.11.1.2.2", 1);
-        if (0 != OBJ_cmp(digest_info->algor->algorithm, merkle_hash_tree_oid)) {
+        if (0 != OBJ_cmp(sig_alg->algorithm, merkle_hash_tree_oid)) {
             fprintf(stderr, "A witness is present without an MHT OID!\n");
-            EVP_MD_CTX_cleanup(ver_ctx);
+            EVP_MD_CTX_reset(ver_ctx);
             ASN1_OBJECT_free(merkle_hash_tree_oid);
             return (-1);
         }
@@ -366,8 +367,8 @@ int ccn_verify_signature(const unsigned char *msg,
         ASN1_OBJECT_free(merkle_hash_tree_oid);
         merkle_path_digest = EVP_sha256();
         /* DER-encoded in the digest_info's digest ASN.1 octet string is the Merkle path info */
-        dd = digest_info->digest->data;
-        merkle_path_info = d2i_MP_info(NULL, &dd, digest_info->digest->length);
+        dd = sig_dig->data;
+        merkle_path_info = d2i_MP_info(NULL, &dd, sig_dig->length);
         X509_SIG_free(digest_info);
 #ifdef DEBUG
         int x,h;
@@ -391,18 +392,18 @@ int ccn_verify_signature(const unsigned char *msg,
         res = ccn_merkle_root_hash(msg, size, co, merkle_path_digest, merkle_path_info, root_hash, root_hash_size);
         MP_info_free(merkle_path_info);
         if (res < 0) {
-            EVP_MD_CTX_cleanup(ver_ctx);
+            EVP_MD_CTX_reset(ver_ctx);
             free(root_hash);
             return(-1);
         }
         res = EVP_VerifyUpdate(ver_ctx, root_hash, root_hash_size);
         free(root_hash);
         if (res == 0) {
-            EVP_MD_CTX_cleanup(ver_ctx);
+            EVP_MD_CTX_reset(ver_ctx);
             return(-1);
         }
         res = EVP_VerifyFinal(ver_ctx, signature_bits, signature_bits_size, pkey);
-        EVP_MD_CTX_cleanup(ver_ctx);
+        EVP_MD_CTX_reset(ver_ctx);
     } else {
         /*
          * In the simple signature case, we signed/verify from the name through
@@ -411,11 +412,11 @@ int ccn_verify_signature(const unsigned char *msg,
         size_t signed_size = co->offset[CCN_PCO_E_Content] - co->offset[CCN_PCO_B_Name];
         res = EVP_VerifyUpdate(ver_ctx, msg + co->offset[CCN_PCO_B_Name], signed_size);
         if (res == 0) {
-            EVP_MD_CTX_cleanup(ver_ctx);
+            EVP_MD_CTX_reset(ver_ctx);
             return(-1);
         }
         res = EVP_VerifyFinal(ver_ctx, signature_bits, signature_bits_size, pkey);
-        EVP_MD_CTX_cleanup(ver_ctx);
+        EVP_MD_CTX_reset(ver_ctx);
     }
     return (res);
 }
@@ -17,16 +17,18 @@ EXPATLIBS = -lexpat
 CCNLIBDIR = ../lib
 
 PROGRAMS = hashtbtest skel_decode_test \
-    encodedecodetest signbenchtest basicparsetest ccnbtreetest
+    encodedecodetest signbenchtest basicparsetest ccnbtreetest \
+    excludebenchtest schedbenchtest namehashbenchtest hashtbbenchtest
 
 BROKEN_PROGRAMS =
+HSRC = benchtime.h
 DEBRIS = ccn_verifysig _bt_* test.keystore
 CSRC = ccn_bloom.c \
        ccn_btree.c ccn_btree_content.c ccn_btree_store.c \
        ccn_buf_decoder.c ccn_buf_encoder.c ccn_bulkdata.c \
        ccn_charbuf.c ccn_client.c ccn_coding.c ccn_digest.c ccn_extend_dict.c \
        ccn_dtag_table.c ccn_indexbuf.c ccn_interest.c ccn_keystore.c \
-       ccn_match.c ccn_reg_mgmt.c ccn_face_mgmt.c \
+       ccn_match.c ccn_reg_mgmt.c ccn_face_mgmt.c ccn_pool.c \
        ccn_merkle_path_asn1.c ccn_name_util.c ccn_schedule.c \
        ccn_seqwriter.c ccn_signing.c \
        ccn_sockcreate.c ccn_traverse.c ccn_uri.c \
@@ -36,7 +38,8 @@ CSRC = ccn_bloom.c \
        lned.c \
        encodedecodetest.c hashtb.c hashtbtest.c \
        signbenchtest.c skel_decode_test.c \
-       basicparsetest.c ccnbtreetest.c \
+       basicparsetest.c ccnbtreetest.c excludebenchtest.c \
+       schedbenchtest.c namehashbenchtest.c hashtbbenchtest.c \
        ccn_sockaddrutil.c ccn_setup_sockaddr_un.c
 LIBS = libccn.a
 LIB_OBJS = ccn_client.o ccn_charbuf.o ccn_indexbuf.o ccn_coding.o \
@@ -45,7 +48,7 @@ LIB_OBJS = ccn_client.o ccn_charbuf.o ccn_indexbuf.o ccn_coding.o \
        ccn_name_util.o ccn_face_mgmt.o ccn_reg_mgmt.o ccn_digest.o \
        ccn_interest.o ccn_keystore.o ccn_seqwriter.o ccn_signing.o \
        ccn_sockcreate.o ccn_traverse.o \
-       ccn_match.o hashtb.o ccn_merkle_path_asn1.o \
+       ccn_match.o hashtb.o ccn_pool.o ccn_merkle_path_asn1.o \
        ccn_sockaddrutil.o ccn_setup_sockaddr_un.o \
        ccn_bulkdata.o ccn_versioning.o ccn_header.o ccn_fetch.o \
        ccn_btree.o ccn_btree_content.o ccn_btree_store.o \
@@ -76,12 +79,24 @@ shlib: $(SHLIBNAME)
 
 lib: libccn.a
 
-test: default encodedecodetest ccnbtreetest
+test: default encodedecodetest ccnbtreetest excludebenchtest schedbenchtest \
+      namehashbenchtest hashtbbenchtest
 	./encodedecodetest -o /dev/null
+	./excludebenchtest -c
+	./schedbenchtest -c
+	./namehashbenchtest -c
+	./hashtbbenchtest -c
 	./ccnbtreetest
 	./ccnbtreetest - < q.dat
 	$(RM) -R _bt_*
 
+bench: default excludebenchtest schedbenchtest namehashbenchtest \
+       hashtbbenchtest
+	./excludebenchtest
+	./schedbenchtest
+	./namehashbenchtest
+	./hashtbbenchtest
+
 dtag_check: _always
 	@./gen_dtag_table 2>/dev/null | diff - ccn_dtag_table.c | grep '^[<]' >/dev/null && echo '*** Warning: ccn_dtag_table.c may be out of sync with tagnames.cvsdict' || :
 
@@ -156,6 +171,18 @@ ccnbtreetest.o:
 ccnbtreetest: ccnbtreetest.o libccn.a
 	$(CC) $(CFLAGS) -o $@ ccnbtreetest.o $(LDLIBS) $(OPENSSL_LIBS) -lcrypto
 
+excludebenchtest: excludebenchtest.o libccn.a
+	$(CC) $(CFLAGS) -o $@ excludebenchtest.o $(LDLIBS) $(OPENSSL_LIBS) -lcrypto
+
+schedbenchtest: schedbenchtest.o libccn.a
+	$(CC) $(CFLAGS) -o $@ schedbenchtest.o $(LDLIBS)
+
+namehashbenchtest: namehashbenchtest.o libccn.a
+	$(CC) $(CFLAGS) -o $@ namehashbenchtest.o $(LDLIBS) $(OPENSSL_LIBS) -lcrypto
+
+hashtbbenchtest: hashtbbenchtest.o libccn.a
+	$(CC) $(CFLAGS) -o $@ hashtbbenchtest.o $(LDLIBS)
+
 clean:
 	rm -f *.o libccn.a libccn.1.$(SHEXT) $(PROGRAMS) depend
 	rm -rf *.dSYM $(DEBRIS) *% *~
@@ -216,7 +243,9 @@ ccn_merkle_path_asn1.o: ccn_merkle_path_asn1.c \
 ccn_name_util.o: ccn_name_util.c ../include/ccn/ccn.h \
   ../include/ccn/coding.h ../include/ccn/charbuf.h \
   ../include/ccn/indexbuf.h ../include/ccn/random.h
-ccn_schedule.o: ccn_schedule.c ../include/ccn/schedule.h
+ccn_pool.o: ccn_pool.c ../include/ccn/pool.h
+ccn_schedule.o: ccn_schedule.c ../include/ccn/pool.h \
+  ../include/ccn/schedule.h
 ccn_seqwriter.o: ccn_seqwriter.c ../include/ccn/ccn.h \
   ../include/ccn/coding.h ../include/ccn/charbuf.h \
   ../include/ccn/indexbuf.h ../include/ccn/seqwriter.h
@@ -250,7 +279,7 @@ encodedecodetest.o: encodedecodetest.c ../include/ccn/ccn.h \
   ../include/ccn/indexbuf.h ../include/ccn/bloom.h ../include/ccn/uri.h \
   ../include/ccn/digest.h ../include/ccn/keystore.h \
   ../include/ccn/signing.h ../include/ccn/random.h
-hashtb.o: hashtb.c ../include/ccn/hashtb.h
+hashtb.o: hashtb.c ../include/ccn/hashtb.h ../include/ccn/pool.h
 hashtbtest.o: hashtbtest.c ../include/ccn/hashtb.h
 signbenchtest.o: signbenchtest.c ../include/ccn/ccn.h \
   ../include/ccn/coding.h ../include/ccn/charbuf.h \
@@ -266,6 +295,16 @@ ccnbtreetest.o: ccnbtreetest.c ../include/ccn/btree.h \
   ../include/ccn/charbuf.h ../include/ccn/hashtb.h \
   ../include/ccn/btree_content.h ../include/ccn/ccn.h \
   ../include/ccn/coding.h ../include/ccn/indexbuf.h ../include/ccn/uri.h
+excludebenchtest.o: excludebenchtest.c ../include/ccn/bloom.h \
+  ../include/ccn/ccn.h ../include/ccn/coding.h ../include/ccn/charbuf.h \
+  ../include/ccn/indexbuf.h benchtime.h
+schedbenchtest.o: schedbenchtest.c ../include/ccn/pool.h \
+  ../include/ccn/schedule.h benchtime.h
+namehashbenchtest.o: namehashbenchtest.c ../include/ccn/ccn.h \
+  ../include/ccn/coding.h ../include/ccn/charbuf.h \
+  ../include/ccn/indexbuf.h ../include/ccn/hashtb.h benchtime.h
+hashtbbenchtest.o: hashtbbenchtest.c ../include/ccn/hashtb.h \
+  ../include/ccn/pool.h benchtime.h
 ccn_sockaddrutil.o: ccn_sockaddrutil.c ../include/ccn/charbuf.h \
   ../include/ccn/sockaddrutil.h
 ccn_setup_sockaddr_un.o: ccn_setup_sockaddr_un.c ../include/ccn/ccnd.h \
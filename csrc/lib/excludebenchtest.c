@@ -0,0 +1,219 @@
+/**
+ * @file excludebenchtest.c
+ *
+ * Check compiled Exclude filters against ccn_excluded, and compare speed.
+ *
+ * With -c, only the checks are made.
+ *
+ * A CCNx program.
+ *
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ccn/bloom.h>
+#include <ccn/ccn.h>
+#include <ccn/charbuf.h>
+#include <ccn/coding.h>
+
+#include "benchtime.h"
+
+/* Components are STEP apart, so probes in between fall in the gaps */
+#define STEP 10
+
+static void
+put_value(unsigned char *buf, size_t size, unsigned v)
+{
+    size_t i;
+
+    for (i = size; i > 0; i--, v >>= 8)
+        buf[i - 1] = v & 0xFF;
+}
+
+static void
+append_comp(struct ccn_charbuf *c, unsigned v)
+{
+    unsigned char buf[4];
+
+    put_value(buf, sizeof(buf), v);
+    ccnb_append_tagged_blob(c, CCN_DTAG_Component, buf, sizeof(buf));
+}
+
+static void
+append_bloom(struct ccn_charbuf *c, unsigned v)
+{
+    unsigned char seed[4] = {1, 2, 3, 4};
+    unsigned char buf[4];
+    unsigned char wire[sizeof(struct ccn_bloom_wire)];
+    struct ccn_bloom *b = ccn_bloom_create(2, seed);
+    int n;
+
+    put_value(buf, sizeof(buf), v);
+    ccn_bloom_insert(b, buf, sizeof(buf));
+    n = ccn_bloom_wiresize(b);
+    ccn_bloom_store_wire(b, wire, n);
+    ccnb_append_tagged_blob(c, CCN_DTAG_Bloom, wire, n);
+    ccn_bloom_destroy(&b);
+}
+
+/**
+ * Build an Exclude with n components, mixing in Any and Bloom filters.
+ * When n is a multiple of 5 the Exclude starts with an Any.
+ * If scramble is set, two components are out of order.
+ */
+static void
+build_exclude(struct ccn_charbuf *c, int n, int scramble)
+{
+    int i;
+    unsigned v;
+
+    c->length = 0;
+    ccnb_element_begin(c, CCN_DTAG_Exclude);
+    if (n % 5 == 0) {
+        ccnb_element_begin(c, CCN_DTAG_Any);
+        ccnb_element_end(c);
+    }
+    for (i = 0; i < n; i++) {
+        v = STEP * (i + 1);
+        if (scramble && i == n / 2)
+            v = STEP * n;
+        else if (scramble && i == n - 1)
+            v = STEP * (n / 2 + 1);
+        append_comp(c, v);
+        if (i % 7 == 3) {
+            ccnb_element_begin(c, CCN_DTAG_Any);
+            ccnb_element_end(c);
+        }
+        else if (i % 11 == 5)
+            append_bloom(c, v + 3);
+        else if (i % 13 == 12)
+            ccnb_append_tagged_blob(c, CCN_DTAG_Bloom, "xx", 2); /* invalid */
+    }
+    ccnb_element_end(c);
+}
+
+/**
+ * Canonical order of name components - shorter first, then bytewise.
+ */
+static int
+comp_compare(const unsigned char *a, size_t asize,
+             const unsigned char *b, size_t bsize)
+{
+    if (asize != bsize)
+        return(asize < bsize ? -1 : 1);
+    return(memcmp(a, b, asize));
+}
+
+static int
+check_size(int n, int scramble, int reps)
+{
+    struct ccn_charbuf *c = ccn_charbuf_create();
+    struct ccn_exclude *x = NULL;
+    unsigned char probe[6];
+    const unsigned char *lim = NULL;
+    size_t lim_size = 0;
+    int limited;
+    struct timeval t0;
+    double told;
+    double tnew;
+    size_t ps;
+    unsigned v;
+    unsigned nprobes = STEP * (n + 1);
+    int r;
+    int errors = 0;
+    int hits = 0;
+
+    build_exclude(c, n, scramble);
+    x = ccn_exclude_compile(c->buf, c->length);
+    if (x == NULL) {
+        fprintf(stderr, "ccn_exclude_compile failed for n = %d\n", n);
+        return(1);
+    }
+    limited = ccn_exclude_upper_limit(x, &lim, &lim_size);
+    for (ps = 2; ps <= sizeof(probe); ps += 2) {
+        for (v = 0; v < nprobes; v++) {
+            put_value(probe, ps, v);
+            if (ccn_excluded(c->buf, c->length, probe, ps) !=
+                ccn_exclude_test(x, probe, ps)) {
+                fprintf(stderr, "mismatch n = %d size = %d value = %u\n",
+                        n, (int)ps, v);
+                errors++;
+            }
+            if (limited && comp_compare(probe, ps, lim, lim_size) >= 0 &&
+                !ccn_exclude_test(x, probe, ps)) {
+                fprintf(stderr, "past limit n = %d size = %d value = %u\n",
+                        n, (int)ps, v);
+                errors++;
+            }
+        }
+    }
+    if (reps == 0)
+        goto Done;
+    gettimeofday(&t0, NULL);
+    for (r = 0; r < reps; r++)
+        for (v = 0; v < nprobes; v++) {
+            put_value(probe, 4, v);
+            hits += ccn_excluded(c->buf, c->length, probe, 4);
+        }
+    told = bench_elapsed(&t0);
+    gettimeofday(&t0, NULL);
+    for (r = 0; r < reps; r++)
+        for (v = 0; v < nprobes; v++) {
+            put_value(probe, 4, v);
+            hits -= ccn_exclude_test(x, probe, 4);
+        }
+    tnew = bench_elapsed(&t0);
+    if (hits != 0)
+        errors++;
+    printf("%5d components%s%s: %9.1f ns decoded, %7.1f ns compiled\n",
+           n, scramble ? " (unsorted)" : "           ",
+           limited ? " (limit)" : "        ",
+           told * 1e9 / reps / nprobes, tnew * 1e9 / reps / nprobes);
+Done:
+    ccn_exclude_destroy(&x);
+    ccn_charbuf_destroy(&c);
+    return(errors);
+}
+
+int
+main(int argc, char **argv)
+{
+    int sizes[] = {0, 1, 2, 10, 11, 100, 1000};
+    int reps = 1;
+    int errors = 0;
+    int i;
+
+    if (bench_check_only(&argc, &argv))
+        reps = 0;
+    else if (argc > 1)
+        reps = atoi(argv[1]);
+    if (reps < 0 || argc > 2 || (argc > 1 && reps == 0)) {
+        fprintf(stderr, "usage: %s [ -c ] [ repetitions ]\n", argv[0]);
+        exit(1);
+    }
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        errors += check_size(sizes[i], 0, reps);
+        if (sizes[i] > 2)
+            errors += check_size(sizes[i], 1, reps);
+    }
+    if (ccn_exclude_compile((const unsigned char *)"\0", 1) != NULL)
+        errors++;
+    if (errors != 0) {
+        fprintf(stderr, "%d errors\n", errors);
+        exit(1);
+    }
+    return(0);
+}
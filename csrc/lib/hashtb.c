@@ -21,8 +21,10 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include <ccn/hashtb.h>
+#include <ccn/pool.h>
 
 struct node;
 struct node {
@@ -35,9 +37,76 @@ struct node {
 #define DATA(ht, p) ((void *)((p) + 1))
 #define KEY(ht, p) ((unsigned char *)((p) + 1) + ht->item_size)
 
+#define NODESIZE(ht, keysize, extsize) \
+    (sizeof(struct node) + (ht)->item_size + (keysize) + (extsize))
+
+/*
+ * With HASHTB_POOLED, nodes up to HASHTB_POOL_MAX bytes come from
+ * per-table pools, one for each multiple of HASHTB_POOL_GRAIN.
+ * Larger ones, and all those of other tables, use malloc.
+ */
+#define HASHTB_POOL_GRAIN 32
+#define HASHTB_POOL_MAX 512
+#define HASHTB_POOL_CLASS(size) (((size) - 1) / HASHTB_POOL_GRAIN)
+#define HASHTB_N_POOLS (HASHTB_POOL_MAX / HASHTB_POOL_GRAIN)
+
 #define CHECKHTE(ht, hte) ((uintptr_t)((hte)->priv[1]) == ~(uintptr_t)(ht))
 #define MARKHTE(ht, hte) ((hte)->priv[1] = (void*)~(uintptr_t)(ht))
 
+/*
+ * Open addressing (HASHTB_OPEN)
+ *
+ * Each slot holds a node pointer along with the node's full hash, so a
+ * probe only touches the node when the hashes agree.  The nodes themselves
+ * are allocated just as for chaining, so entries never move in memory.
+ * Deleted slots become tombstones rather than being refilled from further
+ * along the probe sequence, so that open enumerators keep their places.
+ *
+ * To resize, a new array is made and takes all new entries, while the old
+ * one is drained into it a few slots at a time by later operations.
+ * Entries are moved only when the caller's is the only open enumerator,
+ * since another one might otherwise see an entry twice.  If the array
+ * fills up while that is not possible, further entries go on a spill list
+ * until things can be sorted out.
+ *
+ * An enumerator's priv[2] is the slot array it is in, and priv[0] is the
+ * slot.  On the spill list, priv[2] is NULL and priv[0] is the link that
+ * points to the current node.
+ */
+struct oa_slot {
+    size_t hash;
+    struct node *node;          /* NULL if empty, OA_TOMB if deleted */
+};
+
+struct oa_table {
+    struct oa_slot *slot;
+    size_t mask;                /* number of slots, less one */
+    size_t used;                /* slots that are not empty */
+    size_t live;                /* slots that hold entries */
+    size_t gone;                /* leading slots already given back */
+};
+
+static struct node oa_tomb;
+#define OA_TOMB (&oa_tomb)
+#define OA_LIVE(s) ((s)->node != NULL && (s)->node != OA_TOMB)
+#define OA_MIN_SLOTS 8
+#define OA_SLOTS(t) ((t)->mask + 1)
+/* Time to resize if one more slot is used */
+#define OA_FULL(t) ((t)->used + 1 > OA_SLOTS(t) / 4 * 3)
+/* Must not use another slot; the probe loops rely on some empty ones */
+#define OA_HARD_FULL(t) ((t)->used + 1 > OA_SLOTS(t) - OA_SLOTS(t) / 8)
+/* Worth shrinking */
+#define OA_SPARSE(t) (OA_SLOTS(t) > OA_MIN_SLOTS && (t)->live < OA_SLOTS(t) / 8)
+/* Fewest old slots to drain per operation */
+#define OA_DRAIN_MIN 32
+/* Slot arrays of this many bytes or more are mapped directly */
+#define OA_MMAP_BYTES 65536
+/* Drained parts of a mapped array are given back in pieces this big */
+#define OA_UNMAP_SLOTS (OA_MMAP_BYTES / sizeof(struct oa_slot))
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
 struct hashtb {
     struct node **bucket;
     size_t item_size;           /* Size of client's per-entry data */
@@ -46,16 +115,141 @@ struct hashtb {
     int refcount;               /* Number of open enumerators */
     struct node *deferred;      /* deferred cleanup */
     struct hashtb_param param;  /* saved client parameters */
+    struct ccn_pool *pool[HASHTB_N_POOLS]; /* node pools, made on demand */
+    /* The rest are used only for HASHTB_OPEN */
+    struct oa_table cur;        /* takes new entries */
+    struct oa_table old;        /* being drained into cur, if slot != NULL */
+    size_t drain;               /* next old slot to drain */
+    size_t drain_step;          /* old slots to drain per operation */
+    struct node *spill;         /* entries that did not fit */
 };
 
+#define OPEN(ht) (((ht)->param.flags & HASHTB_OPEN) != 0)
+#define POOLED(ht) (((ht)->param.flags & HASHTB_POOLED) != 0)
+
+static void setpos(struct hashtb_enumerator *hte, struct node **pp);
+static int oa_create(struct hashtb *ht);
+static void oa_slots_free(struct oa_table *t);
+static void *oa_lookup(struct hashtb *ht, const void *key, size_t keysize,
+                       size_t h);
+static void oa_start(struct hashtb_enumerator *hte);
+static void oa_next(struct hashtb_enumerator *hte);
+static int oa_seek(struct hashtb_enumerator *hte, const void *key,
+                   size_t keysize, size_t extsize, size_t h);
+static void oa_delete(struct hashtb_enumerator *hte);
+static void oa_rebuild(struct hashtb *ht, size_t nslots);
+
+static struct node *
+node_alloc(struct hashtb *ht, size_t size)
+{
+    int c;
+
+    if (size > HASHTB_POOL_MAX || !POOLED(ht))
+        return(calloc(1, size));
+    c = HASHTB_POOL_CLASS(size);
+    if (ht->pool[c] == NULL) {
+        ht->pool[c] = ccn_pool_create((c + 1) * HASHTB_POOL_GRAIN);
+        if (ht->pool[c] == NULL)
+            return(NULL);
+    }
+    return(ccn_pool_alloc(ht->pool[c]));
+}
+
+static void
+node_free(struct hashtb *ht, struct node *p)
+{
+    size_t size = NODESIZE(ht, p->keysize, p->extsize);
+
+    if (size > HASHTB_POOL_MAX || !POOLED(ht))
+        free(p);
+    else
+        ccn_pool_free(ht->pool[HASHTB_POOL_CLASS(size)], p);
+}
+
+/*
+ * The hash works a word at a time.  Bytes are gathered into 8-byte words
+ * in the state, so the result does not depend on how the key is split
+ * up among calls to hashtb_hash_step.  The length is mixed in at the end,
+ * followed by a final scramble so that the low-order bits are good enough
+ * to use as a table index.
+ */
+#define HASH_MUL 0x9E3779B97F4A7C15ULL
+#define HASH_MIX(h, w) ((((h) << 5) | ((h) >> 59)) ^ (w)) * HASH_MUL
+
+void
+hashtb_hash_start(struct hashtb_hash_state *s)
+{
+    memset(s, 0, sizeof(*s));
+}
+
+void
+hashtb_hash_step(struct hashtb_hash_state *s, const unsigned char *p, size_t n)
+{
+    uint64_t h = s->h;
+    uint64_t w;
+
+    s->n += n;
+    if (s->ntail > 0) {
+        while (n > 0 && s->ntail < sizeof(w)) {
+            s->tail[s->ntail++] = *p++;
+            n--;
+        }
+        if (s->ntail < sizeof(w))
+            return;
+        memcpy(&w, s->tail, sizeof(w));
+        h = HASH_MIX(h, w);
+        s->ntail = 0;
+    }
+    for (; n >= sizeof(w); p += sizeof(w), n -= sizeof(w)) {
+        memcpy(&w, p, sizeof(w));
+        h = HASH_MIX(h, w);
+    }
+    memcpy(s->tail, p, n);
+    s->ntail = n;
+    s->h = h;
+}
+
+size_t
+hashtb_hash_final(const struct hashtb_hash_state *s)
+{
+    unsigned char tail[8] = {0};
+    uint64_t h = s->h;
+    uint64_t w;
+
+    memcpy(tail, s->tail, s->ntail);
+    memcpy(&w, tail, sizeof(w));
+    h = HASH_MIX(h, w);
+    h = HASH_MIX(h, (uint64_t)s->n + 23);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return((size_t)h);
+}
+
 size_t
 hashtb_hash(const unsigned char *key, size_t key_size)
 {
-    size_t h;
-    size_t i;
-    for (h = key_size + 23, i = 0; i < key_size; i++)
-        h = ((h << 6) ^ (h >> 27)) + key[i];
-    return(h);
+    struct hashtb_hash_state s;
+
+    hashtb_hash_start(&s);
+    hashtb_hash_step(&s, key, key_size);
+    return(hashtb_hash_final(&s));
+}
+
+void
+hashtb_hash_prefixes(const unsigned char *base, const size_t *offsets, int n,
+                     size_t *hashes)
+{
+    struct hashtb_hash_state s;
+    int i;
+
+    hashtb_hash_start(&s);
+    for (i = 0; i < n; i++) {
+        if (i > 0)
+            hashtb_hash_step(&s, base + offsets[i - 1],
+                             offsets[i] - offsets[i - 1]);
+        hashes[i] = hashtb_hash_final(&s);
+    }
 }
 
 struct hashtb *
@@ -66,14 +260,21 @@ hashtb_create(size_t item_size, const struct hashtb_param *param)
     if (ht != NULL) {
         ht->item_size = item_size;
         ht->n = 0;
+        if (param != NULL)
+            ht->param = *param;
+        if (OPEN(ht)) {
+            if (oa_create(ht) < 0) {
+                free(ht);
+                return(NULL); /*ENOMEM*/
+            }
+            return(ht);
+        }
         ht->n_buckets = 7;
         ht->bucket = calloc(ht->n_buckets, sizeof(ht->bucket[0]));
 	if (ht->bucket == NULL) {
 		free(ht);
 		return (NULL); /*ENOMEM*/
 	}
-        if (param != NULL)
-            ht->param = *param;
     }
     return(ht);
 }
@@ -96,6 +297,11 @@ hashtb_destroy(struct hashtb **htp)
             hashtb_delete(e);
         hashtb_end(&tmp);
         if ((*htp)->refcount == 0) {
+            int i;
+            for (i = 0; i < HASHTB_N_POOLS; i++)
+                ccn_pool_destroy(&(*htp)->pool[i]);
+            oa_slots_free(&(*htp)->cur);
+            oa_slots_free(&(*htp)->old);
             free((*htp)->bucket);
             free(*htp);
             *htp = NULL;
@@ -111,14 +317,34 @@ hashtb_n(struct hashtb *ht)
     return(ht->n);
 }
 
+void
+hashtb_pool_stats(struct hashtb *ht, struct ccn_pool_stats *s)
+{
+    int i;
+
+    memset(s, 0, sizeof(*s));
+    for (i = 0; i < HASHTB_N_POOLS; i++)
+        if (ht->pool[i] != NULL)
+            ccn_pool_get_stats(ht->pool[i], s, 1);
+}
+
 void *
 hashtb_lookup(struct hashtb *ht, const void *key, size_t keysize)
+{
+    if (key == NULL)
+        return(NULL);
+    return(hashtb_lookup_hashed(ht, key, keysize, hashtb_hash(key, keysize)));
+}
+
+void *
+hashtb_lookup_hashed(struct hashtb *ht, const void *key, size_t keysize,
+                     size_t h)
 {
     struct node *p;
-    size_t h;
     if (key == NULL)
         return(NULL);
-    h = hashtb_hash(key, keysize);
+    if (OPEN(ht))
+        return(oa_lookup(ht, key, keysize, h));
     for (p = ht->bucket[h % ht->n_buckets]; p != NULL; p = p->link) {
         if (p->hash < h)
             continue;
@@ -131,13 +357,9 @@ hashtb_lookup(struct hashtb *ht, const void *key, size_t keysize)
 }
 
 static void
-setpos(struct hashtb_enumerator *hte, struct node **pp)
+setnode(struct hashtb_enumerator *hte, struct node *p)
 {
     struct hashtb *ht = hte->ht;
-    struct node *p = NULL;
-    hte->priv[0] = pp;
-    if (pp != NULL)
-        p = *pp;
     if (p == NULL) {
         hte->key = NULL;
         hte->keysize = 0;
@@ -152,6 +374,34 @@ setpos(struct hashtb_enumerator *hte, struct node **pp)
     }
 }
 
+static void
+setpos(struct hashtb_enumerator *hte, struct node **pp)
+{
+    hte->priv[0] = pp;
+    hte->priv[2] = NULL;
+    setnode(hte, pp == NULL ? NULL : *pp);
+}
+
+/**
+ * Finalize and free a node that has been unlinked, or put it
+ * aside if there are other enumerators open.
+ */
+static void
+retire_node(struct hashtb_enumerator *hte, struct node *p)
+{
+    struct hashtb *ht = hte->ht;
+    if (ht->refcount == 1) {
+        hashtb_finalize_proc f = ht->param.finalize;
+        if (f != NULL)
+            (*f)(hte);
+        node_free(ht, p);
+    }
+    else {
+        p->link = ht->deferred;
+        ht->deferred = p;
+    }
+}
+
 static struct node **
 scan_buckets(struct hashtb *ht, unsigned b)
 {
@@ -171,7 +421,10 @@ hashtb_start(struct hashtb *ht, struct hashtb_enumerator *hte)
     ht->refcount++;
     if (ht->refcount > MAX_ENUMERATORS)
         abort(); /* probably somebody is missing a call to hashtb_end() */
-    setpos(hte, scan_buckets(ht, 0));
+    if (OPEN(ht))
+        oa_start(hte);
+    else
+        setpos(hte, scan_buckets(ht, 0));
     return(hte);
 }
 
@@ -191,7 +444,7 @@ hashtb_end(struct hashtb_enumerator *hte)
                 (*f)(hte);
             p = ht->deferred;
             ht->deferred = p->link;
-            free(p);
+            node_free(ht, p);
         }
     }
     hte->priv[0] = 0;
@@ -204,6 +457,10 @@ hashtb_next(struct hashtb_enumerator *hte)
 {
     struct node **pp = hte->priv[0];
     struct node **ppp;
+    if (OPEN(hte->ht)) {
+        oa_next(hte);
+        return;
+    }
     if (pp != NULL) {
         ppp = pp;
         pp = &((*pp)->link);
@@ -215,21 +472,33 @@ hashtb_next(struct hashtb_enumerator *hte)
 
 int
 hashtb_seek(struct hashtb_enumerator *hte, const void *key, size_t keysize, size_t extsize)
+{
+    if (key == NULL) {
+        setpos(hte, NULL);
+        return(-1);
+    }
+    return(hashtb_seek_hashed(hte, key, keysize, extsize,
+                              hashtb_hash(key, keysize)));
+}
+
+int
+hashtb_seek_hashed(struct hashtb_enumerator *hte,
+                   const void *key, size_t keysize, size_t extsize, size_t h)
 {
     struct node *p = NULL;
     struct hashtb *ht = hte->ht;
     struct node **pp;
-    size_t h;
     if (key == NULL) {
         setpos(hte, NULL);
         return(-1);
     }
+    if (OPEN(ht))
+        return(oa_seek(hte, key, keysize, extsize, h));
     if (ht->refcount == 1 && ht->n > ht->n_buckets * 3) {
         ht->refcount--;
         hashtb_rehash(ht, 2 * ht->n + 1);
         ht->refcount++;
     }
-    h = hashtb_hash(key, keysize);
     pp = &(ht->bucket[h % ht->n_buckets]);
     for (p = *pp; p != NULL; pp = &(p->link), p = p->link) {
         if (p->hash < h)
@@ -241,7 +510,7 @@ hashtb_seek(struct hashtb_enumerator *hte, const void *key, size_t keysize, size
             return(HT_OLD_ENTRY);
         }
     }
-    p = calloc(1, sizeof(*p) + ht->item_size + keysize + extsize);
+    p = node_alloc(ht, NODESIZE(ht, keysize, extsize));
     if (p == NULL) {
         setpos(hte, NULL);
         return(-1);
@@ -262,22 +531,20 @@ hashtb_delete(struct hashtb_enumerator *hte)
 {
     struct hashtb *ht = hte->ht;
     struct node **pp = hte->priv[0];
-    struct node *p = *pp;
+    struct node *p;
+    if (OPEN(ht)) {
+        oa_delete(hte);
+        return;
+    }
+    if (pp == NULL)
+        return;
+    p = *pp;
     if ((p != NULL) && CHECKHTE(ht, hte) && KEY(ht, p) == hte->key) {
         *pp = p->link;
         if (*pp == NULL)
            pp = scan_buckets(hte->ht, (p->hash % hte->ht->n_buckets) + 1);
         hte->ht->n -= 1;
-        if (ht->refcount == 1) {
-            hashtb_finalize_proc f = ht->param.finalize;
-            if (f != NULL)
-                (*f)(hte);
-            free(p);
-        }
-        else {
-            p->link = ht->deferred;
-            ht->deferred = p;
-        }
+        retire_node(hte, p);
         setpos(hte, pp);
     }
 }
@@ -292,6 +559,11 @@ hashtb_rehash(struct hashtb *ht, unsigned n_buckets)
     size_t h;
     unsigned i;
     unsigned b;
+    if (OPEN(ht)) {
+        if (ht->refcount == 0 && n_buckets >= 1)
+            oa_rebuild(ht, n_buckets);
+        return;
+    }
     if (ht->refcount != 0 || n_buckets < 1 || n_buckets == ht->n_buckets)
         return;
     bucket = calloc(n_buckets, sizeof(bucket[0]));
@@ -312,3 +584,451 @@ hashtb_rehash(struct hashtb *ht, unsigned n_buckets)
     ht->n_buckets = n_buckets;
 }
 
+
+/*
+ * Open addressing
+ */
+
+/** Number of slots to use for n entries; always a power of 2 */
+static size_t
+oa_size_for(size_t n)
+{
+    size_t size = OA_MIN_SLOTS;
+    while (size <= 2 * n)
+        size *= 2;
+    return(size);
+}
+
+/**
+ * Get a zeroed array of nslots.
+ *
+ * A big one is mapped directly, so that it comes from the kernel already
+ * zeroed, rather than from calloc, which clears memory that malloc
+ * reuses all at once.  Huge pages are declined where that is possible,
+ * so that the kernel zeroes the array a small page at a time as it fills
+ * instead of in larger steps.
+ */
+static struct oa_slot *
+oa_slots_alloc(size_t nslots)
+{
+    size_t bytes = nslots * sizeof(struct oa_slot);
+    void *p;
+
+    if (bytes < OA_MMAP_BYTES)
+        return(calloc(nslots, sizeof(struct oa_slot)));
+    p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return(NULL);
+#if defined(MADV_NOHUGEPAGE)
+    madvise(p, bytes, MADV_NOHUGEPAGE);
+#endif
+    return(p);
+}
+
+/** Free the slot array of t, if it has one */
+static void
+oa_slots_free(struct oa_table *t)
+{
+    size_t bytes = OA_SLOTS(t) * sizeof(struct oa_slot);
+
+    if (t->slot == NULL)
+        return;
+    if (bytes < OA_MMAP_BYTES)
+        free(t->slot);
+    else
+        munmap(t->slot + t->gone, bytes - t->gone * sizeof(struct oa_slot));
+    t->slot = NULL;
+    t->gone = 0;
+}
+
+/**
+ * Give back the part of a mapped array below slot n, in whole pieces,
+ * so that freeing a big old array is spread over the drain rather than
+ * all coming at the end.  Everything there must have been moved out.
+ */
+static void
+oa_slots_release(struct oa_table *t, size_t n)
+{
+    size_t upto;
+
+    if (OA_SLOTS(t) * sizeof(struct oa_slot) < OA_MMAP_BYTES)
+        return;
+    upto = n - n % OA_UNMAP_SLOTS;
+    if (upto <= t->gone)
+        return;
+    munmap(t->slot + t->gone, (upto - t->gone) * sizeof(struct oa_slot));
+    t->gone = upto;
+}
+
+static int
+oa_table_init(struct oa_table *t, size_t nslots)
+{
+    t->slot = oa_slots_alloc(nslots);
+    if (t->slot == NULL)
+        return(-1);
+    t->mask = nslots - 1;
+    t->used = 0;
+    t->live = 0;
+    t->gone = 0;
+    return(0);
+}
+
+static int
+oa_create(struct hashtb *ht)
+{
+    return(oa_table_init(&ht->cur, OA_MIN_SLOTS));
+}
+
+/**
+ * Find the slot of t that holds key, or NULL
+ *
+ * Slots that have been given back held only tombstones, so the probe
+ * just steps over them.
+ */
+static struct oa_slot *
+oa_find(struct hashtb *ht, struct oa_table *t,
+        const void *key, size_t keysize, size_t h)
+{
+    struct oa_slot *s;
+    size_t i;
+    size_t n;
+
+    if (t->slot == NULL)
+        return(NULL);
+    i = h & t->mask;
+    for (n = 0; n <= t->mask; n++) {
+        if (i < t->gone)
+            i = t->gone;
+        s = &t->slot[i];
+        if (s->node == NULL)
+            return(NULL);
+        if (s->hash == h && s->node != OA_TOMB &&
+            s->node->keysize == keysize &&
+            0 == memcmp(key, KEY(ht, s->node), keysize))
+            return(s);
+        i = (i + 1) & t->mask;
+    }
+    return(NULL);
+}
+
+/**
+ * Put a node into t
+ * The caller has made sure that it is not already there,
+ * and that t is not too full.
+ */
+static struct oa_slot *
+oa_place(struct oa_table *t, size_t h, struct node *p)
+{
+    struct oa_slot *s;
+    size_t i;
+
+    for (i = h & t->mask;; i = (i + 1) & t->mask) {
+        s = &t->slot[i];
+        if (s->node == NULL || s->node == OA_TOMB)
+            break;
+    }
+    if (s->node == NULL)
+        t->used++;
+    t->live++;
+    s->hash = h;
+    s->node = p;
+    return(s);
+}
+
+/**
+ * Look everywhere for key
+ * @returns the node, or NULL.  If found, *basep and *wherep are set
+ * to the position, in the form kept in an enumerator.
+ */
+static struct node *
+oa_search(struct hashtb *ht, const void *key, size_t keysize, size_t h,
+          struct oa_slot **basep, void **wherep)
+{
+    struct oa_slot *s;
+    struct node **pp;
+
+    s = oa_find(ht, &ht->cur, key, keysize, h);
+    if (s != NULL) {
+        *basep = ht->cur.slot;
+        *wherep = s;
+        return(s->node);
+    }
+    s = oa_find(ht, &ht->old, key, keysize, h);
+    if (s != NULL) {
+        *basep = ht->old.slot;
+        *wherep = s;
+        return(s->node);
+    }
+    for (pp = &ht->spill; *pp != NULL; pp = &((*pp)->link)) {
+        if ((*pp)->hash == h && (*pp)->keysize == keysize &&
+            0 == memcmp(key, KEY(ht, *pp), keysize)) {
+            *basep = NULL;
+            *wherep = pp;
+            return(*pp);
+        }
+    }
+    return(NULL);
+}
+
+/**
+ * Make a new array of nslots to take new entries, and start draining
+ * the current one into it.
+ */
+static int
+oa_start_resize(struct hashtb *ht, size_t nslots)
+{
+    struct oa_table t;
+    size_t room;
+
+    if (ht->old.slot != NULL || oa_table_init(&t, nslots) < 0)
+        return(-1);
+    ht->old = ht->cur;
+    ht->cur = t;
+    ht->drain = 0;
+    /* Aim to be done before new entries take half of the room left */
+    room = OA_SLOTS(&t) / 4 * 3 - ht->old.live;
+    ht->drain_step = OA_SLOTS(&ht->old) / (room / 2 + 1) + 1;
+    if (ht->drain_step < OA_DRAIN_MIN)
+        ht->drain_step = OA_DRAIN_MIN;
+    return(0);
+}
+
+/**
+ * Drain up to n slots of the old array, and free it when it is empty.
+ */
+static void
+oa_drain(struct hashtb *ht, size_t n)
+{
+    struct oa_slot *s;
+
+    for (; n > 0 && ht->drain <= ht->old.mask; n--, ht->drain++) {
+        s = &ht->old.slot[ht->drain];
+        if (OA_LIVE(s)) {
+            if (OA_HARD_FULL(&ht->cur))
+                return;
+            oa_place(&ht->cur, s->hash, s->node);
+            s->node = OA_TOMB;
+            ht->old.live--;
+        }
+    }
+    oa_slots_release(&ht->old, ht->drain);
+    if (ht->drain > ht->old.mask) {
+        oa_slots_free(&ht->old);
+        memset(&ht->old, 0, sizeof(ht->old));
+    }
+}
+
+/**
+ * Move everything into a fresh array of at least nslots, all at once.
+ */
+static void
+oa_rebuild(struct hashtb *ht, size_t nslots)
+{
+    struct oa_table t;
+    struct oa_table *from[2];
+    struct node *p;
+    size_t size;
+    size_t i;
+    int k;
+
+    size = oa_size_for(ht->n);
+    while (size < nslots)
+        size *= 2;
+    if (oa_table_init(&t, size) < 0)
+        return; /* ENOMEM - carry on as we are */
+    from[0] = &ht->old;
+    from[1] = &ht->cur;
+    for (k = 0; k < 2; k++) {
+        if (from[k]->slot == NULL)
+            continue;
+        for (i = from[k]->gone; i <= from[k]->mask; i++)
+            if (OA_LIVE(&from[k]->slot[i]))
+                oa_place(&t, from[k]->slot[i].hash, from[k]->slot[i].node);
+        oa_slots_free(from[k]);
+    }
+    while (ht->spill != NULL) {
+        p = ht->spill;
+        ht->spill = p->link;
+        oa_place(&t, p->hash, p);
+    }
+    ht->cur = t;
+    memset(&ht->old, 0, sizeof(ht->old));
+}
+
+/**
+ * Do a bounded amount of resizing work.
+ * Entries may move, so this must only be called when there are no
+ * enumerators open except possibly the caller's, which must then
+ * be repositioned.
+ */
+static void
+oa_tidy(struct hashtb *ht)
+{
+    if (ht->old.slot != NULL) {
+        oa_drain(ht, ht->drain_step);
+        if (ht->old.slot != NULL && OA_HARD_FULL(&ht->cur))
+            oa_rebuild(ht, 0);
+    }
+    if (ht->spill != NULL)
+        oa_rebuild(ht, 0);
+    if (ht->old.slot == NULL && OA_SPARSE(&ht->cur))
+        oa_start_resize(ht, oa_size_for(ht->n));
+}
+
+static void *
+oa_lookup(struct hashtb *ht, const void *key, size_t keysize, size_t h)
+{
+    struct oa_slot *base;
+    struct node *p;
+    void *where;
+
+    if (ht->refcount == 0)
+        oa_tidy(ht);
+    p = oa_search(ht, key, keysize, h, &base, &where);
+    if (p == NULL)
+        return(NULL);
+    return(DATA(ht, p));
+}
+
+static void
+oa_setpos(struct hashtb_enumerator *hte, struct oa_slot *base, void *where)
+{
+    struct node *p = NULL;
+
+    hte->priv[0] = where;
+    hte->priv[2] = base;
+    if (base != NULL)
+        p = ((struct oa_slot *)where)->node;
+    else if (where != NULL)
+        p = *(struct node **)where;
+    setnode(hte, p);
+}
+
+/**
+ * Position hte at the first entry at or after slot i of base,
+ * going on to the later arrays and then the spill list as needed.
+ */
+static void
+oa_scan(struct hashtb_enumerator *hte, struct oa_slot *base, size_t i)
+{
+    struct hashtb *ht = hte->ht;
+    struct oa_table *t;
+
+    while (base != NULL) {
+        if (base == ht->old.slot)
+            t = &ht->old;
+        else if (base == ht->cur.slot)
+            t = &ht->cur;
+        else
+            abort(); /* enumerator is lost */
+        if (i < t->gone)
+            i = t->gone;
+        for (; i <= t->mask; i++) {
+            if (OA_LIVE(&t->slot[i])) {
+                oa_setpos(hte, base, &t->slot[i]);
+                return;
+            }
+        }
+        base = (t == &ht->old) ? ht->cur.slot : NULL;
+        i = 0;
+    }
+    oa_setpos(hte, NULL, &ht->spill);
+}
+
+static void
+oa_start(struct hashtb_enumerator *hte)
+{
+    struct hashtb *ht = hte->ht;
+
+    oa_scan(hte, ht->old.slot != NULL ? ht->old.slot : ht->cur.slot, 0);
+}
+
+static void
+oa_next(struct hashtb_enumerator *hte)
+{
+    struct oa_slot *base = hte->priv[2];
+    struct node **pp = hte->priv[0];
+
+    if (base != NULL)
+        oa_scan(hte, base, (struct oa_slot *)hte->priv[0] - base + 1);
+    else if (pp != NULL && *pp != NULL)
+        oa_setpos(hte, NULL, &((*pp)->link));
+}
+
+static int
+oa_seek(struct hashtb_enumerator *hte, const void *key,
+        size_t keysize, size_t extsize, size_t h)
+{
+    struct hashtb *ht = hte->ht;
+    struct oa_slot *base;
+    struct node *p;
+    void *where;
+
+    if (ht->refcount == 1)
+        oa_tidy(ht);
+    p = oa_search(ht, key, keysize, h, &base, &where);
+    if (p != NULL) {
+        oa_setpos(hte, base, where);
+        return(HT_OLD_ENTRY);
+    }
+    p = node_alloc(ht, NODESIZE(ht, keysize, extsize));
+    if (p == NULL) {
+        setpos(hte, NULL);
+        return(-1);
+    }
+    memcpy(KEY(ht, p), key, keysize + extsize);
+    p->hash = h;
+    p->keysize = keysize;
+    p->extsize = extsize;
+    if (OA_FULL(&ht->cur) && ht->old.slot == NULL)
+        oa_start_resize(ht, oa_size_for(ht->n + 1));
+    if (!OA_HARD_FULL(&ht->cur))
+        oa_setpos(hte, ht->cur.slot, oa_place(&ht->cur, h, p));
+    else {
+        p->link = ht->spill;
+        ht->spill = p;
+        oa_setpos(hte, NULL, &ht->spill);
+    }
+    ht->n += 1;
+    return(HT_NEW_ENTRY);
+}
+
+static void
+oa_delete(struct hashtb_enumerator *hte)
+{
+    struct hashtb *ht = hte->ht;
+    struct oa_slot *base = hte->priv[2];
+    struct oa_slot *s = NULL;
+    struct node **pp = NULL;
+    struct node *p = NULL;
+
+    if (!CHECKHTE(ht, hte))
+        return;
+    if (base != NULL) {
+        s = hte->priv[0];
+        p = s->node;
+    }
+    else {
+        pp = hte->priv[0];
+        if (pp != NULL)
+            p = *pp;
+    }
+    if (p == NULL || p == OA_TOMB || KEY(ht, p) != hte->key)
+        return;
+    if (s != NULL) {
+        s->node = OA_TOMB;
+        if (base == ht->old.slot)
+            ht->old.live--;
+        else
+            ht->cur.live--;
+    }
+    else
+        *pp = p->link;
+    ht->n -= 1;
+    retire_node(hte, p);
+    if (s != NULL)
+        oa_scan(hte, base, s - base + 1);
+    else
+        oa_setpos(hte, NULL, pp);
+}
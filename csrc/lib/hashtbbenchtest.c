@@ -0,0 +1,352 @@
+/**
+ * @file hashtbbenchtest.c
+ *
+ * Check the open addressing hashtb against the chained one, and
+ * compare their speed.
+ *
+ * With -c, only the checks are made.
+ *
+ * A CCNx program.
+ *
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ccn/hashtb.h>
+#include <ccn/pool.h>
+
+#include "benchtime.h"
+
+struct item {
+    unsigned key;       /* the number the key was made from */
+    unsigned seen;      /* enumeration pass that last saw this */
+};
+
+static int finalized;
+static int errors;
+
+#define CHECK(cond) do { if (!(cond)) { \
+    fprintf(stderr, "line %d: check failed: %s\n", __LINE__, #cond); \
+    errors++; } } while (0)
+
+static void
+finally(struct hashtb_enumerator *e)
+{
+    finalized++;
+}
+
+/** Keys vary in length, so that some are bigger than a word or two */
+static size_t
+make_key(unsigned char *buf, unsigned v)
+{
+    size_t n = 4 + v % 29;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        buf[i] = (v >> (8 * (i % 4))) + i;
+    return(n);
+}
+
+static struct hashtb *
+make_table(int flags)
+{
+    struct hashtb_param param = {0};
+
+    param.finalize = &finally;
+    param.flags = flags;
+    return(hashtb_create(sizeof(struct item), &param));
+}
+
+static int
+seek(struct hashtb_enumerator *e, unsigned v)
+{
+    unsigned char key[40];
+    struct item *item;
+    int res;
+
+    res = hashtb_seek(e, key, make_key(key, v), 0);
+    item = e->data;
+    if (res == HT_NEW_ENTRY)
+        item->key = v;
+    else if (res == HT_OLD_ENTRY)
+        CHECK(item->key == v);
+    return(res);
+}
+
+static struct item *
+lookup(struct hashtb *ht, unsigned v)
+{
+    unsigned char key[40];
+
+    return(hashtb_lookup(ht, key, make_key(key, v)));
+}
+
+/**
+ * Enumerate everything, checking that each entry is seen exactly once.
+ * @returns the number seen.
+ */
+static int
+enumerate_all(struct hashtb *ht, unsigned pass)
+{
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct item *item;
+    int n = 0;
+
+    for (hashtb_start(ht, e); e->data != NULL; hashtb_next(e)) {
+        item = e->data;
+        CHECK(item->seen != pass);
+        item->seen = pass;
+        n++;
+    }
+    hashtb_end(e);
+    CHECK(n == hashtb_n(ht));
+    return(n);
+}
+
+/**
+ * Do random operations on both kinds of table, and compare
+ */
+static void
+random_ops(int nops, unsigned range)
+{
+    struct hashtb *ref = make_table(0);
+    struct hashtb *ht = make_table(HASHTB_OPEN);
+    struct hashtb_enumerator ee[2];
+    struct hashtb_enumerator *e = &ee[0];
+    struct hashtb_enumerator *f = &ee[1];
+    unsigned pass = 0;
+    unsigned v;
+    int i;
+
+    for (i = 0; i < nops; i++) {
+        v = random() % range;
+        switch (random() % 8) {
+            case 0: case 1: case 2:
+                hashtb_start(ref, e);
+                hashtb_start(ht, f);
+                CHECK(seek(e, v) == seek(f, v));
+                hashtb_end(f);
+                hashtb_end(e);
+                break;
+            case 3: case 4:
+                hashtb_start(ref, e);
+                hashtb_start(ht, f);
+                CHECK(seek(e, v) == seek(f, v));
+                hashtb_delete(e);
+                hashtb_delete(f);
+                hashtb_end(f);
+                hashtb_end(e);
+                break;
+            default:
+                CHECK((lookup(ref, v) == NULL) == (lookup(ht, v) == NULL));
+        }
+        CHECK(hashtb_n(ref) == hashtb_n(ht));
+        if (i % (nops / 8) == 0)
+            enumerate_all(ht, ++pass);
+        /* Now and then, empty the table down to a few entries */
+        if (i % (nops / 3) == nops / 6) {
+            hashtb_start(ht, f);
+            while (f->data != NULL) {
+                v = ((struct item *)f->data)->key;
+                if (v % 64 != 0) {
+                    hashtb_start(ref, e);
+                    seek(e, v);
+                    hashtb_delete(e);
+                    hashtb_end(e);
+                    hashtb_delete(f);
+                }
+                else
+                    hashtb_next(f);
+            }
+            hashtb_end(f);
+            CHECK(hashtb_n(ref) == hashtb_n(ht));
+        }
+    }
+    enumerate_all(ht, ++pass);
+    hashtb_destroy(&ref);
+    hashtb_destroy(&ht);
+}
+
+/**
+ * Add and delete entries while other enumerators are open, which forces
+ * growth without moving anything.  An enumeration that was in progress
+ * must still see each of the original entries exactly once, and
+ * finalization must wait until the last enumerator is closed.
+ */
+static void
+nested_enumerators(unsigned n)
+{
+    struct hashtb *ht = make_table(HASHTB_OPEN);
+    struct hashtb_enumerator ee[2];
+    struct hashtb_enumerator *e = &ee[0];
+    struct hashtb_enumerator *f = &ee[1];
+    struct item *item;
+    char *added = calloc(n, 1);
+    unsigned seen = 0;
+    unsigned v;
+    int fin;
+
+    hashtb_start(ht, e);
+    for (v = 0; v < n; v++)
+        seek(e, v);
+    hashtb_end(e);
+    hashtb_start(ht, e);
+    hashtb_start(ht, f);
+    fin = finalized;
+    while (e->data != NULL) {
+        item = e->data;
+        if (item->key < n) {
+            CHECK(item->seen == 0);
+            item->seen = 1;
+            added[item->key] = 1;
+            seen++;
+            /* Add enough new ones that some have to be spilled */
+            for (v = 0; v < 6; v++)
+                seek(f, n + 6 * item->key + v);
+            /* Delete an original, maybe one that e has yet to reach */
+            if (item->key % 4 == 1 && seek(f, item->key - 1) == HT_OLD_ENTRY)
+                hashtb_delete(f);
+        }
+        hashtb_next(e);
+    }
+    CHECK(finalized == fin);
+    hashtb_end(f);
+    hashtb_end(e);
+    CHECK(finalized == fin + n / 4);
+    CHECK(seen + n / 4 >= n && seen <= n);
+    CHECK(hashtb_n(ht) == n - n / 4 + 6 * seen);
+    CHECK(enumerate_all(ht, 2) == hashtb_n(ht));
+    for (v = 0; v < 7 * n; v++) {
+        if (v < n)
+            CHECK((lookup(ht, v) == NULL) == (v % 4 == 0));
+        else
+            CHECK((lookup(ht, v) == NULL) == !added[(v - n) / 6]);
+    }
+    hashtb_destroy(&ht);
+    free(added);
+}
+
+/**
+ * Fill a pooled table and empty it again.  The pools must give back
+ * all but a page or so of each size class.
+ */
+static void
+pooled_release(unsigned n)
+{
+    struct hashtb *ht = make_table(HASHTB_OPEN | HASHTB_POOLED);
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct ccn_pool_stats ps;
+    unsigned long high;
+    unsigned v;
+
+    hashtb_start(ht, e);
+    for (v = 0; v < n; v++)
+        seek(e, v);
+    hashtb_end(e);
+    hashtb_pool_stats(ht, &ps);
+    CHECK(ps.in_use == n);
+    high = ps.pages;
+    hashtb_start(ht, e);
+    for (v = 0; v < n; v++) {
+        seek(e, v);
+        hashtb_delete(e);
+    }
+    hashtb_end(e);
+    hashtb_pool_stats(ht, &ps);
+    CHECK(ps.in_use == 0);
+    CHECK(ps.pages < high && ps.pages <= 2);
+    hashtb_destroy(&ht);
+}
+
+static void
+bench(const char *what, int flags, unsigned n)
+{
+    struct hashtb *ht = make_table(flags);
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct timeval t0;
+    struct timeval t1;
+    double tins;
+    double tlook;
+    double tdel;
+    double worst = 0;
+    double t;
+    unsigned v;
+
+    gettimeofday(&t0, NULL);
+    hashtb_start(ht, e);
+    for (v = 0; v < n; v++) {
+        gettimeofday(&t1, NULL);
+        seek(e, v);
+        t = bench_elapsed(&t1);
+        if (t > worst)
+            worst = t;
+    }
+    hashtb_end(e);
+    tins = bench_elapsed(&t0);
+    gettimeofday(&t0, NULL);
+    for (v = 0; v < 2 * n; v++)
+        if ((lookup(ht, v) == NULL) != (v >= n))
+            errors++;
+    tlook = bench_elapsed(&t0);
+    gettimeofday(&t0, NULL);
+    hashtb_start(ht, e);
+    for (v = 0; v < n; v++) {
+        seek(e, v);
+        hashtb_delete(e);
+    }
+    hashtb_end(e);
+    tdel = bench_elapsed(&t0);
+    CHECK(hashtb_n(ht) == 0);
+    printf("%-7s %8u entries: insert %6.1f ns (worst %8.1f us), "
+           "lookup %6.1f ns, delete %6.1f ns\n", what, n,
+           tins * 1e9 / n, worst * 1e6, tlook * 1e9 / (2 * n),
+           tdel * 1e9 / n);
+    hashtb_destroy(&ht);
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned n = 1000000;
+    int quiet;
+
+    quiet = bench_check_only(&argc, &argv);
+    if (argc > 1)
+        n = atoi(argv[1]);
+    if (n < 8) {
+        fprintf(stderr, "usage: %s [ -c ] [ entries ]\n", argv[0]);
+        exit(1);
+    }
+    srandom(1);
+    random_ops(200000, 5000);
+    random_ops(20000, 50);
+    random_ops(400000, 40000);
+    nested_enumerators(2000);
+    pooled_release(100000);
+    if (!quiet) {
+        bench("chained", 0, n);
+        bench("open", HASHTB_OPEN, n);
+        bench("pooled", HASHTB_OPEN | HASHTB_POOLED, n);
+    }
+    if (errors != 0) {
+        fprintf(stderr, "%d errors\n", errors);
+        exit(1);
+    }
+    return(0);
+}
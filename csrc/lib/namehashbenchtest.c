@@ -0,0 +1,171 @@
+/**
+ * @file namehashbenchtest.c
+ *
+ * Check one-pass name prefix hashing against hashtb_hash, and compare speed
+ * of longest-prefix lookups with and without it.
+ *
+ * With -c, the lookups are made once each, to check that both ways
+ * agree, and nothing is timed.
+ *
+ * A CCNx program.
+ *
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ccn/ccn.h>
+#include <ccn/charbuf.h>
+#include <ccn/hashtb.h>
+#include <ccn/indexbuf.h>
+
+#include "benchtime.h"
+
+/* Names used for timing are this many components long */
+#define NCOMPS 24
+/* Number of distinct names in the table */
+#define NNAMES 1000
+
+/**
+ * Make a name of ncomps components, unique to the value of n.
+ * Only the first half of the components go into the table, so
+ * that lookups have to walk back from the end to find a match.
+ */
+static void
+make_name(struct ccn_charbuf *name, int n, int ncomps)
+{
+    char buf[40];
+    int i;
+
+    ccn_name_init(name);
+    for (i = 0; i < ncomps; i++) {
+        snprintf(buf, sizeof(buf), "%s%d-%d",
+                 (i % 3 == 0) ? "segment" : "c", i, (i == 2) ? n : 0);
+        ccn_name_append_str(name, buf);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    struct ccn_charbuf *name = ccn_charbuf_create();
+    struct ccn_indexbuf *comps = ccn_indexbuf_create();
+    struct ccn_charbuf *probe[NNAMES];
+    struct ccn_indexbuf *pcomps[NNAMES];
+    struct ccn_indexbuf *pc;
+    struct ccn_indexbuf *hashes = ccn_indexbuf_create();
+    struct hashtb *ht = hashtb_create(sizeof(int), NULL);
+    struct hashtb_enumerator ee;
+    struct hashtb_enumerator *e = &ee;
+    struct timeval t0;
+    double told;
+    double tnew;
+    size_t *ph;
+    size_t base;
+    long found = 0;
+    long nbytes = 0;
+    int reps = 200;
+    int quiet;
+    int errors = 0;
+    int n;
+    int i;
+    int r;
+
+    quiet = bench_check_only(&argc, &argv);
+    if (quiet)
+        reps = 1;
+    if (argc > 1)
+        reps = atoi(argv[1]);
+    if (reps <= 0) {
+        fprintf(stderr, "usage: %s [ -c ] [ repetitions ]\n", argv[0]);
+        exit(1);
+    }
+    /* Check the one-pass hashes, and fill the table */
+    hashtb_start(ht, e);
+    for (n = 0; n < NNAMES; n++) {
+        make_name(name, n, n % (2 * NCOMPS));
+        ccn_name_split(name, comps);
+        ph = ccn_indexbuf_reserve(hashes, comps->n);
+        hashtb_hash_prefixes(name->buf, comps->buf, comps->n, ph);
+        base = comps->buf[0];
+        for (i = 0; i < comps->n; i++)
+            if (ph[i] != hashtb_hash(name->buf + base, comps->buf[i] - base))
+                errors++;
+        make_name(name, n, NCOMPS / 2);
+        ccn_name_split(name, comps);
+        base = comps->buf[0];
+        hashtb_seek(e, name->buf + base, comps->buf[comps->n - 1] - base, 0);
+    }
+    hashtb_end(e);
+    if (errors != 0)
+        fprintf(stderr, "%d prefix hashes differ from hashtb_hash\n", errors);
+    /* Build the probe names ahead of time so only lookups are timed */
+    for (n = 0; n < NNAMES; n++) {
+        probe[n] = ccn_charbuf_create();
+        pcomps[n] = ccn_indexbuf_create();
+        make_name(probe[n], n, NCOMPS);
+        ccn_name_split(probe[n], pcomps[n]);
+        nbytes += pcomps[n]->buf[pcomps[n]->n - 1] - pcomps[n]->buf[0];
+    }
+    /* Time the longest-prefix walk both ways */
+    gettimeofday(&t0, NULL);
+    for (r = 0; r < reps; r++) {
+        for (n = 0; n < NNAMES; n++) {
+            pc = pcomps[n];
+            base = pc->buf[0];
+            for (i = pc->n - 1; i >= 0; i--)
+                if (hashtb_lookup(ht, probe[n]->buf + base,
+                                  pc->buf[i] - base) != NULL)
+                    break;
+            found += i;
+        }
+    }
+    told = bench_elapsed(&t0);
+    gettimeofday(&t0, NULL);
+    for (r = 0; r < reps; r++) {
+        for (n = 0; n < NNAMES; n++) {
+            pc = pcomps[n];
+            base = pc->buf[0];
+            ph = ccn_indexbuf_reserve(hashes, pc->n);
+            hashtb_hash_prefixes(probe[n]->buf, pc->buf, pc->n, ph);
+            for (i = pc->n - 1; i >= 0; i--)
+                if (hashtb_lookup_hashed(ht, probe[n]->buf + base,
+                                         pc->buf[i] - base, ph[i]) != NULL)
+                    break;
+            found -= i;
+        }
+    }
+    tnew = bench_elapsed(&t0);
+    if (found != 0) {
+        fprintf(stderr, "lookups disagree\n");
+        errors++;
+    }
+    if (!quiet)
+        printf("%d components, %ld bytes/name: "
+               "%7.1f ns rehashing, %7.1f ns one-pass\n",
+               NCOMPS, nbytes / NNAMES,
+               told * 1e9 / reps / NNAMES, tnew * 1e9 / reps / NNAMES);
+    for (n = 0; n < NNAMES; n++) {
+        ccn_charbuf_destroy(&probe[n]);
+        ccn_indexbuf_destroy(&pcomps[n]);
+    }
+    hashtb_destroy(&ht);
+    ccn_indexbuf_destroy(&hashes);
+    ccn_indexbuf_destroy(&comps);
+    ccn_charbuf_destroy(&name);
+    if (errors != 0)
+        exit(1);
+    return(0);
+}
@@ -0,0 +1,166 @@
+/**
+ * @file schedbenchtest.c
+ *
+ * Compare the heap and timing wheel versions of ccn_schedule.
+ *
+ * With -c, a smaller run checks that each timer fires or is cancelled,
+ * and nothing is timed.
+ *
+ * A CCNx program.
+ *
+ * Copyright (C) 2013 Palo Alto Research Center, Inc.
+ *
+ * This work is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 2 as published by the
+ * Free Software Foundation.
+ * This work is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details. You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ccn/pool.h>
+#include <ccn/schedule.h>
+
+#include "benchtime.h"
+
+/* Timers are spread over this many micros */
+#define SPREAD 10000000
+/* The simulated clock moves in steps of this many micros */
+#define STEP 1000
+
+/* A clock that only moves when we say so */
+static struct ccn_timeval fake_now;
+static void
+fake_gettime(const struct ccn_gettime *self, struct ccn_timeval *result)
+{
+    *result = fake_now;
+}
+static struct ccn_gettime fake_clock = {"fake", &fake_gettime, 1000000, NULL};
+
+static long long
+fake_micros(void)
+{
+    return((long long)fake_now.s * 1000000 + fake_now.micros);
+}
+
+static void
+fake_advance(int micros)
+{
+    fake_now.micros += micros;
+    fake_now.s += fake_now.micros / 1000000;
+    fake_now.micros %= 1000000;
+}
+
+struct counts {
+    long fired;
+    long early;
+    long cancelled;
+    long long late;
+};
+
+static int
+action(struct ccn_schedule *sched, void *clienth,
+       struct ccn_scheduled_event *ev, int flags)
+{
+    struct counts *c = clienth;
+
+    if ((flags & CCN_SCHEDULE_CANCEL) != 0) {
+        c->cancelled++;
+        return(0);
+    }
+    c->fired++;
+    if (fake_micros() < ev->evint)
+        c->early++;
+    else
+        c->late += fake_micros() - ev->evint;
+    return(0);
+}
+
+static int
+bench(const char *what, int wheel, int n, int quiet)
+{
+    struct ccn_schedule *sched = NULL;
+    struct ccn_scheduled_event **ev = NULL;
+    struct ccn_pool_stats ps;
+    struct counts c = {0};
+    struct timeval t0;
+    double tsched;
+    double tcancel;
+    double trun;
+    int delay;
+    int i;
+
+    ev = calloc(n, sizeof(ev[0]));
+    fake_now.s = 1000;
+    fake_now.micros = 0;
+    if (wheel)
+        sched = ccn_schedule_create_wheel(&c, &fake_clock);
+    else
+        sched = ccn_schedule_create(&c, &fake_clock);
+    if (ev == NULL || sched == NULL)
+        return(1);
+    srandom(1);
+    gettimeofday(&t0, NULL);
+    for (i = 0; i < n; i++) {
+        delay = 1 + random() % SPREAD;
+        ev[i] = ccn_schedule_event(sched, delay, &action, NULL,
+                                   fake_micros() + delay);
+    }
+    tsched = bench_elapsed(&t0);
+    gettimeofday(&t0, NULL);
+    for (i = 0; i < n; i += 2)
+        ccn_schedule_cancel(sched, ev[i]);
+    tcancel = bench_elapsed(&t0);
+    ccn_schedule_pool_stats(sched, &ps);
+    gettimeofday(&t0, NULL);
+    while (ccn_schedule_run(sched) >= 0)
+        fake_advance(STEP);
+    trun = bench_elapsed(&t0);
+    if (!quiet)
+        printf("%-6s %8d timers: schedule %6.1f ns, cancel %6.1f ns, "
+               "run %7.1f ms, %8lu held after cancel\n",
+               what, n, tsched * 1e9 / n, tcancel * 1e9 / ((n + 1) / 2),
+               trun * 1e3, ps.in_use);
+    ccn_schedule_destroy(&sched);
+    free(ev);
+    if (c.fired != n / 2 || c.cancelled != (n + 1) / 2 || c.early != 0) {
+        fprintf(stderr, "%s: fired %ld, cancelled %ld, early %ld\n",
+                what, c.fired, c.cancelled, c.early);
+        return(1);
+    }
+    if (c.late > (long long)c.fired * STEP) {
+        fprintf(stderr, "%s: too late\n", what);
+        return(1);
+    }
+    return(0);
+}
+
+int
+main(int argc, char **argv)
+{
+    int n = 1000000;
+    int quiet;
+    int errors = 0;
+
+    quiet = bench_check_only(&argc, &argv);
+    if (quiet)
+        n = 10000;
+    if (argc > 1)
+        n = atoi(argv[1]);
+    if (n <= 0) {
+        fprintf(stderr, "usage: %s [ -c ] [ timers ]\n", argv[0]);
+        exit(1);
+    }
+    errors += bench("heap", 0, n, quiet);
+    errors += bench("wheel", 1, n, quiet);
+    if (errors != 0)
+        exit(1);
+    return(0);
+}
@@ -38,11 +38,13 @@ usage(const char *progname)
 {
     fprintf(stderr,
             "Usage:\n"
-            "   %s [-h] [-d] [-v] [-t <lifetime>] (-f <configfile> | COMMAND)\n"
+            "   %s [-h] [-d] [-v] [-t <lifetime>] [-r <rate> [-b <burst>]] (-f <configfile> | COMMAND)\n"
             "       -h print usage and exit\n"
             "       -d enter dynamic mode and create FIB entries based on DNS SRV records\n"
             "       -f <configfile> add or delete FIB entries based on the content of <configfile>\n"
             "       -t use value in seconds for lifetime of prefix registration\n"
+            "       -r limit content sent on faces that are created to <rate> bytes per second\n"
+            "       -b allow bursts of up to <burst> bytes when rate limiting\n"
             "       -v increase logging level\n"
             "\n"
             "   COMMAND can be one of following:\n"
@@ -54,6 +56,8 @@ usage(const char *progname)
             "           create or destroy a face identified by parameters\n"
             "       destroy face <faceid>\n"
             "           destroy face identified by number\n"
+            "       snapshot\n"
+            "           ask ccnd to save its content store to CCND_CS_SNAPSHOT\n"
             "       srv\n"
             "           add ccnx:/ prefix to face created from parameters in SRV\n"
             "           record of a domain in DNS search list\n"
@@ -104,10 +108,12 @@ main(int argc, char **argv)
     char *cmd = NULL;
     int dynamic = 0;
     int lifetime = -1;
+    int rate = 0;
+    int burst = 0;
     
     progname = argv[0];
     
-    while ((opt = getopt(argc, argv, "hdvt:f:")) != -1) {
+    while ((opt = getopt(argc, argv, "hdvt:r:b:f:")) != -1) {
         switch (opt) {
             case 'f':
                 configfile = optarg;
@@ -119,6 +125,20 @@ main(int argc, char **argv)
                     goto Cleanup;
                 }
                 break;
+            case 'r':
+                rate = atoi(optarg);
+                if (rate <= 0) {
+                    usage(progname);
+                    goto Cleanup;
+                }
+                break;
+            case 'b':
+                burst = atoi(optarg);
+                if (burst <= 0) {
+                    usage(progname);
+                    goto Cleanup;
+                }
+                break;
             case 'v':
                 verbose = 1;
                 break;
@@ -140,6 +160,8 @@ main(int argc, char **argv)
     ccndc = ccndc_initialize_data();
     if (lifetime > 0)
         ccndc->lifetime = lifetime;
+    ccndc->rate = rate;
+    ccndc->burst = burst;
     if (optind < argc) {
         /* config file cannot be combined with command line */
         if (configfile != NULL) {
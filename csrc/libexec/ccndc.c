@@ -156,6 +156,11 @@ ccndc_dispatch_cmd(struct ccndc_data *ccndc,
         if (check_only) return 0;
         return ccndc_srv(ccndc, NULL, 0);
     }
+    if (strcasecmp(cmd, "snapshot") == 0) {
+        if (num_options >= 0 && num_options != 0)
+            return INT_MIN;
+        return ccndc_snapshot(ccndc, check_only);
+    }
     if (strcasecmp(cmd, "renew") == 0) {
         if (num_options >= 0 && (num_options < 3 || num_options > 7))
             return INT_MIN;
@@ -570,6 +575,49 @@ ccndc_destroyface(struct ccndc_data *self,
 }
 
 
+int
+ccndc_snapshot(struct ccndc_data *self,
+               int check_only)
+{
+    struct ccn_charbuf *temp = NULL;
+    struct ccn_charbuf *name = NULL;
+    struct ccn_charbuf *resultbuf = NULL;
+    struct ccn_parsed_ContentObject pcobuf = {0};
+    int res = 0;
+    
+    if (check_only)
+        return (0);
+    
+    temp = ccn_charbuf_create();
+    ON_NULL_CLEANUP(temp);
+    res = ccn_sign_content(self->ccn_handle, temp, self->no_name, NULL, "", 0);
+    ON_ERROR_CLEANUP(res);
+    resultbuf = ccn_charbuf_create();
+    ON_NULL_CLEANUP(resultbuf);
+    
+    name = ccn_charbuf_create();
+    ON_NULL_CLEANUP(name);
+    ON_ERROR_CLEANUP(ccn_name_init(name));
+    ON_ERROR_CLEANUP(ccn_name_append_str(name, "ccnx"));
+    ON_ERROR_CLEANUP(ccn_name_append(name, self->ccnd_id, self->ccnd_id_size));
+    ON_ERROR_CLEANUP(ccn_name_append_str(name, "snapshot"));
+    ON_ERROR_CLEANUP(ccn_name_append(name, temp->buf, temp->length));
+    
+    res = ccn_get(self->ccn_handle, name, self->local_scope_template, 60000, resultbuf, &pcobuf, NULL, 0);
+    ON_ERROR_CLEANUP(res);
+    if (pcobuf.type == CCN_CONTENT_NACK) {
+        ccndc_warn(__LINE__, "ccnd could not write a snapshot (is CCND_CS_SNAPSHOT set?)\n");
+        res = -1;
+    }
+    
+Cleanup:
+    ccn_charbuf_destroy(&temp);
+    ccn_charbuf_destroy(&resultbuf);
+    ccn_charbuf_destroy(&name);
+    return (res < 0 ? -1 : 0);
+}
+
+
 int
 ccndc_srv(struct ccndc_data *self,
           const unsigned char *domain,
@@ -877,6 +925,8 @@ parse_ccn_face_instance(struct ccndc_data *self,
     }
     
     entry->lifetime = freshness;
+    entry->rate = self->rate;
+    entry->burst = self->burst;
     
     return entry;
     
@@ -36,6 +36,8 @@ struct ccndc_data
     char                ccnd_id[32];       //id of local ccnd
     size_t              ccnd_id_size;
     int                 lifetime;
+    int                 rate;           // content rate limit for new faces
+    int                 burst;          // and its burst size
     struct ccn_charbuf  *local_scope_template; // scope 1 template
     struct ccn_charbuf  *no_name;   // an empty name
 };
@@ -183,6 +185,19 @@ ccndc_destroyface(struct ccndc_data *self,
                   int check_only,
                   const char *cmd);
 
+/**
+ * @brief Ask the local ccnd to write a snapshot of its content store
+ *
+ * ccnd must have been started with CCND_CS_SNAPSHOT set.
+ *
+ * @param self          data pointer to "this"
+ * @param check_only    flag indicating that only command checking is requested (nothing will be written)
+ * @returns 0 on success
+ */
+int
+ccndc_snapshot(struct ccndc_data *self,
+               int check_only);
+
 /**
  * @brief Get ID of the local CCND
  *
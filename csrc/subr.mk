@@ -53,10 +53,12 @@ coverage:
 
 shared:
 
+bench:
+
 depend: dir.mk $(CSRC)
 	for i in $(CSRC); do $(GCC) -MM $(CPREFLAGS) $$i; done > depend
 	tail -n `wc -l < depend` dir.mk | diff - depend
 
-install_libs install_programs install uninstall_libs uninstall_programs uninstall coverage shared documentation depend config_subdir: _always
+install_libs install_programs install uninstall_libs uninstall_programs uninstall coverage shared bench documentation depend config_subdir: _always
 .PHONY: _always
 _always:
@@ -21,6 +21,7 @@ ALLTESTS = \
   test_ccndid \
   test_ccnls_meta \
   test_coders \
+  test_cs_snapshot \
   test_destroyface \
   test_child_selector \
   test_extopt \
@@ -31,11 +32,13 @@ ALLTESTS = \
   test_answered_interest_suppression \
   test_key_fetch \
   test_late \
+  test_link_fragment \
   test_local_tcp \
   test_long_consumer \
   test_long_consumer2 \
   test_long_producer \
   test_new_provider \
+  test_name_order \
   test_newface \
   test_prefixreg \
   test_selfreg \
@@ -44,11 +47,13 @@ ALLTESTS = \
   test_single_ccnd_teardown \
   test_spur_traffic \
   test_scope0 \
+  test_same_header \
   test_scope2 \
   test_stale \
   test_twohop_ccnd \
   test_twohop_ccnd_teardown \
-  test_unreg
+  test_unreg \
+  test_workers
 
 default all: $(SCRIPTSRC) testdriver
 
@@ -63,6 +63,10 @@ public class PrefixRegistrationManager extends CCNDaemonHandle {
 	public static final int CCN_FORW_TAP = 64;			// Causes the entry to be used right away - intended
 														// for debugging and monitoring purposes.
 	public static final int CCN_FORW_CAPTURE_OK = 128;	// Use this with CCN_FORW_CHILD_INHERIT to make it eligible for capture.
+	public static final int CCN_FORW_STRATEGY = 3840;	// Mask for the forwarding strategy of the prefix
+	public static final int CCN_FORW_BEST_ROUTE = 256;	// Strategy: best face first, then the rest
+	public static final int CCN_FORW_MULTICAST = 512;	// Strategy: all faces at once
+	public static final int CCN_FORW_LOAD_BALANCE = 768;	// Strategy: faces in turn
 	public static final int CCN_FORW_PUBMASK = 	CCN_FORW_ACTIVE |
             									CCN_FORW_CHILD_INHERIT |
             									CCN_FORW_ADVERTISE     |
@@ -70,7 +74,8 @@ public class PrefixRegistrationManager extends CCNDaemonHandle {
             									CCN_FORW_CAPTURE       |
             									CCN_FORW_LOCAL         |
             									CCN_FORW_TAP           |
-										CCN_FORW_CAPTURE_OK;
+										CCN_FORW_CAPTURE_OK    |
+										CCN_FORW_STRATEGY;
 
 	
 	public static final Integer DEFAULT_SELF_REG_FLAGS = Integer.valueOf(CCN_FORW_ACTIVE + CCN_FORW_CHILD_INHERIT);